@@ -0,0 +1,1256 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: FreehandBenchmark.cxx,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+// .NAME FreehandBenchmark - measure the speed and accuracy of reconstruction
+// .SECTION Description
+// FreehandBenchmark generates synthetic ultrasound sweeps of an analytic
+// phantom (a textured background with a bright sphere), stores the probe
+// poses in a vtkTrackerBuffer, and reconstructs each sweep with every
+// combination of the reconstruction settings.  For each combination it
+// reports the insertion throughput, the hole-filling time, the memory
+// used by the output volume and the process peak, and the error and
+// coverage of the reconstructed voxels with respect to the phantom, both
+// before and after the holes are filled.
+//
+// The engines are: "class" reconstructs with vtkFreehandUltrasound
+// (Optimization 0/1/2, nearest/linear interpolation, compounding off/on),
+// and "kernel" calls the optimized slice insertion and the hole filling
+// of vtkFreehandUltrasoundCore.h directly on one thread, for every math
+// precision, interpolation mode and compounding policy, so that the
+// throughput of each compounding mode can be compared.  If AIGS was built
+// with vtkFreehandUltrasound2 (AIGS_USE_FREEHAND2), then "class2" writes
+// the sweep to a vtkUltrasoundSweepFile and reconstructs it with
+// ReconstructBatch() on BatchNumberOfThreads threads (the default, one per
+// processor), followed by each of the hole filling modes, and "preview"
+// times the coarse preview insertion of the real-time reconstruction.  The
+// preview does not count pixels, so its mpixels_per_s is zero.
+//
+// The results are written as comma-separated values, one line per
+// configuration, so that they can be kept for regression tracking.
+//
+// Usage: FreehandBenchmark [options]
+//   -sweep linear|fan|rotational|all   sweep motion (default all)
+//   -frames N                          number of frames (default 200)
+//   -size W H                          frame size in pixels (default 256 256)
+//   -pixel S                           pixel spacing in mm (default 0.2)
+//   -spacing S                         output spacing in mm (default 0.5)
+//   -type uchar|short|ushort           scalar type (default uchar)
+//   -engine class|kernel|class2|all    what to measure (default all)
+//   -o file.csv                        output file (default stdout)
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#if defined(_WIN32)
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+#include "vtkFreehandUltrasound.h"
+#include "vtkFreehandUltrasoundCore.h"
+#include "vtkImageData.h"
+#include "vtkMatrix4x4.h"
+#include "vtkTransform.h"
+#include "vtkTrackerBuffer.h"
+#include "vtkTimerLog.h"
+#include "vtkUltrasoundFanMask.h"
+#ifdef AIGS_USE_FREEHAND2
+#include "vtkFreehandUltrasound2.h"
+#include "vtkUltrasoundSweepFile.h"
+#endif
+
+#define BENCHMARK_SWEEP_LINEAR 0
+#define BENCHMARK_SWEEP_FAN 1
+#define BENCHMARK_SWEEP_ROTATIONAL 2
+
+#define BENCHMARK_ENGINE_CLASS 1
+#define BENCHMARK_ENGINE_KERNEL 2
+#define BENCHMARK_ENGINE_CLASS2 4
+
+// the compounding modes for the kernel engine, 'none' means that there is
+// no accumulation buffer
+#define BENCHMARK_COMPOUND_NONE -1
+
+// frame rate of the video, and the tracker is sampled four times as often
+#define BENCHMARK_FRAME_RATE 30.0
+#define BENCHMARK_TRACKER_OVERSAMPLING 4
+
+static const char *BenchmarkSweepNames[3] = {
+  "linear", "fan", "rotational" };
+
+//----------------------------------------------------------------------------
+// A synthetic sweep: the frames, and the poses that the reconstruction
+// uses, which are looked up from the tracker buffer at the frame times
+struct BenchmarkSweep
+{
+  int Type;
+  int ScalarType;
+  int FrameSize[2];
+  double PixelSpacing;
+  double ImageOrigin[3];
+  int NumberOfFrames;
+  double Scale;
+  double OutputSpacing;
+  double OutputOrigin[3];
+  int OutputExtent[6];
+  vtkTrackerBuffer *Buffer;
+  double *FramePoses;
+  unsigned char *Frames;
+  size_t FrameBytes;
+};
+
+//----------------------------------------------------------------------------
+// The measurements for one configuration
+struct BenchmarkResult
+{
+  double InsertTime;
+  const char *Fill;
+  double FillTime;
+  long Hits;
+  double VolumeKB;
+  double PeakKB;
+  double RMSError;
+  double Coverage;
+  double FilledRMSError;
+  double FilledCoverage;
+};
+
+//----------------------------------------------------------------------------
+// Peak resident memory of the process, in kilobytes
+static double BenchmarkPeakMemoryKB()
+{
+#if defined(_WIN32)
+  PROCESS_MEMORY_COUNTERS counters;
+  if (GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters)))
+    {
+    return counters.PeakWorkingSetSize/1024.0;
+    }
+  return 0.0;
+#else
+  struct rusage usage;
+  if (getrusage(RUSAGE_SELF, &usage) == 0)
+    {
+#if defined(__APPLE__)
+    return usage.ru_maxrss/1024.0;
+#else
+    return (double)usage.ru_maxrss;
+#endif
+    }
+  return 0.0;
+#endif
+}
+
+//----------------------------------------------------------------------------
+// The phantom, at a point in mm: a textured background with a bright
+// sphere of radius 12 mm, the values are between 0.1 and 0.9
+static double BenchmarkPhantom(const double p[3])
+{
+  double v = 0.3 + 0.2*sin(p[0]/3.0)*sin(p[1]/4.0)*sin(p[2]/5.0);
+  double dy = p[1] - 25.0;
+  if (p[0]*p[0] + dy*dy + p[2]*p[2] < 144.0)
+    {
+    v += 0.4;
+    }
+  return v;
+}
+
+//----------------------------------------------------------------------------
+// The pose of the image at sweep parameter 's' (0 to 1), as a row-major
+// matrix from image coordinates (x lateral, y depth, in mm) to phantom
+// coordinates.  The linear sweep translates the probe 40 mm in the
+// elevational direction, the fan sweep tilts it by +/-30 degrees about
+// the lateral axis at the probe face, and the rotational sweep turns it
+// by 180 degrees about the depth axis.
+static void BenchmarkPose(int type, double s, double m[16])
+{
+  const double degToRad = 0.017453292519943295;
+  double a;
+
+  for (int i = 0; i < 16; i++)
+    {
+    m[i] = ((i % 5) == 0);
+    }
+
+  switch (type)
+    {
+    case BENCHMARK_SWEEP_LINEAR:
+      m[11] = -20.0 + 40.0*s;
+      break;
+    case BENCHMARK_SWEEP_FAN:
+      a = (-30.0 + 60.0*s)*degToRad;
+      m[5] = cos(a); m[6] = -sin(a);
+      m[9] = sin(a); m[10] = cos(a);
+      break;
+    case BENCHMARK_SWEEP_ROTATIONAL:
+      a = 180.0*s*degToRad;
+      m[0] = cos(a); m[2] = sin(a);
+      m[8] = -sin(a); m[10] = cos(a);
+      break;
+    }
+}
+
+//----------------------------------------------------------------------------
+// c = a*b for row-major 4x4 matrices
+static void BenchmarkMultiply(const double a[16], const double b[16],
+                              double c[16])
+{
+  double tmp[16];
+  for (int i = 0; i < 4; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      tmp[4*i+j] = (a[4*i]*b[j] + a[4*i+1]*b[4+j] +
+                    a[4*i+2]*b[8+j] + a[4*i+3]*b[12+j]);
+      }
+    }
+  for (int k = 0; k < 16; k++)
+    {
+    c[k] = tmp[k];
+    }
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+static void BenchmarkGenerateFrames(BenchmarkSweep *sweep, T *frames)
+{
+  int n = sweep->NumberOfFrames;
+  int w = sweep->FrameSize[0];
+  int h = sweep->FrameSize[1];
+  double m[16];
+  double p[3];
+
+  for (int k = 0; k < n; k++)
+    {
+    // the frames are made with the exact pose, not the tracked pose
+    BenchmarkPose(sweep->Type, (n > 1 ? k/(n - 1.0) : 0.0), m);
+    T *frame = frames + (size_t)k*w*h;
+    for (int j = 0; j < h; j++)
+      {
+      double y = sweep->ImageOrigin[1] + j*sweep->PixelSpacing;
+      for (int i = 0; i < w; i++)
+        {
+        double x = sweep->ImageOrigin[0] + i*sweep->PixelSpacing;
+        p[0] = m[0]*x + m[1]*y + m[3];
+        p[1] = m[4]*x + m[5]*y + m[7];
+        p[2] = m[8]*x + m[9]*y + m[11];
+        *frame++ = (T)(BenchmarkPhantom(p)*sweep->Scale + 0.5);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Make the frames, fill the tracker buffer with the poses, and choose an
+// output volume that holds the whole sweep
+static int BenchmarkMakeSweep(BenchmarkSweep *sweep)
+{
+  int n = sweep->NumberOfFrames;
+  int w = sweep->FrameSize[0];
+  int h = sweep->FrameSize[1];
+  double ps = sweep->PixelSpacing;
+  double m[16];
+  int i, k;
+
+  sweep->ImageOrigin[0] = -0.5*(w - 1)*ps;
+  sweep->ImageOrigin[1] = 0.0;
+  sweep->ImageOrigin[2] = 0.0;
+
+  switch (sweep->ScalarType)
+    {
+    case VTK_UNSIGNED_CHAR:
+      sweep->Scale = 255.0;
+      sweep->FrameBytes = (size_t)w*h*sizeof(unsigned char);
+      break;
+    default:
+      sweep->Scale = 4000.0;
+      sweep->FrameBytes = (size_t)w*h*sizeof(short);
+      break;
+    }
+
+  sweep->Frames = new unsigned char[sweep->FrameBytes*n];
+  sweep->FramePoses = new double[16*n];
+  switch (sweep->ScalarType)
+    {
+    case VTK_UNSIGNED_CHAR:
+      BenchmarkGenerateFrames(sweep, (unsigned char *)sweep->Frames);
+      break;
+    case VTK_SHORT:
+      BenchmarkGenerateFrames(sweep, (short *)sweep->Frames);
+      break;
+    case VTK_UNSIGNED_SHORT:
+      BenchmarkGenerateFrames(sweep, (unsigned short *)sweep->Frames);
+      break;
+    }
+
+  // the tracker is sampled faster than the video, and the reconstruction
+  // gets its poses from the buffer just as it would for a live sweep
+  int samples = (n - 1)*BENCHMARK_TRACKER_OVERSAMPLING + 1;
+  vtkMatrix4x4 *matrix = vtkMatrix4x4::New();
+  sweep->Buffer = vtkTrackerBuffer::New();
+  sweep->Buffer->SetBufferSize(samples + 1);
+  for (k = 0; k < samples; k++)
+    {
+    BenchmarkPose(sweep->Type, (samples > 1 ? k/(samples - 1.0) : 0.0), m);
+    matrix->DeepCopy(m);
+    sweep->Buffer->AddItem(matrix, 0, 
+      k/(BENCHMARK_FRAME_RATE*BENCHMARK_TRACKER_OVERSAMPLING));
+    }
+
+  double bounds[6];
+  bounds[0] = bounds[2] = bounds[4] = VTK_DOUBLE_MAX;
+  bounds[1] = bounds[3] = bounds[5] = -VTK_DOUBLE_MAX;
+  for (k = 0; k < n; k++)
+    {
+    sweep->Buffer->GetFlagsAndMatrixFromTime(matrix, k/BENCHMARK_FRAME_RATE);
+    for (i = 0; i < 16; i++)
+      {
+      sweep->FramePoses[16*k+i] = matrix->GetElement(i/4, i%4);
+      }
+    for (int c = 0; c < 4; c++)
+      {
+      double x = sweep->ImageOrigin[0] + (c & 1)*(w - 1)*ps;
+      double y = sweep->ImageOrigin[1] + (c >> 1)*(h - 1)*ps;
+      for (i = 0; i < 3; i++)
+        {
+        double v = (matrix->GetElement(i,0)*x + matrix->GetElement(i,1)*y +
+                    matrix->GetElement(i,3));
+        bounds[2*i] = (v < bounds[2*i] ? v : bounds[2*i]);
+        bounds[2*i+1] = (v > bounds[2*i+1] ? v : bounds[2*i+1]);
+        }
+      }
+    }
+  matrix->Delete();
+
+  double os = sweep->OutputSpacing;
+  for (i = 0; i < 3; i++)
+    {
+    sweep->OutputOrigin[i] = bounds[2*i] - os;
+    sweep->OutputExtent[2*i] = 0;
+    sweep->OutputExtent[2*i+1] =
+      (int)ceil((bounds[2*i+1] - bounds[2*i])/os) + 2;
+    }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+static void BenchmarkFreeSweep(BenchmarkSweep *sweep)
+{
+  delete [] sweep->Frames;
+  delete [] sweep->FramePoses;
+  sweep->Buffer->Delete();
+}
+
+//----------------------------------------------------------------------------
+// Compare the reconstructed voxels (one component plus alpha) with the
+// phantom at the voxel centers, and count the voxels that were hit
+template <class T>
+static void BenchmarkError(BenchmarkSweep *sweep, vtkImageData *image,
+                           T *outPtr, double *rmsError, double *coverage)
+{
+  int *ext = image->GetExtent();
+  double *origin = image->GetOrigin();
+  double *spacing = image->GetSpacing();
+  double sum = 0;
+  long hit = 0;
+  long total = 0;
+  double p[3];
+
+  for (int k = ext[4]; k <= ext[5]; k++)
+    {
+    p[2] = origin[2] + k*spacing[2];
+    for (int j = ext[2]; j <= ext[3]; j++)
+      {
+      p[1] = origin[1] + j*spacing[1];
+      for (int i = ext[0]; i <= ext[1]; i++)
+        {
+        if (outPtr[1])
+          {
+          p[0] = origin[0] + i*spacing[0];
+          double d = outPtr[0] - BenchmarkPhantom(p)*sweep->Scale;
+          sum += d*d;
+          hit++;
+          }
+        total++;
+        outPtr += 2;
+        }
+      }
+    }
+
+  *rmsError = (hit ? sqrt(sum/hit) : 0.0);
+  *coverage = (total ? ((double)hit)/total : 0.0);
+}
+
+static void BenchmarkError(BenchmarkSweep *sweep, vtkImageData *image,
+                           double *rmsError, double *coverage)
+{
+  void *outPtr = image->GetScalarPointer();
+  switch (image->GetScalarType())
+    {
+    case VTK_UNSIGNED_CHAR:
+      BenchmarkError(sweep, image, (unsigned char *)outPtr, rmsError,
+                     coverage);
+      break;
+    case VTK_SHORT:
+      BenchmarkError(sweep, image, (short *)outPtr, rmsError, coverage);
+      break;
+    case VTK_UNSIGNED_SHORT:
+      BenchmarkError(sweep, image, (unsigned short *)outPtr, rmsError,
+                     coverage);
+      break;
+    }
+}
+
+//----------------------------------------------------------------------------
+// An image for one frame of the sweep
+static vtkImageData *BenchmarkNewSlice(BenchmarkSweep *sweep)
+{
+  double ps = sweep->PixelSpacing;
+  vtkImageData *slice = vtkImageData::New();
+  slice->SetScalarType(sweep->ScalarType);
+  slice->SetNumberOfScalarComponents(1);
+  slice->SetExtent(0, sweep->FrameSize[0] - 1, 0, sweep->FrameSize[1] - 1,
+                   0, 0);
+  slice->SetWholeExtent(slice->GetExtent());
+  slice->SetSpacing(ps, ps, 1.0);
+  slice->SetOrigin(sweep->ImageOrigin);
+  slice->AllocateScalars();
+  return slice;
+}
+
+//----------------------------------------------------------------------------
+// The kernel engine has no filter to report progress to
+struct BenchmarkProgress
+{
+  void UpdateProgress(double) {};
+};
+
+//----------------------------------------------------------------------------
+// Reconstruct the sweep with the kernels for one configuration, with the
+// same slice insertion and hole filling as the reconstruction classes
+// (without the fan, since the synthetic frames are rectangular)
+template <int I, class C, class F, class T>
+static void BenchmarkKernelRun(BenchmarkSweep *sweep, int compounding,
+                               BenchmarkResult *result)
+{
+  int *outExt = sweep->OutputExtent;
+  double os = sweep->OutputSpacing;
+
+  vtkImageData *outData = vtkImageData::New();
+  outData->SetScalarType(sweep->ScalarType);
+  outData->SetNumberOfScalarComponents(2);
+  outData->SetExtent(outExt);
+  outData->SetWholeExtent(outExt);
+  outData->SetSpacing(os, os, os);
+  outData->SetOrigin(sweep->OutputOrigin);
+  outData->AllocateScalars();
+  size_t nvox = outData->GetNumberOfPoints();
+
+  T *outPtr = (T *)outData->GetScalarPointer();
+  float *accPtr = 0;
+  T *resPtr = 0;
+  memset(outPtr, 0, 2*nvox*sizeof(T));
+  result->VolumeKB = 2*nvox*sizeof(T);
+  if (compounding != BENCHMARK_COMPOUND_NONE)
+    {
+    accPtr = new float[nvox];
+    memset(accPtr, 0, nvox*sizeof(float));
+    result->VolumeKB += nvox*sizeof(float);
+    }
+  if (compounding == VTK_FREEHAND_COMPOUND_MEDIAN)
+    {
+    resPtr = new T[VTK_FREEHAND_MEDIAN_RESERVOIR*nvox];
+    result->VolumeKB += VTK_FREEHAND_MEDIAN_RESERVOIR*nvox*sizeof(T);
+    }
+  result->VolumeKB /= 1024.0;
+
+  // the frames are rectangular, so the mask only holds the frame extent
+  vtkImageData *slice = BenchmarkNewSlice(sweep);
+  int *inExt = slice->GetExtent();
+  int maskExt[4];
+  maskExt[0] = inExt[0]; maskExt[1] = inExt[1];
+  maskExt[2] = inExt[2]; maskExt[3] = inExt[3];
+  double maskSpacing[2] = { sweep->PixelSpacing, sweep->PixelSpacing };
+  double maskOrigin[2] = { 0.0, 0.0 };
+  double maskSlopes[2] = { 0.0, 0.0 };
+  vtkUltrasoundFanMask *mask = vtkUltrasoundFanMask::GetCachedMask(
+    maskExt, maskSpacing, maskOrigin, maskSlopes, 0.0, maskExt, 1);
+  BenchmarkProgress progress;
+
+  // index matrix: output index <- world <- image <- input index
+  double ps = sweep->PixelSpacing;
+  double inMatrix[16] = { ps, 0, 0, sweep->ImageOrigin[0],
+                          0, ps, 0, sweep->ImageOrigin[1],
+                          0, 0, 1, 0,
+                          0, 0, 0, 1 };
+  double outMatrix[16] = { 1/os, 0, 0, -sweep->OutputOrigin[0]/os,
+                           0, 1/os, 0, -sweep->OutputOrigin[1]/os,
+                           0, 0, 1/os, -sweep->OutputOrigin[2]/os,
+                           0, 0, 0, 1 };
+  double m[16];
+  F matrix[4][4];
+
+  // only the insertion itself is timed, not the copying of the frames
+  result->Hits = 0;
+  result->InsertTime = 0;
+  for (int k = 0; k < sweep->NumberOfFrames; k++)
+    {
+    BenchmarkMultiply(sweep->FramePoses + 16*k, inMatrix, m);
+    BenchmarkMultiply(outMatrix, m, m);
+    for (int i = 0; i < 4; i++)
+      {
+      for (int j = 0; j < 4; j++)
+        {
+        matrix[i][j] = m[4*i+j];
+        }
+      }
+    memcpy(slice->GetScalarPointer(), sweep->Frames + k*sweep->FrameBytes,
+           sweep->FrameBytes);
+
+    double startTime = vtkTimerLog::GetUniversalTime();
+    result->Hits += vtkFreehandOptimizedInsertSlice<I,C>(
+      &progress, mask, outData, outPtr, accPtr, resPtr, slice,
+      (T *)slice->GetScalarPointer(), inExt, matrix, 0, 0, 0, 0);
+    result->InsertTime += vtkTimerLog::GetUniversalTime() - startTime;
+    }
+  vtkUltrasoundFanMask::ReleaseCachedMask(mask);
+  slice->Delete();
+
+  BenchmarkError(sweep, outData, &result->RMSError, &result->Coverage);
+
+  double startTime = vtkTimerLog::GetUniversalTime();
+  vtkFreehandFillHolesInOutput(outData, outPtr, accPtr, outExt);
+  result->FillTime = vtkTimerLog::GetUniversalTime() - startTime;
+  result->Fill = "average";
+  result->PeakKB = BenchmarkPeakMemoryKB();
+
+  BenchmarkError(sweep, outData, &result->FilledRMSError,
+                 &result->FilledCoverage);
+
+  outData->Delete();
+  delete [] accPtr;
+  delete [] resPtr;
+}
+
+//----------------------------------------------------------------------------
+// Choose the interpolation mode and compounding policy for the kernels
+template <class F, class T>
+static void BenchmarkKernelRun(BenchmarkSweep *sweep, int interpolation,
+                               int compounding, BenchmarkResult *result)
+{
+  if (interpolation == VTK_FREEHAND_LINEAR)
+    {
+    switch (compounding)
+      {
+      case VTK_FREEHAND_COMPOUND_MAX:
+        BenchmarkKernelRun<VTK_FREEHAND_LINEAR,vtkFreehandCompoundMax,F,T>(
+          sweep, compounding, result);
+        break;
+      case VTK_FREEHAND_COMPOUND_LATEST:
+        BenchmarkKernelRun<VTK_FREEHAND_LINEAR,vtkFreehandCompoundLatest,F,T>(
+          sweep, compounding, result);
+        break;
+      case VTK_FREEHAND_COMPOUND_DISTANCE_WEIGHTED:
+        BenchmarkKernelRun<VTK_FREEHAND_LINEAR,
+          vtkFreehandCompoundDistanceWeighted,F,T>(sweep, compounding, result);
+        break;
+      case VTK_FREEHAND_COMPOUND_MEDIAN:
+        BenchmarkKernelRun<VTK_FREEHAND_LINEAR,vtkFreehandCompoundMedian,F,T>(
+          sweep, compounding, result);
+        break;
+      default:
+        BenchmarkKernelRun<VTK_FREEHAND_LINEAR,vtkFreehandCompoundMean,F,T>(
+          sweep, compounding, result);
+        break;
+      }
+    }
+  else
+    {
+    switch (compounding)
+      {
+      case VTK_FREEHAND_COMPOUND_MAX:
+        BenchmarkKernelRun<VTK_FREEHAND_NEAREST,vtkFreehandCompoundMax,F,T>(
+          sweep, compounding, result);
+        break;
+      case VTK_FREEHAND_COMPOUND_LATEST:
+        BenchmarkKernelRun<VTK_FREEHAND_NEAREST,vtkFreehandCompoundLatest,F,T>(
+          sweep, compounding, result);
+        break;
+      case VTK_FREEHAND_COMPOUND_DISTANCE_WEIGHTED:
+        BenchmarkKernelRun<VTK_FREEHAND_NEAREST,
+          vtkFreehandCompoundDistanceWeighted,F,T>(sweep, compounding, result);
+        break;
+      case VTK_FREEHAND_COMPOUND_MEDIAN:
+        BenchmarkKernelRun<VTK_FREEHAND_NEAREST,vtkFreehandCompoundMedian,F,T>(
+          sweep, compounding, result);
+        break;
+      default:
+        BenchmarkKernelRun<VTK_FREEHAND_NEAREST,vtkFreehandCompoundMean,F,T>(
+          sweep, compounding, result);
+        break;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Choose the precision, "optimization" 1 is double and 2 is fixed point
+// to match the numbering used by the reconstruction classes
+template <class T>
+static void BenchmarkKernelRun(BenchmarkSweep *sweep, int optimization,
+                               int interpolation, int compounding,
+                               BenchmarkResult *result)
+{
+  if (optimization == 2)
+    {
+    BenchmarkKernelRun<fixed,T>(sweep, interpolation, compounding, result);
+    }
+  else
+    {
+    BenchmarkKernelRun<double,T>(sweep, interpolation, compounding, result);
+    }
+}
+
+//----------------------------------------------------------------------------
+// Reconstruct the sweep with vtkFreehandUltrasound for one configuration
+static void BenchmarkClassRun(BenchmarkSweep *sweep, int optimization,
+                              int interpolation, int compounding,
+                              BenchmarkResult *result)
+{
+  double os = sweep->OutputSpacing;
+
+  vtkImageData *slice = BenchmarkNewSlice(sweep);
+  vtkMatrix4x4 *matrix = vtkMatrix4x4::New();
+  vtkTransform *transform = vtkTransform::New();
+
+  vtkFreehandUltrasound *freehand = vtkFreehandUltrasound::New();
+  freehand->SetSlice(slice);
+  freehand->SetSliceTransform(transform);
+  freehand->SetOptimization(optimization);
+  freehand->SetInterpolationMode(interpolation);
+  freehand->SetCompounding(compounding);
+  freehand->SetOutputSpacing(os, os, os);
+  freehand->SetOutputOrigin(sweep->OutputOrigin);
+  freehand->SetOutputExtent(sweep->OutputExtent);
+  freehand->ClearOutput();
+
+  // only the insertion itself is timed, not the copying of the frames
+  result->InsertTime = 0;
+  for (int k = 0; k < sweep->NumberOfFrames; k++)
+    {
+    memcpy(slice->GetScalarPointer(), sweep->Frames + k*sweep->FrameBytes,
+           sweep->FrameBytes);
+    slice->Modified();
+    matrix->DeepCopy(sweep->FramePoses + 16*k);
+    transform->SetMatrix(matrix);
+
+    double startTime = vtkTimerLog::GetUniversalTime();
+    freehand->InsertSlice();
+    result->InsertTime += vtkTimerLog::GetUniversalTime() - startTime;
+    }
+  result->Hits = freehand->GetPixelCount();
+
+  vtkImageData *output = freehand->GetOutput();
+  size_t nvox = output->GetNumberOfPoints();
+  result->VolumeKB = nvox*output->GetNumberOfScalarComponents()*
+    output->GetScalarSize();
+  if (compounding)
+    {
+    result->VolumeKB += nvox*sizeof(unsigned short);
+    }
+  result->VolumeKB /= 1024.0;
+
+  BenchmarkError(sweep, output, &result->RMSError, &result->Coverage);
+
+  double startTime = vtkTimerLog::GetUniversalTime();
+  freehand->FillHolesInOutput();
+  result->FillTime = vtkTimerLog::GetUniversalTime() - startTime;
+  result->Fill = "average";
+  result->PeakKB = BenchmarkPeakMemoryKB();
+
+  BenchmarkError(sweep, output, &result->FilledRMSError,
+                 &result->FilledCoverage);
+
+  freehand->Delete();
+  transform->Delete();
+  matrix->Delete();
+  slice->Delete();
+}
+
+#ifdef AIGS_USE_FREEHAND2
+//----------------------------------------------------------------------------
+// Write the sweep to a sweep file, so that vtkFreehandUltrasound2 reads
+// its frames and poses just as it would for a recorded sweep
+static int BenchmarkWriteSweepFile(BenchmarkSweep *sweep,
+                                   const char *filename)
+{
+  vtkImageData *slice = BenchmarkNewSlice(sweep);
+  vtkUltrasoundSweepFile *sweepFile = vtkUltrasoundSweepFile::New();
+  sweepFile->SetFileName(filename);
+
+  // the frames are rectangular, so there is no fan and no clipping
+  sweepFile->SetClipRectangle(-1e8, -1e8, 1e8, 1e8);
+  sweepFile->SetFanAngles(0.0, 0.0);
+  sweepFile->SetFanOrigin(0.0, 0.0);
+  sweepFile->SetFanDepth(1e8);
+  sweepFile->SetVideoLag(0.0);
+
+  int success = sweepFile->OpenForWriting(slice);
+  for (int k = 0; success && k < sweep->NumberOfFrames; k++)
+    {
+    memcpy(slice->GetScalarPointer(), sweep->Frames + k*sweep->FrameBytes,
+           sweep->FrameBytes);
+    slice->Modified();
+    success = sweepFile->WriteFrame(slice, k/BENCHMARK_FRAME_RATE);
+    }
+  if (success)
+    {
+    sweepFile->SetTrackerBuffer(sweep->Buffer);
+    }
+  sweepFile->Close();
+
+  sweepFile->Delete();
+  slice->Delete();
+
+  return success;
+}
+
+//----------------------------------------------------------------------------
+static const char *BenchmarkFillName(int fill)
+{
+  switch (fill)
+    {
+    case VTK_FREEHAND_HOLE_FILL_DISTANCE_WEIGHTED:
+      return "distance";
+    case VTK_FREEHAND_HOLE_FILL_GROWING:
+      return "growing";
+    case VTK_FREEHAND_HOLE_FILL_GAUSSIAN:
+      return "gaussian";
+    }
+  return "average";
+}
+
+//----------------------------------------------------------------------------
+// Create a vtkFreehandUltrasound2 for one configuration, with the sweep
+// file as its source of frames
+static vtkFreehandUltrasound2 *BenchmarkNewFreehand2(
+  BenchmarkSweep *sweep, const char *filename, int optimization,
+  int interpolation, int compounding)
+{
+  double os = sweep->OutputSpacing;
+
+  vtkFreehandUltrasound2 *freehand = vtkFreehandUltrasound2::New();
+  freehand->SetOptimization(optimization);
+  freehand->SetInterpolationMode(interpolation);
+  if (compounding == BENCHMARK_COMPOUND_NONE)
+    {
+    freehand->SetCompounding(0);
+    }
+  else
+    {
+    freehand->SetCompounding(1);
+    freehand->SetCompoundingMode(compounding);
+    }
+  freehand->SetOutputSpacing(os, os, os);
+  freehand->SetOutputOrigin(sweep->OutputOrigin);
+  freehand->SetOutputExtent(sweep->OutputExtent);
+  freehand->ReadSweep(filename);
+
+  return freehand;
+}
+
+//----------------------------------------------------------------------------
+// Reconstruct the sweep file with the batch reconstruction of
+// vtkFreehandUltrasound2, and then fill the holes with each of the
+// hole filling modes, starting from the same reconstruction each time
+static void BenchmarkClass2Run(BenchmarkSweep *sweep, const char *filename,
+                               int optimization, int interpolation,
+                               int compounding, BenchmarkResult result[4])
+{
+  vtkFreehandUltrasound2 *freehand = BenchmarkNewFreehand2(
+    sweep, filename, optimization, interpolation, compounding);
+  freehand->ClearOutput();
+
+  double startTime = vtkTimerLog::GetUniversalTime();
+  freehand->ReconstructBatch(sweep->NumberOfFrames);
+  double insertTime = vtkTimerLog::GetUniversalTime() - startTime;
+  long hits = freehand->GetPixelCount();
+
+  vtkImageData *output = freehand->GetOutput();
+  vtkImageData *accData = freehand->GetAccumulationBuffer();
+  double volumeKB = output->GetActualMemorySize();
+  size_t outBytes = output->GetNumberOfPoints()*
+    output->GetNumberOfScalarComponents()*output->GetScalarSize();
+  size_t accBytes = 0;
+  if (compounding != BENCHMARK_COMPOUND_NONE)
+    {
+    volumeKB += accData->GetActualMemorySize();
+    accBytes = accData->GetNumberOfPoints()*sizeof(float);
+    }
+
+  double rmsError, coverage;
+  BenchmarkError(sweep, output, &rmsError, &coverage);
+
+  // keep the reconstruction, since each fill changes it
+  unsigned char *outCopy = new unsigned char[outBytes];
+  unsigned char *accCopy = new unsigned char[accBytes];
+  memcpy(outCopy, output->GetScalarPointer(), outBytes);
+  if (accBytes)
+    {
+    memcpy(accCopy, accData->GetScalarPointer(), accBytes);
+    }
+
+  for (int fill = VTK_FREEHAND_HOLE_FILL_AVERAGE;
+       fill <= VTK_FREEHAND_HOLE_FILL_GAUSSIAN; fill++)
+    {
+    memcpy(output->GetScalarPointer(), outCopy, outBytes);
+    if (accBytes)
+      {
+      memcpy(accData->GetScalarPointer(), accCopy, accBytes);
+      }
+
+    freehand->SetHoleFillingMode(fill);
+    startTime = vtkTimerLog::GetUniversalTime();
+    freehand->FillHolesInOutput();
+    result[fill].FillTime = vtkTimerLog::GetUniversalTime() - startTime;
+    result[fill].Fill = BenchmarkFillName(fill);
+    result[fill].InsertTime = insertTime;
+    result[fill].Hits = hits;
+    result[fill].VolumeKB = volumeKB;
+    result[fill].PeakKB = BenchmarkPeakMemoryKB();
+    result[fill].RMSError = rmsError;
+    result[fill].Coverage = coverage;
+
+    BenchmarkError(sweep, output, &result[fill].FilledRMSError,
+                   &result[fill].FilledCoverage);
+    }
+
+  delete [] outCopy;
+  delete [] accCopy;
+  freehand->Delete();
+}
+
+//----------------------------------------------------------------------------
+// Insert the frames of the sweep file into the coarse preview of the
+// real-time reconstruction, with the full-resolution insertion deferred.
+// The preview is not counted in the PixelCount, and it is not filled.
+static void BenchmarkPreviewRun(BenchmarkSweep *sweep, const char *filename,
+                                int optimization, int interpolation,
+                                int compounding, BenchmarkResult *result)
+{
+  vtkFreehandUltrasound2 *freehand = BenchmarkNewFreehand2(
+    sweep, filename, optimization, interpolation, compounding);
+  freehand->PreviewOn();
+  freehand->SetFullResolutionModeToDeferred();
+  freehand->ClearOutput();
+
+  vtkUltrasoundSweepFile *sweepFile = freehand->GetSweepFile();
+  vtkImageData *frame = vtkImageData::New();
+  vtkMatrix4x4 *sliceAxes = vtkMatrix4x4::New();
+  freehand->SetSliceAxes(sliceAxes);
+
+  // only the insertion itself is timed, not the reading of the frames
+  result->InsertTime = 0;
+  for (int k = 0; k < sweepFile->GetNumberOfFrames(); k++)
+    {
+    sweepFile->ReadFrame(k, frame);
+    sweep->Buffer->GetFlagsAndMatrixFromTime(
+      sliceAxes, sweepFile->GetFrameTimeStamp(k));
+    sliceAxes->Modified();
+
+    double startTime = vtkTimerLog::GetUniversalTime();
+    freehand->InsertPreviewSlice(frame);
+    result->InsertTime += vtkTimerLog::GetUniversalTime() - startTime;
+    }
+  result->Hits = 0;
+
+  vtkImageData *preview = freehand->GetPreviewOutput();
+  result->VolumeKB = preview->GetActualMemorySize();
+  result->PeakKB = BenchmarkPeakMemoryKB();
+  BenchmarkError(sweep, preview, &result->RMSError, &result->Coverage);
+  result->Fill = "none";
+  result->FillTime = 0;
+  result->FilledRMSError = result->RMSError;
+  result->FilledCoverage = result->Coverage;
+
+  sliceAxes->Delete();
+  frame->Delete();
+  freehand->Delete();
+}
+#endif /* AIGS_USE_FREEHAND2 */
+
+//----------------------------------------------------------------------------
+static const char *BenchmarkCompoundingName(int compounding)
+{
+  switch (compounding)
+    {
+    case VTK_FREEHAND_COMPOUND_MEAN:
+      return "mean";
+    case VTK_FREEHAND_COMPOUND_MAX:
+      return "max";
+    case VTK_FREEHAND_COMPOUND_LATEST:
+      return "latest";
+    case VTK_FREEHAND_COMPOUND_DISTANCE_WEIGHTED:
+      return "distance";
+    case VTK_FREEHAND_COMPOUND_MEDIAN:
+      return "median";
+    }
+  return "none";
+}
+
+//----------------------------------------------------------------------------
+static const char *BenchmarkTypeName(int scalarType)
+{
+  switch (scalarType)
+    {
+    case VTK_SHORT:
+      return "short";
+    case VTK_UNSIGNED_SHORT:
+      return "ushort";
+    }
+  return "uchar";
+}
+
+//----------------------------------------------------------------------------
+static void BenchmarkWriteHeader(FILE *file)
+{
+  fprintf(file, "engine,sweep,type,frame_width,frame_height,pixel_spacing,"
+          "output_spacing,frames,optimization,interpolation,compounding,"
+          "fill,insert_s,frames_per_s,mpixels_per_s,fill_s,volume_kb,"
+          "peak_kb,rms_error,coverage,filled_rms_error,filled_coverage\n");
+}
+
+//----------------------------------------------------------------------------
+static void BenchmarkWriteResult(FILE *file, const char *engine,
+                                 BenchmarkSweep *sweep, int optimization,
+                                 int interpolation, int compounding,
+                                 BenchmarkResult *result)
+{
+  double t = (result->InsertTime > 0 ? result->InsertTime : 1e-9);
+  fprintf(file, "%s,%s,%s,%d,%d,%g,%g,%d,%d,%s,%s,%s,"
+          "%.6f,%.2f,%.3f,%.6f,%.0f,%.0f,%.4f,%.4f,%.4f,%.4f\n",
+          engine, BenchmarkSweepNames[sweep->Type],
+          BenchmarkTypeName(sweep->ScalarType),
+          sweep->FrameSize[0], sweep->FrameSize[1],
+          sweep->PixelSpacing, sweep->OutputSpacing, sweep->NumberOfFrames,
+          optimization,
+          (interpolation == VTK_FREEHAND_LINEAR ? "linear" : "nearest"),
+          BenchmarkCompoundingName(compounding), result->Fill,
+          result->InsertTime, sweep->NumberOfFrames/t,
+          result->Hits/t*1e-6, result->FillTime, result->VolumeKB,
+          result->PeakKB, result->RMSError, result->Coverage,
+          result->FilledRMSError, result->FilledCoverage);
+  fflush(file);
+}
+
+//----------------------------------------------------------------------------
+static void BenchmarkUsage(const char *program)
+{
+  fprintf(stderr,
+    "Usage: %s [options]\n"
+    "  -sweep linear|fan|rotational|all   sweep motion (default all)\n"
+    "  -frames N                          number of frames (default 200)\n"
+    "  -size W H                          frame size (default 256 256)\n"
+    "  -pixel S                           pixel spacing in mm (default 0.2)\n"
+    "  -spacing S                         output spacing in mm (default 0.5)\n"
+    "  -type uchar|short|ushort           scalar type (default uchar)\n"
+    "  -engine class|kernel|class2|all    what to measure (default all)\n"
+    "  -o file.csv                        output file (default stdout)\n",
+    program);
+}
+
+//----------------------------------------------------------------------------
+int main(int argc, char *argv[])
+{
+  int sweepType = -1;
+  int numberOfFrames = 200;
+  int frameSize[2] = { 256, 256 };
+  double pixelSpacing = 0.2;
+  double outputSpacing = 0.5;
+  int scalarType = VTK_UNSIGNED_CHAR;
+  int engines = BENCHMARK_ENGINE_CLASS | BENCHMARK_ENGINE_KERNEL;
+#ifdef AIGS_USE_FREEHAND2
+  engines |= BENCHMARK_ENGINE_CLASS2;
+#endif
+  const char *outputFile = 0;
+  int i;
+
+  for (i = 1; i < argc; i++)
+    {
+    const char *arg = argv[i];
+    int more = argc - i - 1;
+    if (strcmp(arg, "-sweep") == 0 && more >= 1)
+      {
+      arg = argv[++i];
+      sweepType = -1;
+      for (int s = 0; s < 3; s++)
+        {
+        if (strcmp(arg, BenchmarkSweepNames[s]) == 0)
+          {
+          sweepType = s;
+          }
+        }
+      if (sweepType < 0 && strcmp(arg, "all") != 0)
+        {
+        BenchmarkUsage(argv[0]);
+        return 1;
+        }
+      }
+    else if (strcmp(arg, "-frames") == 0 && more >= 1)
+      {
+      numberOfFrames = atoi(argv[++i]);
+      }
+    else if (strcmp(arg, "-size") == 0 && more >= 2)
+      {
+      frameSize[0] = atoi(argv[++i]);
+      frameSize[1] = atoi(argv[++i]);
+      }
+    else if (strcmp(arg, "-pixel") == 0 && more >= 1)
+      {
+      pixelSpacing = atof(argv[++i]);
+      }
+    else if (strcmp(arg, "-spacing") == 0 && more >= 1)
+      {
+      outputSpacing = atof(argv[++i]);
+      }
+    else if (strcmp(arg, "-type") == 0 && more >= 1)
+      {
+      arg = argv[++i];
+      if (strcmp(arg, "uchar") == 0)
+        {
+        scalarType = VTK_UNSIGNED_CHAR;
+        }
+      else if (strcmp(arg, "short") == 0)
+        {
+        scalarType = VTK_SHORT;
+        }
+      else if (strcmp(arg, "ushort") == 0)
+        {
+        scalarType = VTK_UNSIGNED_SHORT;
+        }
+      else
+        {
+        BenchmarkUsage(argv[0]);
+        return 1;
+        }
+      }
+    else if (strcmp(arg, "-engine") == 0 && more >= 1)
+      {
+      arg = argv[++i];
+      if (strcmp(arg, "class") == 0)
+        {
+        engines = BENCHMARK_ENGINE_CLASS;
+        }
+      else if (strcmp(arg, "kernel") == 0)
+        {
+        engines = BENCHMARK_ENGINE_KERNEL;
+        }
+#ifdef AIGS_USE_FREEHAND2
+      else if (strcmp(arg, "class2") == 0)
+        {
+        engines = BENCHMARK_ENGINE_CLASS2;
+        }
+#endif
+      else if (strcmp(arg, "all") != 0)
+        {
+        BenchmarkUsage(argv[0]);
+        return 1;
+        }
+      }
+    else if (strcmp(arg, "-o") == 0 && more >= 1)
+      {
+      outputFile = argv[++i];
+      }
+    else
+      {
+      BenchmarkUsage(argv[0]);
+      return 1;
+      }
+    }
+
+  if (numberOfFrames < 1 || frameSize[0] < 2 || frameSize[1] < 2 ||
+      pixelSpacing <= 0 || outputSpacing <= 0)
+    {
+    BenchmarkUsage(argv[0]);
+    return 1;
+    }
+
+  FILE *file = stdout;
+  if (outputFile)
+    {
+    file = fopen(outputFile, "w");
+    if (file == 0)
+      {
+      fprintf(stderr, "%s: cannot open %s\n", argv[0], outputFile);
+      return 1;
+      }
+    }
+  BenchmarkWriteHeader(file);
+
+  for (int s = 0; s < 3; s++)
+    {
+    if (sweepType >= 0 && s != sweepType)
+      {
+      continue;
+      }
+
+    BenchmarkSweep sweep;
+    sweep.Type = s;
+    sweep.ScalarType = scalarType;
+    sweep.FrameSize[0] = frameSize[0];
+    sweep.FrameSize[1] = frameSize[1];
+    sweep.PixelSpacing = pixelSpacing;
+    sweep.OutputSpacing = outputSpacing;
+    sweep.NumberOfFrames = numberOfFrames;
+    BenchmarkMakeSweep(&sweep);
+
+    BenchmarkResult result;
+    int optimization, interpolation, compounding;
+
+    if (engines & BENCHMARK_ENGINE_CLASS)
+      {
+      for (optimization = 0; optimization <= 2; optimization++)
+        {
+        for (interpolation = VTK_FREEHAND_NEAREST;
+             interpolation <= VTK_FREEHAND_LINEAR; interpolation++)
+          {
+          for (compounding = 0; compounding <= 1; compounding++)
+            {
+            BenchmarkClassRun(&sweep, optimization, interpolation,
+                              compounding, &result);
+            BenchmarkWriteResult(file, "class", &sweep, optimization,
+                                 interpolation,
+                                 (compounding ? VTK_FREEHAND_COMPOUND_MEAN :
+                                  BENCHMARK_COMPOUND_NONE), &result);
+            }
+          }
+        }
+      }
+
+    if (engines & BENCHMARK_ENGINE_KERNEL)
+      {
+      for (optimization = 1; optimization <= 2; optimization++)
+        {
+        for (interpolation = VTK_FREEHAND_NEAREST;
+             interpolation <= VTK_FREEHAND_LINEAR; interpolation++)
+          {
+          for (compounding = BENCHMARK_COMPOUND_NONE;
+               compounding <= VTK_FREEHAND_COMPOUND_MEDIAN; compounding++)
+            {
+            switch (scalarType)
+              {
+              case VTK_UNSIGNED_CHAR:
+                BenchmarkKernelRun<unsigned char>(&sweep, optimization,
+                  interpolation, compounding, &result);
+                break;
+              case VTK_SHORT:
+                BenchmarkKernelRun<short>(&sweep, optimization,
+                  interpolation, compounding, &result);
+                break;
+              case VTK_UNSIGNED_SHORT:
+                BenchmarkKernelRun<unsigned short>(&sweep, optimization,
+                  interpolation, compounding, &result);
+                break;
+              }
+            BenchmarkWriteResult(file, "kernel", &sweep, optimization,
+                                 interpolation, compounding, &result);
+            }
+          }
+        }
+      }
+
+#ifdef AIGS_USE_FREEHAND2
+    char filename[64];
+    sprintf(filename, "FreehandBenchmark_%s.sweep", BenchmarkSweepNames[s]);
+    if ((engines & BENCHMARK_ENGINE_CLASS2) &&
+        !BenchmarkWriteSweepFile(&sweep, filename))
+      {
+      fprintf(stderr, "%s: cannot write %s\n", argv[0], filename);
+      }
+    else if (engines & BENCHMARK_ENGINE_CLASS2)
+      {
+      BenchmarkResult results[4];
+      for (optimization = 1; optimization <= 2; optimization++)
+        {
+        for (interpolation = VTK_FREEHAND_NEAREST;
+             interpolation <= VTK_FREEHAND_LINEAR; interpolation++)
+          {
+          for (compounding = BENCHMARK_COMPOUND_NONE;
+               compounding <= VTK_FREEHAND_COMPOUND_MEDIAN; compounding++)
+            {
+            BenchmarkClass2Run(&sweep, filename, optimization, interpolation,
+                               compounding, results);
+            for (int fill = VTK_FREEHAND_HOLE_FILL_AVERAGE;
+                 fill <= VTK_FREEHAND_HOLE_FILL_GAUSSIAN; fill++)
+              {
+              BenchmarkWriteResult(file, "class2", &sweep, optimization,
+                                   interpolation, compounding,
+                                   &results[fill]);
+              }
+            }
+          for (compounding = BENCHMARK_COMPOUND_NONE;
+               compounding <= VTK_FREEHAND_COMPOUND_MEAN; compounding++)
+            {
+            BenchmarkPreviewRun(&sweep, filename, optimization,
+                                interpolation, compounding, &result);
+            BenchmarkWriteResult(file, "preview", &sweep, optimization,
+                                 interpolation, compounding, &result);
+            }
+          }
+        }
+      remove(filename);
+      }
+#endif
+
+    BenchmarkFreeSweep(&sweep);
+    }
+
+  if (file != stdout)
+    {
+    fclose(file);
+    }
+
+  return 0;
+}
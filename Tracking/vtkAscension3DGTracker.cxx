@@ -31,6 +31,9 @@ POSSIBILITY OF SUCH DAMAGES.
 
 #define USE_EULER 0
 
+// the sensor ID that requests the records for all sensors at once
+#define VTK_3DG_ALL_SENSORS -1
+
 #include <limits.h>
 #include <float.h>
 #include <math.h>
@@ -76,10 +79,15 @@ vtkAscension3DGTracker::vtkAscension3DGTracker()
   this->m_bUseDefaultSystemSettings = true;
   this->m_bUseDefaultSensorSettings = true;
   this->m_bUseSynchronous = false;
-  this->m_bUseAllSensors = false;
+  this->m_bUseAllSensors = true;
 
   // for accurate timing
   pRecord = &record[0];
+  this->DeviceTimeOffset = 0;
+  this->DeviceTimeOffsetValid = 0;
+  this->LastDeviceTime = 0;
+  this->LastUpdateErrorTime = 0;
+  this->SuppressedUpdateErrors = 0;
 }
 
 //----------------------------------------------------------------------------
@@ -382,6 +390,16 @@ int vtkAscension3DGTracker::InternalStartTracking()
     if( !this->SetSensorDataFormat(sensorID,type)) {return 0;}
   }
 
+  if( this->m_bUseSynchronous && !this->m_bUseAllSensors )
+  {
+    vtkWarningMacro(<< "GetSynchronousRecord() only works with ALL_SENSORS, using GetAsynchronousRecord() for each sensor instead.");
+  }
+
+  // the device clock is matched to the host clock again from scratch
+  this->DeviceTimeOffsetValid = 0;
+  this->LastDeviceTime = 0;
+  this->SuppressedUpdateErrors = 0;
+
   this->IsTracking = 1;
 
   return 1;
@@ -428,43 +446,47 @@ void vtkAscension3DGTracker::InternalUpdate()
     return;
   }
 
+  int numberSensors = this->m_TrackerCurrentConfig->m_SystemConfig->numberSensors;
+  if (numberSensors > VTK_3DG_NTOOLS)
+  {
+    numberSensors = VTK_3DG_NTOOLS;
+  }
+
   if( this->m_bUseAllSensors )
-  {    
-    //use all sensors.
+  {
+    // fetch every sensor in a single transaction, the records for
+    // disabled ports are masked out below
     if(this->m_bUseSynchronous)
     {
-      errorCode = GetSynchronousRecord(-1, pRecord, this->m_TrackerCurrentConfig->m_SystemConfig->numberSensors*sizeof(record[0]));
+      errorCode = GetSynchronousRecord(VTK_3DG_ALL_SENSORS, pRecord, numberSensors*sizeof(record[0]));
       if(errorCode!=BIRD_ERROR_SUCCESS) 
       {
-        errorHandler(errorCode, "vtkAscension3DGTracker::InternalUpdate() - GetSynchronousRecord(ALL_SENSORS, pRecord, System.numberSensors*sizeof(record[sensorID]))");
+        this->UpdateErrorHandler(errorCode, "vtkAscension3DGTracker::InternalUpdate() - GetSynchronousRecord(ALL_SENSORS, pRecord, System.numberSensors*sizeof(record[sensorID]))");
+        return;
       }
     } /* if synchronous */
     else
     {
-      errorCode = GetAsynchronousRecord(-1, pRecord, this->m_TrackerCurrentConfig->m_SystemConfig->numberSensors*sizeof(record[0]));
+      errorCode = GetAsynchronousRecord(VTK_3DG_ALL_SENSORS, pRecord, numberSensors*sizeof(record[0]));
       if(errorCode!=BIRD_ERROR_SUCCESS) 
       {
-        errorHandler(errorCode, "vtkAscension3DGTracker::InternalUpdate() - GetAsynchronousRecord(ALL_SENSORS, pRecord, System.numberSensors*sizeof(record[sensorID]))");
+        this->UpdateErrorHandler(errorCode, "vtkAscension3DGTracker::InternalUpdate() - GetAsynchronousRecord(ALL_SENSORS, pRecord, System.numberSensors*sizeof(record[sensorID]))");
+        return;
       }
     } /* else asynchronous */
   } /* if all sensors */
   else //do each sensor individual.
   {
     // scan the sensors and request a record if the sensor is physically attached
-    for(int sensorID=0; sensorID < this->m_TrackerCurrentConfig->m_SystemConfig->numberSensors; sensorID++)
+    for(int sensorID=0; sensorID < numberSensors; sensorID++)
     {
       if( this->m_TrackerCurrentConfig->m_SensorConfig[sensorID].attached && PortEnabled[sensorID])
       {
-        if(this->m_bUseSynchronous)
-        {
-          vtkWarningMacro("3DG Guidance Known Issue: GetSynchronousRecord(...) does not work with ALL_SENSORS -- using AsynchronousRecord(...) instead.");  
-        }
-
         errorCode = GetAsynchronousRecord(sensorID, (pRecord+sensorID), sizeof(record[sensorID]));
 
         if(errorCode!=BIRD_ERROR_SUCCESS) 
         {
-          errorHandler(errorCode, "vtkAscension3DGTracker::InternalUpdate() - GetAsynchronousRecord(sensorID, (pRecord+sensorID), sizeof(record[sensorID]))");
+          this->UpdateErrorHandler(errorCode, "vtkAscension3DGTracker::InternalUpdate() - GetAsynchronousRecord(sensorID, (pRecord+sensorID), sizeof(record[sensorID]))");
         }
       } /* if attached */
     }/* for each sensors */
@@ -477,8 +499,62 @@ void vtkAscension3DGTracker::InternalUpdate()
 
   for (tool = 0; tool < VTK_3DG_NTOOLS; tool++) 
   {
+    absent[tool] = 1;
+    if (tool >= numberSensors || !PortEnabled[tool])
+    {
+      continue;
+    }
+    absent[tool] = 0;
+
+    if (record[tool].time > nextcount) 
+    { 
+      nextcount = record[tool].time; 
+    }
+  }
+
+  // with asynchronous records, nothing is new until the device time
+  // stamp advances
+  if (nextcount != 0 && nextcount == this->LastDeviceTime)
+  {
+    return;
+  }
+  this->LastDeviceTime = nextcount;
+
+  double tooltimestamp;
+  if (nextcount != 0)
+  {
+    tooltimestamp = this->DeviceTimeToHostTime(nextcount);
+  }
+  else
+  {
+#if (VTK_MAJOR_VERSION < 5)
+    tooltimestamp = vtkTimerLog::GetCurrentTime();
+#else
+    tooltimestamp = vtkTimerLog::GetUniversalTime();
+#endif
+  }
+
+  // the records carry no status, so the status is read once for the
+  // whole system, and only if some device reports a problem is each
+  // sensor asked for its own status
+  DEVICE_STATUS systemStatus = GetSystemStatus();
+
+  for (tool = 0; tool < VTK_3DG_NTOOLS; tool++) 
+  {
+    if (tool >= numberSensors)
+    {
+      // the system has no such sensor
+      this->SendMatrix->Identity();
+      this->ToolUpdate(tool,this->SendMatrix,TR_MISSING,tooltimestamp);
+      continue;
+    }
+
     // check the sensor status here.
-    DEVICE_STATUS status = GetSensorStatus(tool);
+    DEVICE_STATUS status = VALID_STATUS;
+    if (systemStatus != VALID_STATUS)
+    {
+      status = GetSensorStatus(tool);
+    }
     // bit 1
     attached = !(status & NOT_ATTACHED);
     // bit 2
@@ -513,23 +589,15 @@ void vtkAscension3DGTracker::InternalUpdate()
     transmitterAttached = true;
 #endif
 
-    if( attached && PortEnabled[tool])
-    {   
-      // Not absent.
-      absent[tool] = 0;
-
-      if (record[tool].time > nextcount) 
-      { 
-        nextcount = record[tool].time; 
-      }
-    }
-    else if(!attached && !PortEnabled[tool])
+    if( attached != (PortEnabled[tool] != 0) )
     {
-      absent[tool] = 1;
+      // a sensor was plugged in or unplugged, the new port state is
+      // used from the next update onwards
+      this->EnableToolPorts();
     }
-    else 
+    if( !attached )
     {
-      this->EnableToolPorts();
+      absent[tool] = 1;
     }
 
     // assign flags using vtkTracker format
@@ -578,8 +646,6 @@ void vtkAscension3DGTracker::InternalUpdate()
     // create the transform matrix.
     this->TransformToMatrixd(record[tool],*this->SendMatrix->Element);
     this->SendMatrix->Transpose();
-        
-    double tooltimestamp = nextcount;
 
     // due to legacy issues, the value needs to be shifted 8 bits.
     double qDouble = (double) (record[tool].quality >> 8);
@@ -634,6 +700,64 @@ void vtkAscension3DGTracker::InternalUpdate()
     }while(currentError!=BIRD_ERROR_SUCCESS);
   }
 
+  //----------------------------------------------------------------------------
+  // errors in InternalUpdate() tend to repeat on every frame, so only
+  // report them once per second along with the number that were skipped
+  void vtkAscension3DGTracker::UpdateErrorHandler(int error, char *func)
+  {
+#if (VTK_MAJOR_VERSION < 5)
+    double now = vtkTimerLog::GetCurrentTime();
+#else
+    double now = vtkTimerLog::GetUniversalTime();
+#endif
+
+    if( now - this->LastUpdateErrorTime < 1.0 )
+    {
+      this->SuppressedUpdateErrors++;
+      return;
+    }
+
+    if( this->SuppressedUpdateErrors > 0 )
+    {
+      vtkWarningMacro(<< this->SuppressedUpdateErrors << " errors were not reported during the last second");
+      this->SuppressedUpdateErrors = 0;
+    }
+    this->LastUpdateErrorTime = now;
+    this->errorHandler(error, func);
+  }
+
+  //----------------------------------------------------------------------------
+  // The 3DG time stamps are in seconds from the device clock.  The offset
+  // to host time is the smallest difference that has been seen, since
+  // that is the one with the least transfer delay, and it follows the
+  // drift between the two clocks slowly.
+  double vtkAscension3DGTracker::DeviceTimeToHostTime(double devicetime)
+  {
+#if (VTK_MAJOR_VERSION < 5)
+    double offset = vtkTimerLog::GetCurrentTime() - devicetime;
+#else
+    double offset = vtkTimerLog::GetUniversalTime() - devicetime;
+#endif
+
+    if( !this->DeviceTimeOffsetValid ||
+        fabs(offset - this->DeviceTimeOffset) > 1.0 )
+    {
+      // first record, or the device clock was reset
+      this->DeviceTimeOffset = offset;
+      this->DeviceTimeOffsetValid = 1;
+    }
+    else if( offset < this->DeviceTimeOffset )
+    {
+      this->DeviceTimeOffset = offset;
+    }
+    else
+    {
+      this->DeviceTimeOffset += 0.001*(offset - this->DeviceTimeOffset);
+    }
+
+    return devicetime + this->DeviceTimeOffset;
+  }
+
   void vtkAscension3DGTracker::RelativeTransform(const DOUBLE_ALL_TIME_STAMP_Q_RECORD aRecord, const DOUBLE_ALL_TIME_STAMP_Q_RECORD *bRecord, DOUBLE_ALL_TIME_STAMP_Q_RECORD cRecord)
   {
     double f,x,y,z,w1,x1,y1,z1,w2,x2,y2,z2;
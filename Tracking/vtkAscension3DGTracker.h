@@ -193,7 +193,12 @@ public:
   int SetTransmitterXYZReferenceFrame(int transmitterID, bool buffer);
   int SetSensorFilterLargeChange(int sensorID, bool buffer);
 
-  // Data collection options.
+  // Description:
+  // Data collection options.  By default the records for all of the
+  // sensors are fetched together in one ALL_SENSORS transaction, and the
+  // ports that are not enabled are masked out.  UseAllSensors(false)
+  // fetches each enabled sensor separately, which always uses
+  // GetAsynchronousRecord() and takes one USB transaction per sensor.
   inline void SetUseDefaultSettings(bool bUseDefault) {this->m_bUseDefaultSystemSettings = bUseDefault;}
   inline void SetUseSynchronousRecord(bool bSync) {this->m_bUseSynchronous = bSync;}
   inline void SetUseAllSensors(bool bUseAllSensors) {this->m_bUseAllSensors = bUseAllSensors;}
@@ -202,6 +207,16 @@ protected:
   vtkAscension3DGTracker();
   ~vtkAscension3DGTracker();
   void errorHandler(int error, char* func=0);
+
+  // Description:
+  // Same as errorHandler(), but reports at most once per second so that
+  // an error that repeats on every update doesn't flood the log.
+  void UpdateErrorHandler(int error, char* func);
+
+  // Description:
+  // Convert a time stamp from the device clock into host time, with
+  // correction for the drift between the clocks.
+  double DeviceTimeToHostTime(double devicetime);
   void TransformToMatrixd(const DOUBLE_ALL_TIME_STAMP_Q_RECORD trans, double matrix[16]);
   void RelativeTransform(const DOUBLE_ALL_TIME_STAMP_Q_RECORD aRecord, const DOUBLE_ALL_TIME_STAMP_Q_RECORD *bRecord, DOUBLE_ALL_TIME_STAMP_Q_RECORD cRecord);
 
@@ -263,6 +278,15 @@ protected:
   bool m_bUseSynchronous;  // if true use GetSynchronousRecord, otherwise use GetAsynchronousRecord
   bool m_bUseAllSensors;  // if true use ALL_SENSORS, otherwise loop through each sensor.
 
+  // for converting the device time stamps to host time
+  double DeviceTimeOffset;
+  int DeviceTimeOffsetValid;
+  double LastDeviceTime;
+
+  // for rate-limiting the errors from InternalUpdate()
+  double LastUpdateErrorTime;
+  int SuppressedUpdateErrors;
+
 private:
   vtkAscension3DGTracker(const vtkAscension3DGTracker&);
   void operator=(const vtkAscension3DGTracker&);  
@@ -29,17 +29,26 @@ POSSIBILITY OF SUCH DAMAGES.
 #include <limits.h>
 #include <float.h>
 #include <math.h>
+#include <string.h>
 #include "flock.h"
 #include "vtkMath.h"
 #include "vtkTransform.h"
 #include "vtkFlockTracker.h"
 #include "vtkTrackerTool.h"
 #include "vtkTimerLog.h"
+#include "vtkTrackerStreamReader.h"
 #include "vtkObjectFactory.h"
 
 // maximum calibrated range for flock is 48 inches, this is in millimetres
 #define VTK_FLOCK_RANGE 1219.2
 
+// the maximum number of birds on the FBB
+#define VTK_FLOCK_MAX_BIRDS 14
+
+// a bird is reported missing if no record has arrived for this many
+// seconds, which is several stream periods
+#define VTK_FLOCK_TIMEOUT 0.1
+
 //----------------------------------------------------------------------------
 vtkFlockTracker* vtkFlockTracker::New()
 {
@@ -59,10 +68,15 @@ vtkFlockTracker::vtkFlockTracker()
   this->SendMatrix = vtkMatrix4x4::New();
   this->SerialPort = 1;  // default serial port is COM1
   this->BaudRate = 115200;
-  this->Mode = FB_THREAD;
+  // the stream is read by our own thread, not by the flock library
+  this->Mode = FB_NOTHREAD;
   this->Flock = fbNew();
-  this->SetNumberOfTools(14);
+  this->SetNumberOfTools(VTK_FLOCK_MAX_BIRDS);
   this->NumberOfBirds = 0;
+
+  this->Reader = vtkTrackerStreamReader::New();
+  this->Reader->SetNumberOfStations(VTK_FLOCK_MAX_BIRDS);
+  this->Reader->SetTimeout(VTK_FLOCK_TIMEOUT);
 }
 
 //----------------------------------------------------------------------------
@@ -74,6 +88,7 @@ vtkFlockTracker::~vtkFlockTracker()
     }
   fbDelete(this->Flock);
   this->SendMatrix->Delete();
+  this->Reader->Delete();
 }
   
 //----------------------------------------------------------------------------
@@ -160,6 +175,43 @@ int vtkFlockTracker::Probe()
   return 0;
 } 
 
+//----------------------------------------------------------------------------
+// called over and over by the reader thread while the tracker is tracking
+static void vtkFlockReadRecord(void *self)
+{
+  ((vtkFlockTracker *)self)->InternalReadRecord();
+}
+
+//----------------------------------------------------------------------------
+void vtkFlockTracker::InternalReadRecord()
+{
+  float xyz[3];
+  float zyx[3];
+  int errnum;
+
+  fbUpdate(this->Flock);
+  int bird = fbGetBird(this->Flock)-1;
+  double timestamp = fbGetTime(this->Flock);
+  fbGetPosition(this->Flock,xyz);
+  fbGetAngles(this->Flock,zyx);
+  int button = fbGetButton(this->Flock);
+
+  // keep the error until InternalUpdate() reports it
+  if ((errnum = fbGetError(this->Flock)) != 0)
+    {
+    this->Reader->SetError(errnum,fbGetErrorMessage(this->Flock));
+    return;
+    }
+
+  // if fbGetBird() returns 0, then a phase error has occurred
+  if (bird < 0 || bird >= this->NumberOfBirds)
+    {
+    return;
+    }
+
+  this->Reader->AddRecord(bird,xyz,zyx,button,timestamp);
+}
+
 //----------------------------------------------------------------------------
 int vtkFlockTracker::InternalStartTracking()
 {
@@ -314,26 +366,27 @@ int vtkFlockTracker::InternalStartTracking()
       }
     }
 
-  if (this->Mode != FB_NOTHREAD)
-    {
-    fbStream(this->Flock);
-    }
+  fbStream(this->Flock);
   if (fbGetError(this->Flock))
     {
     vtkErrorMacro(<< fbGetErrorMessage(this->Flock));
     return 0;
     }
 
+  // start reading the stream
+  this->Reader->Start(&vtkFlockReadRecord, this);
+
   return 1;
 }
 
 //----------------------------------------------------------------------------
 int vtkFlockTracker::InternalStopTracking()
 {
-  if (this->Mode != FB_NOTHREAD)
-    {
-    fbEndStream(this->Flock);
-    }
+  // the reader thread stops after its current record, which it will get
+  // within the flock's serial timeout
+  this->Reader->Stop();
+
+  fbEndStream(this->Flock);
   if (fbGetError(this->Flock))
     {
     vtkErrorMacro(<< fbGetErrorMessage(this->Flock));
@@ -357,10 +410,18 @@ void vtkFlockTracker::InternalUpdate()
   float refmat[4][4];
   float toolmat[4][4];
 
-  float (*xyz)[3] = new float[this->NumberOfBirds][3];
-  float (*zyx)[3] = new float[this->NumberOfBirds][3];
-  long *flags = new long[this->NumberOfBirds];
-  double *timestamps = new double[this->NumberOfBirds];
+  float xyz[VTK_FLOCK_MAX_BIRDS][3];
+  float zyx[VTK_FLOCK_MAX_BIRDS][3];
+  long flags[VTK_FLOCK_MAX_BIRDS];
+  double timestamps[VTK_FLOCK_MAX_BIRDS];
+  int fresh[VTK_FLOCK_MAX_BIRDS];
+  int stale[VTK_FLOCK_MAX_BIRDS];
+  vtkTrackerStreamRecord records[VTK_FLOCK_MAX_BIRDS];
+  char errortext[256];
+
+  // block until the reader thread receives a new record or an error,
+  // the flock streams at ~100Hz so this is the update rate
+  this->Reader->WaitForRecord();
 
 #if (VTK_MAJOR_VERSION < 5)
   double timestamp = vtkTimerLog::GetCurrentTime();
@@ -368,46 +429,34 @@ void vtkFlockTracker::InternalUpdate()
   double timestamp = vtkTimerLog::GetUniversalTime();
 #endif
 
-  // initialize the flags to 'out-of-view'
-  for (tool = 0; tool < this->NumberOfBirds; tool++)
-    { 
-    timestamps[tool] = timestamp;
-    flags[tool] = TR_OUT_OF_VIEW;
-    }
-
-  // use point mode if not multithreading
-  if (this->Mode == FB_NOTHREAD)
-    {
-    fbPoint(this->Flock);
-    }
-
-  // update each bird
-  for (tool = 0; tool < this->NumberOfBirds; tool++) 
+  // copy the most recent record for each bird
+  errnum = this->Reader->GetRecords(records, errortext);
+  for (bird = 0; bird < this->NumberOfBirds; bird++)
     {
-    fbUpdate(this->Flock);
-    bird = fbGetBird(this->Flock)-1;
-    // if fbGetBird() returns 0, then a phase error has occurred
-    if (bird >= 0)
+    vtkTrackerStreamRecord *record = &records[bird];
+    for (i = 0; i < 3; i++)
       {
-      timestamps[bird] = fbGetTime(this->Flock);      
-      fbGetPosition(this->Flock,xyz[bird]);
-      fbGetAngles(this->Flock,zyx[bird]);
-      flags[bird] = TR_SWITCH1_IS_ON*fbGetButton(this->Flock);
-      // fprintf(stderr,"bird = %d, NumberOfBirds = %d, timestamp = %f\n",bird,this->NumberOfBirds,this->UpdateTimeStamp);
+      xyz[bird][i] = record->Position[i];
+      zyx[bird][i] = record->Angles[i];
       }
+    flags[bird] = TR_SWITCH1_IS_ON*record->Button;
+    timestamps[bird] = record->TimeStamp;
+    fresh[bird] = record->Fresh;
+    stale[bird] = record->Stale;
     }
 
-  if ((errnum = fbGetError(this->Flock)) != 0)
+  // after an error, the birds whose stream has stopped must still
+  // be reported as missing, so don't return early
+  if (errnum != 0)
     {
     if (errnum == FB_PHASE_ERROR)
       {
-      vtkWarningMacro(<< fbGetErrorMessage(this->Flock));
+      vtkWarningMacro(<< errortext);
       }
     else 
       {
-      vtkErrorMacro(<< fbGetErrorMessage(this->Flock));
+      vtkErrorMacro(<< errortext);
       }
-    return;
     }
 
   // handle the reference tool first
@@ -429,9 +478,13 @@ void vtkFlockTracker::InternalUpdate()
       }
     refmat[3][3] = 1.0;
 
-    if (xyz[tool][0]*xyz[tool][0] +
-	xyz[tool][1]*xyz[tool][1] +
-	xyz[tool][2]*xyz[tool][2] > VTK_FLOCK_RANGE*VTK_FLOCK_RANGE)
+    if (stale[tool])
+      {
+      flags[tool] = TR_MISSING | TR_OUT_OF_VIEW;
+      }
+    else if (xyz[tool][0]*xyz[tool][0] +
+	     xyz[tool][1]*xyz[tool][1] +
+	     xyz[tool][2]*xyz[tool][2] > VTK_FLOCK_RANGE*VTK_FLOCK_RANGE)
       {
       flags[tool] = TR_OUT_OF_VOLUME;
       }
@@ -453,6 +506,19 @@ void vtkFlockTracker::InternalUpdate()
 
   for (tool = 0; tool < this->NumberOfBirds; tool++) 
     {
+    // only birds that sent a record since the last update, and birds
+    // whose stream has stopped are reported as missing
+    if (!fresh[tool])
+      {
+      if (stale[tool])
+        {
+        this->SendMatrix->Identity();
+        this->ToolUpdate(tool,this->SendMatrix,TR_MISSING | TR_OUT_OF_VIEW,
+                         timestamp);
+        }
+      continue;
+      }
+
     flags[tool] = 0;
 
     fbMatrixFromAngles(array,zyx[tool]);
@@ -517,11 +583,6 @@ void vtkFlockTracker::InternalUpdate()
     this->ToolUpdate(tool,this->SendMatrix,TR_MISSING | TR_OUT_OF_VIEW,
 		     timestamp);
     }
-
-  delete [] timestamps;
-  delete [] flags;
-  delete [] xyz;
-  delete [] zyx;
 }
 
 
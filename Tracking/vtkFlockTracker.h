@@ -34,6 +34,9 @@ POSSIBILITY OF SUCH DAMAGES.
 // If you are running an operating system other that Linux or Win32, you
 // might need a special serial cable that has the RTS line cut in order
 // to use the flock of birds.
+// The flock is run in stream mode, and a separate thread reads the
+// data records as they arrive so that InternalUpdate() never has to
+// wait for the serial port.
 // .SECTION see also
 // vtkTrackerTool vtkPOLARISTracker
 
@@ -44,6 +47,8 @@ POSSIBILITY OF SUCH DAMAGES.
 #include "vtkTracker.h"
 #include "vtkTransform.h"
 
+class vtkTrackerStreamReader;
+
 struct fbird;
 
 class VTK_EXPORT vtkFlockTracker : public vtkTracker
@@ -76,6 +81,11 @@ public:
   // i.e. within vtkTracker.cxx.
   void InternalUpdate();
 
+  // Description:
+  // Read one data record from the stream and store it for the bird that
+  // it came from.  This should only be called from the reader thread.
+  void InternalReadRecord();
+
 protected:
   vtkFlockTracker();
   ~vtkFlockTracker();
@@ -99,6 +109,9 @@ protected:
   int BaudRate;
   int Mode;
 
+  // the records from the stream, one per bird
+  vtkTrackerStreamReader *Reader;
+
 private:
   vtkFlockTracker(const vtkFlockTracker&);
   void operator=(const vtkFlockTracker&);  
@@ -30,6 +30,52 @@ POSSIBILITY OF SUCH DAMAGES.
 #include <iostream>
 
 #include "vtkImageData.h"
+#include "vtkPointData.h"
+#include "vtkMultiThreader.h"
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <time.h>
+#endif
+
+//----------------------------------------------------------------------------
+// sleep for the specified number of seconds
+static void vtkMicronTrackerSleep(double t)
+{
+#ifdef _WIN32
+  ::Sleep((int)(1000*t));
+#else
+  struct timespec sleep_time, dummy;
+  sleep_time.tv_sec = (int)t;
+  sleep_time.tv_nsec = (int)(1000000000*(t - sleep_time.tv_sec));
+  nanosleep(&sleep_time,&dummy);
+#endif
+}
+
+//----------------------------------------------------------------------------
+// the snapshots that are waiting to be written by the snapshot thread
+#define VTK_MICRON_SNAPSHOT_QUEUE_SIZE 8
+
+struct vtkMicronTrackerSnapShotQueue
+{
+  string FileNames[VTK_MICRON_SNAPSHOT_QUEUE_SIZE];
+  vtkUnsignedCharArray *Pixels[VTK_MICRON_SNAPSHOT_QUEUE_SIZE];
+  int Buffers[VTK_MICRON_SNAPSHOT_QUEUE_SIZE]; // image buffer, or -1
+  int Head;
+  int Count;
+};
+
+//----------------------------------------------------------------------------
+// make an image that uses the given camera pixels as its scalars
+static void vtkMicronTrackerSetImagePixels(vtkImageData *image,
+					   vtkUnsignedCharArray *pixels)
+{
+  image->SetDimensions(CAM_FRAME_WIDTH, CAM_FRAME_HEIGHT, 1);
+  image->SetScalarTypeToUnsignedChar();
+  image->SetNumberOfScalarComponents(1);
+  image->GetPointData()->SetScalars(pixels);
+}
 
 //----------------------------------------------------------------------------
 vtkMicronTracker* vtkMicronTracker::New()
@@ -83,6 +129,31 @@ vtkMicronTracker::vtkMicronTracker()
   rightImage = NULL;
   xpoints = NULL;
   vectorEnds = NULL;
+
+  // the cameras are shared by the tracker thread and the main thread
+  this->GrabLock = vtkCriticalSection::New();
+  this->FramesGrabbed = 0;
+  this->FindUnidentifiedMarkers = 1;
+  this->RotationBuffer.reserve(9);
+  this->TranslationBuffer.reserve(4);
+
+  // the exported images and the snapshot writer
+  this->ImageExport = 0;
+  this->ImageLock = vtkCriticalSection::New();
+  for (int i = 0; i < VTK_MICRON_IMAGE_BUFFERS; i++)
+    {
+      this->ImageBuffers[i][0] = vtkUnsignedCharArray::New();
+      this->ImageBuffers[i][1] = vtkUnsignedCharArray::New();
+      this->ImageBufferUsers[i] = 0;
+      this->ImageBufferFrames[i] = 0;
+    }
+  this->FrontImageBuffer = -1;
+  this->SnapShotThreader = vtkMultiThreader::New();
+  this->SnapShotThreadId = -1;
+  this->SnapShotLock = vtkCriticalSection::New();
+  this->SnapShotQueue = new vtkMicronTrackerSnapShotQueue;
+  this->SnapShotQueue->Head = 0;
+  this->SnapShotQueue->Count = 0;
   //	leftImageArray = new unsigned char();
   //	rightImageArray = new unsigned char();
   
@@ -150,6 +221,27 @@ char* vtkMicronTracker::GetToolClassName(int toolIndex)
 //----------------------------------------------------------------------------
 vtkMicronTracker::~vtkMicronTracker() 
 {
+  this->GrabLock->Delete();
+
+  // write any snapshots that are still in the queue
+  if (this->SnapShotThreadId != -1)
+    {
+      this->SnapShotThreader->TerminateThread(this->SnapShotThreadId);
+      this->SnapShotThreadId = -1;
+    }
+  while (this->InternalWriteSnapShot())
+    {
+    }
+  this->SnapShotThreader->Delete();
+  this->SnapShotLock->Delete();
+  delete this->SnapShotQueue;
+
+  for (int i = 0; i < VTK_MICRON_IMAGE_BUFFERS; i++)
+    {
+      this->ImageBuffers[i][0]->Delete();
+      this->ImageBuffers[i][1]->Delete();
+    }
+  this->ImageLock->Delete();
   if ( MT != NULL )
     {
       MT->mtEnd();
@@ -227,6 +319,12 @@ int vtkMicronTracker::InternalStartTracking()
       this->RefreshMarkerTemplates();
       // for accurate timing
       this->Timer->Initialize();
+
+      // no frames have been grabbed yet
+      this->ImageLock->Lock();
+      this->FrontImageBuffer = -1;
+      this->ImageLock->Unlock();
+      this->FramesGrabbed = 0;
     }
   return this->IsMicronTracking;
 }
@@ -267,96 +365,103 @@ int vtkMicronTracker::InternalStopTracking()
 void vtkMicronTracker::InternalUpdate()
 {
   int callResult = 0;
+  unsigned long framenum = 0;
+  int i;
   
-  if (this->IsMicronTracking)
+  if (!this->IsMicronTracking)
     {
-      // If grabing a frame was not successful prevent it from calling the mtGrabFrame
-      // method of MT, until the problem is solved.
-      callResult = MT->mtGrabFrame();
-      
-      if (-1 == callResult)
-	{
-	  this->InternalStopTracking();
-	  std::cout << "Error in grabing a frame!\n" << MT->mtGetErrorString() << std::endl;
-	  return;
-	}
-      else
-	{
-	  callResult = MT->mtProcessFrame();
-	}
-      if (-1 == callResult)
+      return;
+    }
+
+  // the MTC library cannot grab a frame while the previous one is being
+  // processed, so the frames are grabbed and processed in series, and
+  // the GrabLock only keeps the main thread away from the cameras
+  this->GrabLock->Lock();
+  callResult = MT->mtGrabFrame();
+  if (-1 == callResult)
+    {
+      this->GrabLock->Unlock();
+      vtkErrorMacro(<< "Error in grabbing a frame: " << MT->mtGetErrorString());
+      this->InternalStopTracking();
+      return;
+    }
+  framenum = ++this->FramesGrabbed;
+  if (this->ImageExport)
+    {
+      // copy the images out while the camera still holds this frame
+      this->ExportImages(framenum);
+    }
+
+  callResult = MT->mtProcessFrame();
+  if (-1 != callResult)
+    {
+      MT->mtFindIdentifiedMarkers();
+      // the unidentified vectors are only needed for new templates,
+      // unless the application wants to display them
+      if (this->FindUnidentifiedMarkers || this->isCollectingNewSamples == 1)
 	{
-	  this->InternalStopTracking();
-	  std::cout << "Error in processing a frame!\n" << MT->mtGetErrorString() << std::endl;
-	  return;
+	  MT->mtFindUnidentifiedMarkers();
 	}
-      MT->mtFindIdentifiedMarkers();
-      MT->mtFindUnidentifiedMarkers();
       // Collecting new samples if creating a new template by the user
       if (this->isCollectingNewSamples == 1)
 	{
-	  callResult = MT->mtCollectNewSamples(this->isAdditionalFacetAdding);
-	  if (callResult == -1)
+	  int sampleResult = MT->mtCollectNewSamples(this->isAdditionalFacetAdding);
+	  if (sampleResult == -1)
 	    {
-	      std::cout << "Less than two vectors are detected." << std::endl;
+	      vtkDebugMacro(<< "Less than two vectors are detected.");
 	    }
-	  else if (callResult == 1)
+	  else if (sampleResult == 1)
 	    {
-	      std::cout << "More than two vectors are detected." << std::endl;
+	      vtkDebugMacro(<< "More than two vectors are detected.");
 	    }
-	  else if (callResult == 99)
+	  else if (sampleResult == 99)
 	    {
-	      std::cout << "No known facet detected." << std::endl;
+	      vtkDebugMacro(<< "No known facet detected.");
 	    }
 	  else
 	    {
 	      this->newSampleFramesCollected++;
-	      std::cout << "Samples collected so far: " << newSampleFramesCollected << std::endl;
+	      vtkDebugMacro(<< "Samples collected so far: " << newSampleFramesCollected);
 	    }
 	}
-      // Setting the timestamp
-      static unsigned long framenum = 0;
-      framenum = Timer->GetLastFrame() + 1;
-      this->Timer->SetLastFrame(framenum);
-      
-      static double timestamp;
-      timestamp = this->Timer->GetTimeStampForFrame(framenum);
-      
-      int* identifiedMarkerIndexAssignedToTool = new int(0);
-      this->numOfIdentifiedMarkers = MT->mtGetIdentifiedMarkersCount();
-     //  if(MT->mtGetIdentifiedMarkersCount() == 0)
-// 	{	
-// 	  cout << "No Markers found\n";
-// 	}
-      for (int i=0; i< this->NumberOfTools; i++)
+    }
+  this->GrabLock->Unlock();
+
+  if (-1 == callResult)
+    {
+      vtkErrorMacro(<< "Error in processing a frame: " << MT->mtGetErrorString());
+      this->InternalStopTracking();
+      return;
+    }
+
+  // Setting the timestamp
+  this->Timer->SetLastFrame(framenum);
+  double timestamp = this->Timer->GetTimeStampForFrame(framenum);
+  
+  int identifiedMarkerIndexAssignedToTool = 0;
+  this->numOfIdentifiedMarkers = MT->mtGetIdentifiedMarkersCount();
+  for (i=0; i< this->NumberOfTools; i++)
+    {
+      // If no marker is assigned to the tool, grab the first one available and so on till 
+      // the list of the identified markers is exhausted (in which case the statusFlag would
+      // be set to TR_OUT_OF_VIEW.
+      if (this->markerIndexAssingedToTools[i] == 99)
 	{
-	  // If no marker is assigned to the tool, grab the first one available and so on till 
-	  // the list of the identified markers is exhausted (in which case the statusFlag would
-	  // be set to TR_OUT_OF_VIEW.
-	  if (this->markerIndexAssingedToTools[i] == 99)
-	    {
-	      //if (i<this->numOfIdentifiedMarkers)
-	      //	statusFlags[i] = 0;
-	      //else
-	      statusFlags[i] = TR_OUT_OF_VIEW;
+	  statusFlags[i] = TR_OUT_OF_VIEW;
+	}
+      else
+	{  
+	  if (MT->mtGetMarkerStatus(this->markerIndexAssingedToTools[i], &identifiedMarkerIndexAssignedToTool) != MTI_MARKER_CAPTURED)
+	    {	
+	      statusFlags[i] = 0;
 	    }
 	  else
-	    {  
-	      if (MT->mtGetMarkerStatus(this->markerIndexAssingedToTools[i], identifiedMarkerIndexAssignedToTool) != MTI_MARKER_CAPTURED)
-		//if (MT->mtGetStatus() != mti_utils::MTI_MARKER_CAPTURED)
-		{	
-		  statusFlags[i] = 0;
-		}
-	      else
-		{
-		  statusFlags[i] = TR_OUT_OF_VIEW;//TR_MISSING;  
-		}
+	    {
+	      statusFlags[i] = TR_OUT_OF_VIEW;//TR_MISSING;  
 	    }
-	  SendMatrix->DeepCopy(this->GetTransformMatrix(*identifiedMarkerIndexAssignedToTool, i));
-	  this->ToolUpdate(i,this->SendMatrix,statusFlags[i],timestamp);
 	}
-      delete identifiedMarkerIndexAssignedToTool;
-      identifiedMarkerIndexAssignedToTool = 0;
+      SendMatrix->DeepCopy(this->GetTransformMatrix(identifiedMarkerIndexAssignedToTool, i));
+      this->ToolUpdate(i,this->SendMatrix,statusFlags[i],timestamp);
     }
 }
 
@@ -420,9 +525,10 @@ vtkMatrix4x4* vtkMicronTracker::GetTransformMatrix(int markerIndex, int toolInde
     {	
       //this->UpdateMutex->Lock();
       rm[markerIndex]->Identity();
-      vector<double> vRotMat;
+      // the buffers keep their storage from one call to the next
+      vector<double> &vRotMat = this->RotationBuffer;
       MT->mtGetRotations( vRotMat, markerIndex );
-      vector<double> vPos;
+      vector<double> &vPos = this->TranslationBuffer;
       MT->mtGetTranslations(vPos, markerIndex);
       //this->UpdateMutex->Unlock();
       int rotIndex =0;
@@ -452,7 +558,9 @@ vtkMatrix4x4* vtkMicronTracker::GetTransformMatrix(int markerIndex, int toolInde
 void vtkMicronTracker::UpdateLeftRightImage()
 {
   this->UpdateMutex->Lock();
+  this->GrabLock->Lock();
   MT->mtGetLeftRightImageArray(leftImageArray, rightImageArray, 0);
+  this->GrabLock->Unlock();
   this->numOfIdentifiedMarkers = MT->mtGetIdentifiedMarkersCount();
   this->numOfUnidentifiedMarkers = MT->mtGetUnidentifiedMarkersCount();
   this->UpdateMutex->Unlock();
@@ -495,53 +603,323 @@ vtkImageImport* vtkMicronTracker::GetRightImage()
 }
 
 //----------------------------------------------------------------------------
-void vtkMicronTracker::GetSnapShot(char* testNum, char* identifier)
+// copy the current camera images, this must be called with the GrabLock
+int vtkMicronTracker::CopyImages(vtkUnsignedCharArray *left,
+				 vtkUnsignedCharArray *right)
 {
-  //imageWriter = vtkJPEGWriter()
-  this->UpdateLeftRightImage();
-  vtkJPEGWriter* imageWriter = vtkJPEGWriter::New();
+  unsigned char **leftArray;
+  unsigned char **rightArray;
+  if (MT->mtGetLeftRightImageArray(leftArray, rightArray, 0) != 0)
+    {
+      return 0;
+    }
+
+  // the arrays are only reallocated if the frame size changes
+  int n = CAM_FRAME_WIDTH*CAM_FRAME_HEIGHT;
+  left->SetNumberOfValues(n);
+  right->SetNumberOfValues(n);
+  memcpy(left->GetPointer(0), (unsigned char *)leftArray, n);
+  memcpy(right->GetPointer(0), (unsigned char *)rightArray, n);
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// fill a free buffer with the new frame and make it the front buffer,
+// this is called by the tracker thread with the GrabLock
+void vtkMicronTracker::ExportImages(unsigned long frame)
+{
+  // a buffer that has been acquired is never overwritten, the grab
+  // thread reserves the one that it fills so that it cannot be acquired
+  this->ImageLock->Lock();
+  int back = -1;
+  for (int i = 0; i < VTK_MICRON_IMAGE_BUFFERS; i++)
+    {
+      if (i != this->FrontImageBuffer && this->ImageBufferUsers[i] == 0)
+	{
+	  back = i;
+	  break;
+	}
+    }
+  if (back >= 0)
+    {
+      this->ImageBufferUsers[back]++;
+    }
+  this->ImageLock->Unlock();
+
+  // if every buffer is in use, this frame is not exported
+  if (back < 0)
+    {
+      return;
+    }
+
+  int success = this->CopyImages(this->ImageBuffers[back][0],
+				 this->ImageBuffers[back][1]);
+
+  this->ImageLock->Lock();
+  this->ImageBufferUsers[back]--;
+  if (success)
+    {
+      this->ImageBufferFrames[back] = frame;
+      this->FrontImageBuffer = back;
+    }
+  this->ImageLock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+// acquire the front buffer, this must be called with the ImageLock
+int vtkMicronTracker::AcquireImageBuffer(int users)
+{
+  int i = this->FrontImageBuffer;
+  if (i >= 0)
+    {
+      this->ImageBufferUsers[i] += users;
+    }
+  return i;
+}
+
+//----------------------------------------------------------------------------
+void vtkMicronTracker::ReleaseImageBuffer(int i)
+{
+  this->ImageLock->Lock();
+  if (i >= 0 && i < VTK_MICRON_IMAGE_BUFFERS && this->ImageBufferUsers[i] > 0)
+    {
+      this->ImageBufferUsers[i]--;
+    }
+  this->ImageLock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+unsigned long vtkMicronTracker::AcquireLatestImages(vtkImageData *left,
+						    vtkImageData *right)
+{
+  this->ImageLock->Lock();
+  int i = this->AcquireImageBuffer(1);
+  unsigned long frame = (i >= 0 ? this->ImageBufferFrames[i] : 0);
+  this->ImageLock->Unlock();
+
+  // the buffer cannot change until it is released, so its scalars
+  // can be given to the images outside of the lock
+  if (i >= 0)
+    {
+      if (left)
+	{
+	  vtkMicronTrackerSetImagePixels(left, this->ImageBuffers[i][0]);
+	}
+      if (right)
+	{
+	  vtkMicronTrackerSetImagePixels(right, this->ImageBuffers[i][1]);
+	}
+    }
+
+  return frame;
+}
+
+//----------------------------------------------------------------------------
+void vtkMicronTracker::ReleaseImages(unsigned long frame)
+{
+  int buffer = -1;
+
+  this->ImageLock->Lock();
+  for (int i = 0; i < VTK_MICRON_IMAGE_BUFFERS; i++)
+    {
+      if (frame != 0 && this->ImageBufferFrames[i] == frame &&
+	  this->ImageBufferUsers[i] > 0)
+	{
+	  buffer = i;
+	  break;
+	}
+    }
+  this->ImageLock->Unlock();
+
+  if (buffer < 0)
+    {
+      vtkWarningMacro(<< "ReleaseImages: frame " << frame
+		      << " was not acquired");
+      return;
+    }
+  this->ReleaseImageBuffer(buffer);
+}
+
+//----------------------------------------------------------------------------
+// this thread writes the snapshots to disk
+static void *vtkMicronTrackerSnapShotThread(vtkMultiThreader::ThreadInfo *data)
+{
+  vtkMicronTracker *self = (vtkMicronTracker *)(data->UserData);
+
+  for (;;)
+    {
+      if (!self->InternalWriteSnapShot())
+	{
+	  vtkMicronTrackerSleep(0.01);
+	}
+
+      // check to see if we are being told to quit
+      data->ActiveFlagLock->Lock();
+      int activeFlag = *(data->ActiveFlag);
+      data->ActiveFlagLock->Unlock();
+
+      if (activeFlag == 0)
+	{
+	  return NULL;
+	}
+    }
+}
+
+//----------------------------------------------------------------------------
+// the queue takes over the pixels: if they are in an acquired image buffer
+// then the buffer is released after the write, otherwise they are deleted
+void vtkMicronTracker::QueueSnapShot(const char *fileName,
+				     vtkUnsignedCharArray *pixels, int buffer)
+{
+  vtkMicronTrackerSnapShotQueue *queue = this->SnapShotQueue;
+
+  this->SnapShotLock->Lock();
+  if (queue->Count == VTK_MICRON_SNAPSHOT_QUEUE_SIZE)
+    {
+      this->SnapShotLock->Unlock();
+      vtkWarningMacro(<< "Snapshot queue is full, " << fileName << " was not written");
+      if (buffer >= 0)
+	{
+	  this->ReleaseImageBuffer(buffer);
+	}
+      else
+	{
+	  pixels->Delete();
+	}
+      return;
+    }
+  int i = (queue->Head + queue->Count) % VTK_MICRON_SNAPSHOT_QUEUE_SIZE;
+  queue->FileNames[i] = fileName;
+  queue->Pixels[i] = pixels;
+  queue->Buffers[i] = buffer;
+  queue->Count++;
+  this->SnapShotLock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+int vtkMicronTracker::InternalWriteSnapShot()
+{
+  vtkMicronTrackerSnapShotQueue *queue = this->SnapShotQueue;
+
+  this->SnapShotLock->Lock();
+  if (queue->Count == 0)
+    {
+      this->SnapShotLock->Unlock();
+      return 0;
+    }
+  string fileName = queue->FileNames[queue->Head];
+  vtkUnsignedCharArray *pixels = queue->Pixels[queue->Head];
+  int buffer = queue->Buffers[queue->Head];
+  queue->Head = (queue->Head + 1) % VTK_MICRON_SNAPSHOT_QUEUE_SIZE;
+  queue->Count--;
+  this->SnapShotLock->Unlock();
+
+  // import the pixels without taking a reference to the array, the
+  // reference count of an image buffer belongs to the main thread
+  vtkImageImport *image = vtkImageImport::New();
+  image->SetDataScalarTypeToUnsignedChar();
+  image->SetNumberOfScalarComponents(1);
+  image->SetDataExtent(0,CAM_FRAME_WIDTH-1, 0,CAM_FRAME_HEIGHT-1, 0,0);
+  image->SetWholeExtent(0,CAM_FRAME_WIDTH-1, 0,CAM_FRAME_HEIGHT-1, 0,0);
+  image->SetImportVoidPointer(pixels->GetPointer(0));
   vtkImageFlip* flip = vtkImageFlip::New();
   flip->SetFilteredAxes(1);
-  
-  //static leftSnapShotCounter = 0;
-  //static rightSnapShotCounter = 0;
-  
-  // For left image
-  flip->SetInput(this->GetLeftImage()->GetOutput());
-  string fileName = MT->mtGetCurrDir();
-#if (WIN32)
-  fileName += "\\SnapShots\\";
-#else
-  fileName += "/SnapShots/";
-#endif
-  fileName += testNum;
-  fileName += "_LeftSnapShot_";
-  fileName += identifier;
-  fileName += ".JPEG";
-  
-  imageWriter->SetFilePattern(fileName.c_str());
+  flip->SetInput(image->GetOutput());
+  vtkJPEGWriter* imageWriter = vtkJPEGWriter::New();
+  imageWriter->SetFileName(fileName.c_str());
   imageWriter->SetInput(flip->GetOutput());
   imageWriter->Write();
-  
-  // For right image
-  flip->SetInput(this->GetRightImage()->GetOutput());
-  fileName = MT->mtGetCurrDir();
+
+  imageWriter->Delete();
+  flip->Delete();
+  image->Delete();
+  if (buffer >= 0)
+    {
+      this->ReleaseImageBuffer(buffer);
+    }
+  else
+    {
+      pixels->Delete();
+    }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkMicronTracker::GetSnapShot(char* testNum, char* identifier)
+{
+  vtkUnsignedCharArray *pixels[2];
+
+  if (MT == NULL)
+    {
+      return;
+    }
+
+  // use the exported images if there are any, so that the cameras
+  // don't have to be touched, the buffer is acquired once for each
+  // of the two images and the snapshot thread releases it
+  int buffer = -1;
+  if (this->ImageExport)
+    {
+      this->ImageLock->Lock();
+      buffer = this->AcquireImageBuffer(2);
+      this->ImageLock->Unlock();
+    }
+
+  int haveImages = (buffer >= 0);
+  if (haveImages)
+    {
+      pixels[0] = this->ImageBuffers[buffer][0];
+      pixels[1] = this->ImageBuffers[buffer][1];
+    }
+  else
+    {
+      pixels[0] = vtkUnsignedCharArray::New();
+      pixels[1] = vtkUnsignedCharArray::New();
+      this->GrabLock->Lock();
+      haveImages = this->CopyImages(pixels[0], pixels[1]);
+      this->GrabLock->Unlock();
+    }
+
+  string dirName = MT->mtGetCurrDir();
 #if (WIN32)
-  fileName += "\\SnapShots\\";
+  dirName += "\\SnapShots\\";
 #else
-  fileName += "/SnapShots/";
+  dirName += "/SnapShots/";
 #endif
-  fileName += testNum;
-  fileName += "_RightSnapShot_";
-  fileName += identifier;
-  fileName += ".JPEG"; 
-  
-  imageWriter->SetFilePattern(fileName.c_str());
-  imageWriter->SetInput(flip->GetOutput());
-  imageWriter->Write();
-  
-  imageWriter->Delete();
-  flip->Delete();
+
+  if (haveImages)
+    {
+      // For left image
+      string fileName = dirName;
+      fileName += testNum;
+      fileName += "_LeftSnapShot_";
+      fileName += identifier;
+      fileName += ".JPEG";
+      this->QueueSnapShot(fileName.c_str(), pixels[0], buffer);
+
+      // For right image
+      fileName = dirName;
+      fileName += testNum;
+      fileName += "_RightSnapShot_";
+      fileName += identifier;
+      fileName += ".JPEG"; 
+      this->QueueSnapShot(fileName.c_str(), pixels[1], buffer);
+
+      if (this->SnapShotThreadId == -1)
+	{
+	  this->SnapShotThreadId =
+	    this->SnapShotThreader->SpawnThread((vtkThreadFunctionType)
+						&vtkMicronTrackerSnapShotThread, this);
+	}
+    }
+  else
+    {
+      vtkErrorMacro(<< "Couldn't get the camera images for the snapshot");
+      pixels[0]->Delete();
+      pixels[1]->Delete();
+    }
 }
 
 //----------------------------------------------------------------------------
@@ -70,8 +70,14 @@ POSSIBILITY OF SUCH DAMAGES.
 
 #define MAX_TOOL_NUM 10
 
+// the number of buffers for the exported camera images
+#define VTK_MICRON_IMAGE_BUFFERS 4
+
 class vtkFrameToTimeConverter;
 class vtkTrackerBuffer;
+class vtkMultiThreader;
+class vtkImageData;
+struct vtkMicronTrackerSnapShotQueue;
 
 // the number of tools the polaris can handle
 //#define VTK_POLARIS_NTOOLS 12
@@ -415,6 +421,15 @@ public:
   // an existing marker.
   vtkSetMacro(isAdditionalFacetAdding, int);
 
+  // Description:
+  // Set whether the unidentified vectors are searched for in every frame,
+  // so that they are available from vtkGetUnidentifiedMarkersEnds().
+  // When this is off, the search is only done while samples are being
+  // collected for a new template.  Default: On.
+  vtkSetMacro(FindUnidentifiedMarkers, int);
+  vtkGetMacro(FindUnidentifiedMarkers, int);
+  vtkBooleanMacro(FindUnidentifiedMarkers, int);
+
   // Description:
   // Resets the counter of the frames collected for the new marker to 0.
   void ResetNewSampleFramesCollected();
@@ -441,8 +456,41 @@ public:
   vtkImageImport* GetLeftImage();
   vtkImageImport* GetRightImage();
   void UpdateLeftRightImage();
+
+  // Description:
+  // Write the current left and right images to the SnapShots folder.
+  // The files are written by a separate thread, so this returns as soon
+  // as the images have been queued.
   void GetSnapShot(char* testNum, char* identifier);
 
+  // Description:
+  // Turn on the export of the camera images while tracking.  When this is
+  // on, the tracker thread copies every new stereo frame into a free image
+  // buffer and makes it the current one, so that a video preview can use
+  // the frames without stalling the tracking.  Default: Off.
+  vtkSetMacro(ImageExport, int);
+  vtkGetMacro(ImageExport, int);
+  vtkBooleanMacro(ImageExport, int);
+
+  // Description:
+  // Acquire the most recent left and right camera frames and set the
+  // scalars of the given images to them, without copying them.  The
+  // tracker thread never overwrites an acquired frame, so the images stay
+  // valid until ReleaseImages() is called with the frame number that
+  // this method returns.  The return value is zero, and nothing is
+  // acquired, if no frame has been exported yet.
+  unsigned long AcquireLatestImages(vtkImageData *left, vtkImageData *right);
+
+  // Description:
+  // Release a frame that was acquired with AcquireLatestImages(), after
+  // which the tracker thread is free to overwrite the images' scalars.
+  void ReleaseImages(unsigned long frame);
+
+  // Description:
+  // Write the images that are waiting in the snapshot queue.  This is
+  // called repeatedly by the snapshot thread.
+  int InternalWriteSnapShot();
+
   /*********************************/
   /*
   /* Get identified markers xpoints
@@ -549,6 +597,38 @@ protected:
   vtkDoubleArray* xpoints;
   vtkDoubleArray* vectorEnds;
 
+  // The tracker thread and the main thread share the cameras, the
+  // GrabLock is held while a frame is being grabbed or processed.
+  vtkCriticalSection *GrabLock;
+  unsigned long FramesGrabbed;
+  int FindUnidentifiedMarkers;
+
+  // The exported images, a pool of left/right buffers.  The number of
+  // users of each buffer is counted under the ImageLock, and the tracker
+  // thread only fills a buffer that has no users and is not the front.
+  int ImageExport;
+  vtkCriticalSection *ImageLock;
+  vtkUnsignedCharArray *ImageBuffers[VTK_MICRON_IMAGE_BUFFERS][2];
+  int ImageBufferUsers[VTK_MICRON_IMAGE_BUFFERS];
+  unsigned long ImageBufferFrames[VTK_MICRON_IMAGE_BUFFERS];
+  int FrontImageBuffer;
+  void ExportImages(unsigned long frame);
+  int CopyImages(vtkUnsignedCharArray *left, vtkUnsignedCharArray *right);
+  int AcquireImageBuffer(int users);
+  void ReleaseImageBuffer(int i);
+
+  // The snapshot thread writes the queued images to disk
+  vtkMultiThreader *SnapShotThreader;
+  int SnapShotThreadId;
+  vtkCriticalSection *SnapShotLock;
+  vtkMicronTrackerSnapShotQueue *SnapShotQueue;
+  void QueueSnapShot(const char *fileName, vtkUnsignedCharArray *pixels,
+		     int buffer);
+
+  // Storage for the marker pose, reused for every frame
+  vector<double> RotationBuffer;
+  vector<double> TranslationBuffer;
+
   string toolNames[MAX_TOOL_NUM];
   string toolFileLines[12];
   string toolClassNames[MAX_TOOL_NUM];
@@ -18,6 +18,9 @@
 #include <float.h>
 #include <math.h>
 #include <ctype.h>
+#if !defined(_WIN32)
+#include <time.h>
+#endif
 
 // NDI header files require this on Windows
 #if defined(_WIN32) && !defined(__WINDOWS_H)
@@ -46,6 +49,30 @@
 // turn this on to turn of multithreading
 #define VTK_CERTUS_NO_THREADING 1
 
+//----------------------------------------------------------------------------
+// the pose records that InternalUpdate() decodes the rigid bodies into,
+// these are allocated once so that no allocation is done per frame
+struct vtkNDICertusPoseRecords
+{
+  OptotrakRigidStruct *RigidBodies;
+  int MaxRigidBodies;
+  double Transforms[VTK_CERTUS_NTOOLS][8];
+  long Flags[VTK_CERTUS_NTOOLS];
+};
+
+//----------------------------------------------------------------------------
+static void vtkCertusSleep(double t)
+{
+#ifdef _WIN32
+  ::Sleep((int)(1000*t));
+#else
+  struct timespec sleep_time, dummy;
+  sleep_time.tv_sec = (int)t;
+  sleep_time.tv_nsec = (int)(1000000000*(t - sleep_time.tv_sec));
+  nanosleep(&sleep_time,&dummy);
+#endif
+}
+
 //----------------------------------------------------------------------------
 // map values 0, 1, 2 to the proper Certus VLED state constant 
 static VLEDState vtkNDICertusMapVLEDState[] = {
@@ -74,6 +101,11 @@ vtkNDICertusTracker::vtkNDICertusTracker()
   this->NumberOfRigidBodies = 0;
   this->SetNumberOfTools(VTK_CERTUS_NTOOLS);
 
+  this->PoseRecords = new vtkNDICertusPoseRecords;
+  this->PoseRecords->RigidBodies = 0;
+  this->PoseRecords->MaxRigidBodies = 0;
+  this->TransformsRequested = 0;
+
   for (int i = 0; i < VTK_CERTUS_NTOOLS; i++)
     {
     this->PortHandle[i] = 0;
@@ -101,6 +133,11 @@ vtkNDICertusTracker::~vtkNDICertusTracker()
     {
     this->Timer->Delete();
     }
+  if (this->PoseRecords->RigidBodies)
+    {
+    delete [] this->PoseRecords->RigidBodies;
+    }
+  delete this->PoseRecords;
 }
   
 //----------------------------------------------------------------------------
@@ -380,6 +417,8 @@ void vtkNDICertusTracker::StopTracking()
 //----------------------------------------------------------------------------
 int vtkNDICertusTracker::InternalStopTracking()
 {
+  this->ReceivePendingTransforms();
+
   if(OptotrakDeActivateMarkers() != OPTO_NO_ERROR_CODE)
     {
     vtkPrintCertusErrorMacro();
@@ -410,14 +449,51 @@ void vtkNDICertusTracker::Update()
 	this->vtkTracker::Update();
 }
 
+//----------------------------------------------------------------------------
+int vtkNDICertusTracker::RequestTransforms()
+{
+  if (!this->TransformsRequested)
+    {
+    if (RequestLatestTransforms() != OPTO_NO_ERROR_CODE)
+      {
+      vtkPrintCertusErrorMacro();
+      return 0;
+      }
+    this->TransformsRequested = 1;
+    }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkNDICertusTracker::ReceivePendingTransforms()
+{
+  if (!this->TransformsRequested)
+    {
+    return;
+    }
+
+  // the reply must be read before the Certus will accept other commands
+  vtkNDICertusPoseRecords *records = this->PoseRecords;
+  unsigned int uFrameNumber = 0;
+  unsigned int uElements = 0;
+  unsigned int uFlags = 0;
+  if (DataReceiveLatestTransforms2(&uFrameNumber, &uElements, &uFlags,
+                                   records->RigidBodies, 0)
+      != OPTO_NO_ERROR_CODE)
+    {
+    vtkPrintCertusErrorMacro();
+    }
+
+  this->TransformsRequested = 0;
+}
+
 //----------------------------------------------------------------------------
 void vtkNDICertusTracker::InternalUpdate()
 {
   int tool;
-  int missing[VTK_CERTUS_NTOOLS];
-  long statusFlags[VTK_CERTUS_NTOOLS];
-  double transform[VTK_CERTUS_NTOOLS][8];
   double *referenceTransform = 0;
+  vtkNDICertusPoseRecords *records = this->PoseRecords;
 
   if (!this->IsDeviceTracking)
     {
@@ -425,67 +501,85 @@ void vtkNDICertusTracker::InternalUpdate()
     return;
     }
 
-  // initialize transformations to identity
-  for (tool = 0; tool < VTK_CERTUS_NTOOLS; tool++)
+  // the request was sent by the previous update, so the transforms are
+  // usually waiting for us and the receive below will not block
+  if (!this->TransformsRequested)
     {
-    missing[tool] = 1; 
-
-    transform[tool][0] = 1.0;
-    transform[tool][1] = transform[tool][2] = transform[tool][3] = 0.0;
-    transform[tool][4] = transform[tool][5] = transform[tool][6] = 0.0;
-    transform[tool][7] = 0.0;
+    this->RequestTransforms();
+    return;
+    }
+  if (!DataIsReady())
+    {
+#if !VTK_CERTUS_NO_THREADING
+    // don't spin the tracker thread while the Certus finishes the frame
+    vtkCertusSleep(0.001);
+#endif
+    return;
     }
 
   unsigned int uFrameNumber = 0;
   unsigned int uElements = 0;
   unsigned int uFlags = 0;
-  OptotrakRigidStruct *rigidBodyData;
-  rigidBodyData = new OptotrakRigidStruct[this->NumberOfRigidBodies];
-  
-  if (DataGetLatestTransforms2(&uFrameNumber, &uElements, &uFlags,
-                               rigidBodyData, 0) != OPTO_NO_ERROR_CODE)
+  int errnum = DataReceiveLatestTransforms2(&uFrameNumber, &uElements,
+                                            &uFlags, records->RigidBodies, 0);
+  this->TransformsRequested = 0;
+
+  // send the next request right away, so that the Certus works on the
+  // next frame while we hand this one to the tools
+  this->RequestTransforms();
+
+  if (errnum != OPTO_NO_ERROR_CODE)
     {
     vtkPrintCertusErrorMacro();
-    delete [] rigidBodyData;
     return;
     }
 
-  vtkCertusDebugMacro("Found " << uElements << " rigid bodies, expected " << this->NumberOfRigidBodies
-	                  << " with " << this->NumberOfMarkers << " markers");
+  if ((int)uElements != this->NumberOfRigidBodies)
+    {
+    vtkCertusDebugMacro("Found " << uElements << " rigid bodies, expected "
+                        << this->NumberOfRigidBodies);
+    }
+  if ((int)uElements > this->NumberOfRigidBodies)
+    {
+    uElements = this->NumberOfRigidBodies;
+    }
 
   // these two calls are to generate an accurate timestamp
   this->Timer->SetLastFrame(uFrameNumber);
   double timestamp = this->Timer->GetTimeStampForFrame(uFrameNumber);
 
-  for (int rigidCounter = 0; rigidCounter < this->NumberOfRigidBodies;
-       rigidCounter++)
+  // initialize the pose records to identity
+  for (tool = 0; tool < VTK_CERTUS_NTOOLS; tool++)
+    {
+    double *trans = records->Transforms[tool];
+    trans[0] = 1.0;
+    trans[1] = trans[2] = trans[3] = 0.0;
+    trans[4] = trans[5] = trans[6] = 0.0;
+    trans[7] = 0.0;
+    records->Flags[tool] = OPTOTRAK_UNDETERMINED_FLAG;
+    }
+
+  // decode all of the rigid bodies into the pose records in one pass
+  for (int rigidCounter = 0; rigidCounter < (int)uElements; rigidCounter++)
     {
-    OptotrakRigidStruct& rigidBody = rigidBodyData[rigidCounter];
+    OptotrakRigidStruct& rigidBody = records->RigidBodies[rigidCounter];
     long rigidId = rigidBody.RigidId;
-	vtkCertusDebugMacro("rigidBody " << rigidCounter << " rigidId = " << rigidId);
     if (rigidId > 10)
       {
       rigidId = this->PortHandle[3];
-	  }
-
-    for (tool = 0; tool < VTK_CERTUS_NTOOLS; tool++)
-      {
-      if (this->PortHandle[tool] == rigidId)
-        {
-        break;
-        }
       }
 
-    if (tool >= VTK_CERTUS_NTOOLS)
+    tool = this->GetToolFromHandle(rigidId);
+    if (tool < 0)
       {
       vtkErrorMacro("InternalUpdate: bad rigid body ID " << rigidId);
       continue;
       }
-    
+
     if ((rigidBody.flags & OPTOTRAK_UNDETERMINED_FLAG) == 0)
       {
       // this is done to keep the code similar to POLARIS
-      double *trans = transform[tool];
+      double *trans = records->Transforms[tool];
       trans[0] = rigidBody.transformation.quaternion.rotation.q0;
       trans[1] = rigidBody.transformation.quaternion.rotation.qx;
       trans[2] = rigidBody.transformation.quaternion.rotation.qy;
@@ -494,51 +588,44 @@ void vtkNDICertusTracker::InternalUpdate()
       trans[5] = rigidBody.transformation.quaternion.translation.y;
       trans[6] = rigidBody.transformation.quaternion.translation.z;
       trans[7] = rigidBody.QuaternionError;
-	  vtkCertusDebugMacro(" " << trans[4] << ", " << trans[5] << ", " << trans[6]);
       }
-    else
-      {
-      vtkCertusDebugMacro("OPTOTRAK_UNDETERMINED_FLAG");
-	  }
 
-    statusFlags[tool] = rigidBody.flags;
+    records->Flags[tool] = rigidBody.flags;
     }
 
-  delete [] rigidBodyData;
-
   // get reference tool transform
   if (this->ReferenceTool >= 0)
     { 
-    referenceTransform = transform[this->ReferenceTool];
+    referenceTransform = records->Transforms[this->ReferenceTool];
     }
 
   for (tool = 0; tool < VTK_CERTUS_NTOOLS; tool++) 
     {
+    double *trans = records->Transforms[tool];
+    long statusFlags = records->Flags[tool];
+
     // convert status flags from Optotrak format to vtkTracker format
     int flags = 0;
-    if ((statusFlags[tool] & OPTOTRAK_UNDETERMINED_FLAG) != 0)
+    if ((statusFlags & OPTOTRAK_UNDETERMINED_FLAG) != 0)
       {
       flags |= TR_MISSING;
       }
-    else if ((statusFlags[tool] & OPTOTRAK_UNDETERMINED_FLAG) != 0)
-      {
-      flags |= TR_OUT_OF_VIEW;
-      }
 
     // if tracking relative to another tool
     if (this->ReferenceTool >= 0 && tool != this->ReferenceTool)
       {
       if ((flags & TR_MISSING) == 0)
         {
-        if ((statusFlags[this->ReferenceTool] & TR_OUT_OF_VIEW) != 0)
+        if ((records->Flags[this->ReferenceTool] &
+             OPTOTRAK_UNDETERMINED_FLAG) != 0)
           {
           flags |= TR_OUT_OF_VIEW;
           }
         }
       // pre-multiply transform by inverse of relative tool transform
-      ndiRelativeTransform(transform[tool],referenceTransform,transform[tool]);
+      ndiRelativeTransform(trans,referenceTransform,trans);
       }
-    ndiTransformToMatrixd(transform[tool],*this->SendMatrix->Element);
+    ndiTransformToMatrixd(trans,*this->SendMatrix->Element);
     this->SendMatrix->Transpose();
 
     // send the matrix and flags to the tool's vtkTrackerBuffer
@@ -568,6 +655,7 @@ int vtkNDICertusTracker::EnableToolPorts()
     }
 
   // stop tracking
+  this->ReceivePendingTransforms();
   if (this->IsDeviceTracking)
     {
     vtkCertusDebugMacro("DeActivating Markers");
@@ -820,6 +908,19 @@ int vtkNDICertusTracker::EnableToolPorts()
         }
       }
     }
+
+  // size the rigid body buffer for InternalUpdate() now, rather than
+  // allocating it for every frame
+  vtkNDICertusPoseRecords *records = this->PoseRecords;
+  if (records->MaxRigidBodies < this->NumberOfRigidBodies)
+    {
+    if (records->RigidBodies)
+      {
+      delete [] records->RigidBodies;
+      }
+    records->RigidBodies = new OptotrakRigidStruct[this->NumberOfRigidBodies];
+    records->MaxRigidBodies = this->NumberOfRigidBodies;
+    }
    
   // re-start the tracking
   if (this->IsDeviceTracking)
@@ -840,6 +941,7 @@ int vtkNDICertusTracker::EnableToolPorts()
 int vtkNDICertusTracker::DisableToolPorts()
 {
   // stop tracking
+  this->ReceivePendingTransforms();
   if (this->IsDeviceTracking)
     {
     if (!this->DeActivateCertusMarkers())
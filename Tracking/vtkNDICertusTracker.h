@@ -29,6 +29,7 @@
 #include "ndicapi.h"
 
 class vtkFrameToTimeConverter;
+struct vtkNDICertusPoseRecords;
 
 // the number of tools this class can handle
 #define VTK_CERTUS_NTOOLS 12
@@ -117,6 +118,13 @@ protected:
   // Find the tool for a specific port handle (-1 if not found).
   int GetToolFromHandle(int handle);
 
+  // Description:
+  // Ask the Certus for the latest transforms without waiting for them.
+  // The reply is collected by a later InternalUpdate(), or discarded by
+  // ReceivePendingTransforms() before any other command is sent.
+  int RequestTransforms();
+  void ReceivePendingTransforms();
+
   // Description:
   // Class for updating the virtual clock that accurately times the
   // arrival of each transform, more accurately than is possible with
@@ -129,6 +137,10 @@ protected:
   int NumberOfMarkers;
   int NumberOfRigidBodies;
 
+  // the buffers used by InternalUpdate(), sized by EnableToolPorts()
+  vtkNDICertusPoseRecords *PoseRecords;
+  int TransformsRequested;
+
   vtkMatrix4x4 *SendMatrix;
   int IsDeviceTracking;
 
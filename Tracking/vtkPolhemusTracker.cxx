@@ -29,18 +29,28 @@ POSSIBILITY OF SUCH DAMAGES.
 #include <limits.h>
 #include <float.h>
 #include <math.h>
+#include <string.h>
+#include <stdio.h>
 #include "polhemus.h"
 #include "vtkMath.h"
 #include "vtkTransform.h"
 #include "vtkPolhemusTracker.h"
 #include "vtkTrackerTool.h"
 #include "vtkTimerLog.h"
+#include "vtkTrackerStreamReader.h"
 #include "vtkObjectFactory.h"
 
 // maximum calibrated range for polhemus is 48 inches, this is in millimetres
 // FIX ME
 #define VTK_POLHEMUS_RANGE 1219.2
 
+// the FasTrak has four stations
+#define VTK_POLHEMUS_MAX_STATIONS 4
+
+// a station is reported missing if no record has arrived for this many
+// seconds, which is several stream periods
+#define VTK_POLHEMUS_TIMEOUT 0.1
+
 //----------------------------------------------------------------------------
 vtkPolhemusTracker* vtkPolhemusTracker::New()
 {
@@ -60,9 +70,18 @@ vtkPolhemusTracker::vtkPolhemusTracker()
   this->SendMatrix = vtkMatrix4x4::New();
   this->SerialPort = 1;  // default serial port is COM1
   this->BaudRate = 9600;
+  // the stream is read by our own thread, not by the polhemus library
   this->Mode = PH_NOTHREAD;
   this->Polhemus = phNew();
-  this->SetNumberOfTools(1);
+  this->SetNumberOfTools(VTK_POLHEMUS_MAX_STATIONS);
+  for (int i = 0; i < VTK_POLHEMUS_MAX_STATIONS; i++)
+    {
+    this->StationActive[i] = 0;
+    }
+
+  this->Reader = vtkTrackerStreamReader::New();
+  this->Reader->SetNumberOfStations(VTK_POLHEMUS_MAX_STATIONS);
+  this->Reader->SetTimeout(VTK_POLHEMUS_TIMEOUT);
 }
 
 //----------------------------------------------------------------------------
@@ -74,6 +93,7 @@ vtkPolhemusTracker::~vtkPolhemusTracker()
     }
   phDelete(this->Polhemus);
   this->SendMatrix->Delete();
+  this->Reader->Delete();
 }
   
 //----------------------------------------------------------------------------
@@ -83,6 +103,9 @@ void vtkPolhemusTracker::PrintSelf(ostream& os, vtkIndent indent)
   
   os << indent << "SerialPort: " << this->SerialPort << "\n";
   os << indent << "BaudRate: " << this->BaudRate << "\n";
+  os << indent << "StationActive: " << this->StationActive[0] << " "
+     << this->StationActive[1] << " " << this->StationActive[2] << " "
+     << this->StationActive[3] << "\n";
   os << indent << "SendMatrix: " << this->SendMatrix << "\n";
   this->SendMatrix->PrintSelf(os,indent.GetNextIndent());
 }  
@@ -172,20 +195,61 @@ int vtkPolhemusTracker::Probe()
   return 0;
 } 
 
+//----------------------------------------------------------------------------
+// called over and over by the reader thread while the tracker is tracking
+static void vtkPolhemusReadRecord(void *self)
+{
+  ((vtkPolhemusTracker *)self)->InternalReadRecord();
+}
+
+//----------------------------------------------------------------------------
+void vtkPolhemusTracker::InternalReadRecord()
+{
+  float xyz[3];
+  float zyx[3];
+  int errnum;
+
+  phUpdate(this->Polhemus);
+
+  // keep the error until InternalUpdate() reports it
+  if ((errnum = phGetError(this->Polhemus)) != 0)
+    {
+    this->Reader->SetError(errnum,phGetErrorMessage(this->Polhemus));
+    return;
+    }
+
+  // if phGetStation() returns 0, then a phase error has occurred
+  int station = phGetStation(this->Polhemus)-1;
+  if (station < 0 || !this->StationActive[station])
+    {
+    return;
+    }
+
+  phGetPosition(this->Polhemus,xyz);
+  phGetAngles(this->Polhemus,zyx);
+  xyz[0] *= 25.4f; // convert inches to mm
+  xyz[1] *= 25.4f;
+  xyz[2] *= 25.4f;
+  this->Reader->AddRecord(station,xyz,zyx,phGetButton(this->Polhemus),
+                          phGetTime(this->Polhemus));
+}
+
 //----------------------------------------------------------------------------
 int vtkPolhemusTracker::InternalStartTracking()
 {
   int errnum,i,baud;
+  char command[16];
+  char reply[256];
 
   switch (this->BaudRate)
     {
-    case 1200: baud = PH_1200; break; 
-    case 2400: baud = PH_2400; break; 
-    case 4800: baud = PH_4800; break; 
-    case 9600: baud = PH_9600; break; 
-    case 19200: baud = PH_19200; break; 
-    case 38400: baud = PH_38400; break; 
-    case 57600: baud = PH_57600; break; 
+    case 1200: baud = PH_1200; break;
+    case 2400: baud = PH_2400; break;
+    case 4800: baud = PH_4800; break;
+    case 9600: baud = PH_9600; break;
+    case 19200: baud = PH_19200; break;
+    case 38400: baud = PH_38400; break;
+    case 57600: baud = PH_57600; break;
     case 115200: baud = PH_115200; break;
     default:
       vtkErrorMacro(<< "Illegal baud rate");
@@ -194,14 +258,8 @@ int vtkPolhemusTracker::InternalStartTracking()
 
   if (!this->Tracking)
     {
-    phSetInitialComm(this->Polhemus, this->BaudRate, 'N', 8, 0); 
+    phSetInitialComm(this->Polhemus, baud, 'N', 8, 0);
     phSetThreadMode(this->Polhemus, this->Mode);
-    errnum = phGetError(this->Polhemus);
-    if (errnum == PH_MODE_ERROR)
-      {
-      this->Mode = PH_NOTHREAD;
-      phSetThreadMode(this->Polhemus, this->Mode);
-      }
 
     phOpen(this->Polhemus, phDeviceName(this->SerialPort-1));
     errnum = phGetError(this->Polhemus);
@@ -210,10 +268,36 @@ int vtkPolhemusTracker::InternalStartTracking()
       vtkErrorMacro(<< phGetErrorMessage(this->Polhemus));
       return 0;
       }
-    
-    for (i = 0; i < this->NumberOfTools; i++)
+
+    // stop any stream that was left running, and clear the serial port
+    phReset(this->Polhemus);
+
+    // ask which stations have a sensor plugged in, the reply
+    // is "21l" followed by a '1' or '0' for each station
+    phSendCommand(this->Polhemus, "l1\r\n");
+    phReceiveReply(this->Polhemus, reply, 256);
+    if (phGetError(this->Polhemus))
       {
-      phSetReplyFormat(this->Polhemus, i+1, PH_POSITION | PH_ANGLES | PH_EXTENDED);
+      vtkErrorMacro(<< phGetErrorMessage(this->Polhemus));
+      phClose(this->Polhemus);
+      return 0;
+      }
+
+    for (i = 0; i < VTK_POLHEMUS_MAX_STATIONS; i++)
+      {
+      this->StationActive[i] = (reply[0] == '2' && reply[2] == 'l' &&
+                                reply[3+i] == '1');
+      if (!this->StationActive[i])
+        {
+        continue;
+        }
+
+      // tell the library which stations will be in the stream
+      sprintf(command, "l%d,1\r\n", i+1);
+      phSendCommand(this->Polhemus, command);
+
+      // binary records hold the position and angles as 32-bit floats
+      phSetReplyFormat(this->Polhemus, i+1, PH_POSITION | PH_ANGLES);
       phSetHemisphere(this->Polhemus, i+1, 0, 0, 0);
       char tool_type[8];
       sprintf(tool_type, "0000%03d", i+1);
@@ -222,28 +306,30 @@ int vtkPolhemusTracker::InternalStartTracking()
       this->Tools[i]->SetToolPartNumber("");
       this->Tools[i]->SetToolSerialNumber("");
       }
+    phSetBinary(this->Polhemus);
     }
 
-  if (this->Mode != PH_NOTHREAD)
-    {
-    phStream(this->Polhemus);
-    }
+  phStream(this->Polhemus);
   if (phGetError(this->Polhemus))
     {
     vtkErrorMacro(<< phGetErrorMessage(this->Polhemus));
     return 0;
     }
 
+  // start reading the stream
+  this->Reader->Start(&vtkPolhemusReadRecord, this);
+
   return 1;
 }
 
 //----------------------------------------------------------------------------
 int vtkPolhemusTracker::InternalStopTracking()
 {
-  if (this->Mode != PH_NOTHREAD)
-    {
-    phEndStream(this->Polhemus);
-    }
+  // the reader thread stops after its current record, which it will get
+  // within the polhemus's serial timeout
+  this->Reader->Stop();
+
+  phEndStream(this->Polhemus);
   if (phGetError(this->Polhemus))
     {
     vtkErrorMacro(<< phGetErrorMessage(this->Polhemus));
@@ -256,7 +342,7 @@ int vtkPolhemusTracker::InternalStopTracking()
     }
 
   return 1;
-}  
+}
 
 //----------------------------------------------------------------------------
 void vtkPolhemusTracker::InternalUpdate()
@@ -267,63 +353,65 @@ void vtkPolhemusTracker::InternalUpdate()
   float refmat[4][4];
   float toolmat[4][4];
 
-  float (*xyz)[3] = new float[this->NumberOfTools][3];
-  float (*zyx)[3] = new float[this->NumberOfTools][3];
-  long *flags = new long[this->NumberOfTools];
-  double *timestamps = new double[this->NumberOfTools];
-
+  float xyz[VTK_POLHEMUS_MAX_STATIONS][3];
+  float zyx[VTK_POLHEMUS_MAX_STATIONS][3];
+  long flags[VTK_POLHEMUS_MAX_STATIONS];
+  double timestamps[VTK_POLHEMUS_MAX_STATIONS];
+  int fresh[VTK_POLHEMUS_MAX_STATIONS];
+  int stale[VTK_POLHEMUS_MAX_STATIONS];
+  vtkTrackerStreamRecord records[VTK_POLHEMUS_MAX_STATIONS];
+  char errortext[256];
+  long refflags = 0;
+
+  // block until the reader thread receives a new record or an error,
+  // the FasTrak streams at 120Hz so this is the update rate
+  this->Reader->WaitForRecord();
+
+#if (VTK_MAJOR_VERSION < 5)
   double timestamp = vtkTimerLog::GetCurrentTime();
-
-  // initialize the flags to 'out-of-view'
-  for (tool = 0; tool < this->NumberOfTools; tool++)
-    { 
-    timestamps[tool] = timestamp;
-    flags[tool] = TR_OUT_OF_VIEW;
-    }
-
-  // use point mode if not multithreading
-  if (this->Mode == PH_NOTHREAD)
+#else
+  double timestamp = vtkTimerLog::GetUniversalTime();
+#endif
+
+  // copy the most recent record for every station, so that all of the
+  // stations that arrived since the last update go out in this batch
+  errnum = this->Reader->GetRecords(records, errortext);
+  for (station = 0; station < VTK_POLHEMUS_MAX_STATIONS; station++)
     {
-    phPoint(this->Polhemus);
-    }
-
-  // update each station
-  for (tool = 0; tool < 1; tool++) 
-    {
-    phUpdate(this->Polhemus);
-    station = phGetStation(this->Polhemus)-1;
-    // if phGetStation() returns 0, then a phase error has occurred
-    if (station >= 0)
+    vtkTrackerStreamRecord *record = &records[station];
+    for (i = 0; i < 3; i++)
       {
-      timestamps[station] = phGetTime(this->Polhemus);      
-      phGetPosition(this->Polhemus,xyz[station]);
-      phGetAngles(this->Polhemus,zyx[station]);
-      flags[station] = TR_SWITCH1_IS_ON*phGetButton(this->Polhemus);
-      // fprintf(stderr,"bird = %d, NumberOfBirds = %d, timestamp = %f\n",bird,this->NumberOfBirds,this->UpdateTimeStamp);
+      xyz[station][i] = record->Position[i];
+      zyx[station][i] = record->Angles[i];
       }
+    flags[station] = TR_SWITCH1_IS_ON*record->Button;
+    timestamps[station] = record->TimeStamp;
+    fresh[station] = record->Fresh;
+    stale[station] = record->Stale;
     }
 
-  if ((errnum = phGetError(this->Polhemus)) != 0)
+  // after an error, the stations whose stream has stopped must still
+  // be reported as missing, so don't return early
+  if (errnum != 0)
     {
     if (errnum == PH_PHASE_ERROR)
       {
-      vtkWarningMacro(<< phGetErrorMessage(this->Polhemus));
+      vtkWarningMacro(<< errortext);
       }
-    else 
+    else
       {
-      vtkErrorMacro(<< phGetErrorMessage(this->Polhemus));
+      vtkErrorMacro(<< errortext);
       }
-    return;
     }
 
   // handle the reference tool first
-  if (this->ReferenceTool >= 0 && this->ReferenceTool < this->NumberOfTools) 
+  if (this->ReferenceTool >= 0 && this->ReferenceTool < this->NumberOfTools &&
+      this->StationActive[this->ReferenceTool])
     {
     tool = this->ReferenceTool;
-    flags[tool] = 0;
 
     phMatrixFromAngles(array,zyx[tool]);
-    
+
     for (i = 0; i < 3; i++)
       {
       for (j = 0; j < 3; j++)
@@ -335,16 +423,20 @@ void vtkPolhemusTracker::InternalUpdate()
       }
     refmat[3][3] = 1.0;
 
-    if (xyz[tool][0]*xyz[tool][0] +
-	xyz[tool][1]*xyz[tool][1] +
-	xyz[tool][2]*xyz[tool][2] > VTK_POLHEMUS_RANGE*VTK_POLHEMUS_RANGE)
+    if (stale[tool])
+      {
+      refflags = TR_MISSING | TR_OUT_OF_VIEW;
+      }
+    else if (xyz[tool][0]*xyz[tool][0] +
+	     xyz[tool][1]*xyz[tool][1] +
+	     xyz[tool][2]*xyz[tool][2] > VTK_POLHEMUS_RANGE*VTK_POLHEMUS_RANGE)
       {
-      flags[tool] = TR_OUT_OF_VOLUME;
+      refflags = TR_OUT_OF_VOLUME;
       }
     }
-  else if (this->ReferenceTool >= this->NumberOfTools)
+  else if (this->ReferenceTool >= 0)
     { // reference tool doesn't actually exist!
-    flags[this->ReferenceTool] = TR_MISSING | TR_OUT_OF_VIEW;
+    refflags = TR_MISSING | TR_OUT_OF_VIEW;
     for (i = 0; i < 3; i++)
       {
       for (j = 0; j < 3; j++)
@@ -357,12 +449,31 @@ void vtkPolhemusTracker::InternalUpdate()
       }
     }
 
-  for (tool = 0; tool < 1; tool++) 
+  this->SendMatrix->Identity();
+  for (tool = 0; tool < VTK_POLHEMUS_MAX_STATIONS; tool++)
     {
-    flags[tool] = 0;
+    // stations without a sensor
+    if (!this->StationActive[tool])
+      {
+      this->ToolUpdate(tool,this->SendMatrix,TR_MISSING | TR_OUT_OF_VIEW,
+                       timestamp);
+      continue;
+      }
+
+    // only stations that sent a record since the last update, and
+    // stations whose stream has stopped are reported as missing
+    if (!fresh[tool])
+      {
+      if (stale[tool])
+        {
+        this->ToolUpdate(tool,this->SendMatrix,TR_MISSING | TR_OUT_OF_VIEW,
+                         timestamp);
+        }
+      continue;
+      }
 
     phMatrixFromAngles(array,zyx[tool]);
-    
+
     for (i = 0; i < 3; i++)
       {
       for (j = 0; j < 3; j++)
@@ -370,7 +481,7 @@ void vtkPolhemusTracker::InternalUpdate()
         toolmat[i][j] = array[3*i + j];
 	}
       toolmat[3][i] = 0.0;
-      toolmat[i][3] = xyz[tool][i] * 25.4; // convert inches to mm
+      toolmat[i][3] = xyz[tool][i];
       }
     toolmat[3][3] = 1.0;
 
@@ -384,9 +495,8 @@ void vtkPolhemusTracker::InternalUpdate()
 
     if (this->ReferenceTool >= 0 && tool != this->ReferenceTool)
       {
-      flags[tool] |= flags[this->ReferenceTool] \
-	                & (TR_MISSING | TR_OUT_OF_VIEW | TR_OUT_OF_VOLUME);
-      
+      flags[tool] |= refflags & (TR_MISSING | TR_OUT_OF_VIEW | TR_OUT_OF_VOLUME);
+
       // multiply by the inverse of the reference tool matrix,
       // taking advantage of the orthogonality of the reference matrix
       for (i = 0; i < 3; i++)
@@ -397,7 +507,7 @@ void vtkPolhemusTracker::InternalUpdate()
 				       toolmat[i][0]*refmat[j][0] +
 				       toolmat[i][1]*refmat[j][1] +
 				       toolmat[i][2]*refmat[j][2] +
-				       toolmat[i][3]*refmat[j][3]); 
+				       toolmat[i][3]*refmat[j][3]);
 	  }
 	this->SendMatrix->SetElement(i,3,toolmat[i][3] - refmat[i][3]);
 	this->SendMatrix->SetElement(3,i,0.0);
@@ -415,24 +525,7 @@ void vtkPolhemusTracker::InternalUpdate()
 	}
       }
     this->ToolUpdate(tool,this->SendMatrix,flags[tool],timestamps[tool]);
+    this->SendMatrix->Identity();
     }
-  // for tools beyond the max
-  this->SendMatrix->Identity();
-  for (tool = 1; tool < this->NumberOfTools; tool++) 
-    {
-    this->ToolUpdate(tool,this->SendMatrix,TR_MISSING | TR_OUT_OF_VIEW,
-		     timestamp);
-    }
-
-  delete [] timestamps;
-  delete [] flags;
-  delete [] xyz;
-  delete [] zyx;
 }
 
-
-
-
-
-
-
@@ -33,6 +33,15 @@ POSSIBILITY OF SUCH DAMAGES.
 // from David Gobbi at the Atamai Inc. (dgobbi@atamai.com).
 // Note that the Polhemus FasTrak requires a null-modem cable instead
 // of a standard straight-through serial cable.
+// The FasTrak is put into binary stream mode, and the stream is read
+// by a separate thread so that no records are lost between updates.
+// Each of the four stations that is active on the FasTrak is reported
+// through the tool with the same index, i.e. station 1 is tool 0.
+// The FasTrak's 120Hz update rate is shared between the active stations,
+// and at low baud rates the serial port will limit the rate further
+// (a 9600 baud port can carry around 30 records per second).
+// The polhemussim program in Utilities/polhemus replays a recorded
+// session on a pseudo-terminal and can be used in place of the device.
 // .SECTION see also
 // vtkTrackerTool vtkPOLARISTracker
 
@@ -43,6 +52,8 @@ POSSIBILITY OF SUCH DAMAGES.
 #include "vtkTracker.h"
 #include "vtkTransform.h"
 
+class vtkTrackerStreamReader;
+
 struct polhemus;
 
 class VTK_EXPORT vtkPolhemusTracker : public vtkTracker
@@ -75,6 +86,12 @@ public:
   // i.e. within vtkTracker.cxx.
   void InternalUpdate();
 
+  // Description:
+  // Read one data record from the stream and decode it into the slot
+  // for the station that it came from.  This should only be called from
+  // the reader thread.
+  void InternalReadRecord();
+
 protected:
   vtkPolhemusTracker();
   ~vtkPolhemusTracker();
@@ -91,12 +108,16 @@ protected:
   int InternalStopTracking();
 
   polhemus *Polhemus;
+  int StationActive[4];
 
   vtkMatrix4x4 *SendMatrix;
   int SerialPort;
   int BaudRate;
   int Mode;
 
+  // the records from the stream, one per station
+  vtkTrackerStreamReader *Reader;
+
 private:
   vtkPolhemusTracker(const vtkPolhemusTracker&);
   void operator=(const vtkPolhemusTracker&);  
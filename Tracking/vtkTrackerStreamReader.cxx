@@ -0,0 +1,291 @@
+/*=========================================================================
+
+  Program:   AtamaiTracking for VTK
+  Module:    $RCSfile: vtkTrackerStreamReader.cxx,v $
+  Creator:   David Gobbi <dgobbi@atamai.com>
+  Language:  C++
+
+==========================================================================
+
+Copyright (c) 2000-2005 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.  
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+#include "vtkTrackerStreamReader.h"
+#include "vtkMultiThreader.h"
+#include "vtkMutexLock.h"
+#include "vtkConditionVariable.h"
+#include "vtkTimerLog.h"
+#include "vtkObjectFactory.h"
+
+#include <string.h>
+
+//----------------------------------------------------------------------------
+vtkTrackerStreamReader* vtkTrackerStreamReader::New()
+{
+  // First try to create the object from the vtkObjectFactory
+  vtkObject* ret = vtkObjectFactory::CreateInstance("vtkTrackerStreamReader");
+  if(ret)
+    {
+    return (vtkTrackerStreamReader*)ret;
+    }
+  // If the factory was unable to create the object, then create it here.
+  return new vtkTrackerStreamReader;
+}
+
+//----------------------------------------------------------------------------
+vtkTrackerStreamReader::vtkTrackerStreamReader()
+{
+  this->NumberOfStations = 0;
+  this->Timeout = 0.1;
+
+  this->Threader = vtkMultiThreader::New();
+  this->ThreadId = -1;
+  this->Reading = 0;
+  this->Lock = vtkMutexLock::New();
+  this->Condition = vtkConditionVariable::New();
+  this->ReadFunction = NULL;
+  this->ReadClientData = NULL;
+  this->Records = NULL;
+  this->RecordCount = 0;
+  this->LastRecordCount = 0;
+  this->Error = 0;
+  this->ErrorText[0] = '\0';
+}
+
+//----------------------------------------------------------------------------
+vtkTrackerStreamReader::~vtkTrackerStreamReader()
+{
+  this->Stop();
+  this->Threader->Delete();
+  this->Lock->Delete();
+  this->Condition->Delete();
+  delete [] this->Records;
+}
+
+//----------------------------------------------------------------------------
+void vtkTrackerStreamReader::PrintSelf(ostream& os, vtkIndent indent)
+{
+  vtkObject::PrintSelf(os,indent);
+
+  os << indent << "NumberOfStations: " << this->NumberOfStations << "\n";
+  os << indent << "Timeout: " << this->Timeout << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkTrackerStreamReader::SetNumberOfStations(int n)
+{
+  if (n < 0)
+    {
+    n = 0;
+    }
+
+  this->Lock->Lock();
+  if (n != this->NumberOfStations)
+    {
+    delete [] this->Records;
+    this->Records = NULL;
+    if (n > 0)
+      {
+      this->Records = new vtkTrackerStreamRecord[n];
+      }
+    this->NumberOfStations = n;
+    }
+  if (n > 0)
+    {
+    memset(this->Records, 0, n*sizeof(vtkTrackerStreamRecord));
+    }
+  this->RecordCount = 0;
+  this->LastRecordCount = 0;
+  this->Error = 0;
+  this->ErrorText[0] = '\0';
+  this->Lock->Unlock();
+
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+// this thread reads the stream while the tracker is tracking
+static void *vtkTrackerStreamReaderThread(vtkMultiThreader::ThreadInfo *data)
+{
+  vtkTrackerStreamReader *self = (vtkTrackerStreamReader *)(data->UserData);
+
+  for (;;)
+    {
+    self->InternalRead();
+
+    // check to see if we are being told to quit
+    data->ActiveFlagLock->Lock();
+    int activeFlag = *(data->ActiveFlag);
+    data->ActiveFlagLock->Unlock();
+
+    if (activeFlag == 0)
+      {
+      return NULL;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkTrackerStreamReader::InternalRead()
+{
+  if (this->ReadFunction)
+    {
+    this->ReadFunction(this->ReadClientData);
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkTrackerStreamReader::Start(void (*readfunc)(void *), void *clientdata)
+{
+  this->Stop();
+
+  // clear the records from any earlier stream, the timeout for the
+  // first record starts now
+  this->SetNumberOfStations(this->NumberOfStations);
+#if (VTK_MAJOR_VERSION < 5)
+  double starttime = vtkTimerLog::GetCurrentTime();
+#else
+  double starttime = vtkTimerLog::GetUniversalTime();
+#endif
+  for (int i = 0; i < this->NumberOfStations; i++)
+    {
+    this->Records[i].ArrivalTime = starttime;
+    }
+
+  this->ReadFunction = readfunc;
+  this->ReadClientData = clientdata;
+  this->Lock->Lock();
+  this->Reading = 1;
+  this->Lock->Unlock();
+  this->ThreadId =
+    this->Threader->SpawnThread((vtkThreadFunctionType)
+                                &vtkTrackerStreamReaderThread, this);
+}
+
+//----------------------------------------------------------------------------
+void vtkTrackerStreamReader::Stop()
+{
+  // wake anyone who is waiting for a record that will never come
+  this->Lock->Lock();
+  this->Reading = 0;
+  this->Condition->Broadcast();
+  this->Lock->Unlock();
+
+  // the reader thread stops after its current record
+  if (this->ThreadId != -1)
+    {
+    this->Threader->TerminateThread(this->ThreadId);
+    this->ThreadId = -1;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkTrackerStreamReader::AddRecord(int station, const float position[3],
+                                       const float angles[3], int button,
+                                       double timestamp)
+{
+#if (VTK_MAJOR_VERSION < 5)
+  double arrivaltime = vtkTimerLog::GetCurrentTime();
+#else
+  double arrivaltime = vtkTimerLog::GetUniversalTime();
+#endif
+
+  this->Lock->Lock();
+  if (station >= 0 && station < this->NumberOfStations)
+    {
+    vtkTrackerStreamRecord *record = &this->Records[station];
+    record->Position[0] = position[0];
+    record->Position[1] = position[1];
+    record->Position[2] = position[2];
+    record->Angles[0] = angles[0];
+    record->Angles[1] = angles[1];
+    record->Angles[2] = angles[2];
+    record->Button = button;
+    record->TimeStamp = timestamp;
+    record->ArrivalTime = arrivaltime;
+    record->Count++;
+    this->RecordCount++;
+    this->Condition->Broadcast();
+    }
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkTrackerStreamReader::SetError(int errnum, const char *text)
+{
+  this->Lock->Lock();
+  this->Error = errnum;
+  strncpy(this->ErrorText,(text ? text : ""),255);
+  this->ErrorText[255] = '\0';
+  this->Condition->Broadcast();
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkTrackerStreamReader::WaitForRecord()
+{
+  this->Lock->Lock();
+  while (this->RecordCount == this->LastRecordCount &&
+         this->Error == 0 && this->Reading)
+    {
+    this->Condition->Wait(this->Lock);
+    }
+  this->Lock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+int vtkTrackerStreamReader::GetRecords(vtkTrackerStreamRecord *records,
+                                       char *errortext)
+{
+#if (VTK_MAJOR_VERSION < 5)
+  double timestamp = vtkTimerLog::GetCurrentTime();
+#else
+  double timestamp = vtkTimerLog::GetUniversalTime();
+#endif
+
+  this->Lock->Lock();
+  for (int i = 0; i < this->NumberOfStations; i++)
+    {
+    vtkTrackerStreamRecord *record = &this->Records[i];
+    record->Fresh = (record->Count != record->LastCount);
+    record->Stale = (!record->Fresh &&
+                     timestamp - record->ArrivalTime > this->Timeout);
+    record->LastCount = record->Count;
+    records[i] = *record;
+    }
+  this->LastRecordCount = this->RecordCount;
+  int errnum = this->Error;
+  this->Error = 0;
+  strcpy(errortext, this->ErrorText);
+  this->Lock->Unlock();
+
+  return errnum;
+}
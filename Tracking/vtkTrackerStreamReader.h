@@ -0,0 +1,169 @@
+/*=========================================================================
+
+  Program:   AtamaiTracking for VTK
+  Module:    $RCSfile: vtkTrackerStreamReader.h,v $
+  Creator:   David Gobbi <dgobbi@atamai.com>
+  Language:  C++
+
+==========================================================================
+
+Copyright (c) 2000-2005 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.  
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+// .NAME vtkTrackerStreamReader - read a streaming tracker in its own thread
+
+// .SECTION Description
+// vtkTrackerStreamReader runs a thread that reads the records that a
+// streaming tracker sends, and keeps the most recent record for each
+// station (i.e. each sensor) until the tracker's InternalUpdate() takes
+// it.  A station that has not sent a record for longer than the Timeout
+// is marked as stale, so that the tracker can report it as missing
+// instead of reporting its last pose over and over.  The tracker's
+// InternalUpdate() can block in WaitForRecord(), which is signalled by
+// the reader thread as soon as a record or an error arrives.
+// This class is used by vtkFlockTracker and vtkPolhemusTracker.
+
+// .SECTION see also
+// vtkFlockTracker vtkPolhemusTracker
+
+#ifndef __vtkTrackerStreamReader_h
+#define __vtkTrackerStreamReader_h
+
+#include "vtkObject.h"
+
+class vtkMultiThreader;
+class vtkMutexLock;
+class vtkConditionVariable;
+
+//BTX
+// the most recent data record for one station
+struct vtkTrackerStreamRecord
+{
+  float Position[3];
+  float Angles[3];
+  int Button;
+  double TimeStamp;   // time stamp from the tracker
+  double ArrivalTime; // local time at which the record was read
+  int Count;      // number of records received for this station
+  int LastCount;  // value of Count at the last GetRecords()
+  int Fresh;      // set by GetRecords() if a record arrived since last time
+  int Stale;      // set by GetRecords() if the Timeout has passed
+};
+//ETX
+
+class VTK_EXPORT vtkTrackerStreamReader : public vtkObject
+{
+public:
+  static vtkTrackerStreamReader *New();
+  vtkTypeMacro(vtkTrackerStreamReader,vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Set the number of stations in the stream.  This also clears the
+  // records, so it should not be called while the reader is running.
+  void SetNumberOfStations(int n);
+  vtkGetMacro(NumberOfStations,int);
+
+  // Description:
+  // Set the time in seconds after which a station that has not sent
+  // a record is considered stale.  Default: 0.1
+  vtkSetMacro(Timeout,double);
+  vtkGetMacro(Timeout,double);
+
+//BTX
+  // Description:
+  // Start the reader thread, which calls the read function over
+  // and over until Stop() is called.  The read function should read
+  // one record and give it to AddRecord() or SetError().
+  void Start(void (*readfunc)(void *), void *clientdata);
+
+  // Description:
+  // Stop the reader thread.  This will wait until the read function
+  // returns, which will be within the serial timeout of the device.
+  void Stop();
+
+  // Description:
+  // Store a record for a station.  This is called from the read function.
+  void AddRecord(int station, const float position[3],
+                 const float angles[3], int button, double timestamp);
+
+  // Description:
+  // Store an error, which is kept until GetRecords() is called.
+  // This is called from the read function.
+  void SetError(int errnum, const char *text);
+
+  // Description:
+  // Wait until the reader thread stores a new record or an error, or
+  // until the reader is stopped.  If the stream stops, this returns
+  // with an error within the serial timeout of the device.
+  void WaitForRecord();
+
+  // Description:
+  // Copy the most recent record for every station, with the Fresh
+  // and Stale members set.  The return value is the error that was
+  // stored by the read function since the last call, or zero, and the
+  // error text is copied into errortext, which must hold 256 chars.
+  int GetRecords(vtkTrackerStreamRecord *records, char *errortext);
+//ETX
+
+  // Description:
+  // Call the read function once.  This should only be called from
+  // the reader thread.
+  void InternalRead();
+
+protected:
+  vtkTrackerStreamReader();
+  ~vtkTrackerStreamReader();
+
+  int NumberOfStations;
+  double Timeout;
+
+  vtkMultiThreader *Threader;
+  int ThreadId;
+  int Reading;
+  vtkMutexLock *Lock;
+  vtkConditionVariable *Condition;
+//BTX
+  void (*ReadFunction)(void *);
+  void *ReadClientData;
+  vtkTrackerStreamRecord *Records;
+//ETX
+  int RecordCount;
+  int LastRecordCount;
+  int Error;
+  char ErrorText[256];
+
+private:
+  vtkTrackerStreamReader(const vtkTrackerStreamReader&);
+  void operator=(const vtkTrackerStreamReader&);
+};
+
+#endif
@@ -0,0 +1,235 @@
+/*=========================================================================
+
+  Program:   AtamaiTracking for VTK
+  Module:    $RCSfile: vtkXarTraXProjection.cxx,v $
+  Language:  C++
+  Author:    $Author: $
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2005 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.  
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+#include "vtkXarTraXProjection.h"
+#include "vtkTrackerTool.h"
+#include "vtkTransform.h"
+#include "vtkMatrix4x4.h"
+#include "vtkCallbackCommand.h"
+#include "vtkCommand.h"
+#include "vtkObjectFactory.h"
+
+//----------------------------------------------------------------------------
+vtkXarTraXProjection* vtkXarTraXProjection::New()
+{
+  // First try to create the object from the vtkObjectFactory
+  vtkObject* ret = vtkObjectFactory::CreateInstance("vtkXarTraXProjection");
+  if(ret)
+    {
+    return (vtkXarTraXProjection*)ret;
+    }
+  // If the factory was unable to create the object, then create it here.
+  return new vtkXarTraXProjection;
+}
+
+//----------------------------------------------------------------------------
+// called by the tool whenever vtkTrackerTool::Update() gives it a new pose
+static void vtkXarTraXProjectionToolModified(vtkObject *, unsigned long,
+                                             void *clientdata, void *)
+{
+  ((vtkXarTraXProjection *)clientdata)->Update();
+}
+
+//----------------------------------------------------------------------------
+vtkXarTraXProjection::vtkXarTraXProjection()
+{
+  this->Device = NULL;
+  this->PointSet = NULL;
+  this->Projection = NULL;
+  this->Tool = NULL;
+  this->ToolObserver = vtkCallbackCommand::New();
+  this->ToolObserver->SetCallback(vtkXarTraXProjectionToolModified);
+  this->ToolObserver->SetClientData(this);
+  this->ToolObserverTag = 0;
+  this->FileName = NULL;
+  this->Registration = NULL;
+  this->OHAT[0] = 0.0;
+  this->OHAT[1] = 0.0;
+  this->OHAT[2] = 1.0;
+  this->Threshold = 0.5;
+  this->TimeBetweenPoints = 0.1;
+  this->ErrorCode = XAR_OKAY;
+}
+
+//----------------------------------------------------------------------------
+vtkXarTraXProjection::~vtkXarTraXProjection()
+{
+  this->SetTool(NULL);
+  this->ToolObserver->Delete();
+  this->SetFileName(NULL);
+  this->SetRegistration(NULL);
+  xarFreeTrackedProjection(this->Projection);
+  xarFreePointSet(this->PointSet);
+}
+
+//----------------------------------------------------------------------------
+void vtkXarTraXProjection::PrintSelf(ostream& os, vtkIndent indent)
+{
+  vtkObject::PrintSelf(os,indent);
+
+  os << indent << "Device: " << this->Device << "\n";
+  os << indent << "Tool: " << this->Tool << "\n";
+  os << indent << "FileName: "
+     << (this->FileName ? this->FileName : "(none)") << "\n";
+  os << indent << "Registration: " << this->Registration << "\n";
+  os << indent << "OHAT: " << this->OHAT[0] << " " << this->OHAT[1]
+     << " " << this->OHAT[2] << "\n";
+  os << indent << "Threshold: " << this->Threshold << "\n";
+  os << indent << "TimeBetweenPoints: " << this->TimeBetweenPoints << "\n";
+  os << indent << "Running: "
+     << (this->Projection && this->Projection->running ? "On" : "Off")
+     << "\n";
+  os << indent << "ErrorCode: " << this->ErrorCode << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkXarTraXProjection::SetTool(vtkTrackerTool *tool)
+{
+  if (tool == this->Tool)
+    {
+    return;
+    }
+  if (this->Tool)
+    {
+    this->Tool->RemoveObserver(this->ToolObserverTag);
+    this->Tool->UnRegister(this);
+    }
+  this->Tool = tool;
+  if (this->Tool)
+    {
+    this->Tool->Register(this);
+    this->ToolObserverTag =
+      this->Tool->AddObserver(vtkCommand::ModifiedEvent, this->ToolObserver);
+    }
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkCxxSetObjectMacro(vtkXarTraXProjection,Registration,vtkMatrix4x4);
+
+//----------------------------------------------------------------------------
+void vtkXarTraXProjection::GetToolMatrix(double matrix[4][4])
+{
+  vtkMatrix4x4 *toolMatrix = this->Tool->GetTransform()->GetMatrix();
+  for (int i = 0; i < 4; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      matrix[i][j] = toolMatrix->GetElement(i,j);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkXarTraXProjection::Start()
+{
+  this->Stop();
+
+  if (this->Device == NULL || this->Tool == NULL || this->FileName == NULL)
+    {
+    vtkErrorMacro(<< "Start: the Device, Tool and FileName must be set");
+    return (this->ErrorCode = XAR_FILEERROR);
+    }
+
+  xarFreeTrackedProjection(this->Projection);
+  this->Projection = NULL;
+  xarFreePointSet(this->PointSet);
+  this->PointSet = xarLoadPointSet(this->FileName);
+  if (this->PointSet == NULL)
+    {
+    vtkErrorMacro(<< "Start: cannot read " << this->FileName);
+    return (this->ErrorCode = XAR_FILEERROR);
+    }
+
+  double registration[4][4];
+  for (int i = 0; i < 4; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      registration[i][j] = (this->Registration ?
+                            this->Registration->GetElement(i,j) :
+                            (i == j ? 1.0 : 0.0));
+      }
+    }
+
+  this->Projection = xarNewTrackedProjection(this->PointSet, registration,
+                                             this->OHAT, this->Threshold);
+  if (this->Projection == NULL)
+    {
+    return (this->ErrorCode = XAR_FILEERROR);
+    }
+
+  double toolMatrix[4][4];
+  this->GetToolMatrix(toolMatrix);
+  this->ErrorCode = xarStartTrackedProjection(this->Device, this->Projection,
+                                              toolMatrix,
+                                              this->Tool->GetTimeStamp(),
+                                              this->TimeBetweenPoints);
+  return this->ErrorCode;
+}
+
+//----------------------------------------------------------------------------
+void vtkXarTraXProjection::Stop()
+{
+  if (this->Projection)
+    {
+    this->Projection->running = 0;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkXarTraXProjection::Update()
+{
+  if (this->Projection == NULL || !this->Projection->running)
+    {
+    return;
+    }
+
+  // the projection is only sent if the time stamp has changed, so
+  // modifications that do not bring a new pose cost nothing
+  double toolMatrix[4][4];
+  this->GetToolMatrix(toolMatrix);
+  int toolStatus = (this->Tool->IsMissing() || this->Tool->IsOutOfView());
+  this->ErrorCode = xarUpdateTrackedProjection(this->Device, this->Projection,
+                                               toolMatrix, toolStatus,
+                                               this->Tool->GetTimeStamp());
+}
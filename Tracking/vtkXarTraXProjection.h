@@ -0,0 +1,164 @@
+/*=========================================================================
+
+  Program:   AtamaiTracking for VTK
+  Module:    $RCSfile: vtkXarTraXProjection.h,v $
+  Language:  C++
+  Author:    $Author: $
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2005 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.  
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+// .NAME vtkXarTraXProjection - keep a XarTraX projection on a tracked tool
+// .SECTION Description
+// vtkXarTraXProjection projects a point set with the XarTraX laser and
+// keeps the pattern attached to a vtkTrackerTool, e.g. the patient
+// reference.  It observes the tool, and each time vtkTracker::Update()
+// gives the tool a new pose it calls xarUpdateTrackedProjection(), which
+// recomputes and uploads only the points that moved by more than the
+// Threshold.  The XarTraX commands are sent from the thread that calls
+// vtkTracker::Update().
+// .SECTION Caveats
+// This class needs Utilities/xartraxapi, which is not built at present
+// (see Utilities/CMakeLists.txt), so it is not in the Tracking library.
+// .SECTION see also
+// vtkTrackerTool vtkTracker
+
+#ifndef __vtkXarTraXProjection_h
+#define __vtkXarTraXProjection_h
+
+#include "vtkObject.h"
+//BTX
+#include "XarTraXAPI.h"
+//ETX
+
+class vtkTrackerTool;
+class vtkMatrix4x4;
+class vtkCallbackCommand;
+
+class VTK_EXPORT vtkXarTraXProjection : public vtkObject
+{
+public:
+  static vtkXarTraXProjection *New();
+  vtkTypeMacro(vtkXarTraXProjection,vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+//BTX
+  // Description:
+  // The XarTraX controller, which must already be open and initialized.
+  void SetDevice(polaris *pol) { this->Device = pol; };
+  polaris *GetDevice() { return this->Device; };
+//ETX
+
+  // Description:
+  // The tool that the projection follows.  The tool must belong to a
+  // tracker that is being updated with vtkTracker::Update().
+  void SetTool(vtkTrackerTool *tool);
+  vtkGetObjectMacro(Tool,vtkTrackerTool);
+
+  // Description:
+  // The file that holds the points to project, in the format that is
+  // read by xarLoadPointSet().  The file is read by Start().
+  vtkSetStringMacro(FileName);
+  vtkGetStringMacro(FileName);
+
+  // Description:
+  // The transform from the coordinates of the points to the coordinates
+  // of the tool.  If this is not set, the identity is used.
+  virtual void SetRegistration(vtkMatrix4x4 *);
+  vtkGetObjectMacro(Registration,vtkMatrix4x4);
+
+  // Description:
+  // The unit vector of the laser in the tracker coordinates.
+  vtkSetVector3Macro(OHAT,double);
+  vtkGetVector3Macro(OHAT,double);
+
+  // Description:
+  // How far a point must move, in tracker units, before it is sent to
+  // the controller again.  Default: 0.5.
+  vtkSetMacro(Threshold,double);
+  vtkGetMacro(Threshold,double);
+
+  // Description:
+  // The time between the points of the waveform, in milliseconds
+  // (see xarATimebpts()).  Default: 0.1.
+  vtkSetMacro(TimeBetweenPoints,double);
+  vtkGetMacro(TimeBetweenPoints,double);
+
+  // Description:
+  // Start projecting at the current pose of the tool, and follow the
+  // tool from then on.  Returns XAR_OKAY, or a XarTraX error code.
+  int Start();
+
+  // Description:
+  // Stop following the tool.  The controller keeps drawing the pattern
+  // for the last pose that was sent.
+  void Stop();
+
+  // Description:
+  // Bring the projection up to date with the tool.  This is called
+  // whenever the tool is modified, so it is not usually called directly.
+  void Update();
+
+  // Description:
+  // The XarTraX error code from the most recent Start() or Update().
+  vtkGetMacro(ErrorCode,int);
+
+protected:
+  vtkXarTraXProjection();
+  ~vtkXarTraXProjection();
+
+//BTX
+  polaris *Device;
+  xarPointSet *PointSet;
+  xarTrackedProjection *Projection;
+//ETX
+  vtkTrackerTool *Tool;
+  vtkCallbackCommand *ToolObserver;
+  unsigned long ToolObserverTag;
+  char *FileName;
+  vtkMatrix4x4 *Registration;
+  double OHAT[3];
+  double Threshold;
+  double TimeBetweenPoints;
+  int ErrorCode;
+
+  void GetToolMatrix(double matrix[4][4]);
+
+private:
+  vtkXarTraXProjection(const vtkXarTraXProjection&);
+  void operator=(const vtkXarTraXProjection&);
+};
+
+#endif
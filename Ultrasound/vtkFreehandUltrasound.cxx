@@ -55,6 +55,7 @@ POSSIBILITY OF SUCH DAMAGES.
 #endif
 
 #include "fixed.h"
+#include "vtkFreehandUltrasoundCore.h"
 #include "vtkStreamingDemandDrivenPipeline.h"
 #include "vtkExecutive.h"
 #include "vtkInformation.h"
@@ -877,350 +878,10 @@ int vtkFreehandUltrasound::ComputePipelineMTime(
 }
 //----------------------------------------------------------------------------
 //  Interpolation subroutines and associated code
+//  (the kernels are shared with vtkFreehandUltrasound2, and are in
+//  vtkFreehandUltrasoundCore.h)
 //----------------------------------------------------------------------------
 
-//----------------------------------------------------------------------------
-// rounding functions, split and optimized for each type
-// (because we don't want to round if the result is a float!)
-
-// in the case of a tie between integers, the larger integer wins.
-
-// The 'floor' function on x86 and mips is many times slower than these
-// and is used a lot in this code, optimize for different CPU architectures
-// static inline int vtkUltraFloor(double x)
-// {
-// #if defined mips || defined sparc
-//   return (int)((unsigned int)(x + 2147483648.0) - 2147483648U);
-// #elif defined i386
-//   double tempval = (x - 0.25) + 3377699720527872.0; // (2**51)*1.5
-//   return ((int*)&tempval)[0] >> 1;
-// #else
-//   return int(floor(x));
-// #endif
-// }
-
-static inline int vtkUltraFloor(double x)
-{
-#if defined mips || defined sparc || defined __ppc__
-  x += 2147483648.0;
-  unsigned int i = (unsigned int)(x);
-  return (int)(i - 2147483648U);
-#elif defined i386 || defined _M_IX86
-  union { double d; unsigned short s[4]; unsigned int i[2]; } dual;
-  dual.d = x + 103079215104.0;  // (2**(52-16))*1.5
-  return (int)((dual.i[1]<<16)|((dual.i[0])>>16));
-#elif defined ia64 || defined __ia64__ || defined IA64
-  x += 103079215104.0;
-  long long i = (long long)(x);
-  return (int)(i - 103079215104LL);
-#else
-  double y = floor(x);
-  return (int)(y);
-#endif
-}
-
-static inline int vtkUltraCeil(double x)
-{
-  return -vtkUltraFloor(-x - 1.0) - 1;
-}
-
-static inline int vtkUltraRound(double x)
-{
-  return vtkUltraFloor(x + 0.5);
-}
-
-static inline int vtkUltraFloor(float x)
-{
-  return vtkUltraFloor((double)x);
-}
-
-static inline int vtkUltraCeil(float x)
-{
-  return vtkUltraCeil((double)x);
-}
-
-static inline int vtkUltraRound(float x)
-{
-  return vtkUltraRound((double)x);
-}
-
-static inline int vtkUltraFloor(fixed x)
-{
-  return x.floor();
-}
-
-static inline int vtkUltraCeil(fixed x)
-{
-  return x.ceil();
-}
-
-static inline int vtkUltraRound(fixed x)
-{
-  return x.round();
-}
-
-
-// convert a float into an integer plus a fraction
-template <class F>
-static inline int vtkUltraFloor(F x, F &f)
-{
-  int ix = vtkUltraFloor(x);
-  f = x - ix;
-
-  return ix;
-}
-
-template <class F, class T>
-static inline void vtkUltraRound(F val, T& rnd)
-{
-  rnd = vtkUltraRound(val);
-}
-
-//----------------------------------------------------------------------------
-// Do nearest-neighbor interpolation of the input data 'inPtr' of extent 
-// 'inExt' at the 'point'.  The result is placed at 'outPtr'.  
-// If the lookup data is beyond the extent 'inExt', set 'outPtr' to
-// the background color 'background'.  
-// The number of scalar components in the data is 'numscalars'
-
-template <class F, class T>
-static int vtkNearestNeighborInterpolation(F *point, T *inPtr, T *outPtr,
-                                           unsigned short *accPtr, 
-                                           int numscalars, 
-                                           int outExt[6], vtkIdType outInc[3])
-{
-  int i;
-  int outIdX = vtkUltraRound(point[0])-outExt[0];
-  int outIdY = vtkUltraRound(point[1])-outExt[2];
-  int outIdZ = vtkUltraRound(point[2])-outExt[4];
-  
-  // fancy way of checking bounds
-  if ((outIdX | (outExt[1]-outExt[0] - outIdX) |
-       outIdY | (outExt[3]-outExt[2] - outIdY) |
-       outIdZ | (outExt[5]-outExt[4] - outIdZ)) >= 0)
-    {
-    vtkIdType inc = outIdX*outInc[0]+outIdY*outInc[1]+outIdZ*outInc[2];
-    outPtr += inc;
-    if (accPtr)
-      {
-      // accumulation buffer: do compounding
-      accPtr += inc/outInc[0];
-      int newa = *accPtr + 255;
-      for (i = 0; i < numscalars; i++)
-        {
-        *outPtr = ((*inPtr++)*255 + (*outPtr)*(*accPtr))/newa;
-        outPtr++;
-        }
-      *outPtr = 255;
-      *accPtr = 65535;
-      if (newa < 65535)
-        {
-        *accPtr = newa;
-        }
-      }
-    else
-      {
-      // no accumulation buffer, replace what was there before
-      for (i = 0; i < numscalars; i++)
-        {
-        *outPtr++ = *inPtr++;
-        }
-      *outPtr = 255;
-      }
-    return 1;
-    }
-  return 0;
-} 
-
-// Do trilinear interpolation of the input data 'inPtr' of extent 'inExt'
-// at the 'point'.  The result is placed at 'outPtr'.  
-// If the lookup data is beyond the extent 'inExt', set 'outPtr' to
-// the background color 'background'.  
-// The number of scalar components in the data is 'numscalars'
-template <class F, class T>
-static int vtkTrilinearInterpolation(F *point, T *inPtr, T *outPtr,
-                                     unsigned short *accPtr, int numscalars, 
-                                     int outExt[6], vtkIdType outInc[3])
-{
-  F fx, fy, fz;
-
-  int outIdX0 = vtkUltraFloor(point[0], fx);
-  int outIdY0 = vtkUltraFloor(point[1], fy);
-  int outIdZ0 = vtkUltraFloor(point[2], fz);
-
-  int outIdX1 = outIdX0 + (fx != 0);
-  int outIdY1 = outIdY0 + (fy != 0);
-  int outIdZ1 = outIdZ0 + (fz != 0);
-  
-  // bounds check
-  if ((outIdX0 | (outExt[1]-outExt[0] - outIdX1) |
-       outIdY0 | (outExt[3]-outExt[2] - outIdY1) |
-       outIdZ0 | (outExt[5]-outExt[4] - outIdZ1)) >= 0)
-    {// do reverse trilinear interpolation
-    vtkIdType factX0 = outIdX0*outInc[0];
-    vtkIdType factY0 = outIdY0*outInc[1];
-    vtkIdType factZ0 = outIdZ0*outInc[2];
-
-    vtkIdType factX1 = outIdX1*outInc[0];
-    vtkIdType factY1 = outIdY1*outInc[1];
-    vtkIdType factZ1 = outIdZ1*outInc[2];
-
-    vtkIdType factY0Z0 = factY0 + factZ0;
-    vtkIdType factY0Z1 = factY0 + factZ1;
-    vtkIdType factY1Z0 = factY1 + factZ0;
-    vtkIdType factY1Z1 = factY1 + factZ1;
-
-    vtkIdType idx[8];
-    idx[0] = factX0 + factY0Z0;
-    idx[1] = factX0 + factY0Z1;
-    idx[2] = factX0 + factY1Z0;
-    idx[3] = factX0 + factY1Z1;
-    idx[4] = factX1 + factY0Z0;
-    idx[5] = factX1 + factY0Z1;
-    idx[6] = factX1 + factY1Z0;
-    idx[7] = factX1 + factY1Z1;
-
-    F rx = 1 - fx;
-    F ry = 1 - fy;
-    F rz = 1 - fz;
-      
-    F ryrz = ry*rz;
-    F ryfz = ry*fz;
-    F fyrz = fy*rz;
-    F fyfz = fy*fz;
-
-    F fdx[8];
-    fdx[0] = rx*ryrz;
-    fdx[1] = rx*ryfz;
-    fdx[2] = rx*fyrz;
-    fdx[3] = rx*fyfz;
-    fdx[4] = fx*ryrz;
-    fdx[5] = fx*ryfz;
-    fdx[6] = fx*fyrz;
-    fdx[7] = fx*fyfz;
-    
-    F f, r, a;
-    T *inPtrTmp, *outPtrTmp;
-    if (accPtr)
-      {
-      //------------------------------------
-      // accumulation buffer: do compounding
-      unsigned short *accPtrTmp;
-
-      // loop over the eight voxels
-      int j = 8;
-      do 
-        {
-        j--;
-        if (fdx[j] == 0)
-          {
-          continue;
-          }
-        inPtrTmp = inPtr;
-        outPtrTmp = outPtr+idx[j];
-        accPtrTmp = accPtr+idx[j]/outInc[0];
-        f = fdx[j];
-        r = F(*accPtrTmp)/255;
-        a = f + r;
-	
-        int i = numscalars;
-        do
-          {
-          i--;
-          vtkUltraRound((f*(*inPtrTmp++) + r*(*outPtrTmp))/a,
-                          *outPtrTmp);
-          outPtrTmp++;
-          }
-        while (i);
-        // set accumulation
-        *accPtrTmp = 65535;
-        *outPtrTmp = 255;
-        a *= 255;
-        if (a < F(65535)) // don't allow accumulation buffer overflow
-          {
-//	  cout<<"Overflow"<<endl;
-          vtkUltraRound(a, *accPtrTmp);
-          }
-        }
-      while (j);
-      }
-    else 
-      {
-      //------------------------------------
-      // no accumulation buffer
-      // loop over the eight voxels
-      int j = 8;
-      do
-        {
-        j--;
-        if (fdx[j] == 0)
-          {
-          continue;
-          }
-        inPtrTmp = inPtr;
-        outPtrTmp = outPtr+idx[j];
-        // if alpha is nonzero then the pixel was hit before, so
-        //  average with previous value
-        if (outPtrTmp[numscalars])
-          {
-          f = fdx[j];
-          r = 1 - f;
-          int i = numscalars;
-          do
-            {
-            i--;
-            vtkUltraRound(f*(*inPtrTmp++) + r*(*outPtrTmp),
-                            *outPtrTmp);
-            outPtrTmp++;
-            }
-          while (i);
-          }
-        // alpha is zero, so just insert the new value
-        else
-          {
-          int i = numscalars;
-          do
-            {
-            i--;
-            *outPtrTmp++ = *inPtrTmp++;
-            }
-          while (i);
-          }          
-        *outPtrTmp = 255;
-        }
-      while (j);
-      }
-    return 1;
-    }
-  return 0;
-}                          
-
-//----------------------------------------------------------------------------
-// Some helper functions
-//----------------------------------------------------------------------------
-
-// get appropriate interpolation function
-template <class F, class T>
-static void vtkGetUltraInterpFunc(vtkFreehandUltrasound *self, 
-                                    int (**interpolate)(F *point, 
-                                                        T *inPtr, T *outPtr,
-                                                        unsigned short *accPtr,
-                                                        int numscalars, 
-                                                        int outExt[6], 
-                                                        vtkIdType outInc[3]))
-{
-  switch (self->GetInterpolationMode())
-    {
-    case VTK_FREEHAND_NEAREST:
-      *interpolate = &vtkNearestNeighborInterpolation;
-      break;
-    case VTK_FREEHAND_LINEAR:
-      *interpolate = &vtkTrilinearInterpolation;
-      break;
-    }
-}
-  
-
 //----------------------------------------------------------------------------
 // This templated function executes the filter for any type of data.
 // (this one function is pretty much the be-all and end-all of the
@@ -1236,15 +897,15 @@ static void vtkFreehandUltrasoundInsertSlice(vtkFreehandUltrasound *self,
   int numscalars;
   int idX, idY, idZ;
   vtkIdType inIncX, inIncY, inIncZ;
-  vtkIdType outInc[3];
+  int outInc[3];
   int outExt[6], clipExt[6];
   vtkFloatingPointType inSpacing[3], inOrigin[3];
   unsigned long target;
   double outPoint[4], inPoint[4];
 
   int (*interpolate)(double *point, T *inPtr, T *outPtr,
-		     unsigned short *accPtr,
-                     int numscalars, int outExt[6], vtkIdType outInc[3]);
+		     unsigned short *accPtr, T *resPtr,
+                     int numscalars, int outExt[6], int outInc[3]);
   
   inData->GetSpacing(inSpacing);
   inData->GetOrigin(inOrigin);
@@ -1281,7 +942,8 @@ static void vtkFreehandUltrasoundInsertSlice(vtkFreehandUltrasound *self,
   numscalars = inData->GetNumberOfScalarComponents();
   
   // Set interpolation method
-  vtkGetUltraInterpFunc(self,&interpolate);
+  vtkFreehandGetInterpFunc<vtkFreehandCompoundSaturatedMean>(
+    self->GetInterpolationMode(), &interpolate);
 
   // Loop through input pixels
   for (idZ = inExt[4]; idZ <= inExt[5]; idZ++)
@@ -1311,8 +973,8 @@ static void vtkFreehandUltrasoundInsertSlice(vtkFreehandUltrasound *self,
             outPoint[2] /= outPoint[3];
             outPoint[3] = 1;
         
-            int hit = interpolate(outPoint, inPtr, outPtr, accPtr, numscalars, 
-                        outExt, outInc);
+            int hit = interpolate(outPoint, inPtr, outPtr, accPtr, 
+                                  (T *)0, numscalars, outExt, outInc);
 	    //    self->SetPixelCount( self->GetPixelCount() + hit);
 	    self->IncrementPixelCount(0, hit);
 	    
@@ -1431,275 +1093,6 @@ void vtkFreehandUltrasound::InsertSlice()
   // this->Modified();
 }
 
-//----------------------------------------------------------------------------
-template <class T>
-static void vtkFreehandUltrasoundFillHolesInOutput(vtkFreehandUltrasound *self,
-						   vtkImageData *outData,
-						   T *outPtr,
-						   unsigned short *accPtr,
-						   int outExt[6])
-{
-  int idX, idY, idZ;
-  vtkIdType incX, incY, incZ;
-  vtkIdType accIncX, accIncY, accIncZ;
-  int startX, endX, numscalars;
-  int c;
-  // clip the extent by 1 voxel width relative to whole extent
-  int *outWholeExt = outData->GetWholeExtent();
-  int extent[6];
-  for (int a = 0; a < 3; a++)
-    {
-    extent[2*a] = outExt[2*a];
-    if (extent[2*a] == outWholeExt[2*a])
-      {
-      extent[2*a]++;
-      }
-    extent[2*a+1] = outExt[2*a+1];
-    if (extent[2*a+1] == outWholeExt[2*a+1])
-      {
-      extent[2*a+1]--;
-      }
-    }
-
-  // get increments for output and for accumulation buffer
-  outData->GetIncrements(incX, incY, incZ);
-  accIncX = 1;
-  accIncY = incY/incX;
-  accIncZ = incZ/incX;
-  // number of components not including the alpha channel
-  numscalars = outData->GetNumberOfScalarComponents() - 1;
-   
-  T *alphaPtr = outPtr + numscalars;
-  T *outPtrZ, *outPtrY, *outPtrX;
-  unsigned short *accPtrZ, *accPtrY, *accPtrX;
-
-  // go through all voxels except the edge voxels
-  for (idZ = extent[4]; idZ <= extent[5]; idZ++)
-    {
-    outPtrZ = outPtr + (idZ - outExt[4])*incZ;
-    accPtrZ = accPtr + (idZ - outExt[4])*accIncZ;
-    for (idY = extent[2]; idY <= extent[3]; idY++)
-      {
-      outPtrY = outPtrZ + (idY - outExt[2])*incY;
-      accPtrY = accPtrZ + (idY - outExt[2])*accIncY;
-      // find entry point
-      alphaPtr = outPtrY + numscalars;
-      for (startX = outExt[0]; startX <= outExt[1]; startX++)
-	{
-	// check the point on the row as well as the 4-connected voxels 
-	if (*alphaPtr |
-	    *(alphaPtr-incY) | *(alphaPtr+incY) |
-	    *(alphaPtr-incZ) | *(alphaPtr+incZ))
-	  {// break when alpha component is nonzero
-	  break;
-	  }
-	alphaPtr += incX;
-	}
-      if (startX > outExt[1])
-	{ // the whole row is empty, do nothing
-	continue;
-	}
-      // find exit point
-      alphaPtr = outPtrY + (outExt[1]-outExt[0])*incX + numscalars;
-      for (endX = outExt[1]; endX >= outExt[0]; endX--)
-	{
-	// check the point on the row as well as the 4-connected voxels 
-	if (*alphaPtr |
-	    *(alphaPtr-incY) | *(alphaPtr+incY) |
-	    *(alphaPtr-incZ) | *(alphaPtr+incZ))
-	  {
-	  break;
-	  }
-	alphaPtr -= incX;
-	}
-      // go through the row, skip first and last voxel in row
-      if (startX == outWholeExt[0])
-	{
-	startX++;
-	}
-      if (endX == outWholeExt[1])
-	{
-	endX--;
-	}
-      outPtrX = outPtrY + (startX - outExt[0])*incX;
-      accPtrX = accPtrY + (startX - outExt[0])*accIncX;
-      for (idX = startX; idX <= endX; idX++)
-	{
-	if (outPtrX[numscalars] == 0)
-	  { // only do this for voxels that haven't been hit
-	  double sum[32];
-	  for (c = 0; c < numscalars; c++) 
-	    {
-	    sum[c] = 0;
-	    }
-	  double asum = 0; 
-	  int n = 0;
-	  int nmin = 14; // half of the connected voxels plus one
-	  T *blockPtr;
-	  unsigned short *accBlockPtr;
-	  // sum the pixel values for the 3x3x3 block
-          //  (this is turned off for now)
-	  if (0) // (accPtr)
-	    { // use accumulation buffer to do weighted average
-	    for (vtkIdType k = -accIncZ; k <= accIncZ; k += accIncZ)
-	      {
-	      for (vtkIdType j = -accIncY; j <= accIncY; j += accIncY)
-		{
-		for (vtkIdType i = -accIncX; i <= accIncX; i += accIncX)
-		  {
-		  vtkIdType inc = j + k + i;
-		  blockPtr = outPtrX + inc*incX;
-		  accBlockPtr = accPtrX + inc;
-		  if (blockPtr[numscalars] == 255)
-		    {
-		    n++;
-		    for (c = 0; c < numscalars; c++)
-		      { // use accumulation buffer as weight
-		      sum[c] += blockPtr[c]*(*accBlockPtr);
-		      }
-		    asum += *accBlockPtr;
-		    }
-		  }
-		}
-	      }
-	    // if less than half the neighbors have data, use larger block
-	    if (n <= nmin && idX != startX && idX != endX &&
-		idX - outWholeExt[0] > 2 && outWholeExt[1] - idX > 2 &&
-		idY - outWholeExt[2] > 2 && outWholeExt[3] - idY > 2 &&
-		idZ - outWholeExt[4] > 2 && outWholeExt[5] - idZ > 2)
-	      {
-	      // weigh inner block by a factor of four (multiply three,
-	      // plus we will be counting it again as part of the 5x5x5
-	      // block)
-	      asum *= 3;
-	      for (c = 0; c < numscalars; c++) 
-		{
-		sum[c]*= 3;
-		}	      
-	      nmin = 63;
-	      n = 0;
-	      for (vtkIdType k = -accIncZ*2; k <= accIncZ*2; k += accIncZ)
-		{
-		for (vtkIdType j = -accIncY*2; j <= accIncY*2; j += accIncY)
-		  {
-		  for (vtkIdType i = -accIncX*2; i <= accIncX*2; i += accIncX)
-		    {
-		    vtkIdType inc = j + k + i;
-		    blockPtr = outPtrX + inc*incX;
-		    accBlockPtr = accPtrX + inc;
-		    if (blockPtr[numscalars] == 255)
-		      { // use accumulation buffer as weight
-		      n++;
-		      for (c = 0; c < numscalars; c++)
-			{
-			sum[c] += blockPtr[c]*(*accBlockPtr);
-			}
-		      asum += *accBlockPtr; 
-		      }
-		    }
-		  }
-		}
-	      }
-	    }
-	  else // no accumulation buffer
-	    {
-	    for (int k = -incZ; k <= incZ; k += incZ)
-	      {
-	      for (int j = -incY; j <= incY; j += incY)
-		{
-		for (int i = -incX; i <= incX; i += incX)
-		  {
-		  blockPtr = outPtrX + j + k + i;
-		  if (blockPtr[numscalars] == 255)
-		    {
-		    n++;
-		    for (int c = 0; c < numscalars; c++)
-		      {
-		      sum[c] += blockPtr[c];
-		      }
-		    }
-		  }
-		}
-	      }
-	    asum = n;
-	    // if less than half the neighbors have data, use larger block,
-	    // and count inner 3x3 block again to weight it by 2
-	    if (n <= nmin && idX != startX && idX != endX &&
-		idX - outWholeExt[0] > 2 && outWholeExt[1] - idX > 2 &&
-		idY - outWholeExt[2] > 2 && outWholeExt[3] - idY > 2 &&
-		idZ - outWholeExt[4] > 2 && outWholeExt[5] - idZ > 2)
-	      { 
-	      // weigh inner block by a factor of four (multiply three,
-	      // plus we will be counting it again as part of the 5x5x5
-	      // block)
-	      asum *= 3;
-	      for (c = 0; c < numscalars; c++) 
-		{
-		sum[c]*= 3;
-		}
-	      nmin = 63;
-	      n = 0;
-	      for (int k = -incZ*2; k <= incZ*2; k += incZ)
-		{
-		for (int j = -incY*2; j <= incY*2; j += incY)
-		  {
-		  for (int i = -incX*2; i <= incX*2; i += incX)
-		    {
-		    blockPtr = outPtrX + j + k + i;
-		    if (blockPtr[numscalars] == 255)
-		      {
-		      n++;
-		      for (int c = 0; c < numscalars; c++)
-			{
-			sum[c] += blockPtr[c];
-			}
-		      }
-		    }
-		  }
-		}
-	      asum += n;
-	      }
-	    }
-	  // if more than half of neighboring voxels are occupied, then fill
-	  if (n >= nmin)
-	    {
-	    for (int c = 0; c < numscalars; c++)
-	      {
-	      vtkUltraRound(sum[c]/asum, outPtrX[c]);
-	      }
-	    // set alpha to 1 now, change to 255 later
-	    outPtrX[numscalars] = 1;
-	    }
-	  }
-	  outPtrX += incX;
-	}
-      }
-    }
-
-  // change alpha value '1' to value '255'
-  alphaPtr = outPtr + numscalars;
-  // go through all voxels this time
-  for (idZ = outExt[4]; idZ <= outExt[5]; idZ++)
-    {
-    for (idY = outExt[2]; idY <= outExt[3]; idY++)
-      {
-      for (idX = outExt[0]; idX <= outExt[1]; idX++)
-	{
-	// convert '1' to 255
-	if (*alphaPtr == 1)
-	  {
-	  *alphaPtr = 255;
-	  }
-	alphaPtr += incX;
-	}
-      // add the continuous increment
-      alphaPtr += (incY - (outExt[1]-outExt[0]+1)*incX);
-      }
-    // add the continuous increment
-    alphaPtr += (incZ - (outExt[3]-outExt[2]+1)*incY);
-    }
-}
-
 //----------------------------------------------------------------------------
 void vtkFreehandUltrasound::ThreadedFillExecute(vtkImageData *outData,	
                                             	int outExt[6], int threadId)
@@ -1717,18 +1110,18 @@ void vtkFreehandUltrasound::ThreadedFillExecute(vtkImageData *outData,
   switch (outData->GetScalarType())
     {
     case VTK_SHORT:
-      vtkFreehandUltrasoundFillHolesInOutput(
-                             this, outData, (short *)(outPtr), 
+      vtkFreehandFillHolesInOutput(
+                             outData, (short *)(outPtr), 
                              (unsigned short *)(accPtr), outExt);
       break;
     case VTK_UNSIGNED_SHORT:
-      vtkFreehandUltrasoundFillHolesInOutput(
-                             this, outData, (unsigned short *)(outPtr),
+      vtkFreehandFillHolesInOutput(
+                             outData, (unsigned short *)(outPtr),
                              (unsigned short *)(accPtr), outExt);
       break;
     case VTK_UNSIGNED_CHAR:
-      vtkFreehandUltrasoundFillHolesInOutput(
-                             this, outData,(unsigned char *)(outPtr),
+      vtkFreehandFillHolesInOutput(
+                             outData, (unsigned char *)(outPtr),
                              (unsigned short *)(accPtr), outExt); 
       break;
     default:
@@ -1834,18 +1227,18 @@ void vtkFreehandUltrasound::FillHolesInOutput()
   switch (outData->GetScalarType())
     {
     case VTK_SHORT:
-      vtkFreehandUltrasoundFillHolesInOutput(
-                             this, outData, (short *)(outPtr), 
+      vtkFreehandFillHolesInOutput(
+                             outData, (short *)(outPtr), 
                              (unsigned short *)(accPtr), outExt);
       break;
     case VTK_UNSIGNED_SHORT:
-      vtkFreehandUltrasoundFillHolesInOutput(
-                             this, outData, (unsigned short *)(outPtr),
+      vtkFreehandFillHolesInOutput(
+                             outData, (unsigned short *)(outPtr),
                              (unsigned short *)(accPtr), outExt);
       break;
     case VTK_UNSIGNED_CHAR:
-      vtkFreehandUltrasoundFillHolesInOutput(
-                             this, outData,(unsigned char *)(outPtr),
+      vtkFreehandFillHolesInOutput(
+                             outData, (unsigned char *)(outPtr),
                              (unsigned short *)(accPtr), outExt); 
       break;
     default:
@@ -1910,27 +1303,6 @@ void vtkFreehandUltrasound::InternalClearOutput()
   this->NeedsClear = 0;
 }
 
-//----------------------------------------------------------------------------
-// check a matrix to see whether it is the identity matrix
-
-static int vtkIsIdentityMatrix(vtkMatrix4x4 *matrix)
-{
-  static double identity[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
-  int i,j;
-
-  for (i = 0; i < 4; i++)
-    {
-    for (j = 0; j < 4; j++)
-      {
-      if (matrix->GetElement(i,j) != identity[4*i+j])
-        {
-        return 0;
-        }
-      }
-    }
-  return 1;
-}
-
 //----------------------------------------------------------------------------
 // The transform matrix supplied by the user converts output coordinates
 // to input coordinates.  
@@ -2011,903 +1383,84 @@ vtkMatrix4x4 *vtkFreehandUltrasound::GetIndexMatrix()
 //----------------------------------------------------------------------------
 
 //----------------------------------------------------------------------------
-// helper functions for vtkOptimizedExecute()
+// Insert the slice with optimization, with the shared kernels in
+// vtkFreehandUltrasoundCore.h.  This class always compounds with the
+// saturated mean.
+template <class F, class T>
+static void vtkOptimizedInsertSlice(vtkFreehandUltrasound *self,
+                                    vtkImageData *outData, T *outPtr,
+                                    unsigned short *accPtr,
+                                    vtkImageData *inData, T *inPtr,
+                                    int inExt[6],
+                                    F matrix[4][4], int threadId)
+{
+  vtkUltrasoundFanMask *mask = vtkFreehandGetFanMask(self, inData, 1, 0, 0);
 
-// find approximate intersection of line with the plane x = x_min,
-// y = y_min, or z = z_min (lower limit of data extent) 
+  int hits =
+    vtkFreehandOptimizedInsertSlice<vtkFreehandCompoundSaturatedMean>(
+      self->GetInterpolationMode(), self, mask, outData, outPtr, accPtr,
+      (T *)0, inData, inPtr, inExt, matrix, 0, 0, 0, threadId);
+  self->IncrementPixelCount(threadId, hits);
 
-template<class F>
-static inline
-int intersectionHelper(F *point, F *axis, int *limit, int ai, int *inExt)
-{
-  F rd = limit[ai]*point[3]-point[ai]  + 0.5; 
-    
-  if (rd < inExt[0])
-    { 
-    return inExt[0];
-    }
-  else if (rd > inExt[1])
-    {
-    return inExt[1];
-    }
-  else
-    {
-    return int(rd);
-    }
+  vtkUltrasoundFanMask::ReleaseCachedMask(mask);
 }
 
-template <class F>
-static int intersectionLow(F *point, F *axis, int *sign,
-                           int *limit, int ai, int *inExt)
+// this mess is really a simple function. All it does is call
+// the ThreadedExecute method after setting the correct
+// extent for this thread. Its just a pain to calculate
+// the correct extent.
+VTK_THREAD_RETURN_TYPE vtkFreehandThreadedExecute( void *arg )
 {
-  // approximate value of r
-  int r = intersectionHelper(point,axis,limit,ai,inExt);
+  vtkFreehandThreadStruct *str;
+  int ext[6], splitExt[6], total;
+  int threadId, threadCount;
+  vtkImageData *input;
 
-  // move back and forth to find the point just inside the extent
-  for (;;)
-    {
-    F p = point[ai]+r*axis[ai];
+  threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
 
-    if ((sign[ai] < 0 && r > inExt[0] ||
-         sign[ai] > 0 && r < inExt[1]) && 
-        vtkUltraRound(p) < limit[ai])
-      {
-      r += sign[ai];
-      }
-    else
-      {
-      break;
-      }
-    }
+  str = (vtkFreehandThreadStruct *)(((ThreadInfoStruct *)(arg))->UserData);
+  input = str->Input;
+  input->GetUpdateExtent( ext );
 
-  for (;;)
+  // execute the actual method with appropriate extent
+  // first find out how many pieces extent can be split into.
+  total = str->Filter->SplitSliceExtent(splitExt, ext, threadId, threadCount);
+  //total = 1;
+  
+  if (threadId < total)
     {
-    F p = point[ai]+(r-sign[ai])*axis[ai];
-
-    if ((sign[ai] > 0 && r > inExt[0] ||
-         sign[ai] < 0 && r < inExt[1]) && 
-        vtkUltraRound(p) >= limit[ai])
-      {
-      r -= sign[ai];
-      }
-    else
-      {
-      break;
-      }
+    str->Filter->ThreadedSliceExecute(str->Input, str->Output,
+				      splitExt, threadId);
     }
-
-  return r;
+  // else
+  //   {
+  //   otherwise don't use this thread. Sometimes the threads dont
+  //   break up very well and it is just as efficient to leave a 
+  //   few threads idle.
+  //   }
+  
+  return VTK_THREAD_RETURN_VALUE;
 }
 
-// same as above, but for x = x_max
-template <class F>
-static int intersectionHigh(F *point, F *axis, int *sign, 
-                            int *limit, int ai, int *inExt)
+//----------------------------------------------------------------------------
+// For streaming and threads.  Splits output update extent into num pieces.
+// This method needs to be called num times.  Results must not overlap for
+// consistent starting extent.  Subclass can override this method.
+// This method returns the number of peices resulting from a successful split.
+// This can be from 1 to "total".  
+// If 1 is returned, the extent cannot be split.
+int vtkFreehandUltrasound::SplitSliceExtent(int splitExt[6],
+					     int startExt[6], 
+					     int num, int total)
 {
-  // approximate value of r
-  int r = intersectionHelper(point,axis,limit,ai,inExt);
-    
-  // move back and forth to find the point just inside the extent
-  for (;;)
-    {
-    F p = point[ai]+r*axis[ai];
+  vtkDebugMacro("SplitSliceExtent: ( " << startExt[0] << ", " << startExt[1]
+		<< ", "
+                << startExt[2] << ", " << startExt[3] << ", "
+                << startExt[4] << ", " << startExt[5] << "), " 
+                << num << " of " << total);
 
-    if ((sign[ai] > 0 && r > inExt[0] ||
-         sign[ai] < 0 && r < inExt[1]) &&
-        vtkUltraRound(p) > limit[ai])
-      {
-      r -= sign[ai];
-      }
-    else
-      {
-      break;
-      }
-    }
-
-  for (;;)
-    {
-    F p = point[ai]+(r+sign[ai])*axis[ai];
-
-    if ((sign[ai] < 0 && r > inExt[0] ||
-         sign[ai] > 0 && r < inExt[1]) && 
-        vtkUltraRound(p) <= limit[ai])
-      {
-      r += sign[ai];
-      }
-    else
-      {
-      break;
-      }
-    }
-
-  return r;
-}
-
-template <class F>
-static int isBounded(F *point, F *xAxis, int *inMin, 
-                     int *inMax, int ai, int r)
-{
-  int bi = ai+1; 
-  int ci = ai+2;
-  if (bi > 2) 
-    { 
-    bi -= 3; // coordinate index must be 0, 1 or 2 
-    } 
-  if (ci > 2)
-    { 
-    ci -= 3;
-    }
-
-  F fbp = point[bi]+r*xAxis[bi];
-  F fcp = point[ci]+r*xAxis[ci];
-
-  int bp = vtkUltraRound(fbp);
-  int cp = vtkUltraRound(fcp);
-  
-  return (bp >= inMin[bi] && bp <= inMax[bi] &&
-          cp >= inMin[ci] && cp <= inMax[ci]);
-}
-
-// this huge mess finds out where the current output raster
-// line intersects the input volume
-
-static void vtkUltraFindExtentHelper(int &r1, int &r2, int sign, int *inExt)
-{
-  if (sign < 0)
-    {
-    int i = r1;
-    r1 = r2;
-    r2 = i;
-    }
-  
-  // bound r1,r2 within reasonable limits
-  if (r1 < inExt[0]) 
-    {
-    r1 = inExt[0];
-    }
-  if (r2 > inExt[1]) 
-    {
-    r2 = inExt[1];
-    }
-  if (r1 > r2) 
-    {
-    r1 = inExt[0];
-    r2 = inExt[0]-1;
-    }
-}  
-
-template <class F>
-static void vtkUltraFindExtent(int& r1, int& r2, F *point, F *xAxis, 
-                                 int *inMin, int *inMax, int *inExt)
-{
-  int i, ix, iy, iz;
-  int sign[3];
-  int indx1[4],indx2[4];
-  F p1,p2;
-
-  // find signs of components of x axis 
-  // (this is complicated due to the homogeneous coordinate)
-  for (i = 0; i < 3; i++)
-    {
-    p1 = point[i];
-
-    p2 = point[i]+xAxis[i];
-
-    if (p1 <= p2)
-      {
-      sign[i] = 1;
-      }
-    else 
-      {
-      sign[i] = -1;
-      }
-    } 
-  
-  // order components of xAxis from largest to smallest
-  
-  ix = 0;
-  for (i = 1; i < 3; i++)
-    {
-    if (((xAxis[i] < 0) ? (-xAxis[i]) : (xAxis[i])) >
-        ((xAxis[ix] < 0) ? (-xAxis[ix]) : (xAxis[ix])))
-      {
-      ix = i;
-      }
-    }
-  
-  iy = ((ix > 1) ? ix-2 : ix+1);
-  iz = ((ix > 0) ? ix-1 : ix+2);
-
-  if (((xAxis[iy] < 0) ? (-xAxis[iy]) : (xAxis[iy])) >
-      ((xAxis[iz] < 0) ? (-xAxis[iz]) : (xAxis[iz])))
-    {
-    i = iy;
-    iy = iz;
-    iz = i;
-    }
-
-  r1 = intersectionLow(point,xAxis,sign,inMin,ix,inExt);
-  r2 = intersectionHigh(point,xAxis,sign,inMax,ix,inExt);
-  
-  // find points of intersections
-  // first, find w-value for perspective (will usually be 1)
-  for (i = 0; i < 3; i++)
-    {
-    p1 = point[i]+r1*xAxis[i];
-    p2 = point[i]+r2*xAxis[i];
-
-    indx1[i] = vtkUltraRound(p1);
-    indx2[i] = vtkUltraRound(p2);
-    }
-  if (isBounded(point,xAxis,inMin,inMax,ix,r1))
-    { // passed through x face, check opposing face
-    if (isBounded(point,xAxis,inMin,inMax,ix,r2))
-      {
-      vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-      return;
-      }
-    
-    if (indx2[iy] < inMin[iy])
-      { // check y face
-      r2 = intersectionLow(point,xAxis,sign,inMin,iy,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iy,r2))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    else if (indx2[iy] > inMax[iy])
-      { // check other y face
-      r2 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iy,r2))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    
-    if (indx2[iz] < inMin[iz])
-      { // check z face
-      r2 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    else if (indx2[iz] > inMax[iz])
-      { // check other z face
-      r2 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    }
-  
-  if (isBounded(point,xAxis,inMin,inMax,ix,r2))
-    { // passed through the opposite x face
-    if (indx1[iy] < inMin[iy])
-      { // check y face
-      r1 = intersectionLow(point,xAxis,sign,inMin,iy,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iy,r1))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    else if (indx1[iy] > inMax[iy])
-      { // check other y face
-      r1 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iy,r1))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    
-    if (indx1[iz] < inMin[iz])
-      { // check z face
-      r1 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    else if (indx1[iz] > inMax[iz])
-      { // check other z face
-      r1 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    }
-  
-  if ((indx1[iy] >= inMin[iy] && indx2[iy] < inMin[iy]) ||
-      (indx1[iy] < inMin[iy] && indx2[iy] >= inMin[iy]))
-    { // line might pass through bottom face
-    r1 = intersectionLow(point,xAxis,sign,inMin,iy,inExt);
-    if (isBounded(point,xAxis,inMin,inMax,iy,r1))
-      {
-      if ((indx1[iy] <= inMax[iy] && indx2[iy] > inMax[iy]) ||
-          (indx1[iy] > inMax[iy] && indx2[iy] <= inMax[iy]))
-        { // line might pass through top face
-        r2 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iy,r2))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        }
-      
-      if (indx1[iz] < inMin[iz] && indx2[iy] < inMin[iy] ||
-          indx2[iz] < inMin[iz] && indx1[iy] < inMin[iy])
-        { // line might pass through in-to-screen face
-        r2 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        }
-      else if (indx1[iz] > inMax[iz] && indx2[iy] < inMin[iy] ||
-               indx2[iz] > inMax[iz] && indx1[iy] < inMin[iy])
-        { // line might pass through out-of-screen face
-        r2 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        } 
-      }
-    }
-  
-  if ((indx1[iy] <= inMax[iy] && indx2[iy] > inMax[iy]) ||
-      (indx1[iy] > inMax[iy] && indx2[iy] <= inMax[iy]))
-    { // line might pass through top face
-    r2 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
-    if (isBounded(point,xAxis,inMin,inMax,iy,r2))
-      {
-      if (indx1[iz] < inMin[iz] && indx2[iy] > inMax[iy] ||
-          indx2[iz] < inMin[iz] && indx1[iy] > inMax[iy])
-        { // line might pass through in-to-screen face
-        r1 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        }
-      else if (indx1[iz] > inMax[iz] && indx2[iy] > inMax[iy] || 
-               indx2[iz] > inMax[iz] && indx1[iy] > inMax[iy])
-        { // line might pass through out-of-screen face
-        r1 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        }
-      } 
-    }
-  
-  if ((indx1[iz] >= inMin[iz] && indx2[iz] < inMin[iz]) ||
-      (indx1[iz] < inMin[iz] && indx2[iz] >= inMin[iz]))
-    { // line might pass through in-to-screen face
-    r1 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-    if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-      {
-      if (indx1[iz] > inMax[iz] || indx2[iz] > inMax[iz])
-        { // line might pass through out-of-screen face
-        r2 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iz],inExt);
-          return;
-          }
-        }
-      }
-    }
-  
-  r1 = inExt[0];
-  r2 = inExt[0] - 1;
-}
-
-// The vtkOptimizedExecute() function uses an optimization which
-// is conceptually simple, but complicated to implement.
-
-// In the un-optimized version, each output voxel
-// is converted into a set of look-up indices for the input data;
-// then, the indices are checked to ensure they lie within the
-// input data extent.
-
-// In the optimized version below, the check is done in reverse:
-// it is first determined which output voxels map to look-up indices
-// within the input data extent.  Then, further calculations are
-// done only for those voxels.  This means that 1) minimal work
-// is done for voxels which map to regions outside fo the input
-// extent (they are just set to the background color) and 2)
-// the inner loops of the look-up and interpolation are
-// tightened relative to the un-uptimized version. 
-
-template<class T>
-static inline void vtkFreehandOptimizedNNHelper(int r1, int r2,
-                                                double *outPoint,
-                                                double *outPoint1,
-						double *xAxis,
-                                                T *&inPtr, T *outPtr,
-                                                int *outExt, vtkIdType *outInc,
-                                                int numscalars, 
-                                                unsigned short *accPtr)
-{
-  if (accPtr)  // Nearest-Neighbor, no extent checks
-    {
-    for (int idX = r1; idX <= r2; idX++)
-      {
-      outPoint[0] = outPoint1[0] + idX*xAxis[0]; 
-      outPoint[1] = outPoint1[1] + idX*xAxis[1];
-      outPoint[2] = outPoint1[2] + idX*xAxis[2];
-
-      int outIdX = vtkUltraRound(outPoint[0]) - outExt[0];
-      int outIdY = vtkUltraRound(outPoint[1]) - outExt[2];
-      int outIdZ = vtkUltraRound(outPoint[2]) - outExt[4];
-
-      /* bounds checking turned off to improve performance
-      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
-          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
-          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
-        {
-        cerr << "out of bounds!!!\n";
-        inPtr += numscalars;
-        return;
-        }
-      */
-      vtkIdType inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
-      T *outPtr1 = outPtr + inc;
-      unsigned short *accPtr1 = accPtr + inc/outInc[0];
-      unsigned short newa = *accPtr1 + 255;
-      int i = numscalars;
-      do 
-        {
-        i--;
-        *outPtr1 = ((*inPtr++)*255 + (*outPtr1)*(*accPtr1))/newa;
-        outPtr1++;
-        }
-      while (i);
-      *outPtr1 = 255;
-      *accPtr1 = 65535;
-      if (newa < 65535)
-        {
-        *accPtr1 = newa;
-        }
-      }
-    }
-  else
-    {  // Nearest-Neighbor, no extent checks, no accumulation
-    for (int idX = r1; idX <= r2; idX++)
-      {
-      outPoint[0] = outPoint1[0] + idX*xAxis[0]; 
-      outPoint[1] = outPoint1[1] + idX*xAxis[1];
-      outPoint[2] = outPoint1[2] + idX*xAxis[2];
-
-      int outIdX = vtkUltraRound(outPoint[0]) - outExt[0];
-      int outIdY = vtkUltraRound(outPoint[1]) - outExt[2];
-      int outIdZ = vtkUltraRound(outPoint[2]) - outExt[4];
-
-      /* bounds checking turned off to improve performance
-      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
-          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
-          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
-        {
-        cerr << "out of bounds!!!\n";
-        inPtr += numscalars;
-        return;
-        }
-      */
-
-      vtkIdType inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
-      T *outPtr1 = outPtr + inc;
-      int i = numscalars;
-      do
-        {
-        i--;
-        *outPtr1++ = *inPtr++;
-        }
-      while (i);
-      *outPtr1 = 255;
-      }
-    } 
-}
-
-// specifically optimized for fixed-point (i.e. integer) mathematics
-template <class T>
-static inline void vtkFreehandOptimizedNNHelper(int r1, int r2,
-                                                fixed *outPoint,
-                                                fixed *outPoint1, fixed *xAxis,
-                                                T *&inPtr, T *outPtr,
-                                                int *outExt, vtkIdType *outInc,
-                                                int numscalars, 
-                                                unsigned short *accPtr)
-{
-  outPoint[0] = outPoint1[0] + r1*xAxis[0] - outExt[0]; 
-  outPoint[1] = outPoint1[1] + r1*xAxis[1] - outExt[2];
-  outPoint[2] = outPoint1[2] + r1*xAxis[2] - outExt[4];
-
-  if (accPtr)  // Nearest-Neighbor, no extent checks
-    {
-    for (int idX = r1; idX <= r2; idX++)
-      {
-      int outIdX = vtkUltraRound(outPoint[0]);
-      int outIdY = vtkUltraRound(outPoint[1]);
-      int outIdZ = vtkUltraRound(outPoint[2]);
-
-      /* bounds checking turned off to improve performance
-      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
-          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
-          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
-        {
-        cerr << "out of bounds!!!\n";
-        inPtr += numscalars;
-        return;
-        }
-      */
-      vtkIdType inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
-      T *outPtr1 = outPtr + inc;
-      unsigned short *accPtr1 = accPtr + inc/outInc[0];
-      unsigned short newa = *accPtr1 + 255;
-      int i = numscalars;
-      do 
-        {
-        i--;
-        *outPtr1 = ((*inPtr++)*255 + (*outPtr1)*(*accPtr1))/newa;
-        outPtr1++;
-        }
-      while (i);
-      *outPtr1 = 255;
-      *accPtr1 = 65535;
-      if (newa < 65535)
-        {
-        *accPtr1 = newa;
-        }
-
-      outPoint[0] += xAxis[0];
-      outPoint[1] += xAxis[1];
-      outPoint[2] += xAxis[2];
-      }
-    }
-  else
-    {  // Nearest-Neighbor, no extent checks, no accumulation
-    for (int idX = r1; idX <= r2; idX++)
-      {
-      int outIdX = vtkUltraRound(outPoint[0]);
-      int outIdY = vtkUltraRound(outPoint[1]);
-      int outIdZ = vtkUltraRound(outPoint[2]);
-
-      /* bounds checking turned off to improve performance
-      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
-          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
-          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
-        {
-        cerr << "out of bounds!!!\n";
-        inPtr += numscalars;
-        return;
-        }
-      */
-      vtkIdType inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
-      T *outPtr1 = outPtr + inc;
-      int i = numscalars;
-      do
-        {
-        i--;
-        *outPtr1++ = *inPtr++;
-        }
-      while (i);
-      *outPtr1 = 255;
-
-      outPoint[0] += xAxis[0];
-      outPoint[1] += xAxis[1];
-      outPoint[2] += xAxis[2];
-      }
-    } 
-}
-
-template <class F, class T>
-static void vtkOptimizedInsertSlice(vtkFreehandUltrasound *self,
-                                    vtkImageData *outData, T *outPtr,
-                                    unsigned short *accPtr,
-                                    vtkImageData *inData, T *inPtr,
-                                    int inExt[6],
-                                    F matrix[4][4], int threadId)
-{
-  int id = 0;
-  int i, numscalars;
-  int idX, idY, idZ;
-  vtkIdType inIncX, inIncY, inIncZ;
-  int outExt[6];
-  int outMax[3], outMin[3];
-  vtkIdType outInc[3];
-  int clipExt[6];
-  unsigned long count = 0;
-  unsigned long target;
-  int r1,r2;
-  F outPoint0[3];
-  F outPoint1[3];
-  F outPoint[3];
-  F xAxis[3], yAxis[3], zAxis[3], origin[3];
-  vtkFloatingPointType inSpacing[3],inOrigin[3];
-
-  inData->GetSpacing(inSpacing);
-  inData->GetOrigin(inOrigin);
-
-  double xf = (self->GetFanOrigin()[0]-inOrigin[0])/inSpacing[0];
-  double yf = (self->GetFanOrigin()[1]-inOrigin[1])/inSpacing[1];
-
-  double d2 = self->GetFanDepth()*self->GetFanDepth();
-
-  double xs = inSpacing[0];
-  double ys = inSpacing[1];
-
-  const double degToRad = 0.017453292519943295;
-
-  double ml = tan(self->GetFanAngles()[0]*degToRad)/xs*ys;
-  double mr = tan(self->GetFanAngles()[1]*degToRad)/xs*ys;
-
-  if (ml > mr)
-    {
-    double tmp = ml; ml = mr; mr = tmp;
-    }
-
-  self->GetClipExtent(clipExt, inOrigin, inSpacing, inExt);
-
-  // find maximum output range
-  outData->GetExtent(outExt);
-  for (i = 0; i < 3; i++)
-    {
-    outMin[i] = outExt[2*i];
-    outMax[i] = outExt[2*i+1];
-    }
-  
-  target = (unsigned long)
-    ((inExt[5]-inExt[4]+1)*(inExt[3]-inExt[2]+1)/50.0);
-  target++;
-  
-  // Get Increments to march through data 
-  outData->GetIncrements(outInc);
-  inData->GetContinuousIncrements(inExt, inIncX, inIncY, inIncZ);
-  numscalars = inData->GetNumberOfScalarComponents();
-  
-  // break matrix into a set of axes plus an origin
-  // (this allows us to calculate the transform Incrementally)
-  for (i = 0; i < 3; i++)
-    {
-    xAxis[i]  = matrix[i][0];
-    yAxis[i]  = matrix[i][1];
-    zAxis[i]  = matrix[i][2];
-    origin[i] = matrix[i][3];
-    }
-
-  // Loop through input pixels
-  for (idZ = inExt[4]; idZ <= inExt[5]; idZ++)
-    {
-    outPoint0[0] = origin[0]+idZ*zAxis[0]; // incremental transform
-    outPoint0[1] = origin[1]+idZ*zAxis[1];
-    outPoint0[2] = origin[2]+idZ*zAxis[2];
-    
-    for (idY = inExt[2]; idY <= inExt[3]; idY++)
-      {
-      outPoint1[0] = outPoint0[0]+idY*yAxis[0]; // incremental transform
-      outPoint1[1] = outPoint0[1]+idY*yAxis[1];
-      outPoint1[2] = outPoint0[2]+idY*yAxis[2];
-      
-      if (!id) 
-        {
-        if (!(count%target)) 
-          {
-          self->UpdateProgress(count/(50.0*target));
-          }
-        count++;
-        }
-      
-      // find intersections of x raster line with the output extent
-      vtkUltraFindExtent(r1,r2,outPoint1,xAxis,outMin,outMax,inExt);
-           
-      // next, handle the 'fan' shape of the input
-      double y = (yf - idY);
-      if (ys < 0)
-        {
-        y = -y;
-        }
-      if (!(ml == 0 && mr == 0))
-        {
-        // first, check the angle range of the fan
-	if (r1 < -vtkUltraFloor(-(ml*y + xf + 1)))
-          {
-          r1 = -vtkUltraFloor(-(ml*y + xf + 1));
-          }
-	  if (r2 > vtkUltraFloor(mr*y + xf - 1))
-          {
-	  r2 = vtkUltraFloor(mr*y + xf - 1);
-          }
-      
-        // next, check the radius of the fan
-        double dx = (d2 - (y*y)*(ys*ys))/(xs*xs);
-        if (dx < 0)
-          {
-          r1 = inExt[0];
-          r2 = inExt[0]-1;
-          }
-        else
-          {
-          dx = sqrt(dx);
-          if (r1 < -vtkUltraFloor(-(xf - dx + 1)))
-            {
-	    r1 = -vtkUltraFloor(-(xf - dx + 1));
-            }
-          if (r2 > vtkUltraFloor(xf + dx - 1))
-            {
-	    r2 = vtkUltraFloor(xf + dx - 1);
-            }
-          }
-        }
-
-      // bound to the ultrasound clip rectangle
-      if (r1 < clipExt[0])
-        {
-        r1 = clipExt[0];
-        }
-      if (r2 > clipExt[1])
-        {
-        r2 = clipExt[1];
-        }
-      if (r1 > r2 || idY < clipExt[2] || idY > clipExt[3]) 
-        {
-        r1 = inExt[0];
-        r2 = inExt[0]-1;
-        }
-
-      // skip the portion of the slice that we don't want to include
-      for (idX = inExt[0]; idX < r1; idX++)
-        {
-        inPtr += numscalars;
-        }
-       if (self->GetInterpolationMode() == VTK_FREEHAND_LINEAR)
-        { 
-        for (idX = r1; idX <= r2; idX++)
-          {
-          outPoint[0] = outPoint1[0] + idX*xAxis[0];
-          outPoint[1] = outPoint1[1] + idX*xAxis[1];
-          outPoint[2] = outPoint1[2] + idX*xAxis[2];
-          
-          int hit = vtkTrilinearInterpolation(outPoint, inPtr, outPtr, accPtr, 
-                                    numscalars, outExt, outInc);
-	  inPtr += numscalars;
-	  //self->PixelCount += hit;
-	  self->IncrementPixelCount(threadId, hit);
-          }
-        }
-      else 
-        {
-        vtkFreehandOptimizedNNHelper(r1, r2, outPoint, outPoint1, xAxis, 
-                                     inPtr, outPtr, outExt, outInc,
-                                     numscalars, accPtr);
-	// self->PixelCount += r2-r1+1;
-	self->IncrementPixelCount(threadId, r2-r1+1);
-        }
-  
-      // skip the portion of the slice we don't want to reconstruct
-      for (idX = r2+1; idX <= inExt[1]; idX++)
-        {
-        inPtr += numscalars;
-        }
-
-      inPtr += inIncY;
-      }
-    inPtr += inIncZ;
-    }
-}
-
-
-// this mess is really a simple function. All it does is call
-// the ThreadedExecute method after setting the correct
-// extent for this thread. Its just a pain to calculate
-// the correct extent.
-VTK_THREAD_RETURN_TYPE vtkFreehandThreadedExecute( void *arg )
-{
-  vtkFreehandThreadStruct *str;
-  int ext[6], splitExt[6], total;
-  int threadId, threadCount;
-  vtkImageData *input;
-
-  threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
-  threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
-
-  str = (vtkFreehandThreadStruct *)(((ThreadInfoStruct *)(arg))->UserData);
-  input = str->Input;
-  input->GetUpdateExtent( ext );
-
-  // execute the actual method with appropriate extent
-  // first find out how many pieces extent can be split into.
-  total = str->Filter->SplitSliceExtent(splitExt, ext, threadId, threadCount);
-  //total = 1;
-  
-  if (threadId < total)
-    {
-    str->Filter->ThreadedSliceExecute(str->Input, str->Output,
-				      splitExt, threadId);
-    }
-  // else
-  //   {
-  //   otherwise don't use this thread. Sometimes the threads dont
-  //   break up very well and it is just as efficient to leave a 
-  //   few threads idle.
-  //   }
-  
-  return VTK_THREAD_RETURN_VALUE;
-}
-
-//----------------------------------------------------------------------------
-// For streaming and threads.  Splits output update extent into num pieces.
-// This method needs to be called num times.  Results must not overlap for
-// consistent starting extent.  Subclass can override this method.
-// This method returns the number of peices resulting from a successful split.
-// This can be from 1 to "total".  
-// If 1 is returned, the extent cannot be split.
-int vtkFreehandUltrasound::SplitSliceExtent(int splitExt[6],
-					     int startExt[6], 
-					     int num, int total)
-{
-  int splitAxis;
-  int min, max;
-
-  vtkDebugMacro("SplitSliceExtent: ( " << startExt[0] << ", " << startExt[1]
-		<< ", "
-                << startExt[2] << ", " << startExt[3] << ", "
-                << startExt[4] << ", " << startExt[5] << "), " 
-                << num << " of " << total);
-
-  // start with same extent
-  memcpy(splitExt, startExt, 6 * sizeof(int));
-
-  splitAxis = 2;
-  min = startExt[4];
-  max = startExt[5];
-  while (min == max)
-    {
-    --splitAxis;
-    if (splitAxis < 0)
-      { // cannot split
-      vtkDebugMacro("  Cannot Split");
-      return 1;
-      }
-    min = startExt[splitAxis*2];
-    max = startExt[splitAxis*2+1];
-    }
-
-  // determine the actual number of pieces that will be generated
-  int range = max - min + 1;
-  int valuesPerThread = (int)ceil(range/(double)total);
-  int maxThreadIdUsed = (int)ceil(range/(double)valuesPerThread) - 1;
-  if (num < maxThreadIdUsed)
-    {
-    splitExt[splitAxis*2] = splitExt[splitAxis*2] + num*valuesPerThread;
-    splitExt[splitAxis*2+1] = splitExt[splitAxis*2] + valuesPerThread - 1;
-    }
-  if (num == maxThreadIdUsed)
-    {
-    splitExt[splitAxis*2] = splitExt[splitAxis*2] + num*valuesPerThread;
-    }
-  /*
-  vtkDebugMacro("  Split Piece: ( " <<splitExt[0]<< ", " <<splitExt[1]<< ", "
-                << splitExt[2] << ", " << splitExt[3] << ", "
-                << splitExt[4] << ", " << splitExt[5] << ")");
-  */
-
-  return maxThreadIdUsed + 1;
+  return vtkFreehandSplitSliceExtent(splitExt, startExt, num, total);
 }
 
 void vtkFreehandUltrasound::MultiThread(vtkImageData *inData,
@@ -3111,64 +1664,6 @@ void vtkFreehandUltrasound::ThreadedSliceExecute(
     }
 }
 
-//----------------------------------------------------------------------------
-// platform-independent sleep function
-static inline void vtkSleep(double duration)
-{
-  duration = duration; // avoid warnings
-  // sleep according to OS preference
-#ifdef _WIN32
-  Sleep(vtkUltraFloor(1000*duration));
-#elif defined(__FreeBSD__) || defined(__linux__) || defined(sgi)
-  struct timespec sleep_time, remaining_time;
-  int seconds = vtkUltraFloor(duration);
-  int nanoseconds = vtkUltraFloor(1000000000*(duration - seconds));
-  sleep_time.tv_sec = seconds;
-  sleep_time.tv_nsec = nanoseconds;
-  nanosleep(&sleep_time, &remaining_time);
-#endif
-}
-
-//----------------------------------------------------------------------------
-// Sleep until the specified absolute time has arrived.
-// You must pass a handle to the current thread.  
-// If '0' is returned, then the thread was aborted before or during the wait.
-static int vtkThreadSleep(struct ThreadInfoStruct *data, double time)
-{
-  //fprintf(stderr,"sleep = %f\n",time-vtkTimerLog::GetCurrentTime());
-  for (;;)
-    {
-    // slice 10 millisecs off the time, since this is how long it will
-    // take for this thread to start executing once it has been
-    // re-scheduled
-    //  vtkTimerLog::GetCurrentTime() is depracated and replace with
-    //GetUniversalTime in VTK 5:
-    double remaining = time - vtkTimerLog::GetUniversalTime() - 0.01;
-
-    // check to see if we have reached the specified time
-    if (remaining <= 0)
-      {
-	//fprintf(stderr,"remaining = %f\n",remaining+0.01);
-      return 1;
-      }
-    // check the ActiveFlag at least every 0.1 seconds
-    if (remaining > 0.1)
-      {
-      remaining = 0.1;
-      }
-
-    // check to see if we are being told to quit 
-    if (*(data->ActiveFlag) == 0)
-      {
-      return 0;
-      }
-    
-    vtkSleep(remaining);
-    }
-
-  return 1;
-}
-
 //----------------------------------------------------------------------------
 // This function is run in a background thread to perform the reconstruction.
 // By running it in the background, it doesn't interfere with the display
@@ -8,6 +8,7 @@ Copyright (c) 2000,2002 David Gobbi.
 #include <float.h>
 #include <math.h>
 #include <stdio.h>
+#include <vector>
 
 // includes for mkdir
 #ifdef _WIN32
@@ -18,6 +19,7 @@ Copyright (c) 2000,2002 David Gobbi.
 #endif
 
 #include "fixed.h"
+#include "vtkFreehandUltrasoundCore.h"
 #include "vtkStreamingDemandDrivenPipeline.h"
 #include "vtkExecutive.h"
 #include "vtkInformation.h"
@@ -28,6 +30,8 @@ Copyright (c) 2000,2002 David Gobbi.
 #include "vtkTransform.h"
 #include "vtkImageAlgorithm.h"
 #include "vtkImageData.h"
+#include "vtkPointData.h"
+#include "vtkDataArray.h"
 #include "vtkMultiThreader.h"
 #include "vtkCriticalSection.h"
 #include "vtkTimerLog.h"
@@ -37,9 +41,10 @@ Copyright (c) 2000,2002 David Gobbi.
 #include "vtkTrackerTool.h"
 #include "vtkMutexLock.h"
 #include "vtkCriticalSection.h"
-#include "vtkImageThreshold.h" // added by Danielle
-#include "vtkImageClip.h" // added by Danielle
 #include "vtkImageFlip.h" // added by Danielle
+#include "vtkUltrasoundSweepFile.h"
+#include "vtkUltrasoundFanMask.h"
+#include "vtkUltrasoundAnnotationDecoder.h"
 
 vtkCxxRevisionMacro(vtkFreehandUltrasound2, "$Revision: 1.4 $");
 vtkStandardNewMacro(vtkFreehandUltrasound2);
@@ -70,9 +75,8 @@ vtkCxxSetObjectMacro(vtkFreehandUltrasound2,SliceTransform,vtkLinearTransform);
 
 // added by danielle
 //vtkCxxSetObjectMacro(vtkFreehandUltrasound2, DepthClipData, vtkImageClip);
-vtkCxxSetObjectMacro(vtkFreehandUltrasound2, RotationClipData, vtkImageClip);
 //vtkCxxSetObjectMacro(vtkFreehandUltrasound2, DepthThreshold, vtkImageThreshold);
-vtkCxxSetObjectMacro(vtkFreehandUltrasound2, RotationThreshold, vtkImageThreshold);
+vtkCxxSetObjectMacro(vtkFreehandUltrasound2, RotationDecoder, vtkUltrasoundAnnotationDecoder);
 //vtkCxxSetObjectMacro(vtkFreehandUltrasound2, FlipThreshold, vtkImageThreshold);
 vtkCxxSetObjectMacro(vtkFreehandUltrasound2, FlipTransform, vtkTransform);
 
@@ -85,6 +89,42 @@ struct vtkFreehand2ThreadStruct
   vtkImageData   *Output;
 };
 
+// the frames waiting to be inserted into the full-resolution output while
+// the preview is being built, with their index matrices: Frames is used
+// as a circular buffer, and Free holds frames that can be reused
+struct vtkFreehand2FrameQueue
+{
+  std::vector<vtkImageData *> Frames;
+  std::vector<vtkImageData *> Free;
+  std::vector<double> Matrices;
+  int First;
+  int Count;
+
+  vtkFreehand2FrameQueue() : First(0), Count(0) {};
+
+  void Clear()
+    {
+    this->Flush();
+    for (size_t i = 0; i < this->Free.size(); i++)
+      {
+      this->Free[i]->Delete();
+      }
+    this->Free.clear();
+    this->Frames.clear();
+    this->Matrices.clear();
+    }
+
+  void Flush()
+    {
+    for (; this->Count > 0; this->Count--)
+      {
+      this->Free.push_back(this->Frames[this->First]);
+      this->First = (this->First + 1) % this->Frames.size();
+      }
+    this->First = 0;
+    }
+};
+
 //----------------------------------------------------------------------------
 // Constructor
 // Just initialize objects and set initial values for attributes
@@ -101,11 +141,11 @@ cout << "HI I'm in Danielle's new code!\n";
   // video information)
   this->VideoLag = 0.0;
 
-  // TODO one PixelCount for each threadId, where 0 <= threadId < 4
-  this->PixelCount[0] = 0;
-  this->PixelCount[1] = 0;
-  this->PixelCount[2] = 0;
-  this->PixelCount[3] = 0;
+  // one PixelCount for each threadId, where 0 <= threadId < VTK_MAX_THREADS
+  for (int t = 0; t < VTK_MAX_THREADS; t++)
+    {
+    this->PixelCount[t] = 0;
+    }
   // set up the output (it will have been created in the superclass)
   // (the output is the reconstruction volume, the second component
   // is the alpha component that stores whether or not a voxel has
@@ -168,6 +208,7 @@ cout << "HI I'm in Danielle's new code!\n";
   // quality parameters
   this->InterpolationMode = VTK_FREEHAND_NEAREST; // no interpolation
   this->Compounding = 0; // don't average data, overwrite instead
+  this->CompoundingMode = VTK_FREEHAND_COMPOUND_MEAN;
 
   // optimization: 
   //   0 means no optimization (almost never used)
@@ -209,6 +250,39 @@ cout << "HI I'm in Danielle's new code!\n";
   // one thread for each CPU is used for the reconstruction
   this->Threader = vtkMultiThreader::New();
   this->NumberOfThreads = 1;//this->Threader->GetNumberOfThreads();  
+
+  // hole filling: the frontier kernels use all of the CPUs
+  this->HoleFillingMode = VTK_FREEHAND_HOLE_FILL_AVERAGE;
+  this->HoleFillingRadius = 1;
+  this->HoleFillingSigma = 1.0;
+  this->HoleFillingMaxPasses = 8;
+  this->HoleFillingMinNeighbors = 1;
+  this->HoleFillingNumberOfThreads = this->Threader->GetNumberOfThreads();
+
+  // batch reconstruction: use all of the CPUs
+  this->BatchNumberOfThreads = this->Threader->GetNumberOfThreads();
+  this->BatchSize = 64;
+
+  // preview during real-time reconstruction
+  this->Preview = 0;
+  this->PreviewShrinkFactor = 4;
+  this->PreviewOutput = vtkImageData::New();
+  this->PreviewAccumulationBuffer = vtkImageData::New();
+  this->FullResolutionMode = VTK_FREEHAND_FULL_RES_BACKGROUND;
+  this->FullResolutionQueueLength = 8;
+  this->FullResolutionDroppedFrames = 0;
+  this->DeferredFrameCount = 0;
+  this->DeferredFirstFrame = 0;
+  this->FullResolutionThreadId = -1;
+  this->FullResolutionQueue = new vtkFreehand2FrameQueue;
+  this->FullResolutionLock = vtkCriticalSection::New();
+  this->FullResolutionInsertLock = vtkCriticalSection::New();
+
+  // for saving and reading sweep files
+  this->SweepFile = NULL;
+  this->SweepFrame = NULL;
+  this->SweepRecorder = NULL;
+  this->SweepLock = vtkCriticalSection::New();
   
   // for running the reconstruction in the background
   this->VideoSource = NULL;
@@ -221,13 +295,21 @@ cout << "HI I'm in Danielle's new code!\n";
   this->ReconstructionFrameCount = 0; // # of frames to reconstruct
   this->ActiveFlagLock = vtkCriticalSection::New();
 
+  // what to do with the frames that arrive while a frame is inserted
+  this->FramePolicy = VTK_FREEHAND_FRAME_POLICY_NEWEST;
+  this->MaximumLatency = 0.25;
+  this->MinimumSliceSeparation = 0.5;
+  this->DroppedFrameCount = 0;
+  this->MergedFrameCount = 0;
+  this->FrameLatency = 0;
+  this->WaitingFrame = vtkImageData::New();
+
   // added by Danielle
   this->FanRotation = 0;
   this->PreviousFanRotation = 0;
  // this->DepthClipData = NULL;
-  this->RotationClipData = NULL;
  // this->DepthThreshold = NULL;
-  this->RotationThreshold = NULL;
+  this->RotationDecoder = NULL;
   //this->FlipThreshold = NULL;
   //this->ImageIsFlipped = -1; // we don't know
   this->FlipTransform = vtkTransform::New();
@@ -243,6 +325,7 @@ cout << "HI I'm in Danielle's new code!\n";
 vtkFreehandUltrasound2::~vtkFreehandUltrasound2()
 {
   this->StopRealTimeReconstruction();
+  this->StopSweepRecording();
 
   // TODO why setting these to NULL instead of deleting them?
   this->SetSlice(NULL);
@@ -261,6 +344,13 @@ vtkFreehandUltrasound2::~vtkFreehandUltrasound2()
     {
     this->AccumulationBuffer->Delete();
     }
+  this->PreviewOutput->Delete();
+  this->PreviewAccumulationBuffer->Delete();
+  this->WaitingFrame->Delete();
+  this->FullResolutionQueue->Clear();
+  delete this->FullResolutionQueue;
+  this->FullResolutionLock->Delete();
+  this->FullResolutionInsertLock->Delete();
   if (this->Threader)
     {
     this->Threader->Delete();
@@ -280,17 +370,13 @@ vtkFreehandUltrasound2::~vtkFreehandUltrasound2()
 	{
 		this->DepthClipData->Delete();
 	}*/
-	if (this->RotationClipData)
-	{
-		this->RotationClipData->Delete();
-	}
 	/*if (this->DepthThreshold)
 	{
 		this->DepthThreshold->Delete();
 	}*/
-	if (this->RotationThreshold)
+	if (this->RotationDecoder)
 	{
-		this->RotationThreshold->Delete();
+		this->RotationDecoder->Delete();
 	}
 	/*if (this->FlipThreshold)
 	{
@@ -300,6 +386,15 @@ vtkFreehandUltrasound2::~vtkFreehandUltrasound2()
 	{
 		this->FlipTransform->Delete();
 	}
+  if (this->SweepFile)
+    {
+    this->SweepFile->Delete();
+    }
+  if (this->SweepFrame)
+    {
+    this->SweepFrame->Delete();
+    }
+  this->SweepLock->Delete();
 
   // TODO also delete OutputOrigin, OutputSpacing, OutputExtent,
   // OldOutputOrigin, OldOutputSpacing, OldOutputExtent, ClipRectangle,
@@ -425,7 +520,7 @@ vtkImageData *vtkFreehandUltrasound2::GetOutput()
 
 void  vtkFreehandUltrasound2::SetPixelCount(int threadId, int count)
 {
-  if( threadId < 4 && threadId >= 0)
+  if( threadId < VTK_MAX_THREADS && threadId >= 0)
     {
     this->PixelCount[threadId] = count;
     }
@@ -438,7 +533,7 @@ void  vtkFreehandUltrasound2::SetPixelCount(int threadId, int count)
 //----------------------------------------------------------------------------
 void  vtkFreehandUltrasound2::IncrementPixelCount(int threadId, int increment)
 {
-  if( threadId < 4 && threadId >= 0)
+  if( threadId < VTK_MAX_THREADS && threadId >= 0)
     {
     this->PixelCount[threadId] += increment;
     }
@@ -450,8 +545,12 @@ void  vtkFreehandUltrasound2::IncrementPixelCount(int threadId, int increment)
 //----------------------------------------------------------------------------
 int  vtkFreehandUltrasound2::GetPixelCount()
 {
-  return ( this->PixelCount[0] + this->PixelCount[1] +
-	   this->PixelCount[2] + this->PixelCount[3] );
+  int count = 0;
+  for (int t = 0; t < VTK_MAX_THREADS; t++)
+    {
+    count += this->PixelCount[t];
+    }
+  return count;
 }
 //----------------------------------------------------------------------------
 // GetClipExtent
@@ -531,11 +630,21 @@ void vtkFreehandUltrasound2::GetClipExtent(int clipExt[6],
 // SliceCalculateMaxSliceSeparation
 // Calculate the maximum distance between two slices, given the
 // index transformation matrix for each.
-// This method is currently not used, so chances are very good that
-// it will NOT provide the correct result.
 //----------------------------------------------------------------------------
 double vtkFreehandUltrasound2::SliceCalculateMaxSliceSeparation(vtkMatrix4x4 *m1,
                                                           vtkMatrix4x4 *m2)
+{
+  return this->CalculateMaxSliceSeparation(m1, m2);
+}
+
+//----------------------------------------------------------------------------
+// CalculateMaxSliceSeparation
+// Calculate an upper bound on the distance, in millimetres, that any pixel
+// within the ClipRectangle moved between two slices, given the index
+// transformation matrix for each.  Used by the Adaptive FramePolicy.
+//----------------------------------------------------------------------------
+double vtkFreehandUltrasound2::CalculateMaxSliceSeparation(vtkMatrix4x4 *m1,
+                                                           vtkMatrix4x4 *m2)
 {
   // The first thing to do is find the four corners of the plane.
   vtkImageData *inData = this->GetSlice();
@@ -587,7 +696,7 @@ double vtkFreehandUltrasound2::SliceCalculateMaxSliceSeparation(vtkMatrix4x4 *m1
   normal1[2] = 1.0;
   normal1[3] = 0.0;
 
-  double r = 0.5*sqrt((x1-x0)*(x1-x0) + (y1-y0)*(y1*y0));
+  double r = 0.5*sqrt((x1-x0)*(x1-x0) + (y1-y0)*(y1-y0));
 
   // divide the matrices to get the relative transformation
   double matrix[4][4];
@@ -656,7 +765,34 @@ void vtkFreehandUltrasound2::PrintSelf(ostream& os, vtkIndent indent)
      << this->GetInterpolationModeAsString() << "\n";
   os << indent << "Optimization: " << (this->Optimization ? "On\n":"Off\n");
   os << indent << "Compounding: " << (this->Compounding ? "On\n":"Off\n");
+  os << indent << "CompoundingMode: "
+     << this->GetCompoundingModeAsString() << "\n";
   os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "HoleFillingMode: "
+     << this->GetHoleFillingModeAsString() << "\n";
+  os << indent << "HoleFillingRadius: " << this->HoleFillingRadius << "\n";
+  os << indent << "HoleFillingSigma: " << this->HoleFillingSigma << "\n";
+  os << indent << "HoleFillingMaxPasses: " << this->HoleFillingMaxPasses << "\n";
+  os << indent << "HoleFillingMinNeighbors: "
+     << this->HoleFillingMinNeighbors << "\n";
+  os << indent << "HoleFillingNumberOfThreads: "
+     << this->HoleFillingNumberOfThreads << "\n";
+  os << indent << "BatchNumberOfThreads: "
+     << this->BatchNumberOfThreads << "\n";
+  os << indent << "BatchSize: " << this->BatchSize << "\n";
+  os << indent << "Preview: " << (this->Preview ? "On\n":"Off\n");
+  os << indent << "PreviewShrinkFactor: " << this->PreviewShrinkFactor << "\n";
+  os << indent << "FullResolutionMode: "
+     << (this->FullResolutionMode == VTK_FREEHAND_FULL_RES_DEFERRED ?
+         "Deferred\n" : "Background\n");
+  os << indent << "FullResolutionQueueLength: "
+     << this->FullResolutionQueueLength << "\n";
+  os << indent << "FramePolicy: " << this->GetFramePolicyAsString() << "\n";
+  os << indent << "MaximumLatency: " << this->MaximumLatency << "\n";
+  os << indent << "MinimumSliceSeparation: "
+     << this->MinimumSliceSeparation << "\n";
+  os << indent << "DroppedFrameCount: " << this->DroppedFrameCount << "\n";
+  os << indent << "MergedFrameCount: " << this->MergedFrameCount << "\n";
 }
 
 //----------------------------------------------------------------------------
@@ -890,7 +1026,7 @@ int vtkFreehandUltrasound2::RequestInformation(
 				this->AccumulationBuffer->SetExtent(this->OutputExtent); // another trial by Danielle
 				this->AccumulationBuffer->SetSpacing(this->OutputSpacing);
 				this->AccumulationBuffer->SetOrigin(this->OutputOrigin);
-				this->AccumulationBuffer->SetScalarType(this->GetOutput()->GetScalarType()); // added by Danielle
+				this->AccumulationBuffer->SetScalarType(VTK_FLOAT); // weights are accumulated as floats
 				//this->AccumulationBuffer->SetNumberOfScalarComponents(this->GetOutput()->GetNumberOfScalarComponents()); // Added by Danielle
 				this->AccumulationBuffer->SetUpdateExtent(this->OutputExtent); // added by Danielle - makes things work!
 				//this->AccumulationBuffer->UpdateInformation(); // perhaps does the same thing as above!
@@ -1171,7 +1307,7 @@ void vtkFreehandUltrasound2::InternalExecuteInformation()
 	this->AccumulationBuffer->SetExtent(this->OutputExtent); // another trial by Danielle
 	this->AccumulationBuffer->SetSpacing(this->OutputSpacing);
 	this->AccumulationBuffer->SetOrigin(this->OutputOrigin);
-	this->AccumulationBuffer->SetScalarType(this->GetOutput()->GetScalarType()); // added by Danielle
+	this->AccumulationBuffer->SetScalarType(VTK_FLOAT); // weights are accumulated as floats
 	//this->AccumulationBuffer->SetNumberOfScalarComponents(this->GetOutput()->GetNumberOfScalarComponents()); // Added by Danielle
 	this->AccumulationBuffer->SetUpdateExtent(this->OutputExtent); // added by Danielle - makes things work!
 	//this->AccumulationBuffer->UpdateInformation(); // perhaps does the same thing as above!
@@ -1279,435 +1415,60 @@ int vtkFreehandUltrasound2::ComputePipelineMTime(
 }
 //----------------------------------------------------------------------------
 //  Interpolation subroutines and associated code
+//  (the kernels are shared with vtkFreehandUltrasound, and are in
+//  vtkFreehandUltrasoundCore.h)
 //----------------------------------------------------------------------------
 
 //----------------------------------------------------------------------------
-// rounding functions, split and optimized for each type
-// (because we don't want to round if the result is a float!)
-
-// in the case of a tie between integers, the larger integer wins.
-
-// The 'floor' function on x86 and mips is many times slower than these
-// and is used a lot in this code, optimize for different CPU architectures
-// static inline int vtkUltraFloor(double x)
-// {
-// #if defined mips || defined sparc
-//   return (int)((unsigned int)(x + 2147483648.0) - 2147483648U);
-// #elif defined i386
-//   double tempval = (x - 0.25) + 3377699720527872.0; // (2**51)*1.5
-//   return ((int*)&tempval)[0] >> 1;
-// #else
-//   return int(floor(x));
-// #endif
-// }
-
-static inline int vtkUltraFloor(double x)
-{
-#if defined mips || defined sparc || defined __ppc__
-  x += 2147483648.0;
-  unsigned int i = (unsigned int)(x);
-  return (int)(i - 2147483648U);
-#elif defined i386 || defined _M_IX86
-  union { double d; unsigned short s[4]; unsigned int i[2]; } dual;
-  dual.d = x + 103079215104.0;  // (2**(52-16))*1.5
-  return (int)((dual.i[1]<<16)|((dual.i[0])>>16));
-#elif defined ia64 || defined __ia64__ || defined IA64
-  x += 103079215104.0;
-  long long i = (long long)(x);
-  return (int)(i - 103079215104LL);
-#else
-  double y = floor(x);
-  return (int)(y);
-#endif
-}
-
-static inline int vtkUltraCeil(double x)
-{
-  return -vtkUltraFloor(-x - 1.0) - 1;
-}
-
-static inline int vtkUltraRound(double x)
-{
-  return vtkUltraFloor(x + 0.5);
-}
-
-static inline int vtkUltraFloor(float x)
-{
-  return vtkUltraFloor((double)x);
-}
-
-static inline int vtkUltraCeil(float x)
-{
-  return vtkUltraCeil((double)x);
-}
-
-static inline int vtkUltraRound(float x)
-{
-  return vtkUltraRound((double)x);
-}
-
-static inline int vtkUltraFloor(fixed x)
-{
-  return x.floor();
-}
-
-static inline int vtkUltraCeil(fixed x)
-{
-  return x.ceil();
-}
-
-static inline int vtkUltraRound(fixed x)
-{
-  return x.round();
-}
-
-
-// convert a float into an integer plus a fraction
-template <class F>
-static inline int vtkUltraFloor(F x, F &f)
-{
-  int ix = vtkUltraFloor(x);
-  f = x - ix;
-
-  return ix;
-}
-
-template <class F, class T>
-static inline void vtkUltraRound(F val, T& rnd)
-{
-  rnd = vtkUltraRound(val);
-}
-
-//----------------------------------------------------------------------------
-// vtkNearestNeighborInterpolation
-// Do nearest-neighbor interpolation of the input data 'inPtr' of extent 
-// 'inExt' at the 'point'.  The result is placed at 'outPtr'.  
-// If the lookup data is beyond the extent 'inExt', set 'outPtr' to
-// the background color 'background'.  
-// The number of scalar components in the data is 'numscalars'
+// vtkFreehand2AllocateAccumulation
+// Allocate and clear an accumulation buffer over 'extent' for an output
+// of type 'scalarType' with 'numscalars' components plus alpha.  The
+// weights are floats, so they do not saturate on heavily oversampled
+// voxels.  For median compounding, the sample reservoir is kept with the
+// weights as a second point data array of the output scalar type.
 //----------------------------------------------------------------------------
-template <class F, class T>
-static int vtkNearestNeighborInterpolation(F *point, T *inPtr, T *outPtr,
-                                           unsigned short *accPtr, 
-                                           int numscalars, 
-                                           int outExt[6], int outInc[3])
+static void vtkFreehand2AllocateAccumulation(vtkImageData *accData,
+                                             int extent[6], int scalarType,
+                                             int numscalars, int mode)
 {
-  int i;
-  int outIdX = vtkUltraRound(point[0])-outExt[0];
-  int outIdY = vtkUltraRound(point[1])-outExt[2];
-  int outIdZ = vtkUltraRound(point[2])-outExt[4];
-  
-  // fancy way of checking bounds
-  if ((outIdX | (outExt[1]-outExt[0] - outIdX) |
-       outIdY | (outExt[3]-outExt[2] - outIdY) |
-       outIdZ | (outExt[5]-outExt[4] - outIdZ)) >= 0)
-    {
-    int inc = outIdX*outInc[0]+outIdY*outInc[1]+outIdZ*outInc[2];
-    outPtr += inc;
-    if (accPtr)
-      {
-      // accumulation buffer: do compounding
-      accPtr += inc/outInc[0];
-      int newa = *accPtr + 255;
-      for (i = 0; i < numscalars; i++)
-        {
-        *outPtr = ((*inPtr++)*255 + (*outPtr)*(*accPtr))/newa;
-        outPtr++;
-        }
-      *outPtr = 255;
-      *accPtr = 65535;
-      if (newa < 65535)
-        {
-        *accPtr = newa;
-        }
-      }
-    else
-      {
-      // no accumulation buffer, replace what was there before
-      for (i = 0; i < numscalars; i++)
-        {
-        *outPtr++ = *inPtr++;
-        }
-      *outPtr = 255;
-      }
-    return 1;
+  accData->SetExtent(extent);
+  accData->SetScalarType(VTK_FLOAT);
+  accData->SetNumberOfScalarComponents(1);
+  accData->AllocateScalars();
+  memset(accData->GetScalarPointer(), 0,
+         accData->GetNumberOfPoints()*sizeof(float));
+
+  accData->GetPointData()->RemoveArray("Reservoir");
+  if (mode == VTK_FREEHAND_COMPOUND_MEDIAN && numscalars > 0)
+    {
+    vtkDataArray *reservoir = vtkDataArray::CreateDataArray(scalarType);
+    reservoir->SetName("Reservoir");
+    reservoir->SetNumberOfComponents(VTK_FREEHAND_MEDIAN_RESERVOIR*
+                                     numscalars);
+    reservoir->SetNumberOfTuples(accData->GetNumberOfPoints());
+    accData->GetPointData()->AddArray(reservoir);
+    reservoir->Delete();
     }
-  return 0;
-} 
-
-//----------------------------------------------------------------------------
-// vtkTrilinearInterpolation
-// Do trilinear interpolation of the input data 'inPtr' of extent 'inExt'
-// at the 'point'.  The result is placed at 'outPtr'.  
-// If the lookup data is beyond the extent 'inExt', set 'outPtr' to
-// the background color 'background'.  
-// The number of scalar components in the data is 'numscalars'
-//----------------------------------------------------------------------------
-template <class F, class T>
-static int vtkTrilinearInterpolation(F *point, T *inPtr, T *outPtr,
-                                     unsigned short *accPtr, int numscalars, 
-                                     int outExt[6], int outInc[3])
-{
-
-	//std::cout << "in vtkTrilinearInterpolation" << std::endl;
-
-  F fx, fy, fz;
-
-  int outIdX0 = vtkUltraFloor(point[0], fx);  // covert point[0] into integer component and a fraction
-  int outIdY0 = vtkUltraFloor(point[1], fy);	// point[0] is unchanged, outIdX0 is the integer (floor), fx is the float
-  int outIdZ0 = vtkUltraFloor(point[2], fz);
-
-  int outIdX1 = outIdX0 + (fx != 0); // ceiling
-  int outIdY1 = outIdY0 + (fy != 0);
-  int outIdZ1 = outIdZ0 + (fz != 0);
-
-  // at this point in time we have the floor (outIdX0), the ceiling (outIdX1) and the fractional component (fx) for
-  // x, y and z
-  
-  // bounds check (remember | is bitwise OR)
-  if ((outIdX0 | (outExt[1]-outExt[0] - outIdX1) |
-       outIdY0 | (outExt[3]-outExt[2] - outIdY1) |
-       outIdZ0 | (outExt[5]-outExt[4] - outIdZ1)) >= 0)
-    {// do reverse trilinear interpolation
-		// trilinear interpolation would use the pixel values to interpolate something in the middle
-		// we have the something in the middle and want to spread it to the discrete pixel values around it, in an
-		// interpolated way
-    int factX0 = outIdX0*outInc[0];
-    int factY0 = outIdY0*outInc[1];
-    int factZ0 = outIdZ0*outInc[2];
-    int factX1 = outIdX1*outInc[0];
-    int factY1 = outIdY1*outInc[1];
-    int factZ1 = outIdZ1*outInc[2];
-
-    int factY0Z0 = factY0 + factZ0;
-    int factY0Z1 = factY0 + factZ1;
-    int factY1Z0 = factY1 + factZ0;
-    int factY1Z1 = factY1 + factZ1;
-
-    int idx[8];// increment between the output pointer and the 8 pixels to work on
-    idx[0] = factX0 + factY0Z0;
-    idx[1] = factX0 + factY0Z1;
-    idx[2] = factX0 + factY1Z0;
-    idx[3] = factX0 + factY1Z1;
-    idx[4] = factX1 + factY0Z0;
-    idx[5] = factX1 + factY0Z1;
-    idx[6] = factX1 + factY1Z0;
-    idx[7] = factX1 + factY1Z1;
-
-    F rx = 1 - fx; // remainders from the fractional components - difference between the fractional value and the ceiling
-    F ry = 1 - fy;
-    F rz = 1 - fz;
-      
-    F ryrz = ry*rz;
-    F ryfz = ry*fz;
-    F fyrz = fy*rz;
-    F fyfz = fy*fz;
-
-    F fdx[8];
-    fdx[0] = rx*ryrz;
-    fdx[1] = rx*ryfz;
-    fdx[2] = rx*fyrz;
-    fdx[3] = rx*fyfz;
-    fdx[4] = fx*ryrz;
-    fdx[5] = fx*ryfz;
-    fdx[6] = fx*fyrz;
-    fdx[7] = fx*fyfz;
-    
-    F f, r, a; // changed by Danielle
-
-
-
-    T *inPtrTmp, *outPtrTmp;
-    if (accPtr)
-      {
-      //------------------------------------
-      // accumulation buffer: do compounding
-
-		  //std::cout << "in the compounding if loop" << std::endl;
-
-                unsigned short *accPtrTmp;
-
-      // loop over the eight voxels
-      int j = 8;
-      do 
-        {
-        j--;
-        if (fdx[j] == 0)
-          {
-          continue;
-          }
-        inPtrTmp = inPtr;
-        outPtrTmp = outPtr+idx[j];
-        accPtrTmp = accPtr+ ((unsigned short)(idx[j]/outInc[0])); ///// compensate for different number of scalar components
-											// this is the same as adding the increments for the acc buffer (should be)
-        f = fdx[j];
-
-		//std::cout << "problem here?" << std::endl;
-
-		//int temp = int(*accPtr);
-
-		/*std::cout << "output is ok... " << accPtr;
-		std::cout << " " << (int)(*accPtr);
-		std::cout << " " << idx[j] << " ";
-		std::cout << outInc[0] << " ";
-		std::cout << accPtrTmp << " ";
-		*/
-
-		/*
-		- accPtr = 4D550020
-		- *accPtr = 0
-		- idx[j] = 200379422
-		- outInc[0] = 2
-		accPtrTmp = 1497795646 (in int, not hex)
-		*/
-		//std::cout << std::endl << "finished!" << std::endl;
-		//std::cout << "printing outPtrTmp" << std::endl;
-		//std::cout << (int) (*outPtrTmp) << std::endl;
-		//std::cout << "did it" << std::endl;
-				//std::cout << "*accPtrTmp = " << (int)(*accPtrTmp) << std::endl;
-
-				//std::cout << "printed that thing!" << std::endl;
-
-		r = F((*accPtrTmp)/255);
-
- /* COPIED FROM NNINTERPOLATION - dies whenever you access accPtrTmp / accPtr1    
- int inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
-      T *outPtr1 = outPtr + inc;
-	  std::cout << "making accPtr1" << std::endl;
-      unsigned short *accPtr1 = accPtr + inc/outInc[0];
-	  std::cout << "making newa" << std::endl;
-      unsigned short newa = *accPtr1 + 255; // dies here!
-	  std::cout << "made newa" << std::endl;*/
-		
-		//int temp2 = (int) F(*accPtrTmp);
-
-		//std::cout << "temp2 is ok temp 2 = " <<temp2<< std::endl;
-
-		//printf("CW-TEST: %d %s\n",  F(*accPtrTmp), F(*accPtrTmp));
-
-		//std::cout << "trying  " << std::endl;
-
-
-        //r = F((*accPtrTmp)/255);///////// changed by Danielle
-
-		//std::cout << "here" << std::endl;
-
-        //r = F(*accPtrTmp)/255;///////// replaced by Danielle with teh thing above
-
-		//std::cout << "f = ";
-		//std::cout << (float) f;
-		//std::cout << " r = " << (float) r << std::endl;
-
-        a = f + r;
-		//std::cout << "just about to copy stuff" << std::endl;
-
-        int i = numscalars;
-        do
-          {
-          i--;
-		  //std::cout << "going to copy stuff" << std::endl;
-          vtkUltraRound((f*(*inPtrTmp++) + r*(*outPtrTmp))/a,
-                          *outPtrTmp);
-		  //std::cout << "copied stuff" << std::endl;
-          outPtrTmp++;
-          }
-        while (i);
-        // set accumulation
-        *accPtrTmp = 65535;
-        *outPtrTmp = 255;
-        a *= 255;
-        if (a < F(65535)) // don't allow accumulation buffer overflow
-          {
-//	  cout<<"Overflow"<<endl;
-          vtkUltraRound(a, *accPtrTmp);
-          }
-
-		  //std::cout << "we are here" << std::endl;
-
-		}
-      while (j);
-	  }
-    else 
-      {
-      //------------------------------------
-      // no accumulation buffer
-      // loop over the eight voxels
-      int j = 8;
-      do
-        {
-        j--;
-        if (fdx[j] == 0)
-          {
-          continue;
-          }
-        inPtrTmp = inPtr;
-        outPtrTmp = outPtr+idx[j];
-        // if alpha is nonzero then the pixel was hit before, so
-        //  average with previous value
-        if (outPtrTmp[numscalars])
-          {
-          f = fdx[j];
-          F r = 1 - f;
-          int i = numscalars;
-          do
-            {
-            i--;
-            vtkUltraRound(f*(*inPtrTmp++) + r*(*outPtrTmp),
-                            *outPtrTmp);
-            outPtrTmp++;
-            }
-          while (i);
-          }
-        // alpha is zero, so just insert the new value
-        else
-          {
-          int i = numscalars;
-          do
-            {
-            i--;
-            *outPtrTmp++ = *inPtrTmp++;
-            }
-          while (i);
-          }          
-        *outPtrTmp = 255;
-        }
-      while (j);
-	  }
-    return 1;
-	}
-	// if bounds check fails
-  return 0;
-}                          
-
-//----------------------------------------------------------------------------
-// Some helper functions
-//----------------------------------------------------------------------------
+}
 
 //----------------------------------------------------------------------------
-// vtkGetUltraInterpFunc
-// Sets interpolate (pointer to a function) to match the current interpolation
-// mode
+// vtkFreehand2GetReservoirPointer
+// The median reservoir for the whole extent of an accumulation buffer, or
+// NULL if there is none
 //----------------------------------------------------------------------------
-template <class F, class T>
-static void vtkGetUltraInterpFunc(vtkFreehandUltrasound2 *self, 
-                                    int (**interpolate)(F *point, 
-                                                        T *inPtr, T *outPtr,
-                                                        unsigned short *accPtr,
-                                                        int numscalars, 
-                                                        int outExt[6], 
-                                                        int outInc[3]))
+static void *vtkFreehand2GetReservoirPointer(vtkImageData *accData)
 {
-  switch (self->GetInterpolationMode())
+  if (accData == NULL)
     {
-    case VTK_FREEHAND_NEAREST:
-      *interpolate = &vtkNearestNeighborInterpolation;
-      break;
-    case VTK_FREEHAND_LINEAR:
-      *interpolate = &vtkTrilinearInterpolation;
-      break;
+    return NULL;
+    }
+  vtkDataArray *reservoir = accData->GetPointData()->GetArray("Reservoir");
+  if (reservoir == NULL)
+    {
+    return NULL;
     }
+  return reservoir->GetVoidPointer(0);
 }
-  
 
 //----------------------------------------------------------------------------
 // Actually inserts the slice - executes the filter for any type of data.
@@ -1722,8 +1483,9 @@ template <class T>
 static void vtkFreehandUltrasound2InsertSlice(vtkFreehandUltrasound2 *self, /* the vtkFreehandUltrasound2 object */
                                              vtkImageData *outData,       /* the volume to insert into (the output data) */
 					          T *outPtr,                   /* the scalar pointer to the output extent */
-                                             unsigned short *accPtr,      /* the scalar pointer to the accumulation */
+                                             float *accPtr,               /* the scalar pointer to the accumulation */
 					                                       /* buffer, if we are compounding */
+                                             T *resPtr,                   /* the median reservoir, if any */
                                              vtkImageData *inData,        /* the slice (input data) */
 					          T *inPtr,                    /* the scalar pointer to the input extent */
                                              int inExt[6],                /* the input extent */
@@ -1748,7 +1510,7 @@ static void vtkFreehandUltrasound2InsertSlice(vtkFreehandUltrasound2 *self, /* t
   // can later assign it to the address of a matching function and use "(*interpolate)"
   // or "interpolate" as if it were a function name
   int (*interpolate)(double *point, T *inPtr, T *outPtr,
-		     unsigned short *accPtr,
+		     float *accPtr, T *resPtr,
                      int numscalars, int outExt[6], int outInc[3]);
   
   // slice spacing and origin
@@ -1788,8 +1550,10 @@ static void vtkFreehandUltrasound2InsertSlice(vtkFreehandUltrasound2 *self, /* t
   inData->GetContinuousIncrements(inExt, inIncX, inIncY, inIncZ);
   numscalars = inData->GetNumberOfScalarComponents();
   
-  // Set interpolation method - nearest neighbor or trilinear
-  vtkGetUltraInterpFunc(self,&interpolate);
+  // Set interpolation method - nearest neighbor or trilinear - and the
+  // compounding mode
+  vtkFreehandGetInterpFunc(self->GetInterpolationMode(),
+                           self->GetCompoundingMode(), resPtr, &interpolate);
 
   // Loop through  slice pixels in the input extent and put them into the output volume
   for (idZ = inExt[4]; idZ <= inExt[5]; idZ++) // for z0 to z1
@@ -1826,8 +1590,8 @@ static void vtkFreehandUltrasound2InsertSlice(vtkFreehandUltrasound2 *self, /* t
             outPoint[3] = 1;
         
 	    // interpolation functions return 1 if the interpolation was successful, 0 otherwise
-            int hit = interpolate(outPoint, inPtr, outPtr, accPtr, numscalars, 
-                        outExt, outInc);
+            int hit = interpolate(outPoint, inPtr, outPtr, accPtr, resPtr,
+                        numscalars, outExt, outInc);
 	    //    self->SetPixelCount( self->GetPixelCount() + hit);
 	    // increment the number of pixels inserted
 	    self->IncrementPixelCount(0, hit);
@@ -1899,12 +1663,14 @@ void vtkFreehandUltrasound2::InsertSlice()
   void *inPtr = inData->GetScalarPointerForExtent(inExt);
   void *outPtr = outData->GetScalarPointerForExtent(outExt);
   void *accPtr = NULL;
+  void *resPtr = NULL;
   
   // if we are compounding, then we have a native pointer for the extent of the
   // accumulation buffer
   if (this->Compounding)
     {
     accPtr = accData->GetScalarPointerForExtent(outExt);
+    resPtr = vtkFreehand2GetReservoirPointer(accData);
 
 	/*accData->SetUpdateExtentToWholeExtent(); // new by Danielle
 	accData->Update();*/
@@ -1952,19 +1718,19 @@ void vtkFreehandUltrasound2::InsertSlice()
     {
     case VTK_SHORT:
       vtkFreehandUltrasound2InsertSlice(this, outData, (short *)(outPtr), 
-                             (unsigned short *)(accPtr), 
+                             (float *)(accPtr), (short *)(resPtr),
                              inData, (short *)(inPtr), 
                              inExt, matrix);
       break;
     case VTK_UNSIGNED_SHORT:
       vtkFreehandUltrasound2InsertSlice(this,outData,(unsigned short *)(outPtr),
-                             (unsigned short *)(accPtr), 
+                             (float *)(accPtr), (unsigned short *)(resPtr),
                              inData, (unsigned short *)(inPtr), 
                              inExt, matrix);
       break;
     case VTK_UNSIGNED_CHAR:
       vtkFreehandUltrasound2InsertSlice(this, outData,(unsigned char *)(outPtr),
-                             (unsigned short *)(accPtr), 
+                             (float *)(accPtr), (unsigned char *)(resPtr),
                              inData, (unsigned char *)(inPtr), 
                              inExt, matrix);
       break;
@@ -1976,275 +1742,6 @@ void vtkFreehandUltrasound2::InsertSlice()
   // this->Modified();
 }
 
-//----------------------------------------------------------------------------
-template <class T>
-static void vtkFreehandUltrasound2FillHolesInOutput(vtkFreehandUltrasound2 *self,
-						   vtkImageData *outData,
-						   T *outPtr,
-						   unsigned short *accPtr,
-						   int outExt[6])
-{
-  int idX, idY, idZ;
-  int incX, incY, incZ;
-  int accIncX, accIncY, accIncZ;
-  int startX, endX, numscalars;
-  int c;
-  // clip the extent by 1 voxel width relative to whole extent
-  int *outWholeExt = outData->GetWholeExtent();
-  int extent[6];
-  for (int a = 0; a < 3; a++)
-    {
-    extent[2*a] = outExt[2*a];
-    if (extent[2*a] == outWholeExt[2*a])
-      {
-      extent[2*a]++;
-      }
-    extent[2*a+1] = outExt[2*a+1];
-    if (extent[2*a+1] == outWholeExt[2*a+1])
-      {
-      extent[2*a+1]--;
-      }
-    }
-
-  // get increments for output and for accumulation buffer
-  outData->GetIncrements(incX, incY, incZ);
-  accIncX = 1;
-  accIncY = incY/incX;
-  accIncZ = incZ/incX;
-  // number of components not including the alpha channel
-  numscalars = outData->GetNumberOfScalarComponents() - 1;
-   
-  T *alphaPtr = outPtr + numscalars;
-  T *outPtrZ, *outPtrY, *outPtrX;
-  unsigned short *accPtrZ, *accPtrY, *accPtrX;
-
-  // go through all voxels except the edge voxels
-  for (idZ = extent[4]; idZ <= extent[5]; idZ++)
-    {
-    outPtrZ = outPtr + (idZ - outExt[4])*incZ;
-    accPtrZ = accPtr + (idZ - outExt[4])*accIncZ;
-    for (idY = extent[2]; idY <= extent[3]; idY++)
-      {
-      outPtrY = outPtrZ + (idY - outExt[2])*incY;
-      accPtrY = accPtrZ + (idY - outExt[2])*accIncY;
-      // find entry point
-      alphaPtr = outPtrY + numscalars;
-      for (startX = outExt[0]; startX <= outExt[1]; startX++)
-	{
-	// check the point on the row as well as the 4-connected voxels 
-	if (*alphaPtr |
-	    *(alphaPtr-incY) | *(alphaPtr+incY) |
-	    *(alphaPtr-incZ) | *(alphaPtr+incZ))
-	  {// break when alpha component is nonzero
-	  break;
-	  }
-	alphaPtr += incX;
-	}
-      if (startX > outExt[1])
-	{ // the whole row is empty, do nothing
-	continue;
-	}
-      // find exit point
-      alphaPtr = outPtrY + (outExt[1]-outExt[0])*incX + numscalars;
-      for (endX = outExt[1]; endX >= outExt[0]; endX--)
-	{
-	// check the point on the row as well as the 4-connected voxels 
-	if (*alphaPtr |
-	    *(alphaPtr-incY) | *(alphaPtr+incY) |
-	    *(alphaPtr-incZ) | *(alphaPtr+incZ))
-	  {
-	  break;
-	  }
-	alphaPtr -= incX;
-	}
-      // go through the row, skip first and last voxel in row
-      if (startX == outWholeExt[0])
-	{
-	startX++;
-	}
-      if (endX == outWholeExt[1])
-	{
-	endX--;
-	}
-      outPtrX = outPtrY + (startX - outExt[0])*incX;
-      accPtrX = accPtrY + (startX - outExt[0])*accIncX;
-      for (idX = startX; idX <= endX; idX++)
-	{
-	if (outPtrX[numscalars] == 0)
-	  { // only do this for voxels that haven't been hit
-	  double sum[32];
-	  for (c = 0; c < numscalars; c++) 
-	    {
-	    sum[c] = 0;
-	    }
-	  double asum = 0; 
-	  int n = 0;
-	  int nmin = 14; // half of the connected voxels plus one
-	  T *blockPtr;
-	  unsigned short *accBlockPtr;
-	  // sum the pixel values for the 3x3x3 block
-          //  (this is turned off for now)
-	  if (0) // (accPtr)
-	    { // use accumulation buffer to do weighted average
-	    for (int k = -accIncZ; k <= accIncZ; k += accIncZ)
-	      {
-	      for (int j = -accIncY; j <= accIncY; j += accIncY)
-		{
-		for (int i = -accIncX; i <= accIncX; i += accIncX)
-		  {
-		  int inc = j + k + i;
-		  blockPtr = outPtrX + inc*incX;
-		  accBlockPtr = accPtrX + inc;
-		  if (blockPtr[numscalars] == 255)
-		    {
-		    n++;
-		    for (c = 0; c < numscalars; c++)
-		      { // use accumulation buffer as weight
-		      sum[c] += blockPtr[c]*(*accBlockPtr);
-		      }
-		    asum += *accBlockPtr;
-		    }
-		  }
-		}
-	      }
-	    // if less than half the neighbors have data, use larger block
-	    if (n <= nmin && idX != startX && idX != endX &&
-		idX - outWholeExt[0] > 2 && outWholeExt[1] - idX > 2 &&
-		idY - outWholeExt[2] > 2 && outWholeExt[3] - idY > 2 &&
-		idZ - outWholeExt[4] > 2 && outWholeExt[5] - idZ > 2)
-	      {
-	      // weigh inner block by a factor of four (multiply three,
-	      // plus we will be counting it again as part of the 5x5x5
-	      // block)
-	      asum *= 3;
-	      for (c = 0; c < numscalars; c++) 
-		{
-		sum[c]*= 3;
-		}	      
-	      nmin = 63;
-	      n = 0;
-	      for (int k = -accIncZ*2; k <= accIncZ*2; k += accIncZ)
-		{
-		for (int j = -accIncY*2; j <= accIncY*2; j += accIncY)
-		  {
-		  for (int i = -accIncX*2; i <= accIncX*2; i += accIncX)
-		    {
-		    int inc = j + k + i;
-		    blockPtr = outPtrX + inc*incX;
-		    accBlockPtr = accPtrX + inc;
-		    if (blockPtr[numscalars] == 255)
-		      { // use accumulation buffer as weight
-		      n++;
-		      for (c = 0; c < numscalars; c++)
-			{
-			sum[c] += blockPtr[c]*(*accBlockPtr);
-			}
-		      asum += *accBlockPtr; 
-		      }
-		    }
-		  }
-		}
-	      }
-	    }
-	  else // no accumulation buffer
-	    {
-	    for (int k = -incZ; k <= incZ; k += incZ)
-	      {
-	      for (int j = -incY; j <= incY; j += incY)
-		{
-		for (int i = -incX; i <= incX; i += incX)
-		  {
-		  blockPtr = outPtrX + j + k + i;
-		  if (blockPtr[numscalars] == 255)
-		    {
-		    n++;
-		    for (int c = 0; c < numscalars; c++)
-		      {
-		      sum[c] += blockPtr[c];
-		      }
-		    }
-		  }
-		}
-	      }
-	    asum = n;
-	    // if less than half the neighbors have data, use larger block,
-	    // and count inner 3x3 block again to weight it by 2
-	    if (n <= nmin && idX != startX && idX != endX &&
-		idX - outWholeExt[0] > 2 && outWholeExt[1] - idX > 2 &&
-		idY - outWholeExt[2] > 2 && outWholeExt[3] - idY > 2 &&
-		idZ - outWholeExt[4] > 2 && outWholeExt[5] - idZ > 2)
-	      { 
-	      // weigh inner block by a factor of four (multiply three,
-	      // plus we will be counting it again as part of the 5x5x5
-	      // block)
-	      asum *= 3;
-	      for (c = 0; c < numscalars; c++) 
-		{
-		sum[c]*= 3;
-		}
-	      nmin = 63;
-	      n = 0;
-	      for (int k = -incZ*2; k <= incZ*2; k += incZ)
-		{
-		for (int j = -incY*2; j <= incY*2; j += incY)
-		  {
-		  for (int i = -incX*2; i <= incX*2; i += incX)
-		    {
-		    blockPtr = outPtrX + j + k + i;
-		    if (blockPtr[numscalars] == 255)
-		      {
-		      n++;
-		      for (int c = 0; c < numscalars; c++)
-			{
-			sum[c] += blockPtr[c];
-			}
-		      }
-		    }
-		  }
-		}
-	      asum += n;
-	      }
-	    }
-	  // if more than half of neighboring voxels are occupied, then fill
-	  if (n >= nmin)
-	    {
-	    for (int c = 0; c < numscalars; c++)
-	      {
-	      vtkUltraRound(sum[c]/asum, outPtrX[c]);
-	      }
-	    // set alpha to 1 now, change to 255 later
-	    outPtrX[numscalars] = 1;
-	    }
-	  }
-	  outPtrX += incX;
-	}
-      }
-    }
-
-  // change alpha value '1' to value '255'
-  alphaPtr = outPtr + numscalars;
-  // go through all voxels this time
-  for (idZ = outExt[4]; idZ <= outExt[5]; idZ++)
-    {
-    for (idY = outExt[2]; idY <= outExt[3]; idY++)
-      {
-      for (idX = outExt[0]; idX <= outExt[1]; idX++)
-	{
-	// convert '1' to 255
-	if (*alphaPtr == 1)
-	  {
-	  *alphaPtr = 255;
-	  }
-	alphaPtr += incX;
-	}
-      // add the continuous increment
-      alphaPtr += (incY - (outExt[1]-outExt[0]+1)*incX);
-      }
-    // add the continuous increment
-    alphaPtr += (incZ - (outExt[3]-outExt[2]+1)*incY);
-    }
-}
-
 //----------------------------------------------------------------------------
 void vtkFreehandUltrasound2::ThreadedFillExecute(vtkImageData *outData,	
                                             	int outExt[6], int threadId)
@@ -2262,19 +1759,19 @@ void vtkFreehandUltrasound2::ThreadedFillExecute(vtkImageData *outData,
   switch (outData->GetScalarType())
     {
     case VTK_SHORT:
-      vtkFreehandUltrasound2FillHolesInOutput(
-                             this, outData, (short *)(outPtr), 
-                             (unsigned short *)(accPtr), outExt);
+      vtkFreehandFillHolesInOutput(
+                             outData, (short *)(outPtr), 
+                             (float *)(accPtr), outExt);
       break;
     case VTK_UNSIGNED_SHORT:
-      vtkFreehandUltrasound2FillHolesInOutput(
-                             this, outData, (unsigned short *)(outPtr),
-                             (unsigned short *)(accPtr), outExt);
+      vtkFreehandFillHolesInOutput(
+                             outData, (unsigned short *)(outPtr),
+                             (float *)(accPtr), outExt);
       break;
     case VTK_UNSIGNED_CHAR:
-      vtkFreehandUltrasound2FillHolesInOutput(
-                             this, outData,(unsigned char *)(outPtr),
-                             (unsigned short *)(accPtr), outExt); 
+      vtkFreehandFillHolesInOutput(
+                             outData, (unsigned char *)(outPtr),
+                             (float *)(accPtr), outExt); 
       break;
     default:
       vtkErrorMacro(<< "FillHolesInOutput: Unknown input ScalarType");
@@ -2335,27 +1832,524 @@ void vtkFreehandUltrasound2::MultiThreadFill(vtkImageData *outData)
 }
 
 //----------------------------------------------------------------------------
-void vtkFreehandUltrasound2::FillHolesInOutput()
-{
-  // TODO note that I think calls to internalexecuteinformation should be
-  // replaced with calls to requestinformation
-//  this->InternalExecuteInformation();
-  // this->GetOutput()->Update();
-  // TODO should replace this with requestinformation for vtk 5
-  this->UpdateInformation();
-  if (this->NeedsClear)
-    {
-    //this->UpdateInformation();
-    this->InternalClearOutput();
-    }
-
-  vtkImageData *outData = this->GetOutput();
-  this->MultiThreadFill(outData);
+// Frontier hole filling
+//
+// Instead of visiting every voxel of the volume, only the empty voxels that
+// border filled voxels (the "frontier") are visited.  The volume is split
+// into z slabs, one per thread, and each thread owns the frontier voxels in
+// its slab.  Each pass has the following stages, with every stage run
+// across all threads before the next one starts:
+//
+// 1) Seed: each thread scans its slab for empty voxels that have a hit
+//    6-connected neighbor (only done once, before the first pass).
+// 2) Fill: each frontier voxel is set to the kernel-weighted average of the
+//    voxels within the kernel that have alpha = 255.  Filled voxels get the
+//    temporary alpha value 1, so that they are not used by other threads
+//    during this pass.
+// 3) Commit: the alpha of the filled voxels is set to 255.  For the Growing
+//    kernel, the empty neighbors of the filled voxels are handed to the
+//    threads that own them.
+// 4) Gather: each thread collects the empty voxels that were handed to it
+//    and makes them the frontier for the next pass.
+//
+// Empty voxels that are on the frontier have alpha = 2, which prevents a
+// voxel from being added to the frontier twice.  Only the thread that owns
+// a voxel ever changes its alpha from 0 to 2, so there are no races.
+//----------------------------------------------------------------------------
 
-  this->Modified(); 
-}
+#define VTK_FREEHAND_FILL_QUEUED 2
+#define VTK_FREEHAND_FILL_PENDING 1
 
-//----------------------------------------------------------------------------
+enum vtkFreehand2FillStage
+{
+  VTK_FREEHAND_FILL_STAGE_SEED,
+  VTK_FREEHAND_FILL_STAGE_FILL,
+  VTK_FREEHAND_FILL_STAGE_COMMIT,
+  VTK_FREEHAND_FILL_STAGE_GATHER
+};
+
+// a single voxel of the hole filling kernel
+struct vtkFreehand2FillKernelElement
+{
+  int I, J, K;
+  vtkIdType Offset;
+  double Weight;
+};
+
+// all of the information shared between the hole filling threads
+struct vtkFreehand2FillState
+{
+  vtkFreehandUltrasound2 *Filter;
+  void *OutPtr;
+  float *AccPtr;
+  int ScalarType;
+  int NumScalars;
+  int Dim[3];
+  vtkIdType Inc[3];
+  int Mode;
+  int Radius;
+  int MinNeighbors;
+  int Grow;
+  int Stage;
+  int NumberOfSlabs;
+  int SlabExtent[VTK_MAX_THREADS][2];
+  std::vector<int> SlabForZ;
+  std::vector<vtkFreehand2FillKernelElement> Kernel;
+  std::vector<vtkIdType> Frontier[VTK_MAX_THREADS];
+  std::vector<vtkIdType> Filled[VTK_MAX_THREADS];
+  // Handoff[i][j] holds the voxels found by thread i that belong to thread j
+  std::vector<vtkIdType> *Handoff[VTK_MAX_THREADS];
+};
+
+//----------------------------------------------------------------------------
+// Build the kernel, which is a sphere of the given radius (minus the
+// center voxel), with inverse-square or gaussian weights.
+static void vtkFreehand2BuildFillKernel(vtkFreehand2FillState *state,
+                                        double sigma)
+{
+  int r = state->Radius;
+  state->Kernel.clear();
+  for (int k = -r; k <= r; k++)
+    {
+    for (int j = -r; j <= r; j++)
+      {
+      for (int i = -r; i <= r; i++)
+        {
+        int d2 = i*i + j*j + k*k;
+        if (d2 == 0 || d2 > r*r + 1)
+          {
+          continue;
+          }
+        vtkFreehand2FillKernelElement e;
+        e.I = i;
+        e.J = j;
+        e.K = k;
+        e.Offset = i*state->Inc[0] + j*state->Inc[1] + k*state->Inc[2];
+        if (state->Mode == VTK_FREEHAND_HOLE_FILL_GAUSSIAN)
+          {
+          e.Weight = exp(-0.5*d2/(sigma*sigma));
+          }
+        else
+          {
+          e.Weight = 1.0/d2;
+          }
+        state->Kernel.push_back(e);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Find the empty voxels in this thread's slab that border a hit voxel.
+template <class T>
+static void vtkFreehand2FillSeed(vtkFreehand2FillState *state, T *outPtr,
+                                 int threadId)
+{
+  int numscalars = state->NumScalars;
+  int nx = state->Dim[0];
+  int ny = state->Dim[1];
+  int nz = state->Dim[2];
+  vtkIdType incY = state->Inc[1];
+  vtkIdType incZ = state->Inc[2];
+  std::vector<vtkIdType> &frontier = state->Frontier[threadId];
+
+  for (int idZ = state->SlabExtent[threadId][0];
+       idZ <= state->SlabExtent[threadId][1]; idZ++)
+    {
+    for (int idY = 0; idY < ny; idY++)
+      {
+      vtkIdType idx = idZ*incZ + idY*incY;
+      T *alphaPtr = outPtr + idx*(numscalars + 1) + numscalars;
+      for (int idX = 0; idX < nx; idX++, idx++, alphaPtr += numscalars + 1)
+        {
+        if (*alphaPtr != 0)
+          {
+          continue;
+          }
+        int stride = numscalars + 1;
+        if ((idX > 0 && alphaPtr[-stride] == 255) ||
+            (idX < nx-1 && alphaPtr[stride] == 255) ||
+            (idY > 0 && alphaPtr[-incY*stride] == 255) ||
+            (idY < ny-1 && alphaPtr[incY*stride] == 255) ||
+            (idZ > 0 && alphaPtr[-incZ*stride] == 255) ||
+            (idZ < nz-1 && alphaPtr[incZ*stride] == 255))
+          {
+          *alphaPtr = VTK_FREEHAND_FILL_QUEUED;
+          frontier.push_back(idx);
+          }
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Fill the frontier voxels that belong to this thread.
+template <class T>
+static void vtkFreehand2FillFrontier(vtkFreehand2FillState *state, T *outPtr,
+                                     int threadId)
+{
+  int numscalars = state->NumScalars;
+  int stride = numscalars + 1;
+  int r = state->Radius;
+  int nx = state->Dim[0];
+  int ny = state->Dim[1];
+  int nz = state->Dim[2];
+  vtkIdType nxy = state->Inc[2];
+  float *accPtr = 0;
+  if (state->Mode == VTK_FREEHAND_HOLE_FILL_GAUSSIAN)
+    {
+    accPtr = state->AccPtr;
+    }
+  int kernelSize = static_cast<int>(state->Kernel.size());
+  const vtkFreehand2FillKernelElement *kernel = &state->Kernel[0];
+  std::vector<vtkIdType> &frontier = state->Frontier[threadId];
+  std::vector<vtkIdType> &filled = state->Filled[threadId];
+  // one sum per scalar component, sized to the data rather than a fixed max
+  std::vector<double> sum(numscalars);
+
+  filled.clear();
+  for (size_t f = 0; f < frontier.size(); f++)
+    {
+    vtkIdType idx = frontier[f];
+    int idZ = static_cast<int>(idx/nxy);
+    int idY = static_cast<int>((idx - idZ*nxy)/nx);
+    int idX = static_cast<int>(idx - idZ*nxy - idY*nx);
+    // voxels that are at least 'r' from the boundary need no bounds checks
+    int interior = (idX >= r && idX < nx - r &&
+                    idY >= r && idY < ny - r &&
+                    idZ >= r && idZ < nz - r);
+
+    T *voxelPtr = outPtr + idx*stride;
+    int c;
+    for (c = 0; c < numscalars; c++)
+      {
+      sum[c] = 0;
+      }
+    double wsum = 0;
+    int n = 0;
+
+    for (int e = 0; e < kernelSize; e++)
+      {
+      const vtkFreehand2FillKernelElement &k = kernel[e];
+      if (!interior &&
+          (idX + k.I < 0 || idX + k.I >= nx ||
+           idY + k.J < 0 || idY + k.J >= ny ||
+           idZ + k.K < 0 || idZ + k.K >= nz))
+        {
+        continue;
+        }
+      T *blockPtr = voxelPtr + k.Offset*stride;
+      if (blockPtr[numscalars] != 255)
+        {
+        continue;
+        }
+      double w = k.Weight;
+      if (accPtr)
+        { // weigh by the accumulation buffer
+        w *= accPtr[idx + k.Offset];
+        }
+      for (c = 0; c < numscalars; c++)
+        {
+        sum[c] += w*blockPtr[c];
+        }
+      wsum += w;
+      n++;
+      }
+
+    if (n >= state->MinNeighbors && wsum > 0)
+      {
+      double f = 1.0/wsum;
+      for (c = 0; c < numscalars; c++)
+        {
+        vtkUltraRound(sum[c]*f, voxelPtr[c]);
+        }
+      voxelPtr[numscalars] = VTK_FREEHAND_FILL_PENDING;
+      filled.push_back(idx);
+      }
+    else
+      {
+      // not enough neighbors, it might be picked up again by a later pass
+      voxelPtr[numscalars] = 0;
+      }
+    }
+  frontier.clear();
+}
+
+//----------------------------------------------------------------------------
+// Commit the voxels that were filled by this thread, and if the kernel is
+// growing, hand their empty neighbors to the threads that own them.
+template <class T>
+static void vtkFreehand2FillCommit(vtkFreehand2FillState *state, T *outPtr,
+                                   int threadId)
+{
+  int numscalars = state->NumScalars;
+  int stride = numscalars + 1;
+  int nx = state->Dim[0];
+  int ny = state->Dim[1];
+  int nz = state->Dim[2];
+  vtkIdType nxy = state->Inc[2];
+  std::vector<vtkIdType> &filled = state->Filled[threadId];
+  std::vector<vtkIdType> *handoff = state->Handoff[threadId];
+
+  static const int neighbors[6][3] =
+    { {-1,0,0}, {1,0,0}, {0,-1,0}, {0,1,0}, {0,0,-1}, {0,0,1} };
+
+  for (size_t f = 0; f < filled.size(); f++)
+    {
+    vtkIdType idx = filled[f];
+    outPtr[idx*stride + numscalars] = 255;
+    if (!state->Grow)
+      {
+      continue;
+      }
+    int idZ = static_cast<int>(idx/nxy);
+    int idY = static_cast<int>((idx - idZ*nxy)/nx);
+    int idX = static_cast<int>(idx - idZ*nxy - idY*nx);
+    for (int m = 0; m < 6; m++)
+      {
+      int x = idX + neighbors[m][0];
+      int y = idY + neighbors[m][1];
+      int z = idZ + neighbors[m][2];
+      if (x < 0 || x >= nx || y < 0 || y >= ny || z < 0 || z >= nz)
+        {
+        continue;
+        }
+      vtkIdType nidx = z*nxy + y*nx + x;
+      if (outPtr[nidx*stride + numscalars] == 0)
+        {
+        handoff[state->SlabForZ[z]].push_back(nidx);
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Collect the voxels that other threads found in this thread's slab.
+template <class T>
+static void vtkFreehand2FillGather(vtkFreehand2FillState *state, T *outPtr,
+                                   int threadId)
+{
+  int numscalars = state->NumScalars;
+  int stride = numscalars + 1;
+  std::vector<vtkIdType> &frontier = state->Frontier[threadId];
+
+  for (int i = 0; i < state->NumberOfSlabs; i++)
+    {
+    std::vector<vtkIdType> &handoff = state->Handoff[i][threadId];
+    for (size_t h = 0; h < handoff.size(); h++)
+      {
+      vtkIdType idx = handoff[h];
+      T *alphaPtr = outPtr + idx*stride + numscalars;
+      if (*alphaPtr == 0)
+        {
+        *alphaPtr = VTK_FREEHAND_FILL_QUEUED;
+        frontier.push_back(idx);
+        }
+      }
+    handoff.clear();
+    }
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+static void vtkFreehand2FillStageExecute(vtkFreehand2FillState *state,
+                                         T *outPtr, int threadId)
+{
+  switch (state->Stage)
+    {
+    case VTK_FREEHAND_FILL_STAGE_SEED:
+      vtkFreehand2FillSeed(state, outPtr, threadId);
+      break;
+    case VTK_FREEHAND_FILL_STAGE_FILL:
+      vtkFreehand2FillFrontier(state, outPtr, threadId);
+      break;
+    case VTK_FREEHAND_FILL_STAGE_COMMIT:
+      vtkFreehand2FillCommit(state, outPtr, threadId);
+      break;
+    case VTK_FREEHAND_FILL_STAGE_GATHER:
+      vtkFreehand2FillGather(state, outPtr, threadId);
+      break;
+    }
+}
+
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkFreehand2FrontierFillExecute( void *arg )
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  vtkFreehand2FillState *state =
+    (vtkFreehand2FillState *)(((ThreadInfoStruct *)(arg))->UserData);
+
+  if (threadId >= state->NumberOfSlabs)
+    {
+    return VTK_THREAD_RETURN_VALUE;
+    }
+
+  switch (state->ScalarType)
+    {
+    case VTK_SHORT:
+      vtkFreehand2FillStageExecute(state, (short *)(state->OutPtr), threadId);
+      break;
+    case VTK_UNSIGNED_SHORT:
+      vtkFreehand2FillStageExecute(state, (unsigned short *)(state->OutPtr),
+                                   threadId);
+      break;
+    case VTK_UNSIGNED_CHAR:
+      vtkFreehand2FillStageExecute(state, (unsigned char *)(state->OutPtr),
+                                   threadId);
+      break;
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// FrontierFill
+// Fill holes with the DistanceWeighted, Growing or Gaussian kernels
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::FrontierFill(vtkImageData *outData)
+{
+  int scalarType = outData->GetScalarType();
+  if (scalarType != VTK_SHORT && scalarType != VTK_UNSIGNED_SHORT &&
+      scalarType != VTK_UNSIGNED_CHAR)
+    {
+    vtkErrorMacro(<< "FillHolesInOutput: Unknown input ScalarType");
+    return;
+    }
+
+  int *outExt = this->OutputExtent;
+  vtkFreehand2FillState *state = new vtkFreehand2FillState;
+  state->Filter = this;
+  state->OutPtr = outData->GetScalarPointerForExtent(outExt);
+  state->AccPtr = 0;
+  if (this->Compounding)
+    {
+    state->AccPtr = (float *)
+      this->AccumulationBuffer->GetScalarPointerForExtent(outExt);
+    }
+  state->ScalarType = scalarType;
+  state->NumScalars = outData->GetNumberOfScalarComponents() - 1;
+  for (int a = 0; a < 3; a++)
+    {
+    state->Dim[a] = outExt[2*a+1] - outExt[2*a] + 1;
+    }
+  state->Inc[0] = 1;
+  state->Inc[1] = state->Dim[0];
+  state->Inc[2] = state->Inc[1]*state->Dim[1];
+  state->Mode = this->HoleFillingMode;
+  state->Radius = this->HoleFillingRadius;
+  state->MinNeighbors = this->HoleFillingMinNeighbors;
+  state->Grow = (this->HoleFillingMode == VTK_FREEHAND_HOLE_FILL_GROWING);
+  vtkFreehand2BuildFillKernel(state, this->HoleFillingSigma);
+
+  // split the volume into one z slab per thread
+  int numThreads = this->HoleFillingNumberOfThreads;
+  if (numThreads > state->Dim[2])
+    {
+    numThreads = state->Dim[2];
+    }
+  state->NumberOfSlabs = numThreads;
+  state->SlabForZ.resize(state->Dim[2]);
+  int i;
+  for (i = 0; i < numThreads; i++)
+    {
+    state->SlabExtent[i][0] = (i*state->Dim[2])/numThreads;
+    state->SlabExtent[i][1] = ((i + 1)*state->Dim[2])/numThreads - 1;
+    for (int z = state->SlabExtent[i][0]; z <= state->SlabExtent[i][1]; z++)
+      {
+      state->SlabForZ[z] = i;
+      }
+    state->Handoff[i] = new std::vector<vtkIdType>[numThreads];
+    }
+
+  this->Threader->SetNumberOfThreads(numThreads);
+  this->Threader->SetSingleMethod(vtkFreehand2FrontierFillExecute, state);
+
+  int maxPasses = (state->Grow ? this->HoleFillingMaxPasses : 1);
+  state->Stage = VTK_FREEHAND_FILL_STAGE_SEED;
+  this->Threader->SingleMethodExecute();
+
+  for (int pass = 0; pass < maxPasses; pass++)
+    {
+    vtkIdType frontierSize = 0;
+    for (i = 0; i < numThreads; i++)
+      {
+      frontierSize += static_cast<vtkIdType>(state->Frontier[i].size());
+      }
+    if (frontierSize == 0)
+      {
+      break;
+      }
+    this->UpdateProgress(static_cast<double>(pass)/maxPasses);
+
+    state->Stage = VTK_FREEHAND_FILL_STAGE_FILL;
+    this->Threader->SingleMethodExecute();
+    // don't hand off new frontier voxels after the final pass
+    state->Grow = (state->Grow && pass + 1 < maxPasses);
+    state->Stage = VTK_FREEHAND_FILL_STAGE_COMMIT;
+    this->Threader->SingleMethodExecute();
+    if (state->Grow)
+      {
+      state->Stage = VTK_FREEHAND_FILL_STAGE_GATHER;
+      this->Threader->SingleMethodExecute();
+      }
+    }
+
+  // voxels that are still queued were never visited, mark them as empty
+  int stride = state->NumScalars + 1;
+  for (i = 0; i < numThreads; i++)
+    {
+    for (size_t f = 0; f < state->Frontier[i].size(); f++)
+      {
+      vtkIdType offset = state->Frontier[i][f]*stride + state->NumScalars;
+      switch (scalarType)
+        {
+        case VTK_SHORT:
+          ((short *)(state->OutPtr))[offset] = 0;
+          break;
+        case VTK_UNSIGNED_SHORT:
+          ((unsigned short *)(state->OutPtr))[offset] = 0;
+          break;
+        case VTK_UNSIGNED_CHAR:
+          ((unsigned char *)(state->OutPtr))[offset] = 0;
+          break;
+        }
+      }
+    delete [] state->Handoff[i];
+    }
+  this->UpdateProgress(1.0);
+
+  delete state;
+}
+
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::FillHolesInOutput()
+{
+  // TODO note that I think calls to internalexecuteinformation should be
+  // replaced with calls to requestinformation
+//  this->InternalExecuteInformation();
+  // this->GetOutput()->Update();
+  // TODO should replace this with requestinformation for vtk 5
+  this->UpdateInformation();
+  if (this->NeedsClear)
+    {
+    //this->UpdateInformation();
+    this->InternalClearOutput();
+    }
+
+  vtkImageData *outData = this->GetOutput();
+  if (this->HoleFillingMode == VTK_FREEHAND_HOLE_FILL_AVERAGE)
+    {
+    this->MultiThreadFill(outData);
+    }
+  else
+    {
+    this->FrontierFill(outData);
+    }
+
+  this->Modified(); 
+}
+
+//----------------------------------------------------------------------------
 
 /*
 void vtkFreehandUltrasound2::FillHolesInOutput()
@@ -2384,19 +2378,19 @@ void vtkFreehandUltrasound2::FillHolesInOutput()
   switch (outData->GetScalarType())
     {
     case VTK_SHORT:
-      vtkFreehandUltrasound2FillHolesInOutput(
-                             this, outData, (short *)(outPtr), 
-                             (unsigned short *)(accPtr), outExt);
+      vtkFreehandFillHolesInOutput(
+                             outData, (short *)(outPtr), 
+                             (float *)(accPtr), outExt);
       break;
     case VTK_UNSIGNED_SHORT:
-      vtkFreehandUltrasound2FillHolesInOutput(
-                             this, outData, (unsigned short *)(outPtr),
-                             (unsigned short *)(accPtr), outExt);
+      vtkFreehandFillHolesInOutput(
+                             outData, (unsigned short *)(outPtr),
+                             (float *)(accPtr), outExt);
       break;
     case VTK_UNSIGNED_CHAR:
-      vtkFreehandUltrasound2FillHolesInOutput(
-                             this, outData,(unsigned char *)(outPtr),
-                             (unsigned short *)(accPtr), outExt); 
+      vtkFreehandFillHolesInOutput(
+                             outData, (unsigned char *)(outPtr),
+                             (float *)(accPtr), outExt); 
       break;
     default:
       vtkErrorMacro(<< "FillHolesInOutput: Unknown input ScalarType");
@@ -2491,45 +2485,14 @@ void vtkFreehandUltrasound2::InternalClearOutput()
   // and returning the value)
 		
 		
+	// the accumulation buffer holds a float weight per voxel, and for median
+	// compounding a reservoir of samples per voxel
 	if (this->Compounding)
     {
-
-
-		//std::cout << "we are trying thisssssssssssssssssssssss 3" << std::endl;
-
-    this->AccumulationBuffer->SetExtent(outExtent);
-
-	//std::cout << "we set the extent" << std::endl;
-
-    this->AccumulationBuffer->AllocateScalars();
-
-	//std::cout << "we allocated scalars" << std::endl;
-
-    // GetScalarPointerForExtent returns the pointer for the scalar data
-    void *accPtr = this->AccumulationBuffer->GetScalarPointerForExtent(outExtent);
-
-	//std::cout << "we got scalar pointers for the extent" << std::endl;
-
-    // memset is a fast way to copy characters into a buffer: memset(buffer, ch, count)
-    // copies ch into the first count characters of buffer
-    // so this copies 0 into the first *crazy number* characters of accPtr
-
-   /* memset(accPtr,0,(outExtent[1]-outExtent[0]+1)*
-	   (outExtent[3]-outExtent[2]+1)*
-	   (outExtent[5]-outExtent[4]+1)*
-	   this->AccumulationBuffer->GetScalarSize());*/
-
-	//std::cout << "number of scalar components in the accumulation buffer = " << this->AccumulationBuffer->GetNumberOfScalarComponents() << std::endl;
-
-	// changed by Danielle to incorporate the number of scalar components
-	memset(accPtr,0,((outExtent[1]-outExtent[0]+1)*
-	   (outExtent[3]-outExtent[2]+1)*
-	   (outExtent[5]-outExtent[4]+1)*
-	   this->AccumulationBuffer->GetScalarSize()*this->AccumulationBuffer->GetNumberOfScalarComponents()));
-
-
-
-	//std::cout << " we memset the accumulation buffer" << std::endl;
+    vtkFreehand2AllocateAccumulation(this->AccumulationBuffer, outExtent,
+      this->GetOutput()->GetScalarType(),
+      this->GetOutput()->GetNumberOfScalarComponents() - 1,
+      this->CompoundingMode);
 	}
 
 	//std::cout << "we are finished thisssssssssssssssssssss 3" << std::endl;
@@ -2540,35 +2503,68 @@ void vtkFreehandUltrasound2::InternalClearOutput()
     this->LastIndexMatrix = NULL;
     }
 
-  this->SetPixelCount(0,0);
-  this->SetPixelCount(1,0);
-  this->SetPixelCount(2,0);
-  this->SetPixelCount(3,0);
+  for (int t = 0; t < VTK_MAX_THREADS; t++)
+    {
+    this->SetPixelCount(t,0);
+    }
   this->NeedsClear = 0;
+
+  if (this->Preview)
+    {
+    this->InternalClearPreview();
+    }
 }
 
 //----------------------------------------------------------------------------
-// vtkIsIdentityMatrix
-// check a matrix to see whether it is the identity matrix
+// GetPreviewExtent
+// The extent of the preview volume: it has the same origin as the output,
+// and each preview voxel is PreviewShrinkFactor output voxels wide
 //----------------------------------------------------------------------------
-static int vtkIsIdentityMatrix(vtkMatrix4x4 *matrix)
+void vtkFreehandUltrasound2::GetPreviewExtent(int extent[6])
 {
-  static double identity[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
-  int i,j;
-
-  for (i = 0; i < 4; i++)
+  double f = this->PreviewShrinkFactor;
+  for (int i = 0; i < 6; i++)
     {
-    for (j = 0; j < 4; j++)
-      {
-      if (matrix->GetElement(i,j) != identity[4*i+j])
-        {
-        return 0;
-        }
-      }
+    extent[i] = vtkUltraFloor(this->OutputExtent[i]/f);
     }
-  return 1;
 }
 
+//----------------------------------------------------------------------------
+// InternalClearPreview
+// Allocate and clear the preview volume
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::InternalClearPreview()
+{
+  vtkImageData *outData = this->GetOutput();
+  int previewExtent[6];
+  this->GetPreviewExtent(previewExtent);
+
+  this->PreviewOutput->SetWholeExtent(previewExtent);
+  this->PreviewOutput->SetExtent(previewExtent);
+  this->PreviewOutput->SetUpdateExtent(previewExtent);
+  this->PreviewOutput->SetSpacing(
+    this->OutputSpacing[0]*this->PreviewShrinkFactor,
+    this->OutputSpacing[1]*this->PreviewShrinkFactor,
+    this->OutputSpacing[2]*this->PreviewShrinkFactor);
+  this->PreviewOutput->SetOrigin(this->OutputOrigin);
+  this->PreviewOutput->SetScalarType(outData->GetScalarType());
+  this->PreviewOutput->SetNumberOfScalarComponents(
+    outData->GetNumberOfScalarComponents());
+  this->PreviewOutput->AllocateScalars();
+  memset(this->PreviewOutput->GetScalarPointer(), 0,
+         this->PreviewOutput->GetNumberOfPoints()*
+         this->PreviewOutput->GetNumberOfScalarComponents()*
+         this->PreviewOutput->GetScalarSize());
+
+  if (this->Compounding)
+    {
+    vtkFreehand2AllocateAccumulation(this->PreviewAccumulationBuffer,
+      previewExtent, outData->GetScalarType(),
+      outData->GetNumberOfScalarComponents() - 1, this->CompoundingMode);
+    }
+
+  this->PreviewOutput->Modified();
+}
 //----------------------------------------------------------------------------
 // The transform matrix supplied by the user converts output coordinates
 // to input coordinates.  
@@ -2576,6 +2572,14 @@ static int vtkIsIdentityMatrix(vtkMatrix4x4 *matrix)
 // matrix which converts output pixel indices to input pixel indices.
 
 vtkMatrix4x4 *vtkFreehandUltrasound2::GetIndexMatrix()
+{
+  return this->GetIndexMatrix(this->GetSlice());
+}
+
+//----------------------------------------------------------------------------
+// Get the index matrix for the given slice, which must have the same
+// geometry as the slices that will be inserted with the matrix
+vtkMatrix4x4 *vtkFreehandUltrasound2::GetIndexMatrix(vtkImageData *inData)
 {
   // first verify that we have to update the matrix
   if (this->IndexMatrix == NULL)
@@ -2588,8 +2592,8 @@ vtkMatrix4x4 *vtkFreehandUltrasound2::GetIndexMatrix()
   vtkFloatingPointType outOrigin[3];
   vtkFloatingPointType outSpacing[3];
 
-  this->GetSlice()->GetSpacing(inSpacing);
-  this->GetSlice()->GetOrigin(inOrigin);
+  inData->GetSpacing(inSpacing);
+  inData->GetOrigin(inOrigin);
   this->GetOutput()->GetSpacing(outSpacing);
   this->GetOutput()->GetOrigin(outOrigin);  
   
@@ -2664,2355 +2668,2118 @@ vtkMatrix4x4 *vtkFreehandUltrasound2::GetIndexMatrix()
 //----------------------------------------------------------------------------
 //----------------------------------------------------------------------------
 
-//----------------------------------------------------------------------------
-// helper functions for vtkOptimizedExecute()
-
-// find approximate intersection of line with the plane x = x_min,
-// y = y_min, or z = z_min (lower limit of data extent) 
 
-template<class F>
-static inline
-int intersectionHelper(F *point, F *axis, int *limit, int ai, int *inExt)
+//----------------------------------------------------------------------------
+// vtkOptimizedInsertSlice
+// Actually inserts the slice, with optimization, compounding with the
+// policy C, using the shared kernels in vtkFreehandUltrasoundCore.h.
+// Only the x limits of the clip rectangle are applied, and the rows and
+// columns are flipped as requested by FlipHorizontalOnOutput and
+// FlipVerticalOnOutput.
+//----------------------------------------------------------------------------
+template <class C, class F, class T>
+static void vtkOptimizedInsertSlice(vtkFreehandUltrasound2 *self, // the freehand us
+                                    vtkImageData *outData, // the output volume
+                                    T *outPtr, // scalar pointer to the output volume over the output extent
+                                    float *accPtr, // scalar pointer to the accumulation buffer over the output extent
+                                    T *resPtr, // the median reservoir over the output extent, if any
+                                    vtkImageData *inData, // input slice
+                                    T *inPtr, // scalar pointer to the input volume over the input slice extent
+                                    int inExt[6], // input slice extent (could have been split for threading)
+                                    F matrix[4][4], // index matrix, output indices -> input indices
+                                    int threadId) // current thread id
 {
-  F rd = limit[ai]*point[3]-point[ai]  + 0.5; 
-    
-  if (rd < inExt[0])
-    { 
-    return inExt[0];
-    }
-  else if (rd > inExt[1])
-    {
-    return inExt[1];
-    }
-  else
-    {
-    return int(rd);
-    }
+  int flipRows = self->GetFlipHorizontalOnOutput();
+  int flipOrigin = self->GetNumberOfPixelsFromTipOfFanToBottomOfScreen();
+  vtkUltrasoundFanMask *mask = vtkFreehandGetFanMask(self, inData, 0,
+                                                     flipRows, flipOrigin);
+
+  int hits = vtkFreehandOptimizedInsertSlice<C>(
+    self->GetInterpolationMode(), self, mask, outData, outPtr, accPtr,
+    resPtr, inData, inPtr, inExt, matrix, flipRows, flipOrigin,
+    self->GetFlipVerticalOnOutput(), threadId);
+  self->IncrementPixelCount(threadId, hits);
+
+  vtkUltrasoundFanMask::ReleaseCachedMask(mask);
 }
 
-template <class F>
-static int intersectionLow(F *point, F *axis, int *sign,
-                           int *limit, int ai, int *inExt)
+//----------------------------------------------------------------------------
+// Choose the compounding policy once per slice, median compounding needs a
+// reservoir and falls back to the mean without one
+template <class F, class T>
+static void vtkOptimizedInsertSlice(vtkFreehandUltrasound2 *self,
+                                    vtkImageData *outData, T *outPtr,
+                                    float *accPtr, T *resPtr,
+                                    vtkImageData *inData, T *inPtr,
+                                    int inExt[6], F matrix[4][4],
+                                    int threadId)
 {
-  // approximate value of r
-  int r = intersectionHelper(point,axis,limit,ai,inExt);
-
-  // move back and forth to find the point just inside the extent
-  for (;;)
+  switch (accPtr ? self->GetCompoundingMode() : VTK_FREEHAND_COMPOUND_MEAN)
     {
-    F p = point[ai]+r*axis[ai];
-
-    if ((sign[ai] < 0 && r > inExt[0] ||
-         sign[ai] > 0 && r < inExt[1]) && 
-        vtkUltraRound(p) < limit[ai])
-      {
-      r += sign[ai];
-      }
-    else
-      {
+    case VTK_FREEHAND_COMPOUND_MAX:
+      vtkOptimizedInsertSlice<vtkFreehandCompoundMax>(self, outData,
+        outPtr, accPtr, resPtr, inData, inPtr, inExt, matrix, threadId);
       break;
-      }
-    }
-
-  for (;;)
-    {
-    F p = point[ai]+(r-sign[ai])*axis[ai];
-
-    if ((sign[ai] > 0 && r > inExt[0] ||
-         sign[ai] < 0 && r < inExt[1]) && 
-        vtkUltraRound(p) >= limit[ai])
-      {
-      r -= sign[ai];
-      }
-    else
-      {
+    case VTK_FREEHAND_COMPOUND_LATEST:
+      vtkOptimizedInsertSlice<vtkFreehandCompoundLatest>(self, outData,
+        outPtr, accPtr, resPtr, inData, inPtr, inExt, matrix, threadId);
+      break;
+    case VTK_FREEHAND_COMPOUND_DISTANCE_WEIGHTED:
+      vtkOptimizedInsertSlice<vtkFreehandCompoundDistanceWeighted>(self,
+        outData, outPtr, accPtr, resPtr, inData, inPtr, inExt, matrix,
+        threadId);
+      break;
+    case VTK_FREEHAND_COMPOUND_MEDIAN:
+      if (resPtr)
+        {
+        vtkOptimizedInsertSlice<vtkFreehandCompoundMedian>(self, outData,
+          outPtr, accPtr, resPtr, inData, inPtr, inExt, matrix, threadId);
+        break;
+        }
+    default:
+      vtkOptimizedInsertSlice<vtkFreehandCompoundMean>(self, outData,
+        outPtr, accPtr, resPtr, inData, inPtr, inExt, matrix, threadId);
       break;
-      }
     }
-
-  return r;
 }
 
-// same as above, but for x = x_max
-template <class F>
-static int intersectionHigh(F *point, F *axis, int *sign, 
-                            int *limit, int ai, int *inExt)
+//----------------------------------------------------------------------------
+// vtkFreehand2ThreadedExecute
+// this mess is really a simple function. All it does is call
+// the ThreadedSliceExecute method after setting the correct
+// extent for this thread. Its just a pain to calculate
+// the correct extent.
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkFreehand2ThreadedExecute( void *arg )
 {
-  // approximate value of r
-  int r = intersectionHelper(point,axis,limit,ai,inExt);
-    
-  // move back and forth to find the point just inside the extent
-  for (;;)
-    {
-    F p = point[ai]+r*axis[ai];
-
-    if ((sign[ai] > 0 && r > inExt[0] ||
-         sign[ai] < 0 && r < inExt[1]) &&
-        vtkUltraRound(p) > limit[ai])
-      {
-      r -= sign[ai];
-      }
-    else
-      {
-      break;
-      }
-    }
 
-  for (;;)
-    {
-    F p = point[ai]+(r+sign[ai])*axis[ai];
 
-    if ((sign[ai] < 0 && r > inExt[0] ||
-         sign[ai] > 0 && r < inExt[1]) && 
-        vtkUltraRound(p) <= limit[ai])
-      {
-      r += sign[ai];
-      }
-    else
-      {
-      break;
-      }
-    }
+  vtkFreehand2ThreadStruct *str; // contains the filter, input and output
+  int ext[6], splitExt[6], total; // the input slice extent, the input slice extent
+                                  // for this thread, and the total number of pieces
+                                  // the extent can be split into (i.e. the number of
+                                  // threads we should use)
+  int threadId, threadCount; // thread id and number of threads, from the argument
+  vtkImageData *input; // the slice input
 
-  return r;
-}
+  // get the thread id and number of threads
+  threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
 
-template <class F>
-static int isBounded(F *point, F *xAxis, int *inMin, 
-                     int *inMax, int ai, int r)
-{
-  int bi = ai+1; 
-  int ci = ai+2;
-  if (bi > 2) 
-    { 
-    bi -= 3; // coordinate index must be 0, 1 or 2 
-    } 
-  if (ci > 2)
-    { 
-    ci -= 3;
-    }
-
-  F fbp = point[bi]+r*xAxis[bi];
-  F fcp = point[ci]+r*xAxis[ci];
-
-  int bp = vtkUltraRound(fbp);
-  int cp = vtkUltraRound(fcp);
-  
-  return (bp >= inMin[bi] && bp <= inMax[bi] &&
-          cp >= inMin[ci] && cp <= inMax[ci]);
-}
+  // get the filter, input and output in the form of a vtkFreehand2ThreadStruct
+  // and get the input extent
+  str = (vtkFreehand2ThreadStruct *)(((ThreadInfoStruct *)(arg))->UserData);
+  input = str->Input;
+  input->GetUpdateExtent( ext );
 
-// this huge mess finds out where the current output raster
-// line intersects the input volume
 
-static void vtkUltraFindExtentHelper(int &r1, int &r2, int sign, int *inExt)
-{
-  if (sign < 0)
-    {
-    int i = r1;
-    r1 = r2;
-    r2 = i;
-    }
   
-  // bound r1,r2 within reasonable limits
-  if (r1 < inExt[0]) 
-    {
-    r1 = inExt[0];
-    }
-  if (r2 > inExt[1]) 
-    {
-    r2 = inExt[1];
-    }
-  if (r1 > r2) 
-    {
-    r1 = inExt[0];
-    r2 = inExt[0]-1;
-    }
-}  
+	//std::cout << "***********************************" << std::endl;
+	//std::cout << "vtkFreehand2ThreadedExecute"<<std::endl;
+	int trialextent[6];
+	str->Output->GetUpdateExtent(trialextent);
+	//std::cout << "output UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
+	
 
-template <class F>
-static void vtkUltraFindExtent(int& r1, int& r2, F *point, F *xAxis, 
-                                 int *inMin, int *inMax, int *inExt)
-{
-  int i, ix, iy, iz;
-  int sign[3];
-  int indx1[4],indx2[4];
-  F p1,p2;
 
-  // find signs of components of x axis 
-  // (this is complicated due to the homogeneous coordinate)
-  for (i = 0; i < 3; i++)
-    {
-    p1 = point[i];
 
-    p2 = point[i]+xAxis[i];
 
-    if (p1 <= p2)
-      {
-      sign[i] = 1;
-      }
-    else 
-      {
-      sign[i] = -1;
-      }
-    } 
-  
-  // order components of xAxis from largest to smallest
+
+  // execute the actual method with appropriate extent
+  // first find out how many pieces the extent can be split into and calculate
+  // the extent for this thread (the splitExt)
+  // TODO the documentation for SplitSliceExtent says that it needs to be called
+  // threadCount times in order to update the split extent for each threadID -
+  // when does that happen?... maybe because we are only using one thread at the moment...
+  // but that depends on the calling function
+  total = str->Filter->SplitSliceExtent(splitExt, ext, threadId, threadCount);
+  //total = 1;
   
-  ix = 0;
-  for (i = 1; i < 3; i++)
+  // if we can use this thread, then call ThreadedSliceExecute
+  if (threadId < total)
     {
-    if (((xAxis[i] < 0) ? (-xAxis[i]) : (xAxis[i])) >
-        ((xAxis[ix] < 0) ? (-xAxis[ix]) : (xAxis[ix])))
-      {
-      ix = i;
-      }
+    str->Filter->ThreadedSliceExecute(str->Input, str->Output,
+				      splitExt, threadId);
     }
+  // else
+  //   {
+  //   otherwise don't use this thread. Sometimes the threads dont
+  //   break up very well and it is just as efficient to leave a 
+  //   few threads idle.
+  //   }
   
-  iy = ((ix > 1) ? ix-2 : ix+1);
-  iz = ((ix > 0) ? ix-1 : ix+2);
-
-  if (((xAxis[iy] < 0) ? (-xAxis[iy]) : (xAxis[iy])) >
-      ((xAxis[iz] < 0) ? (-xAxis[iz]) : (xAxis[iz])))
-    {
-    i = iy;
-    iy = iz;
-    iz = i;
-    }
+  return VTK_THREAD_RETURN_VALUE;
+}
 
-  r1 = intersectionLow(point,xAxis,sign,inMin,ix,inExt);
-  r2 = intersectionHigh(point,xAxis,sign,inMax,ix,inExt);
-  
-  // find points of intersections
-  // first, find w-value for perspective (will usually be 1)
-  for (i = 0; i < 3; i++)
-    {
-    p1 = point[i]+r1*xAxis[i];
-    p2 = point[i]+r2*xAxis[i];
+//----------------------------------------------------------------------------
+// SplitSliceExtent
+// For streaming and threads.  Splits the output update extent (startExt) into
+// "total" pieces and calculates the split extent for the thread of thread id
+// "num".  This method needs to be called "total" times
+// with different values of num (thread id) to fill in the split extents for each
+// therad.  This method returns the number of pieces resulting from a successful
+// split - from 1 to "total".  If 1 is returned, the extent cannot be split.
+// 
+// TODO Old description - I think there are some errors here:
+// For streaming and threads.  Splits output update extent into num pieces.
+// This method needs to be called num times.  Results must not overlap for
+// consistent starting extent.  Subclass can override this method.
+// This method returns the number of peices resulting from a successful split.
+// This can be from 1 to "total".  
+// If 1 is returned, the extent cannot be split.
+//----------------------------------------------------------------------------
+int vtkFreehandUltrasound2::SplitSliceExtent(int splitExt[6], // the extent of this split
+					    int startExt[6],  //the original extent to be split up
+					    int num, // current thread id
+					    int total) // the maximum number of threads (pieces)
+{
+  // prints where we are, the starting extent, num and total for debugging
+   vtkDebugMacro("SplitSliceExtent: ( " << startExt[0] << ", " << startExt[1]
+		<< ", "
+                << startExt[2] << ", " << startExt[3] << ", "
+                << startExt[4] << ", " << startExt[5] << "), " 
+                << num << " of " << total);
 
-    indx1[i] = vtkUltraRound(p1);
-    indx2[i] = vtkUltraRound(p2);
-    }
-  if (isBounded(point,xAxis,inMin,inMax,ix,r1))
-    { // passed through x face, check opposing face
-    if (isBounded(point,xAxis,inMin,inMax,ix,r2))
-      {
-      vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-      return;
-      }
-    
-    if (indx2[iy] < inMin[iy])
-      { // check y face
-      r2 = intersectionLow(point,xAxis,sign,inMin,iy,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iy,r2))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    else if (indx2[iy] > inMax[iy])
-      { // check other y face
-      r2 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iy,r2))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    
-    if (indx2[iz] < inMin[iz])
-      { // check z face
-      r2 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    else if (indx2[iz] > inMax[iz])
-      { // check other z face
-      r2 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    }
-  
-  if (isBounded(point,xAxis,inMin,inMax,ix,r2))
-    { // passed through the opposite x face
-    if (indx1[iy] < inMin[iy])
-      { // check y face
-      r1 = intersectionLow(point,xAxis,sign,inMin,iy,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iy,r1))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    else if (indx1[iy] > inMax[iy])
-      { // check other y face
-      r1 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iy,r1))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    
-    if (indx1[iz] < inMin[iz])
-      { // check z face
-      r1 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    else if (indx1[iz] > inMax[iz])
-      { // check other z face
-      r1 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-      if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-        {
-        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
-        return;
-        }
-      }
-    }
-  
-  if ((indx1[iy] >= inMin[iy] && indx2[iy] < inMin[iy]) ||
-      (indx1[iy] < inMin[iy] && indx2[iy] >= inMin[iy]))
-    { // line might pass through bottom face
-    r1 = intersectionLow(point,xAxis,sign,inMin,iy,inExt);
-    if (isBounded(point,xAxis,inMin,inMax,iy,r1))
-      {
-      if ((indx1[iy] <= inMax[iy] && indx2[iy] > inMax[iy]) ||
-          (indx1[iy] > inMax[iy] && indx2[iy] <= inMax[iy]))
-        { // line might pass through top face
-        r2 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iy,r2))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        }
-      
-      if (indx1[iz] < inMin[iz] && indx2[iy] < inMin[iy] ||
-          indx2[iz] < inMin[iz] && indx1[iy] < inMin[iy])
-        { // line might pass through in-to-screen face
-        r2 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        }
-      else if (indx1[iz] > inMax[iz] && indx2[iy] < inMin[iy] ||
-               indx2[iz] > inMax[iz] && indx1[iy] < inMin[iy])
-        { // line might pass through out-of-screen face
-        r2 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        } 
-      }
-    }
-  
-  if ((indx1[iy] <= inMax[iy] && indx2[iy] > inMax[iy]) ||
-      (indx1[iy] > inMax[iy] && indx2[iy] <= inMax[iy]))
-    { // line might pass through top face
-    r2 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
-    if (isBounded(point,xAxis,inMin,inMax,iy,r2))
-      {
-      if (indx1[iz] < inMin[iz] && indx2[iy] > inMax[iy] ||
-          indx2[iz] < inMin[iz] && indx1[iy] > inMax[iy])
-        { // line might pass through in-to-screen face
-        r1 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        }
-      else if (indx1[iz] > inMax[iz] && indx2[iy] > inMax[iy] || 
-               indx2[iz] > inMax[iz] && indx1[iy] > inMax[iy])
-        { // line might pass through out-of-screen face
-        r1 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
-          return;
-          }
-        }
-      } 
-    }
-  
-  if ((indx1[iz] >= inMin[iz] && indx2[iz] < inMin[iz]) ||
-      (indx1[iz] < inMin[iz] && indx2[iz] >= inMin[iz]))
-    { // line might pass through in-to-screen face
-    r1 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
-    if (isBounded(point,xAxis,inMin,inMax,iz,r1))
-      {
-      if (indx1[iz] > inMax[iz] || indx2[iz] > inMax[iz])
-        { // line might pass through out-of-screen face
-        r2 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
-        if (isBounded(point,xAxis,inMin,inMax,iz,r2))
-          {
-          vtkUltraFindExtentHelper(r1,r2,sign[iz],inExt);
-          return;
-          }
-        }
-      }
-    }
-  
-  r1 = inExt[0];
-  r2 = inExt[0] - 1;
+  return vtkFreehandSplitSliceExtent(splitExt, startExt, num, total);
 }
 
-// The vtkOptimizedExecute() function uses an optimization which
-// is conceptually simple, but complicated to implement.
-
-// In the un-optimized version, each output voxel
-// is converted into a set of look-up indices for the input data;
-// then, the indices are checked to ensure they lie within the
-// input data extent.
-
-// In the optimized version below, the check is done in reverse:
-// it is first determined which output voxels map to look-up indices
-// within the input data extent.  Then, further calculations are
-// done only for those voxels.  This means that 1) minimal work
-// is done for voxels which map to regions outside fo the input
-// extent (they are just set to the background color) and 2)
-// the inner loops of the look-up and interpolation are
-// tightened relative to the un-uptimized version. 
-
-template<class T>
-static inline void vtkFreehand2OptimizedNNHelper(int r1, int r2,
-                                                double *outPoint,
-                                                double *outPoint1,
-												double *xAxis,
-                                                T *&inPtr, T *outPtr,
-                                                int *outExt, int *outInc,
-                                                int numscalars, 
-                                                unsigned short *accPtr)
+//----------------------------------------------------------------------------
+// MultiThread
+// Setup the threader, and set the single method to be vtkFreehand2ThreadedExecute.
+// Then execute vtkFreehand2ThreadedExecute.
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::MultiThread(vtkImageData *inData,
+                                        vtkImageData *outData)
 {
+  // set up a vtkFreehand2ThreadStruct (defined above)
+  vtkFreehand2ThreadStruct str;
+  str.Filter = this;
+  str.Input = inData;
+  str.Output = outData;
+
+    
+	//std::cout << "***********************************" << std::endl;
+	//std::cout << "MultiThread"<<std::endl;
+	int trialextent[6];
+	str.Output->GetUpdateExtent(trialextent);
+	//std::cout << "output UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
 	
 
-  if (accPtr)  // Nearest-Neighbor, no extent checks, we are compounding
-    {
 
-		//std::cout << "here!!!!" << std::endl;
-    for (int idX = r1; idX <= r2; idX++)
-      {
-      outPoint[0] = outPoint1[0] + idX*xAxis[0]; 
-      outPoint[1] = outPoint1[1] + idX*xAxis[1];
-      outPoint[2] = outPoint1[2] + idX*xAxis[2];
-
-      int outIdX = vtkUltraRound(outPoint[0]) - outExt[0];
-      int outIdY = vtkUltraRound(outPoint[1]) - outExt[2];
-      int outIdZ = vtkUltraRound(outPoint[2]) - outExt[4];
-
-      /* bounds checking turned off to improve performance
-      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
-          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
-          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
-        {
-        cerr << "out of bounds!!!\n";
-        inPtr += numscalars;
-        return;
-        }
-      */
-      int inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
-      T *outPtr1 = outPtr + inc;
-	  //std::cout << "going to make accPtr1" << std::endl;
-      unsigned short *accPtr1 = accPtr + ((unsigned short)(inc/outInc[0])); /////  addresss of the corresponding point in the accumulation buffer
-	  //std::cout << "going to make newa" << std::endl;     
-	  unsigned short newa = *accPtr1 + ((unsigned short)(255)); //////////// intensity of the corresponding accumulation point + 255
-	 // std::cout << "ok" << std::endl;
-	  int i = numscalars;
-      do 
-        {
-        i--;
-		// intensity of the point in the output, if there was no compounding this would be *outPtr1++ = *inPtr++;
-        *outPtr1 = ((*inPtr++)*255 + (*outPtr1)*(*accPtr1))/newa;//////////// intensity of the point in the output
-		outPtr1++;/////////
-        }
-      while (i);
 
-	  		//std::cout << "made outPtr1" << std::endl;
-      *outPtr1 = 255;
-      *accPtr1 = 65535;////////////// intensity of the corresponding point in the accumulation buffer
-      if (newa < 65535)/////
-        {
-        *accPtr1 = newa;//////////// change the intensity of the corresponding point in the accumulation buffer
-        }
-		//std::cout << "made accptr1" << std::endl;
-      }
-    }
-  else
-    {  // Nearest-Neighbor, no extent checks, no accumulation
-    for (int idX = r1; idX <= r2; idX++)
-      {
-      outPoint[0] = outPoint1[0] + idX*xAxis[0]; 
-      outPoint[1] = outPoint1[1] + idX*xAxis[1];
-      outPoint[2] = outPoint1[2] + idX*xAxis[2];
-
-	  // difference between the nearest pixel and the start of the output extent
-      int outIdX = vtkUltraRound(outPoint[0]) - outExt[0];
-      int outIdY = vtkUltraRound(outPoint[1]) - outExt[2];
-      int outIdZ = vtkUltraRound(outPoint[2]) - outExt[4];
-
-      /* bounds checking turned off to improve performance
-      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
-          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
-          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
-        {
-        cerr << "out of bounds!!!\n";
-        inPtr += numscalars;
-        return;
-        }
-      */
-	  // the increment needed to get from the start of the pointer to the output extent to the nearest pixel
-      int inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
-      T *outPtr1 = outPtr + inc; // the output pixel in terms of increments
-      int i = numscalars;
-      do
-        {
-        i--;
-		// copy the input pointer value into the output pointer (this is where the intensities get copied)
-		*outPtr1++ = *inPtr++;
-		}
-      while (i);
-      *outPtr1 = 255;
-      }
-    } 
+  
+  // TODO this->NumberOfThreads is never updated past one when threads are
+  // spawned or terminated
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
+  // set the single method
+  this->Threader->SetSingleMethod(vtkFreehand2ThreadedExecute, &str);
+  // execute the single method using this->NumberOfThreads threads
+  this->Threader->SingleMethodExecute();
 }
 
-// specifically optimized for fixed-point (i.e. integer) mathematics
-template <class T>
-static inline void vtkFreehand2OptimizedNNHelper(int r1, int r2,
-                                                fixed *outPoint,
-                                                fixed *outPoint1, fixed *xAxis,
-                                                T *&inPtr, T *outPtr,
-                                                int *outExt, int *outInc,
-                                                int numscalars, 
-                                                unsigned short *accPtr)
+//----------------------------------------------------------------------------
+// OptimizedInsertSlice
+// Given an input and output region, execute the filter algorithm to fill the
+// output from the input - optimized by splitting into x,y,z components or
+// with integer math
+// It just executes a switch statement to call the
+// vtkOptimizedInsertSlice method
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::OptimizedInsertSlice()
 {
-  outPoint[0] = outPoint1[0] + r1*xAxis[0] - outExt[0]; // outPoint changes below, so this is not constant
-  outPoint[1] = outPoint1[1] + r1*xAxis[1] - outExt[2];
-  outPoint[2] = outPoint1[2] + r1*xAxis[2] - outExt[4];
-
-  if (accPtr)  // Nearest-Neighbor, no extent checks
-    {
 
-	//	std::cout << "here!!!!!!!!!!!!" << std::endl; // danielle for debugging
-
-
-    for (int idX = r1; idX <= r2; idX++)
-      {
-      int outIdX = vtkUltraRound(outPoint[0]); // outpoint changes below, so this is not constant
-      int outIdY = vtkUltraRound(outPoint[1]);
-      int outIdZ = vtkUltraRound(outPoint[2]);
-
-      /* bounds checking turned off to improve performance
-      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
-          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
-          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
-        {
-        cerr << "out of bounds!!!\n";
-        inPtr += numscalars;
-        return;
-        }
-      */
-      int inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
-      T *outPtr1 = outPtr + inc;
-	  //std::cout << "making accPtr1" << std::endl;
-      unsigned short *accPtr1 = accPtr + ((unsigned short)(inc/outInc[0])); // divide by outInc[0] to accomodate for the difference
-														// in the number of scalar pointers between the output
-														// and the accumulation buffer
-	 // std::cout << "making newa" << std::endl;
 
+	  
+	//std::cout << "***********************************" << std::endl;
+	//std::cout << "OptimizedInsertSlice"<<std::endl;
+	int trialextent[6];
+	this->GetOutput()->GetUpdateExtent(trialextent);
+	//std::cout << "output UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
 	
-	  //std::cout << (int)outPtr1 << " " << (int)(*outPtr1) << " " << (int)accPtr1 << " " << inc << " " << outInc[0] << " " << << std::endl;
-	  //std::cout << "finished that!" << std::endl;
 
-	/*
-	- outPtr1 = 973417532
-	- *outPtr1 = 0
-	- accPtr1 = 1497181244
-	- inc = 199765020
-	- outInc[2] = 2
-	*/
 
 
-	  //std::cout << (int)(*accPtr1) << std::endl;
-	  //std::cout << "finished second part" << std::endl;
 
+   // cout << "optimized insertslice whole extent: " << this->GetOutput()->GetWholeExtent()[0] << " " << this->GetOutput()->GetWholeExtent()[1] << endl;
+  if (this->ReconstructionThreadId == -1)
+    {
 
-      unsigned short newa = *accPtr1 + ((unsigned short)(255)); // dies here!
-	 // std::cout << "made newa" << std::endl;
-      int i = numscalars;
-      do 
-        {
-        i--;
-        *outPtr1 = ((*inPtr++)*255 + (*outPtr1)*(*accPtr1))/newa;
-        outPtr1++;
-		
-		//std::cout << *accPtr1 << std::endl; // new by danielle for debugging
+		// modified by Danielle
+		//cout << "\t Within OptimizedInsertSlice - reconstructionThreadId == -1\n";
 
-        }
-      while (i);
-	  //std::cout << "fnished the loop" << std::endl;
-      *outPtr1 = 255;
-      *accPtr1 = 65535;
-      if (newa < 65535)
-        {
-        *accPtr1 = newa;
-        }
-	//	std::cout << "finished the if"<< std::endl;
-      outPoint[0] += xAxis[0];
-      outPoint[1] += xAxis[1];
-      outPoint[2] += xAxis[2];
-      }
+    // this->GetOutput()->Update();
+      // TODO note that I think calls to internalexecuteinformation should be replaced with calls to requestinformation
+    // this->InternalExecuteInformation();
+      // TODO should replace this with requestinformation for vtk 5
+		this->UpdateInformation(); // this goes to vtkAlgorithm version (I checked)
+	//return; // ADDED BY CWEDLAKE
     }
-  else
-    {  // Nearest-Neighbor, no extent checks, no accumulation
-
-    for (int idX = r1; idX <= r2; idX++)
-      {
-      int outIdX = vtkUltraRound(outPoint[0]);
-      int outIdY = vtkUltraRound(outPoint[1]);
-      int outIdZ = vtkUltraRound(outPoint[2]);
-
-      /* bounds checking turned off to improve performance
-      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
-          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
-          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
-        {
-        cerr << "out of bounds!!!\n";
-        inPtr += numscalars;
-        return;
-        }
-      */
-      int inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
-      T *outPtr1 = outPtr + inc;
-      int i = numscalars;
-      do
-        {
-        i--;
-        *outPtr1++ = *inPtr++;
-        }
-      while (i);
-      *outPtr1 = 255;
-
-      outPoint[0] += xAxis[0];
-      outPoint[1] += xAxis[1];
-      outPoint[2] += xAxis[2];
-      }
-    } 
-}
-
-//----------------------------------------------------------------------------
-// vtkOptimizedInsertSlice
-// Actually inserts the slice, with optimization.
-//----------------------------------------------------------------------------
-template <class F, class T>
-static void vtkOptimizedInsertSlice(vtkFreehandUltrasound2 *self, // the freehand us
-									vtkImageData *outData, // the output volume
-									T *outPtr, // scalar pointer to the output volume over the output extent
-									unsigned short *accPtr, // scalar pointer to the accumulation buffer over the output extent
-									vtkImageData *inData, // input slice
-									T *inPtr, // scalar pointer to the input volume over the input slice extent
-									int inExt[6], // input slice extent (could have been split for threading)
-									F matrix[4][4], // index matrix, output indices -> input indices
-									int threadId) // current thread id
-{
-	
-
-  /*for (int u = 0; u < 4; u++)
+  if (this->NeedsClear)
     {
-    std::cout << (double)matrix[u][0] << " " << (double)matrix[u][1] << " " << (double)matrix[u][2] << " " << (double)matrix[u][3] << std::endl;
+		// modified by Danielle
+		//cout << "\t Within OptimizedInsertSlice - this->NeedsClear\n";
+    this->InternalClearOutput();
     }
-  std::cout << "*****" << std::endl;*/
-
-	//std::cout << "In vtkOptimizedInsertSlice" << std::endl;
- 
-
-	// added by Danielle
-	int prevPixelCount = self->GetPixelCount();
-
-
-	// local variables
-	int id = 0;
-	int i, numscalars; // numscalars = number of scalar components in the input image
-	int idX, idY, idZ; // the x, y, and z pixel of the input image
-	int inIncX, inIncY, inIncZ; // increments for the input extent
-	int outExt[6]; // output extent
-	int outMax[3], outMin[3]; // the max and min values of the output extents -
-	// if outextent = (x0, x1, y0, y1, z0, z1), then
-	// outMax = (x1, y1, z1) and outMin = (x0, y0, z0)
-	int outInc[3]; // increments for the output extent
-	int clipExt[6];
-	unsigned long count = 0;
-	unsigned long target;
-	int r1,r2;
-	// outPoint0, outPoint1, outPoint is a fancy way of incremetally multiplying the input point by
-	// the index matrix to get the output point... =)  Outpoint is the result
-	F outPoint0[3]; // temp, see above
-	F outPoint1[3]; // temp, see above
-	F outPoint[3]; // this is the final output point, created using Output0 and Output1
-	F xAxis[3], yAxis[3], zAxis[3], origin[3]; // the index matrix (transform), broken up into axes and an origin
-	vtkFloatingPointType inSpacing[3],inOrigin[3]; // input spacing and origin
-
-	// input spacing and origin
-	inData->GetSpacing(inSpacing);
-	inData->GetOrigin(inOrigin);
-
-
-
-	// number of pixels in the x and y directions b/w the fan origin and the slice origin
-	double xf = (self->GetFanOrigin()[0]-inOrigin[0])/inSpacing[0];
-	double yf = (self->GetFanOrigin()[1]-inOrigin[1])/inSpacing[1];
-
-			if (self->GetFlipHorizontalOnOutput())
-			{
-      yf = (double)self->GetNumberOfPixelsFromTipOfFanToBottomOfScreen();
-      }
-
-
-	// fan depth squared
-	double d2 = self->GetFanDepth()*self->GetFanDepth();
-	// input spacing in the x and y directions
-	// TODO in vtkFreehandUltrasound2insertslice they take the fabs here
-	double xs = inSpacing[0];
-	double ys = inSpacing[1];
-	//tan of the left and right fan angles
-        const double degToRad = 0.017453292519943295;
-	double ml = tan(self->GetFanAngles()[0]*degToRad)/xs*ys;
-	double mr = tan(self->GetFanAngles()[1]*degToRad)/xs*ys;
-	// the tan of the right fan angle is always greater than the left one
-	if (ml > mr)
-	{
-		double tmp = ml; ml = mr; mr = tmp;
-	}
 
 
-	//std::cout << "going to get the clip extent" << std::endl;
-
-	// get the clip rectangle as an extent
-	self->GetClipExtent(clipExt, inOrigin, inSpacing, inExt);
+	// added by Danielle for debugging
+	//std::cout << "**************************************" << std::endl;
+	//std::cout << "In optimized insert slice" << std::endl;
+	//int trialextent[6];
+	//this->GetOutput()->GetUpdateExtent(trialextent);
+	//std::cout << "output update extent " << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
+	
+	//std::cout << "OUTPUT IMAGE:" << std::endl;
+	//this->GetOutput()->Print(std::cout);
+	//std::cout << "ACCUMULATION BUFFER" << std::endl;
+	//this->AccumulationBuffer->Print(std::cout);
+	//std::cout << "**************************************" << std::endl;
+	
 
-	// find maximum output range
-	outData->GetExtent(outExt);
 
-	// added by Danielle
-	 //std::cout << "output extent:  " << outExt[0] << " " << outExt[1] << " " << outExt[2] << " " << outExt[3] << " " << outExt[4] << " " << outExt[5] << std::endl;
 
+  vtkImageData *inData = this->GetSlice();
+  vtkImageData *outData = this->GetOutput();
+  //coutcout << "optimized insertslice whole extent: " << this->GetOutput()->GetWholeExtent()[0] << " " << this->GetOutput()->GetWholeExtent()[1] << endl;
+ 
+  this->ActiveFlagLock->Lock();
+  // if not in ReconstructionThread, update the slice here
+  // (otherwise, the slice is updated in vtkReconstructionThread
+  // to ensure synchronization with the tracking)
+  if (this->ReconstructionThreadId == -1) {
+	  // modified by Danielle
+		//cout << "\t Within OptimizedInsertSlice - this->ReconstructionThreadId == -1 still\n";
 
+    inData->SetUpdateExtentToWholeExtent();
+    inData->Update();
 
-	for (i = 0; i < 3; i++)
+	/*if (this->Compounding) // new by Danielle
 	{
-		outMin[i] = outExt[2*i];
-		outMax[i] = outExt[2*i+1];
-	}
+		this->AccumulationBuffer->SetUpdateExtentToWholeExtent();
+		this->AccumulationBuffer->Update();
+	}*/
+
+  }
+  this->ActiveFlagLock->Unlock();
+  //if (this->ReconstructionThreadId == -1) {
+	this->MultiThread(inData, outData);
+  //}
+  this->Modified();
+}
 
-	target = (unsigned long)
-		((inExt[5]-inExt[4]+1)*(inExt[3]-inExt[2]+1)/50.0);
-	target++;
+//----------------------------------------------------------------------------
+// ThreadedSliceExecute
+// This method is passed a input and output region, and executes the filter
+// algorithm to fill the output from the input.
+// It just executes a switch statement to call the correct vtkOptimizedInsertSlice
+// function for the regions data types.
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::ThreadedSliceExecute(vtkImageData *inData, // input data
+						 vtkImageData *outData, // output data
+						 int inExt[6], // input extent (could be split for this thread)
+						 int threadId) // current thread id
+{
 
-	//std::cout << "going to start getting the whole extent of the output " << std::endl;
+	//std::cout << "in ThreadedSliceExecute" << std::endl;
 
-	int wExtent[6]; // output whole extent
-	outData->GetWholeExtent(wExtent);
+// TODO vtkFreehandUltrasound2.cxx says that we need to change ThreadedSliceExecute
+// to ThreadedRequestData...
+// void vtkFreehandUltrasound2::ThreadedRequestData
+// (vtkInformation *,
+//  vtkInformationVector **,
+//  vtkInformationVector*,
+//   vtkImageData ***inputData, 
+//  vtkImageData **outputData,
+//  int inExt[6], int threadId)
+// {
+//   // fprintf(stderr,"inExt %d %d %d %d %d %d\n",inExt[0],inExt[1],inExt[2],inExt[3],inExt[4],inExt[5]);
+//   vtkImageData *inData = inputData[0][0];
+//   vtkImageData *outData = outputData[0];
 
-	// Get Increments to march through data - move from one pixel to the other (remember that we are not
-	// necessarily moving trough the whole image!  We want to be able to easily move through the subset of the extents
-	
-	//std::cout << "going to get the increments of the output" << std::endl;
+  // get scalar pointers for extents and output extent
+  void *inPtr = inData->GetScalarPointerForExtent(inExt);
+  int *outExt = this->OutputExtent;
+  void *outPtr = outData->GetScalarPointerForExtent(outExt);
+ 
+  // get the accumulation buffer and the scalar pointer for its extent, if we are compounding
+  void *accPtr = NULL; 
+  void *resPtr = NULL;
+  vtkImageData *accData = this->AccumulationBuffer;
 
-	outData->GetIncrements(outInc);
-	
-	/*std::cout << "output increments: " << outInc[0] << " " << outInc[1] << " " << outInc[2] << std::endl;
-	std::cout << "output number of scalar components " << outData->GetNumberOfScalarComponents() << std::endl;
-	int tempInc[3];
-	self->GetAccumulationBuffer()->GetIncrements(tempInc);
-	std::cout << "accumulation buffer increments " << tempInc[0] << " " << tempInc[1] << " " << tempInc[2] << std::endl;
-	std::cout << "accumulation buffer number of scalar components " << self->GetAccumulationBuffer()->GetNumberOfScalarComponents() << std::endl;
+  /*std::cout << "the accumulation buffer in threadedsliceexecute:" << std::endl;
+  accData->Print(std::cout);
+  std::cout << "the output in threadedsliceexecute" << std::endl;
+  outData->Print(std::cout);
 */
 
 
-	inData->GetContinuousIncrements(inExt, inIncX, inIncY, inIncZ); // x increment is zero
-	// y increment tells you how to move from the end of one lineto the start of the next one
-	// z increment tells you how to move between images
-	numscalars = inData->GetNumberOfScalarComponents(); // number of scalar components within each "pixel"
+ //this->AccumulationBuffer->Print(std::cout);
 
-	// break matrix into a set of axes plus an origin
-	// (this allows us to calculate the transform Incrementally)
-	for (i = 0; i < 3; i++)
-	{
-		xAxis[i]  = matrix[i][0];   // remember that the matrix is the indexMatrix, and transforms
-		yAxis[i]  = matrix[i][1];	// output pixels to input pixels
-		zAxis[i]  = matrix[i][2];
-		origin[i] = matrix[i][3];
+   if(vtkInformation* pInfo = this->AccumulationBuffer->GetPipelineInformation())
+    {
+    if(pInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT_INITIALIZED()))
+      {
+		 // std::cout << "!!!!!!!!!!!!!!!!!!!!!!!!!!UpdateExtent: Initialized\n";
+      }
+    else
+      {
+		 // std::cout << "!!!!!!!!!!!!!!!!!!!!!!!!!!!!UpdateExtent: Not Initialized\n";
+      }
 	}
 
 
-    static int firstFrame = 1;
-    ofstream outStream;
-    outStream.open("lines.txt");
-
-	//std::cout << "going to start looping through input pixels"<< std::endl;
-
-
-				//TODO take me out
-			/*static int firstTime = 0;
-			ofstream outStream;
-			if (self->GetFlipHorizontalOnOutput())
-			{
-			outStream.open("firstFrame_flip.txt");
-			}
-			else
-			{
-			outStream.open("firstFrame_noFlip.txt");
-			}*/
-
-	// Loop through INPUT pixels - remember this is a 3D cube represented by the input extent
-	for (idZ = inExt[4]; idZ <= inExt[5]; idZ++) // for each image...
-	{
-		//std::cout << "Z = " << idZ<< std::endl;
-
-		outPoint0[0] = origin[0]+idZ*zAxis[0]; // incremental transform
-		outPoint0[1] = origin[1]+idZ*zAxis[1];
-		outPoint0[2] = origin[2]+idZ*zAxis[2];
+	
+	//std::cout << "***********************************" << std::endl;
+	//std::cout << "threaded slice execute"<<std::endl;
+	//std::cout << "THIS->UPDATEExtent" << outExt[0] << " " << outExt[1] << " " << outExt[2] << " " << outExt[3] << " " << outExt[4] << " " << outExt[5] << std::endl;
+	int trialextent[6];
 
-		for (idY = inExt[2]; idY <= inExt[3]; idY++) // for each horizontal line in the image...
-		{
+	outData->GetWholeExtent(trialextent);
+	//std::cout << "output WHOLE extent"<< trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
+	outData->GetExtent(trialextent);
+	//std::cout << "output EXTENT"<< trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
+	outData->GetUpdateExtent(trialextent);
+	//std::cout << "output UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
 
-			//TODO implement this for other options
-			
-			if (self->GetFlipHorizontalOnOutput())
-			{
-      int dist = self->GetNumberOfPixelsFromTipOfFanToBottomOfScreen();
-			outPoint1[0] = outPoint0[0]+(dist-idY)*yAxis[0]; // incremental transform
-			outPoint1[1] = outPoint0[1]+(dist-idY)*yAxis[1];
-			outPoint1[2] = outPoint0[2]+(dist-idY)*yAxis[2];
-			}
-			else
-			{
-			outPoint1[0] = outPoint0[0]+idY*yAxis[0]; // incremental transform
-			outPoint1[1] = outPoint0[1]+idY*yAxis[1];
-			outPoint1[2] = outPoint0[2]+idY*yAxis[2];
-			}
 
-			if (!id)
-			{
-				if (!(count%target)) 
-				{
-					self->UpdateProgress(count/(50.0*target));  // progress between 0 and 1
-				}
-				count++;
-			}
+  if (this->Compounding)
+    {
+		//std::cout << "trying to get the scalar pointer for the extent" << std::endl;
+		
+			// HACK!!!  Danielle
+			//outData->SetUpdateExtent(outData->GetWholeExtent());
 
-			// find intersections of x raster line with the output extent
 			
+			accData->GetWholeExtent(trialextent);
 
-      // this only changes r1 and r2
-			vtkUltraFindExtent(r1,r2,outPoint1,xAxis,outMin,outMax,inExt);
+			//std::cout << "accumulation buffer WHOLE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
+			accData->GetExtent(trialextent);
+			//std::cout << "accumulation buffer EXTENT" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
+			accData->GetUpdateExtent(trialextent);
+			//std::cout << "accumulation buffer UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
+		
+			//std::cout << "THE OUT EXTENT GIVEN TO THE ACCUMULATION BUFFER IS " << outExt[0] << " " << outExt[1] << " " << outExt[2] << " " << outExt[3] << " " << outExt[4] << " " << outExt[5] << std::endl;
 
-      //std::cout << "r1 = " << r1 << ", r2 = " << r2 << std::endl;
+			accPtr = accData->GetScalarPointerForExtent(outExt);
+			resPtr = vtkFreehand2GetReservoirPointer(accData);
+			//std::cout << "is accPtr null? " << (accPtr == NULL) << std::endl;
 
-			/*if (self->GetFlipHorizontalOnOutput())
-			{
-      int dist = self->GetNumberOfPixelsFromTipOfFanToBottomOfScreen();
-			outPoint1[0] = outPoint0[0]+(dist-idY)*yAxis[0]; // incremental transform
-			outPoint1[1] = outPoint0[1]+(dist-idY)*yAxis[1];
-			outPoint1[2] = outPoint0[2]+(dist-idY)*yAxis[2];
-			}*/
+	//std::cout << "got the scalar pointer for the extent" << std::endl;
 
-			// next, handle the 'fan' shape of the input
-			double y = (yf - idY);
-      //std::cout << "yf = " << yf << ", y = " << y << std::endl;
-			if (ys < 0)
-			{
-				y = -y;
-			}
+	//std::cout << "trying the same thing for the output" << std::endl;
+	void * outPtr2 = this->GetOutput()->GetScalarPointerForExtent(outExt);
+	//std::cout << "finished trying the same thing for the output" << std::endl;
 
-      // first, check the angle range of the fan - choose r1 and r2 based
-      // on the triangle that the fan makes from the fan origin to the bottom
-      // line of the video image
-			if (!(ml == 0 && mr == 0))
-			{
-				// equivalent to: r1 < vtkUltraCeil(ml*y + xf + 1)
-        // this is what the radius would be based on tan(fanAngle)
-				if (r1 < -vtkUltraFloor(-(ml*y + xf + 1)))
-				{
-					r1 = -vtkUltraFloor(-(ml*y + xf + 1));
-				}
-				if (r2 > vtkUltraFloor(mr*y + xf - 1))
-				{
-					r2 = vtkUltraFloor(mr*y + xf - 1);
-				}
 
-        //if (firstFrame) {outStream << r1 << " " << r2 << " ";};
 
-				// next, check the radius of the fan - crop the triangle to the fan
-        // depth
-				double dx = (d2 - (y*y)*(ys*ys))/(xs*xs);
+	}
+  else
+    {
+    accPtr = NULL;
+    }
 
-        // if we are outside the fan's radius, ex at the bottom lines
-				if (dx < 0)
-				{
-					r1 = inExt[0];
-					r2 = inExt[0]-1;
-				}
-        // if we are within the fan's radius, we have to adjust if we are in
-        // the "ellipsoidal" (bottom) part of the fan instead of the top
-        // "triangular" part
-				else
-				{
-					dx = sqrt(dx);
-          // this is what r1 would be if we calculated it based on the
-          // pythagorean theorem
-					if (r1 < -vtkUltraFloor(-(xf - dx + 1)))
-					{
-						r1 = -vtkUltraFloor(-(xf - dx + 1));
-					}
-					if (r2 > vtkUltraFloor(xf + dx - 1))
-					{
-						r2 = vtkUltraFloor(xf + dx - 1);
-					}
-				}
-				//	  cout<< "Found Extent: ( "<< r1 << ", " << r2 <<" )"
-				//		  << " Radius Of the Fan: "<<dx<<" \n "
-				//		  << " clipExt: (" << clipExt[0] << ", "<< clipExt[1] 
-				//		  << ", " << clipExt[2]<< ", " << clipExt[3] << endl;
-			}
+	//std::cout << "***********************************" << std::endl;
 
+  // print out for debugging
+  vtkDebugMacro(<< "OptimizedInsertSlice: inData = " << inData 
+  << ", outData = " << outData);
+  
+  // this filter expects that input is the same type as output.
+  if (inData->GetScalarType() != outData->GetScalarType())
+    {
+    vtkErrorMacro(<< "OptimizedInsertSlice: input ScalarType, " 
+		  << inData->GetScalarType()
+		  << ", must match out ScalarType "<<outData->GetScalarType());
+    return;
+    }
 
+  // use fixed-point math for optimization level 2
+  if (this->GetOptimization() == 2)
+    {
+      // TODO did Pieli mean to do this?  It seems like this part just copies
+      // matrix into newmatrix
+    // change transform matrix so that instead of taking 
+    // input coords -> output coords it takes output indices -> input indices
+    vtkMatrix4x4 *matrix = this->GetIndexMatrix();
+    fixed newmatrix[4][4]; // NOTE that this is fixed for optimization = 2!!!
+    for (int i = 0; i < 4; i++)
+      {
+      newmatrix[i][0] = matrix->GetElement(i,0);
+      newmatrix[i][1] = matrix->GetElement(i,1);
+      newmatrix[i][2] = matrix->GetElement(i,2);
+      newmatrix[i][3] = matrix->GetElement(i,3);
+      }
 
-      //std::cout << "AFTER HANDLING THE FAN SHAPE: r1 = " << r1 << ", r2 = " << r2 << std::endl;
-
-
-			//cout<< "Found Extent: ( "<< r1 << ", " << r2 <<" )"
-			//	  << " clipExt: (" << ", " << clipExt[2]<< ", " << clipExt[3] << endl;
-			// bound to the ultrasound clip rectangle
-			if (r1 < clipExt[0])
-			{
-				r1 = clipExt[0];
-			}
-			if (r2 > clipExt[1])
-			{
-				r2 = clipExt[1];
-			}
-
-    //std::cout << "AFTER CLIPPING: r1 = " << r1 << ", r2 = " << r2 << std::endl;
-
-			if (r1 > r2  )//|| idY < clipExt[2] || idY > clipExt[3]) 
-			{
-				r1 = inExt[0];
-				r2 = inExt[0]-1;
-			}
-			else
-			{
-				/* // removed by danielle because this output is annoying
-				if(!( idY < clipExt[2] || idY > clipExt[3]))
-				{
-				cout<< "idY: "<<idY<<endl;
-				}*/
-			}
-
-			// skip the portion of the slice to the left of the fan
-			for (idX = inExt[0]; idX < r1; idX++)
-			{
-				inPtr += numscalars;
-			}
-
-			/*if (self->GetFlipHorizontalOnOutput())
-			{
+    //std::cout << "*****" << std::endl;
+    //matrix->Print(std::cout);
 
-			vtkFloatingPointType outSpacing[3];
-			vtkFloatingPointType videoOrigin[3];
-			vtkFloatingPointType fanOrigin[2];
-			self->GetOutputSpacing(outSpacing);
-			self->GetVideoSource()->GetDataOrigin(videoOrigin);
-			self->GetFanOrigin(fanOrigin);
-
-			int dist = (videoOrigin[1]-fanOrigin[1])/outSpacing[1]*-1.0;
-			//std::cout << dist << std::endl;
-			outPoint1[0] = outPoint0[0]+((dist-idY)+dist)*yAxis[0]; // incremental transform
-			outPoint1[1] = outPoint0[1]+((dist-idY)+dist)*yAxis[1];
-			outPoint1[2] = outPoint0[2]+((dist-idY)+dist)*yAxis[2];
-			}*/
+    //if (this->LastIndexMatrix && 
+    //this->CalculateMaxSliceSeparation(matrix,this->LastIndexMatrix) < 1.0)
+    //{
+    //return;
+    //}
 
-			//TODO remove me
-			/*static int counter = 0;
-			static int yFrig;
-			yFrig = outPoint1[1];
-			if (!(r1 == 0 && r2 == -1))
-			{
-				std::cout << yFrig << " " << r1 << " " << r2 << std::endl;
-				counter++;
-			}*/
+    //if (this->LastIndexMatrix == 0)
+    //  {
+    //  this->LastIndexMatrix = vtkMatrix4x4::New();
+    //  }
+    //this->LastIndexMatrix->DeepCopy(matrix);
+  
+    switch (inData->GetScalarType())
+      {
+	case VTK_SHORT:{
+		vtkOptimizedInsertSlice(this, outData, (short *)(outPtr), 
+                                (float *)(accPtr), (short *)(resPtr), 
+                                inData, (short *)(inPtr), 
+								inExt, newmatrix, threadId);}
+        break;
+	case VTK_UNSIGNED_SHORT:{
+        vtkOptimizedInsertSlice(this,outData,(unsigned short *)(outPtr),
+                                (float *)(accPtr), (unsigned short *)(resPtr), 
+                                inData, (unsigned short *)(inPtr), 
+								inExt, newmatrix, threadId);}
+        break;
+      case VTK_UNSIGNED_CHAR:{
+        vtkOptimizedInsertSlice(this, outData,(unsigned char *)(outPtr),
+                                (float *)(accPtr), (unsigned char *)(resPtr), 
+                                inData, (unsigned char *)(inPtr), 
+								inExt, newmatrix, threadId);}
+        break;
+      default:
+        vtkErrorMacro(<< "OptimizedInsertSlice: Unknown input ScalarType");
+        return;
+      }
+    }
 
-			/*(if (firstTime)
-			{
-				std::cout << idY << " " << r1 << " " << r2 << "          ";
-			}*/
+  // if we are not using fixed point math for optimization = 2, we are either doing no
+  // optimization (0) or we are breaking into x, y, z components with no bounds checking for
+  // nearest neighbor (1)
+  // the stuff in this part is the exact same as above in optimization == 2 except the index matrix
+	// is of type double instead of fixed
+  else
+    {
+        // TODO did Pieli mean to do this?  It seems like this part just copies
+      // matrix into newmatrix
+    // change transform matrix so that instead of taking 
+    // input coords -> output coords it takes output indices -> input indices
+    vtkMatrix4x4 *matrix = this->GetIndexMatrix();
+    double newmatrix[4][4];
+    for (int i = 0; i < 4; i++)
+      {
+      newmatrix[i][0] = matrix->GetElement(i,0);
+      newmatrix[i][1] = matrix->GetElement(i,1);
+      newmatrix[i][2] = matrix->GetElement(i,2);
+      newmatrix[i][3] = matrix->GetElement(i,3);
+      }
 
-			// we want to insert the stuff within the fan
-			// REMEMBER THAT MULTIPLYING THE INPUT POINT BY THE TRANSFORM WILL GIVE YOU FRACTIONAL PIXELS!!!! EWWWWW
-			// interpolation stuff if we are interpolating linearly (code 1)
-			if (self->GetInterpolationMode() == VTK_FREEHAND_LINEAR)
-			{ 
-      
-      //std::cout << "BEFORE RESETTING: r1 = " << r1 << ", r2 = " << r2 << std::endl;
+    //if (this->LastIndexMatrix && 
+    //this->CalculateMaxSliceSeparation(matrix,this->LastIndexMatrix) < 1.0)
+    //{
+    //return;
+    //}
 
-        //TODO take out
-        //r1 = inExt[0];
-        //r2 = inExt[1];
+    //if (this->LastIndexMatrix == 0)
+    //  {
+    //  this->LastIndexMatrix = vtkMatrix4x4::New();
+    //  }
+    //this->LastIndexMatrix->DeepCopy(matrix);
+  
+    switch (inData->GetScalarType())
+      {
+      case VTK_SHORT:
+        vtkOptimizedInsertSlice(this, outData, (short *)(outPtr), 
+                                (float *)(accPtr), (short *)(resPtr), 
+                                inData, (short *)(inPtr), 
+                                inExt, newmatrix, threadId);
+        break;
+      case VTK_UNSIGNED_SHORT:
+        vtkOptimizedInsertSlice(this,outData,(unsigned short *)(outPtr),
+                                (float *)(accPtr), (unsigned short *)(resPtr), 
+                                inData, (unsigned short *)(inPtr), 
+                                inExt, newmatrix, threadId);
+        break;
+      case VTK_UNSIGNED_CHAR:
+        vtkOptimizedInsertSlice(this, outData,(unsigned char *)(outPtr),
+                                (float *)(accPtr), (unsigned char *)(resPtr), 
+                                inData, (unsigned char *)(inPtr), 
+                                inExt, newmatrix, threadId);
+        break;
+      default:
+        vtkErrorMacro(<< "OptimizedInsertSlice: Unknown input ScalarType");
+        return;
+      }
+    }
+}
 
-				for (idX = r1; idX <= r2; idX++) // for all of the x pixels within the fan
-				{
+//----------------------------------------------------------------------------
+// Count the frames in the VideoSource buffer that are newer than 'after'
+// and older than 'before'.
+static int vtkReconstructionCountFrames(vtkVideoSource2 *video,
+                                        double after, double before)
+{
+  int bufferSize = video->GetFrameBufferSize();
+  int count = 0;
 
-					//std::cout << "X = " << idX << std::endl;
-
-					//TODO implement this for other options
-					if (self->GetFlipVerticalOnOutput())
-					{
-					outPoint[0] = outPoint1[0] + (r1+r2-idX)*xAxis[0];
-					outPoint[1] = outPoint1[1] + (r1+r2-idX)*xAxis[1];
-					outPoint[2] = outPoint1[2] + (r1+r2-idX)*xAxis[2];
-					}
-					else
-					{
-					outPoint[0] = outPoint1[0] + idX*xAxis[0];
-					outPoint[1] = outPoint1[1] + idX*xAxis[1];
-					outPoint[2] = outPoint1[2] + idX*xAxis[2];
-					}
-
-/*			if (firstTime == 0 && !(r1 == 0 && r2 == -1))
-			{
-				int out0 = outPoint[0];
-				int out1 = outPoint[1];
-				int out2 = outPoint[2];
-				outStream << out0 << " " << out1 << " " << out2 << std::endl;
-        //std::cout << out0 << " " << out1 << " " << out2 << std::endl;
-			}*/
+  for (int k = 0; k < bufferSize; k++)
+    {
+    double t = video->GetFrameTimeStamp(-k);
+    if (t <= after)
+      {
+      break;
+      }
+    if (t < before)
+      {
+      count++;
+      }
+    }
 
+  return count;
+}
 
+//----------------------------------------------------------------------------
+// Deal with the frames that arrived in the VideoSource buffer after the
+// frame at 'lasttime', for the Queue and Adaptive FramePolicy.  The newest
+// of them is left for the caller, which inserts it as the current frame
+// with vtkReconstructionUpdateFrame(), and its timestamp is returned (or
+// zero if no frames have arrived).  For each of the others, seek back to
+// it to insert it, drop it if it is too old, or merge it with the previous
+// frame.  Since the VideoSource keeps grabbing, the frames are found by
+// their timestamps rather than by their position in the buffer.
+static double vtkReconstructionWaitingFrames(vtkFreehandUltrasound2 *self,
+                                             vtkVideoSource2 *video,
+                                             vtkTrackerBuffer *buffer,
+                                             vtkMatrix4x4 *matrix,
+                                             vtkImageData *inData,
+                                             double lasttime)
+{
+  double videolag = self->GetVideoLag();
+  int bufferSize = video->GetFrameBufferSize();
+  std::vector<double> timestamps;
+  int k;
 
-					//std::cout << "going to trilinear interpolation" << std::endl;
+  // the list and the current frame are taken at the same moment
+  for (k = 0; k < bufferSize; k++)
+    {
+    double t = video->GetFrameTimeStamp(-k);
+    if (t <= lasttime)
+      {
+      break;
+      }
+    timestamps.push_back(t);
+    }
 
-				//std::cout << std::endl << "printing accPtr!" << std::endl;
+  if (timestamps.size() == 0)
+    {
+    return 0.0;
+    }
+  double newest = timestamps.front();
 
-				//std::cout << (int)(*accPtr) << std::endl;
+  vtkImageData *frame = self->WaitingFrame;
 
-				//std::cout << "printing accPtr + 1!" << std::endl;
-				//std::cout << (int) (*(accPtr+1)) << std::endl;
+  // oldest frame first, up to but not including the newest
+  while (timestamps.size() > 1)
+    {
+    double t = timestamps.back();
+    timestamps.pop_back();
 
+    if (vtkTimerLog::GetUniversalTime() - t > self->GetMaximumLatency())
+      {
+      self->DroppedFrameCount++;
+      continue;
+      }
 
+    buffer->Lock();
+    int flags = buffer->GetFlagsAndMatrixFromTime(matrix, t - videolag);
+    buffer->Unlock();
+    if (flags & (TR_MISSING | TR_OUT_OF_VIEW))
+      {
+      continue;
+      }
 
-					int hit = vtkTrilinearInterpolation(outPoint, inPtr, outPtr, accPtr, 
-						numscalars, outExt, outInc); // hit is either 1 or 0
+    // the fan rotation of the previous frame is used for the merge test,
+    // to avoid fetching frames that are not going to be inserted
+    if (self->MergeSlice(inData))
+      {
+      continue;
+      }
 
-					//std::cout << "finished trilinear interpolation" << std::endl;
+    // the frame has moved by one for every frame grabbed since
+    for (k = 1; k < bufferSize; k++)
+      {
+      if (video->GetFrameTimeStamp(-k) == t)
+        {
+        break;
+        }
+      }
+    if (k == bufferSize)
+      {
+      self->DroppedFrameCount++;
+      continue;
+      }
 
-					inPtr += numscalars; // go to the next x pixel
-					//self->PixelCount += hit;
-					self->IncrementPixelCount(threadId, hit);
-				}
+    video->Seek(-k);
+    inData->SetUpdateExtentToWholeExtent();
+    inData->Update();
+    int found = (video->GetFrameTimeStamp() == t);
+    if (found)
+      {
+      frame->DeepCopy(inData);
+      }
+    video->Seek(k);
 
-			}
+    if (!found)
+      {
+      self->DroppedFrameCount++;
+      continue;
+      }
 
-			// interpolation stuff if we are interpolating with nearest neighbor (code 0)
-			else 
-			{
+    self->UpdateFanRotation(frame, matrix);
+    self->InsertWaitingSlice(frame);
+    self->RecordSweepFrame(frame, t);
+    self->FrameLatency = vtkTimerLog::GetUniversalTime() - t;
+    }
 
-				//std::cout << "going to freehand optimized nn helper" << std::endl;
-				vtkFreehand2OptimizedNNHelper(r1, r2, outPoint, outPoint1, xAxis, 
-					inPtr, outPtr, outExt, outInc,
-					numscalars, accPtr);
-				// self->PixelCount += r2-r1+1;
-				self->IncrementPixelCount(threadId, r2-r1+1); // we added all the pixels between r1 and r2,
-																// so increment our count of the number of pixels added
-				//cout<<" NN: Inserted pixels: "<<r2-r1+1<<endl;
-			}
+  return newest;
+}
 
-			// skip the portion of the slice to the right of the fan
-			for (idX = r2+1; idX <= inExt[1]; idX++)
-			{
-				inPtr += numscalars;
-			}
+//----------------------------------------------------------------------------
+// Update the slice with the frame that has the given timestamp, which is
+// no longer the newest frame if more frames were grabbed while the waiting
+// frames were inserted (those are left for the next pass).  If the frame
+// has already left the buffer, the newest frame is used instead and the
+// ones that were skipped are counted as dropped.  Returns the timestamp
+// of the frame that was loaded.
+static double vtkReconstructionUpdateFrame(vtkFreehandUltrasound2 *self,
+                                           vtkVideoSource2 *video,
+                                           vtkImageData *inData,
+                                           double t)
+{
+  int bufferSize = video->GetFrameBufferSize();
+  int k;
 
-			inPtr += inIncY; // move to the next line
-		}
-		inPtr += inIncZ; // move to the next image
-	}
+  for (k = 0; k < bufferSize; k++)
+    {
+    if (video->GetFrameTimeStamp(-k) == t)
+      {
+      break;
+      }
+    }
 
-	//TODO take me out
-	/*if (firstTime == 0)
-	{
-		firstTime = 1;
-		outStream.close();
-		std::cout << "FIRST FRAME FINISHED" << std::endl;
-	}*/
+  if (k == bufferSize)
+    {
+    inData->Update();
+    double loaded = video->GetFrameTimeStamp();
+    self->DroppedFrameCount += 1 + vtkReconstructionCountFrames(video, t,
+                                                                loaded);
+    return loaded;
+    }
 
-	//cout<<"Pixels inserted: "<<self->GetPixelCount()<<endl;
-	//cout<< "-->Pixels added:  " << self->GetPixelCount() - prevPixelCount << endl; // added by Danielle
+  video->Seek(-k);
+  inData->Update();
+  double loaded = video->GetFrameTimeStamp();
+  video->Seek(k);
 
+  return loaded;
 }
 
 //----------------------------------------------------------------------------
-// vtkFreehand2ThreadedExecute
-// this mess is really a simple function. All it does is call
-// the ThreadedSliceExecute method after setting the correct
-// extent for this thread. Its just a pain to calculate
-// the correct extent.
-//----------------------------------------------------------------------------
-VTK_THREAD_RETURN_TYPE vtkFreehand2ThreadedExecute( void *arg )
+// This function is run in a background thread to perform the reconstruction.
+// By running it in the background, it doesn't interfere with the display
+// of the partially reconstructed volume.
+static void *vtkReconstructionThread(struct ThreadInfoStruct *data)
 {
 
 
-  vtkFreehand2ThreadStruct *str; // contains the filter, input and output
-  int ext[6], splitExt[6], total; // the input slice extent, the input slice extent
-                                  // for this thread, and the total number of pieces
-                                  // the extent can be split into (i.e. the number of
-                                  // threads we should use)
-  int threadId, threadCount; // thread id and number of threads, from the argument
-  vtkImageData *input; // the slice input
-
-  // get the thread id and number of threads
-  threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
-  threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
 
-  // get the filter, input and output in the form of a vtkFreehand2ThreadStruct
-  // and get the input extent
-  str = (vtkFreehand2ThreadStruct *)(((ThreadInfoStruct *)(arg))->UserData);
-  input = str->Input;
-  input->GetUpdateExtent( ext );
+  vtkFreehandUltrasound2 *self = (vtkFreehandUltrasound2 *)(data->UserData);
 
 
   
-	//std::cout << "***********************************" << std::endl;
-	//std::cout << "vtkFreehand2ThreadedExecute"<<std::endl;
-	int trialextent[6];
-	str->Output->GetUpdateExtent(trialextent);
-	//std::cout << "output UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
-	
-
-
+		// added by Danielle
+	/*std::cout << "output at the very beginning of the reconstruction thread" << std::endl;
+	self->GetOutput()->Print(std::cout);
+	vtkSleep(5.0);*/
 
 
 
-  // execute the actual method with appropriate extent
-  // first find out how many pieces the extent can be split into and calculate
-  // the extent for this thread (the splitExt)
-  // TODO the documentation for SplitSliceExtent says that it needs to be called
-  // threadCount times in order to update the split extent for each threadID -
-  // when does that happen?... maybe because we are only using one thread at the moment...
-  // but that depends on the calling function
-  total = str->Filter->SplitSliceExtent(splitExt, ext, threadId, threadCount);
-  //total = 1;
-  
-  // if we can use this thread, then call ThreadedSliceExecute
-  if (threadId < total)
-    {
-    str->Filter->ThreadedSliceExecute(str->Input, str->Output,
-				      splitExt, threadId);
-    }
-  // else
-  //   {
-  //   otherwise don't use this thread. Sometimes the threads dont
-  //   break up very well and it is just as efficient to leave a 
-  //   few threads idle.
-  //   }
-  
-  return VTK_THREAD_RETURN_VALUE;
-}
+  //cout<<" vtkReconstructionThread \n\n"<<endl;
+  double prevtimes[10];
+  double currtime = 0;  // most recent timestamp
+  double lastcurrtime = 0;  // previous timestamp
+  double timestamp = 0;  // video timestamp, corrected for lag
+  double videolag = self->GetVideoLag();
+  int preview = (self->RealTimeReconstruction && self->GetPreview());
+  int i;
 
-//----------------------------------------------------------------------------
-// SplitSliceExtent
-// For streaming and threads.  Splits the output update extent (startExt) into
-// "total" pieces and calculates the split extent for the thread of thread id
-// "num".  This method needs to be called "total" times
-// with different values of num (thread id) to fill in the split extents for each
-// therad.  This method returns the number of pieces resulting from a successful
-// split - from 1 to "total".  If 1 is returned, the extent cannot be split.
-// 
-// TODO Old description - I think there are some errors here:
-// For streaming and threads.  Splits output update extent into num pieces.
-// This method needs to be called num times.  Results must not overlap for
-// consistent starting extent.  Subclass can override this method.
-// This method returns the number of peices resulting from a successful split.
-// This can be from 1 to "total".  
-// If 1 is returned, the extent cannot be split.
-//----------------------------------------------------------------------------
-int vtkFreehandUltrasound2::SplitSliceExtent(int splitExt[6], // the extent of this split
-					    int startExt[6],  //the original extent to be split up
-					    int num, // current thread id
-					    int total) // the maximum number of threads (pieces)
-{
-  int splitAxis; // the axis we should split along
-  int min, max; // the min and max indices of the axis of interest
+  for (i = 0; i < 10; i++) {
+    prevtimes[i] = 0.0;
+  }
 
-  // prints where we are, the starting extent, num and total for debugging
-   vtkDebugMacro("SplitSliceExtent: ( " << startExt[0] << ", " << startExt[1]
-		<< ", "
-                << startExt[2] << ", " << startExt[3] << ", "
-                << startExt[4] << ", " << startExt[5] << "), " 
-                << num << " of " << total);
-  
-  // start with same extent - copy the extent from startExt to splitExt
-  memcpy(splitExt, startExt, 6 * sizeof(int));
-
-  // determine which axis we should split along - preference is z, then y, then x
-  // as long as we can possibly split along that axis (i.e. as long as z0 != z1)
-  splitAxis = 2; // at the end, shows whether we split along the z(2), y(1) or x(0) axis
-  min = startExt[4]; // z0 of startExt
-  max = startExt[5]; // z1 of startExt
-  while (min == max)
-    {
-    --splitAxis;
-    // we cannot split if the input extent is something like [50, 50, 100, 100, 0, 0]
-    if (splitAxis < 0)
-      { 
-      vtkDebugMacro("  Cannot Split");
-      return 1;
-      }
-    min = startExt[splitAxis*2];
-    max = startExt[splitAxis*2+1];
-    }
-
-  // determine the actual number of pieces that will be generated (return value)
-  int range = max - min + 1;
-  // split the range over the maximum number of threads
-  int valuesPerThread = (int)ceil(range/(double)total);
-  // figure out the largest thread id used
-  // TODO we will always use the maximum number of threads, so this will always be 
-  // valuesPerThread - 1... 
-  int maxThreadIdUsed = (int)ceil(range/(double)valuesPerThread) - 1;
-  // if we are in a thread that will work on part of the extent, then figure
-  // out the range that this thread should work on
-  if (num < maxThreadIdUsed)
-    {
-    splitExt[splitAxis*2] = splitExt[splitAxis*2] + num*valuesPerThread;
-    splitExt[splitAxis*2+1] = splitExt[splitAxis*2] + valuesPerThread - 1;
-    }
-  if (num == maxThreadIdUsed)
-    {
-    splitExt[splitAxis*2] = splitExt[splitAxis*2] + num*valuesPerThread;
-    }
-
-  // print for debugging
-  /*
-  vtkDebugMacro("  Split Piece: ( " <<splitExt[0]<< ", " <<splitExt[1]<< ", "
-                << splitExt[2] << ", " << splitExt[3] << ", "
-                << splitExt[4] << ", " << splitExt[5] << ")");
-  */
- /* cout<<"SplitSliceExtent: ( " << splitExt[0] << ", " << splitExt[1]
-	  << ", " << splitExt[2] << ", " << splitExt[3] << ", "
-      << splitExt[4] << ", " << splitExt[5] << "), " 
-      << num << " of " << total<<endl;*/
-
-  // return the number of threads used
-  return maxThreadIdUsed + 1;
-}
+  // the tracker tool provides the position of each inserted slice
+  if (!self->GetTrackerTool()) {
+	  cout << "Couldn't find tracker tool =( =( =( =( =( =( =(" << endl;
+    return NULL;
+  }
+  else {
+	cout<<"Found Tracker Tool"<<endl;
+  }
 
-//----------------------------------------------------------------------------
-// MultiThread
-// Setup the threader, and set the single method to be vtkFreehand2ThreadedExecute.
-// Then execute vtkFreehand2ThreadedExecute.
-//----------------------------------------------------------------------------
-void vtkFreehandUltrasound2::MultiThread(vtkImageData *inData,
-                                        vtkImageData *outData)
-{
-  // set up a vtkFreehand2ThreadStruct (defined above)
-  vtkFreehand2ThreadStruct str;
-  str.Filter = this;
-  str.Input = inData;
-  str.Output = outData;
+  vtkMatrix4x4 *matrix = self->GetSliceAxes();
+  vtkTrackerBuffer *buffer = self->GetTrackerTool()->GetBuffer();
+  if (!self->RealTimeReconstruction) { // if reconstructing previous data, use backup buffer
+    buffer = self->TrackerBuffer;
+  }
 
-    
-	//std::cout << "***********************************" << std::endl;
-	//std::cout << "MultiThread"<<std::endl;
-	int trialextent[6];
-	str.Output->GetUpdateExtent(trialextent);
-	//std::cout << "output UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
-	
+  //cout << "recon thread whole extent1: " << self->GetOutput()->GetWholeExtent()[0] << " " << self->GetOutput()->GetWholeExtent()[1] << endl;
+  vtkVideoSource2 *video = self->GetVideoSource();
+  vtkImageData *inData = self->GetSlice();
+  
+  // wait for video to start (i.e. wait for timestamp to change)
+  if (video && self->RealTimeReconstruction) {
+    while (lastcurrtime == 0 || currtime == lastcurrtime) {
+	  // TODO VTK 5 : use Request-style method
+      inData->SetUpdateExtentToWholeExtent();
+      inData->Update();
 
+	  if (self->GetCompounding()) // new by Danielle
+	  {
+		  self->GetAccumulationBuffer()->SetUpdateExtentToWholeExtent();
+		  self->GetAccumulationBuffer()->Update();
+	  }
 
 
-  
-  // TODO this->NumberOfThreads is never updated past one when threads are
-  // spawned or terminated
-  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
-  // set the single method
-  this->Threader->SetSingleMethod(vtkFreehand2ThreadedExecute, &str);
-  // execute the single method using this->NumberOfThreads threads
-  this->Threader->SingleMethodExecute();
-}
+      lastcurrtime = currtime;
+      currtime = video->GetFrameTimeStamp();
+      double timenow = vtkTimerLog::GetUniversalTime();
+      double sleepuntil = currtime + 0.010;
+      if (sleepuntil > timenow) {
+		vtkThreadSleep(data, sleepuntil);
+	  }
+    }
+  }
 
-//----------------------------------------------------------------------------
-// OptimizedInsertSlice
-// Given an input and output region, execute the filter algorithm to fill the
-// output from the input - optimized by splitting into x,y,z components or
-// with integer math
-// It just executes a switch statement to call the
-// vtkOptimizedInsertSlice method
-//----------------------------------------------------------------------------
-void vtkFreehandUltrasound2::OptimizedInsertSlice()
-{
+  // cout << "recon thread whole extent2: " << self->GetOutput()->GetWholeExtent()[0] << " " << self->GetOutput()->GetWholeExtent()[1] << endl;
+  double starttime = 0;
 
+  // loop continuously until reconstruction is halted - HERE IS THE LOOP FOR THE WHOLE THING!!!!!
+  for (i = 0;;) {
+    // save the last timestamp
+    lastcurrtime = currtime;
 
-	  
-	//std::cout << "***********************************" << std::endl;
-	//std::cout << "OptimizedInsertSlice"<<std::endl;
-	int trialextent[6];
-	this->GetOutput()->GetUpdateExtent(trialextent);
-	//std::cout << "output UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
-	
+    // the frames that arrived since the last pass, before the newest
+    int realtime = (video && self->RealTimeReconstruction &&
+                    lastcurrtime != 0);
+    int newestOnly =
+      (self->GetFramePolicy() == VTK_FREEHAND_FRAME_POLICY_NEWEST);
+    double newest = 0;
+    if (realtime && !newestOnly)
+      {
+      newest = vtkReconstructionWaitingFrames(self, video, buffer, matrix,
+                                              inData, lastcurrtime);
+      }
 
+    // update the slice data, the clipping is done by the fan mask
+    // TODO VTK 5: use Request methods
+    inData->SetUpdateExtentToWholeExtent();
+    double loadedtime = 0;
+    if (newest != 0)
+      {
+      loadedtime = vtkReconstructionUpdateFrame(self, video, inData, newest);
+      }
+    else
+      {
+      inData->Update(); // TODO  VTK 5: RequestData ?? 
+      }
 
 
+	/*if (self->GetCompounding()) // new by Danielle
+	{
+		self->GetAccumulationBuffer()->SetUpdateExtentToWholeExtent();
+		self->GetAccumulationBuffer()->Update();
+	}*/
 
-   // cout << "optimized insertslice whole extent: " << this->GetOutput()->GetWholeExtent()[0] << " " << this->GetOutput()->GetWholeExtent()[1] << endl;
-  if (this->ReconstructionThreadId == -1)
-    {
 
-		// modified by Danielle
-		//cout << "\t Within OptimizedInsertSlice - reconstructionThreadId == -1\n";
+    // get the timestamp for the video frame data
+    
+	if (video) {
+	  //cout<<"Frame Index: "<<video->GetFrameIndex()<<endl;
+      currtime = (newest != 0 ? loadedtime : video->GetFrameTimeStamp());
+      timestamp = currtime - videolag;
+      // with the Newest policy, every frame before this one is dropped
+      if (realtime && newestOnly)
+        {
+        self->DroppedFrameCount +=
+          vtkReconstructionCountFrames(video, lastcurrtime, currtime);
+        }
+	  //cout<< "TimeStamp: "<< timestamp<<endl;
+	}
+	else {
+		//cout<<"Video: "<<video<<endl;
+	}
+     
+	if (starttime == 0) {
+		starttime = timestamp;
+    }
 
-    // this->GetOutput()->Update();
-      // TODO note that I think calls to internalexecuteinformation should be replaced with calls to requestinformation
-    // this->InternalExecuteInformation();
-      // TODO should replace this with requestinformation for vtk 5
-		this->UpdateInformation(); // this goes to vtkAlgorithm version (I checked)
-	//return; // ADDED BY CWEDLAKE
+    buffer->Lock();
+    int flags = 0;
+    if (video && (videolag > 0.0 || !self->RealTimeReconstruction)) { // only do this if videolag is nonzero
+      flags = buffer->GetFlagsAndMatrixFromTime(matrix, timestamp);
+      //matrix->Print(std::cout);
     }
-  if (this->NeedsClear)
-    {
-		// modified by Danielle
-		//cout << "\t Within OptimizedInsertSlice - this->NeedsClear\n";
-    this->InternalClearOutput();
+    else {
+      buffer->GetMatrix(matrix, 0);
+      flags = buffer->GetFlags(0);
+	  if (!video) {
+		currtime = buffer->GetTimeStamp(0);
+	  }
     }
+    buffer->Unlock();
 
+	// modified by Danielle
+	// SHOULD INCORPORATE FAN ROTATION HERE
 
-	// added by Danielle for debugging
-	//std::cout << "**************************************" << std::endl;
-	//std::cout << "In optimized insert slice" << std::endl;
-	//int trialextent[6];
-	//this->GetOutput()->GetUpdateExtent(trialextent);
-	//std::cout << "output update extent " << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
-	
-	//std::cout << "OUTPUT IMAGE:" << std::endl;
-	//this->GetOutput()->Print(std::cout);
-	//std::cout << "ACCUMULATION BUFFER" << std::endl;
-	//this->AccumulationBuffer->Print(std::cout);
-	//std::cout << "**************************************" << std::endl;
-	
-
+	//// this code should invert the effect from the slice axes, so the slice isn't transformed =)
+	//vtkMatrix4x4* danielle = vtkMatrix4x4::New();
+	//danielle->DeepCopy(self->GetSliceAxes());
+	//danielle->Invert();
+	//vtkTransform * danielleTransform = vtkTransform::New();
+	//danielleTransform->SetMatrix(danielle);
+	//self->SetSliceTransform(danielleTransform);
 
+	// this code should do nothing - it does! =)
+	//vtkMatrix4x4* danielle = vtkMatrix4x4::New();
+	//danielle->Identity();
+	//vtkTransform * danielleTransform = vtkTransform::New();
+	//danielleTransform->SetMatrix(danielle);
+	//self->SetSliceTransform(danielleTransform);
 
-  vtkImageData *inData = this->GetSlice();
-  vtkImageData *outData = this->GetOutput();
-  //coutcout << "optimized insertslice whole extent: " << this->GetOutput()->GetWholeExtent()[0] << " " << this->GetOutput()->GetWholeExtent()[1] << endl;
- 
-  this->ActiveFlagLock->Lock();
-  // if not in ReconstructionThread, update the slice here
-  // (otherwise, the slice is updated in vtkReconstructionThread
-  // to ensure synchronization with the tracking)
-  if (this->ReconstructionThreadId == -1) {
-	  // modified by Danielle
-		//cout << "\t Within OptimizedInsertSlice - this->ReconstructionThreadId == -1 still\n";
+	// WORKINGSPOT - porting from python code in US_TEprobe.py
 
-    int clipExt[6];
-    this->GetClipExtent(clipExt, inData->GetOrigin(), inData->GetSpacing(),
-			inData->GetWholeExtent());
-    inData->SetUpdateExtentToWholeExtent(); //(clipExt);
-    inData->Update();
+	// very first image - use it to figure out the the flipping
+	// the depth and the flipping should be constant, so there should be no thrashing -
+	// therefore this should be reliable
 
-	/*if (this->Compounding) // new by Danielle
-	{
-		this->AccumulationBuffer->SetUpdateExtentToWholeExtent();
-		this->AccumulationBuffer->Update();
-	}*/
+		/*if (self->GetImageIsFlipped() == 1) // because we are flipping the image
+		{
+      //std::cout << "HERE!!!!!" << std::endl;
+			// we are assuming we are flipped
+			vtkFloatingPointType spacingTemp[3] = {0,0,0};
+			int frameSizeTemp[3] = {0,0,0};
+			self->GetOutputSpacing(spacingTemp);
+			video->GetFrameSize(frameSizeTemp);
+			//((vtkTransform *) (self->GetSliceTransform()))->Translate(0.0, -1.0*spacingTemp[1]*frameSizeTemp[1], 0.0);
+			//((vtkTransform *) (self->GetSliceTransform()))->Scale(1.0, -1.0, 1.0);
+			self->GetFlipTransform()->Translate(0.0, -1.0*spacingTemp[1]*frameSizeTemp[1], 0.0);
+			self->GetFlipTransform()->Scale(1.0, -1.0, 1.0);
+			//flip the image
+			vtkImageFlip* flipper = vtkImageFlip::New();
+			vtkImageData* newImage = vtkImageData::New();
+			flipper->SetFilteredAxis(1);
+			flipper->SetInput(inData);
+			flipper->SetOutput(newImage);
+			newImage->Update();
+			inData = newImage;
+			flipper->Delete();
 
-  }
-  this->ActiveFlagLock->Unlock();
-  //if (this->ReconstructionThreadId == -1) {
-	this->MultiThread(inData, outData);
-  //}
-  this->Modified();
-}
+			// TODO more stuff here with spacing and such...?
+		}*/
 
-//----------------------------------------------------------------------------
-// ThreadedSliceExecute
-// This method is passed a input and output region, and executes the filter
-// algorithm to fill the output from the input.
-// It just executes a switch statement to call the correct vtkOptimizedInsertSlice
-// function for the regions data types.
-//----------------------------------------------------------------------------
-void vtkFreehandUltrasound2::ThreadedSliceExecute(vtkImageData *inData, // input data
-						 vtkImageData *outData, // output data
-						 int inExt[6], // input extent (could be split for this thread)
-						 int threadId) // current thread id
-{
 
-	//std::cout << "in ThreadedSliceExecute" << std::endl;
+/*	if (self->GetRotationClipData() == NULL)
+	{
 
-// TODO vtkFreehandUltrasound2.cxx says that we need to change ThreadedSliceExecute
-// to ThreadedRequestData...
-// void vtkFreehandUltrasound2::ThreadedRequestData
-// (vtkInformation *,
-//  vtkInformationVector **,
-//  vtkInformationVector*,
-//   vtkImageData ***inputData, 
-//  vtkImageData **outputData,
-//  int inExt[6], int threadId)
-// {
-//   // fprintf(stderr,"inExt %d %d %d %d %d %d\n",inExt[0],inExt[1],inExt[2],inExt[3],inExt[4],inExt[5]);
-//   vtkImageData *inData = inputData[0][0];
-//   vtkImageData *outData = outputData[0];
+		// create the clip and threshold objects
+		//self->SetDepthClipData(vtkImageClip::New());
+		//self->GetDepthClipData()->ClipDataOn();
+		self->SetRotationClipData(vtkImageClip::New());
+		self->GetRotationClipData()->ClipDataOn();
+		//self->SetDepthThreshold(vtkImageThreshold::New());
+		//self->GetDepthThreshold()->ThresholdBetween(self->GetFanRotationImageThreshold1(), self->GetFanRotationImageThreshold2());
+		//self->GetDepthThreshold()->SetOutValue(1);
+		//self->GetDepthThreshold()->SetInValue(0);
+		self->SetRotationThreshold(vtkImageThreshold::New());
+		self->GetRotationThreshold()->ThresholdBetween(self->GetFanRotationImageThreshold1(), self->GetFanRotationImageThreshold2());
+		self->GetRotationThreshold()->SetOutValue(1);
+		self->GetRotationThreshold()->SetInValue(0);
+//		self->SetFlipThreshold(vtkImageThreshold::New());
+//		self->GetFlipThreshold()->ThresholdBetween(self->GetFanFlipThreshold1(), self->GetFanFlipThreshold2());
+//		self->GetFlipThreshold()->SetOutValue(1);
+//		self->GetFlipThreshold()->SetInValue(0);
 
-  // get scalar pointers for extents and output extent
-  void *inPtr = inData->GetScalarPointerForExtent(inExt);
-  int *outExt = this->OutputExtent;
-  void *outPtr = outData->GetScalarPointerForExtent(outExt);
- 
-  // get the accumulation buffer and the scalar pointer for its extent, if we are compounding
-  void *accPtr = NULL; 
-  vtkImageData *accData = this->AccumulationBuffer;
+		//// will find the depth assuming flipped and not flipped images
+		//self->GetDepthClipData()->SetInput(inData);
+		//self->GetDepthThreshold()->SetInput(self->GetDepthClipData()->GetOutput());
+		//self->GetDepthThreshold()->Update();
 
-  /*std::cout << "the accumulation buffer in threadedsliceexecute:" << std::endl;
-  accData->Print(std::cout);
-  std::cout << "the output in threadedsliceexecute" << std::endl;
-  outData->Print(std::cout);
-*/
+		//self->SetImageIsFlipped(0); // image is not flipped
+		//int depthNotFlipped = self->CalculateFanDepthCmValue(self->GetDepthThreshold());
+		//self->SetImageIsFlipped(1); // image is flipped
+		//int depthFlipped = self->CalculateFanDepthCmValue(self->GetDepthThreshold());
 
+		//// we are not flipped
+		//if (depthNotFlipped != -1 && depthFlipped == -1)
+		//{
+		//	self->SetImageIsFlipped(0);
+		//	self->SetFanDepthCm(depthNotFlipped);
+		//	
+		//}
+		//// we are flipped
+		//else if (depthNotFlipped == -1 && depthFlipped != -1)
+		//{
+		//	self->SetImageIsFlipped(1);
+		//	self->SetFanDepthCm(depthFlipped);
+		//}
+		//else
+		//{
+		//	std::cout << "problem with initializing depth and flip on first slice - aborting" << std::endl;
+		//	return NULL;
+		//}
+
+
+		if (self->GetImageIsFlipped() == 0)
+		{
+			// we are assuming we are flipped
+			vtkFloatingPointType spacingTemp[3] = {0,0,0};
+			int frameSizeTemp[3] = {0,0,0};
+			self->GetOutputSpacing(spacingTemp);
+			video->GetFrameSize(frameSizeTemp);
+			//((vtkTransform *) (self->GetSliceTransform()))->Translate(0.0, -1.0*spacingTemp[1]*frameSizeTemp[1], 0.0);
+			//((vtkTransform *) (self->GetSliceTransform()))->Scale(1.0, -1.0, 1.0);
+			self->GetFlipTransform()->Translate(0.0, -1.0*spacingTemp[1]*frameSizeTemp[1], 0.0);
+			self->GetFlipTransform()->Scale(1.0, -1.0, 1.0);
+			//flip the image
+			vtkImageFlip* flipper = vtkImageFlip::New();
+			vtkImageData* newImage = vtkImageData::New();
+			flipper->SetFilteredAxis(1);
+			flipper->SetInput(inData);
+			flipper->SetOutput(newImage);
+			newImage->Update();
+			inData = newImage;
+			flipper->Delete();
+		}
+		// more stuff here with spacing and such...?
 
- //this->AccumulationBuffer->Print(std::cout);
 
-   if(vtkInformation* pInfo = this->AccumulationBuffer->GetPipelineInformation())
-    {
-    if(pInfo->Get(vtkStreamingDemandDrivenPipeline::UPDATE_EXTENT_INITIALIZED()))
-      {
-		 // std::cout << "!!!!!!!!!!!!!!!!!!!!!!!!!!UpdateExtent: Initialized\n";
-      }
-    else
-      {
-		 // std::cout << "!!!!!!!!!!!!!!!!!!!!!!!!!!!!UpdateExtent: Not Initialized\n";
-      }
 	}
+*/
 
+	// get the rotation, and use it to change the SliceTransform
+	self->UpdateFanRotation(inData, matrix);
 
-	
-	//std::cout << "***********************************" << std::endl;
-	//std::cout << "threaded slice execute"<<std::endl;
-	//std::cout << "THIS->UPDATEExtent" << outExt[0] << " " << outExt[1] << " " << outExt[2] << " " << outExt[3] << " " << outExt[4] << " " << outExt[5] << std::endl;
-	int trialextent[6];
+    // tool must be properly tracking, and the position must have updated,
+    // if not we sleep until the next video frame
+    if (currtime == lastcurrtime && self->RealTimeReconstruction) {
+	  //cout<< "last current time: "<<lastcurrtime<<endl;	
+      double timenow = vtkTimerLog::GetUniversalTime();
+      double sleepuntil = currtime + 0.033;
+      if (sleepuntil > timenow) {
+		if (vtkThreadSleep(data, sleepuntil) == 0)  { // return if abort occurred during sleep
+			return NULL;
+		}
+	  }
+    }
+    else if (flags & (TR_MISSING | TR_OUT_OF_VIEW)) {
+      double timenow = vtkTimerLog::GetUniversalTime();
+      double sleepuntil = currtime + 0.033;
+	  cout<<"Out Of View"<<endl;
+      if (sleepuntil > timenow) {
+		if (vtkThreadSleep(data, sleepuntil) == 0) { // return if abort occurred during sleep
+			return NULL;
+		}
+	  }
+	}
+    else if (self->MergeSlice(inData)) {
+		// not inserted, because it hardly moved since the last slice
+		if (self->RealTimeReconstruction)
+		  {
+		  self->RecordSweepFrame(inData, currtime);
+		  }
+	}
+    else {
+		// do the reconstruction
+		// TODO VTK 5: this method should stay the same
+		//cout<<"Before InsertSlice"<<endl;
+		if (preview)
+		  {
+		  self->InsertPreviewSlice(inData);
+		  }
+		else
+		  {
+		  self->InsertSlice();
+		  }
+		if (self->RealTimeReconstruction)
+		  {
+		  self->RecordSweepFrame(inData, currtime);
+		  self->FrameLatency = vtkTimerLog::GetUniversalTime() - currtime;
+		  }
+		//cout<<"Inserted Slice"<<endl;
+		// get current reconstruction rate over last 10 updates
+		double tmptime = currtime;
+		if (!self->RealTimeReconstruction) { // calculate frame rate using computer clock, not timestamps
+			tmptime = vtkTimerLog::GetUniversalTime();
+		}
+		double difftime = tmptime - prevtimes[i%10];
+		prevtimes[i%10] = tmptime;
+		if (i > 10 && difftime != 0) {
+			self->ReconstructionRate = (10.0/difftime);
+		}
+		i++;
+	}
 
-	outData->GetWholeExtent(trialextent);
-	//std::cout << "output WHOLE extent"<< trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
-	outData->GetExtent(trialextent);
-	//std::cout << "output EXTENT"<< trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
-	outData->GetUpdateExtent(trialextent);
-	//std::cout << "output UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
+    // check to see if we are being told to quit 
+    int activeFlag = *(data->ActiveFlag);
 
+    if (activeFlag == 0) {
+      return NULL;
+    }
 
-  if (this->Compounding)
-    {
-		//std::cout << "trying to get the scalar pointer for the extent" << std::endl;
-		
-			// HACK!!!  Danielle
-			//outData->SetUpdateExtent(outData->GetWholeExtent());
+    if (!self->RealTimeReconstruction) {
+      // sleep for a millisecond, just to give the main application
+      // thread some time
+      vtkSleep(0.001);
 
-			
-			accData->GetWholeExtent(trialextent);
+      if (video) {
+		//fprintf(stderr, "go!  %i %i %g\n", self->ReconstructionFrameCount, video->GetFrameIndex(), timestamp - starttime);
+		if (--self->ReconstructionFrameCount == 0) {
+			return NULL;
+		}
+		video->Seek(1);
+	  }
+    }
+  }
+}
 
-			//std::cout << "accumulation buffer WHOLE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
-			accData->GetExtent(trialextent);
-			//std::cout << "accumulation buffer EXTENT" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
-			accData->GetUpdateExtent(trialextent);
-			//std::cout << "accumulation buffer UPDATE extent" << trialextent[0] << " " << trialextent[1] << " " << trialextent[2] << " " << trialextent[3] << " " << trialextent[4] << " " << trialextent[5] << std::endl;
-		
-			//std::cout << "THE OUT EXTENT GIVEN TO THE ACCUMULATION BUFFER IS " << outExt[0] << " " << outExt[1] << " " << outExt[2] << " " << outExt[3] << " " << outExt[4] << " " << outExt[5] << std::endl;
 
-			accPtr = accData->GetScalarPointerForExtent(outExt);
-			//std::cout << "is accPtr null? " << (accPtr == NULL) << std::endl;
+//----------------------------------------------------------------------------
+// UpdateFanRotation
+// Find the TEE fan rotation from the slice, and if it has changed, set the
+// SliceTransform to a rotation about the y axis of the probe given by
+// sliceAxes, i.e. sliceAxes * RotateY(rotation) * inverse(sliceAxes)
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::UpdateFanRotation(vtkImageData *inData,
+                                               vtkMatrix4x4 *sliceAxes)
+{
+  if (this->RotationDecoder == NULL)
+    {
+    return;
+    }
 
-	//std::cout << "got the scalar pointer for the extent" << std::endl;
+  // get the rotation
+  int rot = this->CalculateFanRotationValue(inData);
 
-	//std::cout << "trying the same thing for the output" << std::endl;
-	void * outPtr2 = this->GetOutput()->GetScalarPointerForExtent(outExt);
-	//std::cout << "finished trying the same thing for the output" << std::endl;
-
-
-
-	}
-  else
-    {
-    accPtr = NULL;
-    }
-
-	//std::cout << "***********************************" << std::endl;
-
-  // print out for debugging
-  vtkDebugMacro(<< "OptimizedInsertSlice: inData = " << inData 
-  << ", outData = " << outData);
-  
-  // this filter expects that input is the same type as output.
-  if (inData->GetScalarType() != outData->GetScalarType())
-    {
-    vtkErrorMacro(<< "OptimizedInsertSlice: input ScalarType, " 
-		  << inData->GetScalarType()
-		  << ", must match out ScalarType "<<outData->GetScalarType());
-    return;
-    }
-
-  // use fixed-point math for optimization level 2
-  if (this->GetOptimization() == 2)
+  this->SetPreviousFanRotation(this->GetFanRotation());
+  // ignore rotations of -1
+  if (rot > 0)
     {
-      // TODO did Pieli mean to do this?  It seems like this part just copies
-      // matrix into newmatrix
-    // change transform matrix so that instead of taking 
-    // input coords -> output coords it takes output indices -> input indices
-    vtkMatrix4x4 *matrix = this->GetIndexMatrix();
-    fixed newmatrix[4][4]; // NOTE that this is fixed for optimization = 2!!!
-    for (int i = 0; i < 4; i++)
-      {
-      newmatrix[i][0] = matrix->GetElement(i,0);
-      newmatrix[i][1] = matrix->GetElement(i,1);
-      newmatrix[i][2] = matrix->GetElement(i,2);
-      newmatrix[i][3] = matrix->GetElement(i,3);
-      }
-
-    //std::cout << "*****" << std::endl;
-    //matrix->Print(std::cout);
-
-    //if (this->LastIndexMatrix && 
-    //this->CalculateMaxSliceSeparation(matrix,this->LastIndexMatrix) < 1.0)
-    //{
-    //return;
-    //}
-
-    //if (this->LastIndexMatrix == 0)
-    //  {
-    //  this->LastIndexMatrix = vtkMatrix4x4::New();
-    //  }
-    //this->LastIndexMatrix->DeepCopy(matrix);
-  
-    switch (inData->GetScalarType())
-      {
-	case VTK_SHORT:{
-		vtkOptimizedInsertSlice(this, outData, (short *)(outPtr), 
-                                (unsigned short *)(accPtr), 
-                                inData, (short *)(inPtr), 
-								inExt, newmatrix, threadId);}
-        break;
-	case VTK_UNSIGNED_SHORT:{
-        vtkOptimizedInsertSlice(this,outData,(unsigned short *)(outPtr),
-                                (unsigned short *)(accPtr), 
-                                inData, (unsigned short *)(inPtr), 
-								inExt, newmatrix, threadId);}
-        break;
-      case VTK_UNSIGNED_CHAR:{
-        vtkOptimizedInsertSlice(this, outData,(unsigned char *)(outPtr),
-                                (unsigned short *)(accPtr), 
-                                inData, (unsigned char *)(inPtr), 
-								inExt, newmatrix, threadId);}
-        break;
-      default:
-        vtkErrorMacro(<< "OptimizedInsertSlice: Unknown input ScalarType");
-        return;
-      }
+    this->SetFanRotation(rot);
     }
 
-  // if we are not using fixed point math for optimization = 2, we are either doing no
-  // optimization (0) or we are breaking into x, y, z components with no bounds checking for
-  // nearest neighbor (1)
-  // the stuff in this part is the exact same as above in optimization == 2 except the index matrix
-	// is of type double instead of fixed
-  else
+  if (this->SliceTransform &&
+      this->GetFanRotation() != this->GetPreviousFanRotation())
     {
-        // TODO did Pieli mean to do this?  It seems like this part just copies
-      // matrix into newmatrix
-    // change transform matrix so that instead of taking 
-    // input coords -> output coords it takes output indices -> input indices
-    vtkMatrix4x4 *matrix = this->GetIndexMatrix();
-    double newmatrix[4][4];
-    for (int i = 0; i < 4; i++)
-      {
-      newmatrix[i][0] = matrix->GetElement(i,0);
-      newmatrix[i][1] = matrix->GetElement(i,1);
-      newmatrix[i][2] = matrix->GetElement(i,2);
-      newmatrix[i][3] = matrix->GetElement(i,3);
-      }
+    vtkMatrix4x4 *sliceAxesInverseMatrix = vtkMatrix4x4::New();
+    vtkMatrix4x4::Invert(sliceAxes, sliceAxesInverseMatrix);
 
-    //if (this->LastIndexMatrix && 
-    //this->CalculateMaxSliceSeparation(matrix,this->LastIndexMatrix) < 1.0)
-    //{
-    //return;
-    //}
+    vtkTransform *transform = (vtkTransform *)(this->SliceTransform);
+    transform->Identity();
+    transform->RotateY(this->GetFanRotation());
+    transform->PostMultiply();
+    transform->Concatenate(sliceAxes);
+    transform->PreMultiply();
+    transform->Concatenate(sliceAxesInverseMatrix);
 
-    //if (this->LastIndexMatrix == 0)
-    //  {
-    //  this->LastIndexMatrix = vtkMatrix4x4::New();
-    //  }
-    //this->LastIndexMatrix->DeepCopy(matrix);
-  
-    switch (inData->GetScalarType())
-      {
-      case VTK_SHORT:
-        vtkOptimizedInsertSlice(this, outData, (short *)(outPtr), 
-                                (unsigned short *)(accPtr), 
-                                inData, (short *)(inPtr), 
-                                inExt, newmatrix, threadId);
-        break;
-      case VTK_UNSIGNED_SHORT:
-        vtkOptimizedInsertSlice(this,outData,(unsigned short *)(outPtr),
-                                (unsigned short *)(accPtr), 
-                                inData, (unsigned short *)(inPtr), 
-                                inExt, newmatrix, threadId);
-        break;
-      case VTK_UNSIGNED_CHAR:
-        vtkOptimizedInsertSlice(this, outData,(unsigned char *)(outPtr),
-                                (unsigned short *)(accPtr), 
-                                inData, (unsigned char *)(inPtr), 
-                                inExt, newmatrix, threadId);
-        break;
-      default:
-        vtkErrorMacro(<< "OptimizedInsertSlice: Unknown input ScalarType");
-        return;
-      }
+    sliceAxesInverseMatrix->Delete();
     }
 }
 
 //----------------------------------------------------------------------------
-// vtkSleep
-// platform-independent sleep function
-//----------------------------------------------------------------------------
-static inline void vtkSleep(double duration)
-{
-  duration = duration; // avoid warnings
-  // sleep according to OS preference
-#ifdef _WIN32
-  Sleep(vtkUltraFloor(1000*duration));
-#elif defined(__FreeBSD__) || defined(__linux__) || defined(sgi)
-  struct timespec sleep_time, remaining_time;
-  int seconds = vtkUltraFloor(duration);
-  int nanoseconds = vtkUltraFloor(1000000000*(duration - seconds));
-  sleep_time.tv_sec = seconds;
-  sleep_time.tv_nsec = nanoseconds;
-  nanosleep(&sleep_time, &remaining_time);
-#endif
-}
-
+// CalculateFanRotationValue
+// Read the TEE rotation from the overlay in the frame with the
+// RotationDecoder, whose first field is for the image as-is and whose
+// second field is for the flipped image.  Returns -1 if it cannot be read.
 //----------------------------------------------------------------------------
-// Sleep until the specified absolute time has arrived.
-// You must pass a handle to the current thread.  
-// If '0' is returned, then the thread was aborted before or during the wait.
-static int vtkThreadSleep(struct ThreadInfoStruct *data, double time)
+int vtkFreehandUltrasound2::CalculateFanRotationValue(vtkImageData *frame)
 {
-  //fprintf(stderr,"sleep = %f\n",time-vtkTimerLog::GetCurrentTime());
-  for (;;)
+  if (this->RotationDecoder == NULL ||
+      this->GetImageIsFlipped() < 0 || this->GetImageIsFlipped() > 1)
     {
-    // slice 10 millisecs off the time, since this is how long it will
-    // take for this thread to start executing once it has been
-    // re-scheduled
-    //  vtkTimerLog::GetCurrentTime() is depracated and replace with
-    //GetUniversalTime in VTK 5:
-    double remaining = time - vtkTimerLog::GetUniversalTime() - 0.01;
-
-    // check to see if we have reached the specified time
-    if (remaining <= 0)
-      {
-	//fprintf(stderr,"remaining = %f\n",remaining+0.01);
-      return 1;
-      }
-    // check the ActiveFlag at least every 0.1 seconds
-    if (remaining > 0.1)
-      {
-      remaining = 0.1;
-      }
-
-    // check to see if we are being told to quit 
-    if (*(data->ActiveFlag) == 0)
-      {
-      return 0;
-      }
-    
-    vtkSleep(remaining);
+    return -1;
     }
 
-  return 1;
+  // these only cause the cached values to be dropped if they change
+  this->RotationDecoder->SetShift(this->GetFanRotationXShift(),
+                                  this->GetFanRotationYShift());
+  this->RotationDecoder->SetLowerThreshold(
+    this->GetFanRotationImageThreshold1());
+  this->RotationDecoder->SetUpperThreshold(
+    this->GetFanRotationImageThreshold2());
+
+  return this->RotationDecoder->DecodeField(frame, this->GetImageIsFlipped());
 }
 
-//----------------------------------------------------------------------------
-// This function is run in a background thread to perform the reconstruction.
-// By running it in the background, it doesn't interfere with the display
-// of the partially reconstructed volume.
-static void *vtkReconstructionThread(struct ThreadInfoStruct *data)
+/*int vtkFreehandUltrasound2::CalculateFanDepthCmValue (vtkImageThreshold* threshold)
 {
 
+	int d1, d2;
 
+	// not flipped
+	if (this->GetImageIsFlipped() == 0)
+	{
+		// First Depth Value
+		int array1[12] = {132+this->GetFanRotationXShift(), 479-58+this->GetFanRotationYShift(), 132+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift(),
+												135+this->GetFanRotationXShift(), 479-58+this->GetFanRotationYShift(), 135+this->GetFanRotationXShift(), 479-63+this->GetFanRotationYShift(),
+												131+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift(), 137+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift()};
+		d1 = this->GetFanRepresentation (threshold, array1);
+		// Second Depth Value
+		int array2[12] = {142+this->GetFanRotationXShift(), 479-58+this->GetFanRotationYShift(), 142+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift(),
+												145+this->GetFanRotationXShift(), 479-58+this->GetFanRotationYShift(), 145+this->GetFanRotationXShift(), 479-63+this->GetFanRotationYShift(),
+												141+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift(), 147+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift()};
+		d2 = this->GetFanRepresentation(threshold, array2);
+	}
 
-  vtkFreehandUltrasound2 *self = (vtkFreehandUltrasound2 *)(data->UserData);
+	// flipped		
+	else if (this->GetImageIsFlipped() == 1)
+	{
+		// First Depth Value
+		int array1[12] = {22+this->GetFanRotationXShift(), 479-268+this->GetFanRotationYShift(), 22+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift(),
+												25+this->GetFanRotationXShift(), 479-268+this->GetFanRotationYShift(), 25+this->GetFanRotationXShift(), 479-273+this->GetFanRotationYShift(),
+												21+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift(), 27+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift()};
+		d1 = this->GetFanRepresentation(threshold, array1);
+		// Second Depth Value
+		int array2[12] = {32+this->GetFanRotationXShift(), 479-268+this->GetFanRotationYShift(), 32+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift(),
+												35+this->GetFanRotationXShift(), 479-268+this->GetFanRotationYShift(), 35+this->GetFanRotationXShift(), 479-273+this->GetFanRotationYShift(),
+												31+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift(), 37+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift()};
+		d2 = this->GetFanRepresentation(threshold, array2);
+	}
+	else
+	{
+		return -1;
+	}
 
+    if (d2 >=0)
+	{
+        if (d1 >=0)
+		{
+            return d1*10+d2;
+		}
+        else
+		{
+            return d2;
+		}
+	}
+    else
+	{
+        return -1;
+	}
+}*/
 
-  
-		// added by Danielle
-	/*std::cout << "output at the very beginning of the reconstruction thread" << std::endl;
-	self->GetOutput()->Print(std::cout);
-	vtkSleep(5.0);*/
+/*int vtkFreehandUltrasound2::CheckIfUpsideDown(vtkImageThreshold* threshold)
+{
+	int result;
 
+	// if depth value < 10
+	int isDownDepthLessThan10 = threshold->GetOutput()->GetScalarComponentAsFloat(346+this->GetFanRotationXShift(), 479-57+this->GetFanRotationYShift() ,0,0);
+    int isUpDepthLessThan10 = threshold->GetOutput()->GetScalarComponentAsFloat(337+this->GetFanRotationXShift(), 479-380+this->GetFanRotationYShift() ,0,0);
 
+	// if depth value >= 10
+    int isDownDepthGreaterThan10 = threshold->GetOutput()->GetScalarComponentAsFloat(338+this->GetFanRotationXShift(), 479-36+this->GetFanRotationYShift() ,0,0);
+    int isUpDepthGreaterThan10 = threshold->GetOutput()->GetScalarComponentAsFloat(338+this->GetFanRotationXShift(), 479-423+this->GetFanRotationYShift() ,0,0);
+	
+	// image is flipped
+	if ((isDownDepthLessThan10 == 1 && isUpDepthLessThan10 == 0) || (isDownDepthGreaterThan10 == 1 && isUpDepthGreaterThan10 == 0))
+	{
+		result = 1;
+	}
+	// image is not flipped
+	else if ((isUpDepthLessThan10 == 1 && isDownDepthLessThan10 == 0) || (isUpDepthGreaterThan10 == 1 && isDownDepthGreaterThan10 == 0))
+	{
+		result = 0;
+	}
+	else
+	{
+		result = -1;
+	}
 
-  //cout<<" vtkReconstructionThread \n\n"<<endl;
-  double prevtimes[10];
-  double currtime = 0;  // most recent timestamp
-  double lastcurrtime = 0;  // previous timestamp
-  double timestamp = 0;  // video timestamp, corrected for lag
-  double videolag = self->GetVideoLag();
-  int i;
+	return result;
+}*/
 
-  for (i = 0; i < 10; i++) {
-    prevtimes[i] = 0.0;
-  }
 
-  // the tracker tool provides the position of each inserted slice
-  if (!self->GetTrackerTool()) {
-	  cout << "Couldn't find tracker tool =( =( =( =( =( =( =(" << endl;
-    return NULL;
-  }
-  else {
-	cout<<"Found Tracker Tool"<<endl;
-  }
-
-  vtkMatrix4x4 *matrix = self->GetSliceAxes();
-  vtkTrackerBuffer *buffer = self->GetTrackerTool()->GetBuffer();
-  if (!self->RealTimeReconstruction) { // if reconstructing previous data, use backup buffer
-    buffer = self->TrackerBuffer;
-  }
-
-  //cout << "recon thread whole extent1: " << self->GetOutput()->GetWholeExtent()[0] << " " << self->GetOutput()->GetWholeExtent()[1] << endl;
-  vtkVideoSource2 *video = self->GetVideoSource();
-  vtkImageData *inData = self->GetSlice();
-  
-  // wait for video to start (i.e. wait for timestamp to change)
-  if (video && self->RealTimeReconstruction) {
-    while (lastcurrtime == 0 || currtime == lastcurrtime) {
-      int clipExt[6];
-
-	  self->GetClipExtent(clipExt, inData->GetOrigin(), inData->GetSpacing(),
-			  inData->GetWholeExtent());
-
-	  // TODO VTK 5 : use Request-style method
-      inData->SetUpdateExtentToWholeExtent();//(clipExt);
-      inData->Update();
-
-	  if (self->GetCompounding()) // new by Danielle
-	  {
-		  self->GetAccumulationBuffer()->SetUpdateExtentToWholeExtent();
-		  self->GetAccumulationBuffer()->Update();
-	  }
-
-
-      lastcurrtime = currtime;
-      currtime = video->GetFrameTimeStamp();
-      double timenow = vtkTimerLog::GetUniversalTime();
-      double sleepuntil = currtime + 0.010;
-      if (sleepuntil > timenow) {
-		vtkThreadSleep(data, sleepuntil);
-	  }
+//----------------------------------------------------------------------------
+// StartReconstruction
+// Start doing a reconstruction from the video frames stored
+// in the VideoSource buffer.  You should first use 'Seek'
+// on the VideoSource to rewind first.  Then the reconstruction
+// will advance through n frames one by one until the
+// reconstruction is complete.  The reconstruction
+// is performed in the background.
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::StartReconstruction(int frames)
+{
+  if (frames <= 0)
+    {
+    return;
     }
-  }
 
-  // cout << "recon thread whole extent2: " << self->GetOutput()->GetWholeExtent()[0] << " " << self->GetOutput()->GetWholeExtent()[1] << endl;
-  double starttime = 0;
+  // If the reconstruction isn't running (reconstructionThreadId == -1)
+  if (this->ReconstructionThreadId == -1)
+    {
+    fprintf(stderr, "Reconstruction Start\n");
+    this->RealTimeReconstruction = 0; // doing buffered reconstruction
+    this->ReconstructionFrameCount = frames;
+    // TODO why these next three lines? probably bad - look at if this deep copies
+    vtkMatrix4x4 *matrix = vtkMatrix4x4::New();
+    this->SetSliceAxes(matrix);
+    matrix->Delete();
+	
+	/*// added by danielle
+	vtkTransform *transform = vtkTransform::New();
+	this->SetSliceTransform(transform);
+	transform->Delete();*/
 
-  // loop continuously until reconstruction is halted - HERE IS THE LOOP FOR THE WHOLE THING!!!!!
-  for (i = 0;;) {
-    // save the last timestamp
-    lastcurrtime = currtime;
+    this->GetOutput()->Update();
+    // TODO note that I think that calls to internalexecuteinformation should be
+    // replaced with calls to requestinformation
+    //this->InternalExecuteInformation(); // this was vtk 4
+    // TODO does this call the vtkReconstructionThread function below?
+    this->ReconstructionThreadId = \
+      this->Threader->SpawnThread((vtkThreadFunctionType)\
+				  &vtkReconstructionThread,
+				  this);
+	//cout<<" Reconstruction Thread: "<<this->ReconstructionThreadId<<endl;
+    }
+}
 
-    // update the slice data
-    int clipExt[6];
-    self->GetClipExtent(clipExt, inData->GetOrigin(), inData->GetSpacing(),	inData->GetWholeExtent());
-    // TODO VTK 5: use Request methods
-    inData->SetUpdateExtentToWholeExtent();//(clipExt);
-    inData->Update(); // TODO  VTK 5: RequestData ?? 
+//----------------------------------------------------------------------------
+// StopReconstruction
+// Stop the reconstruction started wtih StartReconstruction() - returns the
+// number of frames remaining to be reconstructed
+//----------------------------------------------------------------------------
+int vtkFreehandUltrasound2::StopReconstruction()
+{
+  // if a reconstruction is running (reconstructionThreadId != -1)
+  if (this->ReconstructionThreadId != -1)
+    {
+    this->Threader->TerminateThread(this->ReconstructionThreadId);
+    this->ReconstructionThreadId = -1;
+    return this->ReconstructionFrameCount;
+    }
+  return 0;
+}
 
+//----------------------------------------------------------------------------
+// Batch reconstruction
+//
+// The frames are read from the video source in chunks of BatchSize frames,
+// and the tracking information for each frame is looked up before any
+// frames are inserted.  Each thread then inserts a contiguous run of the
+// chunk's frames into its own output volume and accumulation buffer
+// (thread zero uses the real output), and the volumes are merged.  When
+// compounding, the merge combines the voxels according to the compounding
+// mode (a weighted average, a maximum, or a merge of the median reservoirs)
+// using the accumulation buffers, so it only has to be done once at the
+// end.  Without compounding, or with latest-wins compounding, the newest
+// frame must win, so the volumes are merged in thread order after every
+// chunk.
+//----------------------------------------------------------------------------
 
-	/*if (self->GetCompounding()) // new by Danielle
-	{
-		self->GetAccumulationBuffer()->SetUpdateExtentToWholeExtent();
-		self->GetAccumulationBuffer()->Update();
-	}*/
+#define VTK_FREEHAND_BATCH_INSERT 0
+#define VTK_FREEHAND_BATCH_MERGE 1
 
+struct vtkFreehand2BatchStruct
+{
+  vtkFreehandUltrasound2 *Filter;
+  int Stage;
+  int NumberOfThreads;
+  int NumberOfFrames;
+  vtkImageData **Frames;
+  double (*Matrices)[4][4];
+  vtkImageData *Output[VTK_MAX_THREADS];
+  vtkImageData *Accumulation[VTK_MAX_THREADS];
+  int CompoundingMode;
+};
 
-    // get the timestamp for the video frame data
-    
-	if (video) {
-	  //cout<<"Frame Index: "<<video->GetFrameIndex()<<endl;
-      currtime = video->GetFrameTimeStamp();
-      timestamp = currtime - videolag;
-	  //cout<< "TimeStamp: "<< timestamp<<endl;
-	}
-	else {
-		//cout<<"Video: "<<video<<endl;
-	}
-     
-	if (starttime == 0) {
-		starttime = timestamp;
+//----------------------------------------------------------------------------
+// Insert one frame into the given output volume, with the given index matrix
+static void vtkFreehand2BatchInsertFrame(vtkFreehandUltrasound2 *self,
+                                         vtkImageData *inData,
+                                         double matrix[4][4],
+                                         vtkImageData *outData,
+                                         vtkImageData *accData,
+                                         int threadId)
+{
+  int *inExt = inData->GetExtent();
+  void *inPtr = inData->GetScalarPointerForExtent(inExt);
+  void *outPtr = outData->GetScalarPointerForExtent(outData->GetExtent());
+  void *accPtr = NULL;
+  void *resPtr = NULL;
+  if (accData)
+    {
+    accPtr = accData->GetScalarPointerForExtent(accData->GetExtent());
+    resPtr = vtkFreehand2GetReservoirPointer(accData);
     }
 
-    buffer->Lock();
-    int flags = 0;
-    if (video && (videolag > 0.0 || !self->RealTimeReconstruction)) { // only do this if videolag is nonzero
-      flags = buffer->GetFlagsAndMatrixFromTime(matrix, timestamp);
-      //matrix->Print(std::cout);
+  // use fixed-point math for optimization level 2
+  if (self->GetOptimization() == 2)
+    {
+    fixed newmatrix[4][4];
+    for (int i = 0; i < 4; i++)
+      {
+      newmatrix[i][0] = matrix[i][0];
+      newmatrix[i][1] = matrix[i][1];
+      newmatrix[i][2] = matrix[i][2];
+      newmatrix[i][3] = matrix[i][3];
+      }
+    switch (inData->GetScalarType())
+      {
+      case VTK_SHORT:
+        vtkOptimizedInsertSlice(self, outData, (short *)(outPtr),
+                                (float *)(accPtr), (short *)(resPtr),
+                                inData, (short *)(inPtr),
+                                inExt, newmatrix, threadId);
+        break;
+      case VTK_UNSIGNED_SHORT:
+        vtkOptimizedInsertSlice(self, outData, (unsigned short *)(outPtr),
+                                (float *)(accPtr), (unsigned short *)(resPtr),
+                                inData, (unsigned short *)(inPtr),
+                                inExt, newmatrix, threadId);
+        break;
+      case VTK_UNSIGNED_CHAR:
+        vtkOptimizedInsertSlice(self, outData, (unsigned char *)(outPtr),
+                                (float *)(accPtr), (unsigned char *)(resPtr),
+                                inData, (unsigned char *)(inPtr),
+                                inExt, newmatrix, threadId);
+        break;
+      }
     }
-    else {
-      buffer->GetMatrix(matrix, 0);
-      flags = buffer->GetFlags(0);
-	  if (!video) {
-		currtime = buffer->GetTimeStamp(0);
-	  }
+  else
+    {
+    switch (inData->GetScalarType())
+      {
+      case VTK_SHORT:
+        vtkOptimizedInsertSlice(self, outData, (short *)(outPtr),
+                                (float *)(accPtr), (short *)(resPtr),
+                                inData, (short *)(inPtr),
+                                inExt, matrix, threadId);
+        break;
+      case VTK_UNSIGNED_SHORT:
+        vtkOptimizedInsertSlice(self, outData, (unsigned short *)(outPtr),
+                                (float *)(accPtr), (unsigned short *)(resPtr),
+                                inData, (unsigned short *)(inPtr),
+                                inExt, matrix, threadId);
+        break;
+      case VTK_UNSIGNED_CHAR:
+        vtkOptimizedInsertSlice(self, outData, (unsigned char *)(outPtr),
+                                (float *)(accPtr), (unsigned char *)(resPtr),
+                                inData, (unsigned char *)(inPtr),
+                                inExt, matrix, threadId);
+        break;
+      }
     }
-    buffer->Unlock();
-
-	// modified by Danielle
-	// SHOULD INCORPORATE FAN ROTATION HERE
-
-	//// this code should invert the effect from the slice axes, so the slice isn't transformed =)
-	//vtkMatrix4x4* danielle = vtkMatrix4x4::New();
-	//danielle->DeepCopy(self->GetSliceAxes());
-	//danielle->Invert();
-	//vtkTransform * danielleTransform = vtkTransform::New();
-	//danielleTransform->SetMatrix(danielle);
-	//self->SetSliceTransform(danielleTransform);
-
-	// this code should do nothing - it does! =)
-	//vtkMatrix4x4* danielle = vtkMatrix4x4::New();
-	//danielle->Identity();
-	//vtkTransform * danielleTransform = vtkTransform::New();
-	//danielleTransform->SetMatrix(danielle);
-	//self->SetSliceTransform(danielleTransform);
-
-	// WORKINGSPOT - porting from python code in US_TEprobe.py
+}
 
-	// very first image - use it to figure out the the flipping
-	// the depth and the flipping should be constant, so there should be no thrashing -
-	// therefore this should be reliable
+//----------------------------------------------------------------------------
+// Merge the per-thread volumes into the output for the slab of output
+// slices [z0,z1], and clear the per-thread volumes for the next chunk
+template <class T>
+static void vtkFreehand2BatchMerge(vtkFreehand2BatchStruct *str,
+                                   T *, int z0, int z1)
+{
+  vtkImageData *outData = str->Output[0];
+  int *outExt = outData->GetExtent();
+  int numscalars = outData->GetNumberOfScalarComponents() - 1;
+  vtkIdType sliceSize = (vtkIdType)(outExt[1] - outExt[0] + 1)*
+    (outExt[3] - outExt[2] + 1);
+  vtkIdType start = (z0 - outExt[4])*sliceSize;
+  vtkIdType end = (z1 - outExt[4] + 1)*sliceSize;
+
+  T *outPtr0 = (T *)(outData->GetScalarPointerForExtent(outExt));
+  float *accPtr0 = NULL;
+  T *resPtr0 = NULL;
+  int mode = str->CompoundingMode;
+  if (str->Accumulation[0])
+    {
+    accPtr0 = (float *)
+      (str->Accumulation[0]->GetScalarPointerForExtent(outExt));
+    resPtr0 = (T *)vtkFreehand2GetReservoirPointer(str->Accumulation[0]);
+    }
+  if (mode == VTK_FREEHAND_COMPOUND_MEDIAN && resPtr0 == NULL)
+    {
+    mode = VTK_FREEHAND_COMPOUND_MEAN;
+    }
+  const int r = VTK_FREEHAND_MEDIAN_RESERVOIR;
+  int resInc = r*numscalars;
 
-		/*if (self->GetImageIsFlipped() == 1) // because we are flipping the image
-		{
-      //std::cout << "HERE!!!!!" << std::endl;
-			// we are assuming we are flipped
-			vtkFloatingPointType spacingTemp[3] = {0,0,0};
-			int frameSizeTemp[3] = {0,0,0};
-			self->GetOutputSpacing(spacingTemp);
-			video->GetFrameSize(frameSizeTemp);
-			//((vtkTransform *) (self->GetSliceTransform()))->Translate(0.0, -1.0*spacingTemp[1]*frameSizeTemp[1], 0.0);
-			//((vtkTransform *) (self->GetSliceTransform()))->Scale(1.0, -1.0, 1.0);
-			self->GetFlipTransform()->Translate(0.0, -1.0*spacingTemp[1]*frameSizeTemp[1], 0.0);
-			self->GetFlipTransform()->Scale(1.0, -1.0, 1.0);
-			//flip the image
-			vtkImageFlip* flipper = vtkImageFlip::New();
-			vtkImageData* newImage = vtkImageData::New();
-			flipper->SetFilteredAxis(1);
-			flipper->SetInput(inData);
-			flipper->SetOutput(newImage);
-			newImage->Update();
-			inData = newImage;
-			flipper->Delete();
+  for (int t = 1; t < str->NumberOfThreads; t++)
+    {
+    T *outPtrT = (T *)(str->Output[t]->GetScalarPointerForExtent(outExt));
+    float *accPtrT = NULL;
+    T *resPtrT = NULL;
+    if (accPtr0)
+      {
+      accPtrT = (float *)
+        (str->Accumulation[t]->GetScalarPointerForExtent(outExt));
+      resPtrT = (T *)vtkFreehand2GetReservoirPointer(str->Accumulation[t]);
+      }
 
-			// TODO more stuff here with spacing and such...?
-		}*/
+    for (vtkIdType idx = start; idx < end; idx++)
+      {
+      T *outPtr = outPtr0 + idx*(numscalars + 1);
+      T *inPtr = outPtrT + idx*(numscalars + 1);
+      if (inPtr[numscalars] != 255)
+        {
+        continue;
+        }
+      int i;
+      if (accPtr0 && outPtr[numscalars] == 255 &&
+          mode != VTK_FREEHAND_COMPOUND_LATEST)
+        {
+        float a = accPtr0[idx];
+        float b = accPtrT[idx];
+        if (mode == VTK_FREEHAND_COMPOUND_MAX)
+          {
+          for (i = 0; i < numscalars; i++)
+            {
+            if (inPtr[i] > outPtr[i])
+              {
+              outPtr[i] = inPtr[i];
+              }
+            }
+          }
+        else if (mode == VTK_FREEHAND_COMPOUND_MEDIAN)
+          {
+          // refill the reservoir with samples from both threads in
+          // proportion to the number of samples each has seen, the
+          // stored samples are already a random subset so take the first
+          T *res0 = resPtr0 + idx*resInc;
+          T *resT = resPtrT + idx*resInc;
+          int n0 = (a < r ? (int)a : r);
+          int nT = (b < r ? (int)b : r);
+          int k0 = n0;
+          int kT = nT;
+          if (n0 + nT > r)
+            {
+            k0 = vtkUltraRound(r*a/(a + b));
+            if (k0 > n0)
+              {
+              k0 = n0;
+              }
+            if (k0 < r - nT)
+              {
+              k0 = r - nT;
+              }
+            kT = r - k0;
+            }
+          for (i = 0; i < kT*numscalars; i++)
+            {
+            res0[k0*numscalars + i] = resT[i];
+            }
+          vtkFreehandCompoundMedian::Median(res0, k0 + kT, numscalars,
+                                            outPtr);
+          }
+        else
+          {
+          // weighted average of the two compounded values
+          float f = 1.0f/(a + b);
+          for (i = 0; i < numscalars; i++)
+            {
+            vtkUltraRound((outPtr[i]*a + inPtr[i]*b)*f, outPtr[i]);
+            }
+          }
+        accPtr0[idx] = a + b;
+        accPtrT[idx] = 0;
+        }
+      else
+        {
+        // the later thread has the newer frames
+        for (i = 0; i < numscalars; i++)
+          {
+          outPtr[i] = inPtr[i];
+          }
+        if (accPtr0)
+          {
+          accPtr0[idx] += accPtrT[idx];
+          accPtrT[idx] = 0;
+          if (resPtr0 && mode == VTK_FREEHAND_COMPOUND_MEDIAN)
+            {
+            T *res0 = resPtr0 + idx*resInc;
+            T *resT = resPtrT + idx*resInc;
+            for (i = 0; i < resInc; i++)
+              {
+              res0[i] = resT[i];
+              }
+            }
+          }
+        }
+      outPtr[numscalars] = 255;
+      for (i = 0; i <= numscalars; i++)
+        {
+        inPtr[i] = 0;
+        }
+      }
+    }
+}
 
+//----------------------------------------------------------------------------
+VTK_THREAD_RETURN_TYPE vtkFreehand2BatchExecute( void *arg )
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  vtkFreehand2BatchStruct *str =
+    (vtkFreehand2BatchStruct *)(((ThreadInfoStruct *)(arg))->UserData);
+  int numThreads = str->NumberOfThreads;
 
-/*	if (self->GetRotationClipData() == NULL)
-	{
+  if (threadId >= numThreads)
+    {
+    return VTK_THREAD_RETURN_VALUE;
+    }
 
-		// create the clip and threshold objects
-		//self->SetDepthClipData(vtkImageClip::New());
-		//self->GetDepthClipData()->ClipDataOn();
-		self->SetRotationClipData(vtkImageClip::New());
-		self->GetRotationClipData()->ClipDataOn();
-		//self->SetDepthThreshold(vtkImageThreshold::New());
-		//self->GetDepthThreshold()->ThresholdBetween(self->GetFanRotationImageThreshold1(), self->GetFanRotationImageThreshold2());
-		//self->GetDepthThreshold()->SetOutValue(1);
-		//self->GetDepthThreshold()->SetInValue(0);
-		self->SetRotationThreshold(vtkImageThreshold::New());
-		self->GetRotationThreshold()->ThresholdBetween(self->GetFanRotationImageThreshold1(), self->GetFanRotationImageThreshold2());
-		self->GetRotationThreshold()->SetOutValue(1);
-		self->GetRotationThreshold()->SetInValue(0);
-//		self->SetFlipThreshold(vtkImageThreshold::New());
-//		self->GetFlipThreshold()->ThresholdBetween(self->GetFanFlipThreshold1(), self->GetFanFlipThreshold2());
-//		self->GetFlipThreshold()->SetOutValue(1);
-//		self->GetFlipThreshold()->SetInValue(0);
+  if (str->Stage == VTK_FREEHAND_BATCH_INSERT)
+    {
+    // each thread takes a contiguous run of frames, in order
+    int first = (str->NumberOfFrames*threadId)/numThreads;
+    int last = (str->NumberOfFrames*(threadId + 1))/numThreads;
+    for (int i = first; i < last; i++)
+      {
+      vtkFreehand2BatchInsertFrame(str->Filter, str->Frames[i],
+                                   str->Matrices[i],
+                                   str->Output[threadId],
+                                   str->Accumulation[threadId], threadId);
+      }
+    }
+  else
+    {
+    // each thread merges a slab of the output
+    int *outExt = str->Output[0]->GetExtent();
+    int nz = outExt[5] - outExt[4] + 1;
+    int z0 = outExt[4] + (nz*threadId)/numThreads;
+    int z1 = outExt[4] + (nz*(threadId + 1))/numThreads - 1;
+    if (z1 < z0)
+      {
+      return VTK_THREAD_RETURN_VALUE;
+      }
+    switch (str->Output[0]->GetScalarType())
+      {
+      case VTK_SHORT:
+        vtkFreehand2BatchMerge(str, (short *)(0), z0, z1);
+        break;
+      case VTK_UNSIGNED_SHORT:
+        vtkFreehand2BatchMerge(str, (unsigned short *)(0), z0, z1);
+        break;
+      case VTK_UNSIGNED_CHAR:
+        vtkFreehand2BatchMerge(str, (unsigned char *)(0), z0, z1);
+        break;
+      }
+    }
 
-		//// will find the depth assuming flipped and not flipped images
-		//self->GetDepthClipData()->SetInput(inData);
-		//self->GetDepthThreshold()->SetInput(self->GetDepthClipData()->GetOutput());
-		//self->GetDepthThreshold()->Update();
+  return VTK_THREAD_RETURN_VALUE;
+}
 
-		//self->SetImageIsFlipped(0); // image is not flipped
-		//int depthNotFlipped = self->CalculateFanDepthCmValue(self->GetDepthThreshold());
-		//self->SetImageIsFlipped(1); // image is flipped
-		//int depthFlipped = self->CalculateFanDepthCmValue(self->GetDepthThreshold());
+//----------------------------------------------------------------------------
+// ReconstructBatch
+// Reconstruct n frames from the sweep read by ReadSweep(), or otherwise
+// from the VideoSource buffer, without pacing, using BatchNumberOfThreads
+// threads, and return the number of frames inserted
+//----------------------------------------------------------------------------
+int vtkFreehandUltrasound2::ReconstructBatch(int frames)
+{
+  if (this->ReconstructionThreadId != -1)
+    {
+    vtkErrorMacro(<< "ReconstructBatch: a reconstruction is already running");
+    return 0;
+    }
 
-		//// we are not flipped
-		//if (depthNotFlipped != -1 && depthFlipped == -1)
-		//{
-		//	self->SetImageIsFlipped(0);
-		//	self->SetFanDepthCm(depthNotFlipped);
-		//	
-		//}
-		//// we are flipped
-		//else if (depthNotFlipped == -1 && depthFlipped != -1)
-		//{
-		//	self->SetImageIsFlipped(1);
-		//	self->SetFanDepthCm(depthFlipped);
-		//}
-		//else
-		//{
-		//	std::cout << "problem with initializing depth and flip on first slice - aborting" << std::endl;
-		//	return NULL;
-		//}
+  vtkUltrasoundSweepFile *sweep = NULL;
+  if (this->SweepFile &&
+      this->SweepFile->GetMode() == VTK_SWEEP_MODE_READ)
+    {
+    sweep = this->SweepFile;
+    if (frames > sweep->GetNumberOfFrames())
+      {
+      frames = sweep->GetNumberOfFrames();
+      }
+    }
+  else if (this->VideoSource == NULL)
+    {
+    vtkErrorMacro(<< "ReconstructBatch: no VideoSource");
+    return 0;
+    }
+  if (frames <= 0)
+    {
+    return 0;
+    }
 
+  this->RealTimeReconstruction = 0;
+  vtkMatrix4x4 *sliceAxes = vtkMatrix4x4::New();
+  this->SetSliceAxes(sliceAxes);
+  sliceAxes->Delete();
 
-		if (self->GetImageIsFlipped() == 0)
-		{
-			// we are assuming we are flipped
-			vtkFloatingPointType spacingTemp[3] = {0,0,0};
-			int frameSizeTemp[3] = {0,0,0};
-			self->GetOutputSpacing(spacingTemp);
-			video->GetFrameSize(frameSizeTemp);
-			//((vtkTransform *) (self->GetSliceTransform()))->Translate(0.0, -1.0*spacingTemp[1]*frameSizeTemp[1], 0.0);
-			//((vtkTransform *) (self->GetSliceTransform()))->Scale(1.0, -1.0, 1.0);
-			self->GetFlipTransform()->Translate(0.0, -1.0*spacingTemp[1]*frameSizeTemp[1], 0.0);
-			self->GetFlipTransform()->Scale(1.0, -1.0, 1.0);
-			//flip the image
-			vtkImageFlip* flipper = vtkImageFlip::New();
-			vtkImageData* newImage = vtkImageData::New();
-			flipper->SetFilteredAxis(1);
-			flipper->SetInput(inData);
-			flipper->SetOutput(newImage);
-			newImage->Update();
-			inData = newImage;
-			flipper->Delete();
-		}
-		// more stuff here with spacing and such...?
+  this->UpdateInformation();
+  if (this->NeedsClear)
+    {
+    this->InternalClearOutput();
+    }
 
+  vtkImageData *inData = this->GetSlice();
+  vtkImageData *outData = this->GetOutput();
+  int inScalarType;
+  if (sweep)
+    {
+    inScalarType = sweep->GetFrameScalarType();
+    }
+  else
+    {
+    inData->UpdateInformation();
+    inScalarType = inData->GetScalarType();
+    }
+  if (inScalarType != outData->GetScalarType())
+    {
+    vtkErrorMacro(<< "ReconstructBatch: input ScalarType, "
+                  << inScalarType
+                  << ", must match out ScalarType "
+                  << outData->GetScalarType());
+    return 0;
+    }
+  int scalarType = outData->GetScalarType();
+  if (scalarType != VTK_SHORT && scalarType != VTK_UNSIGNED_SHORT &&
+      scalarType != VTK_UNSIGNED_CHAR)
+    {
+    vtkErrorMacro(<< "ReconstructBatch: Unknown input ScalarType");
+    return 0;
+    }
 
-	}
-*/
+  int chunkSize = this->BatchSize;
+  if (chunkSize > frames)
+    {
+    chunkSize = frames;
+    }
+  int numThreads = this->BatchNumberOfThreads;
+  if (numThreads > chunkSize)
+    {
+    numThreads = chunkSize;
+    }
 
-	// get the rotation
-	self->GetRotationClipData()->SetInput(inData);
-	self->GetRotationThreshold()->SetInput(self->GetRotationClipData()->GetOutput());
-	self->GetRotationThreshold()->Update();
-	int rot = self->CalculateFanRotationValue(self->GetRotationThreshold());
-	//std::cout << "**********" << std::endl;
-	//std::cout << "*  rotation = " << rot << " ";
-	//std::cout << "*  depth = " << self->GetFanDepthCm()< std::endl;
-	//std::cout << "*  flipped = " << self->GetImageIsFlipped() << std::endl;
-	//std::cout << "**********" << std::endl;*/
-  
-	if (rot > 0)
-	{
-		self->SetPreviousFanRotation(self->GetFanRotation());
-		self->SetFanRotation(rot);
-	}
-  // ignore rotations of -1
-  else
+  // thread zero inserts directly into the output, the other threads get
+  // their own volumes
+  vtkFreehand2BatchStruct str;
+  str.Filter = this;
+  str.NumberOfThreads = numThreads;
+  str.Output[0] = outData;
+  str.Accumulation[0] = (this->Compounding ? this->AccumulationBuffer : 0);
+  str.CompoundingMode = this->CompoundingMode;
+  int i;
+  for (i = 1; i < numThreads; i++)
     {
-    self->SetPreviousFanRotation(self->GetFanRotation());
+    str.Output[i] = vtkImageData::New();
+    str.Output[i]->SetExtent(outData->GetExtent());
+    str.Output[i]->SetScalarType(scalarType);
+    str.Output[i]->SetNumberOfScalarComponents(
+      outData->GetNumberOfScalarComponents());
+    str.Output[i]->AllocateScalars();
+    memset(str.Output[i]->GetScalarPointer(), 0,
+           str.Output[i]->GetNumberOfPoints()*
+           str.Output[i]->GetNumberOfScalarComponents()*
+           str.Output[i]->GetScalarSize());
+    str.Accumulation[i] = 0;
+    if (this->Compounding)
+      {
+      str.Accumulation[i] = vtkImageData::New();
+      vtkFreehand2AllocateAccumulation(str.Accumulation[i],
+        outData->GetExtent(), scalarType,
+        outData->GetNumberOfScalarComponents() - 1, this->CompoundingMode);
+      }
     }
 
-  //std::cout << "rot = " << rot << ", previous = " << self->GetPreviousFanRotation() << ", current = "<< self->GetFanRotation() << std::endl;
+  // the frames are copied from the video source, one chunk at a time
+  vtkImageData **chunkFrames = new vtkImageData *[chunkSize];
+  double (*chunkMatrices)[4][4] = new double[chunkSize][4][4];
+  for (i = 0; i < chunkSize; i++)
+    {
+    chunkFrames[i] = vtkImageData::New();
+    }
+  str.Frames = chunkFrames;
+  str.Matrices = chunkMatrices;
 
-	
-	// now use the rotation to change the SliceTransform (vtkTransform)
-	// want to make sure that we're rotating in the right direction!!!
-  vtkTransform* tempTransform = vtkTransform::New();
-  vtkMatrix4x4* sliceAxesInverseMatrix = vtkMatrix4x4::New();
-  vtkMatrix4x4::Invert(matrix, sliceAxesInverseMatrix);
+  this->Threader->SetNumberOfThreads(numThreads);
+  this->Threader->SetSingleMethod(vtkFreehand2BatchExecute, &str);
 
-	if (self->GetSliceTransform())
-	{
-		// the code assumes the image is flipped
-		if (self->GetFanRotation() != self->GetPreviousFanRotation())
-		{
-      // original was these two lines
-			//((vtkTransform *) (self->GetSliceTransform()))->RotateY(-1.0 * self->GetPreviousFanRotation());
-			//((vtkTransform *) (self->GetSliceTransform()))->RotateY(self->GetFanRotation());
-      
-
-      tempTransform = (vtkTransform *) (self->GetSliceTransform());
-      tempTransform->Identity();
-      tempTransform->RotateY(self->GetFanRotation());
-      //MATLAB CODE = (sliceAxes * sliceTransform(rotation) * inv(sliceAxes)
-      tempTransform->PostMultiply();
-      tempTransform->Concatenate(matrix); // remember, matrix = this->SliceAxes
-      tempTransform->PreMultiply();
-      tempTransform->Concatenate(sliceAxesInverseMatrix);
-		}
-	}
+  // when the newest frame wins, the volumes must be merged in order
+  int mergeAtEnd = (this->Compounding &&
+                    this->CompoundingMode != VTK_FREEHAND_COMPOUND_LATEST);
 
-    // tool must be properly tracking, and the position must have updated,
-    // if not we sleep until the next video frame
-    if (currtime == lastcurrtime && self->RealTimeReconstruction) {
-	  //cout<< "last current time: "<<lastcurrtime<<endl;	
-      double timenow = vtkTimerLog::GetUniversalTime();
-      double sleepuntil = currtime + 0.033;
-      if (sleepuntil > timenow) {
-		if (vtkThreadSleep(data, sleepuntil) == 0)  { // return if abort occurred during sleep
-			return NULL;
-		}
-	  }
-    }
-    else if (flags & (TR_MISSING | TR_OUT_OF_VIEW)) {
-      double timenow = vtkTimerLog::GetUniversalTime();
-      double sleepuntil = currtime + 0.033;
-	  cout<<"Out Of View"<<endl;
-      if (sleepuntil > timenow) {
-		if (vtkThreadSleep(data, sleepuntil) == 0) { // return if abort occurred during sleep
-			return NULL;
-		}
-	  }
-	}
-    else {
-		// do the reconstruction
-		// TODO VTK 5: this method should stay the same
-		//cout<<"Before InsertSlice"<<endl;
-		self->InsertSlice();
-		//cout<<"Inserted Slice"<<endl;
-		// get current reconstruction rate over last 10 updates
-		double tmptime = currtime;
-		if (!self->RealTimeReconstruction) { // calculate frame rate using computer clock, not timestamps
-			tmptime = vtkTimerLog::GetUniversalTime();
-		}
-		double difftime = tmptime - prevtimes[i%10];
-		prevtimes[i%10] = tmptime;
-		if (i > 10 && difftime != 0) {
-			self->ReconstructionRate = (10.0/difftime);
-		}
-		i++;
-	}
+  int inserted = 0;
+  int remaining = frames;
+  int sweepIndex = 0;
+  while (remaining > 0)
+    {
+    // resolve the pose of every frame in the chunk before inserting them
+    int n = 0;
+    for (; n < chunkSize && remaining > 0; remaining--)
+      {
+      vtkImageData *frame = chunkFrames[n];
+      double timestamp;
+      if (sweep)
+        {
+        if (!sweep->ReadFrame(sweepIndex, frame))
+          {
+          sweepIndex++;
+          continue;
+          }
+        timestamp = sweep->GetFrameTimeStamp(sweepIndex++) - this->VideoLag;
+        }
+      else
+        {
+        inData->SetUpdateExtentToWholeExtent();
+        inData->Update();
+        timestamp = this->VideoSource->GetFrameTimeStamp() - this->VideoLag;
+        }
 
-    // check to see if we are being told to quit 
-    int activeFlag = *(data->ActiveFlag);
+      this->TrackerBuffer->Lock();
+      int flags = this->TrackerBuffer->GetFlagsAndMatrixFromTime(
+        this->SliceAxes, timestamp);
+      this->TrackerBuffer->Unlock();
 
-    if (activeFlag == 0) {
-      return NULL;
-    }
+      if (!(flags & (TR_MISSING | TR_OUT_OF_VIEW)))
+        {
+        if (!sweep)
+          {
+          frame->DeepCopy(inData);
+          }
+        this->UpdateFanRotation(frame, this->SliceAxes);
+        vtkMatrix4x4 *matrix = this->GetIndexMatrix(frame);
+        for (int j = 0; j < 4; j++)
+          {
+          for (int k = 0; k < 4; k++)
+            {
+            chunkMatrices[n][j][k] = matrix->GetElement(j,k);
+            }
+          }
+        n++;
+        }
 
-    if (!self->RealTimeReconstruction) {
-      // sleep for a millisecond, just to give the main application
-      // thread some time
-      vtkSleep(0.001);
+      if (!sweep && remaining > 1)
+        {
+        this->VideoSource->Seek(1);
+        }
+      }
 
-      if (video) {
-		//fprintf(stderr, "go!  %i %i %g\n", self->ReconstructionFrameCount, video->GetFrameIndex(), timestamp - starttime);
-		if (--self->ReconstructionFrameCount == 0) {
-			return NULL;
-		}
-		video->Seek(1);
-	  }
+    if (n > 0)
+      {
+      str.NumberOfFrames = n;
+      str.Stage = VTK_FREEHAND_BATCH_INSERT;
+      this->Threader->SingleMethodExecute();
+      inserted += n;
+
+      if (!mergeAtEnd)
+        {
+        str.Stage = VTK_FREEHAND_BATCH_MERGE;
+        this->Threader->SingleMethodExecute();
+        }
+      }
+
+    this->UpdateProgress((double)(frames - remaining)/frames);
     }
-  }
-}
 
+  if (mergeAtEnd)
+    {
+    str.Stage = VTK_FREEHAND_BATCH_MERGE;
+    this->Threader->SingleMethodExecute();
+    }
 
-// TODO right now this is hard coded for the adult TEE
-int vtkFreehandUltrasound2::CalculateFanRotationValue(vtkImageThreshold* threshold)
-{
-	int d1, d2, d3; // rotation values
+  for (i = 0; i < chunkSize; i++)
+    {
+    chunkFrames[i]->Delete();
+    }
+  delete [] chunkFrames;
+  delete [] chunkMatrices;
+  for (i = 1; i < numThreads; i++)
+    {
+    str.Output[i]->Delete();
+    if (str.Accumulation[i])
+      {
+      str.Accumulation[i]->Delete();
+      }
+    }
 
-	// not flipped
-	if (this->GetImageIsFlipped() == 0)
-	{
-		// First Rotation Value
-		int array3[12] = {72+this->GetFanRotationXShift(), 479-294+this->GetFanRotationYShift(), 72+this->GetFanRotationXShift(), 479-298+this->GetFanRotationYShift(),
-											75+this->GetFanRotationXShift(), 479-294+this->GetFanRotationYShift(), 75+this->GetFanRotationXShift(), 479-299+this->GetFanRotationYShift(),
-											71+this->GetFanRotationXShift(), 479-298+this->GetFanRotationYShift(), 77+this->GetFanRotationXShift(), 479-298+this->GetFanRotationYShift()};
-		d3 = this->GetFanRepresentation(threshold, array3);
-		// Second Rotation Value
-		int array2[12] = {62+this->GetFanRotationXShift(), 479-294+this->GetFanRotationYShift(), 62+this->GetFanRotationXShift(), 479-298+this->GetFanRotationYShift(),
-												65+this->GetFanRotationXShift(), 479-294+this->GetFanRotationYShift(), 65+this->GetFanRotationXShift(), 479-299+this->GetFanRotationYShift(),
-												61+this->GetFanRotationXShift(), 479-298+this->GetFanRotationYShift(), 67+this->GetFanRotationXShift(), 479-298+this->GetFanRotationYShift()};
-		d2 = this->GetFanRepresentation(threshold, array2);
-		// Third Rotation Value
-		int array1[12] = {52+this->GetFanRotationXShift(), 479-294+this->GetFanRotationYShift(), 52+this->GetFanRotationXShift(), 479-298+this->GetFanRotationYShift(),
-												55+this->GetFanRotationXShift(), 479-294+this->GetFanRotationYShift(), 55+this->GetFanRotationXShift(), 479-299+this->GetFanRotationYShift(),
-												51+this->GetFanRotationXShift(), 479-298+this->GetFanRotationYShift(), 57+this->GetFanRotationXShift(), 479-298+this->GetFanRotationYShift()};
-		d1 = this->GetFanRepresentation(threshold, array1);
-	}
-	// flipped
-	else if (this->GetImageIsFlipped() == 1)
-	{
-		// First rotation value
-		int array3[12] = {502+this->GetFanRotationXShift(), 479-126+this->GetFanRotationYShift(), 502+this->GetFanRotationXShift(), 479-130+this->GetFanRotationYShift(),
-														505+this->GetFanRotationXShift(), 479-126+this->GetFanRotationYShift(), 505+this->GetFanRotationXShift(), 479-131+this->GetFanRotationYShift(),
-														501+this->GetFanRotationXShift(), 479-130+this->GetFanRotationYShift(), 507+this->GetFanRotationXShift(), 479-130+this->GetFanRotationYShift()};
-		d3 = this->GetFanRepresentation(threshold, array3);
-
-		//Second Rotation Value
-		int array2[12] = {492+this->GetFanRotationXShift(), 479-126+this->GetFanRotationYShift(), 492+this->GetFanRotationXShift(), 479-130+this->GetFanRotationYShift(),
-														495+this->GetFanRotationXShift(), 479-126+this->GetFanRotationYShift(), 495+this->GetFanRotationXShift(), 479-131+this->GetFanRotationYShift(),
-														491+this->GetFanRotationXShift(), 479-130+this->GetFanRotationYShift(), 497+this->GetFanRotationXShift(), 479-130+this->GetFanRotationYShift()};
-		d2 = this->GetFanRepresentation(threshold, array2);
+  this->Modified();
 
-		// Third rotation value
-		int array1[12] = {482+this->GetFanRotationXShift(), 479-126+this->GetFanRotationYShift(), 482+this->GetFanRotationXShift(), 479-130+this->GetFanRotationYShift(),
-														485+this->GetFanRotationXShift(), 479-126+this->GetFanRotationYShift(), 485+this->GetFanRotationXShift(), 479-131+this->GetFanRotationYShift(),
-														481+this->GetFanRotationXShift(), 479-130+this->GetFanRotationYShift(), 487+this->GetFanRotationXShift(), 479-130+this->GetFanRotationYShift()};
-		d1 = this->GetFanRepresentation(threshold, array1);
-	}
-	else
-	{
-		return -1;
-	}
+  return inserted;
+}
 
-    if (d3 >= 0)
-	{
-        if (d2 >=0)
-		{
-            if (d1 >=0)
-			{
-                return d1*100+d2*10+d3;
-			}
-            else
-			{
-                return d2*10+d3;
-			}
-		}
-        else
-		{
-            return d3;
-		}
-	}
-	else
-	{
-		return -1;
-	}
+//----------------------------------------------------------------------------
+// Preview reconstruction
+//
+// While the preview is on, the reconstruction thread inserts each frame
+// into the coarse PreviewOutput, which is cheap enough to keep up with the
+// video.  The frame and its index matrix are then either queued for the
+// full-resolution thread, or just counted so that they can be inserted by
+// ReconstructDeferredFrames() after the scan.  FullResolutionLock guards
+// the queue, and FullResolutionInsertLock keeps the output from being
+// cleared while the full-resolution thread is inserting into it.
+//----------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------
+// This function is run in a second background thread while the preview is
+// being built.  When it is told to quit, it finishes the frames that are
+// still in the queue before returning.
+static void *vtkFullResolutionThread(struct ThreadInfoStruct *data)
+{
+  vtkFreehandUltrasound2 *self = (vtkFreehandUltrasound2 *)(data->UserData);
 
+  for (;;)
+    {
+    if (self->InsertQueuedSlices() == 0)
+      {
+      if (*(data->ActiveFlag) == 0)
+        {
+        return NULL;
+        }
+      vtkSleep(0.005);
+      }
+    }
 }
 
-/*int vtkFreehandUltrasound2::CalculateFanDepthCmValue (vtkImageThreshold* threshold)
+//----------------------------------------------------------------------------
+// InsertPreviewSlice
+// Insert the frame into the preview, then queue a copy of it for the
+// full-resolution thread or defer it
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::InsertPreviewSlice(vtkImageData *inData)
 {
+  vtkFreehand2FrameQueue *queue = this->FullResolutionQueue;
 
-	int d1, d2;
+  if (this->NeedsClear)
+    {
+    this->FullResolutionLock->Lock();
+    queue->Flush();
+    this->FullResolutionLock->Unlock();
+    this->FullResolutionInsertLock->Lock();
+    this->InternalClearOutput();
+    this->FullResolutionInsertLock->Unlock();
+    }
 
-	// not flipped
-	if (this->GetImageIsFlipped() == 0)
-	{
-		// First Depth Value
-		int array1[12] = {132+this->GetFanRotationXShift(), 479-58+this->GetFanRotationYShift(), 132+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift(),
-												135+this->GetFanRotationXShift(), 479-58+this->GetFanRotationYShift(), 135+this->GetFanRotationXShift(), 479-63+this->GetFanRotationYShift(),
-												131+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift(), 137+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift()};
-		d1 = this->GetFanRepresentation (threshold, array1);
-		// Second Depth Value
-		int array2[12] = {142+this->GetFanRotationXShift(), 479-58+this->GetFanRotationYShift(), 142+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift(),
-												145+this->GetFanRotationXShift(), 479-58+this->GetFanRotationYShift(), 145+this->GetFanRotationXShift(), 479-63+this->GetFanRotationYShift(),
-												141+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift(), 147+this->GetFanRotationXShift(), 479-62+this->GetFanRotationYShift()};
-		d2 = this->GetFanRepresentation(threshold, array2);
-	}
+  // the preview indices are the output indices divided by the shrink factor
+  vtkMatrix4x4 *indexMatrix = this->GetIndexMatrix(inData);
+  double matrix[4][4];
+  double previewMatrix[4][4];
+  double f = 1.0/this->PreviewShrinkFactor;
+  int i, j;
+  for (i = 0; i < 4; i++)
+    {
+    for (j = 0; j < 4; j++)
+      {
+      matrix[i][j] = indexMatrix->GetElement(i,j);
+      previewMatrix[i][j] = (i < 3 ? matrix[i][j]*f : matrix[i][j]);
+      }
+    }
 
-	// flipped		
-	else if (this->GetImageIsFlipped() == 1)
-	{
-		// First Depth Value
-		int array1[12] = {22+this->GetFanRotationXShift(), 479-268+this->GetFanRotationYShift(), 22+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift(),
-												25+this->GetFanRotationXShift(), 479-268+this->GetFanRotationYShift(), 25+this->GetFanRotationXShift(), 479-273+this->GetFanRotationYShift(),
-												21+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift(), 27+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift()};
-		d1 = this->GetFanRepresentation(threshold, array1);
-		// Second Depth Value
-		int array2[12] = {32+this->GetFanRotationXShift(), 479-268+this->GetFanRotationYShift(), 32+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift(),
-												35+this->GetFanRotationXShift(), 479-268+this->GetFanRotationYShift(), 35+this->GetFanRotationXShift(), 479-273+this->GetFanRotationYShift(),
-												31+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift(), 37+this->GetFanRotationXShift(), 479-272+this->GetFanRotationYShift()};
-		d2 = this->GetFanRepresentation(threshold, array2);
-	}
-	else
-	{
-		return -1;
-	}
+  // a thread id of -1 keeps the preview out of the PixelCount
+  vtkFreehand2BatchInsertFrame(this, inData, previewMatrix,
+                               this->PreviewOutput,
+                               (this->Compounding ?
+                                this->PreviewAccumulationBuffer : 0), -1);
+  this->PreviewOutput->Modified();
 
-    if (d2 >=0)
-	{
-        if (d1 >=0)
-		{
-            return d1*10+d2;
-		}
-        else
-		{
-            return d2;
-		}
-	}
-    else
-	{
-        return -1;
-	}
-}*/
+  // the LastIndexMatrix is a copy of the most recent index matrix used
+  if (this->LastIndexMatrix == 0)
+    {
+    this->LastIndexMatrix = vtkMatrix4x4::New();
+    }
+  this->LastIndexMatrix->DeepCopy(indexMatrix);
+
+  // the deferred frames are counted in video frames, since the
+  // reconstruction thread does not get to see every frame
+  if (this->FullResolutionMode == VTK_FREEHAND_FULL_RES_DEFERRED)
+    {
+    int frameCount = 0;
+    if (this->VideoSource)
+      {
+      frameCount = this->VideoSource->GetFrameCount();
+      }
+    if (this->DeferredFrameCount == 0)
+      {
+      this->DeferredFirstFrame = frameCount;
+      }
+    this->DeferredFrameCount = frameCount - this->DeferredFirstFrame + 1;
+    return;
+    }
+
+  // copy the frame outside of the lock, the queue must not wait on it
+  vtkImageData *frame;
+  this->FullResolutionLock->Lock();
+  if (queue->Free.empty())
+    {
+    frame = vtkImageData::New();
+    }
+  else
+    {
+    frame = queue->Free.back();
+    queue->Free.pop_back();
+    }
+  this->FullResolutionLock->Unlock();
 
-// TODO right now this is hard coded for the adult TEE
-int vtkFreehandUltrasound2::GetFanRepresentation (vtkImageThreshold* threshold, int array[12])
-{
-	int list[6];
-	int B = 0;
-	int W = 1;
-	int result = -1;
+  frame->DeepCopy(inData);
 
-	for (int i = 0; i < 6; i++)
-	{
-		list[i] = threshold->GetOutput()->GetScalarComponentAsFloat(array[2*i], array[2*i+1],0,0);
-	}
+  this->FullResolutionLock->Lock();
+  int size = static_cast<int>(queue->Frames.size());
+  if (queue->Count == size)
+    {
+    // drop the oldest frame
+    queue->Free.push_back(queue->Frames[queue->First]);
+    queue->First = (queue->First + 1) % size;
+    queue->Count--;
+    this->FullResolutionDroppedFrames++;
+    }
+  int slot = (queue->First + queue->Count) % size;
+  queue->Frames[slot] = frame;
+  memcpy(&queue->Matrices[16*slot], matrix, sizeof(matrix));
+  queue->Count++;
+  this->FullResolutionLock->Unlock();
+}
 
-    if ((list[0] == B) && (list[1] == W) && (list[2] == W) && (list[3] == B) && (list[4] == W) && (list[5] == W))
-	{
-        result = 0;
-	}
-	else if ((list[0] == W) && (list[1] == B) && (list[2] == W) && (list[3] == W) && (list[4] == B) && (list[5] == B))
-	{
-        result = 1;  
-	}
-	else if ((list[0] == B) && (list[1] == W) && (list[2] == B) && (list[3] == B) && (list[4] == B) && (list[5] == B))
-	{
-        result = 2;
-	}
-	else if ((list[0] == B) && (list[1] == B) && (list[2] == W) && (list[3] == B) && (list[4] == B) && (list[5] == W))
-	{
-        result = 3;
-	}
-	else if ((list[0] == W) && (list[1] == W) && (list[2] == W) && (list[3] == W) && (list[4] == W) && (list[5] == W))
-	{    
-		result = 4;
-	}
-	else if ((list[0] == B) && (list[1] == B) && (list[2] == B) && (list[3] == B) && (list[4] == B) && (list[5] == W))
-	{
-        result = 5;
-	}
-    else if ((list[0] == W) && (list[1] == B) && (list[2] == B) && (list[3] == B) && (list[4] == W) && (list[5] == W))
-	{
-        result = 6;
-	}
-    else if ((list[0] == B) && (list[1] == W) && (list[2] == W) && (list[3] == B) && (list[4] == W) && (list[5] == B))
-	{
-        result = 7;
-	}
-    else if ((list[0] == B) && (list[1] == B) && (list[2] == B) && (list[3] == B) && (list[4] == W) && (list[5] == W))
-	{
-        result = 8;
-	}
-    else if ((list[0] == B) && (list[1] == B) && (list[2] == B) && (list[3] == W) && (list[4] == B) && (list[5] == W))
-	{
-        result = 9;
-	}
-	else
-	{
-		result = -1;
-	}
+//----------------------------------------------------------------------------
+// InsertQueuedSlices
+// Insert the queued frames into the full-resolution output, oldest first,
+// and return the number of frames that were inserted
+//----------------------------------------------------------------------------
+int vtkFreehandUltrasound2::InsertQueuedSlices()
+{
+  vtkFreehand2FrameQueue *queue = this->FullResolutionQueue;
+  int inserted = 0;
 
-	delete[] &list;
-	return result;
+  for (;;)
+    {
+    this->FullResolutionLock->Lock();
+    if (queue->Count == 0)
+      {
+      this->FullResolutionLock->Unlock();
+      return inserted;
+      }
+    vtkImageData *frame = queue->Frames[queue->First];
+    double matrix[4][4];
+    memcpy(matrix, &queue->Matrices[16*queue->First], sizeof(matrix));
+    queue->First = (queue->First + 1) % queue->Frames.size();
+    queue->Count--;
+    this->FullResolutionLock->Unlock();
+
+    this->FullResolutionInsertLock->Lock();
+    vtkFreehand2BatchInsertFrame(this, frame, matrix, this->GetOutput(),
+                                 (this->Compounding ?
+                                  this->AccumulationBuffer : 0), 0);
+    this->FullResolutionInsertLock->Unlock();
+    this->Modified();
+
+    this->FullResolutionLock->Lock();
+    queue->Free.push_back(frame);
+    this->FullResolutionLock->Unlock();
+    inserted++;
+    }
 }
 
-/*int vtkFreehandUltrasound2::CheckIfUpsideDown(vtkImageThreshold* threshold)
+//----------------------------------------------------------------------------
+// MergeSlice
+// Check whether the slice moved far enough since the last inserted slice
+// to be worth inserting, when the FramePolicy is Adaptive
+//----------------------------------------------------------------------------
+int vtkFreehandUltrasound2::MergeSlice(vtkImageData *inData)
 {
-	int result;
-
-	// if depth value < 10
-	int isDownDepthLessThan10 = threshold->GetOutput()->GetScalarComponentAsFloat(346+this->GetFanRotationXShift(), 479-57+this->GetFanRotationYShift() ,0,0);
-    int isUpDepthLessThan10 = threshold->GetOutput()->GetScalarComponentAsFloat(337+this->GetFanRotationXShift(), 479-380+this->GetFanRotationYShift() ,0,0);
+  if (this->FramePolicy != VTK_FREEHAND_FRAME_POLICY_ADAPTIVE)
+    {
+    return 0;
+    }
 
-	// if depth value >= 10
-    int isDownDepthGreaterThan10 = threshold->GetOutput()->GetScalarComponentAsFloat(338+this->GetFanRotationXShift(), 479-36+this->GetFanRotationYShift() ,0,0);
-    int isUpDepthGreaterThan10 = threshold->GetOutput()->GetScalarComponentAsFloat(338+this->GetFanRotationXShift(), 479-423+this->GetFanRotationYShift() ,0,0);
-	
-	// image is flipped
-	if ((isDownDepthLessThan10 == 1 && isUpDepthLessThan10 == 0) || (isDownDepthGreaterThan10 == 1 && isUpDepthGreaterThan10 == 0))
-	{
-		result = 1;
-	}
-	// image is not flipped
-	else if ((isUpDepthLessThan10 == 1 && isDownDepthLessThan10 == 0) || (isUpDepthGreaterThan10 == 1 && isDownDepthGreaterThan10 == 0))
-	{
-		result = 0;
-	}
-	else
-	{
-		result = -1;
-	}
+  vtkMatrix4x4 *matrix = this->GetIndexMatrix(inData);
 
-	return result;
-}*/
+  // the LastIndexMatrix is removed whenever the output is cleared
+  if (this->LastIndexMatrix && !this->NeedsClear)
+    {
+    double spacing = this->OutputSpacing[0];
+    spacing = (this->OutputSpacing[1] < spacing ?
+               this->OutputSpacing[1] : spacing);
+    spacing = (this->OutputSpacing[2] < spacing ?
+               this->OutputSpacing[2] : spacing);
+
+    if (this->CalculateMaxSliceSeparation(this->LastIndexMatrix, matrix) <
+        this->MinimumSliceSeparation*spacing)
+      {
+      this->MergedFrameCount++;
+      return 1;
+      }
+    }
 
+  // the LastIndexMatrix is set when the slice is inserted, since the
+  // slice might still be dropped
+  return 0;
+}
 
 //----------------------------------------------------------------------------
-// StartReconstruction
-// Start doing a reconstruction from the video frames stored
-// in the VideoSource buffer.  You should first use 'Seek'
-// on the VideoSource to rewind first.  Then the reconstruction
-// will advance through n frames one by one until the
-// reconstruction is complete.  The reconstruction
-// is performed in the background.
+// InsertWaitingSlice
+// Insert a frame that the reconstruction thread took from the VideoSource
+// buffer.  InsertSlice() cannot be used, since it updates the slice.
 //----------------------------------------------------------------------------
-void vtkFreehandUltrasound2::StartReconstruction(int frames)
+void vtkFreehandUltrasound2::InsertWaitingSlice(vtkImageData *frame)
 {
-  if (frames <= 0)
+  if (this->Preview)
     {
+    this->InsertPreviewSlice(frame);
     return;
     }
 
-  // If the reconstruction isn't running (reconstructionThreadId == -1)
-  if (this->ReconstructionThreadId == -1)
+  if (this->NeedsClear)
     {
-    fprintf(stderr, "Reconstruction Start\n");
-    this->RealTimeReconstruction = 0; // doing buffered reconstruction
-    this->ReconstructionFrameCount = frames;
-    // TODO why these next three lines? probably bad - look at if this deep copies
-    vtkMatrix4x4 *matrix = vtkMatrix4x4::New();
-    this->SetSliceAxes(matrix);
-    matrix->Delete();
-	
-	/*// added by danielle
-	vtkTransform *transform = vtkTransform::New();
-	this->SetSliceTransform(transform);
-	transform->Delete();*/
+    this->InternalClearOutput();
+    }
 
-    this->GetOutput()->Update();
-    // TODO note that I think that calls to internalexecuteinformation should be
-    // replaced with calls to requestinformation
-    //this->InternalExecuteInformation(); // this was vtk 4
-    // TODO does this call the vtkReconstructionThread function below?
-    this->ReconstructionThreadId = \
-      this->Threader->SpawnThread((vtkThreadFunctionType)\
-				  &vtkReconstructionThread,
-				  this);
-	//cout<<" Reconstruction Thread: "<<this->ReconstructionThreadId<<endl;
+  vtkMatrix4x4 *indexMatrix = this->GetIndexMatrix(frame);
+  double matrix[4][4];
+  vtkMatrix4x4::DeepCopy(*matrix, *indexMatrix->Element);
+
+  vtkFreehand2BatchInsertFrame(this, frame, matrix, this->GetOutput(),
+                               (this->Compounding ?
+                                this->AccumulationBuffer : 0), 0);
+  this->Modified();
+
+  // the LastIndexMatrix is a copy of the most recent index matrix used
+  if (this->LastIndexMatrix == 0)
+    {
+    this->LastIndexMatrix = vtkMatrix4x4::New();
     }
+  this->LastIndexMatrix->DeepCopy(indexMatrix);
 }
 
 //----------------------------------------------------------------------------
-// StopReconstruction
-// Stop the reconstruction started wtih StartReconstruction() - returns the
-// number of frames remaining to be reconstructed
+// ReconstructDeferredFrames
+// Rewind the VideoSource to the first deferred frame and insert all of the
+// deferred frames into the full-resolution output
 //----------------------------------------------------------------------------
-int vtkFreehandUltrasound2::StopReconstruction()
+int vtkFreehandUltrasound2::ReconstructDeferredFrames()
 {
-  // if a reconstruction is running (reconstructionThreadId != -1)
   if (this->ReconstructionThreadId != -1)
     {
-    this->Threader->TerminateThread(this->ReconstructionThreadId);
-    this->ReconstructionThreadId = -1;
-    return this->ReconstructionFrameCount;
+    vtkErrorMacro(<< "ReconstructDeferredFrames: stop the real-time "
+                  "reconstruction first");
+    return 0;
     }
-  return 0;
+  if (this->VideoSource == NULL || this->DeferredFrameCount <= 0)
+    {
+    return 0;
+    }
+
+  // the video may have grabbed more frames since the scan was stopped
+  int frames = this->DeferredFrameCount;
+  int rewind = this->VideoSource->GetFrameCount() - this->DeferredFirstFrame;
+  int bufferSize = this->VideoSource->GetFrameBufferSize();
+  if (rewind >= bufferSize)
+    {
+    vtkWarningMacro(<< "ReconstructDeferredFrames: some of the "
+                    << frames << " frames are no longer in the video buffer");
+    frames -= rewind - bufferSize + 1;
+    rewind = bufferSize - 1;
+    }
+
+  this->VideoSource->Seek(-rewind);
+  this->DeferredFrameCount = 0;
+
+  return this->ReconstructBatch(frames);
 }
 
 
@@ -5054,17 +4821,49 @@ void vtkFreehandUltrasound2::StartRealTimeReconstruction()
     // replaced with requestinformation
    this->InternalExecuteInformation();
 
+    this->DroppedFrameCount = 0;
+    this->MergedFrameCount = 0;
+    this->FrameLatency = 0;
+
 
 		// Added by Danielle to deal with rotations
-		this->SetRotationClipData(vtkImageClip::New());
-		this->GetRotationClipData()->ClipDataOn();
-		this->SetRotationThreshold(vtkImageThreshold::New());
-		this->GetRotationThreshold()->ThresholdBetween(this->GetFanRotationImageThreshold1(), this->GetFanRotationImageThreshold2());
-		this->GetRotationThreshold()->SetOutValue(1);
-		this->GetRotationThreshold()->SetInValue(0);
+    if (this->RotationDecoder == NULL)
+      {
+      // the adult TEE shows the rotation as three digits, in a different
+      // place when the image is flipped
+      vtkUltrasoundAnnotationDecoder *decoder =
+        vtkUltrasoundAnnotationDecoder::New();
+      decoder->AddField(72, 294, 3, -10);
+      decoder->AddField(502, 126, 3, -10);
+      this->SetRotationDecoder(decoder);
+      decoder->Delete();
+      }
 
 		// End added by Danielle
 
+    // the preview must match the current output, and the full-resolution
+    // thread must be running before the first frame is queued
+    if (this->Preview)
+      {
+      this->InternalClearPreview();
+      this->FullResolutionDroppedFrames = 0;
+      this->DeferredFrameCount = 0;
+      this->FullResolutionLock->Lock();
+      this->FullResolutionQueue->Flush();
+      this->FullResolutionQueue->Frames.resize(
+        this->FullResolutionQueueLength);
+      this->FullResolutionQueue->Matrices.resize(
+        16*this->FullResolutionQueueLength);
+      this->FullResolutionLock->Unlock();
+      if (this->FullResolutionMode == VTK_FREEHAND_FULL_RES_BACKGROUND)
+        {
+        this->FullResolutionThreadId =
+          this->ReconstructionThreader->SpawnThread((vtkThreadFunctionType)
+                                                    &vtkFullResolutionThread,
+                                                    this);
+        }
+      }
+
    //cout << "start realtime whole extent: " << this->GetOutput()->GetWholeExtent()[0] << " " << this->GetOutput()->GetWholeExtent()[1] << endl;
     this->ReconstructionThreadId = \
       this->Threader->SpawnThread((vtkThreadFunctionType)\
@@ -5100,6 +4899,13 @@ void vtkFreehandUltrasound2::StopRealTimeReconstruction()
 	cout<<"Thread : "<<this->ReconstructionThreadId <<" terminated"<<endl;
 	this->ReconstructionThreadId = -1;
 	this->ActiveFlagLock->Unlock();
+	// the full-resolution thread finishes the queued frames before it stops
+	if (this->FullResolutionThreadId != -1)
+	  {
+	  this->ReconstructionThreader->TerminateThread(
+	    this->FullResolutionThreadId);
+	  this->FullResolutionThreadId = -1;
+	  }
 	if (this->TrackerTool)
 	  {
 	    // the vtkTrackerBuffer (Atamai) should be locked before changing or
@@ -5373,3 +5179,202 @@ void vtkFreehandUltrasound2::ReadRawData(const char *directory)
   this->VideoSource->WriteFramesAsPNG(path, filePath);*/
 
 }
+
+//----------------------------------------------------------------------------
+// SaveSweep
+// Save n frames from the VideoSource buffer, plus the tracking information
+// and the ultrasound parameters, in a single sweep file
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::SaveSweep(const char *filename, int frames)
+{
+  if (this->ReconstructionThreadId != -1)
+    {
+    if (this->RealTimeReconstruction)
+      {
+      this->StopRealTimeReconstruction();
+      }
+    else
+      {
+      this->StopReconstruction();
+      }
+    }
+
+  if (this->VideoSource == NULL)
+    {
+    vtkErrorMacro(<< "SaveSweep: no VideoSource");
+    return;
+    }
+
+  vtkImageData *image = this->VideoSource->GetOutput();
+  vtkUltrasoundSweepFile *writer = vtkUltrasoundSweepFile::New();
+  writer->SetFileName(filename);
+  this->SetSweepParameters(writer);
+  if (!writer->OpenForWriting(image))
+    {
+    writer->Delete();
+    return;
+    }
+
+  // the frames are compressed and written in the background while
+  // they are being copied from the video source
+  for (int i = 0; i < frames; i++)
+    {
+    image->SetUpdateExtentToWholeExtent();
+    image->Update();
+    if (!writer->WriteFrame(image, this->VideoSource->GetFrameTimeStamp()))
+      {
+      break;
+      }
+    if (i < frames - 1)
+      {
+      this->VideoSource->Seek(1);
+      }
+    }
+
+  writer->SetTrackerBuffer(this->TrackerBuffer);
+  writer->Close();
+  writer->Delete();
+}
+
+//----------------------------------------------------------------------------
+// ReadSweep
+// Read the tracking information and the ultrasound parameters from a sweep
+// file, and keep the file open as the frame source for ReconstructBatch()
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::ReadSweep(const char *filename)
+{
+  if (this->ReconstructionThreadId != -1)
+    {
+    if (this->RealTimeReconstruction)
+      {
+      this->StopRealTimeReconstruction();
+      }
+    else
+      {
+      this->StopReconstruction();
+      }
+    }
+
+  if (this->SweepFile == NULL)
+    {
+    this->SweepFile = vtkUltrasoundSweepFile::New();
+    }
+  this->SweepFile->SetFileName(filename);
+  if (!this->SweepFile->Open())
+    {
+    return;
+    }
+
+  this->SetClipRectangle(this->SweepFile->GetClipRectangle());
+  this->SetFanAngles(this->SweepFile->GetFanAngles());
+  this->SetFanOrigin(this->SweepFile->GetFanOrigin());
+  this->SetFanDepth(this->SweepFile->GetFanDepth());
+  this->SetVideoLag(this->SweepFile->GetVideoLag());
+
+  if (!this->SweepFile->ReadTrackerBuffer(this->TrackerBuffer))
+    {
+    vtkWarningMacro(<< "ReadSweep: " << filename
+                    << " has no tracking information");
+    }
+
+  // without a video source, the first frame of the sweep provides the
+  // slice information for the output
+  if (this->SweepFrame == NULL)
+    {
+    this->SweepFrame = vtkImageData::New();
+    }
+  if (this->SweepFile->GetNumberOfFrames() > 0)
+    {
+    this->SweepFile->ReadFrame(0, this->SweepFrame);
+    if (this->VideoSource == NULL)
+      {
+      this->SetSlice(this->SweepFrame);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// StartSweepRecording
+// Record every frame that is inserted by the real-time reconstruction into
+// a sweep file.  The frames are written by a background thread.
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::StartSweepRecording(const char *filename)
+{
+  this->StopSweepRecording();
+
+  vtkImageData *image = this->GetSlice();
+  if (image == NULL)
+    {
+    vtkErrorMacro(<< "StartSweepRecording: no VideoSource or Slice");
+    return;
+    }
+
+  vtkUltrasoundSweepFile *writer = vtkUltrasoundSweepFile::New();
+  writer->SetFileName(filename);
+  this->SetSweepParameters(writer);
+  if (!writer->OpenForWriting(image))
+    {
+    writer->Delete();
+    return;
+    }
+
+  this->SweepLock->Lock();
+  this->SweepRecorder = writer;
+  this->SweepLock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+// StopSweepRecording
+// Write the tracking information to the sweep file and close it
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::StopSweepRecording()
+{
+  this->SweepLock->Lock();
+  vtkUltrasoundSweepFile *writer = this->SweepRecorder;
+  this->SweepRecorder = NULL;
+  this->SweepLock->Unlock();
+
+  if (writer == NULL)
+    {
+    return;
+    }
+
+  if (this->TrackerTool)
+    {
+    this->TrackerTool->GetBuffer()->Lock();
+    writer->SetTrackerBuffer(this->TrackerTool->GetBuffer());
+    this->TrackerTool->GetBuffer()->Unlock();
+    }
+  else
+    {
+    writer->SetTrackerBuffer(this->TrackerBuffer);
+    }
+
+  writer->Close();
+  writer->Delete();
+}
+
+//----------------------------------------------------------------------------
+// RecordSweepFrame
+// Called by the reconstruction thread for each frame that is inserted
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::RecordSweepFrame(vtkImageData *frame,
+                                              double timestamp)
+{
+  this->SweepLock->Lock();
+  if (this->SweepRecorder)
+    {
+    this->SweepRecorder->WriteFrame(frame, timestamp);
+    }
+  this->SweepLock->Unlock();
+}
+
+//----------------------------------------------------------------------------
+void vtkFreehandUltrasound2::SetSweepParameters(vtkUltrasoundSweepFile *file)
+{
+  file->SetClipRectangle(this->ClipRectangle);
+  file->SetFanAngles(this->FanAngles);
+  file->SetFanOrigin(this->FanOrigin);
+  file->SetFanDepth(this->FanDepth);
+  file->SetVideoLag(this->VideoLag);
+}
@@ -56,6 +56,7 @@ POSSIBILITY OF SUCH DAMAGES.
 
 #include "vtkImageSource.h"
 #include "vtkImageAlgorithm.h"
+#include "vtkMultiThreader.h" // for VTK_MAX_THREADS
 
 class vtkLinearTransform;
 class vtkMatrix4x4;
@@ -65,13 +66,36 @@ class vtkTrackerTool;
 class vtkTrackerBuffer;
 class vtkCriticalSection;
 class vtkImageData;
-class vtkImageThreshold;
-class vtkImageClip;
+class vtkUltrasoundAnnotationDecoder;
 class vtkTransform;
+class vtkUltrasoundSweepFile;
 
 #define VTK_FREEHAND_NEAREST 0
 #define VTK_FREEHAND_LINEAR 1
 
+#define VTK_FREEHAND_HOLE_FILL_AVERAGE 0
+#define VTK_FREEHAND_HOLE_FILL_DISTANCE_WEIGHTED 1
+#define VTK_FREEHAND_HOLE_FILL_GROWING 2
+#define VTK_FREEHAND_HOLE_FILL_GAUSSIAN 3
+
+#define VTK_FREEHAND_FULL_RES_BACKGROUND 0
+#define VTK_FREEHAND_FULL_RES_DEFERRED 1
+
+#define VTK_FREEHAND_FRAME_POLICY_QUEUE 0
+#define VTK_FREEHAND_FRAME_POLICY_NEWEST 1
+#define VTK_FREEHAND_FRAME_POLICY_ADAPTIVE 2
+
+#define VTK_FREEHAND_COMPOUND_MEAN 0
+#define VTK_FREEHAND_COMPOUND_MAX 1
+#define VTK_FREEHAND_COMPOUND_LATEST 2
+#define VTK_FREEHAND_COMPOUND_DISTANCE_WEIGHTED 3
+#define VTK_FREEHAND_COMPOUND_MEDIAN 4
+
+// number of samples kept per voxel for median compounding
+#define VTK_FREEHAND_MEDIAN_RESERVOIR 5
+
+struct vtkFreehand2FrameQueue;
+
 class VTK_EXPORT vtkFreehandUltrasound2 : public vtkImageAlgorithm
 {
 public:
@@ -113,6 +137,30 @@ public:
   // be reconstructed is returned.
   int StopReconstruction();
 
+  // Description:
+  // Reconstruct n frames from the VideoSource buffer as quickly as
+  // possible.  Unlike StartReconstruction(), this does not run in the
+  // background and does not wait between frames: it blocks until all
+  // n frames have been inserted, and returns the number of frames that
+  // were inserted (frames without valid tracking are skipped).  You
+  // should first use 'Seek' on the VideoSource to rewind it, and the
+  // tracking must be in the TrackerBuffer (e.g. from ReadRawData).
+  int ReconstructBatch(int n);
+
+  // Description:
+  // The number of threads used by ReconstructBatch().  Each thread other
+  // than the first needs its own copy of the output volume (and of the
+  // accumulation buffer, if Compounding is on).
+  // Default: the number of processors.
+  vtkSetClampMacro(BatchNumberOfThreads,int,1,VTK_MAX_THREADS);
+  vtkGetMacro(BatchNumberOfThreads,int);
+
+  // Description:
+  // The number of video frames that ReconstructBatch() holds in memory
+  // at once.  Default: 64.
+  vtkSetClampMacro(BatchSize,int,1,VTK_LARGE_INTEGER);
+  vtkGetMacro(BatchSize,int);
+
   // Description:
   // Start doing real-time reconstruction from the video source.
   // This will spawn a thread that does the reconstruction in the
@@ -127,6 +175,118 @@ public:
   // Get the reconstruction rate.
   double GetReconstructionRate() { return this->ReconstructionRate; };
 
+  // Description:
+  // Maintain a coarse preview volume during real-time reconstruction.
+  // The preview covers the same region as the output, but its spacing
+  // is PreviewShrinkFactor times the OutputSpacing.  Each new frame is
+  // inserted into the preview first, and the full-resolution output is
+  // built according to the FullResolutionMode.  This must be set before
+  // StartRealTimeReconstruction() is called.  Default: off.
+  vtkSetMacro(Preview,int);
+  vtkGetMacro(Preview,int);
+  vtkBooleanMacro(Preview,int);
+
+  // Description:
+  // How much coarser the preview spacing is than the OutputSpacing.
+  // Default: 4.
+  vtkSetClampMacro(PreviewShrinkFactor,int,1,16);
+  vtkGetMacro(PreviewShrinkFactor,int);
+
+  // Description:
+  // Get the preview volume.  Like the output, its last component is the
+  // alpha component.
+  vtkGetObjectMacro(PreviewOutput,vtkImageData);
+
+  // Description:
+  // How the full-resolution output is built while Preview is on.
+  // Background: the frames are passed to a second thread that inserts
+  // them into the output whenever it can keep up.  If it falls behind
+  // by more than FullResolutionQueueLength frames, the oldest waiting
+  // frames are dropped, just as the real-time reconstruction skips video
+  // frames when it falls behind.  Deferred: only the preview is built
+  // during the scan, and the output is built afterwards by calling
+  // ReconstructDeferredFrames().  Default: Background.
+  vtkSetClampMacro(FullResolutionMode,int,VTK_FREEHAND_FULL_RES_BACKGROUND,
+                   VTK_FREEHAND_FULL_RES_DEFERRED);
+  vtkGetMacro(FullResolutionMode,int);
+  void SetFullResolutionModeToBackground()
+    { this->SetFullResolutionMode(VTK_FREEHAND_FULL_RES_BACKGROUND); };
+  void SetFullResolutionModeToDeferred()
+    { this->SetFullResolutionMode(VTK_FREEHAND_FULL_RES_DEFERRED); };
+
+  // Description:
+  // The number of frames that can wait for the background insertion
+  // into the full-resolution output.  Default: 8.
+  vtkSetClampMacro(FullResolutionQueueLength,int,1,VTK_LARGE_INTEGER);
+  vtkGetMacro(FullResolutionQueueLength,int);
+
+  // Description:
+  // Get the number of frames that were put into the preview but not into
+  // the output, because they were dropped by the background insertion.
+  vtkGetMacro(FullResolutionDroppedFrames,int);
+
+  // Description:
+  // Get the number of video frames, from the first deferred frame to the
+  // last, that are missing from the output in Deferred mode.
+  vtkGetMacro(DeferredFrameCount,int);
+
+  // Description:
+  // Insert the video frames that were deferred during the last real-time
+  // reconstruction into the full-resolution output, by rewinding the
+  // VideoSource and calling ReconstructBatch().  This inserts every video
+  // frame, including those that the real-time reconstruction skipped.
+  // The frames must still be in the VideoSource buffer, and the
+  // real-time reconstruction must be stopped so that the TrackerBuffer
+  // has been filled.  Returns the number of frames inserted.
+  int ReconstructDeferredFrames();
+
+  // Description:
+  // What the real-time reconstruction does with the video frames that
+  // arrive while it is busy inserting a frame.  Queue: the frames wait in
+  // the VideoSource buffer and are inserted in order, unless they are
+  // older than MaximumLatency when their turn comes, in which case they
+  // are dropped.  Newest: only the most recent frame is inserted and the
+  // others are dropped.  Adaptive: like Queue, but frames whose position
+  // differs from the last inserted frame by less than the
+  // MinimumSliceSeparation are merged into it (i.e. skipped), so that
+  // slow probe motion costs little time.  Default: Newest.
+  vtkSetClampMacro(FramePolicy,int,VTK_FREEHAND_FRAME_POLICY_QUEUE,
+                   VTK_FREEHAND_FRAME_POLICY_ADAPTIVE);
+  vtkGetMacro(FramePolicy,int);
+  void SetFramePolicyToQueue()
+    { this->SetFramePolicy(VTK_FREEHAND_FRAME_POLICY_QUEUE); };
+  void SetFramePolicyToNewest()
+    { this->SetFramePolicy(VTK_FREEHAND_FRAME_POLICY_NEWEST); };
+  void SetFramePolicyToAdaptive()
+    { this->SetFramePolicy(VTK_FREEHAND_FRAME_POLICY_ADAPTIVE); };
+  char *GetFramePolicyAsString();
+
+  // Description:
+  // The oldest a waiting video frame can be, in seconds, and still be
+  // inserted when the FramePolicy is Queue or Adaptive.  Default: 0.25.
+  vtkSetMacro(MaximumLatency,double);
+  vtkGetMacro(MaximumLatency,double);
+
+  // Description:
+  // The smallest motion, as a fraction of the smallest OutputSpacing,
+  // for which a frame is inserted when the FramePolicy is Adaptive.
+  // Default: 0.5.
+  vtkSetMacro(MinimumSliceSeparation,double);
+  vtkGetMacro(MinimumSliceSeparation,double);
+
+  // Description:
+  // Get the number of video frames that the real-time reconstruction did
+  // not insert because it was falling behind, and the number of frames
+  // that the Adaptive policy merged into the previous frame.  These are
+  // reset by StartRealTimeReconstruction().
+  vtkGetMacro(DroppedFrameCount,int);
+  vtkGetMacro(MergedFrameCount,int);
+
+  // Description:
+  // Get the time, in seconds, from the capture of the most recently
+  // inserted frame until its insertion was complete.
+  vtkGetMacro(FrameLatency,double);
+
   double SliceCalculateMaxSliceSeparation(vtkMatrix4x4 *m1, vtkMatrix4x4 *m2);
   // Description:
   // Fill holes in the output by using the weighted average of the
@@ -134,6 +294,60 @@ public:
   // are weighted equally. 
   void FillHolesInOutput();
 
+  // Description:
+  // Set the kernel used by FillHolesInOutput.  Average is the original
+  // fixed 3x3x3 (or 5x5x5) neighborhood average over the interior of the
+  // volume.  The other modes only visit empty voxels that border filled
+  // voxels (the "frontier"), and they also fill the boundary of the volume:
+  // DistanceWeighted uses inverse-square distance weights within the
+  // HoleFillingRadius, Growing repeats the distance-weighted pass on the
+  // newly filled voxels until no frontier is left or HoleFillingMaxPasses
+  // is reached, and Gaussian uses gaussian weights that are further
+  // weighted by the accumulation buffer if Compounding is on.
+  // Default: Average.
+  vtkSetClampMacro(HoleFillingMode,int,VTK_FREEHAND_HOLE_FILL_AVERAGE,
+                   VTK_FREEHAND_HOLE_FILL_GAUSSIAN);
+  vtkGetMacro(HoleFillingMode,int);
+  void SetHoleFillingModeToAverage()
+    { this->SetHoleFillingMode(VTK_FREEHAND_HOLE_FILL_AVERAGE); };
+  void SetHoleFillingModeToDistanceWeighted()
+    { this->SetHoleFillingMode(VTK_FREEHAND_HOLE_FILL_DISTANCE_WEIGHTED); };
+  void SetHoleFillingModeToGrowing()
+    { this->SetHoleFillingMode(VTK_FREEHAND_HOLE_FILL_GROWING); };
+  void SetHoleFillingModeToGaussian()
+    { this->SetHoleFillingMode(VTK_FREEHAND_HOLE_FILL_GAUSSIAN); };
+  char *GetHoleFillingModeAsString();
+
+  // Description:
+  // The half-width of the hole filling kernel, in voxels.  Default: 1.
+  vtkSetClampMacro(HoleFillingRadius,int,1,4);
+  vtkGetMacro(HoleFillingRadius,int);
+
+  // Description:
+  // The standard deviation of the Gaussian kernel, in voxels. Default: 1.
+  vtkSetMacro(HoleFillingSigma,double);
+  vtkGetMacro(HoleFillingSigma,double);
+
+  // Description:
+  // The maximum number of passes for the Growing kernel.  Gaps that are
+  // wider than twice this many voxels will not be completely filled.
+  // Default: 8.
+  vtkSetClampMacro(HoleFillingMaxPasses,int,1,VTK_LARGE_INTEGER);
+  vtkGetMacro(HoleFillingMaxPasses,int);
+
+  // Description:
+  // The minimum number of filled voxels within the kernel that are
+  // needed before a frontier voxel is filled.  Raise this to stop the
+  // Growing kernel from spreading beyond the edges of a sweep. Default: 1.
+  vtkSetClampMacro(HoleFillingMinNeighbors,int,1,VTK_LARGE_INTEGER);
+  vtkGetMacro(HoleFillingMinNeighbors,int);
+
+  // Description:
+  // The number of threads to use for the frontier hole filling kernels.
+  // Default: the number of processors.
+  vtkSetClampMacro(HoleFillingNumberOfThreads,int,1,VTK_MAX_THREADS);
+  vtkGetMacro(HoleFillingNumberOfThreads,int);
+
   // Description:
   // Save the raw data in the (relative!) directory specified.  The directory will
   // be created if it doesn't exist, and the following files will be
@@ -152,6 +366,31 @@ public:
   // following reconstructions.
   void ReadRawData(const char *directory);
 
+  // Description:
+  // Save n frames, the tracking information and the fan/clip parameters
+  // in a single sweep file (see vtkUltrasoundSweepFile).  This is much
+  // faster than SaveRawData(), since the frames are compressed and written
+  // by a background thread instead of being written as PNG files.
+  // You should first use 'Seek' on the VideoSource to rewind it.
+  void SaveSweep(const char *filename, int n);
+
+  // Description:
+  // Read the tracking information and fan/clip parameters from a sweep
+  // file.  The file stays open, and ReconstructBatch() will take its
+  // frames from the file instead of from the VideoSource.
+  void ReadSweep(const char *filename);
+
+  // Description:
+  // Record all frames that are inserted by the real-time reconstruction
+  // into a sweep file.  The tracking information is written when the
+  // recording is stopped.
+  void StartSweepRecording(const char *filename);
+  void StopSweepRecording();
+
+  // Description:
+  // Get the sweep file that was opened by ReadSweep().
+  vtkGetObjectMacro(SweepFile, vtkUltrasoundSweepFile);
+
   // Description:
   // Set the time by which the video lags behind the tracking information,
   // in seconds.  This value may be negative.  Default: 0.
@@ -228,12 +467,15 @@ public:
   vtkGetMacro(FanDepthCm,int);
   //virtual void SetDepthClipData(vtkImageClip *);
   //vtkGetObjectMacro(DepthClipData, vtkImageClip);
-  virtual void SetRotationClipData(vtkImageClip *);
-  vtkGetObjectMacro(RotationClipData, vtkImageClip);
   //virtual void SetDepthThreshold(vtkImageThreshold *);
   //vtkGetObjectMacro(DepthThreshold, vtkImageThreshold);
-  virtual void SetRotationThreshold(vtkImageThreshold *);
-  vtkGetObjectMacro(RotationThreshold, vtkImageThreshold);
+
+  // Description:
+  // The decoder that reads the fan rotation from the video overlay.  If
+  // it is not set, StartRealTimeReconstruction() sets one up for the
+  // adult TEE probe.
+  virtual void SetRotationDecoder(vtkUltrasoundAnnotationDecoder *);
+  vtkGetObjectMacro(RotationDecoder, vtkUltrasoundAnnotationDecoder);
   //vtkSetMacro(FanFlipThreshold1,int);
   //vtkGetMacro(FanFlipThreshold1,int);
   //vtkSetMacro(FanFlipThreshold2,int);
@@ -246,11 +488,8 @@ public:
   vtkGetObjectMacro(FlipTransform, vtkTransform);
 
   // added by Danielle
-  int CalculateFanRotationValue(vtkImageThreshold *);
+  int CalculateFanRotationValue(vtkImageData *);
  // int CalculateFanDepthCmValue(vtkImageThreshold *);
-//BTX
-  int GetFanRepresentation (vtkImageThreshold *, int[12]);
-//ETX
   //int CheckIfUpsideDown(vtkImageThreshold *);
 
 
@@ -282,6 +521,29 @@ public:
   //vtkBooleanMacro(Compounding,int);
   void SetCompounding(int);
 
+  // Description:
+  // Set how overlapping scans are combined when Compounding is on.
+  // Mean keeps a running average, Max keeps the brightest sample,
+  // Latest keeps the newest sample, DistanceWeighted is a running
+  // average that favours samples that land close to the voxel center,
+  // and Median keeps a small reservoir of VTK_FREEHAND_MEDIAN_RESERVOIR
+  // samples per voxel and outputs their median.  The default is Mean.
+  // Changing the mode requires the output to be cleared.
+  vtkSetClampMacro(CompoundingMode,int,VTK_FREEHAND_COMPOUND_MEAN,
+                   VTK_FREEHAND_COMPOUND_MEDIAN);
+  vtkGetMacro(CompoundingMode,int);
+  void SetCompoundingModeToMean()
+    { this->SetCompoundingMode(VTK_FREEHAND_COMPOUND_MEAN); };
+  void SetCompoundingModeToMax()
+    { this->SetCompoundingMode(VTK_FREEHAND_COMPOUND_MAX); };
+  void SetCompoundingModeToLatest()
+    { this->SetCompoundingMode(VTK_FREEHAND_COMPOUND_LATEST); };
+  void SetCompoundingModeToDistanceWeighted()
+    { this->SetCompoundingMode(VTK_FREEHAND_COMPOUND_DISTANCE_WEIGHTED); };
+  void SetCompoundingModeToMedian()
+    { this->SetCompoundingMode(VTK_FREEHAND_COMPOUND_MEDIAN); };
+  char *GetCompoundingModeAsString();
+
   // Description:
   // Spacing, origin, and extent of output data
   // You MUST set this information.
@@ -334,14 +596,56 @@ public:
   int RealTimeReconstruction;
   int ReconstructionFrameCount;
   vtkTrackerBuffer *TrackerBuffer;
+  int DroppedFrameCount;
+  int MergedFrameCount;
+  double FrameLatency;
+  vtkImageData *WaitingFrame;
 //ETX
-  int PixelCount[4];
+  int PixelCount[VTK_MAX_THREADS];
   int GetPixelCount();
   void SetPixelCount(int threadId, int val);
   void IncrementPixelCount(int threadId, int increment);
 
   int GetReconstructionThreadId(){ return this->ReconstructionThreadId; };
 
+  // Description:
+  // Find the fan rotation of a TEE probe from the slice (requires the
+  // RotationDecoder) and use it to set the SliceTransform.  Called by
+  // the reconstruction for each frame.
+  void UpdateFanRotation(vtkImageData *inData, vtkMatrix4x4 *sliceAxes);
+
+  // Description:
+  // Add a frame to the sweep that is being recorded, if any.  Called by
+  // the reconstruction thread.
+  void RecordSweepFrame(vtkImageData *frame, double timestamp);
+
+  // Description:
+  // Insert a frame into the preview, and queue or defer it for the
+  // full-resolution output.  Called by the reconstruction thread when
+  // Preview is on.
+  void InsertPreviewSlice(vtkImageData *inData);
+
+  // Description:
+  // Insert the frames that are waiting in the full-resolution queue.
+  // Called by the background insertion thread, returns zero once the
+  // queue is empty.
+  int InsertQueuedSlices();
+
+  // Description:
+  // Check whether the Adaptive FramePolicy merges the slice into the
+  // previously inserted slice.  The SliceAxes and SliceTransform must
+  // already be set for the slice.  Returns 1 if the slice should not be
+  // inserted.  The slice is not recorded as the previously inserted
+  // slice until it has been inserted.  Called by the reconstruction thread.
+  int MergeSlice(vtkImageData *inData);
+
+  // Description:
+  // Insert a frame that was taken from the VideoSource buffer after it
+  // had been passed over, i.e. a frame other than the slice.  The
+  // SliceAxes and SliceTransform must already be set for the frame.
+  // Called by the reconstruction thread.
+  void InsertWaitingSlice(vtkImageData *frame);
+
 protected:
   vtkFreehandUltrasound2();
   ~vtkFreehandUltrasound2();
@@ -359,9 +663,8 @@ protected:
   int FanRotationYShift;
   int FanDepthCm;
   //vtkImageClip *DepthClipData;
-  vtkImageClip *RotationClipData;
   //vtkImageThreshold* DepthThreshold;
-  vtkImageThreshold* RotationThreshold;
+  vtkUltrasoundAnnotationDecoder *RotationDecoder;
   //int FanFlipThreshold1;
   //int FanFlipThreshold2;
   //vtkImageThreshold* FlipThreshold;
@@ -375,6 +678,7 @@ protected:
   int InterpolationMode;
   int Optimization;
   int Compounding;
+  int CompoundingMode;
   vtkFloatingPointType OutputOrigin[3];
   vtkFloatingPointType OutputSpacing[3];
   int OutputExtent[6];
@@ -391,6 +695,39 @@ protected:
   double FanDepth;
   int NumberOfPixelsFromTipOfFanToBottomOfScreen;
 
+  int HoleFillingMode;
+  int HoleFillingRadius;
+  double HoleFillingSigma;
+  int HoleFillingMaxPasses;
+  int HoleFillingMinNeighbors;
+  int HoleFillingNumberOfThreads;
+
+  int BatchNumberOfThreads;
+  int BatchSize;
+
+  int Preview;
+  int PreviewShrinkFactor;
+  vtkImageData *PreviewOutput;
+  vtkImageData *PreviewAccumulationBuffer;
+  int FramePolicy;
+  double MaximumLatency;
+  double MinimumSliceSeparation;
+
+  int FullResolutionMode;
+  int FullResolutionQueueLength;
+  int FullResolutionDroppedFrames;
+  int DeferredFrameCount;
+  int DeferredFirstFrame;
+  int FullResolutionThreadId;
+  vtkFreehand2FrameQueue *FullResolutionQueue;
+  vtkCriticalSection *FullResolutionLock;
+  vtkCriticalSection *FullResolutionInsertLock;
+
+  vtkUltrasoundSweepFile *SweepFile;
+  vtkImageData *SweepFrame;
+  vtkUltrasoundSweepFile *SweepRecorder;
+  vtkCriticalSection *SweepLock;
+
   vtkMatrix4x4 *IndexMatrix;
   vtkMatrix4x4 *LastIndexMatrix;
 
@@ -411,10 +748,15 @@ protected:
 
   void MultiThread(vtkImageData *inData, vtkImageData *outData);
   void MultiThreadFill(vtkImageData *outData);
+  void FrontierFill(vtkImageData *outData);
   double CalculateMaxSliceSeparation(vtkMatrix4x4 *m1, vtkMatrix4x4 *m2);
   vtkMatrix4x4 *GetIndexMatrix();
+  vtkMatrix4x4 *GetIndexMatrix(vtkImageData *inData);
+  void SetSweepParameters(vtkUltrasoundSweepFile *file);
   void OptimizedInsertSlice();
   void InternalClearOutput();
+  void InternalClearPreview();
+  void GetPreviewExtent(int extent[6]);
   void InternalExecuteInformation();
 
   // Remove these methods (they are VTK 4)
@@ -468,6 +810,60 @@ inline char *vtkFreehandUltrasound2::GetInterpolationModeAsString()
     }
 }  
 
+//----------------------------------------------------------------------------
+inline char *vtkFreehandUltrasound2::GetCompoundingModeAsString()
+{
+  switch (this->CompoundingMode)
+    {
+    case VTK_FREEHAND_COMPOUND_MEAN:
+      return "Mean";
+    case VTK_FREEHAND_COMPOUND_MAX:
+      return "Max";
+    case VTK_FREEHAND_COMPOUND_LATEST:
+      return "Latest";
+    case VTK_FREEHAND_COMPOUND_DISTANCE_WEIGHTED:
+      return "DistanceWeighted";
+    case VTK_FREEHAND_COMPOUND_MEDIAN:
+      return "Median";
+    default:
+      return "";
+    }
+}
+
+//----------------------------------------------------------------------------
+inline char *vtkFreehandUltrasound2::GetFramePolicyAsString()
+{
+  switch (this->FramePolicy)
+    {
+    case VTK_FREEHAND_FRAME_POLICY_QUEUE:
+      return "Queue";
+    case VTK_FREEHAND_FRAME_POLICY_NEWEST:
+      return "Newest";
+    case VTK_FREEHAND_FRAME_POLICY_ADAPTIVE:
+      return "Adaptive";
+    default:
+      return "";
+    }
+}
+
+//----------------------------------------------------------------------------
+inline char *vtkFreehandUltrasound2::GetHoleFillingModeAsString()
+{
+  switch (this->HoleFillingMode)
+    {
+    case VTK_FREEHAND_HOLE_FILL_AVERAGE:
+      return "Average";
+    case VTK_FREEHAND_HOLE_FILL_DISTANCE_WEIGHTED:
+      return "DistanceWeighted";
+    case VTK_FREEHAND_HOLE_FILL_GROWING:
+      return "Growing";
+    case VTK_FREEHAND_HOLE_FILL_GAUSSIAN:
+      return "Gaussian";
+    default:
+      return "";
+    }
+}
+
 #endif
 
 
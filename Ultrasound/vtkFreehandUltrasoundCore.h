@@ -0,0 +1,1960 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkFreehandUltrasoundCore.h,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+// .NAME vtkFreehandUltrasoundCore - shared reconstruction kernels
+// .SECTION Description
+// This is an internal header for vtkFreehandUltrasound and
+// vtkFreehandUltrasound2, it is not wrapped and should not be included
+// by applications.  It holds the one copy of the reconstruction kernels
+// that both classes use: the rounding functions, the compounding policies,
+// the nearest-neighbor and trilinear insertion functions, the raster line
+// clipping for the optimized code, the row and slice insertion functions,
+// the hole filling, and the thread helpers.
+//
+// The kernels are templates over the scalar type T, the interpolation
+// mode I (VTK_FREEHAND_NEAREST or VTK_FREEHAND_LINEAR), the compounding
+// policy C (vtkFreehandCompoundMean etc.), the math precision F (double
+// or fixed) and the accumulation buffer type A, so that every combination
+// is compiled into its own tight loop and the modes are chosen once per
+// slice rather than once per voxel.
+// .SECTION see also
+// vtkFreehandUltrasound vtkFreehandUltrasound2
+
+#ifndef __vtkFreehandUltrasoundCore_h
+#define __vtkFreehandUltrasoundCore_h
+
+#include "vtkMatrix4x4.h"
+#include "vtkImageData.h"
+#include "vtkMultiThreader.h"
+#include "vtkTimerLog.h"
+#include "vtkUltrasoundFanMask.h"
+#include "fixed.h"
+#include <math.h>
+#include <stddef.h>
+#include <string.h>
+
+#ifndef VTK_FREEHAND_NEAREST
+#define VTK_FREEHAND_NEAREST 0
+#define VTK_FREEHAND_LINEAR 1
+#endif
+
+#ifndef VTK_FREEHAND_COMPOUND_MEAN
+#define VTK_FREEHAND_COMPOUND_MEAN 0
+#define VTK_FREEHAND_COMPOUND_MAX 1
+#define VTK_FREEHAND_COMPOUND_LATEST 2
+#define VTK_FREEHAND_COMPOUND_DISTANCE_WEIGHTED 3
+#define VTK_FREEHAND_COMPOUND_MEDIAN 4
+#endif
+
+#ifndef VTK_FREEHAND_MEDIAN_RESERVOIR
+#define VTK_FREEHAND_MEDIAN_RESERVOIR 5
+#endif
+
+//----------------------------------------------------------------------------
+// rounding functions, split and optimized for each type
+// (because we don't want to round if the result is a float!)
+
+// in the case of a tie between integers, the larger integer wins.
+
+// The 'floor' function on x86 and mips is many times slower than these
+// and is used a lot in this code, optimize for different CPU architectures
+// static inline int vtkUltraFloor(double x)
+// {
+// #if defined mips || defined sparc
+//   return (int)((unsigned int)(x + 2147483648.0) - 2147483648U);
+// #elif defined i386
+//   double tempval = (x - 0.25) + 3377699720527872.0; // (2**51)*1.5
+//   return ((int*)&tempval)[0] >> 1;
+// #else
+//   return int(floor(x));
+// #endif
+// }
+
+static inline int vtkUltraFloor(double x)
+{
+#if defined mips || defined sparc || defined __ppc__
+  x += 2147483648.0;
+  unsigned int i = (unsigned int)(x);
+  return (int)(i - 2147483648U);
+#elif defined i386 || defined _M_IX86
+  union { double d; unsigned short s[4]; unsigned int i[2]; } dual;
+  dual.d = x + 103079215104.0;  // (2**(52-16))*1.5
+  return (int)((dual.i[1]<<16)|((dual.i[0])>>16));
+#elif defined ia64 || defined __ia64__ || defined IA64
+  x += 103079215104.0;
+  long long i = (long long)(x);
+  return (int)(i - 103079215104LL);
+#else
+  double y = floor(x);
+  return (int)(y);
+#endif
+}
+
+static inline int vtkUltraCeil(double x)
+{
+  return -vtkUltraFloor(-x - 1.0) - 1;
+}
+
+static inline int vtkUltraRound(double x)
+{
+  return vtkUltraFloor(x + 0.5);
+}
+
+static inline int vtkUltraFloor(float x)
+{
+  return vtkUltraFloor((double)x);
+}
+
+static inline int vtkUltraCeil(float x)
+{
+  return vtkUltraCeil((double)x);
+}
+
+static inline int vtkUltraRound(float x)
+{
+  return vtkUltraRound((double)x);
+}
+
+static inline int vtkUltraFloor(fixed x)
+{
+  return x.floor();
+}
+
+static inline int vtkUltraCeil(fixed x)
+{
+  return x.ceil();
+}
+
+static inline int vtkUltraRound(fixed x)
+{
+  return x.round();
+}
+
+
+// convert a float into an integer plus a fraction
+template <class F>
+static inline int vtkUltraFloor(F x, F &f)
+{
+  int ix = vtkUltraFloor(x);
+  f = x - ix;
+
+  return ix;
+}
+
+template <class F, class T>
+static inline void vtkUltraRound(F val, T& rnd)
+{
+  rnd = vtkUltraRound(val);
+}
+
+//----------------------------------------------------------------------------
+// Compounding policies
+// Each policy combines a new sample 'inPtr' with the output voxel at
+// 'outPtr', whose accumulated weight is at 'accPtr' and (for the median)
+// whose sample reservoir is at 'resPtr'.  'w' is the weight of the new
+// sample, as returned by Weight() and scaled by the interpolation kernel.
+// The insertion functions are instantiated once per policy, so the
+// compounding mode is chosen once per slice instead of once per voxel.
+// The accumulation buffer is float, except for the saturated mean.
+//----------------------------------------------------------------------------
+
+// defaults: unit weight, and no reservoir
+struct vtkFreehandCompoundBase
+{
+  enum { UsesDistance = 0 };
+
+  static inline float Weight(double)
+    {
+    return 1.0f;
+    }
+
+  template <class T>
+  static inline T *Reservoir(T *, int, int)
+    {
+    return 0;
+    }
+};
+
+// running weighted average
+struct vtkFreehandCompoundMean : public vtkFreehandCompoundBase
+{
+  template <class T>
+  static inline void Insert(T *inPtr, T *outPtr, float *accPtr, T *,
+                            int numscalars, float w)
+    {
+    float a = *accPtr;
+    float f = 1.0f/(a + w);
+    for (int i = 0; i < numscalars; i++)
+      {
+      vtkUltraRound((w*inPtr[i] + a*outPtr[i])*f, outPtr[i]);
+      }
+    outPtr[numscalars] = 255;
+    *accPtr = a + w;
+    }
+};
+
+// keep the brightest sample
+struct vtkFreehandCompoundMax : public vtkFreehandCompoundBase
+{
+  template <class T>
+  static inline void Insert(T *inPtr, T *outPtr, float *accPtr, T *,
+                            int numscalars, float w)
+    {
+    int first = (*accPtr == 0);
+    for (int i = 0; i < numscalars; i++)
+      {
+      if (first || inPtr[i] > outPtr[i])
+        {
+        outPtr[i] = inPtr[i];
+        }
+      }
+    outPtr[numscalars] = 255;
+    *accPtr += w;
+    }
+};
+
+// the newest sample replaces whatever was there
+struct vtkFreehandCompoundLatest : public vtkFreehandCompoundBase
+{
+  template <class T>
+  static inline void Insert(T *inPtr, T *outPtr, float *accPtr, T *,
+                            int numscalars, float w)
+    {
+    for (int i = 0; i < numscalars; i++)
+      {
+      outPtr[i] = inPtr[i];
+      }
+    outPtr[numscalars] = 255;
+    *accPtr += w;
+    }
+};
+
+// running average weighted by the inverse squared distance 'd2' (in
+// voxels) between the sample and the voxel center
+struct vtkFreehandCompoundDistanceWeighted : public vtkFreehandCompoundBase
+{
+  enum { UsesDistance = 1 };
+
+  static inline float Weight(double d2)
+    {
+    return (float)(1.0/(d2 + 0.0625));
+    }
+
+  template <class T>
+  static inline void Insert(T *inPtr, T *outPtr, float *accPtr, T *resPtr,
+                            int numscalars, float w)
+    {
+    vtkFreehandCompoundMean::Insert(inPtr, outPtr, accPtr, resPtr,
+                                    numscalars, w);
+    }
+};
+
+// running average with an unsigned short accumulation buffer that holds
+// the weight times 255 and saturates at 65535, as vtkFreehandUltrasound
+// has always done: once a voxel has had 257 unit-weight hits, each new hit
+// counts for less than its share
+struct vtkFreehandCompoundSaturatedMean : public vtkFreehandCompoundBase
+{
+  template <class T>
+  static inline void Insert(T *inPtr, T *outPtr, unsigned short *accPtr,
+                            T *, int numscalars, float w)
+    {
+    int i;
+    if (w == 1.0f)
+      {
+      // nearest neighbor: integer weights, truncate the mean (the
+      // products can exceed the range of an int, so use double)
+      double a = *accPtr;
+      int newa = *accPtr + 255;
+      for (i = 0; i < numscalars; i++)
+        {
+        outPtr[i] = (T)((inPtr[i]*255.0 + outPtr[i]*a)/newa);
+        }
+      outPtr[numscalars] = 255;
+      *accPtr = (unsigned short)(newa < 65535 ? newa : 65535);
+      }
+    else
+      {
+      float r = (*accPtr)/255.0f;
+      float a = w + r;
+      for (i = 0; i < numscalars; i++)
+        {
+        vtkUltraRound((w*inPtr[i] + r*outPtr[i])/a, outPtr[i]);
+        }
+      outPtr[numscalars] = 255;
+      // don't allow accumulation buffer overflow
+      *accPtr = 65535;
+      a *= 255;
+      if (a < 65535.0f)
+        {
+        vtkUltraRound(a, *accPtr);
+        }
+      }
+    }
+};
+
+// median of a reservoir sample of the values that hit the voxel, the
+// accumulation buffer holds the number of samples seen so far
+struct vtkFreehandCompoundMedian : public vtkFreehandCompoundBase
+{
+  template <class T>
+  static inline T *Reservoir(T *resPtr, int idx, int numscalars)
+    {
+    return resPtr + idx*VTK_FREEHAND_MEDIAN_RESERVOIR*numscalars;
+    }
+
+  // write the per-component median of the first 'n' reservoir samples
+  template <class T>
+  static inline void Median(T *resPtr, int n, int numscalars, T *outPtr)
+    {
+    T s[VTK_FREEHAND_MEDIAN_RESERVOIR];
+    for (int i = 0; i < numscalars; i++)
+      {
+      // insertion sort, n is tiny
+      for (int j = 0; j < n; j++)
+        {
+        T v = resPtr[j*numscalars + i];
+        int k = j;
+        for (; k > 0 && s[k-1] > v; k--)
+          {
+          s[k] = s[k-1];
+          }
+        s[k] = v;
+        }
+      outPtr[i] = s[n/2];
+      }
+    outPtr[numscalars] = 255;
+    }
+
+  template <class T>
+  static inline void Insert(T *inPtr, T *outPtr, float *accPtr, T *resPtr,
+                            int numscalars, float)
+    {
+    const unsigned int r = VTK_FREEHAND_MEDIAN_RESERVOIR;
+    unsigned int n = (unsigned int)(*accPtr);
+    *accPtr = (float)(n + 1);
+    unsigned int slot = n;
+    if (n >= r)
+      {
+      // reservoir sampling: the new sample replaces a stored sample with
+      // probability r/(n+1), using a cheap hash of the count and voxel
+      // since vtkMath::Random() is not thread safe
+      unsigned int h = (n*2654435761u) ^ (unsigned int)(size_t)(resPtr);
+      h ^= h >> 15;
+      h *= 2246822519u;
+      h ^= h >> 13;
+      slot = h % (n + 1);
+      if (slot >= r)
+        {
+        return;
+        }
+      }
+    for (int i = 0; i < numscalars; i++)
+      {
+      resPtr[slot*numscalars + i] = inPtr[i];
+      }
+    vtkFreehandCompoundMedian::Median(resPtr, (n < r ? n + 1 : r),
+                                      numscalars, outPtr);
+    }
+};
+
+//----------------------------------------------------------------------------
+// vtkNearestNeighborInterpolation
+// Do nearest-neighbor interpolation of the input data 'inPtr' of extent 
+// 'inExt' at the 'point'.  The result is placed at 'outPtr'.  
+// If the lookup data is beyond the extent 'inExt', set 'outPtr' to
+// the background color 'background'.  
+// The number of scalar components in the data is 'numscalars'
+// If compounding, the sample is combined with the voxel according to the
+// compounding policy 'C'
+//----------------------------------------------------------------------------
+template <class C, class F, class T, class A>
+static int vtkNearestNeighborInterpolation(F *point, T *inPtr, T *outPtr,
+                                           A *accPtr, T *resPtr,
+                                           int numscalars, 
+                                           int outExt[6], int outInc[3])
+{
+  int i;
+  int outIdX = vtkUltraRound(point[0])-outExt[0];
+  int outIdY = vtkUltraRound(point[1])-outExt[2];
+  int outIdZ = vtkUltraRound(point[2])-outExt[4];
+  
+  // fancy way of checking bounds
+  if ((outIdX | (outExt[1]-outExt[0] - outIdX) |
+       outIdY | (outExt[3]-outExt[2] - outIdY) |
+       outIdZ | (outExt[5]-outExt[4] - outIdZ)) >= 0)
+    {
+    int inc = outIdX*outInc[0]+outIdY*outInc[1]+outIdZ*outInc[2];
+    outPtr += inc;
+    if (accPtr)
+      {
+      // accumulation buffer: do compounding
+      int idx = inc/outInc[0];
+      double d2 = 0;
+      if (C::UsesDistance)
+        {
+        double dx = point[0] - (outIdX + outExt[0]);
+        double dy = point[1] - (outIdY + outExt[2]);
+        double dz = point[2] - (outIdZ + outExt[4]);
+        d2 = dx*dx + dy*dy + dz*dz;
+        }
+      C::Insert(inPtr, outPtr, accPtr + idx,
+                C::Reservoir(resPtr, idx, numscalars),
+                numscalars, C::Weight(d2));
+      }
+    else
+      {
+      // no accumulation buffer, replace what was there before
+      for (i = 0; i < numscalars; i++)
+        {
+        *outPtr++ = *inPtr++;
+        }
+      *outPtr = 255;
+      }
+    return 1;
+    }
+  return 0;
+} 
+
+//----------------------------------------------------------------------------
+// vtkTrilinearInterpolation
+// Do trilinear interpolation of the input data 'inPtr' of extent 'inExt'
+// at the 'point'.  The result is placed at 'outPtr'.  
+// If the lookup data is beyond the extent 'inExt', set 'outPtr' to
+// the background color 'background'.  
+// The number of scalar components in the data is 'numscalars'
+//----------------------------------------------------------------------------
+template <class C, class F, class T, class A>
+static int vtkTrilinearInterpolation(F *point, T *inPtr, T *outPtr,
+                                     A *accPtr, T *resPtr, int numscalars, 
+                                     int outExt[6], int outInc[3])
+{
+  F fx, fy, fz;
+
+  int outIdX0 = vtkUltraFloor(point[0], fx);  // covert point[0] into integer component and a fraction
+  int outIdY0 = vtkUltraFloor(point[1], fy);	// point[0] is unchanged, outIdX0 is the integer (floor), fx is the float
+  int outIdZ0 = vtkUltraFloor(point[2], fz);
+
+  int outIdX1 = outIdX0 + (fx != 0); // ceiling
+  int outIdY1 = outIdY0 + (fy != 0);
+  int outIdZ1 = outIdZ0 + (fz != 0);
+
+  // at this point in time we have the floor (outIdX0), the ceiling (outIdX1) and the fractional component (fx) for
+  // x, y and z
+  
+  // bounds check (remember | is bitwise OR)
+  if ((outIdX0 | (outExt[1]-outExt[0] - outIdX1) |
+       outIdY0 | (outExt[3]-outExt[2] - outIdY1) |
+       outIdZ0 | (outExt[5]-outExt[4] - outIdZ1)) >= 0)
+    {// do reverse trilinear interpolation
+		// trilinear interpolation would use the pixel values to interpolate something in the middle
+		// we have the something in the middle and want to spread it to the discrete pixel values around it, in an
+		// interpolated way
+    int factX0 = outIdX0*outInc[0];
+    int factY0 = outIdY0*outInc[1];
+    int factZ0 = outIdZ0*outInc[2];
+    int factX1 = outIdX1*outInc[0];
+    int factY1 = outIdY1*outInc[1];
+    int factZ1 = outIdZ1*outInc[2];
+
+    int factY0Z0 = factY0 + factZ0;
+    int factY0Z1 = factY0 + factZ1;
+    int factY1Z0 = factY1 + factZ0;
+    int factY1Z1 = factY1 + factZ1;
+
+    int idx[8];// increment between the output pointer and the 8 pixels to work on
+    idx[0] = factX0 + factY0Z0;
+    idx[1] = factX0 + factY0Z1;
+    idx[2] = factX0 + factY1Z0;
+    idx[3] = factX0 + factY1Z1;
+    idx[4] = factX1 + factY0Z0;
+    idx[5] = factX1 + factY0Z1;
+    idx[6] = factX1 + factY1Z0;
+    idx[7] = factX1 + factY1Z1;
+
+    F rx = 1 - fx; // remainders from the fractional components - difference between the fractional value and the ceiling
+    F ry = 1 - fy;
+    F rz = 1 - fz;
+      
+    F ryrz = ry*rz;
+    F ryfz = ry*fz;
+    F fyrz = fy*rz;
+    F fyfz = fy*fz;
+
+    F fdx[8];
+    fdx[0] = rx*ryrz;
+    fdx[1] = rx*ryfz;
+    fdx[2] = rx*fyrz;
+    fdx[3] = rx*fyfz;
+    fdx[4] = fx*ryrz;
+    fdx[5] = fx*ryfz;
+    fdx[6] = fx*fyrz;
+    fdx[7] = fx*fyfz;
+    
+    F f;
+
+
+
+    T *inPtrTmp, *outPtrTmp;
+    if (accPtr)
+      {
+      //------------------------------------
+      // accumulation buffer: do compounding
+
+      // squared distances from the point to the eight voxels
+      double d2[8];
+      if (C::UsesDistance)
+        {
+        double dx0 = fx, dy0 = fy, dz0 = fz;
+        double dx1 = 1 - dx0, dy1 = 1 - dy0, dz1 = 1 - dz0;
+        dx0 *= dx0; dy0 *= dy0; dz0 *= dz0;
+        dx1 *= dx1; dy1 *= dy1; dz1 *= dz1;
+        d2[0] = dx0 + dy0 + dz0;
+        d2[1] = dx0 + dy0 + dz1;
+        d2[2] = dx0 + dy1 + dz0;
+        d2[3] = dx0 + dy1 + dz1;
+        d2[4] = dx1 + dy0 + dz0;
+        d2[5] = dx1 + dy0 + dz1;
+        d2[6] = dx1 + dy1 + dz0;
+        d2[7] = dx1 + dy1 + dz1;
+        }
+
+      // loop over the eight voxels
+      int j = 8;
+      do 
+        {
+        j--;
+        if (fdx[j] == 0)
+          {
+          continue;
+          }
+        // the accumulation buffer has one component per voxel
+        int accIdx = idx[j]/outInc[0];
+        C::Insert(inPtr, outPtr + idx[j], accPtr + accIdx,
+                  C::Reservoir(resPtr, accIdx, numscalars), numscalars,
+                  (float)(fdx[j])*C::Weight(C::UsesDistance ? d2[j] : 0));
+        }
+      while (j);
+      }
+    else 
+      {
+      //------------------------------------
+      // no accumulation buffer
+      // loop over the eight voxels
+      int j = 8;
+      do
+        {
+        j--;
+        if (fdx[j] == 0)
+          {
+          continue;
+          }
+        inPtrTmp = inPtr;
+        outPtrTmp = outPtr+idx[j];
+        // if alpha is nonzero then the pixel was hit before, so
+        //  average with previous value
+        if (outPtrTmp[numscalars])
+          {
+          f = fdx[j];
+          F r = 1 - f;
+          int i = numscalars;
+          do
+            {
+            i--;
+            vtkUltraRound(f*(*inPtrTmp++) + r*(*outPtrTmp),
+                            *outPtrTmp);
+            outPtrTmp++;
+            }
+          while (i);
+          }
+        // alpha is zero, so just insert the new value
+        else
+          {
+          int i = numscalars;
+          do
+            {
+            i--;
+            *outPtrTmp++ = *inPtrTmp++;
+            }
+          while (i);
+          }          
+        *outPtrTmp = 255;
+        }
+      while (j);
+      }
+    return 1;
+    }
+  // if bounds check fails
+  return 0;
+}                          
+
+//----------------------------------------------------------------------------
+// vtkFreehandGetInterpFunc
+// Sets interpolate (pointer to a function) to match the interpolation
+// mode, instantiated for the compounding policy C
+//----------------------------------------------------------------------------
+template <class C, class F, class T, class A>
+static void vtkFreehandGetInterpFunc(int interpolationMode,
+                                     int (**interpolate)(F *point, 
+                                                         T *inPtr, T *outPtr,
+                                                         A *accPtr,
+                                                         T *resPtr,
+                                                         int numscalars, 
+                                                         int outExt[6], 
+                                                         int outInc[3]))
+{
+  switch (interpolationMode)
+    {
+    case VTK_FREEHAND_NEAREST:
+      *interpolate = &vtkNearestNeighborInterpolation<C,F,T,A>;
+      break;
+    case VTK_FREEHAND_LINEAR:
+      *interpolate = &vtkTrilinearInterpolation<C,F,T,A>;
+      break;
+    }
+}
+
+// Sets interpolate to match the interpolation and compounding modes,
+// median compounding needs a reservoir and falls back to the mean without one
+template <class F, class T, class A>
+static void vtkFreehandGetInterpFunc(int interpolationMode,
+                                     int compoundingMode, T *resPtr,
+                                     int (**interpolate)(F *point, 
+                                                         T *inPtr, T *outPtr,
+                                                         A *accPtr,
+                                                         T *resPtr,
+                                                         int numscalars, 
+                                                         int outExt[6], 
+                                                         int outInc[3]))
+{
+  switch (compoundingMode)
+    {
+    case VTK_FREEHAND_COMPOUND_MAX:
+      vtkFreehandGetInterpFunc<vtkFreehandCompoundMax>(interpolationMode,
+                                                       interpolate);
+      break;
+    case VTK_FREEHAND_COMPOUND_LATEST:
+      vtkFreehandGetInterpFunc<vtkFreehandCompoundLatest>(interpolationMode,
+                                                          interpolate);
+      break;
+    case VTK_FREEHAND_COMPOUND_DISTANCE_WEIGHTED:
+      vtkFreehandGetInterpFunc<vtkFreehandCompoundDistanceWeighted>(
+        interpolationMode, interpolate);
+      break;
+    case VTK_FREEHAND_COMPOUND_MEDIAN:
+      if (resPtr)
+        {
+        vtkFreehandGetInterpFunc<vtkFreehandCompoundMedian>(
+          interpolationMode, interpolate);
+        break;
+        }
+    default:
+      vtkFreehandGetInterpFunc<vtkFreehandCompoundMean>(interpolationMode,
+                                                        interpolate);
+      break;
+    }
+}
+
+
+//----------------------------------------------------------------------------
+// vtkIsIdentityMatrix
+// check a matrix to see whether it is the identity matrix
+//----------------------------------------------------------------------------
+static inline int vtkIsIdentityMatrix(vtkMatrix4x4 *matrix)
+{
+  static double identity[16] = {1,0,0,0, 0,1,0,0, 0,0,1,0, 0,0,0,1};
+  int i,j;
+
+  for (i = 0; i < 4; i++)
+    {
+    for (j = 0; j < 4; j++)
+      {
+      if (matrix->GetElement(i,j) != identity[4*i+j])
+        {
+        return 0;
+        }
+      }
+    }
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// The remainder of this file is used by the 'optimized' insertion code.
+//----------------------------------------------------------------------------
+
+//----------------------------------------------------------------------------
+// helper functions for vtkOptimizedExecute()
+
+// find approximate intersection of line with the plane x = x_min,
+// y = y_min, or z = z_min (lower limit of data extent) 
+
+template<class F>
+static inline
+int intersectionHelper(F *point, F *axis, int *limit, int ai, int *inExt)
+{
+  F rd = limit[ai]*point[3]-point[ai]  + 0.5; 
+    
+  if (rd < inExt[0])
+    { 
+    return inExt[0];
+    }
+  else if (rd > inExt[1])
+    {
+    return inExt[1];
+    }
+  else
+    {
+    return int(rd);
+    }
+}
+
+template <class F>
+static int intersectionLow(F *point, F *axis, int *sign,
+                           int *limit, int ai, int *inExt)
+{
+  // approximate value of r
+  int r = intersectionHelper(point,axis,limit,ai,inExt);
+
+  // move back and forth to find the point just inside the extent
+  for (;;)
+    {
+    F p = point[ai]+r*axis[ai];
+
+    if ((sign[ai] < 0 && r > inExt[0] ||
+         sign[ai] > 0 && r < inExt[1]) && 
+        vtkUltraRound(p) < limit[ai])
+      {
+      r += sign[ai];
+      }
+    else
+      {
+      break;
+      }
+    }
+
+  for (;;)
+    {
+    F p = point[ai]+(r-sign[ai])*axis[ai];
+
+    if ((sign[ai] > 0 && r > inExt[0] ||
+         sign[ai] < 0 && r < inExt[1]) && 
+        vtkUltraRound(p) >= limit[ai])
+      {
+      r -= sign[ai];
+      }
+    else
+      {
+      break;
+      }
+    }
+
+  return r;
+}
+
+// same as above, but for x = x_max
+template <class F>
+static int intersectionHigh(F *point, F *axis, int *sign, 
+                            int *limit, int ai, int *inExt)
+{
+  // approximate value of r
+  int r = intersectionHelper(point,axis,limit,ai,inExt);
+    
+  // move back and forth to find the point just inside the extent
+  for (;;)
+    {
+    F p = point[ai]+r*axis[ai];
+
+    if ((sign[ai] > 0 && r > inExt[0] ||
+         sign[ai] < 0 && r < inExt[1]) &&
+        vtkUltraRound(p) > limit[ai])
+      {
+      r -= sign[ai];
+      }
+    else
+      {
+      break;
+      }
+    }
+
+  for (;;)
+    {
+    F p = point[ai]+(r+sign[ai])*axis[ai];
+
+    if ((sign[ai] < 0 && r > inExt[0] ||
+         sign[ai] > 0 && r < inExt[1]) && 
+        vtkUltraRound(p) <= limit[ai])
+      {
+      r += sign[ai];
+      }
+    else
+      {
+      break;
+      }
+    }
+
+  return r;
+}
+
+template <class F>
+static int isBounded(F *point, F *xAxis, int *inMin, 
+                     int *inMax, int ai, int r)
+{
+  int bi = ai+1; 
+  int ci = ai+2;
+  if (bi > 2) 
+    { 
+    bi -= 3; // coordinate index must be 0, 1 or 2 
+    } 
+  if (ci > 2)
+    { 
+    ci -= 3;
+    }
+
+  F fbp = point[bi]+r*xAxis[bi];
+  F fcp = point[ci]+r*xAxis[ci];
+
+  int bp = vtkUltraRound(fbp);
+  int cp = vtkUltraRound(fcp);
+  
+  return (bp >= inMin[bi] && bp <= inMax[bi] &&
+          cp >= inMin[ci] && cp <= inMax[ci]);
+}
+
+// this huge mess finds out where the current output raster
+// line intersects the input volume
+
+static inline void vtkUltraFindExtentHelper(int &r1, int &r2, int sign, int *inExt)
+{
+  if (sign < 0)
+    {
+    int i = r1;
+    r1 = r2;
+    r2 = i;
+    }
+  
+  // bound r1,r2 within reasonable limits
+  if (r1 < inExt[0]) 
+    {
+    r1 = inExt[0];
+    }
+  if (r2 > inExt[1]) 
+    {
+    r2 = inExt[1];
+    }
+  if (r1 > r2) 
+    {
+    r1 = inExt[0];
+    r2 = inExt[0]-1;
+    }
+}  
+
+template <class F>
+static void vtkUltraFindExtent(int& r1, int& r2, F *point, F *xAxis, 
+                                 int *inMin, int *inMax, int *inExt)
+{
+  int i, ix, iy, iz;
+  int sign[3];
+  int indx1[4],indx2[4];
+  F p1,p2;
+
+  // find signs of components of x axis 
+  // (this is complicated due to the homogeneous coordinate)
+  for (i = 0; i < 3; i++)
+    {
+    p1 = point[i];
+
+    p2 = point[i]+xAxis[i];
+
+    if (p1 <= p2)
+      {
+      sign[i] = 1;
+      }
+    else 
+      {
+      sign[i] = -1;
+      }
+    } 
+  
+  // order components of xAxis from largest to smallest
+  
+  ix = 0;
+  for (i = 1; i < 3; i++)
+    {
+    if (((xAxis[i] < 0) ? (-xAxis[i]) : (xAxis[i])) >
+        ((xAxis[ix] < 0) ? (-xAxis[ix]) : (xAxis[ix])))
+      {
+      ix = i;
+      }
+    }
+  
+  iy = ((ix > 1) ? ix-2 : ix+1);
+  iz = ((ix > 0) ? ix-1 : ix+2);
+
+  if (((xAxis[iy] < 0) ? (-xAxis[iy]) : (xAxis[iy])) >
+      ((xAxis[iz] < 0) ? (-xAxis[iz]) : (xAxis[iz])))
+    {
+    i = iy;
+    iy = iz;
+    iz = i;
+    }
+
+  r1 = intersectionLow(point,xAxis,sign,inMin,ix,inExt);
+  r2 = intersectionHigh(point,xAxis,sign,inMax,ix,inExt);
+  
+  // find points of intersections
+  // first, find w-value for perspective (will usually be 1)
+  for (i = 0; i < 3; i++)
+    {
+    p1 = point[i]+r1*xAxis[i];
+    p2 = point[i]+r2*xAxis[i];
+
+    indx1[i] = vtkUltraRound(p1);
+    indx2[i] = vtkUltraRound(p2);
+    }
+  if (isBounded(point,xAxis,inMin,inMax,ix,r1))
+    { // passed through x face, check opposing face
+    if (isBounded(point,xAxis,inMin,inMax,ix,r2))
+      {
+      vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
+      return;
+      }
+    
+    if (indx2[iy] < inMin[iy])
+      { // check y face
+      r2 = intersectionLow(point,xAxis,sign,inMin,iy,inExt);
+      if (isBounded(point,xAxis,inMin,inMax,iy,r2))
+        {
+        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
+        return;
+        }
+      }
+    else if (indx2[iy] > inMax[iy])
+      { // check other y face
+      r2 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
+      if (isBounded(point,xAxis,inMin,inMax,iy,r2))
+        {
+        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
+        return;
+        }
+      }
+    
+    if (indx2[iz] < inMin[iz])
+      { // check z face
+      r2 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
+      if (isBounded(point,xAxis,inMin,inMax,iz,r2))
+        {
+        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
+        return;
+        }
+      }
+    else if (indx2[iz] > inMax[iz])
+      { // check other z face
+      r2 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
+      if (isBounded(point,xAxis,inMin,inMax,iz,r2))
+        {
+        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
+        return;
+        }
+      }
+    }
+  
+  if (isBounded(point,xAxis,inMin,inMax,ix,r2))
+    { // passed through the opposite x face
+    if (indx1[iy] < inMin[iy])
+      { // check y face
+      r1 = intersectionLow(point,xAxis,sign,inMin,iy,inExt);
+      if (isBounded(point,xAxis,inMin,inMax,iy,r1))
+        {
+        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
+        return;
+        }
+      }
+    else if (indx1[iy] > inMax[iy])
+      { // check other y face
+      r1 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
+      if (isBounded(point,xAxis,inMin,inMax,iy,r1))
+        {
+        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
+        return;
+        }
+      }
+    
+    if (indx1[iz] < inMin[iz])
+      { // check z face
+      r1 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
+      if (isBounded(point,xAxis,inMin,inMax,iz,r1))
+        {
+        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
+        return;
+        }
+      }
+    else if (indx1[iz] > inMax[iz])
+      { // check other z face
+      r1 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
+      if (isBounded(point,xAxis,inMin,inMax,iz,r1))
+        {
+        vtkUltraFindExtentHelper(r1,r2,sign[ix],inExt);
+        return;
+        }
+      }
+    }
+  
+  if ((indx1[iy] >= inMin[iy] && indx2[iy] < inMin[iy]) ||
+      (indx1[iy] < inMin[iy] && indx2[iy] >= inMin[iy]))
+    { // line might pass through bottom face
+    r1 = intersectionLow(point,xAxis,sign,inMin,iy,inExt);
+    if (isBounded(point,xAxis,inMin,inMax,iy,r1))
+      {
+      if ((indx1[iy] <= inMax[iy] && indx2[iy] > inMax[iy]) ||
+          (indx1[iy] > inMax[iy] && indx2[iy] <= inMax[iy]))
+        { // line might pass through top face
+        r2 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
+        if (isBounded(point,xAxis,inMin,inMax,iy,r2))
+          {
+          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
+          return;
+          }
+        }
+      
+      if (indx1[iz] < inMin[iz] && indx2[iy] < inMin[iy] ||
+          indx2[iz] < inMin[iz] && indx1[iy] < inMin[iy])
+        { // line might pass through in-to-screen face
+        r2 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
+        if (isBounded(point,xAxis,inMin,inMax,iz,r2))
+          {
+          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
+          return;
+          }
+        }
+      else if (indx1[iz] > inMax[iz] && indx2[iy] < inMin[iy] ||
+               indx2[iz] > inMax[iz] && indx1[iy] < inMin[iy])
+        { // line might pass through out-of-screen face
+        r2 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
+        if (isBounded(point,xAxis,inMin,inMax,iz,r2))
+          {
+          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
+          return;
+          }
+        } 
+      }
+    }
+  
+  if ((indx1[iy] <= inMax[iy] && indx2[iy] > inMax[iy]) ||
+      (indx1[iy] > inMax[iy] && indx2[iy] <= inMax[iy]))
+    { // line might pass through top face
+    r2 = intersectionHigh(point,xAxis,sign,inMax,iy,inExt);
+    if (isBounded(point,xAxis,inMin,inMax,iy,r2))
+      {
+      if (indx1[iz] < inMin[iz] && indx2[iy] > inMax[iy] ||
+          indx2[iz] < inMin[iz] && indx1[iy] > inMax[iy])
+        { // line might pass through in-to-screen face
+        r1 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
+        if (isBounded(point,xAxis,inMin,inMax,iz,r1))
+          {
+          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
+          return;
+          }
+        }
+      else if (indx1[iz] > inMax[iz] && indx2[iy] > inMax[iy] || 
+               indx2[iz] > inMax[iz] && indx1[iy] > inMax[iy])
+        { // line might pass through out-of-screen face
+        r1 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
+        if (isBounded(point,xAxis,inMin,inMax,iz,r1))
+          {
+          vtkUltraFindExtentHelper(r1,r2,sign[iy],inExt);
+          return;
+          }
+        }
+      } 
+    }
+  
+  if ((indx1[iz] >= inMin[iz] && indx2[iz] < inMin[iz]) ||
+      (indx1[iz] < inMin[iz] && indx2[iz] >= inMin[iz]))
+    { // line might pass through in-to-screen face
+    r1 = intersectionLow(point,xAxis,sign,inMin,iz,inExt);
+    if (isBounded(point,xAxis,inMin,inMax,iz,r1))
+      {
+      if (indx1[iz] > inMax[iz] || indx2[iz] > inMax[iz])
+        { // line might pass through out-of-screen face
+        r2 = intersectionHigh(point,xAxis,sign,inMax,iz,inExt);
+        if (isBounded(point,xAxis,inMin,inMax,iz,r2))
+          {
+          vtkUltraFindExtentHelper(r1,r2,sign[iz],inExt);
+          return;
+          }
+        }
+      }
+    }
+  
+  r1 = inExt[0];
+  r2 = inExt[0] - 1;
+}
+
+// The vtkOptimizedExecute() function uses an optimization which
+// is conceptually simple, but complicated to implement.
+
+// In the un-optimized version, each output voxel
+// is converted into a set of look-up indices for the input data;
+// then, the indices are checked to ensure they lie within the
+// input data extent.
+
+// In the optimized version below, the check is done in reverse:
+// it is first determined which output voxels map to look-up indices
+// within the input data extent.  Then, further calculations are
+// done only for those voxels.  This means that 1) minimal work
+// is done for voxels which map to regions outside fo the input
+// extent (they are just set to the background color) and 2)
+// the inner loops of the look-up and interpolation are
+// tightened relative to the un-uptimized version. 
+
+template<class C, class T, class A>
+static inline void vtkFreehandOptimizedNNHelper(int r1, int r2,
+                                               double *outPoint,
+                                               double *outPoint1,
+                                               double *xAxis,
+                                               T *&inPtr, T *outPtr,
+                                               int *outExt, int *outInc,
+                                               int numscalars,
+                                               A *accPtr, T *resPtr)
+{
+  if (accPtr)  // Nearest-Neighbor, no extent checks, we are compounding
+    {
+    for (int idX = r1; idX <= r2; idX++)
+      {
+      outPoint[0] = outPoint1[0] + idX*xAxis[0]; 
+      outPoint[1] = outPoint1[1] + idX*xAxis[1];
+      outPoint[2] = outPoint1[2] + idX*xAxis[2];
+
+      int outIdX = vtkUltraRound(outPoint[0]) - outExt[0];
+      int outIdY = vtkUltraRound(outPoint[1]) - outExt[2];
+      int outIdZ = vtkUltraRound(outPoint[2]) - outExt[4];
+
+      /* bounds checking turned off to improve performance
+      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
+          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
+          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
+        {
+        cerr << "out of bounds!!!\n";
+        inPtr += numscalars;
+        return;
+        }
+      */
+      int inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
+      // divide by outInc[0] to get the index in the accumulation buffer,
+      // which has only one component
+      int idx = inc/outInc[0];
+      double d2 = 0;
+      if (C::UsesDistance)
+        {
+        double dx = outPoint[0] - (outIdX + outExt[0]);
+        double dy = outPoint[1] - (outIdY + outExt[2]);
+        double dz = outPoint[2] - (outIdZ + outExt[4]);
+        d2 = dx*dx + dy*dy + dz*dz;
+        }
+      C::Insert(inPtr, outPtr + inc, accPtr + idx,
+                C::Reservoir(resPtr, idx, numscalars),
+                numscalars, C::Weight(d2));
+      inPtr += numscalars;
+      }
+    }
+  else
+    {  // Nearest-Neighbor, no extent checks, no accumulation
+    for (int idX = r1; idX <= r2; idX++)
+      {
+      outPoint[0] = outPoint1[0] + idX*xAxis[0]; 
+      outPoint[1] = outPoint1[1] + idX*xAxis[1];
+      outPoint[2] = outPoint1[2] + idX*xAxis[2];
+
+	  // difference between the nearest pixel and the start of the output extent
+      int outIdX = vtkUltraRound(outPoint[0]) - outExt[0];
+      int outIdY = vtkUltraRound(outPoint[1]) - outExt[2];
+      int outIdZ = vtkUltraRound(outPoint[2]) - outExt[4];
+
+      /* bounds checking turned off to improve performance
+      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
+          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
+          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
+        {
+        cerr << "out of bounds!!!\n";
+        inPtr += numscalars;
+        return;
+        }
+      */
+	  // the increment needed to get from the start of the pointer to the output extent to the nearest pixel
+      int inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
+      T *outPtr1 = outPtr + inc; // the output pixel in terms of increments
+      int i = numscalars;
+      do
+        {
+        i--;
+        // copy the input value into the output (this is where the
+        // intensities get copied)
+        *outPtr1++ = *inPtr++;
+        }
+      while (i);
+      *outPtr1 = 255;
+      }
+    } 
+}
+
+// specifically optimized for fixed-point (i.e. integer) mathematics
+template <class C, class T, class A>
+static inline void vtkFreehandOptimizedNNHelper(int r1, int r2,
+                                               fixed *outPoint,
+                                               fixed *outPoint1, fixed *xAxis,
+                                               T *&inPtr, T *outPtr,
+                                               int *outExt, int *outInc,
+                                               int numscalars,
+                                               A *accPtr, T *resPtr)
+{
+  outPoint[0] = outPoint1[0] + r1*xAxis[0] - outExt[0]; // outPoint changes below, so this is not constant
+  outPoint[1] = outPoint1[1] + r1*xAxis[1] - outExt[2];
+  outPoint[2] = outPoint1[2] + r1*xAxis[2] - outExt[4];
+
+  if (accPtr)  // Nearest-Neighbor, no extent checks
+    {
+    for (int idX = r1; idX <= r2; idX++)
+      {
+      int outIdX = vtkUltraRound(outPoint[0]); // outpoint changes below, so this is not constant
+      int outIdY = vtkUltraRound(outPoint[1]);
+      int outIdZ = vtkUltraRound(outPoint[2]);
+
+      /* bounds checking turned off to improve performance
+      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
+          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
+          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
+        {
+        cerr << "out of bounds!!!\n";
+        inPtr += numscalars;
+        return;
+        }
+      */
+      int inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
+      // divide by outInc[0] to accomodate for the difference in the number
+      // of scalar components between the output and the accumulation buffer
+      int idx = inc/outInc[0];
+      double d2 = 0;
+      if (C::UsesDistance)
+        {
+        double dx = (double)(outPoint[0]) - outIdX;
+        double dy = (double)(outPoint[1]) - outIdY;
+        double dz = (double)(outPoint[2]) - outIdZ;
+        d2 = dx*dx + dy*dy + dz*dz;
+        }
+      C::Insert(inPtr, outPtr + inc, accPtr + idx,
+                C::Reservoir(resPtr, idx, numscalars),
+                numscalars, C::Weight(d2));
+      inPtr += numscalars;
+      outPoint[0] += xAxis[0];
+      outPoint[1] += xAxis[1];
+      outPoint[2] += xAxis[2];
+      }
+    }
+  else
+    {  // Nearest-Neighbor, no extent checks, no accumulation
+
+    for (int idX = r1; idX <= r2; idX++)
+      {
+      int outIdX = vtkUltraRound(outPoint[0]);
+      int outIdY = vtkUltraRound(outPoint[1]);
+      int outIdZ = vtkUltraRound(outPoint[2]);
+
+      /* bounds checking turned off to improve performance
+      if (outIdX < 0 || outIdX > outExt[1] - outExt[0] ||
+          outIdY < 0 || outIdY > outExt[3] - outExt[2] ||
+          outIdZ < 0 || outIdZ > outExt[5] - outExt[4])
+        {
+        cerr << "out of bounds!!!\n";
+        inPtr += numscalars;
+        return;
+        }
+      */
+      int inc = outIdX*outInc[0] + outIdY*outInc[1] + outIdZ*outInc[2];
+      T *outPtr1 = outPtr + inc;
+      int i = numscalars;
+      do
+        {
+        i--;
+        *outPtr1++ = *inPtr++;
+        }
+      while (i);
+      *outPtr1 = 255;
+
+      outPoint[0] += xAxis[0];
+      outPoint[1] += xAxis[1];
+      outPoint[2] += xAxis[2];
+      }
+    } 
+}
+
+//----------------------------------------------------------------------------
+// vtkFreehandInsertRow
+// Insert the pixels r1 to r2 of one row of the input slice, where the
+// output index of input pixel 'idX' is outPoint1 + idX*xAxis.  The row
+// must already have been clipped with vtkUltraFindExtent().  If 'flip'
+// is set, the row is inserted back-to-front (only for linear
+// interpolation).  On return, inPtr points just past pixel r2.  The
+// return value is the number of pixels that were inserted.
+//----------------------------------------------------------------------------
+template <int I, class C, class F, class T, class A>
+static inline int vtkFreehandInsertRow(int r1, int r2,
+                                       F *outPoint, F *outPoint1, F *xAxis,
+                                       T *&inPtr, T *outPtr,
+                                       int *outExt, int *outInc,
+                                       int numscalars,
+                                       A *accPtr, T *resPtr,
+                                       int flip)
+{
+  if (I == VTK_FREEHAND_LINEAR)
+    {
+    int hits = 0;
+    for (int idX = r1; idX <= r2; idX++)
+      {
+      int x = (flip ? r1 + r2 - idX : idX);
+      outPoint[0] = outPoint1[0] + x*xAxis[0];
+      outPoint[1] = outPoint1[1] + x*xAxis[1];
+      outPoint[2] = outPoint1[2] + x*xAxis[2];
+
+      hits += vtkTrilinearInterpolation<C>(outPoint, inPtr, outPtr,
+                                           accPtr, resPtr, numscalars,
+                                           outExt, outInc);
+      inPtr += numscalars;
+      }
+    return hits;
+    }
+
+  vtkFreehandOptimizedNNHelper<C>(r1, r2, outPoint, outPoint1, xAxis,
+                                  inPtr, outPtr, outExt, outInc,
+                                  numscalars, accPtr, resPtr);
+  return (r2 >= r1 ? r2 - r1 + 1 : 0);
+}
+
+//----------------------------------------------------------------------------
+// vtkFreehandGetFanMask
+// Get the row spans of the fan of 'self' for the slice 'inData' from the
+// shared vtkUltrasoundFanMask cache.  The mask covers the whole input
+// slice, so every thread and every frame with the same geometry shares
+// one mask.  The fan edges are moved in by one pixel.  If 'clipRows' is
+// off, only the x limits of the clip rectangle are applied.  If 'flipRows'
+// is set, the fan origin is at row 'flipOrigin' (see
+// vtkFreehandOptimizedInsertSlice).  The mask must be given back with
+// vtkUltrasoundFanMask::ReleaseCachedMask().
+//----------------------------------------------------------------------------
+template <class S>
+static vtkUltrasoundFanMask *vtkFreehandGetFanMask(S *self,
+                                                   vtkImageData *inData,
+                                                   int clipRows,
+                                                   int flipRows,
+                                                   int flipOrigin)
+{
+  vtkFloatingPointType inSpacing[3], inOrigin[3];
+  inData->GetSpacing(inSpacing);
+  inData->GetOrigin(inOrigin);
+
+  // the fan origin, in pixels from the slice origin
+  double fanOrigin[2];
+  fanOrigin[0] = (self->GetFanOrigin()[0]-inOrigin[0])/inSpacing[0];
+  fanOrigin[1] = (self->GetFanOrigin()[1]-inOrigin[1])/inSpacing[1];
+  if (flipRows)
+    {
+    fanOrigin[1] = flipOrigin;
+    }
+
+  double spacing[2];
+  spacing[0] = inSpacing[0];
+  spacing[1] = inSpacing[1];
+
+  // tan of the left and right fan angles, the right is always the greater
+  const double degToRad = 0.017453292519943295;
+  double slopes[2];
+  slopes[0] = tan(self->GetFanAngles()[0]*degToRad)/spacing[0]*spacing[1];
+  slopes[1] = tan(self->GetFanAngles()[1]*degToRad)/spacing[0]*spacing[1];
+  if (slopes[0] > slopes[1])
+    {
+    double tmp = slopes[0]; slopes[0] = slopes[1]; slopes[1] = tmp;
+    }
+
+  int dataExt[6];
+  int clipExt[6];
+  inData->GetExtent(dataExt);
+  self->GetClipExtent(clipExt, inOrigin, inSpacing, dataExt);
+  if (!clipRows)
+    {
+    clipExt[2] = dataExt[2];
+    clipExt[3] = dataExt[3];
+    }
+
+  return vtkUltrasoundFanMask::GetCachedMask(dataExt, spacing, fanOrigin,
+                                             slopes, self->GetFanDepth(),
+                                             clipExt, 1);
+}
+
+//----------------------------------------------------------------------------
+// vtkFreehandOptimizedInsertSlice
+// Insert the slice 'inPtr' of extent 'inExt' (which may have been split
+// for threading) into the output, with the index matrix 'matrix' that
+// takes input indices to output indices.  Each input row is clipped to
+// the output extent and then to the fan with the row spans of 'mask'.
+// If 'flipRows' is set, row idY is placed at row (flipOrigin - idY) of
+// the slice, and if 'flipColumns' is set, each row is inserted
+// back-to-front.  Only thread 0 reports progress through 'self'.  The
+// return value is the number of pixels that were inserted.
+//----------------------------------------------------------------------------
+template <int I, class C, class F, class T, class A, class S>
+static int vtkFreehandOptimizedInsertSlice(S *self,
+                                           vtkUltrasoundFanMask *mask,
+                                           vtkImageData *outData, T *outPtr,
+                                           A *accPtr, T *resPtr,
+                                           vtkImageData *inData, T *inPtr,
+                                           int inExt[6], F matrix[4][4],
+                                           int flipRows, int flipOrigin,
+                                           int flipColumns, int threadId)
+{
+  int i, numscalars;
+  int idX, idY, idZ;
+  vtkIdType inIncX, inIncY, inIncZ;
+  int outExt[6];
+  int outMax[3], outMin[3];
+  int outInc[3];
+  unsigned long count = 0;
+  unsigned long target;
+  int r1, r2, s1, s2;
+  int hits = 0;
+  F outPoint0[3];
+  F outPoint1[3];
+  F outPoint[3];
+  F xAxis[3], yAxis[3], zAxis[3], origin[3];
+
+  // find maximum output range
+  outData->GetExtent(outExt);
+  for (i = 0; i < 3; i++)
+    {
+    outMin[i] = outExt[2*i];
+    outMax[i] = outExt[2*i+1];
+    }
+
+  target = (unsigned long)
+    ((inExt[5]-inExt[4]+1)*(inExt[3]-inExt[2]+1)/50.0);
+  target++;
+
+  // Get Increments to march through data 
+  outData->GetIncrements(outInc);
+  inData->GetContinuousIncrements(inExt, inIncX, inIncY, inIncZ);
+  numscalars = inData->GetNumberOfScalarComponents();
+
+  // break matrix into a set of axes plus an origin
+  // (this allows us to calculate the transform Incrementally)
+  for (i = 0; i < 3; i++)
+    {
+    xAxis[i]  = matrix[i][0];
+    yAxis[i]  = matrix[i][1];
+    zAxis[i]  = matrix[i][2];
+    origin[i] = matrix[i][3];
+    }
+
+  // Loop through input pixels
+  for (idZ = inExt[4]; idZ <= inExt[5]; idZ++)
+    {
+    outPoint0[0] = origin[0]+idZ*zAxis[0]; // incremental transform
+    outPoint0[1] = origin[1]+idZ*zAxis[1];
+    outPoint0[2] = origin[2]+idZ*zAxis[2];
+
+    for (idY = inExt[2]; idY <= inExt[3]; idY++)
+      {
+      int y = (flipRows ? flipOrigin - idY : idY);
+      outPoint1[0] = outPoint0[0]+y*yAxis[0]; // incremental transform
+      outPoint1[1] = outPoint0[1]+y*yAxis[1];
+      outPoint1[2] = outPoint0[2]+y*yAxis[2];
+
+      if (threadId == 0)
+        {
+        if (!(count%target))
+          {
+          self->UpdateProgress(count/(50.0*target));
+          }
+        count++;
+        }
+
+      // find intersections of x raster line with the output extent
+      vtkUltraFindExtent(r1,r2,outPoint1,xAxis,outMin,outMax,inExt);
+
+      // next, handle the 'fan' shape of the input and bound to the
+      // ultrasound clip rectangle, using the precomputed row spans
+      mask->GetRowSpan(idY, s1, s2);
+      if (r1 < s1)
+        {
+        r1 = s1;
+        }
+      if (r2 > s2)
+        {
+        r2 = s2;
+        }
+      if (r1 > r2)
+        {
+        r1 = inExt[0];
+        r2 = inExt[0]-1;
+        }
+
+      // skip the portion of the slice that we don't want to include
+      for (idX = inExt[0]; idX < r1; idX++)
+        {
+        inPtr += numscalars;
+        }
+
+      hits += vtkFreehandInsertRow<I,C>(r1, r2, outPoint, outPoint1, xAxis,
+                                        inPtr, outPtr, outExt, outInc,
+                                        numscalars, accPtr, resPtr,
+                                        flipColumns);
+
+      // skip the portion of the slice we don't want to reconstruct
+      for (idX = r2+1; idX <= inExt[1]; idX++)
+        {
+        inPtr += numscalars;
+        }
+
+      inPtr += inIncY;
+      }
+    inPtr += inIncZ;
+    }
+
+  return hits;
+}
+
+// Choose the interpolation mode once per slice
+template <class C, class F, class T, class A, class S>
+static int vtkFreehandOptimizedInsertSlice(int interpolationMode,
+                                           S *self,
+                                           vtkUltrasoundFanMask *mask,
+                                           vtkImageData *outData, T *outPtr,
+                                           A *accPtr, T *resPtr,
+                                           vtkImageData *inData, T *inPtr,
+                                           int inExt[6], F matrix[4][4],
+                                           int flipRows, int flipOrigin,
+                                           int flipColumns, int threadId)
+{
+  if (interpolationMode == VTK_FREEHAND_LINEAR)
+    {
+    return vtkFreehandOptimizedInsertSlice<VTK_FREEHAND_LINEAR,C>(
+      self, mask, outData, outPtr, accPtr, resPtr, inData, inPtr, inExt,
+      matrix, flipRows, flipOrigin, flipColumns, threadId);
+    }
+  return vtkFreehandOptimizedInsertSlice<VTK_FREEHAND_NEAREST,C>(
+    self, mask, outData, outPtr, accPtr, resPtr, inData, inPtr, inExt,
+    matrix, flipRows, flipOrigin, flipColumns, threadId);
+}
+
+//----------------------------------------------------------------------------
+// vtkFreehandFillHolesInOutput
+// Fill the voxels of 'outExt' that were not hit with the mean of their
+// neighbors, if at least half of the 3x3x3 neighborhood (or failing that,
+// the 5x5x5 neighborhood) was hit.  The last component of the output is
+// the alpha.  Filled voxels get alpha 1 while the pass runs, so that they
+// are not used to fill their neighbors, and are then set to 255.
+//----------------------------------------------------------------------------
+template <class T, class A>
+static void vtkFreehandFillHolesInOutput(vtkImageData *outData, T *outPtr,
+                                         A *accPtr, int outExt[6])
+{
+  int idX, idY, idZ;
+  vtkIdType incX, incY, incZ;
+  vtkIdType accIncX, accIncY, accIncZ;
+  int startX, endX, numscalars;
+  int c;
+  // clip the extent by 1 voxel width relative to whole extent
+  int *outWholeExt = outData->GetWholeExtent();
+  int extent[6];
+  for (int a = 0; a < 3; a++)
+    {
+    extent[2*a] = outExt[2*a];
+    if (extent[2*a] == outWholeExt[2*a])
+      {
+      extent[2*a]++;
+      }
+    extent[2*a+1] = outExt[2*a+1];
+    if (extent[2*a+1] == outWholeExt[2*a+1])
+      {
+      extent[2*a+1]--;
+      }
+    }
+
+  // get increments for output and for accumulation buffer
+  outData->GetIncrements(incX, incY, incZ);
+  accIncX = 1;
+  accIncY = incY/incX;
+  accIncZ = incZ/incX;
+  // number of components not including the alpha channel
+  numscalars = outData->GetNumberOfScalarComponents() - 1;
+
+  T *alphaPtr = outPtr + numscalars;
+  T *outPtrZ, *outPtrY, *outPtrX;
+  A *accPtrZ, *accPtrY, *accPtrX;
+
+  // go through all voxels except the edge voxels
+  for (idZ = extent[4]; idZ <= extent[5]; idZ++)
+    {
+    outPtrZ = outPtr + (idZ - outExt[4])*incZ;
+    accPtrZ = accPtr + (idZ - outExt[4])*accIncZ;
+    for (idY = extent[2]; idY <= extent[3]; idY++)
+      {
+      outPtrY = outPtrZ + (idY - outExt[2])*incY;
+      accPtrY = accPtrZ + (idY - outExt[2])*accIncY;
+      // find entry point
+      alphaPtr = outPtrY + numscalars;
+      for (startX = outExt[0]; startX <= outExt[1]; startX++)
+        {
+        // check the point on the row as well as the 4-connected voxels
+        if (*alphaPtr |
+            *(alphaPtr-incY) | *(alphaPtr+incY) |
+            *(alphaPtr-incZ) | *(alphaPtr+incZ))
+          {// break when alpha component is nonzero
+          break;
+          }
+        alphaPtr += incX;
+        }
+      if (startX > outExt[1])
+        { // the whole row is empty, do nothing
+        continue;
+        }
+      // find exit point
+      alphaPtr = outPtrY + (outExt[1]-outExt[0])*incX + numscalars;
+      for (endX = outExt[1]; endX >= outExt[0]; endX--)
+        {
+        // check the point on the row as well as the 4-connected voxels
+        if (*alphaPtr |
+            *(alphaPtr-incY) | *(alphaPtr+incY) |
+            *(alphaPtr-incZ) | *(alphaPtr+incZ))
+          {
+          break;
+          }
+        alphaPtr -= incX;
+        }
+      // go through the row, skip first and last voxel in row
+      if (startX == outWholeExt[0])
+        {
+        startX++;
+        }
+      if (endX == outWholeExt[1])
+        {
+        endX--;
+        }
+      outPtrX = outPtrY + (startX - outExt[0])*incX;
+      accPtrX = accPtrY + (startX - outExt[0])*accIncX;
+      for (idX = startX; idX <= endX; idX++)
+        {
+        if (outPtrX[numscalars] == 0)
+          { // only do this for voxels that haven't been hit
+          double sum[32];
+          for (c = 0; c < numscalars; c++)
+            {
+            sum[c] = 0;
+            }
+          double asum = 0;
+          int n = 0;
+          int nmin = 14; // half of the connected voxels plus one
+          T *blockPtr;
+          A *accBlockPtr;
+          // sum the pixel values for the 3x3x3 block
+          //  (this is turned off for now)
+          if (0) // (accPtr)
+            { // use accumulation buffer to do weighted average
+            for (vtkIdType k = -accIncZ; k <= accIncZ; k += accIncZ)
+              {
+              for (vtkIdType j = -accIncY; j <= accIncY; j += accIncY)
+                {
+                for (vtkIdType i = -accIncX; i <= accIncX; i += accIncX)
+                  {
+                  vtkIdType inc = j + k + i;
+                  blockPtr = outPtrX + inc*incX;
+                  accBlockPtr = accPtrX + inc;
+                  if (blockPtr[numscalars] == 255)
+                    {
+                    n++;
+                    for (c = 0; c < numscalars; c++)
+                      { // use accumulation buffer as weight
+                      sum[c] += blockPtr[c]*(*accBlockPtr);
+                      }
+                    asum += *accBlockPtr;
+                    }
+                  }
+                }
+              }
+            // if less than half the neighbors have data, use larger block
+            if (n <= nmin && idX != startX && idX != endX &&
+                idX - outWholeExt[0] > 2 && outWholeExt[1] - idX > 2 &&
+                idY - outWholeExt[2] > 2 && outWholeExt[3] - idY > 2 &&
+                idZ - outWholeExt[4] > 2 && outWholeExt[5] - idZ > 2)
+              {
+              // weigh inner block by a factor of four (multiply three,
+              // plus we will be counting it again as part of the 5x5x5
+              // block)
+              asum *= 3;
+              for (c = 0; c < numscalars; c++)
+                {
+                sum[c]*= 3;
+                }
+              nmin = 63;
+              n = 0;
+              for (vtkIdType k = -accIncZ*2; k <= accIncZ*2; k += accIncZ)
+                {
+                for (vtkIdType j = -accIncY*2; j <= accIncY*2; j += accIncY)
+                  {
+                  for (vtkIdType i = -accIncX*2; i <= accIncX*2; i += accIncX)
+                    {
+                    vtkIdType inc = j + k + i;
+                    blockPtr = outPtrX + inc*incX;
+                    accBlockPtr = accPtrX + inc;
+                    if (blockPtr[numscalars] == 255)
+                      { // use accumulation buffer as weight
+                      n++;
+                      for (c = 0; c < numscalars; c++)
+                        {
+                        sum[c] += blockPtr[c]*(*accBlockPtr);
+                        }
+                      asum += *accBlockPtr;
+                      }
+                    }
+                  }
+                }
+              }
+            }
+          else // no accumulation buffer
+            {
+            for (int k = -incZ; k <= incZ; k += incZ)
+              {
+              for (int j = -incY; j <= incY; j += incY)
+                {
+                for (int i = -incX; i <= incX; i += incX)
+                  {
+                  blockPtr = outPtrX + j + k + i;
+                  if (blockPtr[numscalars] == 255)
+                    {
+                    n++;
+                    for (int c = 0; c < numscalars; c++)
+                      {
+                      sum[c] += blockPtr[c];
+                      }
+                    }
+                  }
+                }
+              }
+            asum = n;
+            // if less than half the neighbors have data, use larger block,
+            // and count inner 3x3 block again to weight it by 2
+            if (n <= nmin && idX != startX && idX != endX &&
+                idX - outWholeExt[0] > 2 && outWholeExt[1] - idX > 2 &&
+                idY - outWholeExt[2] > 2 && outWholeExt[3] - idY > 2 &&
+                idZ - outWholeExt[4] > 2 && outWholeExt[5] - idZ > 2)
+              {
+              // weigh inner block by a factor of four (multiply three,
+              // plus we will be counting it again as part of the 5x5x5
+              // block)
+              asum *= 3;
+              for (c = 0; c < numscalars; c++)
+                {
+                sum[c]*= 3;
+                }
+              nmin = 63;
+              n = 0;
+              for (int k = -incZ*2; k <= incZ*2; k += incZ)
+                {
+                for (int j = -incY*2; j <= incY*2; j += incY)
+                  {
+                  for (int i = -incX*2; i <= incX*2; i += incX)
+                    {
+                    blockPtr = outPtrX + j + k + i;
+                    if (blockPtr[numscalars] == 255)
+                      {
+                      n++;
+                      for (int c = 0; c < numscalars; c++)
+                        {
+                        sum[c] += blockPtr[c];
+                        }
+                      }
+                    }
+                  }
+                }
+              asum += n;
+              }
+            }
+          // if more than half of neighboring voxels are occupied, then fill
+          if (n >= nmin)
+            {
+            for (int c = 0; c < numscalars; c++)
+              {
+              vtkUltraRound(sum[c]/asum, outPtrX[c]);
+              }
+            // set alpha to 1 now, change to 255 later
+            outPtrX[numscalars] = 1;
+            }
+          }
+          outPtrX += incX;
+        }
+      }
+    }
+
+  // change alpha value '1' to value '255'
+  alphaPtr = outPtr + numscalars;
+  // go through all voxels this time
+  for (idZ = outExt[4]; idZ <= outExt[5]; idZ++)
+    {
+    for (idY = outExt[2]; idY <= outExt[3]; idY++)
+      {
+      for (idX = outExt[0]; idX <= outExt[1]; idX++)
+        {
+        // convert '1' to 255
+        if (*alphaPtr == 1)
+          {
+          *alphaPtr = 255;
+          }
+        alphaPtr += incX;
+        }
+      // add the continuous increment
+      alphaPtr += (incY - (outExt[1]-outExt[0]+1)*incX);
+      }
+    // add the continuous increment
+    alphaPtr += (incZ - (outExt[3]-outExt[2]+1)*incY);
+    }
+}
+
+//----------------------------------------------------------------------------
+// vtkFreehandSplitSliceExtent
+// Split 'startExt' into 'total' pieces along z, or y or x if it is flat,
+// and put piece 'num' in 'splitExt'.  The return value is the number of
+// pieces that the extent was actually split into, from 1 to 'total'.
+//----------------------------------------------------------------------------
+static inline int vtkFreehandSplitSliceExtent(int splitExt[6],
+                                              int startExt[6],
+                                              int num, int total)
+{
+  int splitAxis;
+  int min, max;
+
+  // start with same extent
+  memcpy(splitExt, startExt, 6 * sizeof(int));
+
+  splitAxis = 2;
+  min = startExt[4];
+  max = startExt[5];
+  while (min == max)
+    {
+    --splitAxis;
+    if (splitAxis < 0)
+      { // cannot split
+      return 1;
+      }
+    min = startExt[splitAxis*2];
+    max = startExt[splitAxis*2+1];
+    }
+
+  // determine the actual number of pieces that will be generated
+  int range = max - min + 1;
+  int valuesPerThread = (int)ceil(range/(double)total);
+  int maxThreadIdUsed = (int)ceil(range/(double)valuesPerThread) - 1;
+  if (num < maxThreadIdUsed)
+    {
+    splitExt[splitAxis*2] = splitExt[splitAxis*2] + num*valuesPerThread;
+    splitExt[splitAxis*2+1] = splitExt[splitAxis*2] + valuesPerThread - 1;
+    }
+  if (num == maxThreadIdUsed)
+    {
+    splitExt[splitAxis*2] = splitExt[splitAxis*2] + num*valuesPerThread;
+    }
+
+  return maxThreadIdUsed + 1;
+}
+
+//----------------------------------------------------------------------------
+// vtkSleep
+// platform-independent sleep function
+//----------------------------------------------------------------------------
+static inline void vtkSleep(double duration)
+{
+  duration = duration; // avoid warnings
+  // sleep according to OS preference
+#ifdef _WIN32
+  Sleep(vtkUltraFloor(1000*duration));
+#elif defined(__FreeBSD__) || defined(__linux__) || defined(sgi)
+  struct timespec sleep_time, remaining_time;
+  int seconds = vtkUltraFloor(duration);
+  int nanoseconds = vtkUltraFloor(1000000000*(duration - seconds));
+  sleep_time.tv_sec = seconds;
+  sleep_time.tv_nsec = nanoseconds;
+  nanosleep(&sleep_time, &remaining_time);
+#endif
+}
+
+//----------------------------------------------------------------------------
+// vtkThreadSleep
+// Sleep until the specified absolute time has arrived.
+// You must pass a handle to the current thread.  
+// If '0' is returned, then the thread was aborted before or during the wait.
+//----------------------------------------------------------------------------
+static inline int vtkThreadSleep(struct ThreadInfoStruct *data, double time)
+{
+  for (;;)
+    {
+    // slice 10 millisecs off the time, since this is how long it will
+    // take for this thread to start executing once it has been
+    // re-scheduled
+    double remaining = time - vtkTimerLog::GetUniversalTime() - 0.01;
+
+    // check to see if we have reached the specified time
+    if (remaining <= 0)
+      {
+      return 1;
+      }
+    // check the ActiveFlag at least every 0.1 seconds
+    if (remaining > 0.1)
+      {
+      remaining = 0.1;
+      }
+
+    // check to see if we are being told to quit 
+    if (*(data->ActiveFlag) == 0)
+      {
+      return 0;
+      }
+    
+    vtkSleep(remaining);
+    }
+}
+
+#endif
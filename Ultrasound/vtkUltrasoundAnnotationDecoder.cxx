@@ -0,0 +1,348 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundAnnotationDecoder.cxx,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+
+#include <math.h>
+#include "vtkUltrasoundAnnotationDecoder.h"
+#include "vtkImageData.h"
+#include "vtkObjectFactory.h"
+
+vtkCxxRevisionMacro(vtkUltrasoundAnnotationDecoder, "$Revision: 1.1 $");
+vtkStandardNewMacro(vtkUltrasoundAnnotationDecoder);
+
+//----------------------------------------------------------------------------
+// The probe patterns for the digits 0 to 9, 'B' is background and 'W' is
+// text.  Each pattern lists the probes in the order that they are set by
+// SetDigitProbe().
+static const char *vtkUltrasoundAnnotationGlyphs[10] = {
+  "BWWBWW", "WBWWBB", "BWBBBB", "BBWBBW", "WWWWWW",
+  "BBBBBW", "WBBBWW", "BWWBWB", "BBBBWW", "BBBWBW" };
+
+//----------------------------------------------------------------------------
+vtkUltrasoundAnnotationDecoder::vtkUltrasoundAnnotationDecoder()
+{
+  this->ReferenceSize[0] = 640;
+  this->ReferenceSize[1] = 480;
+  this->Shift[0] = 0;
+  this->Shift[1] = 0;
+  this->LowerThreshold = 0;
+  this->UpperThreshold = 0;
+  this->NumberOfFields = 0;
+  this->NumberOfCacheHits = 0;
+
+  // the probes for the adult TEE rotation digits
+  static const int probes[VTK_ANNOTATION_PROBES][2] = {
+    { 0, 0 }, { 0, 4 }, { 3, 0 }, { 3, 5 }, { -1, 4 }, { 5, 4 } };
+  int i, j;
+  for (i = 0; i < VTK_ANNOTATION_PROBES; i++)
+    {
+    this->DigitProbes[i][0] = probes[i][0];
+    this->DigitProbes[i][1] = probes[i][1];
+    }
+
+  // build the glyph table from the patterns
+  for (i = 0; i < (1 << VTK_ANNOTATION_PROBES); i++)
+    {
+    this->Glyphs[i] = -1;
+    }
+  for (i = 0; i < 10; i++)
+    {
+    int code = 0;
+    for (j = 0; j < VTK_ANNOTATION_PROBES; j++)
+      {
+      if (vtkUltrasoundAnnotationGlyphs[i][j] == 'W')
+        {
+        code |= (1 << j);
+        }
+      }
+    this->Glyphs[code] = i;
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundAnnotationDecoder::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "ReferenceSize: (" << this->ReferenceSize[0] << ", "
+     << this->ReferenceSize[1] << ")\n";
+  os << indent << "Shift: (" << this->Shift[0] << ", "
+     << this->Shift[1] << ")\n";
+  os << indent << "LowerThreshold: " << this->LowerThreshold << "\n";
+  os << indent << "UpperThreshold: " << this->UpperThreshold << "\n";
+  os << indent << "NumberOfFields: " << this->NumberOfFields << "\n";
+  os << indent << "NumberOfCacheHits: " << this->NumberOfCacheHits << "\n";
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundAnnotationDecoder::SetDigitProbe(int i, int x, int y)
+{
+  if (i < 0 || i >= VTK_ANNOTATION_PROBES)
+    {
+    vtkErrorMacro(<< "SetDigitProbe: probe " << i << " is out of range");
+    return;
+    }
+  if (this->DigitProbes[i][0] != x || this->DigitProbes[i][1] != y)
+    {
+    this->DigitProbes[i][0] = x;
+    this->DigitProbes[i][1] = y;
+    this->Modified();
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundAnnotationDecoder::AddField(int x, int y,
+                                             int numberOfDigits,
+                                             int digitStep)
+{
+  if (this->NumberOfFields >= VTK_ANNOTATION_MAX_FIELDS)
+    {
+    vtkErrorMacro(<< "AddField: too many fields");
+    return -1;
+    }
+  if (numberOfDigits < 1 || numberOfDigits > VTK_ANNOTATION_MAX_DIGITS)
+    {
+    vtkErrorMacro(<< "AddField: a field must have between 1 and "
+                  << VTK_ANNOTATION_MAX_DIGITS << " digits");
+    return -1;
+    }
+
+  Field *field = &this->Fields[this->NumberOfFields];
+  field->Position[0] = x;
+  field->Position[1] = y;
+  field->NumberOfDigits = numberOfDigits;
+  field->DigitStep = digitStep;
+  field->Value = -1;
+  field->Hash = 0;
+  this->Modified();
+
+  return this->NumberOfFields++;
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundAnnotationDecoder::RemoveAllFields()
+{
+  if (this->NumberOfFields)
+    {
+    this->NumberOfFields = 0;
+    this->Modified();
+    }
+}
+
+//----------------------------------------------------------------------------
+// Hash the bytes of a rectangle of the frame (FNV-1a)
+static unsigned long vtkUltrasoundAnnotationHash(const unsigned char *ptr,
+                                                 int rowLength, int rows,
+                                                 int rowStride,
+                                                 unsigned long hash)
+{
+  for (int j = 0; j < rows; j++)
+    {
+    const unsigned char *rowPtr = ptr + j*rowStride;
+    for (int i = 0; i < rowLength; i++)
+      {
+      hash ^= rowPtr[i];
+      hash *= 16777619UL;
+      hash &= 0xffffffffUL;
+      }
+    }
+  return hash;
+}
+
+//----------------------------------------------------------------------------
+// Threshold the probes, giving 1 for text and 0 for background
+template <class T>
+static void vtkUltrasoundAnnotationThreshold(const T *ptr, const int *offsets,
+                                             int n, double lower,
+                                             double upper, int *bits)
+{
+  for (int i = 0; i < n; i++)
+    {
+    double v = ptr[offsets[i]];
+    bits[i] = (v < lower || v > upper);
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundAnnotationDecoder::DecodeField(vtkImageData *frame,
+                                                int fieldIndex)
+{
+  if (frame == NULL || fieldIndex < 0 || fieldIndex >= this->NumberOfFields)
+    {
+    return -1;
+    }
+
+  Field *field = &this->Fields[fieldIndex];
+  int numberOfProbes = field->NumberOfDigits*VTK_ANNOTATION_PROBES;
+
+  int extent[6];
+  frame->GetExtent(extent);
+  int nx = extent[1] - extent[0] + 1;
+  int ny = extent[3] - extent[2] + 1;
+  if (nx <= 0 || ny <= 0 || extent[5] < extent[4])
+    {
+    return -1;
+    }
+  double sx = double(nx)/this->ReferenceSize[0];
+  double sy = double(ny)/this->ReferenceSize[1];
+
+  // map the probes to pixel indices, and find the box around them
+  int probeX[VTK_ANNOTATION_MAX_DIGITS*VTK_ANNOTATION_PROBES];
+  int probeY[VTK_ANNOTATION_MAX_DIGITS*VTK_ANNOTATION_PROBES];
+  int box[4];
+  box[0] = extent[1];
+  box[1] = extent[0];
+  box[2] = extent[3];
+  box[3] = extent[2];
+  int d, i, k = 0;
+  for (d = 0; d < field->NumberOfDigits; d++)
+    {
+    for (i = 0; i < VTK_ANNOTATION_PROBES; i++)
+      {
+      double x = field->Position[0] + d*field->DigitStep +
+        this->DigitProbes[i][0] + this->Shift[0];
+      double y = field->Position[1] + this->DigitProbes[i][1] -
+        this->Shift[1];
+      // the reference y is down from the top, the frame's y is up
+      int idX = extent[0] + int(floor(x*sx + 0.5));
+      int idY = extent[2] + ny - 1 - int(floor(y*sy + 0.5));
+      if (idX < extent[0] || idX > extent[1] ||
+          idY < extent[2] || idY > extent[3])
+        {
+        return -1;
+        }
+      probeX[k] = idX;
+      probeY[k] = idY;
+      k++;
+      box[0] = (idX < box[0] ? idX : box[0]);
+      box[1] = (idX > box[1] ? idX : box[1]);
+      box[2] = (idY < box[2] ? idY : box[2]);
+      box[3] = (idY > box[3] ? idY : box[3]);
+      }
+    }
+
+  int inc[3];
+  frame->GetIncrements(inc);
+  int scalarSize = frame->GetScalarSize();
+  void *boxPtr = frame->GetScalarPointer(box[0], box[2], extent[4]);
+
+  // hash the box, if it is unchanged then so is the value
+  unsigned long hash = 2166136261UL;
+  hash = (hash ^ nx)*16777619UL & 0xffffffffUL;
+  hash = (hash ^ ny)*16777619UL & 0xffffffffUL;
+  hash = (hash ^ frame->GetScalarType())*16777619UL & 0xffffffffUL;
+  hash = vtkUltrasoundAnnotationHash((const unsigned char *)boxPtr,
+                                     (box[1] - box[0] + 1)*inc[0]*scalarSize,
+                                     box[3] - box[2] + 1,
+                                     inc[1]*scalarSize, hash);
+
+  if (hash == field->Hash &&
+      field->DecodeTime.GetMTime() > this->GetMTime())
+    {
+    this->NumberOfCacheHits++;
+    return field->Value;
+    }
+
+  // threshold the first component of each probe
+  int offsets[VTK_ANNOTATION_MAX_DIGITS*VTK_ANNOTATION_PROBES];
+  int bits[VTK_ANNOTATION_MAX_DIGITS*VTK_ANNOTATION_PROBES];
+  for (k = 0; k < numberOfProbes; k++)
+    {
+    offsets[k] = (probeX[k] - box[0])*inc[0] + (probeY[k] - box[2])*inc[1];
+    }
+
+  switch (frame->GetScalarType())
+    {
+    case VTK_UNSIGNED_CHAR:
+      vtkUltrasoundAnnotationThreshold((unsigned char *)boxPtr, offsets,
+                                       numberOfProbes, this->LowerThreshold,
+                                       this->UpperThreshold, bits);
+      break;
+    case VTK_CHAR:
+      vtkUltrasoundAnnotationThreshold((char *)boxPtr, offsets,
+                                       numberOfProbes, this->LowerThreshold,
+                                       this->UpperThreshold, bits);
+      break;
+    case VTK_SHORT:
+      vtkUltrasoundAnnotationThreshold((short *)boxPtr, offsets,
+                                       numberOfProbes, this->LowerThreshold,
+                                       this->UpperThreshold, bits);
+      break;
+    case VTK_UNSIGNED_SHORT:
+      vtkUltrasoundAnnotationThreshold((unsigned short *)boxPtr, offsets,
+                                       numberOfProbes, this->LowerThreshold,
+                                       this->UpperThreshold, bits);
+      break;
+    case VTK_FLOAT:
+      vtkUltrasoundAnnotationThreshold((float *)boxPtr, offsets,
+                                       numberOfProbes, this->LowerThreshold,
+                                       this->UpperThreshold, bits);
+      break;
+    default:
+      vtkErrorMacro(<< "DecodeField: unsupported scalar type");
+      return -1;
+    }
+
+  // look up the digits, least significant first
+  int value = -1;
+  int place = 1;
+  for (d = 0; d < field->NumberOfDigits; d++)
+    {
+    int code = 0;
+    for (i = 0; i < VTK_ANNOTATION_PROBES; i++)
+      {
+      code |= (bits[d*VTK_ANNOTATION_PROBES + i] << i);
+      }
+    int digit = this->Glyphs[code];
+    if (digit < 0)
+      {
+      break;
+      }
+    value = (value < 0 ? 0 : value) + digit*place;
+    place *= 10;
+    }
+
+  field->Value = value;
+  field->Hash = hash;
+  field->DecodeTime.Modified();
+
+  return value;
+}
@@ -0,0 +1,159 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundAnnotationDecoder.h,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+// .NAME vtkUltrasoundAnnotationDecoder - read numbers from a video overlay
+// .SECTION Description
+// vtkUltrasoundAnnotationDecoder reads the numbers that an ultrasound
+// machine draws into the video frame, e.g. the rotation of a TEE probe.
+// Each number is a field of digits, and each digit is read by thresholding
+// six probe pixels and looking the resulting pattern up in a glyph table.
+// The probes are read straight from the frame's scalars, without running
+// a VTK pipeline.
+//
+// The positions of the fields and of the probes are given in the pixels
+// of a reference frame (640x480 by default, with y measured down from the
+// top of the frame), and are scaled to the size of the frame that is
+// decoded.  The value of each field is cached along with a hash of the
+// pixels around the field, so a field is only decoded again when its
+// pixels change.
+// .SECTION see also
+// vtkFreehandUltrasound2
+
+#ifndef __vtkUltrasoundAnnotationDecoder_h
+#define __vtkUltrasoundAnnotationDecoder_h
+
+#include "vtkObject.h"
+
+class vtkImageData;
+
+#define VTK_ANNOTATION_MAX_FIELDS 8
+#define VTK_ANNOTATION_MAX_DIGITS 4
+#define VTK_ANNOTATION_PROBES 6
+
+class VTK_EXPORT vtkUltrasoundAnnotationDecoder : public vtkObject
+{
+public:
+  static vtkUltrasoundAnnotationDecoder *New();
+  vtkTypeRevisionMacro(vtkUltrasoundAnnotationDecoder, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // The size of the frame that the field and probe positions are given
+  // for (default 640x480).
+  vtkSetVector2Macro(ReferenceSize, int);
+  vtkGetVector2Macro(ReferenceSize, int);
+
+  // Description:
+  // A shift, in reference pixels, that is added to all the fields.  A
+  // positive y shift moves the fields up.
+  vtkSetVector2Macro(Shift, int);
+  vtkGetVector2Macro(Shift, int);
+
+  // Description:
+  // Pixels with values between the lower and upper threshold are taken
+  // to be the background of the overlay, all others are the text.
+  vtkSetMacro(LowerThreshold, double);
+  vtkGetMacro(LowerThreshold, double);
+  vtkSetMacro(UpperThreshold, double);
+  vtkGetMacro(UpperThreshold, double);
+
+  // Description:
+  // Set the position of one of the six probes of a digit, relative to the
+  // position of the digit, in reference pixels.  The default probes are
+  // for the digits of the rotation shown by the adult TEE probe.
+  void SetDigitProbe(int i, int x, int y);
+
+  // Description:
+  // Add a field, and return its index.  The position (in reference
+  // pixels, y down from the top) is that of the least significant digit,
+  // and the step is the x distance from each digit to the next more
+  // significant one.  Returns -1 if there is no room for the field.
+  int AddField(int x, int y, int numberOfDigits, int digitStep);
+  void RemoveAllFields();
+  int GetNumberOfFields() { return this->NumberOfFields; };
+
+  // Description:
+  // Decode a field from the frame.  A number is made from the least
+  // significant digit up to the first digit that cannot be read.  The
+  // return value is -1 if the least significant digit cannot be read,
+  // or if the field lies outside of the frame.
+  int DecodeField(vtkImageData *frame, int field);
+
+  // Description:
+  // The number of times that DecodeField() returned a cached value,
+  // rather than reading the digits again.
+  vtkGetMacro(NumberOfCacheHits, int);
+
+protected:
+  vtkUltrasoundAnnotationDecoder();
+  ~vtkUltrasoundAnnotationDecoder() {};
+
+//BTX
+  struct Field
+  {
+    int Position[2];
+    int NumberOfDigits;
+    int DigitStep;
+    // the cache
+    int Value;
+    unsigned long Hash;
+    vtkTimeStamp DecodeTime;
+  };
+//ETX
+
+  int ReferenceSize[2];
+  int Shift[2];
+  double LowerThreshold;
+  double UpperThreshold;
+  int DigitProbes[VTK_ANNOTATION_PROBES][2];
+  Field Fields[VTK_ANNOTATION_MAX_FIELDS];
+  int NumberOfFields;
+  int NumberOfCacheHits;
+
+  // the glyph table, indexed by the probe pattern
+  int Glyphs[1 << VTK_ANNOTATION_PROBES];
+
+private:
+  vtkUltrasoundAnnotationDecoder(const vtkUltrasoundAnnotationDecoder&);
+  void operator=(const vtkUltrasoundAnnotationDecoder&);
+};
+
+#endif
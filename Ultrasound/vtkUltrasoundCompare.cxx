@@ -43,8 +43,11 @@ POSSIBILITY OF SUCH DAMAGES.
 #include "vtkUltrasoundCompare.h"
 
 #include "vtkImageData.h"
+#include "vtkMultiThreader.h"
 #include "vtkObjectFactory.h"
 
+#include <math.h>
+
 //----------------------------------------------------------------------------
 vtkUltrasoundCompare* vtkUltrasoundCompare::New()
 {
@@ -61,15 +64,21 @@ vtkUltrasoundCompare* vtkUltrasoundCompare::New()
 // Construct object to extract all of the input data.
 vtkUltrasoundCompare::vtkUltrasoundCompare()
 {
-  int i;
-  for ( i = 0; i < this->NumberOfThreads; i++ )
+  this->Metric = VTK_COMPARE_SAD;
+  memset(this->Partials, 0, sizeof(this->Partials));
+  this->OffsetPartials = NULL;
+  this->OffsetPartialsSize = 0;
+}
+
+//----------------------------------------------------------------------------
+vtkUltrasoundCompare::~vtkUltrasoundCompare()
+{
+  if (this->OffsetPartials)
     {
-    this->ErrorPerThread[i] = 0.0;
-    this->PixelCountPerThread[i] = 0;
+    delete [] this->OffsetPartials;
     }
 }
 
-
 //----------------------------------------------------------------------------
 // This method computes the input extent necessary to generate the output.
 void vtkUltrasoundCompare::ComputeInputUpdateExtent(int inExt[6],
@@ -83,76 +92,142 @@ void vtkUltrasoundCompare::ComputeInputUpdateExtent(int inExt[6],
 }
 
 //----------------------------------------------------------------------------
-void vtkUltrasoundCompare::ThreadedExecute(vtkImageData **inData, 
-                                           vtkImageData *outData,
-                                           int outExt[6], int id)
+static int vtkUltrasoundCompareSupportedType(int scalarType)
 {
-  unsigned char *in1Ptr0, *in1Ptr1, *in1Ptr2;
-  unsigned char *in2Ptr0, *in2Ptr1, *in2Ptr2;
-  unsigned char *outPtr0, *outPtr1, *outPtr2;
-  int min0, max0, min1, max1, min2, max2;
-  int idx0, idx1, idx2;
-  vtkIdType in1Inc0, in1Inc1, in1Inc2;
-  vtkIdType in2Inc0, in2Inc1, in2Inc2;
-  vtkIdType outInc0, outInc1, outInc2;
-  int alpha1 = 0;
-  int alpha2 = 0;
-  int alphaO = 0;
-  unsigned long count = 0;
-  unsigned long target;
+  return (scalarType == VTK_UNSIGNED_CHAR ||
+          scalarType == VTK_SHORT ||
+          scalarType == VTK_UNSIGNED_SHORT ||
+          scalarType == VTK_FLOAT);
+}
 
-  double errorval = 0;
-  int pixelcount = 0;
-  
-  // these are the values returned if an error occurs
-  this->ErrorPerThread[id] = 0;
-  this->PixelCountPerThread[id] = 1;
-  
-  if (inData[0] == NULL || inData[1] == NULL || outData == NULL)
+//----------------------------------------------------------------------------
+// Accumulate the comparison sums for a run of n pixels.  Each alpha
+// pointer points at the alpha component of the first pixel, or at a
+// constant opaque value with an increment of zero if that image has no
+// alpha.  The loop has no branches and keeps its sums in locals so that
+// the compiler can vectorize it.
+template <class T>
+static void vtkUltrasoundCompareAccumulate(const T *in1Ptr,
+                                           const T *alpha1Ptr,
+                                           vtkIdType in1Inc,
+                                           vtkIdType alpha1Inc,
+                                           const T *in2Ptr,
+                                           const T *alpha2Ptr,
+                                           vtkIdType in2Inc,
+                                           vtkIdType alpha2Inc,
+                                           int n,
+                                           vtkUltrasoundComparePartial *partial)
+{
+  double sumAbs = 0, sumSq = 0, count = 0;
+  double sum1 = 0, sum2 = 0, sum11 = 0, sum22 = 0, sum12 = 0;
+
+  for (int i = 0; i < n; i++)
     {
-    if (!id)
-      {
-      vtkErrorMacro(<< "Execute: Missing data");
-      }
-    return;
+    double m = (alpha1Ptr[0] == 255 && alpha2Ptr[0] == 255);
+    double a = m*in1Ptr[0];
+    double b = m*in2Ptr[0];
+    double d = a - b;
+
+    count += m;
+    sumAbs += fabs(d);
+    sumSq += d*d;
+    sum1 += a;
+    sum2 += b;
+    sum11 += a*a;
+    sum22 += b*b;
+    sum12 += a*b;
+
+    in1Ptr += in1Inc;
+    in2Ptr += in2Inc;
+    alpha1Ptr += alpha1Inc;
+    alpha2Ptr += alpha2Inc;
     }
 
-  if (inData[0]->GetNumberOfScalarComponents() > 2 ||
-      inData[1]->GetNumberOfScalarComponents() > 2 ||
-      outData->GetNumberOfScalarComponents() > 2)
+  partial->SumAbs += sumAbs;
+  partial->SumSq += sumSq;
+  partial->Sum1 += sum1;
+  partial->Sum2 += sum2;
+  partial->Sum11 += sum11;
+  partial->Sum22 += sum22;
+  partial->Sum12 += sum12;
+  partial->Count += count;
+}
+
+//----------------------------------------------------------------------------
+// Write the absolute difference image for a run of n pixels, clamped
+// to the range of the output type.
+template <class T>
+static void vtkUltrasoundCompareDifference(const T *in1Ptr,
+                                           const T *alpha1Ptr,
+                                           vtkIdType in1Inc,
+                                           vtkIdType alpha1Inc,
+                                           const T *in2Ptr,
+                                           const T *alpha2Ptr,
+                                           vtkIdType in2Inc,
+                                           vtkIdType alpha2Inc,
+                                           T *outPtr, vtkIdType outInc,
+                                           int alphaO, double outMax, int n)
+{
+  for (int i = 0; i < n; i++)
     {
-    if (!id)
+    int inmask = (alpha1Ptr[0] == 255 && alpha2Ptr[0] == 255);
+    double diff = fabs((double)in1Ptr[0] - (double)in2Ptr[0]);
+    if (diff > outMax)
       {
-      vtkErrorMacro(<< "Execute: RGB images are not supported");
+      diff = outMax;
       }
-    return;
-    }
-    
-  // this filter expects that input is the same type as output.
-  if (inData[0]->GetScalarType() != VTK_UNSIGNED_CHAR || 
-      inData[1]->GetScalarType() != VTK_UNSIGNED_CHAR || 
-      outData->GetScalarType() != VTK_UNSIGNED_CHAR)
+    outPtr[0] = (T)(inmask*diff);
+    if (alphaO)
       {
-      if (!id)
-        {
-        vtkErrorMacro(<< "Execute: All ScalarTypes must be unsigned char");
-        }
-      return;
+      outPtr[1] = (T)(inmask*255);
       }
-  
-  alpha1 = (inData[0]->GetNumberOfScalarComponents() > 1);
-  alpha2 = (inData[1]->GetNumberOfScalarComponents() > 1);
-  alphaO = (outData->GetNumberOfScalarComponents() > 1);
 
-  in1Ptr2 = (unsigned char *) inData[0]->GetScalarPointerForExtent(outExt);  
-  in2Ptr2 = (unsigned char *) inData[1]->GetScalarPointerForExtent(outExt);  
-  outPtr2 = (unsigned char *) outData->GetScalarPointerForExtent(outExt);  
+    outPtr += outInc;
+    in1Ptr += in1Inc;
+    in2Ptr += in2Inc;
+    alpha1Ptr += alpha1Inc;
+    alpha2Ptr += alpha2Inc;
+    }
+}
+
+//----------------------------------------------------------------------------
+template <class T>
+static void vtkUltrasoundCompareExecute(vtkUltrasoundCompare *self,
+                                        vtkImageData **inData,
+                                        vtkImageData *outData,
+                                        int outExt[6], int id,
+                                        vtkUltrasoundComparePartial *partial,
+                                        T *)
+{
+  T *in1Ptr1, *in1Ptr2;
+  T *in2Ptr1, *in2Ptr2;
+  T *outPtr1, *outPtr2;
+  int min1, max1, min2, max2;
+  int idx1, idx2;
+  vtkIdType in1Inc0, in1Inc1, in1Inc2;
+  vtkIdType in2Inc0, in2Inc1, in2Inc2;
+  vtkIdType outInc0, outInc1, outInc2;
+  vtkIdType alpha1Inc, alpha2Inc;
+  unsigned long count = 0;
+  unsigned long target;
+  T opaque = 255;
+
+  int alpha1 = (inData[0]->GetNumberOfScalarComponents() > 1);
+  int alpha2 = (inData[1]->GetNumberOfScalarComponents() > 1);
+  int alphaO = (outData->GetNumberOfScalarComponents() > 1);
+  double outMax = outData->GetScalarTypeMax();
+
+  in1Ptr2 = (T *) inData[0]->GetScalarPointerForExtent(outExt);  
+  in2Ptr2 = (T *) inData[1]->GetScalarPointerForExtent(outExt);  
+  outPtr2 = (T *) outData->GetScalarPointerForExtent(outExt);  
 
   inData[0]->GetIncrements(in1Inc0, in1Inc1, in1Inc2);
   inData[1]->GetIncrements(in2Inc0, in2Inc1, in2Inc2);
   outData->GetIncrements(outInc0, outInc1, outInc2);
+  alpha1Inc = (alpha1 ? in1Inc0 : 0);
+  alpha2Inc = (alpha2 ? in2Inc0 : 0);
   
-  min0 = outExt[0];  max0 = outExt[1];
+  int n = outExt[1] - outExt[0] + 1;
   min1 = outExt[2];  max1 = outExt[3];
   min2 = outExt[4];  max2 = outExt[5];
   
@@ -164,55 +239,27 @@ void vtkUltrasoundCompare::ThreadedExecute(vtkImageData **inData,
     in1Ptr1 = in1Ptr2;
     in2Ptr1 = in2Ptr2;
     outPtr1 = outPtr2;
-    for (idx1 = min1; !this->AbortExecute && idx1 <= max1; ++idx1)
+    for (idx1 = min1; !self->GetAbortExecute() && idx1 <= max1; ++idx1)
       {
       if (!id) 
         {
         if (!(count%target))
           {
-          this->UpdateProgress(count/(50.0*target));
+          self->UpdateProgress(count/(50.0*target));
           }
         count++;
         }
-      in1Ptr0 = in1Ptr1;
-      in2Ptr0 = in2Ptr1;
-      outPtr0 = outPtr1;
-      for (idx0 = min0; idx0 <= max0; ++idx0)
-        {
-        int inmask = 1;
-        if (alpha1 && in1Ptr0[1] != 255)
-          {
-          inmask = 0;
-          }
-        else if (alpha2 && in2Ptr0[1] != 255)
-          {
-          inmask = 0;
-          }
-        if (inmask) 
-          {
-          pixelcount++;
-          int diff = in1Ptr0[0] - in2Ptr0[0];
-          if (diff < 0)
-            {
-            diff = -diff;
-            }
-          errorval += diff;
-
-          outPtr0[0] = diff;
-          }
-        else
-          {
-          outPtr0[0] = 0;
-          }
-        if (alphaO)
-          {
-          outPtr0[1] = inmask*255;
-          }
-            
-        outPtr0 += outInc0;
-        in1Ptr0 += in1Inc0;
-        in2Ptr0 += in2Inc0;
-        }
+
+      const T *alpha1Ptr = (alpha1 ? in1Ptr1 + 1 : &opaque);
+      const T *alpha2Ptr = (alpha2 ? in2Ptr1 + 1 : &opaque);
+
+      vtkUltrasoundCompareAccumulate(in1Ptr1, alpha1Ptr, in1Inc0, alpha1Inc,
+                                     in2Ptr1, alpha2Ptr, in2Inc0, alpha2Inc,
+                                     n, partial);
+      vtkUltrasoundCompareDifference(in1Ptr1, alpha1Ptr, in1Inc0, alpha1Inc,
+                                     in2Ptr1, alpha2Ptr, in2Inc0, alpha2Inc,
+                                     outPtr1, outInc0, alphaO, outMax, n);
+
       outPtr1 += outInc1;
       in1Ptr1 += in1Inc1;
       in2Ptr1 += in2Inc1;
@@ -221,9 +268,82 @@ void vtkUltrasoundCompare::ThreadedExecute(vtkImageData **inData,
     in1Ptr2 += in1Inc2;
     in2Ptr2 += in2Inc2;
     }
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundCompare::ThreadedExecute(vtkImageData **inData, 
+                                           vtkImageData *outData,
+                                           int outExt[6], int id)
+{
+  vtkUltrasoundComparePartial *partial = &this->Partials[id];
+
+  // these are the values returned if an error occurs
+  memset(partial, 0, sizeof(vtkUltrasoundComparePartial));
+  partial->Count = 1;
+  
+  if (inData[0] == NULL || inData[1] == NULL || outData == NULL)
+    {
+    if (!id)
+      {
+      vtkErrorMacro(<< "Execute: Missing data");
+      }
+    return;
+    }
 
-  this->ErrorPerThread[id] = errorval;
-  this->PixelCountPerThread[id] = pixelcount;
+  if (inData[0]->GetNumberOfScalarComponents() > 2 ||
+      inData[1]->GetNumberOfScalarComponents() > 2 ||
+      outData->GetNumberOfScalarComponents() > 2)
+    {
+    if (!id)
+      {
+      vtkErrorMacro(<< "Execute: RGB images are not supported");
+      }
+    return;
+    }
+    
+  // this filter expects that input is the same type as output.
+  int scalarType = inData[0]->GetScalarType();
+  if (inData[1]->GetScalarType() != scalarType || 
+      outData->GetScalarType() != scalarType)
+    {
+    if (!id)
+      {
+      vtkErrorMacro(<< "Execute: All ScalarTypes must be the same");
+      }
+    return;
+    }
+
+  if (!vtkUltrasoundCompareSupportedType(scalarType))
+    {
+    if (!id)
+      {
+      vtkErrorMacro(<< "Execute: ScalarType must be unsigned char, "
+                    "short, unsigned short or float");
+      }
+    return;
+    }
+
+  partial->Count = 0;
+
+  switch (scalarType)
+    {
+    case VTK_UNSIGNED_CHAR:
+      vtkUltrasoundCompareExecute(this, inData, outData, outExt, id,
+                                  partial, (unsigned char *)0);
+      break;
+    case VTK_SHORT:
+      vtkUltrasoundCompareExecute(this, inData, outData, outExt, id,
+                                  partial, (short *)0);
+      break;
+    case VTK_UNSIGNED_SHORT:
+      vtkUltrasoundCompareExecute(this, inData, outData, outExt, id,
+                                  partial, (unsigned short *)0);
+      break;
+    case VTK_FLOAT:
+      vtkUltrasoundCompareExecute(this, inData, outData, outExt, id,
+                                  partial, (float *)0);
+      break;
+    }
 }
 
 //----------------------------------------------------------------------------
@@ -253,8 +373,8 @@ void vtkUltrasoundCompare::ExecuteInformation(vtkImageData **inputs,
     {
     for (i = 0; i < this->NumberOfThreads; i++)
       {
-      this->ErrorPerThread[i] = 0;
-      this->PixelCountPerThread[i] = 1;
+      memset(&this->Partials[i], 0, sizeof(vtkUltrasoundComparePartial));
+      this->Partials[i].Count = 1;
       }
     vtkErrorMacro("ExecuteInformation: Input are not the same size.");
     }
@@ -282,45 +402,358 @@ void vtkUltrasoundCompare::ExecuteInformation(vtkImageData **inputs,
         inputs[0]->GetNumberOfScalarComponents());
 }
 
-double vtkUltrasoundCompare::GetError()
+//----------------------------------------------------------------------------
+// The information shared by the threads of EvaluateOffsets()
+struct vtkCompareOffsetStruct
 {
-  double error = 0.0;
-  int i;
+  vtkImageData *Inputs[2];
+  int NumberOfOffsets;
+  const int (*Offsets)[3];
+  vtkUltrasoundComparePartial *Partials;
+};
 
-  for (i = 0; i < this->NumberOfThreads; i++ )
+//----------------------------------------------------------------------------
+// Accumulate the sums for all of the offsets over the rows from r0 to
+// r1-1 of the first input.  Each row of the first input is compared
+// against all of the candidates while it is still in the cache.
+template <class T>
+static void vtkCompareOffsetExecute(vtkCompareOffsetStruct *str,
+                                    int r0, int r1,
+                                    vtkUltrasoundComparePartial *partials,
+                                    T *)
+{
+  vtkImageData *in1Data = str->Inputs[0];
+  vtkImageData *in2Data = str->Inputs[1];
+  int *ext1 = in1Data->GetExtent();
+  int *ext2 = in2Data->GetExtent();
+  vtkIdType in1Inc[3], in2Inc[3];
+  T opaque = 255;
+
+  in1Data->GetIncrements(in1Inc);
+  in2Data->GetIncrements(in2Inc);
+  T *in1Base = (T *)in1Data->GetScalarPointerForExtent(ext1);
+  T *in2Base = (T *)in2Data->GetScalarPointerForExtent(ext2);
+  int alpha1 = (in1Data->GetNumberOfScalarComponents() > 1);
+  int alpha2 = (in2Data->GetNumberOfScalarComponents() > 1);
+  vtkIdType alpha1Inc = (alpha1 ? in1Inc[0] : 0);
+  vtkIdType alpha2Inc = (alpha2 ? in2Inc[0] : 0);
+  int numRows = ext1[3] - ext1[2] + 1;
+
+  for (int r = r0; r < r1; r++)
+    {
+    int idY = ext1[2] + r % numRows;
+    int idZ = ext1[4] + r / numRows;
+    T *in1Row = in1Base + (idY - ext1[2])*in1Inc[1] +
+      (idZ - ext1[4])*in1Inc[2];
+
+    for (int k = 0; k < str->NumberOfOffsets; k++)
+      {
+      const int *offset = str->Offsets[k];
+      int idY2 = idY + offset[1];
+      int idZ2 = idZ + offset[2];
+      if (idY2 < ext2[2] || idY2 > ext2[3] ||
+          idZ2 < ext2[4] || idZ2 > ext2[5])
+        {
+        continue;
+        }
+
+      // clip the row to the overlap with the shifted second input
+      int idX0 = ext1[0];
+      int idX1 = ext1[1];
+      if (idX0 + offset[0] < ext2[0])
+        {
+        idX0 = ext2[0] - offset[0];
+        }
+      if (idX1 + offset[0] > ext2[1])
+        {
+        idX1 = ext2[1] - offset[0];
+        }
+      if (idX0 > idX1)
+        {
+        continue;
+        }
+
+      T *in1Ptr = in1Row + (idX0 - ext1[0])*in1Inc[0];
+      T *in2Ptr = in2Base + (idX0 + offset[0] - ext2[0])*in2Inc[0] +
+        (idY2 - ext2[2])*in2Inc[1] + (idZ2 - ext2[4])*in2Inc[2];
+
+      vtkUltrasoundCompareAccumulate(in1Ptr,
+                                     (alpha1 ? in1Ptr + 1 : &opaque),
+                                     in1Inc[0], alpha1Inc,
+                                     in2Ptr,
+                                     (alpha2 ? in2Ptr + 1 : &opaque),
+                                     in2Inc[0], alpha2Inc,
+                                     idX1 - idX0 + 1, &partials[k]);
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+static VTK_THREAD_RETURN_TYPE vtkCompareOffsetThread(void *arg)
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  int threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  vtkCompareOffsetStruct *str = (vtkCompareOffsetStruct *)
+    (((ThreadInfoStruct *)(arg))->UserData);
+
+  // split the rows of the first input between the threads
+  int *ext = str->Inputs[0]->GetExtent();
+  int numRows = (ext[3] - ext[2] + 1)*(ext[5] - ext[4] + 1);
+  int r0 = (int)(((double)numRows*threadId)/threadCount);
+  int r1 = (int)(((double)numRows*(threadId + 1))/threadCount);
+  vtkUltrasoundComparePartial *partials =
+    &str->Partials[threadId*str->NumberOfOffsets];
+
+  switch (str->Inputs[0]->GetScalarType())
     {
-    error += this->ErrorPerThread[i];
+    case VTK_UNSIGNED_CHAR:
+      vtkCompareOffsetExecute(str, r0, r1, partials, (unsigned char *)0);
+      break;
+    case VTK_SHORT:
+      vtkCompareOffsetExecute(str, r0, r1, partials, (short *)0);
+      break;
+    case VTK_UNSIGNED_SHORT:
+      vtkCompareOffsetExecute(str, r0, r1, partials, (unsigned short *)0);
+      break;
+    case VTK_FLOAT:
+      vtkCompareOffsetExecute(str, r0, r1, partials, (float *)0);
+      break;
     }
 
-  return error;
+  return VTK_THREAD_RETURN_VALUE;
 }
 
-int vtkUltrasoundCompare::GetPixelCount()
+//----------------------------------------------------------------------------
+int vtkUltrasoundCompare::EvaluateOffsets(int n, const int (*offsets)[3],
+                                          double *results)
+{
+  vtkImageData *inputs[2];
+  int i, k;
+
+  inputs[0] = this->GetInput(0);
+  inputs[1] = this->GetInput(1);
+  if (inputs[0] == NULL || inputs[1] == NULL)
+    {
+    vtkErrorMacro(<< "EvaluateOffsets: Input is not set.");
+    return 0;
+    }
+
+  for (i = 0; i < 2; i++)
+    {
+    inputs[i]->UpdateInformation();
+    inputs[i]->SetUpdateExtentToWholeExtent();
+    inputs[i]->Update();
+    }
+
+  int scalarType = inputs[0]->GetScalarType();
+  if (inputs[1]->GetScalarType() != scalarType ||
+      !vtkUltrasoundCompareSupportedType(scalarType))
+    {
+    vtkErrorMacro(<< "EvaluateOffsets: ScalarTypes must be the same, and "
+                  "must be unsigned char, short, unsigned short or float");
+    return 0;
+    }
+
+  if (inputs[0]->GetNumberOfScalarComponents() > 2 ||
+      inputs[1]->GetNumberOfScalarComponents() > 2)
+    {
+    vtkErrorMacro(<< "EvaluateOffsets: RGB images are not supported");
+    return 0;
+    }
+
+  if (n <= 0)
+    {
+    return 1;
+    }
+
+  // the partials are kept between calls, since an optimizer will
+  // call this method many times with the same number of candidates
+  int numThreads = this->NumberOfThreads;
+  int size = numThreads*n;
+  if (this->OffsetPartialsSize < size)
+    {
+    if (this->OffsetPartials)
+      {
+      delete [] this->OffsetPartials;
+      }
+    this->OffsetPartials = new vtkUltrasoundComparePartial[size];
+    this->OffsetPartialsSize = size;
+    }
+  memset(this->OffsetPartials, 0, size*sizeof(vtkUltrasoundComparePartial));
+
+  vtkCompareOffsetStruct str;
+  str.Inputs[0] = inputs[0];
+  str.Inputs[1] = inputs[1];
+  str.NumberOfOffsets = n;
+  str.Offsets = offsets;
+  str.Partials = this->OffsetPartials;
+
+  this->Threader->SetNumberOfThreads(numThreads);
+  this->Threader->SetSingleMethod(vtkCompareOffsetThread, &str);
+  this->Threader->SingleMethodExecute();
+
+  // reduce the per-thread partials for each candidate
+  for (k = 0; k < n; k++)
+    {
+    vtkUltrasoundComparePartial total = this->OffsetPartials[k];
+    for (i = 1; i < numThreads; i++)
+      {
+      vtkUltrasoundComparePartial *partial = &this->OffsetPartials[i*n + k];
+      total.SumAbs += partial->SumAbs;
+      total.SumSq += partial->SumSq;
+      total.Sum1 += partial->Sum1;
+      total.Sum2 += partial->Sum2;
+      total.Sum11 += partial->Sum11;
+      total.Sum22 += partial->Sum22;
+      total.Sum12 += partial->Sum12;
+      total.Count += partial->Count;
+      }
+    results[k] = this->ComputeMetric(&total);
+    }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+double vtkUltrasoundCompare::EvaluateOffset(int dx, int dy, int dz)
+{
+  int offset[1][3];
+  double result = 0.0;
+
+  offset[0][0] = dx;
+  offset[0][1] = dy;
+  offset[0][2] = dz;
+  this->EvaluateOffsets(1, offset, &result);
+
+  return result;
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundCompare::GetTotals(vtkUltrasoundComparePartial *total)
 {
-  int count = 0;
   int i;
 
+  memset(total, 0, sizeof(vtkUltrasoundComparePartial));
   for (i = 0; i < this->NumberOfThreads; i++ )
     {
-    count += this->PixelCountPerThread[i];
+    total->SumAbs += this->Partials[i].SumAbs;
+    total->SumSq += this->Partials[i].SumSq;
+    total->Sum1 += this->Partials[i].Sum1;
+    total->Sum2 += this->Partials[i].Sum2;
+    total->Sum11 += this->Partials[i].Sum11;
+    total->Sum22 += this->Partials[i].Sum22;
+    total->Sum12 += this->Partials[i].Sum12;
+    total->Count += this->Partials[i].Count;
     }
+}
+
+//----------------------------------------------------------------------------
+double vtkUltrasoundCompare::ComputeMetric(
+  const vtkUltrasoundComparePartial *total)
+{
+  double n = total->Count;
+
+  if (n <= 0)
+    {
+    return 0.0;
+    }
+
+  if (this->Metric == VTK_COMPARE_SSD)
+    {
+    return total->SumSq/n;
+    }
+  else if (this->Metric == VTK_COMPARE_NCC)
+    {
+    double cov = total->Sum12 - total->Sum1*total->Sum2/n;
+    double var1 = total->Sum11 - total->Sum1*total->Sum1/n;
+    double var2 = total->Sum22 - total->Sum2*total->Sum2/n;
+    if (var1 <= 0 || var2 <= 0)
+      {
+      return 0.0;
+      }
+    return cov/sqrt(var1*var2);
+    }
+
+  return total->SumAbs/n;
+}
+
+//----------------------------------------------------------------------------
+double vtkUltrasoundCompare::GetError()
+{
+  vtkUltrasoundComparePartial total;
+  this->GetTotals(&total);
+
+  return total.SumAbs;
+}
 
-  return count;
+//----------------------------------------------------------------------------
+double vtkUltrasoundCompare::GetSumOfSquaredDifferences()
+{
+  vtkUltrasoundComparePartial total;
+  this->GetTotals(&total);
+
+  return total.SumSq;
 }
 
+//----------------------------------------------------------------------------
+double vtkUltrasoundCompare::GetNormalizedCrossCorrelation()
+{
+  vtkUltrasoundComparePartial total;
+  this->GetTotals(&total);
+
+  int metric = this->Metric;
+  this->Metric = VTK_COMPARE_NCC;
+  double ncc = this->ComputeMetric(&total);
+  this->Metric = metric;
+
+  return ncc;
+}
+
+//----------------------------------------------------------------------------
+double vtkUltrasoundCompare::GetMetricValue()
+{
+  vtkUltrasoundComparePartial total;
+  this->GetTotals(&total);
+
+  return this->ComputeMetric(&total);
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundCompare::GetPixelCount()
+{
+  vtkUltrasoundComparePartial total;
+  this->GetTotals(&total);
+
+  return (int)total.Count;
+}
+
+//----------------------------------------------------------------------------
+const char *vtkUltrasoundCompare::GetMetricAsString()
+{
+  switch (this->Metric)
+    {
+    case VTK_COMPARE_SSD:
+      return "SSD";
+    case VTK_COMPARE_NCC:
+      return "NCC";
+    }
+  return "SAD";
+}
+
+//----------------------------------------------------------------------------
 void vtkUltrasoundCompare::PrintSelf(ostream& os, vtkIndent indent)
 {
   this->Superclass::PrintSelf(os,indent);
   
   int i;
 
+  os << indent << "Metric: " << this->GetMetricAsString() << "\n";
   for ( i= 0; i < this->NumberOfThreads; i++ )
     {
-    os << indent << "Error for thread " << i << ": " << this->ErrorPerThread[i] << "\n";
-    os << indent << "PixelCount for thread " << i << ": " << this->PixelCountPerThread[i] << "\n";
+    os << indent << "Error for thread " << i << ": " << this->Partials[i].SumAbs << "\n";
+    os << indent << "PixelCount for thread " << i << ": " << this->Partials[i].Count << "\n";
     }
   os << indent << "Error: " << this->GetError() << "\n";
   os << indent << "PixelCount: " << this->GetPixelCount() << "\n";
+  os << indent << "MetricValue: " << this->GetMetricValue() << "\n";
 }
-
-
@@ -44,13 +44,43 @@ POSSIBILITY OF SUCH DAMAGES.
 // vtkUltrasoundCompare takes two images and compares them and calculates
 // statistics on them.  If either image has an alpha channel associated
 // with it, then the images are compared only for pixels with an alpha
-// value of 255 (i.e. 1.0).
+// value of 255 (i.e. 1.0).  The inputs must have the same scalar type,
+// which can be unsigned char, short, unsigned short or float.  The sum
+// of absolute differences, the sum of squared differences and the
+// normalized cross correlation are all computed in the same pass, and
+// the Metric selects which of them GetMetricValue() reports.
+// EvaluateOffsets() computes the metric for a whole set of candidate
+// offsets of the second image in a single pass over the first image,
+// which is much cheaper than re-executing the filter once per candidate
+// inside of a calibration optimizer.
 
 #ifndef __vtkUltrasoundCompare_h
 #define __vtkUltrasoundCompare_h
 
 #include "vtkImageTwoInputFilter.h"
 
+#define VTK_COMPARE_SAD 0
+#define VTK_COMPARE_SSD 1
+#define VTK_COMPARE_NCC 2
+
+//BTX
+// Partial sums for one thread.  The sums are followed by a full cache
+// line of padding, so that threads which are accumulating into adjacent
+// entries never write to the same cache line.
+struct vtkUltrasoundComparePartial
+{
+  double SumAbs;
+  double SumSq;
+  double Sum1;
+  double Sum2;
+  double Sum11;
+  double Sum22;
+  double Sum12;
+  double Count;
+  double Pad[8];
+};
+//ETX
+
 class VTK_EXPORT vtkUltrasoundCompare : public vtkImageTwoInputFilter
 {
 public:
@@ -58,22 +88,74 @@ public:
   vtkTypeMacro(vtkUltrasoundCompare,vtkImageTwoInputFilter);
   void PrintSelf(ostream& os, vtkIndent indent);
 
+  // Description:
+  // Set the metric that is reported by GetMetricValue() and by
+  // EvaluateOffsets().  SAD and SSD are the mean absolute and mean
+  // squared differences over the compared pixels (smaller is better),
+  // NCC is the normalized cross correlation (larger is better).
+  // The default is SAD.
+  vtkSetClampMacro(Metric,int,VTK_COMPARE_SAD,VTK_COMPARE_NCC);
+  vtkGetMacro(Metric,int);
+  void SetMetricToSAD() { this->SetMetric(VTK_COMPARE_SAD); };
+  void SetMetricToSSD() { this->SetMetric(VTK_COMPARE_SSD); };
+  void SetMetricToNCC() { this->SetMetric(VTK_COMPARE_NCC); };
+  const char *GetMetricAsString();
+
   // Description:
   // Get the error between the images, i.e. the sum of the
   // absolute value all the pixel differences.
   double GetError();
+
+  // Description:
+  // Get the sum of the squared pixel differences.
+  double GetSumOfSquaredDifferences();
+
+  // Description:
+  // Get the normalized cross correlation between the images, or zero
+  // if either image is constant over the compared pixels.
+  double GetNormalizedCrossCorrelation();
+
+  // Description:
+  // Get the value of the selected Metric for the last execution.
+  double GetMetricValue();
   
   // Description:
   // Get the number of pixels that were compared.  This will depend
   // on the alpha channel of the images.
   int GetPixelCount();
 
+  // Description:
+  // Compute the selected Metric with the second input shifted by the
+  // offset (dx,dy,dz), in pixels, i.e. pixel (i,j,k) of the first input
+  // is compared with pixel (i+dx,j+dy,k+dz) of the second input.  Only
+  // the overlap of the two images is compared.  The output is not
+  // modified.
+  double EvaluateOffset(int dx, int dy, int dz);
+
+//BTX
+  // Description:
+  // Compute the selected Metric for n candidate offsets at once, where
+  // offsets holds the n (dx,dy,dz) triplets and the n metric values
+  // are stored in results.  The inputs are traversed only once for
+  // all the candidates.  Candidates with no overlapping pixels give a
+  // result of zero.  The return value is zero if an error occurred.
+  int EvaluateOffsets(int n, const int (*offsets)[3], double *results);
+//ETX
+
 protected:
   vtkUltrasoundCompare();
-  ~vtkUltrasoundCompare() {};
+  ~vtkUltrasoundCompare();
+
+  int Metric;
+
+//BTX
+  vtkUltrasoundComparePartial Partials[VTK_MAX_THREADS];
+  vtkUltrasoundComparePartial *OffsetPartials;
+  int OffsetPartialsSize;
 
-  double ErrorPerThread[VTK_MAX_THREADS];
-  int PixelCountPerThread[VTK_MAX_THREADS];
+  void GetTotals(vtkUltrasoundComparePartial *total);
+  double ComputeMetric(const vtkUltrasoundComparePartial *total);
+//ETX
   
   void ExecuteInformation(vtkImageData **inputs, vtkImageData *output); 
   void ComputeInputUpdateExtent(int inExt[6], int outExt[6],
@@ -67,6 +67,33 @@ vtkUltrasoundFan* vtkUltrasoundFan::New()
 
 #define DEGREES_TO_RADIANS (3.14159265359/180.0)
 
+//----------------------------------------------------------------------------
+// The scan-conversion table.  The input and output share the same x
+// axis, so everything except the x range depends only on the output row
+// (y,z): each row stores the two input depth (y) and theta (z) indices
+// to blend, their weights, and the range of x that lies within the fan.
+// Rows outside the input have MinX > MaxX.
+struct vtkUltrasoundFanRow
+{
+  int MinX;
+  int MaxX;
+  int Depth[2];
+  int Theta[2];
+  int NearestDepth;
+  int NearestTheta;
+  float Weight[4];
+};
+
+struct vtkUltrasoundFanPlan
+{
+  vtkUltrasoundFanRow *Rows;
+  int Extent[6];
+  int InputExtent[6];
+  float InputOrigin[3];
+  float InputSpacing[3];
+  vtkTimeStamp BuildTime;
+};
+
 //----------------------------------------------------------------------------
 vtkUltrasoundFan::vtkUltrasoundFan()
 {
@@ -78,12 +105,34 @@ vtkUltrasoundFan::vtkUltrasoundFan()
   this->MaximumDepth = 1000;
   this->FanAngleExtent[0] = -90.0;
   this->FanAngleExtent[1] = +90.0;
+
+  this->Plan = new vtkUltrasoundFanPlan;
+  this->Plan->Rows = NULL;
 }
 
 //----------------------------------------------------------------------------
 vtkUltrasoundFan::~vtkUltrasoundFan()
 {
   this->SetRotationAngles(NULL);
+  delete [] this->Plan->Rows;
+  delete this->Plan;
+}
+
+//----------------------------------------------------------------------------
+unsigned long vtkUltrasoundFan::GetMTime()
+{
+  unsigned long mTime = this->vtkImageToImageFilter::GetMTime();
+
+  if (this->RotationAngles)
+    {
+    unsigned long t = this->RotationAngles->GetMTime();
+    if (t > mTime)
+      {
+      mTime = t;
+      }
+    }
+
+  return mTime;
 }
 
 //----------------------------------------------------------------------------
@@ -250,6 +299,199 @@ static double vtkGetThetaIndexFromTable(vtkDoubleArray *table, double theta)
     }   
 }
 
+//----------------------------------------------------------------------------
+// Compute the polar coordinates and interpolation weights of every output
+// row, this only has to be redone when the geometry changes
+void vtkUltrasoundFan::UpdatePlan()
+{
+  vtkUltrasoundFanPlan *plan = this->Plan;
+  float inOrigin[3];
+  float inSpacing[3];
+  int inExt[6];
+  int i;
+
+  this->GetInput()->GetOrigin(inOrigin);
+  this->GetInput()->GetSpacing(inSpacing);
+  this->GetInput()->GetWholeExtent(inExt);
+
+  // check whether the table is still valid
+  int valid = (plan->Rows != NULL &&
+               plan->BuildTime.GetMTime() > this->GetMTime());
+  for (i = 0; i < 6 && valid; i++)
+    {
+    valid = (plan->Extent[i] == this->OutputExtent[i] &&
+             plan->InputExtent[i] == inExt[i]);
+    }
+  for (i = 0; i < 3 && valid; i++)
+    {
+    valid = (plan->InputOrigin[i] == inOrigin[i] &&
+             plan->InputSpacing[i] == inSpacing[i]);
+    }
+  if (valid)
+    {
+    return;
+    }
+
+  int *outExt = this->OutputExtent;
+  int ny = outExt[3] - outExt[2] + 1;
+  int nz = outExt[5] - outExt[4] + 1;
+  delete [] plan->Rows;
+  plan->Rows = new vtkUltrasoundFanRow[ny*nz];
+
+  double y0 = this->RotationAxisDepth;
+  double maxDepth = this->MaximumDepth;
+
+  // phi describes the sweep of the utrasound beam within a single image
+  double tanPhi0 = -1000.0;  // small number 
+  double tanPhi1 = +1000.0;  // large number
+
+  if (this->FanAngleExtent[0] > -90.0)
+    {
+    tanPhi0 = tan(this->FanAngleExtent[0]*DEGREES_TO_RADIANS);
+    }
+  if (this->FanAngleExtent[1] < +90.0)
+    {
+    tanPhi1 = tan(this->FanAngleExtent[1]*DEGREES_TO_RADIANS);
+    }
+
+  vtkUltrasoundFanRow *row = plan->Rows;
+  for (int idZ = outExt[4]; idZ <= outExt[5]; idZ++)
+    {
+    for (int idY = outExt[2]; idY <= outExt[3]; idY++, row++)
+      {
+      double y = this->OutputOrigin[1]+idY*this->OutputSpacing[1];
+      double z = this->OutputOrigin[2]+idZ*this->OutputSpacing[2];
+      double dy = y-y0;
+
+      // calculate the 'theta' and 'depth' input coordinates that
+      // correspond to the current y and z output coordinates
+      // (the input and output x is the same)
+      double theta = atan2(z,dy)/DEGREES_TO_RADIANS; // theta is in degrees
+      double depth = sqrt(dy*dy+z*z)+y0; // depth is in millimetres
+
+      // convert depth and theta into indices so that we can
+      // interpolate, without a table the input z coordinate is the angle
+      // in radians (as in ExecuteInformation)
+      double idDepth = (depth-inOrigin[1])/inSpacing[1];
+      double idTheta;
+      if (this->RotationAngles)
+        {
+        idTheta = vtkGetThetaIndexFromTable(this->RotationAngles,
+                                            theta)+inExt[4];
+        }
+      else
+        {
+        idTheta = (theta*DEGREES_TO_RADIANS-inOrigin[2])/inSpacing[2];
+        }
+
+      int idDepth1 = int(idDepth+1.0);
+      int idTheta1 = int(idTheta+32768.0)-32767; // ensure proper rounding
+
+      int idDepth0 = idDepth1 - 1;
+      int idTheta0 = idTheta1 - 1;
+
+      // don't interpolate if not necessary
+      if (idDepth0 == idDepth)
+        {
+        idDepth1 = idDepth0;
+        }
+      if (idTheta0 == idTheta)
+        {
+        idTheta1 = idTheta0;
+        }
+
+      // empty row until proven otherwise
+      row->MinX = outExt[1]+1;
+      row->MaxX = outExt[1];
+
+      if (idDepth0 < inExt[2] || idDepth1 > inExt[3] ||
+          idTheta0 <= inExt[4] || idTheta1 >= inExt[5] ||
+          depth < 0.0 || depth > maxDepth)
+        { 
+        // out of bounds, the whole row will be cleared to black
+        continue;
+        }
+
+      int minX = outExt[0];
+      int maxX = outExt[1];
+
+      // check to see what the x extent should be
+      // first, according to the specified beam-sweep angle
+      int tmpMinX = int((depth*tanPhi0-this->OutputOrigin[0])/
+                        this->OutputSpacing[0]+1.5)-1;
+      int tmpMaxX = int((depth*tanPhi1-this->OutputOrigin[0])/
+                        this->OutputSpacing[0]+1.5)-1;
+      if (tmpMinX > minX)
+        {
+        minX = tmpMinX;
+        }
+      if (tmpMaxX < maxX)
+        {
+        maxX = tmpMaxX;
+        }
+
+      // next, according to the depth of penetration of the beam
+      double absX = sqrt(maxDepth*maxDepth - depth*depth);
+      tmpMinX = int((-absX - this->OutputOrigin[0])/
+                    this->OutputSpacing[0] + 1.5) - 1;  
+      tmpMaxX = int((absX - this->OutputOrigin[0])/
+                    this->OutputSpacing[0] + 1.5) - 1;  
+      if (tmpMinX > minX)
+        {
+        minX = tmpMinX;
+        }
+      if (tmpMaxX < maxX)
+        {
+        maxX = tmpMaxX;
+        }
+
+      if (minX > maxX)
+        {
+        continue;
+        }
+
+      // extract whole and fractional portion of indices
+      double fd = idDepth-idDepth0;
+      double ft = idTheta-idTheta0;
+      double rd = 1.0-fd;
+      double rt = 1.0-ft;
+
+      row->MinX = minX;
+      row->MaxX = maxX;
+      row->Depth[0] = idDepth0;
+      row->Depth[1] = idDepth1;
+      row->Theta[0] = idTheta0;
+      row->Theta[1] = idTheta1;
+      row->NearestDepth = int(idDepth+1.5)-1;
+      row->NearestTheta = int(idTheta+32767.5)-32767; // ensure proper round
+      row->Weight[0] = (float)(rd*rt);
+      row->Weight[1] = (float)(rd*ft);
+      row->Weight[2] = (float)(fd*rt);
+      row->Weight[3] = (float)(fd*ft);
+      }
+    }
+
+  for (i = 0; i < 6; i++)
+    {
+    plan->Extent[i] = outExt[i];
+    plan->InputExtent[i] = inExt[i];
+    }
+  for (i = 0; i < 3; i++)
+    {
+    plan->InputOrigin[i] = inOrigin[i];
+    plan->InputSpacing[i] = inSpacing[i];
+    }
+  plan->BuildTime.Modified();
+}
+
+//----------------------------------------------------------------------------
+// The table is built before the threads are started
+void vtkUltrasoundFan::ExecuteData(vtkDataObject *out)
+{
+  this->UpdatePlan();
+  this->vtkImageToImageFilter::ExecuteData(out);
+}
+
 //----------------------------------------------------------------------------
 // rounding functions, split and optimized for each type
 // (because we don't want to round if the result is a float!)
@@ -281,22 +523,44 @@ static inline void vtkUltrasoundRound(double val, float& rnd)
   rnd = (float)(val);
 }
 
+//----------------------------------------------------------------------------
+// Blend four input rows into an output row of 'n' values.  The loop runs
+// over contiguous memory without branches, so that it can be vectorized.
+template <class T>
+static inline void vtkUltrasoundFanGather(T *outPtr, const T *inPtr00,
+                                          const T *inPtr01,
+                                          const T *inPtr10,
+                                          const T *inPtr11,
+                                          const float weight[4], int n)
+{
+  double f00 = weight[0];
+  double f01 = weight[1];
+  double f10 = weight[2];
+  double f11 = weight[3];
+
+  for (int i = 0; i < n; i++)
+    {
+    vtkUltrasoundRound(f00*inPtr00[i] + f01*inPtr01[i] + 
+                       f10*inPtr10[i] + f11*inPtr11[i], outPtr[i]);
+    }
+}
+
 //----------------------------------------------------------------------------
 // This templated function executes the filter for any type of data.
 // (this one function is pretty much the be-all and end-all of the
-// filter)
+// filter)  The geometry comes from the scan-conversion table, so all
+// that is left to do per row is a gather from the input.
 template <class T>
 static void vtkUltrasoundFanExecute(vtkUltrasoundFan *self,
+                                    vtkUltrasoundFanPlan *plan,
                                     vtkImageData *inData, T *inPtr,
                                     vtkImageData *outData, T *outPtr,
                                     int outExt[6], int id)
 {
   int numScalars, rowLength;
-  int idC, idX, idY, idZ;
+  int idY, idZ;
   int outIncX, outIncY, outIncZ;
   int inExt[6], inInc[3];
-  float inOrigin[3],outOrigin[3];
-  float inSpacing[3],outSpacing[3];
   unsigned long count = 0;
   unsigned long target;
 
@@ -313,37 +577,19 @@ static void vtkUltrasoundFanExecute(vtkUltrasoundFan *self,
   outData->GetContinuousIncrements(outExt, outIncX, outIncY, outIncZ);
   numScalars = inData->GetNumberOfScalarComponents();
 
-  // Get spacing and origin
-  inData->GetSpacing(inSpacing);
-  inData->GetOrigin(inOrigin);
-  outData->GetSpacing(outSpacing);
-  outData->GetOrigin(outOrigin);
-
-  double y0 = self->GetRotationAxisDepth();
-  double depth0 = self->GetFanApexDepth();
-  double y,z,dy,theta,depth;
-
-  // phi describes the sweep of the utrasound beam within a single image
-  double *phiExtent = self->GetFanAngleExtent();
-  double tanPhi0 = -1000.0;  // small number 
-  double tanPhi1 = +1000.0;  // large number
-
-  if (phiExtent[0] > -90.0)
-    {
-    tanPhi0 = tan(phiExtent[0]*DEGREES_TO_RADIANS);
-    }
-  if (phiExtent[1] < +90.0)
-    {
-    tanPhi1 = tan(phiExtent[1]*DEGREES_TO_RADIANS);
-    }
+  int interpolate = self->GetInterpolate();
+  int planRowsY = plan->Extent[3]-plan->Extent[2]+1;
 
   // prime the input pointer
-  inPtr += outExt[0]*inInc[0];
+  inPtr += (outExt[0]-inExt[0])*inInc[0];
 
   // Loop through ouput pixels
   for (idZ = outExt[4]; idZ <= outExt[5]; idZ++)
     {
-    for (idY = outExt[2]; idY <= outExt[3]; idY++)
+    vtkUltrasoundFanRow *row = plan->Rows +
+      (idZ-plan->Extent[4])*planRowsY + (outExt[2]-plan->Extent[2]);
+
+    for (idY = outExt[2]; idY <= outExt[3]; idY++, row++)
       {
       if (!id) 
         {
@@ -354,149 +600,52 @@ static void vtkUltrasoundFanExecute(vtkUltrasoundFan *self,
         count++;
         }
 
-      y = outOrigin[1]+idY*outSpacing[1];
-      z = outOrigin[2]+idZ*outSpacing[2];
-      dy = y-y0;
-
-      // calculate the 'theta' and 'depth' input coordinates that
-      // correspond to the current y and z output coordinates
-      // (the input and output x is the same)
-      theta = atan2(z,dy)/DEGREES_TO_RADIANS; // theta is in degrees
-      depth = sqrt(dy*dy+z*z)+y0; // depth is in millimetres
-
-      // convert depth and theta into indices so that we can
-      // interpolate
-      double idDepth = (depth-inOrigin[1])/inSpacing[1];
-      double idTheta = vtkGetThetaIndexFromTable(self->GetRotationAngles(),
-                                                 theta)+inExt[4];
-
-      int idDepth1 = int(idDepth+1.0);
-      int idTheta1 = int(idTheta+32768.0)-32767; // ensure proper rounding
-
-      int idDepth0 = idDepth1 - 1;
-      int idTheta0 = idTheta1 - 1;
-
-      int idDepthNearest = int(idDepth+1.5)-1;
-      int idThetaNearest = int(idTheta+32767.5)-32767; // ensure proper round
-        
-      // don't interpolate if not necessary
-      if (idDepth0 == idDepth)
+      // restrict the row's fan range to this piece of the output
+      int minX = (row->MinX > outExt[0] ? row->MinX : outExt[0]);
+      int maxX = (row->MaxX < outExt[1] ? row->MaxX : outExt[1]);
+      if (minX > maxX)
         {
-        idDepth1 = idDepth0;
-        }
-      if (idTheta0 == idTheta)
-        {
-        idTheta1 = idTheta0;
+        minX = outExt[1]+1;
+        maxX = outExt[1];
         }
 
-      if (idDepth0 < inExt[2] || idDepth1 > inExt[3] ||
-          idTheta0 <= inExt[4] || idTheta1 >= inExt[5] ||
-          depth < 0.0 || depth > self->GetMaximumDepth())
-        { 
-        // out of bounds! clear to black
-        rowLength = (outExt[1]-outExt[0]+1)*numScalars;
-        memset(outPtr,0,rowLength*sizeof(T));
+      // clear leading space
+      rowLength = (minX-outExt[0])*numScalars;
+      memset(outPtr,0,rowLength*sizeof(T));
+      outPtr += rowLength;
+
+      // reconstruct where appropriate
+      T *inPtrTmp = inPtr+rowLength;
+      rowLength = (maxX-minX+1)*numScalars;
+
+      if (rowLength > 0 && interpolate)
+        { // do linear interpolation
+        int factDepth0 = (row->Depth[0]-inExt[2])*inInc[1];
+        int factTheta0 = (row->Theta[0]-inExt[4])*inInc[2];
+        int factDepth1 = (row->Depth[1]-inExt[2])*inInc[1];
+        int factTheta1 = (row->Theta[1]-inExt[4])*inInc[2];
+
+        vtkUltrasoundFanGather(outPtr,
+                               inPtrTmp + factDepth0 + factTheta0,
+                               inPtrTmp + factDepth0 + factTheta1,
+                               inPtrTmp + factDepth1 + factTheta0,
+                               inPtrTmp + factDepth1 + factTheta1,
+                               row->Weight, rowLength);
         outPtr += rowLength;
         }
-      else
-        {
-        int minX = outExt[0];
-        int maxX = outExt[1];
-        
-        // check to see what the x extent should be
-        // first, according to the specified beam-sweep angle
-        int tmpMinX = int((depth*tanPhi0-outOrigin[0])/outSpacing[0]+1.5)-1;
-        int tmpMaxX = int((depth*tanPhi1-outOrigin[0])/outSpacing[0]+1.5)-1;
-        
-        if (tmpMinX > minX)
-          {
-          minX = tmpMinX;
-          }
-        if (tmpMaxX < maxX)
-          {
-          maxX = tmpMaxX;
-          }
-
-        // next, according to the depth of penetration of the beam
-        double absX = sqrt(self->GetMaximumDepth()*self->GetMaximumDepth()
-                           - depth*depth);
-        tmpMinX = int((-absX - outOrigin[0])/outSpacing[0] + 1.5) - 1;  
-        tmpMaxX = int((absX - outOrigin[0])/outSpacing[0] + 1.5) - 1;  
-        
-        if (tmpMinX > minX)
-          {
-          minX = tmpMinX;
-          }
-        if (tmpMaxX < maxX)
-          {
-          maxX = tmpMaxX;
-          }
-      
-        // make sure the limits themselves are within limits
-        if (minX > maxX)
-          {
-          minX = outExt[1]+1;
-          maxX = outExt[1];
-          }
-        
-        // clear leading space
-        rowLength = (minX-outExt[0])*numScalars;
-        memset(outPtr,0,rowLength*sizeof(T));
-        outPtr += rowLength;
-
-        // reconstruct where appropriate
-        T *inPtrTmp = inPtr+rowLength;
-
-        if (self->GetInterpolate())
-          { // do linear interpolation
-        
-          // extract whole and fractional portion of indices
-          double fd = idDepth-idDepth0;
-          double ft = idTheta-idTheta0;
-
-          double rd = 1.0-fd;
-          double rt = 1.0-ft;
-
-          double f00 = rd*rt;
-          double f01 = rd*ft;
-          double f10 = fd*rt;
-          double f11 = fd*ft;
-        
-          int factDepth0 = idDepth0*inInc[1];
-          int factTheta0 = idTheta0*inInc[2];
-          int factDepth1 = idDepth1*inInc[1];
-          int factTheta1 = idTheta1*inInc[2];
-        
-          int inc00 = factDepth0 + factTheta0;
-          int inc01 = factDepth0 + factTheta1;
-          int inc10 = factDepth1 + factTheta0;
-          int inc11 = factDepth1 + factTheta1;
-
-          for (idX = minX; idX <= maxX; idX++)
-            {
-            for (idC = 0; idC < numScalars; idC++)
-              {
-              vtkUltrasoundRound(f00*inPtrTmp[inc00] + f01*inPtrTmp[inc01] + 
-                                 f10*inPtrTmp[inc10] + f11*inPtrTmp[inc11],
-                                 *outPtr++);
-              inPtrTmp++;
-              }
-            }
-          }
-        else
-          { // do nearest-neighbor as efficiently as possible
-          rowLength = (maxX-minX+1)*numScalars;
-          memcpy(outPtr,
-                 inPtrTmp+idDepthNearest*inInc[1]+idThetaNearest*inInc[2],
-                 rowLength*sizeof(T));
-          outPtr += rowLength;
-          }
-
-        // clear trailing space
-        rowLength = (outExt[1]-maxX)*numScalars;
-        memset(outPtr,0,rowLength*sizeof(T));
+      else if (rowLength > 0)
+        { // do nearest-neighbor as efficiently as possible
+        memcpy(outPtr,
+               inPtrTmp + (row->NearestDepth-inExt[2])*inInc[1] +
+               (row->NearestTheta-inExt[4])*inInc[2],
+               rowLength*sizeof(T));
         outPtr += rowLength;
         }
+
+      // clear trailing space
+      rowLength = (outExt[1]-maxX)*numScalars;
+      memset(outPtr,0,rowLength*sizeof(T));
+      outPtr += rowLength;
       outPtr += outIncY;
       }
     outPtr += outIncZ;
@@ -529,24 +678,29 @@ void vtkUltrasoundFan::ThreadedExecute(vtkImageData *inData,
   switch (inData->GetScalarType())
     {
     case VTK_FLOAT:
-      vtkUltrasoundFanExecute(this, inData, (float *)(inPtr), 
-                              outData, (float *)(outPtr),outExt, id);
+      vtkUltrasoundFanExecute(this, this->Plan,
+                              inData, (float *)(inPtr),
+                              outData, (float *)(outPtr), outExt, id);
       break;
     case VTK_INT:
-      vtkUltrasoundFanExecute(this, inData, (int *)(inPtr), 
-                              outData, (int *)(outPtr),outExt, id);
+      vtkUltrasoundFanExecute(this, this->Plan,
+                              inData, (int *)(inPtr),
+                              outData, (int *)(outPtr), outExt, id);
       break;
     case VTK_SHORT:
-      vtkUltrasoundFanExecute(this, inData, (short *)(inPtr), 
-                              outData, (short *)(outPtr),outExt, id);
+      vtkUltrasoundFanExecute(this, this->Plan,
+                              inData, (short *)(inPtr),
+                              outData, (short *)(outPtr), outExt, id);
       break;
     case VTK_UNSIGNED_SHORT:
-      vtkUltrasoundFanExecute(this, inData, (unsigned short *)(inPtr), 
-                              outData, (unsigned short *)(outPtr),outExt,id);
+      vtkUltrasoundFanExecute(this, this->Plan,
+                              inData, (unsigned short *)(inPtr),
+                              outData, (unsigned short *)(outPtr), outExt, id);
       break;
     case VTK_UNSIGNED_CHAR:
-      vtkUltrasoundFanExecute(this, inData, (unsigned char *)(inPtr), 
-                              outData, (unsigned char *)(outPtr),outExt, id);
+      vtkUltrasoundFanExecute(this, this->Plan,
+                              inData, (unsigned char *)(inPtr),
+                              outData, (unsigned char *)(outPtr), outExt, id);
       break;
     default:
       vtkErrorMacro(<< "Execute: Unknown input ScalarType");
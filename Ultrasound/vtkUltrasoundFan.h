@@ -64,6 +64,7 @@ POSSIBILITY OF SUCH DAMAGES.
 #include "vtkDoubleArray.h"
 
 class vtkMatrix4x4;
+struct vtkUltrasoundFanPlan;
 
 #define VTK_RESLICE_NEAREST 0
 #define VTK_RESLICE_LINEAR 1
@@ -79,6 +80,10 @@ public:
 
   virtual void PrintSelf(ostream& os, vtkIndent indent);
 
+  // Description:
+  // The modified time includes the RotationAngles.
+  unsigned long GetMTime();
+
   // Description:
   // Set the depth (in mm) of the axis about which the 
   // transducer is rotating -- can be negative or positive,
@@ -88,8 +93,8 @@ public:
 
   // Description:
   // In case the slices are not at evenly-spaced angles,
-  // provide an angle for each slice (by default, the Z 
-  // coordinate of the input is treated as an angle).
+  // provide an angle in degrees for each slice (by default, the Z 
+  // coordinate of the input is treated as an angle in radians).
   vtkSetObjectMacro(RotationAngles, vtkDoubleArray);
   vtkGetObjectMacro(RotationAngles, vtkDoubleArray);
 
@@ -134,7 +139,18 @@ protected:
   float OutputSpacing[3];
   float OutputOrigin[3];
 
+  // scan-conversion table: the input depth/theta indices and the
+  // interpolation weights for each output row, and the x range of
+  // each row that lies within the fan
+  vtkUltrasoundFanPlan *Plan;
+
+  // Description:
+  // Rebuild the scan-conversion table if the fan geometry, the rotation
+  // angles or the input geometry have changed since it was last built.
+  void UpdatePlan();
+
   void ExecuteInformation();
+  void ExecuteData(vtkDataObject *out);
   void ComputeRequiredInputUpdateExtent(int inExt[6], int outExt[6]);
   
   // Description:
@@ -0,0 +1,355 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundFanMask.cxx,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+
+#include <math.h>
+#include "vtkUltrasoundFanMask.h"
+#include "vtkObjectFactory.h"
+#include "vtkCriticalSection.h"
+
+vtkCxxRevisionMacro(vtkUltrasoundFanMask, "$Revision: 1.1 $");
+vtkStandardNewMacro(vtkUltrasoundFanMask);
+
+#define VTK_FAN_MASK_MAX_CACHE 64
+
+//----------------------------------------------------------------------------
+// The shared cache, most recently used first.  The cache holds a
+// reference to each mask, and each caller of GetCachedMask() holds
+// another until it calls ReleaseCachedMask(), so a mask that is dropped
+// from the cache stays valid for the threads that are still using it.
+// The reference counts are only changed while the lock is held.
+static vtkSimpleCriticalSection vtkUltrasoundFanMaskCacheLock;
+static vtkUltrasoundFanMask *vtkUltrasoundFanMaskCache[VTK_FAN_MASK_MAX_CACHE];
+static int vtkUltrasoundFanMaskCacheCount = 0;
+static int vtkUltrasoundFanMaskCacheSize = 8;
+
+// release the cache at exit
+class vtkUltrasoundFanMaskCacheCleanup
+{
+public:
+  ~vtkUltrasoundFanMaskCacheCleanup()
+    {
+    vtkUltrasoundFanMask::ClearCache();
+    }
+};
+static vtkUltrasoundFanMaskCacheCleanup vtkUltrasoundFanMaskCacheCleanupInstance;
+
+//----------------------------------------------------------------------------
+vtkUltrasoundFanMask::vtkUltrasoundFanMask()
+{
+  for (int i = 0; i < 4; i++)
+    {
+    this->Extent[i] = 0;
+    this->ClipExtent[i] = 0;
+    }
+  this->Extent[3] = -1;
+  this->Spacing[0] = 1.0;
+  this->Spacing[1] = 1.0;
+  this->FanOrigin[0] = 0.0;
+  this->FanOrigin[1] = 0.0;
+  this->FanSlopes[0] = 0.0;
+  this->FanSlopes[1] = 0.0;
+  this->FanDepth = 0.0;
+  this->Margin = 0;
+  this->Spans = NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkUltrasoundFanMask::~vtkUltrasoundFanMask()
+{
+  delete [] this->Spans;
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundFanMask::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "Extent: (" << this->Extent[0] << ", "
+     << this->Extent[1] << ", " << this->Extent[2] << ", "
+     << this->Extent[3] << ")\n";
+  os << indent << "ClipExtent: (" << this->ClipExtent[0] << ", "
+     << this->ClipExtent[1] << ", " << this->ClipExtent[2] << ", "
+     << this->ClipExtent[3] << ")\n";
+  os << indent << "Spacing: (" << this->Spacing[0] << ", "
+     << this->Spacing[1] << ")\n";
+  os << indent << "FanOrigin: (" << this->FanOrigin[0] << ", "
+     << this->FanOrigin[1] << ")\n";
+  os << indent << "FanSlopes: (" << this->FanSlopes[0] << ", "
+     << this->FanSlopes[1] << ")\n";
+  os << indent << "FanDepth: " << this->FanDepth << "\n";
+  os << indent << "Margin: " << this->Margin << "\n";
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundFanMask::Matches(const int extent[4],
+                                  const double spacing[2],
+                                  const double fanOrigin[2],
+                                  const double fanSlopes[2],
+                                  double fanDepth,
+                                  const int clipExtent[4], int margin)
+{
+  for (int i = 0; i < 4; i++)
+    {
+    if (this->Extent[i] != extent[i] || this->ClipExtent[i] != clipExtent[i])
+      {
+      return 0;
+      }
+    }
+  for (int j = 0; j < 2; j++)
+    {
+    if (this->Spacing[j] != spacing[j] ||
+        this->FanOrigin[j] != fanOrigin[j] ||
+        this->FanSlopes[j] != fanSlopes[j])
+      {
+      return 0;
+      }
+    }
+  return (this->FanDepth == fanDepth && this->Margin == margin);
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundFanMask::Build(const int extent[4],
+                                 const double spacing[2],
+                                 const double fanOrigin[2],
+                                 const double fanSlopes[2],
+                                 double fanDepth,
+                                 const int clipExtent[4], int margin)
+{
+  int i;
+  for (i = 0; i < 4; i++)
+    {
+    this->Extent[i] = extent[i];
+    this->ClipExtent[i] = clipExtent[i];
+    }
+  for (i = 0; i < 2; i++)
+    {
+    this->Spacing[i] = spacing[i];
+    this->FanOrigin[i] = fanOrigin[i];
+    this->FanSlopes[i] = fanSlopes[i];
+    }
+  this->FanDepth = fanDepth;
+  this->Margin = margin;
+
+  delete [] this->Spans;
+  this->Spans = NULL;
+  int ny = extent[3] - extent[2] + 1;
+  if (ny <= 0)
+    {
+    return;
+    }
+  this->Spans = new int[2*ny];
+
+  double xf = fanOrigin[0];
+  double yf = fanOrigin[1];
+  double ml = fanSlopes[0];
+  double mr = fanSlopes[1];
+  double xs = spacing[0];
+  double ys = spacing[1];
+  double d2 = fanDepth*fanDepth;
+  double m = margin;
+
+  int *span = this->Spans;
+  for (int idY = extent[2]; idY <= extent[3]; idY++)
+    {
+    int r1 = extent[0];
+    int r2 = extent[1];
+
+    // handle the 'fan' shape of the input
+    double y = (yf - idY);
+    if (ys < 0)
+      {
+      y = -y;
+      }
+    if (!(ml == 0 && mr == 0))
+      {
+      // first, check the angle range of the fan
+      if (r1 < ml*y + xf + m)
+        {
+        r1 = int(ceil(ml*y + xf + m));
+        }
+      if (r2 > mr*y + xf - m)
+        {
+        r2 = int(floor(mr*y + xf - m));
+        }
+
+      // next, check the radius of the fan
+      double dx = (d2 - (y*y)*(ys*ys))/(xs*xs);
+      if (dx < 0)
+        {
+        r1 = extent[0];
+        r2 = extent[0]-1;
+        }
+      else
+        {
+        dx = sqrt(dx);
+        if (r1 < xf - dx + m)
+          {
+          r1 = int(ceil(xf - dx + m));
+          }
+        if (r2 > xf + dx - m)
+          {
+          r2 = int(floor(xf + dx - m));
+          }
+        }
+      }
+
+    // bound to the ultrasound clip rectangle
+    if (r1 < clipExtent[0])
+      {
+      r1 = clipExtent[0];
+      }
+    if (r2 > clipExtent[1])
+      {
+      r2 = clipExtent[1];
+      }
+    if (r1 > r2 || idY < clipExtent[2] || idY > clipExtent[3])
+      {
+      r1 = extent[0];
+      r2 = extent[0]-1;
+      }
+
+    *span++ = r1;
+    *span++ = r2;
+    }
+
+  this->Modified();
+}
+
+//----------------------------------------------------------------------------
+vtkUltrasoundFanMask *vtkUltrasoundFanMask::GetCachedMask(
+  const int extent[4], const double spacing[2], const double fanOrigin[2],
+  const double fanSlopes[2], double fanDepth, const int clipExtent[4],
+  int margin)
+{
+  vtkUltrasoundFanMaskCacheLock.Lock();
+
+  vtkUltrasoundFanMask **cache = vtkUltrasoundFanMaskCache;
+  vtkUltrasoundFanMask *mask = NULL;
+  int i;
+  for (i = 0; i < vtkUltrasoundFanMaskCacheCount; i++)
+    {
+    if (cache[i]->Matches(extent, spacing, fanOrigin, fanSlopes, fanDepth,
+                          clipExtent, margin))
+      {
+      mask = cache[i];
+      break;
+      }
+    }
+
+  if (mask == NULL)
+    {
+    // build a new mask, and drop the least recently used one if full.
+    // building while holding the lock means that threads that need the
+    // same mask wait for it instead of building it themselves.
+    mask = vtkUltrasoundFanMask::New();
+    mask->Build(extent, spacing, fanOrigin, fanSlopes, fanDepth,
+                clipExtent, margin);
+    if (vtkUltrasoundFanMaskCacheCount == vtkUltrasoundFanMaskCacheSize)
+      {
+      cache[--vtkUltrasoundFanMaskCacheCount]->Delete();
+      }
+    i = vtkUltrasoundFanMaskCacheCount++;
+    }
+
+  // move to the front
+  for (; i > 0; i--)
+    {
+    cache[i] = cache[i-1];
+    }
+  cache[0] = mask;
+
+  // the cache owns one reference, the caller gets another
+  mask->Register(NULL);
+
+  vtkUltrasoundFanMaskCacheLock.Unlock();
+
+  return mask;
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundFanMask::ReleaseCachedMask(vtkUltrasoundFanMask *mask)
+{
+  if (mask)
+    {
+    vtkUltrasoundFanMaskCacheLock.Lock();
+    mask->UnRegister(NULL);
+    vtkUltrasoundFanMaskCacheLock.Unlock();
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundFanMask::SetCacheSize(int n)
+{
+  if (n < 1)
+    {
+    n = 1;
+    }
+  if (n > VTK_FAN_MASK_MAX_CACHE)
+    {
+    n = VTK_FAN_MASK_MAX_CACHE;
+    }
+
+  vtkUltrasoundFanMaskCacheLock.Lock();
+  while (vtkUltrasoundFanMaskCacheCount > n)
+    {
+    vtkUltrasoundFanMaskCache[--vtkUltrasoundFanMaskCacheCount]->Delete();
+    }
+  vtkUltrasoundFanMaskCacheSize = n;
+  vtkUltrasoundFanMaskCacheLock.Unlock();
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundFanMask::GetCacheSize()
+{
+  return vtkUltrasoundFanMaskCacheSize;
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundFanMask::ClearCache()
+{
+  vtkUltrasoundFanMaskCacheLock.Lock();
+  while (vtkUltrasoundFanMaskCacheCount > 0)
+    {
+    vtkUltrasoundFanMaskCache[--vtkUltrasoundFanMaskCacheCount]->Delete();
+    }
+  vtkUltrasoundFanMaskCacheLock.Unlock();
+}
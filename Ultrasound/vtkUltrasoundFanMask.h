@@ -0,0 +1,144 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundFanMask.h,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+// .NAME vtkUltrasoundFanMask - cached row spans of an ultrasound fan
+// .SECTION Description
+// vtkUltrasoundFanMask is a run-length mask of the part of an ultrasound
+// image that contains ultrasound data: for each row of the image, it
+// stores the one span of pixels that lies within both the fan (the
+// pizza-slice defined by the fan origin, the fan angles and the fan depth)
+// and the clip rectangle.  Building the mask requires trigonometry for
+// every row, but once it is built, clipping a row is a table lookup.
+//
+// The masks are kept in a small cache that is shared by all the
+// ultrasound filters (e.g. vtkUltrasoundImageStencilSource and
+// vtkFreehandUltrasound2), keyed on the image extent, the spacing and the
+// fan and clip parameters, so a mask is only rebuilt when the geometry
+// changes.  The cache is thread safe.
+// .SECTION see also
+// vtkUltrasoundImageStencilSource vtkFreehandUltrasound2
+
+#ifndef __vtkUltrasoundFanMask_h
+#define __vtkUltrasoundFanMask_h
+
+#include "vtkObject.h"
+
+class VTK_EXPORT vtkUltrasoundFanMask : public vtkObject
+{
+public:
+  static vtkUltrasoundFanMask *New();
+  vtkTypeRevisionMacro(vtkUltrasoundFanMask, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // Get a mask from the shared cache, building it if it is not there.
+  // The extent is the x,y extent of the image and the clip extent is the
+  // clip rectangle as pixel indices (x0, x1, y0, y1).  The fan origin is
+  // in pixel indices, the fan slopes are the tangents of the two fan
+  // angles scaled to pixel indices, and the fan depth is in the same
+  // units as the spacing.  If both slopes are zero there is no fan.  The
+  // fan edges are moved inwards by 'margin' pixels.  Every mask that is
+  // returned must be given back with ReleaseCachedMask().
+  static vtkUltrasoundFanMask *GetCachedMask(const int extent[4],
+                                             const double spacing[2],
+                                             const double fanOrigin[2],
+                                             const double fanSlopes[2],
+                                             double fanDepth,
+                                             const int clipExtent[4],
+                                             int margin);
+  static void ReleaseCachedMask(vtkUltrasoundFanMask *mask);
+
+  // Description:
+  // The number of masks to keep in the shared cache (default 8).
+  static void SetCacheSize(int n);
+  static int GetCacheSize();
+
+  // Description:
+  // Remove all masks from the shared cache.
+  static void ClearCache();
+
+  // Description:
+  // Get the span [r1,r2] of row idY that lies within the fan and the clip
+  // rectangle.  If the row is empty, then r1 > r2.
+  void GetRowSpan(int idY, int &r1, int &r2)
+    {
+    int *span = this->Spans + 2*(idY - this->Extent[2]);
+    r1 = span[0];
+    r2 = span[1];
+    };
+
+  // Description:
+  // Get the x,y extent of the mask.
+  vtkGetVector4Macro(Extent, int);
+
+  // Description:
+  // Build the mask for the given geometry, see GetCachedMask().
+  void Build(const int extent[4], const double spacing[2],
+             const double fanOrigin[2], const double fanSlopes[2],
+             double fanDepth, const int clipExtent[4], int margin);
+
+  // Description:
+  // Check whether the mask was built for the given geometry.
+  int Matches(const int extent[4], const double spacing[2],
+              const double fanOrigin[2], const double fanSlopes[2],
+              double fanDepth, const int clipExtent[4], int margin);
+
+protected:
+  vtkUltrasoundFanMask();
+  ~vtkUltrasoundFanMask();
+
+  int Extent[4];
+  int ClipExtent[4];
+  double Spacing[2];
+  double FanOrigin[2];
+  double FanSlopes[2];
+  double FanDepth;
+  int Margin;
+
+  // two values (r1,r2) per row
+  int *Spans;
+
+private:
+  vtkUltrasoundFanMask(const vtkUltrasoundFanMask&);
+  void operator=(const vtkUltrasoundFanMask&);
+};
+
+#endif
@@ -44,6 +44,28 @@ POSSIBILITY OF SUCH DAMAGES.
 #include "vtkObjectFactory.h"
 #include "vtkImageData.h"
 #include "vtkPointData.h"
+#include "vtkInformation.h"
+#include "vtkInformationVector.h"
+#include "vtkStreamingDemandDrivenPipeline.h"
+#include "vtkMultiThreader.h"
+
+// the analysis is done in static functions, which report their progress
+// through the filter's debug output (older VTK 5 lacks this macro)
+#ifndef vtkDebugWithObjectMacro
+#define vtkDebugWithObjectMacro(self, x) \
+  { \
+  if (self->GetDebug() && vtkObject::GetGlobalWarningDisplay()) \
+    { \
+    vtkOStreamWrapper::EndlType endl; \
+    vtkOStreamWrapper::UseEndl(endl); \
+    vtkOStrStreamWrapper vtkmsg; \
+    vtkmsg << "Debug: In " __FILE__ ", line " << __LINE__ << "\n" \
+           << self->GetClassName() << " (" << self << "): " x << "\n\n"; \
+    vtkOutputWindowDisplayDebugText(vtkmsg.str()); \
+    vtkmsg.rdbuf()->freeze(0); \
+    } \
+  }
+#endif
 
 //----------------------------------------------------------------------------
 vtkUltrasoundFrameAnalyze* vtkUltrasoundFrameAnalyze::New()
@@ -82,6 +104,14 @@ vtkUltrasoundFrameAnalyze::vtkUltrasoundFrameAnalyze()
   this->ClipGuess[4] = 0;
   this->ClipGuess[5] = 0;
 
+  this->IncrementalAnalysis = 0;
+  this->FrameSignature = 0;
+  this->GeometryChanged = 0;
+  this->GeometryValid = 0;
+
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = this->Threader->GetNumberOfThreads();
+
   this->StencilSource = vtkUltrasoundImageStencilSource::New();
 }
 
@@ -89,6 +119,7 @@ vtkUltrasoundFrameAnalyze::vtkUltrasoundFrameAnalyze()
 vtkUltrasoundFrameAnalyze::~vtkUltrasoundFrameAnalyze()
 {
   this->StencilSource->Delete();
+  this->Threader->Delete();
 }
 
 //--------------------------------------------------------------------------
@@ -133,40 +164,131 @@ static inline int vtkResliceFloor(float x, float &f)
   return ix;
 }
 
+//----------------------------------------------------------------------------
+// Split the range [lo,hi] into threadCount contiguous pieces, and give the
+// piece for threadId.  The piece is empty (thi < tlo) if there are more
+// threads than values.
+static void vtkFrameAnalyzeSplitRange(int lo, int hi, int threadId,
+                                      int threadCount, int &tlo, int &thi)
+{
+  int n = hi - lo + 1;
+  tlo = lo + (n*threadId)/threadCount;
+  thi = lo + (n*(threadId + 1))/threadCount - 1;
+}
+
+//----------------------------------------------------------------------------
+// Run a thread function with the given data on all the threads
+static void vtkFrameAnalyzeMultiThread(vtkMultiThreader *threader,
+                                       vtkThreadFunctionType func,
+                                       void *data)
+{
+  threader->SetSingleMethod(func, data);
+  threader->SingleMethodExecute();
+}
+
+//----------------------------------------------------------------------------
+// Add the first component of a block of rows to a histogram.  Four
+// partial histograms are used so that runs of pixels with the same value
+// (i.e. the black background) do not all increment the same counter one
+// after the other, which lets the compiler keep several increments in
+// flight at once.
+static void vtkFrameAnalyzeHistogramRows(const unsigned char *inPtr,
+                                         int n, vtkIdType incX,
+                                         int rows, vtkIdType incY,
+                                         int histogram[256])
+{
+  int partial[4][256];
+  memset(partial, 0, sizeof(partial));
+
+  for (int j = 0; j < rows; j++)
+    {
+    const unsigned char *ptr = inPtr + j*incY;
+    int i = 0;
+    for (; i + 4 <= n; i += 4)
+      {
+      partial[0][ptr[0]]++;
+      partial[1][ptr[incX]]++;
+      partial[2][ptr[2*incX]]++;
+      partial[3][ptr[3*incX]]++;
+      ptr += 4*incX;
+      }
+    for (; i < n; i++)
+      {
+      partial[0][*ptr]++;
+      ptr += incX;
+      }
+    }
+
+  for (int k = 0; k < 256; k++)
+    {
+    histogram[k] += partial[0][k] + partial[1][k] +
+                    partial[2][k] + partial[3][k];
+    }
+}
+
+//----------------------------------------------------------------------------
+struct vtkFrameAnalyzeHistogramStruct
+{
+  unsigned char *InPtr;
+  int Extent[6];
+  vtkIdType Increments[3];
+  int *Histograms; // 256 bins per thread
+};
+
+//----------------------------------------------------------------------------
+static VTK_THREAD_RETURN_TYPE vtkFrameAnalyzeHistogramThread(void *arg)
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  int threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  vtkFrameAnalyzeHistogramStruct *str = (vtkFrameAnalyzeHistogramStruct *)
+    (((ThreadInfoStruct *)(arg))->UserData);
+
+  int jmin, jmax;
+  vtkFrameAnalyzeSplitRange(str->Extent[2], str->Extent[3],
+                            threadId, threadCount, jmin, jmax);
+  if (jmin <= jmax)
+    {
+    vtkFrameAnalyzeHistogramRows(
+      str->InPtr + (jmin - str->Extent[2])*str->Increments[1],
+      str->Extent[1] - str->Extent[0] + 1, str->Increments[0],
+      jmax - jmin + 1, str->Increments[1],
+      str->Histograms + 256*threadId);
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
 // Find the black and white levels for the image.
 // The black level is the the most abundant pixel color, i.e. the
 // histogram bin that contains the largest number of pixels.
 // The white level is the color of the brightest pixel in the image.
-static void vtkGetBlackAndWhite(vtkUltrasoundFrameAnalyze *self,
+static void vtkGetBlackAndWhite(vtkMultiThreader *threader,
                                 vtkImageData *input, unsigned char *inPtr,
                                 float& black, float& white)
 {
-  int i,j;
-  int inExt[6], numScalars;
-  vtkIdType inInc[3];
-  input->GetExtent(inExt);
-  input->GetIncrements(inInc);
-  numScalars = input->GetNumberOfScalarComponents();
-
-  // initialize the histogram to zero
-  int *histogram = new int[256];
+  int i, t;
+  vtkFrameAnalyzeHistogramStruct str;
+  input->GetExtent(str.Extent);
+  input->GetIncrements(str.Increments);
+  str.InPtr = inPtr;
+
+  // each thread builds a histogram for a block of rows
+  int numThreads = threader->GetNumberOfThreads();
+  str.Histograms = new int[256*numThreads];
+  memset(str.Histograms, 0, 256*numThreads*sizeof(int));
+  vtkFrameAnalyzeMultiThread(threader, vtkFrameAnalyzeHistogramThread, &str);
+
+  int histogram[256];
   for (i = 0; i <= 255; i++)
     {
     histogram[i] = 0;
-    }
-
-  // loop over all pixels to build the histogram
-  for (i = inExt[0]; i <= inExt[1]; i++)
-    {
-    for (j = inExt[2]; j <= inExt[3]; j++)
+    for (t = 0; t < numThreads; t++)
       {
-      int val = inPtr[i*inInc[0] + j*inInc[1]];
-      if (val >= 0 && val <= 255)
-        {
-        histogram[val] += 1;
-        }
+      histogram[i] += str.Histograms[256*t + i];
       }
     }
+  delete [] str.Histograms;
 
   // loop over the histogram bins to find white and black
   black = 0;
@@ -184,8 +306,6 @@ static void vtkGetBlackAndWhite(vtkUltrasoundFrameAnalyze *self,
       white = i;
       }
     }
-
-  delete [] histogram;
 }  
 
 // Provide indices and coefficients for interpolation of values, where the
@@ -207,71 +327,187 @@ static inline void vtkGratInterpCoeffs(double x,
   f2 = 0.25 + f;
 }
 
+//----------------------------------------------------------------------------
+// A graticule profile, prepared for the boxcar interpolation that is done
+// by vtkGratInterpCoeffs.  With x1 = round(x),
+//   f0*image[x1-1] + f1*image[x1] + f2*image[x1+1] = Sum[x1] + (x-x1)*Diff[x1]
+// so each sample of the profile takes two loads and one multiply-add.
+struct vtkGratProfile
+{
+  float *Sum;
+  float *Diff;
+  int Size;
+};
+
+static void vtkGratPrepareProfile(const float *image, int size,
+                                  vtkGratProfile *profile)
+{
+  profile->Size = size;
+  profile->Sum = new float[size];
+  profile->Diff = new float[size];
+  profile->Sum[0] = profile->Diff[0] = 0;
+  profile->Sum[size-1] = profile->Diff[size-1] = 0;
+  for (int x = 1; x < size - 1; x++)
+    {
+    profile->Sum[x] = 0.25f*(image[x-1] + image[x+1]) + 0.5f*image[x];
+    profile->Diff[x] = 0.5f*(image[x+1] - image[x-1]);
+    }
+}
+
+static void vtkGratReleaseProfile(vtkGratProfile *profile)
+{
+  delete [] profile->Sum;
+  delete [] profile->Diff;
+}
+
+// Sample the profile at x, the return value is zero if x is beyond the
+// end of the profile
+static inline int vtkGratSample(const vtkGratProfile *profile, double x,
+                                double &val)
+{
+  int x1 = vtkResliceRound(x);
+  if (x1 + 1 >= profile->Size)
+    {
+    return 0;
+    }
+  val = profile->Sum[x1] + (x - x1)*profile->Diff[x1];
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+struct vtkGratSearchStruct
+{
+  const vtkGratProfile *Profile;
+  const double *Spacings;
+  int NumberOfSpacings;
+  int MaxStarts;
+  double *Foms; // MaxStarts per spacing
+  int *NumberOfStarts;
+};
+
+//----------------------------------------------------------------------------
+// Compute the figure of merit for every start position of a set of
+// spacings, the spacings are dealt out to the threads in turn
+static VTK_THREAD_RETURN_TYPE vtkGratSearchThread(void *arg)
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  int threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  vtkGratSearchStruct *str = (vtkGratSearchStruct *)
+    (((ThreadInfoStruct *)(arg))->UserData);
+
+  for (int k = threadId; k < str->NumberOfSpacings; k += threadCount)
+    {
+    double spacing = str->Spacings[k];
+    double *foms = str->Foms + k*str->MaxStarts;
+    int n = 0;
+    for (double start = 1; start < spacing+1 && n < str->MaxStarts;
+         start += 0.25)
+      {
+      double fom = 0;
+      double val;
+      int i;
+      for (i = 0; vtkGratSample(str->Profile, start + spacing*i, val); i++)
+        {
+        fom += val;
+        }
+      foms[n++] = fom/(i + 1);
+      }
+    str->NumberOfStarts[k] = n;
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
 // This function analyzes a 1D image array of size 'size' which is known
 // to contain a graticule pattern. 
 // The spacing between the graticules, the position of the first graticule,
 // and the number of graticules are returned.
-static void vtkAnalyzeGratingImage(float *image, int size,
+static void vtkAnalyzeGratingImage(vtkMultiThreader *threader,
+                                   float *image, int size,
 				   double mins, double maxs,
                                    vtkFloatingPointType &rspacing,
 				   vtkFloatingPointType &rstart, int &rn)
 {
-  int i;
+  int i, k, n;
   double bestspacing = 0;
   double beststart = 0;
   double bestfom = 0;
 
-  // loop over a whole bunch of spacings & start positions, find the
-  // one for which the most 'white' lies on the graticules.
-  for (double spacing = mins; spacing <= maxs; spacing += 0.03125)
+  vtkGratProfile profile;
+  vtkGratPrepareProfile(image, size, &profile);
+
+  // the spacings to try, in the order that they are tried
+  double spacing;
+  int numSpacings = 0;
+  for (spacing = mins; spacing <= maxs; spacing += 0.03125)
     {
-    for (double start = 1; start < spacing+1; start += 0.25)
-      {
-      double fom = 0;
-      for (i = 0; ; i++)
-        {
-        double x = start + spacing*i;
-        double f0, f1, f2;
-        int x0, x1, x2;
-        vtkGratInterpCoeffs(x, x0, x1, x2, f0, f1, f2);
-        if (x2 >= size)
-          {
-          break;
-          }
-        fom += f0*image[x0] + f1*image[x1] + f2*image[x2];
-        }
-      fom /= i + 1;
+    numSpacings++;
+    }
+  double *spacings = new double[numSpacings + 1];
+  k = 0;
+  for (spacing = mins; spacing <= maxs; spacing += 0.03125)
+    {
+    spacings[k++] = spacing;
+    }
 
+  // compute the figures of merit for all spacings and start positions
+  // in parallel
+  vtkGratSearchStruct str;
+  str.Profile = &profile;
+  str.Spacings = spacings;
+  str.NumberOfSpacings = numSpacings;
+  str.MaxStarts = (numSpacings > 0 ?
+                   int(4*spacings[numSpacings-1]) + 2 : 1);
+  str.Foms = new double[numSpacings*str.MaxStarts + 1];
+  str.NumberOfStarts = new int[numSpacings + 1];
+  vtkFrameAnalyzeMultiThread(threader, vtkGratSearchThread, &str);
+
+  // find the one for which the most 'white' lies on the graticules,
+  // going through them in order because the choice depends on the
+  // best spacing that was found so far
+  for (k = 0; k < numSpacings; k++)
+    {
+    spacing = spacings[k];
+    double *foms = str.Foms + k*str.MaxStarts;
+    for (n = 0; n < str.NumberOfStarts[k]; n++)
+      {
+      double fom = foms[n];
       if (fom > bestfom)
         {
-        //fprintf(stderr, "f, s, s %f %f %f\n",fom,start,spacing);
         double ratio = spacing/bestspacing;
         int iratio = vtkResliceRound(ratio);
         if (fom*0.7 > bestfom || iratio == 1 ||
 	    ((ratio > iratio) ? (ratio - iratio) : (iratio - ratio)) > 0.1)
           {
           bestfom = fom;
-          beststart = start;
+          beststart = 1 + 0.25*n;
           bestspacing = spacing;
           }
         }
       }
     }
+
+  delete [] spacings;
+  delete [] str.Foms;
+  delete [] str.NumberOfStarts;
+
   rspacing = bestspacing;
+  if (bestspacing <= 0)
+    {
+    // no graticules
+    rstart = beststart;
+    rn = 0;
+    vtkGratReleaseProfile(&profile);
+    return;
+    }
 
   // find out precisely where the graticule starts, i.e. find the
   // first graticule position that is 'white'
-  for (i = 0; ; i++)
+  double val;
+  for (i = 0; vtkGratSample(&profile, beststart + bestspacing*i, val); i++)
     {
-    double x = beststart + bestspacing*i;
-    double f0, f1, f2;
-    int x0, x1, x2;
-    vtkGratInterpCoeffs(x, x0, x1, x2, f0, f1, f2);
-    if (x2 >= size)
-      {
-      break;
-      }
-    if (f0*image[x0] + f1*image[x1] + f2*image[x2] > bestfom*0.2)
+    if (val > bestfom*0.2)
       {
       break;
       }
@@ -279,22 +515,16 @@ static void vtkAnalyzeGratingImage(float *image, int size,
   rstart = beststart + bestspacing*i;
 
   // find out where the graticules stops
-  for (i = 0; ; i++)
+  for (i = 0; vtkGratSample(&profile, rstart + bestspacing*i, val); i++)
     {
-    double x = rstart + bestspacing*i;
-    double f0, f1, f2;
-    int x0, x1, x2;
-    vtkGratInterpCoeffs(x, x0, x1, x2, f0, f1, f2);
-    if (x2 >= size)
-      {
-      break;
-      }
-    if (f0*image[x0] + f1*image[x1] + f2*image[x2] < bestfom*0.2)
+    if (val < bestfom*0.2)
       {
       break;
       }
     }
   rn = i;
+
+  vtkGratReleaseProfile(&profile);
 }
 
 // the orientation dot on an Aloka SSD-1700
@@ -388,28 +618,145 @@ static unsigned char SSD5000_FOCUS[]   = {0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
                                           0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,
                                           0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,0,};
 
+//----------------------------------------------------------------------------
+struct vtkGlyphSearchStruct
+{
+  unsigned char *ImPtr;
+  int MinI, MaxI, MinJ, MaxJ;
+  vtkIdType IncX, IncY;
+  int WhiteThresh;
+  double MatchThresh;
+  unsigned char Glyph[256];
+  unsigned char Mask[256];
+  int NumberOfCoords;
+  int (*Coords)[2]; // NumberOfCoords per thread
+  int *Sums;        // NumberOfCoords per thread
+  int NumberFound[VTK_MAX_THREADS];
+};
+
+//----------------------------------------------------------------------------
+// Insert a match into a list of matches that is sorted by the sum of
+// squared differences, if it is better than one of the matches in the list
+static void vtkGlyphInsertMatch(int (*coords)[2], int *coordsum2,
+                                int ncoords, int x, int y, int sum2)
+{
+  for (int c = 0; c < ncoords; c++)
+    {
+    if (sum2 < coordsum2[c])
+      {
+      for (int cc = ncoords-1; cc > c; cc--)
+        {
+        coords[cc][0] = coords[cc-1][0];
+        coords[cc][1] = coords[cc-1][1];
+        coordsum2[cc] = coordsum2[cc-1];
+        }
+      coords[c][0] = x; 
+      coords[c][1] = y;
+      coordsum2[c] = sum2;
+      break;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Search a block of rows for the glyph
+static VTK_THREAD_RETURN_TYPE vtkGlyphSearchThread(void *arg)
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  int threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  vtkGlyphSearchStruct *str = (vtkGlyphSearchStruct *)
+    (((ThreadInfoStruct *)(arg))->UserData);
+
+  int ncoords = str->NumberOfCoords;
+  int (*coords)[2] = str->Coords + threadId*ncoords;
+  int *coordsum2 = str->Sums + threadId*ncoords;
+  for (int c = 0; c < ncoords; c++)
+    {
+    coordsum2[c] = 1073741824;
+    }
+
+  int minj, maxj;
+  vtkFrameAnalyzeSplitRange(str->MinJ, str->MaxJ, threadId, threadCount,
+                            minj, maxj);
+
+  unsigned char *imPtr = str->ImPtr;
+  vtkIdType imIncX = str->IncX;
+  vtkIdType imIncY = str->IncY;
+  int numfound = 0;
+
+  int llastsum2 = 1073741824;
+  int lastsum2 = 1073741824;
+  for (int j = minj; j <= maxj; j++)
+    {
+    for (int i = str->MinI; i <= str->MaxI; i++)
+      {
+      if (imPtr[(j+7)*imIncY + (i+7)*imIncX] < str->WhiteThresh)
+        {
+        continue;
+        }
+
+      int sum2 = 0;
+      for (int jj = 0; jj < 16; jj++)
+        {
+        int jjj = j + jj;
+        unsigned char *imPtr0 = imPtr + jjj*imIncY + i*imIncX;
+        unsigned char *glyph0 = str->Glyph + jj*16;
+        unsigned char *mask0 = str->Mask + jj*16;
+        for (int ii = 0; ii < 16; ii++)
+          {
+          int diff = (*glyph0 - *imPtr0)*(*mask0);
+          sum2 += (diff*diff)*255/(*glyph0 + 8);
+          glyph0++;
+          mask0++;
+          imPtr0 += imIncX;
+          }
+        }
+
+      if (lastsum2 < sum2 && lastsum2 < llastsum2 &&
+          lastsum2 < str->MatchThresh)
+        {
+        // insert it into the list
+        numfound++;
+        vtkGlyphInsertMatch(coords, coordsum2, ncoords, i-1, j, lastsum2);
+        }
+      llastsum2 = lastsum2;
+      lastsum2 = sum2;
+      }
+    }
+
+  str->NumberFound[threadId] = numfound;
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
 // Search for the specified 16x16 binary glyph within an image, where
 // [black,white] is the range of grey values in the image.
 // You must pass a coord array for this function to fill in, as well as
 // the maximum number 'ncoords' of matches to place in the array.
 // The return value from this function is the number of matches actually
 // found, which might be either greater or less than ncoords.
-static int vtkGetGlyphPositions(unsigned char *imPtr, int imExt[6], 
+// The rows are split between the threads, and the best matches from
+// each thread are merged in row order.
+static int vtkGetGlyphPositions(vtkMultiThreader *threader,
+                                unsigned char *imPtr, int imExt[6], 
                                 vtkIdType imInc[3], float black, float white,
                                 unsigned char *glyph, 
                                 int (*coords)[2], int ncoords)
 {
-  float scale = 1.0/(white-black);
-  int whitethresh = vtkResliceFloor(white*0.5);
+  vtkGlyphSearchStruct str;
+
+  str.ImPtr = imPtr;
+  str.WhiteThresh = vtkResliceFloor(white*0.5);
 
-  int mini = imExt[0];
-  int maxi = imExt[1] - 16;
+  str.MinI = imExt[0];
+  str.MaxI = imExt[1] - 16;
   
-  int minj = imExt[2];
-  int maxj = imExt[3] - 16;
+  str.MinJ = imExt[2];
+  str.MaxJ = imExt[3] - 16;
   
-  vtkIdType imIncX = imInc[0];
-  vtkIdType imIncY = imInc[1];
+  str.IncX = imInc[0];
+  str.IncY = imInc[1];
 
   unsigned char *tmpGlyph = new unsigned char[288];
   memset(tmpGlyph,0,288);
@@ -423,8 +770,8 @@ static int vtkGetGlyphPositions(unsigned char *imPtr, int imExt[6],
 
   // convolve the shape with an approximate of the video prefilter
   static float kernel[5] = {-0.05, 0.30, 0.50, 0.30, -0.05};
-  unsigned char gPtr[256], gMaskPtr[256];
-  //fprintf(stderr,"%3.3i %3.3i ",0,0);
+  unsigned char *gPtr = str.Glyph;
+  unsigned char *gMaskPtr = str.Mask;
   int numpixels = 0;
   for (int k = 0; k < 256; k++)
     {
@@ -467,6 +814,21 @@ static int vtkGetGlyphPositions(unsigned char *imPtr, int imExt[6],
   delete [] tmpGlyph;
   delete [] tmpMask;
 
+  str.MatchThresh = 0.2*numpixels*(white-black)*(white-black);
+
+  // search in parallel
+  int numThreads = threader->GetNumberOfThreads();
+  str.NumberOfCoords = ncoords;
+  str.Coords = new int[numThreads*ncoords][2];
+  str.Sums = new int[numThreads*ncoords];
+  int t;
+  for (t = 0; t < numThreads; t++)
+    {
+    str.NumberFound[t] = 0;
+    }
+  vtkFrameAnalyzeMultiThread(threader, vtkGlyphSearchThread, &str);
+
+  // merge the matches
   int *coordsum2 = new int[ncoords];
   for (int c = 0; c < ncoords; c++)
     {
@@ -474,74 +836,120 @@ static int vtkGetGlyphPositions(unsigned char *imPtr, int imExt[6],
     }
 
   int numfound = 0;
-
-  int llastsum2 = 1073741824;
-  int lastsum2 = 1073741824;
-  for (int j = minj; j <= maxj; j++)
+  for (t = 0; t < numThreads; t++)
     {
-    for (int i = mini; i <= maxi; i++)
+    numfound += str.NumberFound[t];
+    for (int c = 0; c < ncoords; c++)
       {
-      if (imPtr[(j+7)*imIncY + (i+7)*imIncX] < whitethresh)
+      int sum2 = str.Sums[t*ncoords + c];
+      if (sum2 < 1073741824)
         {
-        continue;
+        vtkGlyphInsertMatch(coords, coordsum2, ncoords,
+                            str.Coords[t*ncoords + c][0],
+                            str.Coords[t*ncoords + c][1], sum2);
         }
-
-      int sum2 = 0;
-      for (int jj = 0; jj < 16; jj++)
-        {
-        int jjj = j + jj;
-        unsigned char *imPtr0 = imPtr + jjj*imIncY + i*imIncX;
-        unsigned char *glyph0 = gPtr + jj*16;
-        unsigned char *mask0 = gMaskPtr + jj*16;
-        for (int ii = 0; ii < 16; ii++)
-          {
-          int diff = (*glyph0 - *imPtr0)*(*mask0);
-          sum2 += (diff*diff)*255/(*glyph0 + 8);
-          glyph0++;
-          mask0++;
-          imPtr0 += imIncX;
-          }
-        }
-
-      if (lastsum2 < sum2 && lastsum2 < llastsum2 &&
-          lastsum2 < 0.2*numpixels*(white-black)*(white-black))
-        {
-        fprintf(stderr,"found at %i,%i  %i %f\n",i-1,j,lastsum2,
-                0.2*numpixels*(white-black)*(white-black));
-        // insert it into the list
-        numfound++;
-        for (int c = 0; c < ncoords; c++)
-          {
-          if (lastsum2 < coordsum2[c])
-            {
-            for (int cc = ncoords-1; cc > c; cc--)
-              {
-              coords[cc][0] = coords[cc-1][0];
-              coords[cc][1] = coords[cc-1][1];
-              coordsum2[cc] = coordsum2[cc-1];
-              }
-            coords[c][0] = i-1; 
-            coords[c][1] = j;
-            coordsum2[c] = lastsum2;
-            break;
-            }
-          }
-        }
-      llastsum2 = lastsum2;
-      lastsum2 = sum2;
       }
     }
 
   delete [] coordsum2;
+  delete [] str.Coords;
+  delete [] str.Sums;
 
   return numfound;
 }
                           
+//----------------------------------------------------------------------------
+// Make the 1D profiles of the y and x graticules, normalized so that
+// black is zero and white is one.  These are used for finding the spacing
+// and origin, and also for the frame signature.
+static void vtkGetGratingProfiles(vtkImageData *input, unsigned char *inPtr,
+                                  float black, float white,
+                                  int ClipGuess[6],
+                                  float *ygrating, float *xgrating)
+{
+  int i, j, jstart, jstop;
+  vtkIdType inInc[3];
+  input->GetIncrements(inInc);
+
+  // sum together the columns of the image between 
+  // one-thirtenth and 1/13 + 1/32 of the way across
+  // the image to make a single-column 1D image
+  jstart = ClipGuess[0];
+  jstop =  ClipGuess[0] + (ClipGuess[1] - ClipGuess[0] + 1)/32;
+  for (i = ClipGuess[2]; i <= ClipGuess[3]; i++)
+    {
+    double val = 0;
+    for (j = jstart; j < jstop; j++)
+      {
+      val += inPtr[i*inInc[1] + j*inInc[0]];
+      }
+    ygrating[i - ClipGuess[2]] = float((val/(jstop - jstart) - black)/
+				       (white - black));
+    }
+
+  // sum together the rows of the image between 
+  // one-twelfth and three-twentyfourths of the way up
+  // the image to make a single-row 1D image, going along the
+  // rows so that the memory is read in order
+  int nx = ClipGuess[1] - ClipGuess[0] + 1;
+  double *xsum = new double[nx];
+  for (i = 0; i < nx; i++)
+    {
+    xsum[i] = 0;
+    }
+ 
+  jstart = ClipGuess[2];
+  jstop =  ClipGuess[2] + (ClipGuess[3] - ClipGuess[2] + 1)/20;
+  for (j = jstart; j < jstop; j++)
+    {
+    unsigned char *rowPtr = inPtr + j*inInc[1] + ClipGuess[0]*inInc[0];
+    for (i = 0; i < nx; i++)
+      {
+      xsum[i] += rowPtr[i*inInc[0]];
+      }
+    }
+  for (i = 0; i < nx; i++)
+    {
+    xgrating[i] = float((xsum[i]/(jstop - jstart) - black)/(white - black));
+    }
+
+  delete [] xsum;
+}
+
+//----------------------------------------------------------------------------
+// The frame signature is a hash of the two graticule profiles.  Each
+// sample of the profiles is reduced to a single bit (brighter or darker
+// than halfway between black and white) so that noise in the video does
+// not change the signature, but moving the graticules does.
+static unsigned long vtkGetFrameSignature(const int extent[6],
+                                          const float *ygrating, int ny,
+                                          const float *xgrating, int nx)
+{
+  unsigned long hash = 2166136261UL;
+  int i;
+  for (i = 0; i < 4; i++)
+    {
+    hash = ((hash ^ (unsigned long)(extent[i])) * 16777619UL) & 0xffffffffUL;
+    }
+  for (i = 0; i < ny; i++)
+    {
+    hash = ((hash ^ (ygrating[i] > 0.5f)) * 16777619UL) & 0xffffffffUL;
+    }
+  for (i = 0; i < nx; i++)
+    {
+    hash = ((hash ^ (xgrating[i] > 0.5f)) * 16777619UL) & 0xffffffffUL;
+    }
+  return hash;
+}
+
+//----------------------------------------------------------------------------
 // This function finds the x and y graticules that are present in the
 // image and uses them to determine the x and y pixel spacing and
 // origin of the image.
 static void vtkGetSpacingAndOrigin(vtkUltrasoundFrameAnalyze *self,
+                                   vtkMultiThreader *threader,
                                    vtkImageData *input, unsigned char *inPtr,
+                                   float *ygrating, float *xgrating,
                                    vtkFloatingPointType Origin[3],
 				   vtkFloatingPointType Spacing[3],
 				   int ClipGuess[6],
@@ -559,23 +967,9 @@ static void vtkGetSpacingAndOrigin(vtkUltrasoundFrameAnalyze *self,
   float black = self->GetBlackLevel();
   float white = self->GetWhiteLevel();
 
-  // sum together the columns of the image between 
-  // one-thirtenth and 1/13 + 1/32 of the way across
-  // the image to make a single-column 1D image
-  float *ygrating = new float[ClipGuess[3] - ClipGuess[2] + 1];
- 
+  // the columns that were summed for the y graticule profile
   jstart = ClipGuess[0];
   jstop =  ClipGuess[0] + (ClipGuess[1] - ClipGuess[0] + 1)/32;
-  for (i = ClipGuess[2]; i <= ClipGuess[3]; i++)
-    {
-    double val = 0;
-    for (j = jstart; j < jstop; j++)
-      {
-      val += inPtr[i*inInc[1] + j*inInc[0]];
-      }
-    ygrating[i - ClipGuess[2]] = float((val/(jstop - jstart) - black)/
-				       (white - black));
-    }
 
   // minimum and maximum spacing between graticules
   double mins = (ClipGuess[3] - ClipGuess[2] + 1)/25;
@@ -584,13 +978,13 @@ static void vtkGetSpacingAndOrigin(vtkUltrasoundFrameAnalyze *self,
   // analyze the 1D image to find the graticule parameters
   vtkFloatingPointType yspacing, ystart;
   int yn;
-  vtkAnalyzeGratingImage(ygrating, ClipGuess[3] - ClipGuess[2] + 1,
+  vtkAnalyzeGratingImage(threader, ygrating, ClipGuess[3] - ClipGuess[2] + 1,
 			 mins, maxs,
                          yspacing, ystart, yn);
   ystart += ClipGuess[2];
-  delete [] ygrating;
 
-  cerr << "best " << yspacing << " " << ystart << " " << yn << "\n";
+  vtkDebugWithObjectMacro(self, << "best " << yspacing << " " << ystart
+                          << " " << yn);
 
   // find the precise y position of the x graticule, in order to
   // determine the image bounding box:
@@ -639,10 +1033,11 @@ static void vtkGetSpacingAndOrigin(vtkUltrasoundFrameAnalyze *self,
     last_major_yn = major_yn;
     major_yn = try_major_yn;
     }
-  cerr << "x position: " << xmin << " " << xmin2 << "\n";
+  vtkDebugWithObjectMacro(self, << "x position: " << xmin << " " << xmin2);
 
   // get the ratio of tick marks that are major ticks
-  cerr << "major tick every " << tickratio << " ticks\n";
+  vtkDebugWithObjectMacro(self, << "major tick every " << tickratio
+                          << " ticks");
   
   /*
   // for debugging purposes: re-draw the graticules
@@ -667,34 +1062,20 @@ static void vtkGetSpacingAndOrigin(vtkUltrasoundFrameAnalyze *self,
     }
   */
   
-  // sum together the rows of the image between 
-  // one-twelfth and three-twentyfourths of the way up
-  // the image to make a single-row 1D image
-  float *xgrating = new float[ClipGuess[1] - ClipGuess[0] + 1];
- 
+  // the rows that were summed for the x graticule profile
   jstart = ClipGuess[2];
   jstop =  ClipGuess[2] + (ClipGuess[3] - ClipGuess[2] + 1)/20;
-  for (i = ClipGuess[0]; i <= ClipGuess[1]; i++)
-    {
-    double val = 0;
-    for (j = jstart; j < jstop; j++)
-      {
-      val += inPtr[i*inInc[0] + j*inInc[1]];
-      }
-    xgrating[i - ClipGuess[0]] = float((val/(jstop - jstart) - black)/
-				       (white - black));
-    }
 
   // analyze the 1D image to find the graticule parameters
   vtkFloatingPointType xspacing, xstart;
   int xn;
-  vtkAnalyzeGratingImage(xgrating, ClipGuess[1] - ClipGuess[0] + 1,
+  vtkAnalyzeGratingImage(threader, xgrating, ClipGuess[1] - ClipGuess[0] + 1,
 			 yspacing*0.8, yspacing*1.2,
                          xspacing, xstart, xn);
   xstart += ClipGuess[0];
-  delete [] xgrating;
 
-  cerr << "best " << xspacing << " " << xstart << " " << xn << "\n";
+  vtkDebugWithObjectMacro(self, << "best " << xspacing << " " << xstart
+                          << " " << xn);
 
   // find the precise y position of the x graticule, in order to
   // determine the image bounding box:
@@ -726,7 +1107,7 @@ static void vtkGetSpacingAndOrigin(vtkUltrasoundFrameAnalyze *self,
       ymin2 = j;
       }
     }
-  cerr << "y position: " << ymin << " " << ymin2 << "\n";  
+  vtkDebugWithObjectMacro(self, << "y position: " << ymin << " " << ymin2);
 
  /* 
   // for debugging purposes: re-draw the graticules
@@ -790,6 +1171,7 @@ static void vtkGetSpacingAndOrigin(vtkUltrasoundFrameAnalyze *self,
 // the image it lies within, then stores the results in 'flip'.  The
 // Z-flip is always set to zero.
 static void vtkGetFlip(vtkUltrasoundFrameAnalyze *self,
+                       vtkMultiThreader *threader,
                        vtkImageData *input, unsigned char *inPtr,
                        int flip[2])
 {
@@ -803,7 +1185,8 @@ static void vtkGetFlip(vtkUltrasoundFrameAnalyze *self,
   float black = self->GetBlackLevel();
   float white = self->GetWhiteLevel();
 
-  fprintf(stderr, "black = %f, white = %f\n", black, white);
+  vtkDebugWithObjectMacro(self, << "black = " << black << ", white = "
+                          << white);
 
   int coords[1][2];
   int found = 0;
@@ -811,18 +1194,18 @@ static void vtkGetFlip(vtkUltrasoundFrameAnalyze *self,
   if (inExt[1] - inExt[0] + 1 > 380) // full-resolution ultrasound image
     {
     // try finding the orientation dots for each machine
-    fprintf(stderr, "SSD5000_DOT\n");
-    found |= vtkGetGlyphPositions(inPtr,inExt,inInc,black,white,SSD5000_DOT,
-                                  coords,1);
-    fprintf(stderr, "SSD1700_DOT\n");
-    found |= vtkGetGlyphPositions(inPtr,inExt,inInc,black,white,SSD1700_DOT,
-                                  coords,1);
+    vtkDebugWithObjectMacro(self, << "SSD5000_DOT");
+    found |= vtkGetGlyphPositions(threader,inPtr,inExt,inInc,black,white,
+                                  SSD5000_DOT, coords,1);
+    vtkDebugWithObjectMacro(self, << "SSD1700_DOT");
+    found |= vtkGetGlyphPositions(threader,inPtr,inExt,inInc,black,white,
+                                  SSD1700_DOT, coords,1);
     }
   else // reduced-resolution (e.g. 320x240) ultrasound image
     {
-    fprintf(stderr, "SSD HALF_DOT\n");
-    found |= vtkGetGlyphPositions(inPtr,inExt,inInc,black,white,SSDHALF_DOT,
-                                  coords,1);    
+    vtkDebugWithObjectMacro(self, << "SSD HALF_DOT");
+    found |= vtkGetGlyphPositions(threader,inPtr,inExt,inInc,black,white,
+                                  SSDHALF_DOT, coords,1);    
     }
 
   // find the 'centre' of the image, i.e. the points that separates
@@ -837,7 +1220,137 @@ static void vtkGetFlip(vtkUltrasoundFrameAnalyze *self,
   flip[1] = (coords[0][1] < ycenter);
   flip[2] = 0;
 
-  fprintf(stderr,"Flip -> %i %i %i\n",flip[0],flip[1],flip[2]);
+  vtkDebugWithObjectMacro(self, << "Flip -> " << flip[0] << " " << flip[1]
+                          << " " << flip[2]);
+}
+
+//----------------------------------------------------------------------------
+struct vtkFanEdgeStruct
+{
+  unsigned char *InPtr;
+  vtkIdType IncX, IncY;
+  int XMin, XMax, YMin, YMax, XCenter;
+  int Thresh;
+  float Black, White;
+  int NumberOfStarts; // the number of x0 positions to try on each side
+  double BestFom[VTK_MAX_THREADS][2];
+  int BestLine[VTK_MAX_THREADS][2][4];
+  int BestIndex[VTK_MAX_THREADS][2];
+};
+
+//----------------------------------------------------------------------------
+// Try all the lines from the bottom of the image at x0 towards the top
+// of the image on the given side, and keep the line that best matches
+// an edge of the fan if it is better than bestfom.
+static void vtkFanEdgeSearch(vtkFanEdgeStruct *str, int side, int x0,
+                             double &bestfom, int bestline[4])
+{
+  unsigned char *inPtr = str->InPtr;
+  vtkIdType incX = str->IncX;
+  vtkIdType incY = str->IncY;
+  int xmin = str->XMin;
+  int xmax = str->XMax;
+  int ymin = str->YMin;
+  int ymax = str->YMax;
+  int thresh = str->Thresh;
+  float black = str->Black;
+  float white = str->White;
+
+  int x, y, x1, tx1, y1;
+  int y0 = ymax;
+  int leftsum, rightsum;
+
+  for (tx1 = x0; (tx1 - x0)*side < (ymax - ymin)*2; tx1 += side)
+    {
+    x1 = tx1;
+    y1 = ymin;
+    if (x1 > xmax)
+      {
+      x1 = xmax;
+      y1 = vtkResliceRound(y0 - ((x1 - x0)*1.0/(tx1 - x0))*(ymax - ymin));
+      }
+    else if (x1 < xmin)
+      {
+      x1 = xmin;
+      y1 = vtkResliceRound(y0 - ((x1 - x0)*1.0/(tx1 - x0))*(ymax - ymin));
+      }
+    if ((y0 - y1)*3 < (ymax - ymin))
+      {
+      continue;
+      }
+    leftsum = rightsum = 0;
+    for (y = y1; y <= y0; y += 4)
+      {
+      x = vtkResliceRound(x0 + ((x1 - x0)*1.0/(y0 - y1))*(y0 - y));
+      int lv = (inPtr[x*incX + y*incY] +
+                inPtr[(x-side)*incX + y*incY]) >> 1;
+      int rv = inPtr[(x+side)*incX + y*incY];
+      if (lv > thresh)
+        {
+        lv = thresh;
+        }
+      if (rv > thresh)
+        {
+        rv = thresh;
+        }
+      leftsum += lv;
+      rightsum += rv;
+      }
+    double leftval = ((leftsum*1.0/((y0 - y1 + 1)/4) - black)
+                      /(white - black));
+    double rightval = ((rightsum*1.0/((y0 - y1 + 1)/4) - black)
+                       /(white - black));
+    double fom = (leftval - rightval)*(1 - rightval*rightval);
+
+    if (fom > bestfom)
+      {
+      bestfom = fom;
+      bestline[0] = x0;
+      bestline[1] = y0;
+      bestline[2] = x1;
+      bestline[3] = y1;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// The starting positions on both sides are dealt out to the threads in
+// turn, each thread keeps its best line for each side
+static VTK_THREAD_RETURN_TYPE vtkFanEdgeThread(void *arg)
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  int threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  vtkFanEdgeStruct *str = (vtkFanEdgeStruct *)
+    (((ThreadInfoStruct *)(arg))->UserData);
+
+  int j, k;
+  for (j = 0; j < 2; j++)
+    {
+    str->BestFom[threadId][j] = 0;
+    str->BestIndex[threadId][j] = 0;
+    for (k = 0; k < 4; k++)
+      {
+      str->BestLine[threadId][j][k] = 0;
+      }
+    }
+
+  int n = str->NumberOfStarts;
+  for (int w = threadId; w < 2*n; w += threadCount)
+    {
+    j = w/n;
+    k = w - j*n;
+    int side = 2*j - 1;
+    double fom = str->BestFom[threadId][j];
+    vtkFanEdgeSearch(str, side, str->XCenter + k*side, fom,
+                     str->BestLine[threadId][j]);
+    if (fom > str->BestFom[threadId][j])
+      {
+      str->BestFom[threadId][j] = fom;
+      str->BestIndex[threadId][j] = k;
+      }
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
 }
 
 //----------------------------------------------------------------------------
@@ -845,6 +1358,7 @@ static void vtkGetFlip(vtkUltrasoundFrameAnalyze *self,
 // ultrasound fan.  This is done by finding the two edges that define
 // the fan.
 static void vtkGetFanAngles(vtkUltrasoundFrameAnalyze *self,
+                            vtkMultiThreader *threader,
                             vtkImageData *input, unsigned char *inPtr,
                             double FanAngles[2], double FanOrigin[2],
                             double &FanDepth)
@@ -886,85 +1400,58 @@ static void vtkGetFanAngles(vtkUltrasoundFrameAnalyze *self,
   double bestfom = 0;
   int leftsum, rightsum;
 
+  // search for the two edges in parallel
+  vtkFanEdgeStruct str;
+  str.InPtr = inPtr;
+  str.IncX = inInc[0];
+  str.IncY = inInc[1];
+  str.XMin = xmin;
+  str.XMax = xmax;
+  str.YMin = ymin;
+  str.YMax = ymax;
+  str.XCenter = xcenter;
+  str.Thresh = thresh;
+  str.Black = black;
+  str.White = white;
+  str.NumberOfStarts = (xmax - xcenter)*8/10 + 1;
+  if (str.NumberOfStarts < 0)
+    {
+    str.NumberOfStarts = 0;
+    }
+  vtkFrameAnalyzeMultiThread(threader, vtkFanEdgeThread, &str);
+  int numThreads = threader->GetNumberOfThreads();
+
   double bx0[2], by0[2], bx1[2], by1[2];
   for (int side = -1; side <= 1; side += 2)
     {
-    int x, y, x0, x1, tx1, y0, y1;
+    int j = (1 + side)/2;
+
+    // merge the threads' results, on a tie the first line that
+    // was tried wins
     int bestx0 = 0;
     int besty0 = 0;
     int bestx1 = 0;
     int besty1 = 0;
-    y0 = ymax;
+    int bestk = 0;
     bestfom = 0;
-
-    for (x0 = xcenter; (x0 - xcenter)*side <= (xmax - xcenter)*8/10; x0+=side)
+    for (int t = 0; t < numThreads; t++)
       {
-      for (tx1 = x0; (tx1 - x0)*side < (ymax - ymin)*2; tx1 += side)
+      fom = str.BestFom[t][j];
+      if (fom > bestfom || (fom == bestfom && fom > 0 &&
+                            str.BestIndex[t][j] < bestk))
         {
-        x1 = tx1;
-        y1 = ymin;
-        if (x1 > xmax)
-          {
-          x1 = xmax;
-          y1 = vtkResliceRound(y0 - ((x1 - x0)*1.0/(tx1 - x0))*(ymax - ymin));
-          }
-        else if (x1 < xmin)
-          {
-          x1 = xmin;
-          y1 = vtkResliceRound(y0 - ((x1 - x0)*1.0/(tx1 - x0))*(ymax - ymin));
-          }
-        if ((y0 - y1)*3 < (ymax - ymin))
-          {
-          continue;
-          }
-        leftsum = rightsum = 0;
-        for (y = y1; y <= y0; y += 4)
-          {
-          x = vtkResliceRound(x0 + ((x1 - x0)*1.0/(y0 - y1))*(y0 - y));
-          int lv = (inPtr[x*inInc[0] + y*inInc[1]] +
-                    inPtr[(x-side)*inInc[0] + y*inInc[1]]) >> 1;
-          int rv = inPtr[(x+side)*inInc[0] + y*inInc[1]];
-          if (lv > thresh)
-            {
-            lv = thresh;
-            }
-          if (rv > thresh)
-            {
-            rv = thresh;
-            }
-          leftsum += lv;
-          rightsum += rv;
-          }
-        double leftval = ((leftsum*1.0/((y0 - y1 + 1)/4) - black)
-                          /(white - black));
-        double rightval = ((rightsum*1.0/((y0 - y1 + 1)/4) - black)
-                           /(white - black));
-        fom = (leftval - rightval)*(1 - rightval*rightval);
-        
-        if (fom > bestfom)
-          {
-          bestfom = fom;
-          bestx0 = x0;
-          besty0 = y0;
-          bestx1 = x1;
-          besty1 = y1;
-          }
-        /*
-        if (fom > 0.005)
-        { 
-        cerr << fom;
-        cerr << " (" << x0 << ", " << y0 << "), (" << x1 << ", " << y1 << ") ";
-        cerr << " left " << leftval;
-        cerr << " right " << rightval;
-        cerr << "\n";
-        }
-                         */
-      
+        bestfom = fom;
+        bestk = str.BestIndex[t][j];
+        bestx0 = str.BestLine[t][j][0];
+        besty0 = str.BestLine[t][j][1];
+        bestx1 = str.BestLine[t][j][2];
+        besty1 = str.BestLine[t][j][3];
         }
       }
-    fprintf(stderr, "best line = (%i, %i), (%i, %i) %f\n",bestx0,besty0,bestx1,besty1,bestfom);
+    vtkDebugWithObjectMacro(self, << "best line = (" << bestx0 << ", "
+                            << besty0 << "), (" << bestx1 << ", " << besty1
+                            << ") " << bestfom);
 
-    int j = (1 + side)/2;
     double dx = bestx1 - bestx0;
     double dy = besty1 - besty0;
     FanAngles[j] = atan2(dx*Spacing[0],-dy*Spacing[1])*57.2957795131;
@@ -985,8 +1472,9 @@ static void vtkGetFanAngles(vtkUltrasoundFrameAnalyze *self,
   FanOrigin[0] = Origin[0] + (bx0[0] + l[0]*(bx1[0] - bx0[0]))*Spacing[0];
   FanOrigin[1] = Origin[1] + (by0[0] + l[0]*(by1[0] - by0[0]))*Spacing[1];
 
-  fprintf(stderr,"angles = (%f, %f), origin = (%f, %f)\n",
-          FanAngles[0],FanAngles[1],FanOrigin[0],FanOrigin[1]);
+  vtkDebugWithObjectMacro(self, << "angles = (" << FanAngles[0] << ", "
+                          << FanAngles[1] << "), origin = (" << FanOrigin[0]
+                          << ", " << FanOrigin[1] << ")");
 
   bestfom = 0;
   int bestdepth = 0;
@@ -996,7 +1484,8 @@ static void vtkGetFanAngles(vtkUltrasoundFrameAnalyze *self,
   int mindepth = vtkResliceRound(FanOrigin[1]/Spacing[1] + (ymax-ymin)*1.0);
   int maxdepth = vtkResliceRound(FanOrigin[1]/Spacing[1] + (ymax-ymin)*1.5);
 
-  fprintf(stderr, "x0 = %f, y0 = %f, off = %f\n", x0, y0, FanOrigin[1]/Spacing[1]);
+  vtkDebugWithObjectMacro(self, << "x0 = " << x0 << ", y0 = " << y0
+                          << ", off = " << FanOrigin[1]/Spacing[1]);
 
   for (int depth = mindepth; depth < maxdepth; depth++)
     {
@@ -1053,7 +1542,8 @@ static void vtkGetFanAngles(vtkUltrasoundFrameAnalyze *self,
     bestdepth = maxdepth;
     }
 
-  fprintf(stderr, "best depth = %i %i %f\n",bestdepth,bestcount,bestfom);
+  vtkDebugWithObjectMacro(self, << "best depth = " << bestdepth << " "
+                          << bestcount << " " << bestfom);
 
   FanDepth = bestdepth*Spacing[1];
 }
@@ -1061,7 +1551,7 @@ static void vtkGetFanAngles(vtkUltrasoundFrameAnalyze *self,
 //----------------------------------------------------------------------------
 void vtkUltrasoundFrameAnalyze::Analyze()
 {
-  vtkImageData *input = this->GetInput();
+  vtkImageData *input = vtkImageData::SafeDownCast(this->GetInput());
   vtkFloatingPointType *inSpacing, *inOrigin;
   int inExt[6], numScalars;
   vtkIdType inInc[3];
@@ -1101,47 +1591,92 @@ void vtkUltrasoundFrameAnalyze::Analyze()
       }
     }
 
-  vtkGetBlackAndWhite(this, input, inPtr, this->BlackLevel, this->WhiteLevel);
-  vtkGetSpacingAndOrigin(this, input, inPtr, this->Origin, this->Spacing,
-                         clipGuess,
-			 this->ClipExtent, this->ClipRectangle);
-  vtkGetFlip(this, input, inPtr, this->Flip);
-  vtkGetFanAngles(this, input, inPtr, this->FanAngles, this->FanOrigin,
-                  this->FanDepth);
+  this->Threader->SetNumberOfThreads(this->NumberOfThreads);
 
-  this->StencilSource->SetClipRectangle(this->ClipRectangle);
-  this->StencilSource->SetFanAngles(this->FanAngles);
-  this->StencilSource->SetFanOrigin(this->FanOrigin);
-  this->StencilSource->SetFanDepth(this->FanDepth);
+  vtkGetBlackAndWhite(this->Threader, input, inPtr,
+                      this->BlackLevel, this->WhiteLevel);
 
-  this->Modified();
+  // the graticule profiles are needed for the spacing, and they also
+  // give a signature that changes when the depth or zoom is changed
+  int ny = clipGuess[3] - clipGuess[2] + 1;
+  int nx = clipGuess[1] - clipGuess[0] + 1;
+  float *ygrating = new float[ny];
+  float *xgrating = new float[nx];
+  vtkGetGratingProfiles(input, inPtr, this->BlackLevel, this->WhiteLevel,
+                        clipGuess, ygrating, xgrating);
+  unsigned long signature = vtkGetFrameSignature(inExt, ygrating, ny,
+                                                 xgrating, nx);
+
+  this->GeometryChanged = (!this->IncrementalAnalysis ||
+                           !this->GeometryValid ||
+                           signature != this->FrameSignature);
+  this->FrameSignature = signature;
+
+  if (this->GeometryChanged)
+    {
+    vtkGetSpacingAndOrigin(this, this->Threader, input, inPtr,
+                           ygrating, xgrating, this->Origin, this->Spacing,
+                           clipGuess,
+                           this->ClipExtent, this->ClipRectangle);
+    vtkGetFlip(this, this->Threader, input, inPtr, this->Flip);
+    vtkGetFanAngles(this, this->Threader, input, inPtr, this->FanAngles,
+                    this->FanOrigin, this->FanDepth);
+
+    this->StencilSource->SetClipRectangle(this->ClipRectangle);
+    this->StencilSource->SetFanAngles(this->FanAngles);
+    this->StencilSource->SetFanOrigin(this->FanOrigin);
+    this->StencilSource->SetFanDepth(this->FanDepth);
+
+    this->GeometryValid = 1;
+    this->Modified();
+    }
+
+  delete [] ygrating;
+  delete [] xgrating;
 }
 
 //----------------------------------------------------------------------------
-// Change the information
-void vtkUltrasoundFrameAnalyze::ExecuteInformation(vtkImageData *inData, 
-                                                   vtkImageData *outData)
+// Change the information: the whole extent and the scalar information
+// are passed from the input by the executive, only the spacing and
+// origin are changed
+int vtkUltrasoundFrameAnalyze::RequestInformation(
+  vtkInformation *vtkNotUsed(request),
+  vtkInformationVector **vtkNotUsed(inputVector),
+  vtkInformationVector *outputVector)
 {
-  outData->SetWholeExtent(inData->GetWholeExtent());
-  outData->SetSpacing(this->Spacing);
-  outData->SetOrigin(this->Origin);
+  vtkInformation *outInfo = outputVector->GetInformationObject(0);
+
+  outInfo->Set(vtkDataObject::SPACING(), this->Spacing, 3);
+  outInfo->Set(vtkDataObject::ORIGIN(), this->Origin, 3);
+
+  return 1;
 }
 
 //----------------------------------------------------------------------------
 // This method simply copies by reference the input data to the output.
-void vtkUltrasoundFrameAnalyze::ExecuteData(vtkDataObject *data)
+int vtkUltrasoundFrameAnalyze::RequestData(
+  vtkInformation *vtkNotUsed(request),
+  vtkInformationVector **inputVector,
+  vtkInformationVector *outputVector)
 {
-  vtkImageData *inData = this->GetInput();
-  vtkImageData *outData = (vtkImageData *)(data);
+  vtkInformation *inInfo = inputVector[0]->GetInformationObject(0);
+  vtkInformation *outInfo = outputVector->GetInformationObject(0);
+
+  vtkImageData *inData = vtkImageData::SafeDownCast(
+    inInfo->Get(vtkDataObject::DATA_OBJECT()));
+  vtkImageData *outData = vtkImageData::SafeDownCast(
+    outInfo->Get(vtkDataObject::DATA_OBJECT()));
 
   outData->SetExtent(inData->GetExtent());
   outData->GetPointData()->PassData(inData->GetPointData());
+
+  return 1;
 }
 
 //----------------------------------------------------------------------------
 void vtkUltrasoundFrameAnalyze::PrintSelf(ostream& os, vtkIndent indent)
 {
-  vtkImageToImageFilter::PrintSelf(os,indent);
+  this->Superclass::PrintSelf(os,indent);
   os << indent << "Input: " << this->GetInput() << "\n";
 
   os << indent << "BlackLevel: " << this->BlackLevel << "\n";
@@ -1165,5 +1700,10 @@ void vtkUltrasoundFrameAnalyze::PrintSelf(ostream& os, vtkIndent indent)
   os << indent << "FanOrigin: (" << this->FanOrigin[0] << ", "
      << this->FanOrigin[1] << ")\n";
   os << indent << "FanDepth: " << this->FanDepth << "\n";
+  os << indent << "IncrementalAnalysis: "
+     << (this->IncrementalAnalysis ? "On\n" : "Off\n");
+  os << indent << "FrameSignature: " << this->FrameSignature << "\n";
+  os << indent << "GeometryChanged: " << this->GeometryChanged << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
   os << indent << "Stencil: " << this->StencilSource->GetOutput() << "\n";
 }
@@ -50,14 +50,15 @@ POSSIBILITY OF SUCH DAMAGES.
 #ifndef __vtkUltrasoundFrameAnalyze_h
 #define __vtkUltrasoundFrameAnalyze_h
 
-#include "vtkImageToImageFilter.h"
+#include "vtkImageAlgorithm.h"
+#include "vtkMultiThreader.h"
 #include "vtkUltrasoundImageStencilSource.h"
 
-class VTK_EXPORT vtkUltrasoundFrameAnalyze : public vtkImageToImageFilter
+class VTK_EXPORT vtkUltrasoundFrameAnalyze : public vtkImageAlgorithm
 {
 public:
   static vtkUltrasoundFrameAnalyze *New();
-  vtkTypeMacro(vtkUltrasoundFrameAnalyze,vtkImageToImageFilter);
+  vtkTypeMacro(vtkUltrasoundFrameAnalyze,vtkImageAlgorithm);
   void PrintSelf(ostream& os, vtkIndent indent);
 
   // Description:
@@ -66,6 +67,31 @@ public:
   // if the image has changed since the last execute.
   void Analyze();
 
+  // Description:
+  // If IncrementalAnalysis is on, then Analyze() only estimates the
+  // spacing, origin, flip and fan geometry again if the frame signature
+  // has changed, i.e. if the graticules have moved because the depth or
+  // zoom of the scanner was changed.  The black and white levels are
+  // found for every frame.  This is off by default.
+  vtkSetMacro(IncrementalAnalysis, int);
+  vtkBooleanMacro(IncrementalAnalysis, int);
+  vtkGetMacro(IncrementalAnalysis, int);
+
+  // Description:
+  // Get the signature of the last frame that was analyzed, which is
+  // a hash of the graticule profiles.
+  vtkGetMacro(FrameSignature, unsigned long);
+
+  // Description:
+  // Check whether the last call to Analyze() estimated the geometry,
+  // rather than keeping the geometry from the previous frame.
+  vtkGetMacro(GeometryChanged, int);
+
+  // Description:
+  // Set the number of threads to use for the analysis.
+  vtkSetClampMacro(NumberOfThreads, int, 1, VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads, int);
+
   // Description:
   // Get the origin and spacing for the input image accoding to
   // the graticules (the rulers) in the image.
@@ -113,10 +139,12 @@ protected:
   vtkUltrasoundFrameAnalyze();
   ~vtkUltrasoundFrameAnalyze();
 
-  void ExecuteInformation(vtkImageData *inData, vtkImageData *outData);
-  void ExecuteInformation() {
-    this->vtkImageToImageFilter::ExecuteInformation(); };
-  void ExecuteData(vtkDataObject *data);
+  int RequestInformation(vtkInformation *request,
+                         vtkInformationVector **inputVector,
+                         vtkInformationVector *outputVector);
+  int RequestData(vtkInformation *request,
+                  vtkInformationVector **inputVector,
+                  vtkInformationVector *outputVector);
 
   vtkFloatingPointType Spacing[3];
   vtkFloatingPointType Origin[3];
@@ -131,6 +159,14 @@ protected:
 
   int ClipGuess[6];
 
+  int IncrementalAnalysis;
+  unsigned long FrameSignature;
+  int GeometryChanged;
+  int GeometryValid;
+
+  vtkMultiThreader *Threader;
+  int NumberOfThreads;
+
   vtkUltrasoundImageStencilSource* StencilSource;
 
 private:
@@ -43,6 +43,7 @@ POSSIBILITY OF SUCH DAMAGES.
 
 #include <math.h>
 #include "vtkUltrasoundImageStencilSource.h"
+#include "vtkUltrasoundFanMask.h"
 #include "vtkImageStencilData.h"
 #include "vtkObjectFactory.h"
 #include "vtkInformation.h"
@@ -133,8 +134,6 @@ int vtkUltrasoundImageStencilSource::RequestData(
   double xf = (this->GetFanOrigin()[0] - origin[0])/spacing[0];
   double yf = (this->GetFanOrigin()[1] - origin[1])/spacing[1];
 
-  double d2 = this->GetFanDepth()*this->GetFanDepth();
-
   vtkFloatingPointType xs = spacing[0];
   vtkFloatingPointType ys = spacing[1];
 
@@ -160,17 +159,41 @@ int vtkUltrasoundImageStencilSource::RequestData(
     int tmp = y0; y0 = y1; y1 = tmp;
     }
   
+  // get the row spans of the fan from the shared cache, they only have
+  // to be computed again when the geometry changes
+  int maskExtent[4];
+  maskExtent[0] = extent[0];
+  maskExtent[1] = extent[1];
+  maskExtent[2] = extent[2];
+  maskExtent[3] = extent[3];
+  double maskSpacing[2];
+  maskSpacing[0] = xs;
+  maskSpacing[1] = ys;
+  double maskOrigin[2];
+  maskOrigin[0] = xf;
+  maskOrigin[1] = yf;
+  double maskSlopes[2];
+  maskSlopes[0] = ml;
+  maskSlopes[1] = mr;
+  int clipExtent[4];
+  clipExtent[0] = x0;
+  clipExtent[1] = x1;
+  clipExtent[2] = y0;
+  clipExtent[3] = y1;
+
+  vtkUltrasoundFanMask *mask = vtkUltrasoundFanMask::GetCachedMask(
+    maskExtent, maskSpacing, maskOrigin, maskSlopes, this->GetFanDepth(),
+    clipExtent, 0);
+
   // for keeping track of progress
   unsigned long count = 0;
   unsigned long target = (unsigned long)
     ((extent[5] - extent[4] + 1)*(extent[3] - extent[2] + 1)/50.0);
   target++;
 
-  // loop through all voxels
+  // loop through all rows
   for (int idZ = extent[4]; idZ <= extent[5]; idZ++)
     {
-    double z = idZ*spacing[2] + origin[2];
-
     for (int idY = extent[2]; idY <= extent[3]; idY++)
       {
       // update progress if we're the main thread
@@ -179,64 +202,9 @@ int vtkUltrasoundImageStencilSource::RequestData(
 	this->UpdateProgress(count/(50.0*target));
 	}
       count++;
-      
-
-      int r1 = extent[0];
-      int r2 = extent[1];
-
-      // next, handle the 'fan' shape of the input
-      double y = (yf - idY);
-      if (spacing[1] < 0)
-        {
-        y = -y;
-        }
-      if (!(ml == 0 && mr == 0))
-        {
-        // first, check the angle range of the fan
-        if (r1 < ml*y + xf )
-            {
-          r1 = int(ceil(ml*y + xf));
-          }
-        if (r2 > mr*y + xf)
-          {
-          r2 = int(floor(mr*y + xf));
-          }
-
-        // next, check the radius of the fan
-        double dx = (d2 - (y*y)*(ys*ys))/(xs*xs);
-        if (dx < 0)
-          {
-          r1 = extent[0];
-          r2 = extent[0]-1;
-          }
-        else
-          {
-          dx = sqrt(dx);
-          if (r1 < xf - dx)
-            {
-            r1 = int(ceil(xf - dx));
-            }
-          if (r2 > xf + dx)
-            {
-            r2 = int(floor(xf + dx));
-            }
-          }
-        }
 
-      // bound to the ultrasound clip rectangle
-      if (r1 < x0)
-        {
-        r1 = x0;
-        }
-      if (r2 > x1)
-        {
-        r2 = x1;
-        }
-      if (r1 > r2 || idY < y0 || idY > y1) 
-        {
-        r1 = extent[0];
-        r2 = extent[0]-1;
-        }
+      int r1, r2;
+      mask->GetRowSpan(idY, r1, r2);
 
       // insert the extent into the stencil
       if (r2 >= r1)
@@ -245,6 +213,10 @@ int vtkUltrasoundImageStencilSource::RequestData(
         }
       }
     }
+
+  vtkUltrasoundFanMask::ReleaseCachedMask(mask);
+
+  return 1;
 }
 
 int vtkUltrasoundImageStencilSource::FillInputPortInformation(
@@ -0,0 +1,962 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundSpatialCalibrator.cxx,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+
+#include "vtkUltrasoundSpatialCalibrator.h"
+#include "vtkObjectFactory.h"
+#include "vtkImageData.h"
+#include "vtkMatrix4x4.h"
+#include "vtkMath.h"
+#include "vtkTracker.h"
+#include "vtkTrackerBuffer.h"
+#include "vtkUltrasoundSweepFile.h"
+
+#include <math.h>
+#include <vector>
+
+vtkCxxRevisionMacro(vtkUltrasoundSpatialCalibrator, "$Revision: 1.1 $");
+vtkStandardNewMacro(vtkUltrasoundSpatialCalibrator);
+
+vtkCxxSetObjectMacro(vtkUltrasoundSpatialCalibrator,SweepFile,
+                     vtkUltrasoundSweepFile);
+vtkCxxSetObjectMacro(vtkUltrasoundSpatialCalibrator,TrackerBuffer,
+                     vtkTrackerBuffer);
+vtkCxxSetObjectMacro(vtkUltrasoundSpatialCalibrator,InitialCalibrationMatrix,
+                     vtkMatrix4x4);
+
+// The parameters are the rotation increment (3), the translation (3),
+// the two angles and the offset of the wall (3), and the spacing (2).
+#define VTK_SPATIAL_MAX_PARAMETERS 11
+
+//----------------------------------------------------------------------------
+// The segmented points, as (i, j, pose) triples where (i,j) are the
+// pixel indices and pose indexes into the poses, which are stored as
+// twelve values each: the 3x3 rotation in row-major order followed by
+// the translation.
+class vtkUltrasoundSpatialCalibratorInternals
+{
+public:
+  std::vector<double> Points;
+  std::vector<double> Poses;
+  double Origin[2];
+  double Spacing[2];
+};
+
+//----------------------------------------------------------------------------
+vtkUltrasoundSpatialCalibrator::vtkUltrasoundSpatialCalibrator()
+{
+  this->SweepFile = NULL;
+  this->TrackerBuffer = NULL;
+  this->InitialCalibrationMatrix = NULL;
+  this->CalibrationMatrix = vtkMatrix4x4::New();
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = this->Threader->GetNumberOfThreads();
+
+  this->VideoLag = 0.0;
+  this->ClipExtent[0] = -VTK_LARGE_INTEGER;
+  this->ClipExtent[1] = VTK_LARGE_INTEGER;
+  this->ClipExtent[2] = -VTK_LARGE_INTEGER;
+  this->ClipExtent[3] = VTK_LARGE_INTEGER;
+  this->ColumnStep = 8;
+  this->Threshold = 128.0;
+  this->OutlierDistance = 2.0;
+  this->SolveForSpacing = 0;
+  this->MaximumNumberOfIterations = 100;
+  this->Tolerance = 1e-9;
+
+  this->CalibratedSpacing[0] = 1.0;
+  this->CalibratedSpacing[1] = 1.0;
+  this->PlaneNormal[0] = 0.0;
+  this->PlaneNormal[1] = 0.0;
+  this->PlaneNormal[2] = 1.0;
+  this->PlaneDistance = 0.0;
+  this->RMSError = 0.0;
+  this->NumberOfPoints = 0;
+  this->NumberOfFrames = 0;
+  this->NumberOfIterations = 0;
+
+  this->Internals = new vtkUltrasoundSpatialCalibratorInternals;
+  this->Internals->Origin[0] = 0.0;
+  this->Internals->Origin[1] = 0.0;
+  this->Internals->Spacing[0] = 1.0;
+  this->Internals->Spacing[1] = 1.0;
+}
+
+//----------------------------------------------------------------------------
+vtkUltrasoundSpatialCalibrator::~vtkUltrasoundSpatialCalibrator()
+{
+  this->SetSweepFile(NULL);
+  this->SetTrackerBuffer(NULL);
+  this->SetInitialCalibrationMatrix(NULL);
+  this->CalibrationMatrix->Delete();
+  this->Threader->Delete();
+  delete this->Internals;
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundSpatialCalibrator::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "SweepFile: " << this->SweepFile << "\n";
+  os << indent << "TrackerBuffer: " << this->TrackerBuffer << "\n";
+  os << indent << "VideoLag: " << this->VideoLag << "\n";
+  os << indent << "ClipExtent: " << this->ClipExtent[0] << " "
+     << this->ClipExtent[1] << " " << this->ClipExtent[2] << " "
+     << this->ClipExtent[3] << "\n";
+  os << indent << "ColumnStep: " << this->ColumnStep << "\n";
+  os << indent << "Threshold: " << this->Threshold << "\n";
+  os << indent << "OutlierDistance: " << this->OutlierDistance << "\n";
+  os << indent << "InitialCalibrationMatrix: "
+     << this->InitialCalibrationMatrix << "\n";
+  os << indent << "SolveForSpacing: "
+     << (this->SolveForSpacing ? "On\n" : "Off\n");
+  os << indent << "MaximumNumberOfIterations: "
+     << this->MaximumNumberOfIterations << "\n";
+  os << indent << "Tolerance: " << this->Tolerance << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "CalibrationMatrix: " << this->CalibrationMatrix << "\n";
+  this->CalibrationMatrix->PrintSelf(os,indent.GetNextIndent());
+  os << indent << "CalibratedSpacing: " << this->CalibratedSpacing[0] << " "
+     << this->CalibratedSpacing[1] << "\n";
+  os << indent << "PlaneNormal: " << this->PlaneNormal[0] << " "
+     << this->PlaneNormal[1] << " " << this->PlaneNormal[2] << "\n";
+  os << indent << "PlaneDistance: " << this->PlaneDistance << "\n";
+  os << indent << "RMSError: " << this->RMSError << "\n";
+  os << indent << "NumberOfPoints: " << this->NumberOfPoints << "\n";
+  os << indent << "NumberOfFrames: " << this->NumberOfFrames << "\n";
+  os << indent << "NumberOfIterations: " << this->NumberOfIterations << "\n";
+}
+
+//----------------------------------------------------------------------------
+// Fit the line y = m*x + c to the points by least squares.
+static int vtkSpatialCalibrationFitLine(const double *points, int n,
+                                        double *m, double *c)
+{
+  double sx = 0, sy = 0, sxx = 0, sxy = 0;
+  for (int i = 0; i < n; i++)
+    {
+    double x = points[2*i];
+    double y = points[2*i + 1];
+    sx += x;
+    sy += y;
+    sxx += x*x;
+    sxy += x*y;
+    }
+  double d = n*sxx - sx*sx;
+  if (n < 2 || d <= 0)
+    {
+    return 0;
+    }
+  *m = (n*sxy - sx*sy)/d;
+  *c = (sy - (*m)*sx)/n;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// Find the wall in one frame.  The brightest pixel in each sampled column
+// is refined to sub-pixel precision with a parabola, and then the points
+// that do not lie on the line through the others are discarded.
+// Returns the number of points.
+template <class T>
+static int vtkSpatialCalibrationSegmentFrame(vtkImageData *frame,
+                                             const int clipExt[4],
+                                             int step, double threshold,
+                                             double outlierDistance,
+                                             double *points, T *)
+{
+  vtkIdType inc[3];
+  frame->GetIncrements(inc);
+  int *extent = frame->GetExtent();
+  int numRows = clipExt[3] - clipExt[2] + 1;
+  int count = 0;
+
+  for (int idX = clipExt[0]; idX <= clipExt[1]; idX += step)
+    {
+    T *inPtr = (T *)frame->GetScalarPointer(idX, clipExt[2], extent[4]);
+    int peak = 0;
+    for (int idY = 1; idY < numRows; idY++)
+      {
+      if (inPtr[idY*inc[1]] > inPtr[peak*inc[1]])
+        {
+        peak = idY;
+        }
+      }
+    double b = inPtr[peak*inc[1]];
+    if (b < threshold)
+      {
+      continue;
+      }
+    double offset = 0.0;
+    if (peak > 0 && peak < numRows - 1)
+      {
+      double a = inPtr[(peak - 1)*inc[1]];
+      double c = inPtr[(peak + 1)*inc[1]];
+      double d = a - 2*b + c;
+      if (d < 0)
+        {
+        offset = 0.5*(a - c)/d;
+        }
+      }
+    points[2*count] = idX;
+    points[2*count + 1] = clipExt[2] + peak + offset;
+    count++;
+    }
+
+  // two passes of outlier rejection
+  for (int pass = 0; pass < 2; pass++)
+    {
+    double m, c;
+    if (!vtkSpatialCalibrationFitLine(points, count, &m, &c))
+      {
+      return 0;
+      }
+    double maxDist = outlierDistance*sqrt(1.0 + m*m);
+    int j = 0;
+    for (int i = 0; i < count; i++)
+      {
+      double x = points[2*i];
+      double y = points[2*i + 1];
+      if (fabs(y - m*x - c) <= maxDist)
+        {
+        points[2*j] = x;
+        points[2*j + 1] = y;
+        j++;
+        }
+      }
+    count = j;
+    }
+
+  return (count >= 4 ? count : 0);
+}
+
+//----------------------------------------------------------------------------
+// The information shared by the segmentation threads
+struct vtkSpatialSegmentStruct
+{
+  vtkUltrasoundSweepFile *SweepFile;
+  vtkImageData *Frames[VTK_MAX_THREADS];
+  int ClipExtent[4];
+  int ColumnStep;
+  double Threshold;
+  double OutlierDistance;
+  int NumberOfFrames;
+  int MaxPointsPerFrame;
+  double *Points;
+  int *Counts;
+};
+
+//----------------------------------------------------------------------------
+static VTK_THREAD_RETURN_TYPE vtkSpatialSegmentThread(void *arg)
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  int threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  vtkSpatialSegmentStruct *str = (vtkSpatialSegmentStruct *)
+    (((ThreadInfoStruct *)(arg))->UserData);
+
+  int n = str->NumberOfFrames;
+  int i0 = (int)(((double)n*threadId)/threadCount);
+  int i1 = (int)(((double)n*(threadId + 1))/threadCount);
+  vtkImageData *frame = str->Frames[threadId];
+
+  for (int i = i0; i < i1; i++)
+    {
+    double *points = str->Points + 2*i*str->MaxPointsPerFrame;
+    str->Counts[i] = 0;
+    if (!str->SweepFile->ReadFrame(i, frame))
+      {
+      continue;
+      }
+    switch (frame->GetScalarType())
+      {
+      case VTK_UNSIGNED_CHAR:
+        str->Counts[i] = vtkSpatialCalibrationSegmentFrame(
+          frame, str->ClipExtent, str->ColumnStep, str->Threshold,
+          str->OutlierDistance, points, (unsigned char *)0);
+        break;
+      case VTK_SHORT:
+        str->Counts[i] = vtkSpatialCalibrationSegmentFrame(
+          frame, str->ClipExtent, str->ColumnStep, str->Threshold,
+          str->OutlierDistance, points, (short *)0);
+        break;
+      case VTK_UNSIGNED_SHORT:
+        str->Counts[i] = vtkSpatialCalibrationSegmentFrame(
+          frame, str->ClipExtent, str->ColumnStep, str->Threshold,
+          str->OutlierDistance, points, (unsigned short *)0);
+        break;
+      case VTK_FLOAT:
+        str->Counts[i] = vtkSpatialCalibrationSegmentFrame(
+          frame, str->ClipExtent, str->ColumnStep, str->Threshold,
+          str->OutlierDistance, points, (float *)0);
+        break;
+      }
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSpatialCalibrator::Segment()
+{
+  vtkUltrasoundSweepFile *sweep = this->SweepFile;
+  vtkUltrasoundSpatialCalibratorInternals *internals = this->Internals;
+
+  internals->Points.clear();
+  internals->Poses.clear();
+  this->NumberOfPoints = 0;
+  this->NumberOfFrames = 0;
+
+  if (sweep == NULL || sweep->GetMode() != VTK_SWEEP_MODE_READ)
+    {
+    vtkErrorMacro(<< "Segment: the SweepFile is not open for reading");
+    return 0;
+    }
+
+  int scalarType = sweep->GetFrameScalarType();
+  if (scalarType != VTK_UNSIGNED_CHAR && scalarType != VTK_SHORT &&
+      scalarType != VTK_UNSIGNED_SHORT && scalarType != VTK_FLOAT)
+    {
+    vtkErrorMacro(<< "Segment: frames must be unsigned char, short, "
+                  "unsigned short or float");
+    return 0;
+    }
+
+  // the tool poses, without any tool calibration
+  vtkTrackerBuffer *buffer = vtkTrackerBuffer::New();
+  if (this->TrackerBuffer)
+    {
+    this->TrackerBuffer->Lock();
+    buffer->DeepCopy(this->TrackerBuffer);
+    this->TrackerBuffer->Unlock();
+    }
+  else if (!sweep->ReadTrackerBuffer(buffer))
+    {
+    vtkErrorMacro(<< "Segment: the sweep has no tracking information");
+    buffer->Delete();
+    return 0;
+    }
+  buffer->SetToolCalibrationMatrix(NULL);
+  if (buffer->GetNumberOfItems() < 2)
+    {
+    vtkErrorMacro(<< "Segment: the sweep has no tracking information");
+    buffer->Delete();
+    return 0;
+    }
+
+  // clip the region to the frames
+  vtkSpatialSegmentStruct str;
+  int *frameExt = sweep->GetFrameExtent();
+  int i, j;
+  for (i = 0; i < 2; i++)
+    {
+    str.ClipExtent[2*i] = this->ClipExtent[2*i];
+    if (str.ClipExtent[2*i] < frameExt[2*i])
+      {
+      str.ClipExtent[2*i] = frameExt[2*i];
+      }
+    str.ClipExtent[2*i+1] = this->ClipExtent[2*i+1];
+    if (str.ClipExtent[2*i+1] > frameExt[2*i+1])
+      {
+      str.ClipExtent[2*i+1] = frameExt[2*i+1];
+      }
+    }
+  if (str.ClipExtent[0] > str.ClipExtent[1] ||
+      str.ClipExtent[2] + 2 > str.ClipExtent[3])
+    {
+    vtkErrorMacro(<< "Segment: the ClipExtent is outside of the frames");
+    buffer->Delete();
+    return 0;
+    }
+
+  int n = sweep->GetNumberOfFrames();
+  int numThreads = this->NumberOfThreads;
+  str.SweepFile = sweep;
+  str.ColumnStep = this->ColumnStep;
+  str.Threshold = this->Threshold;
+  str.OutlierDistance = this->OutlierDistance;
+  str.NumberOfFrames = n;
+  str.MaxPointsPerFrame =
+    (str.ClipExtent[1] - str.ClipExtent[0])/this->ColumnStep + 1;
+  str.Points = new double[2*n*str.MaxPointsPerFrame];
+  str.Counts = new int[n];
+  for (i = 0; i < numThreads; i++)
+    {
+    str.Frames[i] = vtkImageData::New();
+    }
+
+  this->Threader->SetNumberOfThreads(numThreads);
+  this->Threader->SetSingleMethod(vtkSpatialSegmentThread, &str);
+  this->Threader->SingleMethodExecute();
+
+  for (i = 0; i < numThreads; i++)
+    {
+    str.Frames[i]->Delete();
+    }
+
+  // pair each frame with the interpolated tool pose
+  double firstTime = buffer->GetTimeStamp(buffer->GetNumberOfItems() - 1);
+  double lastTime = buffer->GetTimeStamp(0);
+  vtkMatrix4x4 *matrix = vtkMatrix4x4::New();
+  for (i = 0; i < n; i++)
+    {
+    if (str.Counts[i] == 0)
+      {
+      continue;
+      }
+    double t = sweep->GetFrameTimeStamp(i) - this->VideoLag;
+    if (t < firstTime || t > lastTime)
+      {
+      continue;
+      }
+    long flags = buffer->GetFlagsAndMatrixFromTime(matrix, t);
+    if (flags & (TR_MISSING | TR_OUT_OF_VIEW))
+      {
+      continue;
+      }
+
+    int pose = this->NumberOfFrames++;
+    for (j = 0; j < 3; j++)
+      {
+      internals->Poses.push_back(matrix->GetElement(j, 0));
+      internals->Poses.push_back(matrix->GetElement(j, 1));
+      internals->Poses.push_back(matrix->GetElement(j, 2));
+      }
+    for (j = 0; j < 3; j++)
+      {
+      internals->Poses.push_back(matrix->GetElement(j, 3));
+      }
+
+    double *points = str.Points + 2*i*str.MaxPointsPerFrame;
+    for (j = 0; j < str.Counts[i]; j++)
+      {
+      internals->Points.push_back(points[2*j]);
+      internals->Points.push_back(points[2*j + 1]);
+      internals->Points.push_back(pose);
+      }
+    this->NumberOfPoints += str.Counts[i];
+    }
+  matrix->Delete();
+  buffer->Delete();
+  delete [] str.Points;
+  delete [] str.Counts;
+
+  double *spacing = sweep->GetFrameSpacing();
+  double *origin = sweep->GetFrameOrigin();
+  internals->Spacing[0] = spacing[0];
+  internals->Spacing[1] = spacing[1];
+  internals->Origin[0] = origin[0];
+  internals->Origin[1] = origin[1];
+
+  if (this->NumberOfFrames == 0)
+    {
+    vtkErrorMacro(<< "Segment: the wall was not found in any tracked frame");
+    return 0;
+    }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// The current estimate of the solution.  The rotation is updated
+// multiplicatively, so its three parameters are always zero in the
+// Jacobian.
+struct vtkSpatialCalibrationState
+{
+  double Rotation[3][3];
+  double Translation[3];
+  double PlaneAngles[2];
+  double PlaneOffset;
+  double Spacing[2];
+};
+
+// The normal equations from one thread, padded so that the sums of
+// different threads are not on the same cache line.
+struct vtkSpatialCalibrationPartial
+{
+  double JTJ[VTK_SPATIAL_MAX_PARAMETERS][VTK_SPATIAL_MAX_PARAMETERS];
+  double JTr[VTK_SPATIAL_MAX_PARAMETERS];
+  double Cost;
+  double Pad[8];
+};
+
+// The information shared by the solver threads
+struct vtkSpatialSolveStruct
+{
+  const double *Points;
+  const double *Poses;
+  int NumberOfPoints;
+  int NumberOfParameters;
+  int ComputeJacobian;
+  double Origin[2];
+  vtkSpatialCalibrationState State;
+  vtkSpatialCalibrationPartial *Partials;
+};
+
+//----------------------------------------------------------------------------
+static void vtkSpatialCalibrationPlaneNormal(const double angles[2],
+                                             double n[3], double da[3],
+                                             double db[3])
+{
+  double ca = cos(angles[0]);
+  double sa = sin(angles[0]);
+  double cb = cos(angles[1]);
+  double sb = sin(angles[1]);
+
+  n[0] = -ca*sb;  n[1] = sa;  n[2] = ca*cb;
+  da[0] = sa*sb;  da[1] = ca;  da[2] = -sa*cb;
+  db[0] = -ca*cb;  db[1] = 0.0;  db[2] = -ca*sb;
+}
+
+//----------------------------------------------------------------------------
+// Each thread computes the residuals r = n.q + offset for a range of
+// points, where q is the point in tracker coordinates, and accumulates
+// J^T J, J^T r and r^T r.
+static VTK_THREAD_RETURN_TYPE vtkSpatialSolveThread(void *arg)
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  int threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  vtkSpatialSolveStruct *str = (vtkSpatialSolveStruct *)
+    (((ThreadInfoStruct *)(arg))->UserData);
+
+  const vtkSpatialCalibrationState *state = &str->State;
+  int np = str->NumberOfParameters;
+  int n = str->NumberOfPoints;
+  int k0 = (int)(((double)n*threadId)/threadCount);
+  int k1 = (int)(((double)n*(threadId + 1))/threadCount);
+
+  double jtj[VTK_SPATIAL_MAX_PARAMETERS][VTK_SPATIAL_MAX_PARAMETERS];
+  double jtr[VTK_SPATIAL_MAX_PARAMETERS];
+  double cost = 0.0;
+  int i, j, k;
+  for (i = 0; i < np; i++)
+    {
+    jtr[i] = 0.0;
+    for (j = 0; j < np; j++)
+      {
+      jtj[i][j] = 0.0;
+      }
+    }
+
+  double normal[3], da[3], db[3];
+  vtkSpatialCalibrationPlaneNormal(state->PlaneAngles, normal, da, db);
+  const double (*R)[3] = state->Rotation;
+
+  for (k = k0; k < k1; k++)
+    {
+    const double *point = str->Points + 3*k;
+    const double *pose = str->Poses + 12*(int)point[2];
+
+    double p[3], pc[3], q[3];
+    p[0] = str->Origin[0] + state->Spacing[0]*point[0];
+    p[1] = str->Origin[1] + state->Spacing[1]*point[1];
+    p[2] = 0.0;
+    for (i = 0; i < 3; i++)
+      {
+      pc[i] = R[i][0]*p[0] + R[i][1]*p[1] + state->Translation[i];
+      }
+    for (i = 0; i < 3; i++)
+      {
+      q[i] = pose[3*i]*pc[0] + pose[3*i+1]*pc[1] + pose[3*i+2]*pc[2] +
+        pose[9+i];
+      }
+    double r = normal[0]*q[0] + normal[1]*q[1] + normal[2]*q[2] +
+      state->PlaneOffset;
+    cost += r*r;
+
+    if (!str->ComputeJacobian)
+      {
+      continue;
+      }
+
+    // g = A^T n, w = R^T g
+    double g[3], w[3], J[VTK_SPATIAL_MAX_PARAMETERS];
+    for (i = 0; i < 3; i++)
+      {
+      g[i] = pose[i]*normal[0] + pose[3+i]*normal[1] + pose[6+i]*normal[2];
+      }
+    for (i = 0; i < 3; i++)
+      {
+      w[i] = R[0][i]*g[0] + R[1][i]*g[1] + R[2][i]*g[2];
+      }
+
+    J[0] = p[1]*w[2] - p[2]*w[1];
+    J[1] = p[2]*w[0] - p[0]*w[2];
+    J[2] = p[0]*w[1] - p[1]*w[0];
+    J[3] = g[0];
+    J[4] = g[1];
+    J[5] = g[2];
+    J[6] = da[0]*q[0] + da[1]*q[1] + da[2]*q[2];
+    J[7] = db[0]*q[0] + db[1]*q[1] + db[2]*q[2];
+    J[8] = 1.0;
+    J[9] = w[0]*point[0];
+    J[10] = w[1]*point[1];
+
+    for (i = 0; i < np; i++)
+      {
+      jtr[i] += J[i]*r;
+      for (j = i; j < np; j++)
+        {
+        jtj[i][j] += J[i]*J[j];
+        }
+      }
+    }
+
+  vtkSpatialCalibrationPartial *partial = &str->Partials[threadId];
+  partial->Cost = cost;
+  for (i = 0; i < np; i++)
+    {
+    partial->JTr[i] = jtr[i];
+    for (j = i; j < np; j++)
+      {
+      partial->JTJ[i][j] = jtj[i][j];
+      }
+    }
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+// Run the solver threads and sum their results into the first partial.
+static void vtkSpatialCalibrationEvaluate(vtkMultiThreader *threader,
+                                          int numThreads,
+                                          vtkSpatialSolveStruct *str,
+                                          int computeJacobian)
+{
+  str->ComputeJacobian = computeJacobian;
+  threader->SetNumberOfThreads(numThreads);
+  threader->SetSingleMethod(vtkSpatialSolveThread, str);
+  threader->SingleMethodExecute();
+
+  int np = str->NumberOfParameters;
+  vtkSpatialCalibrationPartial *total = &str->Partials[0];
+  for (int t = 1; t < numThreads; t++)
+    {
+    vtkSpatialCalibrationPartial *partial = &str->Partials[t];
+    total->Cost += partial->Cost;
+    if (computeJacobian)
+      {
+      for (int i = 0; i < np; i++)
+        {
+        total->JTr[i] += partial->JTr[i];
+        for (int j = i; j < np; j++)
+          {
+          total->JTJ[i][j] += partial->JTJ[i][j];
+          }
+        }
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+// Apply a step to the state, the rotation increment is converted to a
+// matrix with Rodrigues' formula.
+static void vtkSpatialCalibrationStep(const vtkSpatialCalibrationState *state,
+                                      const double *delta, int np,
+                                      vtkSpatialCalibrationState *result)
+{
+  *result = *state;
+
+  double theta = sqrt(delta[0]*delta[0] + delta[1]*delta[1] +
+                      delta[2]*delta[2]);
+  double a = 1.0;
+  double b = 0.5;
+  if (theta > 1e-12)
+    {
+    a = sin(theta)/theta;
+    b = (1.0 - cos(theta))/(theta*theta);
+    }
+  double K[3][3] = { { 0.0, -delta[2], delta[1] },
+                     { delta[2], 0.0, -delta[0] },
+                     { -delta[1], delta[0], 0.0 } };
+  double dR[3][3];
+  int i, j, k;
+  for (i = 0; i < 3; i++)
+    {
+    for (j = 0; j < 3; j++)
+      {
+      double kk = 0.0;
+      for (k = 0; k < 3; k++)
+        {
+        kk += K[i][k]*K[k][j];
+        }
+      dR[i][j] = (i == j) + a*K[i][j] + b*kk;
+      }
+    }
+  for (i = 0; i < 3; i++)
+    {
+    for (j = 0; j < 3; j++)
+      {
+      result->Rotation[i][j] = state->Rotation[i][0]*dR[0][j] +
+        state->Rotation[i][1]*dR[1][j] + state->Rotation[i][2]*dR[2][j];
+      }
+    }
+
+  for (i = 0; i < 3; i++)
+    {
+    result->Translation[i] += delta[3 + i];
+    }
+  result->PlaneAngles[0] += delta[6];
+  result->PlaneAngles[1] += delta[7];
+  result->PlaneOffset += delta[8];
+  if (np > 9)
+    {
+    result->Spacing[0] += delta[9];
+    result->Spacing[1] += delta[10];
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSpatialCalibrator::Solve()
+{
+  vtkUltrasoundSpatialCalibratorInternals *internals = this->Internals;
+  int np = (this->SolveForSpacing ? 11 : 9);
+  int numThreads = this->NumberOfThreads;
+  int n = this->NumberOfPoints;
+  int i, j;
+
+  this->NumberOfIterations = 0;
+  if (n < 2*np)
+    {
+    vtkErrorMacro(<< "Solve: only " << n << " points were segmented");
+    return 0;
+    }
+
+  vtkSpatialSolveStruct str;
+  str.Points = &internals->Points[0];
+  str.Poses = &internals->Poses[0];
+  str.NumberOfPoints = n;
+  str.NumberOfParameters = np;
+  str.Origin[0] = internals->Origin[0];
+  str.Origin[1] = internals->Origin[1];
+  str.Partials = new vtkSpatialCalibrationPartial[numThreads];
+
+  // the starting estimate of the calibration
+  vtkSpatialCalibrationState state;
+  for (i = 0; i < 3; i++)
+    {
+    for (j = 0; j < 3; j++)
+      {
+      state.Rotation[i][j] = (i == j);
+      if (this->InitialCalibrationMatrix)
+        {
+        state.Rotation[i][j] =
+          this->InitialCalibrationMatrix->GetElement(i, j);
+        }
+      }
+    state.Translation[i] = 0.0;
+    if (this->InitialCalibrationMatrix)
+      {
+      state.Translation[i] =
+        this->InitialCalibrationMatrix->GetElement(i, 3);
+      }
+    }
+  state.Spacing[0] = internals->Spacing[0];
+  state.Spacing[1] = internals->Spacing[1];
+
+  // the starting estimate of the wall is the plane through the points
+  double center[3] = { 0.0, 0.0, 0.0 };
+  double cov[3][3] = { { 0.0, 0.0, 0.0 }, { 0.0, 0.0, 0.0 },
+                       { 0.0, 0.0, 0.0 } };
+  std::vector<double> world(3*n);
+  int k;
+  for (k = 0; k < n; k++)
+    {
+    const double *point = str.Points + 3*k;
+    const double *pose = str.Poses + 12*(int)point[2];
+    double p[2], pc[3];
+    p[0] = str.Origin[0] + state.Spacing[0]*point[0];
+    p[1] = str.Origin[1] + state.Spacing[1]*point[1];
+    for (i = 0; i < 3; i++)
+      {
+      pc[i] = state.Rotation[i][0]*p[0] + state.Rotation[i][1]*p[1] +
+        state.Translation[i];
+      }
+    for (i = 0; i < 3; i++)
+      {
+      world[3*k+i] = pose[3*i]*pc[0] + pose[3*i+1]*pc[1] +
+        pose[3*i+2]*pc[2] + pose[9+i];
+      center[i] += world[3*k+i];
+      }
+    }
+  for (i = 0; i < 3; i++)
+    {
+    center[i] /= n;
+    }
+  for (k = 0; k < n; k++)
+    {
+    for (i = 0; i < 3; i++)
+      {
+      for (j = 0; j < 3; j++)
+        {
+        cov[i][j] += (world[3*k+i] - center[i])*(world[3*k+j] - center[j]);
+        }
+      }
+    }
+  double eigenvalues[3], eigenvectors[3][3];
+  double *covPtrs[3] = { cov[0], cov[1], cov[2] };
+  double *vecPtrs[3] = { eigenvectors[0], eigenvectors[1], eigenvectors[2] };
+  vtkMath::Jacobi(covPtrs, eigenvalues, vecPtrs);
+  // the eigenvectors are the columns, sorted by decreasing eigenvalue
+  double normal[3];
+  for (i = 0; i < 3; i++)
+    {
+    normal[i] = eigenvectors[i][2];
+    }
+  if (normal[2] < 0)
+    {
+    normal[0] = -normal[0];
+    normal[1] = -normal[1];
+    normal[2] = -normal[2];
+    }
+  state.PlaneAngles[0] = asin(normal[1]);
+  state.PlaneAngles[1] = atan2(-normal[0], normal[2]);
+  state.PlaneOffset = -(normal[0]*center[0] + normal[1]*center[1] +
+                        normal[2]*center[2]);
+
+  // Levenberg-Marquardt
+  double A[VTK_SPATIAL_MAX_PARAMETERS][VTK_SPATIAL_MAX_PARAMETERS];
+  double *rows[VTK_SPATIAL_MAX_PARAMETERS];
+  double delta[VTK_SPATIAL_MAX_PARAMETERS];
+  double lambda = 1e-3;
+  double cost = 0.0;
+  int iteration;
+  for (i = 0; i < np; i++)
+    {
+    rows[i] = A[i];
+    }
+
+  for (iteration = 0; iteration < this->MaximumNumberOfIterations;
+       iteration++)
+    {
+    str.State = state;
+    vtkSpatialCalibrationEvaluate(this->Threader, numThreads, &str, 1);
+    vtkSpatialCalibrationPartial *total = &str.Partials[0];
+    cost = total->Cost;
+
+    double jtj[VTK_SPATIAL_MAX_PARAMETERS][VTK_SPATIAL_MAX_PARAMETERS];
+    double jtr[VTK_SPATIAL_MAX_PARAMETERS];
+    for (i = 0; i < np; i++)
+      {
+      jtr[i] = total->JTr[i];
+      for (j = i; j < np; j++)
+        {
+        jtj[i][j] = jtj[j][i] = total->JTJ[i][j];
+        }
+      }
+
+    // increase the damping until the step reduces the error
+    double newCost = cost;
+    vtkSpatialCalibrationState trial;
+    while (lambda < 1e10)
+      {
+      for (i = 0; i < np; i++)
+        {
+        for (j = 0; j < np; j++)
+          {
+          A[i][j] = jtj[i][j];
+          }
+        A[i][i] += lambda*(jtj[i][i] > 0 ? jtj[i][i] : 1.0);
+        delta[i] = -jtr[i];
+        }
+      if (vtkMath::SolveLinearSystem(rows, delta, np))
+        {
+        vtkSpatialCalibrationStep(&state, delta, np, &trial);
+        str.State = trial;
+        vtkSpatialCalibrationEvaluate(this->Threader, numThreads, &str, 0);
+        newCost = str.Partials[0].Cost;
+        if (newCost < cost)
+          {
+          break;
+          }
+        }
+      lambda *= 10;
+      }
+
+    if (lambda >= 1e10)
+      {
+      break;
+      }
+
+    state = trial;
+    lambda *= 0.1;
+    if (cost - newCost <= this->Tolerance*cost)
+      {
+      cost = newCost;
+      iteration++;
+      break;
+      }
+    cost = newCost;
+    }
+
+  delete [] str.Partials;
+
+  // store the results
+  this->CalibrationMatrix->Identity();
+  for (i = 0; i < 3; i++)
+    {
+    for (j = 0; j < 3; j++)
+      {
+      this->CalibrationMatrix->SetElement(i, j, state.Rotation[i][j]);
+      }
+    this->CalibrationMatrix->SetElement(i, 3, state.Translation[i]);
+    }
+  this->CalibratedSpacing[0] = state.Spacing[0];
+  this->CalibratedSpacing[1] = state.Spacing[1];
+  double da[3], db[3];
+  vtkSpatialCalibrationPlaneNormal(state.PlaneAngles, this->PlaneNormal,
+                                   da, db);
+  this->PlaneDistance = -state.PlaneOffset;
+  this->RMSError = sqrt(cost/n);
+  this->NumberOfIterations = iteration;
+  this->Modified();
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSpatialCalibrator::Calibrate()
+{
+  if (!this->Segment())
+    {
+    return 0;
+    }
+  return this->Solve();
+}
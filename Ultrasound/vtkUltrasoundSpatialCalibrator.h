@@ -0,0 +1,221 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundSpatialCalibrator.h,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+// .NAME vtkUltrasoundSpatialCalibrator - single-wall probe calibration
+// .SECTION Description
+// vtkUltrasoundSpatialCalibrator computes the probe calibration, i.e. the
+// matrix from the image coordinates (in millimetres, as given by the
+// frame spacing and origin) to the coordinates of the tracked tool on
+// the probe, from a recorded sweep of a flat wall.  The wall (e.g. the
+// bottom of a water bath) must be scanned from many different probe
+// orientations, and appears in each frame as a bright line.
+//
+// The line is segmented in every frame within the ClipExtent: the
+// brightest row is found for every ColumnStep'th column, a line is
+// fitted to these points and the points that are more than
+// OutlierDistance pixels from the line are rejected.  Each frame is
+// paired with the tool pose interpolated from the tracker buffer at the
+// frame timestamp minus the VideoLag.  The calibration and the position
+// of the wall are then found with a Levenberg-Marquardt solver that
+// minimizes the distance of all points from the wall, with analytic
+// Jacobians.  The segmentation and the normal equations are computed by
+// all of the threads in parallel.
+//
+// The solver must be started from a rough estimate of the calibration
+// (within roughly 20 degrees and 20 mm), given as the
+// InitialCalibrationMatrix.  The result can be given to
+// vtkTrackerTool::SetCalibrationMatrix().
+// .SECTION see also
+// vtkUltrasoundTemporalCalibrator vtkUltrasoundSweepFile vtkTrackerBuffer
+
+#ifndef __vtkUltrasoundSpatialCalibrator_h
+#define __vtkUltrasoundSpatialCalibrator_h
+
+#include "vtkObject.h"
+#include "vtkMultiThreader.h"
+
+class vtkMatrix4x4;
+class vtkTrackerBuffer;
+class vtkUltrasoundSweepFile;
+class vtkUltrasoundSpatialCalibratorInternals;
+
+class VTK_EXPORT vtkUltrasoundSpatialCalibrator : public vtkObject
+{
+public:
+  static vtkUltrasoundSpatialCalibrator *New();
+  vtkTypeRevisionMacro(vtkUltrasoundSpatialCalibrator, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // The recorded sweep.  The file must already be open for reading.
+  virtual void SetSweepFile(vtkUltrasoundSweepFile *);
+  vtkGetObjectMacro(SweepFile, vtkUltrasoundSweepFile);
+
+  // Description:
+  // The tracking information for the sweep.  If this is not set, then
+  // the tracking information that is stored in the sweep file is used.
+  // Any tool calibration in the buffer is ignored.
+  virtual void SetTrackerBuffer(vtkTrackerBuffer *);
+  vtkGetObjectMacro(TrackerBuffer, vtkTrackerBuffer);
+
+  // Description:
+  // The lag of the video timestamps behind the tracker timestamps,
+  // e.g. as measured by vtkUltrasoundTemporalCalibrator.  Default: 0.
+  vtkSetMacro(VideoLag, double);
+  vtkGetMacro(VideoLag, double);
+
+  // Description:
+  // The region of the frames (x0,x1,y0,y1, in pixels) that contains the
+  // wall.  It is clipped to the frame extent.  Default: the whole frame.
+  vtkSetVector4Macro(ClipExtent, int);
+  vtkGetVector4Macro(ClipExtent, int);
+
+  // Description:
+  // The spacing, in pixels, of the columns that are searched for the
+  // wall.  Default: 8.
+  vtkSetClampMacro(ColumnStep, int, 1, VTK_LARGE_INTEGER);
+  vtkGetMacro(ColumnStep, int);
+
+  // Description:
+  // The smallest pixel value that can be part of the wall.
+  // Default: 128.
+  vtkSetMacro(Threshold, double);
+  vtkGetMacro(Threshold, double);
+
+  // Description:
+  // Points that are further than this from the line that is fitted to
+  // the wall in each frame, in pixels, are discarded.  Default: 2.
+  vtkSetMacro(OutlierDistance, double);
+  vtkGetMacro(OutlierDistance, double);
+
+  // Description:
+  // The starting estimate for the calibration.  Default: identity.
+  virtual void SetInitialCalibrationMatrix(vtkMatrix4x4 *);
+  vtkGetObjectMacro(InitialCalibrationMatrix, vtkMatrix4x4);
+
+  // Description:
+  // Also solve for the pixel spacing of the frames, instead of using
+  // the spacing that is stored in the sweep.  This needs a sweep with
+  // a wide range of probe orientations.  Default: Off.
+  vtkSetMacro(SolveForSpacing, int);
+  vtkBooleanMacro(SolveForSpacing, int);
+  vtkGetMacro(SolveForSpacing, int);
+
+  // Description:
+  // The solver stops after this many iterations, or when the relative
+  // change in the error is less than the Tolerance.  Defaults: 100, 1e-9.
+  vtkSetClampMacro(MaximumNumberOfIterations, int, 1, VTK_LARGE_INTEGER);
+  vtkGetMacro(MaximumNumberOfIterations, int);
+  vtkSetMacro(Tolerance, double);
+  vtkGetMacro(Tolerance, double);
+
+  // Description:
+  // The number of threads to use.  The default is the number of
+  // processors.
+  vtkSetClampMacro(NumberOfThreads, int, 1, VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads, int);
+
+  // Description:
+  // Segment the frames and compute the calibration.  Returns zero if
+  // the calibration failed.
+  int Calibrate();
+
+  // Description:
+  // Only segment the frames.  This is done by Calibrate(), but can be
+  // done separately in order to solve again with different settings
+  // by calling Solve().  Returns zero on failure.
+  int Segment();
+  int Solve();
+
+  // Description:
+  // The results: the calibration matrix, the pixel spacing (equal to
+  // the frame spacing unless SolveForSpacing is on), the plane of the
+  // wall in tracker coordinates (normal and distance from the origin),
+  // and the root-mean-square distance of the points from the wall.
+  vtkGetObjectMacro(CalibrationMatrix, vtkMatrix4x4);
+  vtkGetVector2Macro(CalibratedSpacing, double);
+  vtkGetVector3Macro(PlaneNormal, double);
+  vtkGetMacro(PlaneDistance, double);
+  vtkGetMacro(RMSError, double);
+
+  // Description:
+  // The number of segmented points and frames, and the number of
+  // iterations that the solver used.
+  vtkGetMacro(NumberOfPoints, int);
+  vtkGetMacro(NumberOfFrames, int);
+  vtkGetMacro(NumberOfIterations, int);
+
+protected:
+  vtkUltrasoundSpatialCalibrator();
+  ~vtkUltrasoundSpatialCalibrator();
+
+  vtkUltrasoundSweepFile *SweepFile;
+  vtkTrackerBuffer *TrackerBuffer;
+  vtkMatrix4x4 *InitialCalibrationMatrix;
+  vtkMatrix4x4 *CalibrationMatrix;
+  vtkMultiThreader *Threader;
+  int NumberOfThreads;
+
+  double VideoLag;
+  int ClipExtent[4];
+  int ColumnStep;
+  double Threshold;
+  double OutlierDistance;
+  int SolveForSpacing;
+  int MaximumNumberOfIterations;
+  double Tolerance;
+
+  double CalibratedSpacing[2];
+  double PlaneNormal[3];
+  double PlaneDistance;
+  double RMSError;
+  int NumberOfPoints;
+  int NumberOfFrames;
+  int NumberOfIterations;
+
+  vtkUltrasoundSpatialCalibratorInternals *Internals;
+
+private:
+  vtkUltrasoundSpatialCalibrator(const vtkUltrasoundSpatialCalibrator&);
+  void operator=(const vtkUltrasoundSpatialCalibrator&);
+};
+
+#endif
@@ -0,0 +1,1409 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundSweepFile.cxx,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+#include <deque>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+#include "vtkUltrasoundSweepFile.h"
+#include "vtkObjectFactory.h"
+#include "vtkImageData.h"
+#include "vtkMatrix4x4.h"
+#include "vtkMultiThreader.h"
+#include "vtkMutexLock.h"
+#include "vtkConditionVariable.h"
+#include "vtkTrackerBuffer.h"
+
+vtkCxxRevisionMacro(vtkUltrasoundSweepFile, "$Revision: 1.1 $");
+vtkStandardNewMacro(vtkUltrasoundSweepFile);
+
+#define VTK_SWEEP_VERSION 1
+#define VTK_SWEEP_BYTE_ORDER 0x01020304
+
+//----------------------------------------------------------------------------
+// The file layout.  All values are stored in native byte order, and the
+// ByteOrder field of the header is used to detect a mismatch: files are
+// not swapped on reading, so they can only be read on a machine with the
+// same byte order.
+//
+//   header
+//   "FRAM" chunk for each frame
+//   "TRAK" chunk (tracking records)
+//   "PARM" chunk (ultrasound parameters)
+//   "INDX" chunk (file offsets of the FRAM chunks)
+//   "SEND" chunk, with Size = file offset of the INDX chunk
+//----------------------------------------------------------------------------
+struct vtkSweepFileHeader
+{
+  char Magic[8];
+  int Version;
+  int ByteOrder;
+  int Extent[6];
+  int ScalarType;
+  int NumberOfScalarComponents;
+  double Spacing[3];
+  double Origin[3];
+};
+
+struct vtkSweepChunkHeader
+{
+  char Tag[4];
+  int Reserved;
+  vtkTypeInt64 Size; // size of chunk, not including this header
+};
+
+struct vtkSweepFrameHeader
+{
+  double TimeStamp;
+  int Compression;
+  int Reserved;
+  vtkTypeInt64 RawSize;
+};
+
+struct vtkSweepTrackHeader
+{
+  int NumberOfRecords;
+  int Reserved;
+  double ToolCalibrationMatrix[16];
+  double WorldCalibrationMatrix[16];
+};
+
+struct vtkSweepTrackRecord
+{
+  double TimeStamp;
+  int Flags;
+  int Reserved;
+  double Matrix[16];
+};
+
+struct vtkSweepParameters
+{
+  double ClipRectangle[4];
+  double FanAngles[2];
+  double FanOrigin[2];
+  double FanDepth;
+  double VideoLag;
+};
+
+//----------------------------------------------------------------------------
+// A frame that is waiting for the writer thread
+struct vtkSweepQueuedFrame
+{
+  double TimeStamp;
+  unsigned char *Data;
+};
+
+//----------------------------------------------------------------------------
+class vtkUltrasoundSweepFileInternals
+{
+public:
+  vtkUltrasoundSweepFileInternals()
+    {
+    this->File = 0;
+    this->QueueLock = vtkMutexLock::New();
+    this->QueueCondition = vtkConditionVariable::New();
+    this->Writing = 0;
+    this->Position = 0;
+    this->WriteError = 0;
+    this->Compression = 0;
+    this->FrameSize = 0;
+    this->Map = 0;
+    this->MapSize = 0;
+#ifdef _WIN32
+    this->FileHandle = INVALID_HANDLE_VALUE;
+    this->MappingHandle = NULL;
+#else
+    this->FileDescriptor = -1;
+#endif
+    this->TrackOffset = -1;
+    this->TrackSize = 0;
+    this->ParameterOffset = -1;
+    }
+
+  ~vtkUltrasoundSweepFileInternals()
+    {
+    this->ClearBuffers();
+    this->QueueLock->Delete();
+    this->QueueCondition->Delete();
+    }
+
+  void ClearBuffers()
+    {
+    size_t i;
+    for (i = 0; i < this->Queue.size(); i++)
+      {
+      delete [] this->Queue[i].Data;
+      }
+    this->Queue.clear();
+    for (i = 0; i < this->FreeBuffers.size(); i++)
+      {
+      delete [] this->FreeBuffers[i];
+      }
+    this->FreeBuffers.clear();
+    }
+
+  // for writing: the queue is shared with the writer thread, and
+  // everything else below is used only by the writer thread until
+  // the thread has finished
+  FILE *File;
+  vtkMutexLock *QueueLock;
+  vtkConditionVariable *QueueCondition;
+  std::deque<vtkSweepQueuedFrame> Queue;
+  int Writing;
+  std::vector<unsigned char *> FreeBuffers;
+  vtkTypeInt64 Position;
+  int WriteError;
+  int Compression;
+  int FrameSize;
+
+  // for reading
+  unsigned char *Map;
+  vtkTypeInt64 MapSize;
+#ifdef _WIN32
+  HANDLE FileHandle;
+  HANDLE MappingHandle;
+#else
+  int FileDescriptor;
+#endif
+  vtkTypeInt64 TrackOffset;
+  vtkTypeInt64 TrackSize;
+  vtkTypeInt64 ParameterOffset;
+
+  // for both (the writer thread adds to these while holding the QueueLock)
+  std::vector<vtkTypeInt64> FrameOffsets;
+  std::vector<double> FrameTimeStamps;
+};
+
+//----------------------------------------------------------------------------
+// LZ4 block format compression.  The frames are compressed independently,
+// so each one can be decompressed by any LZ4 block decoder.  The format is
+// a sequence of (literals, match) pairs: a token byte with the literal
+// length in the high nibble and the match length minus four in the low
+// nibble (15 means that more length bytes follow), the literals, and then
+// a two-byte little-endian match offset.  The final sequence has only
+// literals, and the last five bytes of a block are always literals.
+//----------------------------------------------------------------------------
+
+#define VTK_SWEEP_LZ4_HASH_LOG 12
+#define VTK_SWEEP_LZ4_MIN_MATCH 4
+#define VTK_SWEEP_LZ4_LAST_LITERALS 5
+#define VTK_SWEEP_LZ4_MF_LIMIT 12
+
+static inline unsigned int vtkSweepRead32(const unsigned char *cp)
+{
+  unsigned int v;
+  memcpy(&v, cp, 4);
+  return v;
+}
+
+//----------------------------------------------------------------------------
+static inline int vtkSweepLZ4CompressBound(int n)
+{
+  return n + n/255 + 16;
+}
+
+//----------------------------------------------------------------------------
+static inline unsigned char *vtkSweepLZ4WriteLength(unsigned char *op,
+                                                    int length)
+{
+  while (length >= 255)
+    {
+    *op++ = 255;
+    length -= 255;
+    }
+  *op++ = (unsigned char)(length);
+  return op;
+}
+
+//----------------------------------------------------------------------------
+// Compress n bytes from src into dst, returns the compressed size or zero
+// if the result would not fit within dstCapacity bytes.
+static int vtkSweepLZ4Compress(const unsigned char *src, int n,
+                               unsigned char *dst, int dstCapacity)
+{
+  int table[1 << VTK_SWEEP_LZ4_HASH_LOG];
+  const unsigned char *ip = src;
+  const unsigned char *anchor = src;
+  const unsigned char *iend = src + n;
+  const unsigned char *mflimit = iend - VTK_SWEEP_LZ4_MF_LIMIT;
+  const unsigned char *matchlimit = iend - VTK_SWEEP_LZ4_LAST_LITERALS;
+  unsigned char *op = dst;
+  unsigned char *oend = dst + dstCapacity;
+  int i;
+
+  if (n > VTK_SWEEP_LZ4_MF_LIMIT)
+    {
+    for (i = 0; i < (1 << VTK_SWEEP_LZ4_HASH_LOG); i++)
+      {
+      table[i] = -1;
+      }
+
+    // skip ahead faster through data that doesn't compress
+    int searchCount = (1 << 6);
+
+    while (ip < mflimit)
+      {
+      unsigned int sequence = vtkSweepRead32(ip);
+      unsigned int h = (sequence*2654435761U) >>
+        (32 - VTK_SWEEP_LZ4_HASH_LOG);
+      int ref = table[h];
+      table[h] = (int)(ip - src);
+
+      if (ref < 0 || (ip - src) - ref > 65535 ||
+          vtkSweepRead32(src + ref) != sequence)
+        {
+        ip += (searchCount++ >> 6);
+        continue;
+        }
+      searchCount = (1 << 6);
+
+      // extend the match backwards and forwards
+      const unsigned char *match = src + ref;
+      while (ip > anchor && match > src && ip[-1] == match[-1])
+        {
+        ip--;
+        match--;
+        }
+      const unsigned char *mp = ip + VTK_SWEEP_LZ4_MIN_MATCH;
+      const unsigned char *rp = match + VTK_SWEEP_LZ4_MIN_MATCH;
+      while (mp < matchlimit && *mp == *rp)
+        {
+        mp++;
+        rp++;
+        }
+
+      int literalLength = (int)(ip - anchor);
+      int matchLength = (int)(mp - ip) - VTK_SWEEP_LZ4_MIN_MATCH;
+      if (op + 1 + literalLength + literalLength/255 + 1 +
+          2 + matchLength/255 + 1 > oend)
+        {
+        return 0;
+        }
+
+      unsigned char *token = op++;
+      if (literalLength >= 15)
+        {
+        *token = (15 << 4);
+        op = vtkSweepLZ4WriteLength(op, literalLength - 15);
+        }
+      else
+        {
+        *token = (unsigned char)(literalLength << 4);
+        }
+      memcpy(op, anchor, literalLength);
+      op += literalLength;
+
+      int offset = (int)(ip - match);
+      *op++ = (unsigned char)(offset & 0xff);
+      *op++ = (unsigned char)(offset >> 8);
+
+      if (matchLength >= 15)
+        {
+        *token |= 15;
+        op = vtkSweepLZ4WriteLength(op, matchLength - 15);
+        }
+      else
+        {
+        *token |= (unsigned char)(matchLength);
+        }
+
+      ip = mp;
+      anchor = ip;
+      }
+    }
+
+  // the final literals
+  int literalLength = (int)(iend - anchor);
+  if (op + 1 + literalLength + literalLength/255 + 1 > oend)
+    {
+    return 0;
+    }
+  if (literalLength >= 15)
+    {
+    *op++ = (15 << 4);
+    op = vtkSweepLZ4WriteLength(op, literalLength - 15);
+    }
+  else
+    {
+    *op++ = (unsigned char)(literalLength << 4);
+    }
+  memcpy(op, anchor, literalLength);
+  op += literalLength;
+
+  return (int)(op - dst);
+}
+
+//----------------------------------------------------------------------------
+// Decompress n bytes from src into dst, returns the decompressed size or
+// -1 if the data is corrupt.
+static int vtkSweepLZ4Decompress(const unsigned char *src, int n,
+                                 unsigned char *dst, int dstCapacity)
+{
+  const unsigned char *ip = src;
+  const unsigned char *iend = src + n;
+  unsigned char *op = dst;
+  unsigned char *oend = dst + dstCapacity;
+  unsigned int b;
+
+  while (ip < iend)
+    {
+    unsigned int token = *ip++;
+
+    int literalLength = (token >> 4);
+    if (literalLength == 15)
+      {
+      do
+        {
+        if (ip >= iend)
+          {
+          return -1;
+          }
+        b = *ip++;
+        literalLength += b;
+        }
+      while (b == 255);
+      }
+    if (literalLength > iend - ip || literalLength > oend - op)
+      {
+      return -1;
+      }
+    memcpy(op, ip, literalLength);
+    op += literalLength;
+    ip += literalLength;
+
+    // the last sequence has no match
+    if (ip >= iend)
+      {
+      break;
+      }
+
+    if (iend - ip < 2)
+      {
+      return -1;
+      }
+    int offset = ip[0] | (ip[1] << 8);
+    ip += 2;
+    if (offset == 0 || offset > op - dst)
+      {
+      return -1;
+      }
+
+    int matchLength = (token & 15);
+    if (matchLength == 15)
+      {
+      do
+        {
+        if (ip >= iend)
+          {
+          return -1;
+          }
+        b = *ip++;
+        matchLength += b;
+        }
+      while (b == 255);
+      }
+    matchLength += VTK_SWEEP_LZ4_MIN_MATCH;
+    if (matchLength > oend - op)
+      {
+      return -1;
+      }
+
+    // the match can overlap the output, so copy one byte at a time
+    const unsigned char *match = op - offset;
+    while (matchLength-- > 0)
+      {
+      *op++ = *match++;
+      }
+    }
+
+  return (int)(op - dst);
+}
+
+//----------------------------------------------------------------------------
+// Write a chunk at the current position, and advance the position
+static int vtkSweepFileWriteChunk(vtkUltrasoundSweepFileInternals *internals,
+                                  const char *tag,
+                                  const void *header, size_t headerSize,
+                                  const void *data, size_t dataSize)
+{
+  vtkSweepChunkHeader chunk;
+  memcpy(chunk.Tag, tag, 4);
+  chunk.Reserved = 0;
+  chunk.Size = (vtkTypeInt64)(headerSize + dataSize);
+
+  if (fwrite(&chunk, sizeof(chunk), 1, internals->File) != 1 ||
+      (headerSize &&
+       fwrite(header, headerSize, 1, internals->File) != 1) ||
+      (dataSize &&
+       fwrite(data, dataSize, 1, internals->File) != 1))
+    {
+    internals->WriteError = 1;
+    return 0;
+    }
+
+  internals->Position += sizeof(chunk) + chunk.Size;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// This function runs in a background thread, it takes the frames from the
+// queue, compresses them, and writes them to the file.
+static void *vtkSweepFileWriterThread(struct ThreadInfoStruct *data)
+{
+  vtkUltrasoundSweepFile *self = (vtkUltrasoundSweepFile *)(data->UserData);
+  vtkUltrasoundSweepFileInternals *internals = self->GetInternals();
+  int frameSize = internals->FrameSize;
+  int compressedCapacity = vtkSweepLZ4CompressBound(frameSize);
+  unsigned char *compressed = 0;
+  if (internals->Compression == VTK_SWEEP_COMPRESSION_LZ4)
+    {
+    compressed = new unsigned char[compressedCapacity];
+    }
+
+  for (;;)
+    {
+    vtkSweepQueuedFrame frame;
+
+    // wait for a frame, and only quit once the queue has been emptied
+    internals->QueueLock->Lock();
+    while (internals->Queue.empty() && internals->Writing)
+      {
+      internals->QueueCondition->Wait(internals->QueueLock);
+      }
+    if (internals->Queue.empty())
+      {
+      internals->QueueLock->Unlock();
+      break;
+      }
+    frame = internals->Queue.front();
+    internals->Queue.pop_front();
+    // wake WriteFrame() if it is waiting for room in the queue
+    internals->QueueCondition->Broadcast();
+    internals->QueueLock->Unlock();
+
+    vtkSweepFrameHeader header;
+    header.TimeStamp = frame.TimeStamp;
+    header.Compression = VTK_SWEEP_COMPRESSION_NONE;
+    header.Reserved = 0;
+    header.RawSize = frameSize;
+
+    const unsigned char *payload = frame.Data;
+    int payloadSize = frameSize;
+    if (compressed)
+      {
+      int size = vtkSweepLZ4Compress(frame.Data, frameSize,
+                                     compressed, compressedCapacity);
+      // store the frame raw if it didn't compress
+      if (size > 0 && size < frameSize)
+        {
+        header.Compression = VTK_SWEEP_COMPRESSION_LZ4;
+        payload = compressed;
+        payloadSize = size;
+        }
+      }
+
+    if (!internals->WriteError)
+      {
+      vtkTypeInt64 offset = internals->Position;
+      if (vtkSweepFileWriteChunk(internals, "FRAM", &header, sizeof(header),
+                                 payload, payloadSize))
+        {
+        internals->QueueLock->Lock();
+        internals->FrameOffsets.push_back(offset);
+        internals->FrameTimeStamps.push_back(frame.TimeStamp);
+        internals->QueueLock->Unlock();
+        }
+      }
+
+    // recycle the buffer
+    internals->QueueLock->Lock();
+    internals->FreeBuffers.push_back(frame.Data);
+    internals->QueueLock->Unlock();
+    }
+
+  delete [] compressed;
+
+  return NULL;
+}
+
+//----------------------------------------------------------------------------
+vtkUltrasoundSweepFile::vtkUltrasoundSweepFile()
+{
+  this->FileName = NULL;
+  this->Compression = VTK_SWEEP_COMPRESSION_LZ4;
+  this->MaximumQueueLength = 256;
+  this->Mode = VTK_SWEEP_MODE_CLOSED;
+
+  this->ClipRectangle[0] = -1e8;
+  this->ClipRectangle[1] = -1e8;
+  this->ClipRectangle[2] = +1e8;
+  this->ClipRectangle[3] = +1e8;
+  this->FanAngles[0] = 0.0;
+  this->FanAngles[1] = 0.0;
+  this->FanOrigin[0] = 0.0;
+  this->FanOrigin[1] = 0.0;
+  this->FanDepth = +1e8;
+  this->VideoLag = 0.0;
+
+  int i;
+  for (i = 0; i < 6; i++)
+    {
+    this->FrameExtent[i] = 0;
+    }
+  for (i = 0; i < 3; i++)
+    {
+    this->FrameSpacing[i] = 1.0;
+    this->FrameOrigin[i] = 0.0;
+    }
+  this->FrameScalarType = VTK_UNSIGNED_CHAR;
+  this->FrameNumberOfScalarComponents = 1;
+
+  this->TrackerBuffer = vtkTrackerBuffer::New();
+  this->Threader = vtkMultiThreader::New();
+  this->WriterThreadId = -1;
+
+  this->Internals = new vtkUltrasoundSweepFileInternals;
+}
+
+//----------------------------------------------------------------------------
+vtkUltrasoundSweepFile::~vtkUltrasoundSweepFile()
+{
+  this->Close();
+  this->SetFileName(NULL);
+  this->TrackerBuffer->Delete();
+  this->Threader->Delete();
+  delete this->Internals;
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundSweepFile::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "FileName: "
+     << (this->FileName ? this->FileName : "(none)") << "\n";
+  os << indent << "Compression: "
+     << (this->Compression == VTK_SWEEP_COMPRESSION_LZ4 ? "LZ4\n" : "None\n");
+  os << indent << "MaximumQueueLength: " << this->MaximumQueueLength << "\n";
+  os << indent << "Mode: " << this->Mode << "\n";
+  os << indent << "ClipRectangle: " << this->ClipRectangle[0] << " "
+     << this->ClipRectangle[1] << " " << this->ClipRectangle[2] << " "
+     << this->ClipRectangle[3] << "\n";
+  os << indent << "FanAngles: " << this->FanAngles[0] << " "
+     << this->FanAngles[1] << "\n";
+  os << indent << "FanOrigin: " << this->FanOrigin[0] << " "
+     << this->FanOrigin[1] << "\n";
+  os << indent << "FanDepth: " << this->FanDepth << "\n";
+  os << indent << "VideoLag: " << this->VideoLag << "\n";
+  os << indent << "FrameExtent: " << this->FrameExtent[0] << " "
+     << this->FrameExtent[1] << " " << this->FrameExtent[2] << " "
+     << this->FrameExtent[3] << " " << this->FrameExtent[4] << " "
+     << this->FrameExtent[5] << "\n";
+  os << indent << "FrameSpacing: " << this->FrameSpacing[0] << " "
+     << this->FrameSpacing[1] << " " << this->FrameSpacing[2] << "\n";
+  os << indent << "FrameOrigin: " << this->FrameOrigin[0] << " "
+     << this->FrameOrigin[1] << " " << this->FrameOrigin[2] << "\n";
+  os << indent << "FrameScalarType: " << this->FrameScalarType << "\n";
+  os << indent << "FrameNumberOfScalarComponents: "
+     << this->FrameNumberOfScalarComponents << "\n";
+  os << indent << "NumberOfFrames: " << this->GetNumberOfFrames() << "\n";
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSweepFile::GetFrameSize()
+{
+  int scalarSize = 1;
+  switch (this->FrameScalarType)
+    {
+    case VTK_CHAR:
+    case VTK_SIGNED_CHAR:
+    case VTK_UNSIGNED_CHAR:
+      scalarSize = 1;
+      break;
+    case VTK_SHORT:
+    case VTK_UNSIGNED_SHORT:
+      scalarSize = 2;
+      break;
+    case VTK_INT:
+    case VTK_UNSIGNED_INT:
+    case VTK_FLOAT:
+      scalarSize = 4;
+      break;
+    case VTK_DOUBLE:
+      scalarSize = 8;
+      break;
+    }
+
+  return ((this->FrameExtent[1] - this->FrameExtent[0] + 1)*
+          (this->FrameExtent[3] - this->FrameExtent[2] + 1)*
+          (this->FrameExtent[5] - this->FrameExtent[4] + 1)*
+          this->FrameNumberOfScalarComponents*scalarSize);
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSweepFile::OpenForWriting(vtkImageData *frameInfo)
+{
+  if (this->Mode != VTK_SWEEP_MODE_CLOSED)
+    {
+    this->Close();
+    }
+  if (this->FileName == NULL)
+    {
+    vtkErrorMacro(<< "OpenForWriting: no FileName");
+    return 0;
+    }
+
+  frameInfo->UpdateInformation();
+  frameInfo->GetWholeExtent(this->FrameExtent);
+  frameInfo->GetSpacing(this->FrameSpacing);
+  frameInfo->GetOrigin(this->FrameOrigin);
+  this->FrameScalarType = frameInfo->GetScalarType();
+  this->FrameNumberOfScalarComponents =
+    frameInfo->GetNumberOfScalarComponents();
+
+  vtkUltrasoundSweepFileInternals *internals = this->Internals;
+  internals->File = fopen(this->FileName, "wb");
+  if (internals->File == 0)
+    {
+    vtkErrorMacro(<< "OpenForWriting: can't open file " << this->FileName);
+    return 0;
+    }
+
+  vtkSweepFileHeader header;
+  memset(&header, 0, sizeof(header));
+  memcpy(header.Magic, "AIGSSWP", 8);
+  header.Version = VTK_SWEEP_VERSION;
+  header.ByteOrder = VTK_SWEEP_BYTE_ORDER;
+  int i;
+  for (i = 0; i < 6; i++)
+    {
+    header.Extent[i] = this->FrameExtent[i];
+    }
+  header.ScalarType = this->FrameScalarType;
+  header.NumberOfScalarComponents = this->FrameNumberOfScalarComponents;
+  for (i = 0; i < 3; i++)
+    {
+    header.Spacing[i] = this->FrameSpacing[i];
+    header.Origin[i] = this->FrameOrigin[i];
+    }
+
+  if (fwrite(&header, sizeof(header), 1, internals->File) != 1)
+    {
+    vtkErrorMacro(<< "OpenForWriting: can't write to file " << this->FileName);
+    fclose(internals->File);
+    internals->File = 0;
+    return 0;
+    }
+
+  internals->Position = sizeof(header);
+  internals->WriteError = 0;
+  internals->Compression = this->Compression;
+  internals->FrameSize = this->GetFrameSize();
+  internals->FrameOffsets.clear();
+  internals->FrameTimeStamps.clear();
+  internals->Writing = 1;
+
+  this->Mode = VTK_SWEEP_MODE_WRITE;
+  this->WriterThreadId =
+    this->Threader->SpawnThread((vtkThreadFunctionType)\
+                                &vtkSweepFileWriterThread, this);
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSweepFile::WriteFrame(vtkImageData *frame, double timestamp)
+{
+  if (this->Mode != VTK_SWEEP_MODE_WRITE)
+    {
+    vtkErrorMacro(<< "WriteFrame: file is not open for writing");
+    return 0;
+    }
+
+  int *extent = frame->GetExtent();
+  for (int i = 0; i < 6; i++)
+    {
+    if (extent[i] != this->FrameExtent[i])
+      {
+      vtkErrorMacro(<< "WriteFrame: frame extent does not match the file");
+      return 0;
+      }
+    }
+  if (frame->GetScalarType() != this->FrameScalarType ||
+      frame->GetNumberOfScalarComponents() !=
+      this->FrameNumberOfScalarComponents)
+    {
+    vtkErrorMacro(<< "WriteFrame: frame type does not match the file");
+    return 0;
+    }
+
+  vtkUltrasoundSweepFileInternals *internals = this->Internals;
+  if (internals->WriteError)
+    {
+    vtkErrorMacro(<< "WriteFrame: error writing to " << this->FileName);
+    return 0;
+    }
+
+  // wait for the writer thread if it has fallen too far behind,
+  // then get a buffer and copy the frame into it
+  unsigned char *buffer = 0;
+  internals->QueueLock->Lock();
+  while ((int)(internals->Queue.size()) >= this->MaximumQueueLength)
+    {
+    internals->QueueCondition->Wait(internals->QueueLock);
+    }
+  if (!internals->FreeBuffers.empty())
+    {
+    buffer = internals->FreeBuffers.back();
+    internals->FreeBuffers.pop_back();
+    }
+  internals->QueueLock->Unlock();
+  if (buffer == 0)
+    {
+    buffer = new unsigned char[internals->FrameSize];
+    }
+
+  memcpy(buffer, frame->GetScalarPointer(), internals->FrameSize);
+
+  vtkSweepQueuedFrame queued;
+  queued.TimeStamp = timestamp;
+  queued.Data = buffer;
+  internals->QueueLock->Lock();
+  internals->Queue.push_back(queued);
+  internals->QueueCondition->Broadcast();
+  internals->QueueLock->Unlock();
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundSweepFile::SetTrackerBuffer(vtkTrackerBuffer *buffer)
+{
+  this->TrackerBuffer->Lock();
+  this->TrackerBuffer->DeepCopy(buffer);
+  this->TrackerBuffer->Unlock();
+}
+
+//----------------------------------------------------------------------------
+static void vtkSweepFileGetCalibration(vtkMatrix4x4 *matrix, double e[16])
+{
+  for (int i = 0; i < 4; i++)
+    {
+    for (int j = 0; j < 4; j++)
+      {
+      e[4*i+j] = (matrix ? matrix->GetElement(i,j) : (i == j));
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundSweepFile::Close()
+{
+  vtkUltrasoundSweepFileInternals *internals = this->Internals;
+
+  if (this->Mode == VTK_SWEEP_MODE_WRITE)
+    {
+    // the writer thread will empty the queue before it stops
+    internals->QueueLock->Lock();
+    internals->Writing = 0;
+    internals->QueueCondition->Broadcast();
+    internals->QueueLock->Unlock();
+    if (this->WriterThreadId != -1)
+      {
+      this->Threader->TerminateThread(this->WriterThreadId);
+      this->WriterThreadId = -1;
+      }
+
+    // the tracking information
+    vtkTrackerBuffer *buffer = this->TrackerBuffer;
+    int n = buffer->GetNumberOfItems();
+    vtkSweepTrackHeader trackHeader;
+    trackHeader.NumberOfRecords = n;
+    trackHeader.Reserved = 0;
+    vtkSweepFileGetCalibration(buffer->GetToolCalibrationMatrix(),
+                               trackHeader.ToolCalibrationMatrix);
+    vtkSweepFileGetCalibration(buffer->GetWorldCalibrationMatrix(),
+                               trackHeader.WorldCalibrationMatrix);
+    std::vector<vtkSweepTrackRecord> records(n);
+    vtkMatrix4x4 *matrix = vtkMatrix4x4::New();
+    int i, j;
+    for (i = 0; i < n; i++)
+      {
+      // oldest first
+      int k = n - 1 - i;
+      records[i].TimeStamp = buffer->GetTimeStamp(k);
+      records[i].Flags = buffer->GetFlags(k);
+      records[i].Reserved = 0;
+      buffer->GetUncalibratedMatrix(matrix, k);
+      for (j = 0; j < 16; j++)
+        {
+        records[i].Matrix[j] = matrix->Element[j/4][j%4];
+        }
+      }
+    matrix->Delete();
+    vtkSweepFileWriteChunk(internals, "TRAK", &trackHeader,
+                           sizeof(trackHeader),
+                           (n > 0 ? &records[0] : 0),
+                           n*sizeof(vtkSweepTrackRecord));
+
+    // the ultrasound parameters
+    vtkSweepParameters parameters;
+    for (i = 0; i < 4; i++)
+      {
+      parameters.ClipRectangle[i] = this->ClipRectangle[i];
+      }
+    for (i = 0; i < 2; i++)
+      {
+      parameters.FanAngles[i] = this->FanAngles[i];
+      parameters.FanOrigin[i] = this->FanOrigin[i];
+      }
+    parameters.FanDepth = this->FanDepth;
+    parameters.VideoLag = this->VideoLag;
+    vtkSweepFileWriteChunk(internals, "PARM", &parameters,
+                           sizeof(parameters), 0, 0);
+
+    // the index, and the pointer to the index
+    vtkTypeInt64 indexOffset = internals->Position;
+    size_t numFrames = internals->FrameOffsets.size();
+    vtkSweepFileWriteChunk(internals, "INDX", 0, 0,
+                           (numFrames > 0 ? &internals->FrameOffsets[0] : 0),
+                           numFrames*sizeof(vtkTypeInt64));
+    vtkSweepChunkHeader footer;
+    memcpy(footer.Tag, "SEND", 4);
+    footer.Reserved = 0;
+    footer.Size = indexOffset;
+    if (fwrite(&footer, sizeof(footer), 1, internals->File) != 1)
+      {
+      internals->WriteError = 1;
+      }
+
+    if (fclose(internals->File) != 0 || internals->WriteError)
+      {
+      vtkErrorMacro(<< "Close: error writing to " << this->FileName);
+      }
+    internals->File = 0;
+    internals->ClearBuffers();
+    }
+  else if (this->Mode == VTK_SWEEP_MODE_READ)
+    {
+#ifdef _WIN32
+    UnmapViewOfFile(internals->Map);
+    CloseHandle(internals->MappingHandle);
+    CloseHandle(internals->FileHandle);
+    internals->MappingHandle = NULL;
+    internals->FileHandle = INVALID_HANDLE_VALUE;
+#else
+    munmap(internals->Map, (size_t)(internals->MapSize));
+    close(internals->FileDescriptor);
+    internals->FileDescriptor = -1;
+#endif
+    internals->Map = 0;
+    internals->MapSize = 0;
+    }
+
+  this->Mode = VTK_SWEEP_MODE_CLOSED;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSweepFile::Open()
+{
+  if (this->Mode != VTK_SWEEP_MODE_CLOSED)
+    {
+    this->Close();
+    }
+  if (this->FileName == NULL)
+    {
+    vtkErrorMacro(<< "Open: no FileName");
+    return 0;
+    }
+
+  // map the whole file into memory
+  vtkUltrasoundSweepFileInternals *internals = this->Internals;
+#ifdef _WIN32
+  internals->FileHandle = CreateFile(this->FileName, GENERIC_READ,
+                                     FILE_SHARE_READ, NULL, OPEN_EXISTING,
+                                     FILE_ATTRIBUTE_NORMAL, NULL);
+  if (internals->FileHandle == INVALID_HANDLE_VALUE)
+    {
+    vtkErrorMacro(<< "Open: can't open file " << this->FileName);
+    return 0;
+    }
+  LARGE_INTEGER fileSize;
+  GetFileSizeEx(internals->FileHandle, &fileSize);
+  internals->MapSize = fileSize.QuadPart;
+  internals->MappingHandle = CreateFileMapping(internals->FileHandle, NULL,
+                                               PAGE_READONLY, 0, 0, NULL);
+  if (internals->MappingHandle != NULL)
+    {
+    internals->Map = (unsigned char *)
+      MapViewOfFile(internals->MappingHandle, FILE_MAP_READ, 0, 0, 0);
+    }
+  if (internals->Map == 0)
+    {
+    vtkErrorMacro(<< "Open: can't map file " << this->FileName);
+    if (internals->MappingHandle != NULL)
+      {
+      CloseHandle(internals->MappingHandle);
+      internals->MappingHandle = NULL;
+      }
+    CloseHandle(internals->FileHandle);
+    internals->FileHandle = INVALID_HANDLE_VALUE;
+    return 0;
+    }
+#else
+  internals->FileDescriptor = open(this->FileName, O_RDONLY);
+  if (internals->FileDescriptor < 0)
+    {
+    vtkErrorMacro(<< "Open: can't open file " << this->FileName);
+    return 0;
+    }
+  struct stat fileStat;
+  fstat(internals->FileDescriptor, &fileStat);
+  internals->MapSize = fileStat.st_size;
+  void *map = MAP_FAILED;
+  if (internals->MapSize > 0)
+    {
+    map = mmap(0, (size_t)(internals->MapSize), PROT_READ, MAP_SHARED,
+               internals->FileDescriptor, 0);
+    }
+  if (map == MAP_FAILED)
+    {
+    vtkErrorMacro(<< "Open: can't map file " << this->FileName);
+    close(internals->FileDescriptor);
+    internals->FileDescriptor = -1;
+    return 0;
+    }
+  internals->Map = (unsigned char *)(map);
+#endif
+  this->Mode = VTK_SWEEP_MODE_READ;
+
+  // check the header
+  vtkSweepFileHeader header;
+  if (internals->MapSize < (vtkTypeInt64)sizeof(header))
+    {
+    vtkErrorMacro(<< "Open: " << this->FileName << " is not a sweep file");
+    this->Close();
+    return 0;
+    }
+  memcpy(&header, internals->Map, sizeof(header));
+  if (memcmp(header.Magic, "AIGSSWP", 8) != 0)
+    {
+    vtkErrorMacro(<< "Open: " << this->FileName << " is not a sweep file");
+    this->Close();
+    return 0;
+    }
+  if (header.ByteOrder != VTK_SWEEP_BYTE_ORDER ||
+      header.Version > VTK_SWEEP_VERSION)
+    {
+    vtkErrorMacro(<< "Open: " << this->FileName
+                  << " was written by an incompatible system");
+    this->Close();
+    return 0;
+    }
+
+  int i;
+  for (i = 0; i < 6; i++)
+    {
+    this->FrameExtent[i] = header.Extent[i];
+    }
+  for (i = 0; i < 3; i++)
+    {
+    this->FrameSpacing[i] = header.Spacing[i];
+    this->FrameOrigin[i] = header.Origin[i];
+    }
+  this->FrameScalarType = header.ScalarType;
+  this->FrameNumberOfScalarComponents = header.NumberOfScalarComponents;
+
+  if (!this->ScanChunks())
+    {
+    this->Close();
+    return 0;
+    }
+
+  // read the parameters
+  if (internals->ParameterOffset >= 0)
+    {
+    vtkSweepParameters parameters;
+    memcpy(&parameters, internals->Map + internals->ParameterOffset +
+           sizeof(vtkSweepChunkHeader), sizeof(parameters));
+    for (i = 0; i < 4; i++)
+      {
+      this->ClipRectangle[i] = parameters.ClipRectangle[i];
+      }
+    for (i = 0; i < 2; i++)
+      {
+      this->FanAngles[i] = parameters.FanAngles[i];
+      this->FanOrigin[i] = parameters.FanOrigin[i];
+      }
+    this->FanDepth = parameters.FanDepth;
+    this->VideoLag = parameters.VideoLag;
+    this->Modified();
+    }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// Read the frame offsets from the INDX chunk at the given offset, checking
+// each one against the FRAM chunk that it points to.  Returns the position
+// just past the last frame, or -1 if the index is missing or corrupt.
+static vtkTypeInt64 vtkSweepFileReadIndex(
+  vtkUltrasoundSweepFileInternals *internals, vtkTypeInt64 indexOffset,
+  vtkTypeInt64 end)
+{
+  const unsigned char *map = internals->Map;
+  vtkSweepChunkHeader chunk;
+  vtkSweepFrameHeader frameHeader;
+  vtkTypeInt64 headerSize = sizeof(vtkSweepChunkHeader);
+  vtkTypeInt64 position = sizeof(vtkSweepFileHeader);
+
+  if (indexOffset < position || indexOffset + headerSize > end)
+    {
+    return -1;
+    }
+  memcpy(&chunk, map + indexOffset, sizeof(chunk));
+  if (memcmp(chunk.Tag, "INDX", 4) != 0 || chunk.Size < 0 ||
+      chunk.Size % (vtkTypeInt64)sizeof(vtkTypeInt64) != 0 ||
+      indexOffset + headerSize + chunk.Size > end)
+    {
+    return -1;
+    }
+
+  vtkTypeInt64 n = chunk.Size/(vtkTypeInt64)sizeof(vtkTypeInt64);
+  const unsigned char *cp = map + indexOffset + headerSize;
+  for (vtkTypeInt64 k = 0; k < n; k++)
+    {
+    vtkTypeInt64 offset;
+    memcpy(&offset, cp + k*sizeof(vtkTypeInt64), sizeof(offset));
+    if (offset < position ||
+        offset + headerSize + (vtkTypeInt64)sizeof(frameHeader) > indexOffset)
+      {
+      return -1;
+      }
+    memcpy(&chunk, map + offset, sizeof(chunk));
+    if (memcmp(chunk.Tag, "FRAM", 4) != 0 ||
+        chunk.Size < (vtkTypeInt64)sizeof(frameHeader) ||
+        offset + headerSize + chunk.Size > indexOffset)
+      {
+      return -1;
+      }
+    memcpy(&frameHeader, map + offset + headerSize, sizeof(frameHeader));
+    internals->FrameOffsets.push_back(offset);
+    internals->FrameTimeStamps.push_back(frameHeader.TimeStamp);
+    position = offset + headerSize + chunk.Size;
+    }
+
+  return position;
+}
+
+//----------------------------------------------------------------------------
+// Find the chunks in the mapped file.  If the file has an index, it is
+// used for the frames, and only the chunks that follow the last frame are
+// scanned.  Otherwise the chunks are scanned one after another until the
+// end of the file (or until a truncated chunk is found).
+int vtkUltrasoundSweepFile::ScanChunks()
+{
+  vtkUltrasoundSweepFileInternals *internals = this->Internals;
+  const unsigned char *map = internals->Map;
+  vtkTypeInt64 mapSize = internals->MapSize;
+  vtkSweepChunkHeader chunk;
+
+  internals->FrameOffsets.clear();
+  internals->FrameTimeStamps.clear();
+  internals->TrackOffset = -1;
+  internals->TrackSize = 0;
+  internals->ParameterOffset = -1;
+
+  // the position of the first chunk, and the end of the last chunk
+  vtkTypeInt64 position = sizeof(vtkSweepFileHeader);
+  vtkTypeInt64 end = mapSize;
+
+  // check for the footer, which gives the position of the index
+  if (mapSize >= position + (vtkTypeInt64)sizeof(chunk))
+    {
+    memcpy(&chunk, map + mapSize - sizeof(chunk), sizeof(chunk));
+    if (memcmp(chunk.Tag, "SEND", 4) == 0 && chunk.Size >= position &&
+        chunk.Size < mapSize)
+      {
+      end = mapSize - sizeof(chunk);
+      vtkTypeInt64 afterFrames =
+        vtkSweepFileReadIndex(internals, chunk.Size, end);
+      if (afterFrames >= 0)
+        {
+        position = afterFrames;
+        }
+      else
+        {
+        vtkWarningMacro(<< "ScanChunks: the index in " << this->FileName
+                        << " is corrupt, scanning the frames instead");
+        internals->FrameOffsets.clear();
+        internals->FrameTimeStamps.clear();
+        }
+      }
+    }
+
+  while (position + (vtkTypeInt64)sizeof(chunk) <= end)
+    {
+    memcpy(&chunk, map + position, sizeof(chunk));
+    if (chunk.Size < 0 ||
+        position + (vtkTypeInt64)sizeof(chunk) + chunk.Size > end)
+      {
+      vtkWarningMacro(<< "ScanChunks: " << this->FileName
+                      << " is truncated, only "
+                      << internals->FrameOffsets.size()
+                      << " frames were recovered");
+      break;
+      }
+
+    if (memcmp(chunk.Tag, "FRAM", 4) == 0)
+      {
+      vtkSweepFrameHeader frameHeader;
+      if (chunk.Size < (vtkTypeInt64)sizeof(frameHeader))
+        {
+        vtkWarningMacro(<< "ScanChunks: " << this->FileName
+                        << " is corrupt, only "
+                        << internals->FrameOffsets.size()
+                        << " frames were recovered");
+        break;
+        }
+      memcpy(&frameHeader, map + position + sizeof(chunk),
+             sizeof(frameHeader));
+      internals->FrameOffsets.push_back(position);
+      internals->FrameTimeStamps.push_back(frameHeader.TimeStamp);
+      }
+    else if (memcmp(chunk.Tag, "TRAK", 4) == 0)
+      {
+      internals->TrackOffset = position;
+      internals->TrackSize = chunk.Size;
+      }
+    else if (memcmp(chunk.Tag, "PARM", 4) == 0)
+      {
+      if (chunk.Size >= (vtkTypeInt64)sizeof(vtkSweepParameters))
+        {
+        internals->ParameterOffset = position;
+        }
+      }
+    else if (memcmp(chunk.Tag, "INDX", 4) == 0)
+      {
+      // the index comes after all of the frames
+      break;
+      }
+
+    position += sizeof(chunk) + chunk.Size;
+    }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSweepFile::GetNumberOfFrames()
+{
+  // the writer thread might be adding frames
+  vtkUltrasoundSweepFileInternals *internals = this->Internals;
+  internals->QueueLock->Lock();
+  int n = (int)(internals->FrameOffsets.size());
+  internals->QueueLock->Unlock();
+  return n;
+}
+
+//----------------------------------------------------------------------------
+double vtkUltrasoundSweepFile::GetFrameTimeStamp(int i)
+{
+  if (i < 0 || i >= this->GetNumberOfFrames())
+    {
+    vtkErrorMacro(<< "GetFrameTimeStamp: frame " << i << " out of range");
+    return 0.0;
+    }
+  vtkUltrasoundSweepFileInternals *internals = this->Internals;
+  internals->QueueLock->Lock();
+  double timestamp = internals->FrameTimeStamps[i];
+  internals->QueueLock->Unlock();
+  return timestamp;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSweepFile::ReadFrame(int i, vtkImageData *frame)
+{
+  if (this->Mode != VTK_SWEEP_MODE_READ)
+    {
+    vtkErrorMacro(<< "ReadFrame: file is not open for reading");
+    return 0;
+    }
+  if (i < 0 || i >= this->GetNumberOfFrames())
+    {
+    vtkErrorMacro(<< "ReadFrame: frame " << i << " out of range");
+    return 0;
+    }
+
+  // allocate the frame, unless it already has the right geometry
+  int *extent = frame->GetExtent();
+  if (extent[0] != this->FrameExtent[0] || extent[1] != this->FrameExtent[1] ||
+      extent[2] != this->FrameExtent[2] || extent[3] != this->FrameExtent[3] ||
+      extent[4] != this->FrameExtent[4] || extent[5] != this->FrameExtent[5] ||
+      frame->GetScalarType() != this->FrameScalarType ||
+      frame->GetNumberOfScalarComponents() !=
+      this->FrameNumberOfScalarComponents ||
+      frame->GetScalarPointer() == NULL)
+    {
+    frame->SetExtent(this->FrameExtent);
+    frame->SetWholeExtent(this->FrameExtent);
+    frame->SetScalarType(this->FrameScalarType);
+    frame->SetNumberOfScalarComponents(this->FrameNumberOfScalarComponents);
+    frame->AllocateScalars();
+    }
+  frame->SetSpacing(this->FrameSpacing);
+  frame->SetOrigin(this->FrameOrigin);
+
+  vtkUltrasoundSweepFileInternals *internals = this->Internals;
+  const unsigned char *cp = internals->Map + internals->FrameOffsets[i];
+  vtkSweepChunkHeader chunk;
+  vtkSweepFrameHeader header;
+  memcpy(&chunk, cp, sizeof(chunk));
+  memcpy(&header, cp + sizeof(chunk), sizeof(header));
+  const unsigned char *data = cp + sizeof(chunk) + sizeof(header);
+  int dataSize = (int)(chunk.Size - sizeof(header));
+  int frameSize = this->GetFrameSize();
+  unsigned char *outPtr = (unsigned char *)(frame->GetScalarPointer());
+
+  if (header.RawSize != frameSize)
+    {
+    vtkErrorMacro(<< "ReadFrame: frame " << i << " has the wrong size");
+    return 0;
+    }
+
+  if (header.Compression == VTK_SWEEP_COMPRESSION_LZ4)
+    {
+    if (vtkSweepLZ4Decompress(data, dataSize, outPtr, frameSize) !=
+        frameSize)
+      {
+      vtkErrorMacro(<< "ReadFrame: frame " << i << " is corrupt");
+      return 0;
+      }
+    }
+  else
+    {
+    if (dataSize != frameSize)
+      {
+      vtkErrorMacro(<< "ReadFrame: frame " << i << " is corrupt");
+      return 0;
+      }
+    memcpy(outPtr, data, frameSize);
+    }
+
+  frame->Modified();
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundSweepFile::ReadTrackerBuffer(vtkTrackerBuffer *buffer)
+{
+  vtkUltrasoundSweepFileInternals *internals = this->Internals;
+  if (this->Mode != VTK_SWEEP_MODE_READ || internals->TrackOffset < 0)
+    {
+    return 0;
+    }
+
+  const unsigned char *cp = internals->Map + internals->TrackOffset +
+    sizeof(vtkSweepChunkHeader);
+  vtkSweepTrackHeader header;
+  if (internals->TrackSize < (vtkTypeInt64)sizeof(header))
+    {
+    vtkErrorMacro(<< "ReadTrackerBuffer: the tracking information in "
+                  << this->FileName << " is corrupt");
+    return 0;
+    }
+  memcpy(&header, cp, sizeof(header));
+  cp += sizeof(header);
+
+  // the records must fit within the chunk
+  if (header.NumberOfRecords < 0 ||
+      (vtkTypeInt64)(header.NumberOfRecords) >
+      (internals->TrackSize - (vtkTypeInt64)sizeof(header))/
+      (vtkTypeInt64)sizeof(vtkSweepTrackRecord))
+    {
+    vtkErrorMacro(<< "ReadTrackerBuffer: the tracking information in "
+                  << this->FileName << " is corrupt");
+    return 0;
+    }
+
+  // build the buffer in a temporary, so that the destination buffer is
+  // only locked for the copy
+  vtkTrackerBuffer *tmp = vtkTrackerBuffer::New();
+  tmp->SetBufferSize(header.NumberOfRecords > 0 ? header.NumberOfRecords : 1);
+  vtkMatrix4x4 *matrix = vtkMatrix4x4::New();
+  matrix->DeepCopy(header.ToolCalibrationMatrix);
+  tmp->SetToolCalibrationMatrix(matrix);
+  matrix->Delete();
+  matrix = vtkMatrix4x4::New();
+  matrix->DeepCopy(header.WorldCalibrationMatrix);
+  tmp->SetWorldCalibrationMatrix(matrix);
+  matrix->Delete();
+
+  matrix = vtkMatrix4x4::New();
+  for (int i = 0; i < header.NumberOfRecords; i++)
+    {
+    vtkSweepTrackRecord record;
+    memcpy(&record, cp, sizeof(record));
+    cp += sizeof(record);
+    matrix->DeepCopy(record.Matrix);
+    tmp->AddItem(matrix, record.Flags, record.TimeStamp);
+    }
+  matrix->Delete();
+
+  buffer->Lock();
+  buffer->DeepCopy(tmp);
+  buffer->Unlock();
+  tmp->Delete();
+
+  return 1;
+}
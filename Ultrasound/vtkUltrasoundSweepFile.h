@@ -0,0 +1,221 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundSweepFile.h,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+// .NAME vtkUltrasoundSweepFile - single-file archive of a freehand sweep
+// .SECTION Description
+// vtkUltrasoundSweepFile stores an ultrasound sweep (the video frames,
+// their timestamps, the tracking information and the fan/clip parameters)
+// in a single binary file.  The file consists of a fixed header that
+// describes the frame geometry, followed by a sequence of chunks:
+// one chunk per frame (stored raw, or compressed in the LZ4 block format),
+// then a tracking chunk, a parameter chunk, and an index of the frame
+// chunks.  Open() finds the frames through the index.  If the file was
+// not closed properly (e.g. the program crashed during an acquisition),
+// so that there is no index, the frames are recovered by scanning the
+// chunks.
+//
+// All values are stored in the byte order of the machine that wrote the
+// file, and they are not swapped on reading: Open() rejects a file that
+// was written with a different byte order.
+//
+// When writing, WriteFrame() only copies the frame into a queue: the
+// frames are compressed and written to disk by a background thread, so
+// it is safe to call WriteFrame() during an acquisition.  When reading,
+// the file is memory-mapped and any frame can be read in any order.
+// .SECTION see also
+// vtkFreehandUltrasound2 vtkTrackerBuffer
+
+#ifndef __vtkUltrasoundSweepFile_h
+#define __vtkUltrasoundSweepFile_h
+
+#include "vtkObject.h"
+
+class vtkImageData;
+class vtkTrackerBuffer;
+class vtkMultiThreader;
+class vtkUltrasoundSweepFileInternals;
+
+#define VTK_SWEEP_COMPRESSION_NONE 0
+#define VTK_SWEEP_COMPRESSION_LZ4 1
+
+#define VTK_SWEEP_MODE_CLOSED 0
+#define VTK_SWEEP_MODE_WRITE 1
+#define VTK_SWEEP_MODE_READ 2
+
+class VTK_EXPORT vtkUltrasoundSweepFile : public vtkObject
+{
+public:
+  static vtkUltrasoundSweepFile *New();
+  vtkTypeRevisionMacro(vtkUltrasoundSweepFile, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // The name of the file.
+  vtkSetStringMacro(FileName);
+  vtkGetStringMacro(FileName);
+
+  // Description:
+  // The compression to use when writing frames.  Frames that do not
+  // compress are always stored raw.  Default: LZ4.
+  vtkSetClampMacro(Compression, int, VTK_SWEEP_COMPRESSION_NONE,
+                   VTK_SWEEP_COMPRESSION_LZ4);
+  vtkGetMacro(Compression, int);
+  void SetCompressionToNone()
+    { this->SetCompression(VTK_SWEEP_COMPRESSION_NONE); };
+  void SetCompressionToLZ4()
+    { this->SetCompression(VTK_SWEEP_COMPRESSION_LZ4); };
+
+  // Description:
+  // The maximum number of frames that can be waiting for the writer
+  // thread.  If the queue is full, WriteFrame() waits.  Default: 256.
+  vtkSetClampMacro(MaximumQueueLength, int, 1, VTK_LARGE_INTEGER);
+  vtkGetMacro(MaximumQueueLength, int);
+
+  // Description:
+  // The ultrasound parameters that are stored with the sweep.  These
+  // are written when the file is closed, and read by Open().
+  vtkSetVector4Macro(ClipRectangle, double);
+  vtkGetVector4Macro(ClipRectangle, double);
+  vtkSetVector2Macro(FanAngles, double);
+  vtkGetVector2Macro(FanAngles, double);
+  vtkSetVector2Macro(FanOrigin, double);
+  vtkGetVector2Macro(FanOrigin, double);
+  vtkSetMacro(FanDepth, double);
+  vtkGetMacro(FanDepth, double);
+  vtkSetMacro(VideoLag, double);
+  vtkGetMacro(VideoLag, double);
+
+  // Description:
+  // Create the file and start the writer thread.  The geometry of the
+  // frames (extent, spacing, origin, scalar type and components) is
+  // taken from the given image, and all frames must match it.
+  // Returns zero on failure.
+  int OpenForWriting(vtkImageData *frameInfo);
+
+  // Description:
+  // Queue a frame to be written, with the given timestamp.  The frame is
+  // copied, so it can be modified as soon as this method returns.
+  // Returns zero on failure.
+  int WriteFrame(vtkImageData *frame, double timestamp);
+
+  // Description:
+  // Set the tracking information that will be written when the file is
+  // closed.  The buffer is copied, so lock it before calling this method
+  // if it is in use by a tracker.
+  void SetTrackerBuffer(vtkTrackerBuffer *buffer);
+
+  // Description:
+  // Open an existing file for reading.  Returns zero on failure.
+  int Open();
+
+  // Description:
+  // Close the file.  If the file is being written, this waits for the
+  // writer thread to finish, and then writes the tracking information,
+  // the parameters and the index.
+  void Close();
+
+  // Description:
+  // Information about the frames in a file that has been opened.
+  int GetNumberOfFrames();
+  double GetFrameTimeStamp(int i);
+  vtkGetVector6Macro(FrameExtent, int);
+  vtkGetVector3Macro(FrameSpacing, double);
+  vtkGetVector3Macro(FrameOrigin, double);
+  vtkGetMacro(FrameScalarType, int);
+  vtkGetMacro(FrameNumberOfScalarComponents, int);
+
+  // Description:
+  // Read frame i into the given image, which is allocated if necessary.
+  // Returns zero on failure.
+  int ReadFrame(int i, vtkImageData *frame);
+
+  // Description:
+  // Read the tracking information into the given buffer.  Returns zero
+  // if the file contains no tracking information.
+  int ReadTrackerBuffer(vtkTrackerBuffer *buffer);
+
+  // Description:
+  // Returns VTK_SWEEP_MODE_WRITE or VTK_SWEEP_MODE_READ if the file is
+  // open, or VTK_SWEEP_MODE_CLOSED.
+  vtkGetMacro(Mode, int);
+
+//BTX
+  // Description:
+  // Used by the writer thread.
+  vtkUltrasoundSweepFileInternals *GetInternals() { return this->Internals; };
+//ETX
+
+protected:
+  vtkUltrasoundSweepFile();
+  ~vtkUltrasoundSweepFile();
+
+  char *FileName;
+  int Compression;
+  int MaximumQueueLength;
+  int Mode;
+
+  double ClipRectangle[4];
+  double FanAngles[2];
+  double FanOrigin[2];
+  double FanDepth;
+  double VideoLag;
+
+  int FrameExtent[6];
+  double FrameSpacing[3];
+  double FrameOrigin[3];
+  int FrameScalarType;
+  int FrameNumberOfScalarComponents;
+
+  vtkTrackerBuffer *TrackerBuffer;
+  vtkMultiThreader *Threader;
+  int WriterThreadId;
+
+  vtkUltrasoundSweepFileInternals *Internals;
+
+  int GetFrameSize();
+  int ScanChunks();
+
+private:
+  vtkUltrasoundSweepFile(const vtkUltrasoundSweepFile&);
+  void operator=(const vtkUltrasoundSweepFile&);
+};
+
+#endif
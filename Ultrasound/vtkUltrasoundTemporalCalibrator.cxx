@@ -0,0 +1,692 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundTemporalCalibrator.cxx,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+
+#include "vtkUltrasoundTemporalCalibrator.h"
+#include "vtkObjectFactory.h"
+#include "vtkImageData.h"
+#include "vtkDoubleArray.h"
+#include "vtkMatrix4x4.h"
+#include "vtkMath.h"
+#include "vtkMultiThreader.h"
+#include "vtkTrackerBuffer.h"
+#include "vtkUltrasoundSweepFile.h"
+
+#include <math.h>
+
+vtkCxxRevisionMacro(vtkUltrasoundTemporalCalibrator, "$Revision: 1.1 $");
+vtkStandardNewMacro(vtkUltrasoundTemporalCalibrator);
+
+vtkCxxSetObjectMacro(vtkUltrasoundTemporalCalibrator,SweepFile,
+                     vtkUltrasoundSweepFile);
+vtkCxxSetObjectMacro(vtkUltrasoundTemporalCalibrator,TrackerBuffer,
+                     vtkTrackerBuffer);
+
+//----------------------------------------------------------------------------
+vtkUltrasoundTemporalCalibrator::vtkUltrasoundTemporalCalibrator()
+{
+  this->SweepFile = NULL;
+  this->TrackerBuffer = NULL;
+  this->Threader = vtkMultiThreader::New();
+  this->NumberOfThreads = this->Threader->GetNumberOfThreads();
+
+  this->ClipExtent[0] = -VTK_LARGE_INTEGER;
+  this->ClipExtent[1] = VTK_LARGE_INTEGER;
+  this->ClipExtent[2] = -VTK_LARGE_INTEGER;
+  this->ClipExtent[3] = VTK_LARGE_INTEGER;
+  this->SampleInterval = 0.001;
+  this->MaximumLag = 0.5;
+
+  this->VideoLag = 0.0;
+  this->PeakCorrelation = 0.0;
+
+  this->VideoSignal = vtkDoubleArray::New();
+  this->VideoSignal->SetNumberOfComponents(2);
+  this->TrackerSignal = vtkDoubleArray::New();
+  this->TrackerSignal->SetNumberOfComponents(2);
+}
+
+//----------------------------------------------------------------------------
+vtkUltrasoundTemporalCalibrator::~vtkUltrasoundTemporalCalibrator()
+{
+  this->SetSweepFile(NULL);
+  this->SetTrackerBuffer(NULL);
+  this->Threader->Delete();
+  this->VideoSignal->Delete();
+  this->TrackerSignal->Delete();
+}
+
+//----------------------------------------------------------------------------
+void vtkUltrasoundTemporalCalibrator::PrintSelf(ostream& os, vtkIndent indent)
+{
+  this->Superclass::PrintSelf(os,indent);
+
+  os << indent << "SweepFile: " << this->SweepFile << "\n";
+  os << indent << "TrackerBuffer: " << this->TrackerBuffer << "\n";
+  os << indent << "ClipExtent: " << this->ClipExtent[0] << " "
+     << this->ClipExtent[1] << " " << this->ClipExtent[2] << " "
+     << this->ClipExtent[3] << "\n";
+  os << indent << "SampleInterval: " << this->SampleInterval << "\n";
+  os << indent << "MaximumLag: " << this->MaximumLag << "\n";
+  os << indent << "NumberOfThreads: " << this->NumberOfThreads << "\n";
+  os << indent << "VideoLag: " << this->VideoLag << "\n";
+  os << indent << "PeakCorrelation: " << this->PeakCorrelation << "\n";
+  os << indent << "VideoSignal: " << this->VideoSignal << "\n";
+  os << indent << "TrackerSignal: " << this->TrackerSignal << "\n";
+}
+
+//----------------------------------------------------------------------------
+// Find the depth of the reflector in one frame: the rows of the clip
+// region are summed, and the brightest row is refined to sub-pixel
+// precision with a parabola.  Returns zero if the frame has no peak.
+template <class T>
+static int vtkTemporalCalibrationFrameSignal(vtkImageData *frame,
+                                             const int clipExt[4],
+                                             double *rowSums,
+                                             double *value, T *)
+{
+  vtkIdType inc[3];
+  frame->GetIncrements(inc);
+  int *extent = frame->GetExtent();
+  T *inPtr = (T *)frame->GetScalarPointer(clipExt[0], clipExt[2], extent[4]);
+  int numCols = clipExt[1] - clipExt[0] + 1;
+  int numRows = clipExt[3] - clipExt[2] + 1;
+
+  int idY;
+  for (idY = 0; idY < numRows; idY++)
+    {
+    T *rowPtr = inPtr + idY*inc[1];
+    double sum = 0.0;
+    for (int idX = 0; idX < numCols; idX++)
+      {
+      sum += rowPtr[0];
+      rowPtr += inc[0];
+      }
+    rowSums[idY] = sum;
+    }
+
+  int peak = 0;
+  double minSum = rowSums[0];
+  for (idY = 1; idY < numRows; idY++)
+    {
+    if (rowSums[idY] > rowSums[peak])
+      {
+      peak = idY;
+      }
+    if (rowSums[idY] < minSum)
+      {
+      minSum = rowSums[idY];
+      }
+    }
+  if (rowSums[peak] <= minSum)
+    {
+    return 0;
+    }
+
+  double offset = 0.0;
+  if (peak > 0 && peak < numRows - 1)
+    {
+    double a = rowSums[peak - 1];
+    double b = rowSums[peak];
+    double c = rowSums[peak + 1];
+    double d = a - 2*b + c;
+    if (d < 0)
+      {
+      offset = 0.5*(a - c)/d;
+      }
+    }
+
+  *value = clipExt[2] + peak + offset;
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// The information shared by the frame analysis threads
+struct vtkTemporalCalibrationStruct
+{
+  vtkUltrasoundSweepFile *SweepFile;
+  vtkImageData *Frames[VTK_MAX_THREADS];
+  int ClipExtent[4];
+  int NumberOfFrames;
+  double *Values;
+  int *Valid;
+};
+
+//----------------------------------------------------------------------------
+// Each thread decodes and analyzes a contiguous range of frames.
+static VTK_THREAD_RETURN_TYPE vtkTemporalCalibrationThread(void *arg)
+{
+  int threadId = ((ThreadInfoStruct *)(arg))->ThreadID;
+  int threadCount = ((ThreadInfoStruct *)(arg))->NumberOfThreads;
+  vtkTemporalCalibrationStruct *str = (vtkTemporalCalibrationStruct *)
+    (((ThreadInfoStruct *)(arg))->UserData);
+
+  int n = str->NumberOfFrames;
+  int i0 = (int)(((double)n*threadId)/threadCount);
+  int i1 = (int)(((double)n*(threadId + 1))/threadCount);
+  vtkImageData *frame = str->Frames[threadId];
+  double *rowSums =
+    new double[str->ClipExtent[3] - str->ClipExtent[2] + 1];
+
+  for (int i = i0; i < i1; i++)
+    {
+    str->Valid[i] = 0;
+    if (!str->SweepFile->ReadFrame(i, frame))
+      {
+      continue;
+      }
+    switch (frame->GetScalarType())
+      {
+      case VTK_UNSIGNED_CHAR:
+        str->Valid[i] = vtkTemporalCalibrationFrameSignal(
+          frame, str->ClipExtent, rowSums, &str->Values[i],
+          (unsigned char *)0);
+        break;
+      case VTK_SHORT:
+        str->Valid[i] = vtkTemporalCalibrationFrameSignal(
+          frame, str->ClipExtent, rowSums, &str->Values[i], (short *)0);
+        break;
+      case VTK_UNSIGNED_SHORT:
+        str->Valid[i] = vtkTemporalCalibrationFrameSignal(
+          frame, str->ClipExtent, rowSums, &str->Values[i],
+          (unsigned short *)0);
+        break;
+      case VTK_FLOAT:
+        str->Valid[i] = vtkTemporalCalibrationFrameSignal(
+          frame, str->ClipExtent, rowSums, &str->Values[i], (float *)0);
+        break;
+      }
+    }
+
+  delete [] rowSums;
+
+  return VTK_THREAD_RETURN_VALUE;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundTemporalCalibrator::ComputeVideoSignal()
+{
+  vtkUltrasoundSweepFile *sweep = this->SweepFile;
+  int scalarType = sweep->GetFrameScalarType();
+  if (scalarType != VTK_UNSIGNED_CHAR && scalarType != VTK_SHORT &&
+      scalarType != VTK_UNSIGNED_SHORT && scalarType != VTK_FLOAT)
+    {
+    vtkErrorMacro(<< "Calibrate: frames must be unsigned char, short, "
+                  "unsigned short or float");
+    return 0;
+    }
+
+  // clip the region to the frames
+  vtkTemporalCalibrationStruct str;
+  int *frameExt = sweep->GetFrameExtent();
+  int i;
+  for (i = 0; i < 2; i++)
+    {
+    str.ClipExtent[2*i] = this->ClipExtent[2*i];
+    if (str.ClipExtent[2*i] < frameExt[2*i])
+      {
+      str.ClipExtent[2*i] = frameExt[2*i];
+      }
+    str.ClipExtent[2*i+1] = this->ClipExtent[2*i+1];
+    if (str.ClipExtent[2*i+1] > frameExt[2*i+1])
+      {
+      str.ClipExtent[2*i+1] = frameExt[2*i+1];
+      }
+    }
+  if (str.ClipExtent[0] > str.ClipExtent[1] ||
+      str.ClipExtent[2] + 2 > str.ClipExtent[3])
+    {
+    vtkErrorMacro(<< "Calibrate: the ClipExtent is outside of the frames");
+    return 0;
+    }
+
+  int n = sweep->GetNumberOfFrames();
+  int numThreads = this->NumberOfThreads;
+  str.SweepFile = sweep;
+  str.NumberOfFrames = n;
+  str.Values = new double[n];
+  str.Valid = new int[n];
+  for (i = 0; i < numThreads; i++)
+    {
+    str.Frames[i] = vtkImageData::New();
+    }
+
+  this->Threader->SetNumberOfThreads(numThreads);
+  this->Threader->SetSingleMethod(vtkTemporalCalibrationThread, &str);
+  this->Threader->SingleMethodExecute();
+
+  this->VideoSignal->Reset();
+  for (i = 0; i < n; i++)
+    {
+    if (str.Valid[i])
+      {
+      this->VideoSignal->InsertNextValue(sweep->GetFrameTimeStamp(i));
+      this->VideoSignal->InsertNextValue(str.Values[i]);
+      }
+    }
+
+  for (i = 0; i < numThreads; i++)
+    {
+    str.Frames[i]->Delete();
+    }
+  delete [] str.Values;
+  delete [] str.Valid;
+
+  if (this->VideoSignal->GetNumberOfTuples() < 2)
+    {
+    vtkErrorMacro(<< "Calibrate: the reflector was not found in the frames");
+    return 0;
+    }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundTemporalCalibrator::ComputeTrackerSignal()
+{
+  vtkTrackerBuffer *buffer = this->TrackerBuffer;
+  if (buffer == NULL)
+    {
+    buffer = vtkTrackerBuffer::New();
+    if (!this->SweepFile->ReadTrackerBuffer(buffer))
+      {
+      vtkErrorMacro(<< "Calibrate: the sweep has no tracking information");
+      buffer->Delete();
+      return 0;
+      }
+    }
+  else
+    {
+    buffer->Register(this);
+    }
+
+  // collect the positions, oldest first
+  vtkMatrix4x4 *matrix = vtkMatrix4x4::New();
+  vtkDoubleArray *positions = vtkDoubleArray::New();
+  positions->SetNumberOfComponents(4);
+  buffer->Lock();
+  int i;
+  for (i = buffer->GetNumberOfItems() - 1; i >= 0; i--)
+    {
+    if (buffer->IsMissing(i) || buffer->IsOutOfView(i))
+      {
+      continue;
+      }
+    buffer->GetMatrix(matrix, i);
+    positions->InsertNextValue(buffer->GetTimeStamp(i));
+    positions->InsertNextValue(matrix->GetElement(0, 3));
+    positions->InsertNextValue(matrix->GetElement(1, 3));
+    positions->InsertNextValue(matrix->GetElement(2, 3));
+    }
+  buffer->Unlock();
+  buffer->UnRegister(this);
+  matrix->Delete();
+
+  int n = positions->GetNumberOfTuples();
+  if (n < 2)
+    {
+    vtkErrorMacro(<< "Calibrate: the sweep has no valid tracking records");
+    positions->Delete();
+    return 0;
+    }
+
+  // the mean and the covariance of the positions
+  double *pos = positions->GetPointer(0);
+  double mean[3] = { 0.0, 0.0, 0.0 };
+  double cov[3][3];
+  int j, k;
+  for (i = 0; i < n; i++)
+    {
+    for (j = 0; j < 3; j++)
+      {
+      mean[j] += pos[4*i + 1 + j];
+      }
+    }
+  for (j = 0; j < 3; j++)
+    {
+    mean[j] /= n;
+    for (k = 0; k < 3; k++)
+      {
+      cov[j][k] = 0.0;
+      }
+    }
+  for (i = 0; i < n; i++)
+    {
+    for (j = 0; j < 3; j++)
+      {
+      for (k = 0; k < 3; k++)
+        {
+        cov[j][k] += (pos[4*i + 1 + j] - mean[j])*(pos[4*i + 1 + k] - mean[k]);
+        }
+      }
+    }
+
+  // the principal direction of motion, by power iteration starting
+  // from the axis with the largest variance
+  double axis[3] = { 0.0, 0.0, 0.0 };
+  k = 0;
+  for (j = 1; j < 3; j++)
+    {
+    if (cov[j][j] > cov[k][k])
+      {
+      k = j;
+      }
+    }
+  axis[k] = 1.0;
+  for (i = 0; i < 50; i++)
+    {
+    double v[3];
+    for (j = 0; j < 3; j++)
+      {
+      v[j] = cov[j][0]*axis[0] + cov[j][1]*axis[1] + cov[j][2]*axis[2];
+      }
+    double norm = sqrt(v[0]*v[0] + v[1]*v[1] + v[2]*v[2]);
+    if (norm == 0)
+      {
+      break;
+      }
+    for (j = 0; j < 3; j++)
+      {
+      axis[j] = v[j]/norm;
+      }
+    }
+
+  this->TrackerSignal->Reset();
+  for (i = 0; i < n; i++)
+    {
+    double value = 0.0;
+    for (j = 0; j < 3; j++)
+      {
+      value += (pos[4*i + 1 + j] - mean[j])*axis[j];
+      }
+    this->TrackerSignal->InsertNextValue(pos[4*i]);
+    this->TrackerSignal->InsertNextValue(value);
+    }
+  positions->Delete();
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// Resample a signal of (time, value) pairs onto a uniform grid by linear
+// interpolation, then normalize it to zero mean and unit variance.
+// The signal times must be increasing.  Returns zero if the resampled
+// signal is constant.
+static int vtkTemporalCalibrationResample(const double *signal, int m,
+                                          double t0, double dt, int n,
+                                          double *output)
+{
+  int j = 0;
+  double sum = 0.0;
+  int i;
+  for (i = 0; i < n; i++)
+    {
+    double t = t0 + i*dt;
+    while (j < m - 2 && signal[2*(j + 1)] <= t)
+      {
+      j++;
+      }
+    double ta = signal[2*j];
+    double tb = signal[2*(j + 1)];
+    double f = (tb > ta ? (t - ta)/(tb - ta) : 0.0);
+    f = (f < 0.0 ? 0.0 : (f > 1.0 ? 1.0 : f));
+    output[i] = (1.0 - f)*signal[2*j + 1] + f*signal[2*j + 3];
+    sum += output[i];
+    }
+
+  double mean = sum/n;
+  double sumSq = 0.0;
+  for (i = 0; i < n; i++)
+    {
+    output[i] -= mean;
+    sumSq += output[i]*output[i];
+    }
+  if (sumSq <= 0)
+    {
+    return 0;
+    }
+
+  double scale = 1.0/sqrt(sumSq/n);
+  for (i = 0; i < n; i++)
+    {
+    output[i] *= scale;
+    }
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+// In-place radix-2 complex FFT, n must be a power of two.  The inverse
+// transform is not scaled.
+static void vtkTemporalCalibrationFFT(double *re, double *im, int n,
+                                      int inverse)
+{
+  int i, j, k;
+
+  // bit-reversal permutation
+  j = 0;
+  for (i = 0; i < n - 1; i++)
+    {
+    if (i < j)
+      {
+      double tmp = re[i]; re[i] = re[j]; re[j] = tmp;
+      tmp = im[i]; im[i] = im[j]; im[j] = tmp;
+      }
+    k = n >> 1;
+    while (k <= j)
+      {
+      j -= k;
+      k >>= 1;
+      }
+    j += k;
+    }
+
+  // butterflies
+  for (int step = 1; step < n; step <<= 1)
+    {
+    double theta = (inverse ? vtkMath::Pi() : -vtkMath::Pi())/step;
+    double wpr = cos(theta);
+    double wpi = sin(theta);
+    double wr = 1.0;
+    double wi = 0.0;
+    for (int m = 0; m < step; m++)
+      {
+      for (i = m; i < n; i += 2*step)
+        {
+        j = i + step;
+        double tr = wr*re[j] - wi*im[j];
+        double ti = wr*im[j] + wi*re[j];
+        re[j] = re[i] - tr;
+        im[j] = im[i] - ti;
+        re[i] += tr;
+        im[i] += ti;
+        }
+      double tmp = wr;
+      wr = tmp*wpr - wi*wpi;
+      wi = tmp*wpi + wi*wpr;
+      }
+    }
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundTemporalCalibrator::CorrelateSignals()
+{
+  const double *video = this->VideoSignal->GetPointer(0);
+  const double *track = this->TrackerSignal->GetPointer(0);
+  int mv = this->VideoSignal->GetNumberOfTuples();
+  int mt = this->TrackerSignal->GetNumberOfTuples();
+  double dt = this->SampleInterval;
+
+  // the time range that is covered by both signals
+  double t0 = (video[0] > track[0] ? video[0] : track[0]);
+  double t1 = video[2*(mv - 1)];
+  if (track[2*(mt - 1)] < t1)
+    {
+    t1 = track[2*(mt - 1)];
+    }
+  if (t1 - t0 <= 2*this->MaximumLag)
+    {
+    vtkErrorMacro(<< "Calibrate: the video and tracking overlap for only "
+                  << (t1 > t0 ? t1 - t0 : 0.0) << " seconds");
+    return 0;
+    }
+
+  // the video signal is only used away from the ends of the range, so
+  // that it overlaps the tracker signal completely at every lag
+  int n = (int)((t1 - t0)/dt) + 1;
+  int maxK = (int)(this->MaximumLag/dt);
+  if (maxK > (n - 1)/4)
+    {
+    maxK = (n - 1)/4;
+    }
+  int nv = n - 2*maxK;
+
+  int nfft = 1;
+  while (nfft < 2*n)
+    {
+    nfft <<= 1;
+    }
+
+  // pack the video signal into the real part and the tracker signal
+  // into the imaginary part, so that one transform does both
+  double *re = new double[nfft];
+  double *im = new double[nfft];
+  double *cre = new double[nfft];
+  double *cim = new double[nfft];
+  int i;
+  for (i = 0; i < nfft; i++)
+    {
+    re[i] = 0.0;
+    im[i] = 0.0;
+    }
+  if (!vtkTemporalCalibrationResample(video, mv, t0 + maxK*dt, dt, nv,
+                                      re + maxK) ||
+      !vtkTemporalCalibrationResample(track, mt, t0, dt, n, im))
+    {
+    vtkErrorMacro(<< "Calibrate: no motion was found in the sweep");
+    delete [] re;
+    delete [] im;
+    delete [] cre;
+    delete [] cim;
+    return 0;
+    }
+
+  vtkTemporalCalibrationFFT(re, im, nfft, 0);
+
+  // separate the two spectra V and P, and form V*conj(P)
+  for (i = 0; i < nfft; i++)
+    {
+    int j = (nfft - i) & (nfft - 1);
+    double vr = 0.5*(re[i] + re[j]);
+    double vi = 0.5*(im[i] - im[j]);
+    double pr = 0.5*(im[i] + im[j]);
+    double pi = -0.5*(re[i] - re[j]);
+    cre[i] = vr*pr + vi*pi;
+    cim[i] = vi*pr - vr*pi;
+    }
+
+  // the inverse gives c[k] = sum v[t]*p[t-k], with negative k wrapped
+  vtkTemporalCalibrationFFT(cre, cim, nfft, 1);
+
+  // scale to get the correlation coefficient
+  double *corr = re + maxK;
+  for (int k = -maxK; k <= maxK; k++)
+    {
+    corr[k] = cre[k & (nfft - 1)]/(nfft*(double)nv);
+    }
+
+  int peak = -maxK;
+  for (int k = -maxK; k <= maxK; k++)
+    {
+    if (fabs(corr[k]) > fabs(corr[peak]))
+      {
+      peak = k;
+      }
+    }
+
+  // refine the peak with a parabola, unless it is at the maximum lag
+  double offset = 0.0;
+  if (peak > -maxK && peak < maxK)
+    {
+    double a = fabs(corr[peak - 1]);
+    double b = fabs(corr[peak]);
+    double c = fabs(corr[peak + 1]);
+    double d = a - 2*b + c;
+    if (d < 0)
+      {
+      offset = 0.5*(a - c)/d;
+      }
+    }
+
+  this->VideoLag = (peak + offset)*dt;
+  this->PeakCorrelation = corr[peak];
+
+  delete [] re;
+  delete [] im;
+  delete [] cre;
+  delete [] cim;
+
+  return 1;
+}
+
+//----------------------------------------------------------------------------
+int vtkUltrasoundTemporalCalibrator::Calibrate()
+{
+  this->VideoLag = 0.0;
+  this->PeakCorrelation = 0.0;
+
+  if (this->SweepFile == NULL ||
+      this->SweepFile->GetMode() != VTK_SWEEP_MODE_READ)
+    {
+    vtkErrorMacro(<< "Calibrate: the SweepFile is not open for reading");
+    return 0;
+    }
+
+  if (!this->ComputeVideoSignal() ||
+      !this->ComputeTrackerSignal() ||
+      !this->CorrelateSignals())
+    {
+    return 0;
+    }
+
+  this->Modified();
+  return 1;
+}
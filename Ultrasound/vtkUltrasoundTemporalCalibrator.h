@@ -0,0 +1,166 @@
+/*=========================================================================
+
+  Program:   Visualization Toolkit
+  Module:    $RCSfile: vtkUltrasoundTemporalCalibrator.h,v $
+  Language:  C++
+  Date:      $Date: $
+  Version:   $Revision: 1.1 $
+
+==========================================================================
+
+Copyright (c) 2000-2007 Atamai, Inc.
+
+Use, modification and redistribution of the software, in source or
+binary forms, are permitted provided that the following terms and
+conditions are met:
+
+1) Redistribution of the source code, in verbatim or modified
+   form, must retain the above copyright notice, this license,
+   the following disclaimer, and any notices that refer to this
+   license and/or the following disclaimer.
+
+2) Redistribution in binary form must include the above copyright
+   notice, a copy of this license and the following disclaimer
+   in the documentation or with other materials provided with the
+   distribution.
+
+3) Modified copies of the source code must be clearly marked as such,
+   and must not be misrepresented as verbatim copies of the source code.
+
+THE COPYRIGHT HOLDERS AND/OR OTHER PARTIES PROVIDE THE SOFTWARE "AS IS"
+WITHOUT EXPRESSED OR IMPLIED WARRANTY INCLUDING, BUT NOT LIMITED TO,
+THE IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR
+PURPOSE.  IN NO EVENT SHALL ANY COPYRIGHT HOLDER OR OTHER PARTY WHO MAY
+MODIFY AND/OR REDISTRIBUTE THE SOFTWARE UNDER THE TERMS OF THIS LICENSE
+BE LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL OR CONSEQUENTIAL DAMAGES
+(INCLUDING, BUT NOT LIMITED TO, LOSS OF DATA OR DATA BECOMING INACCURATE
+OR LOSS OF PROFIT OR BUSINESS INTERRUPTION) ARISING IN ANY WAY OUT OF
+THE USE OR INABILITY TO USE THE SOFTWARE, EVEN IF ADVISED OF THE
+POSSIBILITY OF SUCH DAMAGES.
+
+=========================================================================*/
+// .NAME vtkUltrasoundTemporalCalibrator - measure the video lag of a sweep
+// .SECTION Description
+// vtkUltrasoundTemporalCalibrator measures the lag between the video
+// timestamps and the tracker timestamps of a recorded sweep, i.e. the
+// value that should be given to vtkFreehandUltrasound2::SetVideoLag().
+// The sweep must be a periodic motion of the probe against a flat
+// reflector, e.g. the probe bobbing up and down over the bottom of a
+// water bath, so that the reflector appears as a bright horizontal line
+// whose depth changes with the probe motion.
+//
+// A motion signal is extracted from each video frame (the sub-pixel row
+// of the brightest line within the ClipExtent), and a position signal is
+// extracted from the tracker buffer (the tool position projected onto
+// its principal direction of motion).  Both signals are resampled onto a
+// common time grid, and the lag is found at the peak of their cross
+// correlation, which is computed with an FFT and refined to sub-sample
+// precision by a parabolic fit.  The frames are decoded and analyzed by
+// all of the threads in parallel.
+// .SECTION see also
+// vtkUltrasoundSweepFile vtkTrackerBuffer vtkFreehandUltrasound2
+
+#ifndef __vtkUltrasoundTemporalCalibrator_h
+#define __vtkUltrasoundTemporalCalibrator_h
+
+#include "vtkObject.h"
+#include "vtkMultiThreader.h"
+
+class vtkDoubleArray;
+class vtkTrackerBuffer;
+class vtkUltrasoundSweepFile;
+
+class VTK_EXPORT vtkUltrasoundTemporalCalibrator : public vtkObject
+{
+public:
+  static vtkUltrasoundTemporalCalibrator *New();
+  vtkTypeRevisionMacro(vtkUltrasoundTemporalCalibrator, vtkObject);
+  void PrintSelf(ostream& os, vtkIndent indent);
+
+  // Description:
+  // The recorded sweep.  The file must already be open for reading.
+  virtual void SetSweepFile(vtkUltrasoundSweepFile *);
+  vtkGetObjectMacro(SweepFile, vtkUltrasoundSweepFile);
+
+  // Description:
+  // The tracking information for the sweep.  If this is not set, then
+  // the tracking information that is stored in the sweep file is used.
+  virtual void SetTrackerBuffer(vtkTrackerBuffer *);
+  vtkGetObjectMacro(TrackerBuffer, vtkTrackerBuffer);
+
+  // Description:
+  // The region of the frames (x0,x1,y0,y1, in pixels) that contains the
+  // reflector.  It is clipped to the frame extent.  Default: the whole
+  // frame.
+  vtkSetVector4Macro(ClipExtent, int);
+  vtkGetVector4Macro(ClipExtent, int);
+
+  // Description:
+  // The interval, in seconds, of the time grid onto which the signals
+  // are resampled before they are correlated.  Default: 0.001.
+  vtkSetClampMacro(SampleInterval, double, 1e-5, 1.0);
+  vtkGetMacro(SampleInterval, double);
+
+  // Description:
+  // The largest lag, in seconds, that will be considered.  This should
+  // be less than half of the period of the motion.  Default: 0.5.
+  vtkSetClampMacro(MaximumLag, double, 0.0, VTK_DOUBLE_MAX);
+  vtkGetMacro(MaximumLag, double);
+
+  // Description:
+  // The number of threads that analyze the frames.  The default is
+  // the number of processors.
+  vtkSetClampMacro(NumberOfThreads, int, 1, VTK_MAX_THREADS);
+  vtkGetMacro(NumberOfThreads, int);
+
+  // Description:
+  // Measure the lag.  Returns zero if the lag could not be measured.
+  int Calibrate();
+
+  // Description:
+  // The results of Calibrate().  The VideoLag is the amount by which
+  // the video timestamps are later than the tracker timestamps.  The
+  // PeakCorrelation is the correlation coefficient of the two signals
+  // at that lag, and is negative if the image moves opposite to the
+  // tracked motion.  Its magnitude should be close to one for a good
+  // calibration.
+  vtkGetMacro(VideoLag, double);
+  vtkGetMacro(PeakCorrelation, double);
+
+  // Description:
+  // The signals that were extracted by Calibrate(), as (time, value)
+  // pairs: one tuple per frame for the video, and one tuple per valid
+  // tracker record for the tracker.  These are useful for checking the
+  // quality of the sweep.
+  vtkGetObjectMacro(VideoSignal, vtkDoubleArray);
+  vtkGetObjectMacro(TrackerSignal, vtkDoubleArray);
+
+protected:
+  vtkUltrasoundTemporalCalibrator();
+  ~vtkUltrasoundTemporalCalibrator();
+
+  int ComputeVideoSignal();
+  int ComputeTrackerSignal();
+  int CorrelateSignals();
+
+  vtkUltrasoundSweepFile *SweepFile;
+  vtkTrackerBuffer *TrackerBuffer;
+  vtkMultiThreader *Threader;
+  int NumberOfThreads;
+
+  int ClipExtent[4];
+  double SampleInterval;
+  double MaximumLag;
+
+  double VideoLag;
+  double PeakCorrelation;
+
+  vtkDoubleArray *VideoSignal;
+  vtkDoubleArray *TrackerSignal;
+
+private:
+  vtkUltrasoundTemporalCalibrator(const vtkUltrasoundTemporalCalibrator&);
+  void operator=(const vtkUltrasoundTemporalCalibrator&);
+};
+
+#endif
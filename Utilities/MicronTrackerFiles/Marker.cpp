@@ -10,6 +10,7 @@
 *
 ***************************************************************/
 #include "Marker.h"
+#include "TemplateIndex.h"
 
 #include <string>
 
@@ -136,13 +137,24 @@ bool Marker::validateTemplate(double positionToleranceMM, string complString)
 			return false;
 	}
 
+	// The facets that differ in vector lengths or angle by more than twice
+	// the tolerance can't be confused, so only the others are identified
+	int facetCount = facetsColl->count();
+	vector<FacetSignature> sigs(facetCount+1);
+	vector<bool> haveSig(facetCount+1);
+	for (int fk=1; fk <= facetCount; fk++)
+		haveSig[fk] = TemplateIndex::getFacetSignature(facetsColl->itemI(fk), &sigs[fk]);
+
 	vector<Vector*> vs;
-	for (int fi=1; fi < facetsColl->count()-1; fi++)
+	for (int fi=1; fi < facetCount; fi++)
 	{
-		Facet* Fti = new Facet(fi);
-		for(int fj= fi+1; fj < facetsColl->count(); fj++)
+		Facet* Fti = new Facet(facetsColl->itemI(fi));
+		for(int fj= fi+1; fj <= facetCount; fj++)
 		{
-			Facet* Ftj = new Facet(fj);
+			if (haveSig[fi] && haveSig[fj] &&
+				!TemplateIndex::signaturesMatch(sigs[fi], sigs[fj], 2*positionToleranceMM))
+				continue;
+			Facet* Ftj = new Facet(facetsColl->itemI(fj));
 			vs = Ftj->TemplateVectors();
 			if (Fti->identify(NULL, vs, 2*positionToleranceMM))
 				return false; //mtDifferentFacetsGeometryTooSimilar
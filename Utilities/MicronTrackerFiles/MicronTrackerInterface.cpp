@@ -24,6 +24,7 @@ int MicronTrackerInterface::mtInit()
   this->initialINIAccess();
   //m_pCurrTempMarker =  new Marker();
   this->m_pTempMarkerForAddingFacet = NULL; //new Marker();
+  this->m_pTemplateIndex = new TemplateIndex();
   
   return 1;
 }
@@ -32,6 +33,8 @@ int MicronTrackerInterface::mtInit()
 void MicronTrackerInterface::mtEnd()
 {
   this->mtDetachCameras();	
+  delete this->m_pTemplateIndex;
+  this->m_pTemplateIndex = NULL;
 }
 
 //------------------------------------------
@@ -193,6 +196,9 @@ int MicronTrackerInterface::mtRefreshTemplates(vector<string> &tmplsName,
     {
       st = Markers_LoadTemplates(currentFolderPath);
     }
+  // index the new templates so that they don't have to be searched
+  // for every frame
+  this->m_pTemplateIndex->build();
   return (int)st;
 }
 //------------------------------------------
@@ -427,21 +433,16 @@ void MicronTrackerInterface::mtFindIdentifiedMarkers()
 {
   Collection* markersCollection = new Collection(this->m_pMarkers->identifiedMarkers(this->m_pCurrCam));
   this->m_numOfIdentifiedMarkers = markersCollection->count();
+  this->m_vTemplateToIdentified.assign(this->m_pTemplateIndex->getTemplateCount(), -1);
   if (this->m_numOfIdentifiedMarkers == 0)
     {
       this->m_markerStatus = MTI_NO_MARKER_CAPTURED;
       delete markersCollection; 
       return;
     }
-  this->m_2dvRotations.clear();
-  this->m_2dvTranslations.clear();
-  this->m_vIdentifiedMarkersXPoints.clear();
-  for (int i=0;i<this->m_vIdentifiedMarkersName.size();i++)
-    {
-      this->m_vIdentifiedMarkersName[i].erase();
-    }
-  
-  this->m_vIdentifiedMarkersName.resize(0);
+  // The per-marker results are kept from one frame to the next and are
+  // overwritten in place, so that once the vectors have grown to the
+  // number of markers in view no memory is allocated per frame.
   this->m_vIdentifiedMarkersName.clear();
   this->m_vNumOfFacetsInEachMarker.clear();
   this->m_vNumOfTotalFacetsInEachMarker.clear();
@@ -449,6 +450,7 @@ void MicronTrackerInterface::mtFindIdentifiedMarkers()
   this->m_markerStatus = MTI_MARKER_CAPTURED;
   int markerNum = 1;
   int facetNum = 1;
+  int identifiedNum = 0;
   
   for (markerNum = 1; markerNum <= markersCollection->count(); markerNum++)
     {
@@ -457,6 +459,14 @@ void MicronTrackerInterface::mtFindIdentifiedMarkers()
       //Collection* totalFacetsCollection = new Collection(marker->getTemplateFacets());
       Collection* totalFacetsCollection = new Collection(marker->getTemplateFacets());
       this->m_vIdentifiedMarkersName.push_back(marker->getName());
+
+      // remember which loaded template this marker is
+      int templateIndex = this->m_pTemplateIndex->findTemplate(this->m_vIdentifiedMarkersName.back().c_str());
+      if (templateIndex >= 0 && templateIndex < this->m_vTemplateToIdentified.size() &&
+	  this->m_vTemplateToIdentified[templateIndex] == -1)
+	{
+	  this->m_vTemplateToIdentified[templateIndex] = markerNum - 1;
+	}
       
       if (marker->wasIdentified(this->m_pCurrCam) != 0)
 	{
@@ -509,7 +519,13 @@ void MicronTrackerInterface::mtFindIdentifiedMarkers()
 	      delete f;
 	      
 	    } // End of the for loop for the facets.
-	  this->m_vIdentifiedMarkersXPoints.push_back( vXPointsTemp );
+	  if (identifiedNum >= this->m_vIdentifiedMarkersXPoints.size())
+	    {
+	      this->m_vIdentifiedMarkersXPoints.resize(identifiedNum+1);
+	      this->m_2dvTranslations.resize(identifiedNum+1);
+	      this->m_2dvRotations.resize(identifiedNum+1);
+	    }
+	  this->m_vIdentifiedMarkersXPoints[identifiedNum] = vXPointsTemp;
 	  this->m_vNumOfFacetsInEachMarker.push_back(facetsCollection->count());
 	  this->m_vNumOfTotalFacetsInEachMarker.push_back(totalFacetsCollection->count());
 	  delete facetsCollection;
@@ -525,20 +541,20 @@ void MicronTrackerInterface::mtFindIdentifiedMarkers()
 	  Xform3D* Marker2CurrCameraXf = marker->marker2CameraXf(this->m_pCurrCam->getHandle());
 	  // Find the translations and push them in a 2 temporary vector and then push that temp vector into a 
 	  // 2 dimensional vector.
-	  vector<double> vTransTemp;
-	  vTransTemp.clear();
+	  vector<double> &vTransTemp = this->m_2dvTranslations[identifiedNum];
+	  vTransTemp.resize(4);
 	  for (int i = 0 ; i < 3; i++)
 	    {
-	      vTransTemp.push_back(Marker2CurrCameraXf->getShift(i));
+	      vTransTemp[i] = Marker2CurrCameraXf->getShift(i);
 	    }
-	  vTransTemp.push_back(1);
-	  this->m_2dvTranslations.push_back(vTransTemp);
+	  vTransTemp[3] = 1;
 	  // Find the rotations and push them in a 2 temporary vector and then push that temp vector into a 
 	  // 2 dimensional vector.
 	  
 	  double vR[3][3];
 	  
-	  vector<double> vRotTemp;
+	  vector<double> &vRotTemp = this->m_2dvRotations[identifiedNum];
+	  vRotTemp.resize(9);
 	  // problem lies here !
 	  Xform3D_RotMatGet(Marker2CurrCameraXf->getHandle(), reinterpret_cast<double *>(vR[0]));
 	 //Marker2CurrCameraXf->getRotationMatrix(reinterpret_cast<double *>(vR[0]));
@@ -546,12 +562,12 @@ void MicronTrackerInterface::mtFindIdentifiedMarkers()
 	    {
 		for (int k = 0; k < 3; k++)
 		  { 
-		  vRotTemp.push_back( vR[j][k] );
+		  vRotTemp[3*j + k] = vR[j][k];
 	  	  }
 	    }
 	  
-	  this->m_2dvRotations.push_back(vRotTemp);/**/
 	  delete Marker2CurrCameraXf;
+	  identifiedNum++;
 	  
 	  
 	} // End of if (m_pCurrTempMarker->wasIdentified...)
@@ -589,7 +605,10 @@ void MicronTrackerInterface::mtFindUnidentifiedMarkers()
       delete unidentifiedVectorsColl;
       return;
     }
-  this->m_vUnidentifiedMarkersEndPoints.clear();
+  if (this->m_vUnidentifiedMarkersEndPoints.size() < m_numOfUnidentifiedMarkers)
+    {
+      this->m_vUnidentifiedMarkersEndPoints.resize(m_numOfUnidentifiedMarkers);
+    }
   for (int i=1; i<= m_numOfUnidentifiedMarkers; i++)
     {
       this->vUnidentifiedEndPointsTemp.clear();
@@ -607,10 +626,9 @@ void MicronTrackerInterface::mtFindUnidentifiedMarkers()
       this->vUnidentifiedEndPointsTemp.push_back(LR_BH_XY[1][1][1]);
 
       // Right
-      this->m_vUnidentifiedMarkersEndPoints.push_back(this->vUnidentifiedEndPointsTemp);
+      this->m_vUnidentifiedMarkersEndPoints[i-1] = this->vUnidentifiedEndPointsTemp;
       delete v;
     }
-  return ;
   delete unidentifiedVectorsColl;
 }
 
@@ -637,20 +655,19 @@ int MicronTrackerInterface::mtGetMarkerStatus(int loadedMarkerIndex, int* identi
 {
   // Safety check. If the request marke index is greater than the identified markers,
   // return NO_MARKER_CAPTURED
-  if (loadedMarkerIndex > this->mtGetLoadedTemplatesNum() || loadedMarkerIndex < 0)
+  if (loadedMarkerIndex >= this->m_vTemplateToIdentified.size() || loadedMarkerIndex < 0)
     {
       return MTI_NO_MARKER_CAPTURED;
     }
-  char* markerName = this->mtGetTemplateName(loadedMarkerIndex);
-  for (int i=0; i< this->m_numOfIdentifiedMarkers; i++)
+  // the identified markers were matched to the templates by name
+  // in mtFindIdentifiedMarkers()
+  int i = this->m_vTemplateToIdentified[loadedMarkerIndex];
+  if (i < 0)
     {
-      if (markerName == this->m_vIdentifiedMarkersName[i])
-	{
-	  *identifiedMarkerIndex = i;
-	  return MTI_MARKER_CAPTURED;
-	}
+      return MTI_NO_MARKER_CAPTURED;
     }
-  return MTI_NO_MARKER_CAPTURED;
+  *identifiedMarkerIndex = i;
+  return MTI_MARKER_CAPTURED;
 }
 
 //------------------------------------------
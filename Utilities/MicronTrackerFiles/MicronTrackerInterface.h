@@ -27,6 +27,7 @@
 #include "Collection.h"
 #include "MTVideo.h"
 #include "MTC.h"
+#include "TemplateIndex.h"
 
 using std::vector;
 using std::string;
@@ -629,6 +630,15 @@ private:
 	//Marker* m_pCurrTempMarker;
 	Marker *m_pTempMarkerForAddingFacet;
 
+	// The loaded templates, indexed by name and by facet geometry
+
+	TemplateIndex* m_pTemplateIndex;
+
+	// For each loaded template, the index of its identified marker in the
+	// current frame, or -1 if it wasn't identified.
+
+	vector<int> m_vTemplateToIdentified;
+
 	int m_markerStatus;
 	int m_numOfIdentifiedMarkers;
 	int m_numOfUnidentifiedMarkers;
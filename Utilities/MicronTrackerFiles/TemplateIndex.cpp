@@ -0,0 +1,121 @@
+/**************************************************************
+*
+*     Micron Tracker: Index of the loaded marker templates
+*
+***************************************************************/
+#include "TemplateIndex.h"
+#include <algorithm>
+#include <math.h>
+
+/****************************/
+/** Constructor */
+TemplateIndex::TemplateIndex()
+{
+	this->m_templateCount = 0;
+}
+
+/****************************/
+/** Destructor */
+TemplateIndex::~TemplateIndex()
+{
+}
+
+/****************************/
+/** */
+void TemplateIndex::clear()
+{
+	this->m_names.clear();
+	this->m_nameIndices.clear();
+	this->m_templateCount = 0;
+}
+
+/****************************/
+/** */
+void TemplateIndex::build()
+{
+	char name[400];
+	int size;
+	int i;
+
+	this->clear();
+	this->m_templateCount = Markers_TemplatesCount();
+
+	vector< std::pair<string,int> > names;
+	// The template indices start at 0, as in mtDeleteTemplate()
+	for (i=0; i<this->m_templateCount; i++)
+	{
+		mtHandle markerHandle = 0;
+		if (Markers_TemplateItemGet(i, &markerHandle) != mtOK || markerHandle == 0)
+			continue;
+
+		size = 0;
+		if (Marker_NameGet(markerHandle, name, sizeof(name), &size) == mtOK)
+		{
+			if (size < 0 || size >= (int)sizeof(name))
+				size = sizeof(name) - 1;
+			name[size] = '\0';
+			names.push_back(std::pair<string,int>(name, i));
+		}
+	}
+
+	std::sort(names.begin(), names.end());
+	for (i=0; i<names.size(); i++)
+	{
+		this->m_names.push_back(names[i].first);
+		this->m_nameIndices.push_back(names[i].second);
+	}
+}
+
+/****************************/
+/** */
+int TemplateIndex::findTemplate(const char *name)
+{
+	vector<string>::iterator it = std::lower_bound(this->m_names.begin(), this->m_names.end(), string(name));
+	if (it == this->m_names.end() || *it != name)
+		return -1;
+	return this->m_nameIndices[it - this->m_names.begin()];
+}
+
+/****************************/
+/** */
+bool TemplateIndex::getFacetSignature(int facetHandle, FacetSignature *sig)
+{
+	double longUnitV[3], shortUnitV[3];
+	bool result = false;
+
+	int longVector = Vector_New();
+	int shortVector = Vector_New();
+	if (Facet_TemplateVectorsGet(facetHandle, longVector, shortVector) == mtOK &&
+		Vector_LengthGet(longVector, &sig->longLength) == mtOK &&
+		Vector_LengthGet(shortVector, &sig->shortLength) == mtOK &&
+		Vector_UnitVGet(longVector, longUnitV) == mtOK &&
+		Vector_UnitVGet(shortVector, shortUnitV) == mtOK)
+	{
+		double c = longUnitV[0]*shortUnitV[0] + longUnitV[1]*shortUnitV[1] + longUnitV[2]*shortUnitV[2];
+		c = (c > 1.0 ? 1.0 : (c < -1.0 ? -1.0 : c));
+		sig->angle = acos(c);
+		sig->facetHandle = facetHandle;
+		result = true;
+	}
+	Vector_Free(longVector);
+	Vector_Free(shortVector);
+
+	return result;
+}
+
+/****************************/
+/** */
+bool TemplateIndex::signaturesMatch(const FacetSignature &a, const FacetSignature &b, double toleranceMM)
+{
+	if (fabs(a.longLength - b.longLength) > toleranceMM ||
+		fabs(a.shortLength - b.shortLength) > toleranceMM)
+		return false;
+
+	// A change in angle moves the head of the short vector by about
+	// its length times the angle
+	double shortLength = (a.shortLength < b.shortLength ? a.shortLength : b.shortLength);
+	if (shortLength > 0 && fabs(a.angle - b.angle)*shortLength > toleranceMM)
+		return false;
+
+	return true;
+}
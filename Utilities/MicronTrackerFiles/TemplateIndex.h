@@ -0,0 +1,58 @@
+/**************************************************************
+*
+*     Micron Tracker: Index of the loaded marker templates
+*
+*     The template names are kept sorted, so that an identified
+*     marker is matched to its template without going through MTC.
+*     A facet can also be described by the lengths of its long and
+*     short vectors and the angle between them, which is used to
+*     tell quickly whether two facets could be confused.
+*
+***************************************************************/
+#ifndef __TEMPLATEINDEX_H__
+#define __TEMPLATEINDEX_H__
+
+#include "MTC.h"
+#include <vector>
+#include <string>
+
+using std::vector;
+using std::string;
+
+struct FacetSignature
+{
+	double longLength;	// mm
+	double shortLength;	// mm
+	double angle;		// radians, between the long and the short vector
+	int facetHandle;
+};
+
+class TemplateIndex
+{
+public:
+	TemplateIndex();
+	~TemplateIndex();
+
+	/** Rebuild the index from the templates that are loaded in MTC. */
+	void build();
+	void clear();
+
+	/** Returns the index of the loaded template with this name, or -1. */
+	int findTemplate(const char *name);
+
+	inline int getTemplateCount(){ return m_templateCount; };
+
+	/** Computes the signature of a template facet, returns false if the
+	template vectors can't be read. */
+	static bool getFacetSignature(int facetHandle, FacetSignature *sig);
+
+	/** Whether two facets could be confused within the tolerance. */
+	static bool signaturesMatch(const FacetSignature &a, const FacetSignature &b, double toleranceMM);
+
+private:
+	vector<string> m_names;					// sorted
+	vector<int> m_nameIndices;				// template index of each name
+	int m_templateCount;
+};
+
+#endif
@@ -82,6 +82,11 @@ POSSIBILITY OF SUCH DAMAGES.
 
 #include "ndicapi_serial.h"
 
+#ifdef NDI_USE_SERIALIO
+#include <pthread.h>
+#include "serialio.h"
+#endif
+
 /* USB versions of NDI tracking can communicate at baud rate 921600 but is not defined in WinBase.h */
 #if defined(WIN32) || defined(_WIN32)
   #ifndef  CBR_921600
@@ -97,7 +102,12 @@ POSSIBILITY OF SUCH DAMAGES.
 /*---------------------------------------------------------------------*/
 /* Some static variables to keep track of which ports are open, so that
    we can restore the comm parameters (baud rate etc) when they are closed.
-   Restoring the comm parameters is just part of being a good neighbor. */
+   Restoring the comm parameters is just part of being a good neighbor.
+   When NDI_USE_SERIALIO is defined, the ports are opened through the
+   shared serial I/O library (which restores the comm parameters itself
+   and reads all of the ports from one thread), and the file descriptor
+   is used to look up the port.  The ports can be opened and closed from
+   different threads, so the table is protected by a mutex. */
 
 #if defined(WIN32) || defined(_WIN32)
 
@@ -110,6 +120,30 @@ static HANDLE ndi_open_handles[4] = { INVALID_HANDLE_VALUE,
 static COMMTIMEOUTS ndi_save_timeouts[4];
 static DCB ndi_save_dcb[4];
 
+#elif defined(NDI_USE_SERIALIO)
+
+#define NDI_MAX_SIO_PORTS 8
+static sioport *ndi_sio_ports[NDI_MAX_SIO_PORTS] = { NULL, NULL, NULL, NULL,
+                                                     NULL, NULL, NULL, NULL };
+static pthread_mutex_t ndi_sio_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static sioport *ndi_sio_port(int serial_port)
+{
+  sioport *port = NULL;
+  int i;
+
+  pthread_mutex_lock(&ndi_sio_mutex);
+  for (i = 0; i < NDI_MAX_SIO_PORTS; i++) {
+    if (ndi_sio_ports[i] && sioGetHandle(ndi_sio_ports[i]) == serial_port) {
+      port = ndi_sio_ports[i];
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ndi_sio_mutex);
+
+  return port;
+}
+
 #elif defined(unix) || defined(__unix__) || defined(__APPLE__)
 
 #define NDI_MAX_SAVE_STATE 4
@@ -204,6 +238,38 @@ HANDLE ndiSerialOpen(const char *device)
   return serial_port;
 }
 
+#elif defined(NDI_USE_SERIALIO)
+
+int ndiSerialOpen(const char *device)
+{
+  sioport *port;
+  int i;
+
+  port = sioOpen(device);
+  if (port == NULL) {
+    return -1;
+  }
+
+  pthread_mutex_lock(&ndi_sio_mutex);
+  for (i = 0; i < NDI_MAX_SIO_PORTS; i++) {
+    if (ndi_sio_ports[i] == NULL) {
+      ndi_sio_ports[i] = port;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ndi_sio_mutex);
+  if (i == NDI_MAX_SIO_PORTS) {
+    sioClose(port);
+    return -1;
+  }
+
+  /* every reply ends with a carriage return */
+  sioSetFramer(port, &sioFrameCR, NULL);
+  sioSetTimeout(port, TIMEOUT_PERIOD);
+
+  return sioGetHandle(port);
+}
+
 #elif defined(unix) || defined(__unix__) || defined(__APPLE__)
 
 int ndiSerialOpen(const char *device)
@@ -330,6 +396,29 @@ void ndiSerialClose(HANDLE serial_port)
   CloseHandle(serial_port);
 }
 
+#elif defined(NDI_USE_SERIALIO)
+
+void ndiSerialClose(int serial_port)
+{
+  sioport *port = NULL;
+  int i;
+
+  pthread_mutex_lock(&ndi_sio_mutex);
+  for (i = 0; i < NDI_MAX_SIO_PORTS; i++) {
+    if (ndi_sio_ports[i] && sioGetHandle(ndi_sio_ports[i]) == serial_port) {
+      port = ndi_sio_ports[i];
+      ndi_sio_ports[i] = NULL;
+      break;
+    }
+  }
+  pthread_mutex_unlock(&ndi_sio_mutex);
+
+  /* close outside of the lock, this might wait for the reactor to stop */
+  if (port) {
+    sioClose(port);
+  }
+}
+
 #elif defined(unix) || defined(__unix__) || defined(__APPLE__)
 
 void ndiSerialClose(int serial_port)
@@ -425,6 +514,19 @@ int ndiSerialBreak(HANDLE serial_port)
   return 0;
 }
 
+#elif defined(NDI_USE_SERIALIO)
+
+int ndiSerialBreak(int serial_port)
+{
+  sioport *port = ndi_sio_port(serial_port);
+
+  if (port == NULL) {
+    return -1;
+  }
+
+  return sioBreak(port);
+}
+
 #elif defined(unix) || defined(__unix__) || defined(__APPLE__)
 
 int ndiSerialBreak(int serial_port)
@@ -474,6 +576,27 @@ int ndiSerialFlush(HANDLE serial_port, int buffers)
   return 0;
 }
 
+#elif defined(NDI_USE_SERIALIO)
+
+int ndiSerialFlush(int serial_port, int buffers)
+{
+  sioport *port = ndi_sio_port(serial_port);
+  int flushtype = SIO_IOFLUSH;
+
+  if (buffers == NDI_IFLUSH) {
+    flushtype = SIO_IFLUSH;
+  }
+  else if (buffers == NDI_OFLUSH) {
+    flushtype = SIO_OFLUSH;
+  }
+
+  if (port == NULL) {
+    return -1;
+  }
+
+  return sioFlush(port, flushtype);
+}
+
 #elif defined(unix) || defined(__unix__) || defined(__APPLE__)
 
 int ndiSerialFlush(int serial_port, int buffers)
@@ -575,6 +698,19 @@ int ndiSerialComm(HANDLE serial_port, int baud, const char *mode,
   return 0;
 }
 
+#elif defined(NDI_USE_SERIALIO)
+
+int ndiSerialComm(int serial_port, int baud, const char mode[4], int handshake)
+{
+  sioport *port = ndi_sio_port(serial_port);
+
+  if (port == NULL) {
+    return -1;
+  }
+
+  return sioComm(port, baud, mode, handshake);
+}
+
 #elif defined(unix) || defined(__unix__) || defined(__APPLE__)
 
 int ndiSerialComm(int serial_port, int baud, const char mode[4], int handshake)
@@ -795,6 +931,21 @@ int ndiSerialTimeout(HANDLE serial_port, int milliseconds)
   return 0;
 }
 
+#elif defined(NDI_USE_SERIALIO)
+
+int ndiSerialTimeout(int serial_port, int milliseconds)
+{
+  sioport *port = ndi_sio_port(serial_port);
+
+  if (port == NULL) {
+    return -1;
+  }
+
+  sioSetTimeout(port, milliseconds);
+
+  return 0;
+}
+
 #elif defined(unix) || defined(__unix__) || defined(__APPLE__)
 
 int ndiSerialTimeout(int serial_port, int milliseconds)
@@ -853,6 +1004,19 @@ int ndiSerialWrite(HANDLE serial_port, const char *text, int n)
   return i;  /* return the number of characters written */
 }
 
+#elif defined(NDI_USE_SERIALIO)
+
+int ndiSerialWrite(int serial_port, const char *text, int n)
+{
+  sioport *port = ndi_sio_port(serial_port);
+
+  if (port == NULL) {
+    return -1;
+  }
+
+  return sioWrite(port, text, n);
+}
+
 #elif defined(unix) || defined(__unix__) || defined(__APPLE__)
 
 int ndiSerialWrite(int serial_port, const char *text, int n)
@@ -920,6 +1084,20 @@ int ndiSerialRead(HANDLE serial_port, char *reply, int n)
   return i;
 }
 
+#elif defined(NDI_USE_SERIALIO)
+
+int ndiSerialRead(int serial_port, char *reply, int n)
+{
+  sioport *port = ndi_sio_port(serial_port);
+
+  if (port == NULL) {
+    return -1;
+  }
+
+  /* the reply has already been cut at the <CR> by the I/O thread */
+  return sioRead(port, reply, n);
+}
+
 #elif defined(unix) || defined(__unix__) || defined(__APPLE__)
 
 int ndiSerialRead(int serial_port, char *reply, int n)
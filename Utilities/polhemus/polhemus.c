@@ -1514,7 +1514,7 @@ int phUpdate(polhemus *ph)
   if (phGetStation(ph) != ph->station + 1) {
       fprintf(stderr, "station mismatch %i %i\n", ph->data_buffer[1] - '1', ph->station);
     if (phGetStation(ph)) {
-      ph->station = phGetStation(ph);
+      ph->station = phGetStation(ph) - 1;
     }
     set_error(ph,PH_PHASE_ERROR,"received malformed data record");
   }
@@ -2113,10 +2113,13 @@ void phSendCommand(polhemus *ph, const char *command)
     case 'u':  /* metric units (centimeters) */
       ph->centimeters = 1;
       break;
-    case 'l':  /* set active station state */
-      station = command[1] - '1';
-      state = command[3] - '0';
-      ph->station_active[station] = state;
+    case 'l':  /* set active station state, "l1" alone is a query */
+      if (command[2] == ',') {
+        station = command[1] - '1';
+        state = command[3] - '0';
+        ph->station_active[station] = state;
+      }
+      break;
     case 'e':  /* stylus button mode */
       station = command[1] - '1';
       state = command[3] - '0';
@@ -2383,7 +2386,9 @@ void phReceiveRaw(polhemus *ph, char *reply, int len, int thread)
 #elif defined(__unix__) || defined(unix) || defined(__APPLE__)
   /* fprintf(stderr,"reading i=%i, n=%i\n", i, n); */
   while (n > 0) {
-    m = read(ph->file,&reply[i],1);
+    /* binary records have a known length, so read them in one go; */
+    /* ascii replies are read one char at a time to catch the <LF> */
+    m = read(ph->file,&reply[i],(binary_record ? n : 1));
     /* fprintf(stderr,"m = %d, n = %d, i = %d, s=%.*s\n",m,n,i,i,reply); */
     if (m == -1 && errno != EAGAIN) {    /* if problem is not 'temporary,' */ 
       error = PH_IO_ERROR;
@@ -2754,7 +2759,7 @@ float phBinaryToFloat(char **cpp)
   } uvalue; 
 
   uvalue.ul = (*(*cpp)++ & 0xff);
-  uvalue.ul += (*(*cpp)++ & 0xff) << 4;
+  uvalue.ul += (*(*cpp)++ & 0xff) << 8;
   uvalue.ul += (*(*cpp)++ & 0xff) << 16;
   uvalue.ul += (*(*cpp)++ & 0xff) << 24;
 
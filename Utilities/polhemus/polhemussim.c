@@ -0,0 +1,417 @@
+/*=======================================================================
+
+  polhemussim.c - a FasTrak stand-in on a pseudo-terminal
+
+  This program creates a pseudo-terminal and answers the subset of the
+  FasTrak command set that is used by polhemus.c, so that the library
+  and vtkPolhemusTracker can be exercised without the device.  The
+  position/angle data is replayed from a recorded session such as
+  polhemusdata.txt, and is sent in ascii or binary according to the
+  'F' and 'f' commands.
+
+  Usage:  polhemussim [-s stations] [-r rate] [datafile]
+
+  The name of the pseudo-terminal is printed on startup, pass it to
+  phOpen() (or use a symbolic link to it) in place of a serial port.
+  Only UNIX is supported.
+
+=======================================================================*/
+
+#define _XOPEN_SOURCE 600
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <termios.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/select.h>
+
+#define MAX_RECORDS 4096
+
+/* the replayed data, x y z (inches) and azimuth elevation roll (degrees) */
+static float records[MAX_RECORDS][6];
+static int num_records = 0;
+
+/* the state of the simulated device */
+static int binary = 0;
+static int stream = 0;
+static int station_active[4] = { 1, 0, 0, 0 };
+static int format_len[4];
+static int format[4][64];
+
+/*-------------------------------------------------------------------
+  read the recorded session: every line that contains at least six
+  decimal numbers is taken to be a data record */
+
+static void read_data(const char *filename)
+{
+  FILE *fp;
+  char line[512];
+  char *cp, *endp;
+  float vals[6];
+  double d;
+  int n;
+
+  fp = fopen(filename, "rb");
+  if (fp == NULL) {
+    fprintf(stderr, "polhemussim: can't open %s\n", filename);
+    exit(1);
+  }
+
+  while (fgets(line, sizeof(line), fp) && num_records < MAX_RECORDS) {
+    n = 0;
+    cp = line;
+    while (*cp != '\0' && n < 6) {
+      if ((*cp >= '0' && *cp <= '9') || *cp == '-' || *cp == '+') {
+        d = strtod(cp, &endp);
+        if (endp > cp) {
+          /* integers are record headers or button states */
+          if (memchr(cp, '.', endp - cp)) {
+            vals[n++] = (float)d;
+          }
+          cp = endp;
+          continue;
+        }
+      }
+      cp++;
+    }
+    if (n == 6) {
+      memcpy(records[num_records++], vals, sizeof(vals));
+    }
+  }
+
+  fclose(fp);
+
+  if (num_records == 0) {
+    fprintf(stderr, "polhemussim: no data records in %s\n", filename);
+    exit(1);
+  }
+}
+
+/*-------------------------------------------------------------------
+  restore the power-on defaults */
+
+static void reset_device(void)
+{
+  int i;
+
+  binary = 0;
+  stream = 0;
+  for (i = 0; i < 4; i++) {
+    format_len[i] = 3;
+    format[i][0] = 2;
+    format[i][1] = 4;
+    format[i][2] = 1;
+  }
+}
+
+/*-------------------------------------------------------------------
+  append one value to a data record */
+
+static char *put_value(char *cp, float val, int extended)
+{
+  unsigned int ul;
+  union {
+    float fl;
+    unsigned int ul;
+  } uvalue;
+
+  if (extended) {
+    sprintf(cp, "%13.5E", val);
+    cp += 13;
+  }
+  else if (binary) {
+    uvalue.fl = val;
+    ul = uvalue.ul;
+    *cp++ = (char)(ul & 0xff);
+    *cp++ = (char)((ul >> 8) & 0xff);
+    *cp++ = (char)((ul >> 16) & 0xff);
+    *cp++ = (char)((ul >> 24) & 0xff);
+  }
+  else {
+    sprintf(cp, "%7.2f", val);
+    cp += 7;
+  }
+
+  return cp;
+}
+
+/*-------------------------------------------------------------------
+  send one data record for the specified station */
+
+static void send_record(int fd, int station, const float *data)
+{
+  char buffer[256];
+  char *cp = buffer;
+  int i, j, item, extended;
+
+  *cp++ = '0';
+  *cp++ = '1' + station;
+  *cp++ = ' ';
+
+  for (i = 0; i < format_len[station]; i++) {
+    item = format[station][i];
+    extended = 0;
+    if (item >= 50) {
+      extended = 1;
+      item -= 50;
+    }
+    switch (item) {
+    case 0:
+      *cp++ = ' ';
+      break;
+    case 1:
+      *cp++ = '\r';
+      *cp++ = '\n';
+      break;
+    case 2:
+      /* each station is offset from the previous one by 5 inches */
+      cp = put_value(cp, data[0] + 5.0f*station, extended);
+      cp = put_value(cp, data[1], extended);
+      cp = put_value(cp, data[2], extended);
+      break;
+    case 4:
+      for (j = 3; j < 6; j++) {
+        cp = put_value(cp, data[j], extended);
+      }
+      break;
+    case 16:
+      if (extended) {
+        sprintf(cp, "%9d", 0);
+        cp += 9;
+      }
+      else {
+        *cp++ = ' ';
+        *cp++ = '0';
+      }
+      break;
+    }
+  }
+
+  write(fd, buffer, cp - buffer);
+}
+
+/*-------------------------------------------------------------------
+  send one data record for each active station */
+
+static void send_frame(int fd, int *counter)
+{
+  int station;
+  const float *data = records[*counter % num_records];
+
+  for (station = 0; station < 4; station++) {
+    if (station_active[station]) {
+      send_record(fd, station, data);
+    }
+  }
+  (*counter)++;
+}
+
+/*-------------------------------------------------------------------
+  execute a command that takes parameters, e.g. "O1,2,4,1" */
+
+static void do_command(int fd, const char *command, int *counter)
+{
+  char reply[64];
+  const char *cp;
+  int station, i, n;
+
+  if (command[0] == '\0') {
+    /* a lone carriage return is answered with a single record */
+    send_frame(fd, counter);
+    return;
+  }
+
+  station = command[1] - '1';
+  if (station < 0 || station > 3) {
+    return;
+  }
+
+  switch (command[0]) {
+  case 'O':
+    n = 0;
+    cp = &command[2];
+    while (*cp == ',' && n < 64) {
+      format[station][n++] = atoi(++cp);
+      while (*cp >= '0' && *cp <= '9') {
+        cp++;
+      }
+    }
+    format_len[station] = n;
+    break;
+  case 'l':
+    if (command[2] == ',') {
+      station_active[station] = (command[3] == '1');
+    }
+    else {
+      sprintf(reply, "2%cl", command[1]);
+      for (i = 0; i < 4; i++) {
+        reply[3 + i] = '0' + station_active[i];
+      }
+      reply[7] = '\r';
+      reply[8] = '\n';
+      write(fd, reply, 9);
+    }
+    break;
+  default:
+    /* hemisphere, boresight, etc. have no effect on the replay */
+    break;
+  }
+}
+
+/*-------------------------------------------------------------------*/
+
+int main(int argc, char *argv[])
+{
+  const char *filename = "polhemusdata.txt";
+  double rate = 120.0;
+  int nstations = 1;
+  int master, slave;
+  char command[256];
+  int command_len = 0;
+  int counter = 0;
+  char c;
+  int i, n;
+  struct termios t;
+  struct timeval tv, now, next_time;
+  fd_set readfds;
+  long period_usec;
+
+  for (i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "-s") == 0 && i+1 < argc) {
+      nstations = atoi(argv[++i]);
+    }
+    else if (strcmp(argv[i], "-r") == 0 && i+1 < argc) {
+      rate = atof(argv[++i]);
+    }
+    else {
+      filename = argv[i];
+    }
+  }
+  if (nstations < 1 || nstations > 4 || rate <= 0) {
+    fprintf(stderr, "usage: polhemussim [-s stations] [-r rate] [datafile]\n");
+    return 1;
+  }
+  for (i = 0; i < 4; i++) {
+    station_active[i] = (i < nstations);
+  }
+
+  read_data(filename);
+  reset_device();
+
+  master = posix_openpt(O_RDWR | O_NOCTTY);
+  if (master == -1 || grantpt(master) == -1 || unlockpt(master) == -1) {
+    fprintf(stderr, "polhemussim: can't create pseudo-terminal\n");
+    return 1;
+  }
+
+  /* keep the slave open so that the master doesn't hang up whenever
+     the application closes its end, and make it raw */
+  slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+  if (slave != -1 && tcgetattr(slave, &t) == 0) {
+    t.c_lflag = 0;
+    t.c_iflag = 0;
+    t.c_oflag = 0;
+    tcsetattr(slave, TCSANOW, &t);
+  }
+
+  printf("%s\n", ptsname(master));
+  fflush(stdout);
+  fprintf(stderr, "polhemussim: replaying %d records from %s\n",
+          num_records, filename);
+
+  gettimeofday(&next_time, 0);
+
+  for (;;) {
+    /* the FasTrak divides its update rate between the active stations */
+    n = 0;
+    for (i = 0; i < 4; i++) {
+      n += station_active[i];
+    }
+    period_usec = (long)(1e6*(n > 0 ? n : 1)/rate);
+
+    FD_ZERO(&readfds);
+    FD_SET(master, &readfds);
+    tv.tv_sec = 0;
+    tv.tv_usec = period_usec;
+    if (stream) {
+      gettimeofday(&now, 0);
+      tv.tv_usec = (next_time.tv_sec - now.tv_sec)*1000000 +
+                   (next_time.tv_usec - now.tv_usec);
+      if (tv.tv_usec < 0) {
+        tv.tv_usec = 0;
+      }
+    }
+
+    if (select(master+1, &readfds, 0, 0, &tv) > 0) {
+      if (read(master, &c, 1) != 1) {
+        continue;
+      }
+
+      if (command_len > 0) {
+        /* in the middle of a command that takes parameters */
+        if (c == '\r' || c == '\n') {
+          command[command_len] = '\0';
+          do_command(master, command, &counter);
+          command_len = 0;
+        }
+        else if (command_len < 255) {
+          command[command_len++] = c;
+        }
+        continue;
+      }
+
+      switch (c) {
+      case '\x19':  /* ^Y, reinitialize */
+        reset_device();
+        break;
+      case 'f':
+        binary = 1;
+        break;
+      case 'F':
+        binary = 0;
+        break;
+      case 'C':
+        stream = 1;
+        gettimeofday(&next_time, 0);
+        break;
+      case 'c':
+        stream = 0;
+        break;
+      case 'P':
+        send_frame(master, &counter);
+        break;
+      case '\r':
+        command[0] = '\0';
+        do_command(master, command, &counter);
+        break;
+      case '\n':
+      case 'u':
+      case 'U':
+        break;
+      default:
+        command[command_len++] = c;
+        break;
+      }
+    }
+
+    if (stream) {
+      gettimeofday(&now, 0);
+      if (now.tv_sec > next_time.tv_sec ||
+          (now.tv_sec == next_time.tv_sec &&
+           now.tv_usec >= next_time.tv_usec)) {
+        send_frame(master, &counter);
+        next_time.tv_usec += period_usec;
+        while (next_time.tv_usec >= 1000000) {
+          next_time.tv_usec -= 1000000;
+          next_time.tv_sec++;
+        }
+      }
+    }
+  }
+
+  return 0;
+}
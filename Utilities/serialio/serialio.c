@@ -0,0 +1,916 @@
+/*=======================================================================
+
+  Program:   Serial I/O Library
+  Module:    serialio.c
+  Language:  C
+
+==========================================================================
+
+Redistribution of this source code and/or any binary applications created
+using this source code is prohibited without the expressed, written
+permission of the copyright holders.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+=======================================================================*/
+
+/* =========== standard includes */
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* =========== unix includes */
+#include <unistd.h>
+#include <fcntl.h>
+#include <termios.h>
+#include <netdb.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include <sys/time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#if defined(linux) || defined(__linux__)
+#include <sys/epoll.h>
+#define SIO_USE_EPOLL 1
+#endif
+
+#include "serialio.h"
+
+/* time out period in milliseconds */
+#define TIMEOUT_PERIOD 5000
+
+/* bytes that can be held while waiting for the end of a reply */
+#define SIO_INPUT_SIZE (2*SIO_MAX_REPLY)
+
+/* replies that can be queued before the oldest is dropped */
+#define SIO_MAX_FRAMES 8
+
+/* the maximum number of events that the reactor handles per wakeup */
+#define SIO_MAX_EVENTS 16
+
+struct sioport {
+  int file;                /* file descriptor */
+  int tcp;                 /* true if this is a socket */
+  int saved;               /* true if save_termios holds the old state */
+  struct termios save_termios;
+  int timeout;             /* milliseconds */
+  sioport *next;           /* next port that the reactor is watching */
+  int registered;          /* true while the reactor is watching it */
+
+  /* everything below is shared with the reactor thread */
+  pthread_mutex_t mutex;
+  pthread_cond_t cond;     /* signalled when a reply arrives */
+  sioFramer framer;
+  void *framer_data;
+  char input[SIO_INPUT_SIZE];  /* bytes not yet framed */
+  int input_len;
+  char frames[SIO_MAX_FRAMES][SIO_MAX_REPLY];
+  int frame_len[SIO_MAX_FRAMES];
+  int first_frame;         /* oldest queued reply */
+  int num_frames;          /* number of queued replies */
+  int hangup;              /* device closed or I/O error */
+  double write_time;       /* start of last write, zero once answered */
+  double latency_sum;
+  siostats stats;
+};
+
+/* the reactor: the ports list and the thread are protected by the mutex,
+   which the reactor thread holds whenever it is touching a port, while
+   the open mutex keeps the reactor from being started while it is
+   still being stopped */
+static pthread_mutex_t sio_open_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t sio_reactor_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_t sio_reactor_thread;
+static int sio_reactor_running = 0;
+static int sio_reactor_quit = 0;
+static int sio_wakeup[2] = { -1, -1 };  /* pipe that interrupts the wait */
+static sioport *sio_ports = NULL;
+#ifdef SIO_USE_EPOLL
+static int sio_epoll = -1;
+#endif
+
+/*---------------------------------------------------------------------*/
+/* the current time in milliseconds */
+
+static double sio_time()
+{
+  struct timeval tv;
+
+  gettimeofday(&tv, 0);
+  return tv.tv_sec*1000.0 + tv.tv_usec*0.001;
+}
+
+/*---------------------------------------------------------------------*/
+/* cut as many replies as possible from the input, must be called with
+   the port mutex held */
+
+static void sio_frame_input(sioport *port)
+{
+  int i, m, n;
+  double latency;
+
+  while (port->input_len > 0) {
+    n = port->framer(port->framer_data, port->input, port->input_len);
+    if (n == 0) {
+      /* need more bytes, unless there is no room for them */
+      if (port->input_len < SIO_INPUT_SIZE) {
+        break;
+      }
+      n = -port->input_len;
+    }
+    if (n < 0) {
+      n = -n;
+      if (n > port->input_len) {
+        n = port->input_len;
+      }
+      port->stats.bytes_discarded += n;
+    }
+    else {
+      if (n > port->input_len) {
+        n = port->input_len;
+      }
+      if (port->num_frames == SIO_MAX_FRAMES) {
+        port->first_frame = (port->first_frame + 1) % SIO_MAX_FRAMES;
+        port->num_frames--;
+        port->stats.frames_dropped++;
+      }
+      i = (port->first_frame + port->num_frames) % SIO_MAX_FRAMES;
+      m = (n < SIO_MAX_REPLY ? n : SIO_MAX_REPLY);
+      memcpy(port->frames[i], port->input, m);
+      port->frame_len[i] = m;
+      port->num_frames++;
+      port->stats.frames++;
+      port->stats.bytes_discarded += n - m;
+
+      /* the first reply after a write is taken to be the answer to it */
+      if (port->write_time != 0) {
+        latency = sio_time() - port->write_time;
+        port->write_time = 0;
+        if (port->stats.replies == 0 || latency < port->stats.latency_min) {
+          port->stats.latency_min = latency;
+        }
+        if (port->stats.replies == 0 || latency > port->stats.latency_max) {
+          port->stats.latency_max = latency;
+        }
+        port->latency_sum += latency;
+        port->stats.replies++;
+      }
+      pthread_cond_broadcast(&port->cond);
+    }
+    port->input_len -= n;
+    memmove(port->input, &port->input[n], port->input_len);
+  }
+}
+
+/*---------------------------------------------------------------------*/
+/* read everything that is waiting on a port, called by the reactor,
+   hangup is set if the reactor was told that the device hung up */
+
+static void sio_read_port(sioport *port, int hangup)
+{
+  int m;
+
+  pthread_mutex_lock(&port->mutex);
+  while (!port->hangup) {
+    m = read(port->file, &port->input[port->input_len],
+             SIO_INPUT_SIZE - port->input_len);
+    if (m > 0) {
+      port->input_len += m;
+      port->stats.bytes_read += m;
+      sio_frame_input(port);
+      continue;
+    }
+    else if (m == -1 && errno == EINTR) {
+      continue;
+    }
+    else if ((m == -1 && errno == EAGAIN) || (m == 0 && !port->tcp)) {
+      /* nothing more to read, a tty only returns zero if it hung up */
+      if (!hangup) {
+        break;
+      }
+    }
+    /* end of file, or an I/O error (e.g. EIO when a pty is closed) */
+    port->hangup = 1;
+    pthread_cond_broadcast(&port->cond);
+  }
+  pthread_mutex_unlock(&port->mutex);
+}
+
+/*---------------------------------------------------------------------*/
+/* check that a port that had an event is still open, must be called
+   with the reactor mutex held */
+
+static int sio_is_open(sioport *port)
+{
+  sioport *p;
+
+  for (p = sio_ports; p != NULL; p = p->next) {
+    if (p == port) {
+      return 1;
+    }
+  }
+  return 0;
+}
+
+/*---------------------------------------------------------------------*/
+/* the reactor thread: wait for input on any of the ports */
+
+static void *sio_reactor(void *user_data)
+{
+  char dummy[16];
+  int i, n;
+#ifdef SIO_USE_EPOLL
+  struct epoll_event events[SIO_MAX_EVENTS];
+#else
+  struct pollfd fds[SIO_MAX_EVENTS+1];
+  sioport *ports[SIO_MAX_EVENTS+1];
+  sioport *port;
+#endif
+
+  (void)user_data;
+
+  for (;;) {
+#ifdef SIO_USE_EPOLL
+    n = epoll_wait(sio_epoll, events, SIO_MAX_EVENTS, -1);
+#else
+    /* the poll set is rebuilt each time, since ports come and go */
+    pthread_mutex_lock(&sio_reactor_mutex);
+    fds[0].fd = sio_wakeup[0];
+    fds[0].events = POLLIN;
+    ports[0] = NULL;
+    n = 1;
+    for (port = sio_ports; port != NULL && n <= SIO_MAX_EVENTS;
+         port = port->next) {
+      if (!port->hangup) {
+        fds[n].fd = port->file;
+        fds[n].events = POLLIN;
+        ports[n++] = port;
+      }
+    }
+    pthread_mutex_unlock(&sio_reactor_mutex);
+    n = poll(fds, n, -1);
+#endif
+
+    if (n < 0 && errno != EINTR) {
+      break;
+    }
+
+    pthread_mutex_lock(&sio_reactor_mutex);
+    if (sio_reactor_quit) {
+      pthread_mutex_unlock(&sio_reactor_mutex);
+      break;
+    }
+#ifdef SIO_USE_EPOLL
+    for (i = 0; i < n; i++) {
+      if (events[i].data.ptr == NULL) {
+        while (read(sio_wakeup[0], dummy, sizeof(dummy)) > 0) ;
+      }
+      else if (sio_is_open((sioport *)events[i].data.ptr)) {
+        sio_read_port((sioport *)events[i].data.ptr,
+                      (events[i].events & (EPOLLHUP|EPOLLERR)) != 0);
+        if (((sioport *)events[i].data.ptr)->hangup) {
+          epoll_ctl(sio_epoll, EPOLL_CTL_DEL,
+                    ((sioport *)events[i].data.ptr)->file, NULL);
+        }
+      }
+    }
+#else
+    for (i = 0; n > 0 && i < SIO_MAX_EVENTS+1; i++) {
+      if (fds[i].revents == 0) {
+        continue;
+      }
+      if (ports[i] == NULL) {
+        while (read(sio_wakeup[0], dummy, sizeof(dummy)) > 0) ;
+      }
+      else if (sio_is_open(ports[i])) {
+        sio_read_port(ports[i], (fds[i].revents & (POLLHUP|POLLERR)) != 0);
+      }
+    }
+#endif
+    pthread_mutex_unlock(&sio_reactor_mutex);
+  }
+
+  return NULL;
+}
+
+/*---------------------------------------------------------------------*/
+/* make the reactor rebuild its poll set, the caller must hold the
+   reactor mutex and the reactor must be running */
+
+static void sio_wake_reactor()
+{
+  int m;
+
+  do {
+    m = write(sio_wakeup[1], "", 1);
+  }
+  while (m == -1 && errno == EINTR);
+
+  /* EAGAIN means that the pipe is full, so the reactor will wake anyway,
+     any other error means that the reactor will only see the change
+     the next time that it wakes up */
+}
+
+/*---------------------------------------------------------------------*/
+/* add a port to the reactor, starting the reactor if necessary */
+
+static int sio_register(sioport *port)
+{
+#ifdef SIO_USE_EPOLL
+  struct epoll_event ev;
+#endif
+  int rval = -1;
+
+  pthread_mutex_lock(&sio_open_mutex);
+  pthread_mutex_lock(&sio_reactor_mutex);
+
+  if (!sio_reactor_running) {
+    if (pipe(sio_wakeup) == -1) {
+      goto done;
+    }
+    fcntl(sio_wakeup[0], F_SETFL, O_NONBLOCK);
+    fcntl(sio_wakeup[1], F_SETFL, O_NONBLOCK);
+#ifdef SIO_USE_EPOLL
+    sio_epoll = epoll_create(SIO_MAX_EVENTS);
+    ev.events = EPOLLIN;
+    ev.data.ptr = NULL;
+    if (sio_epoll == -1 ||
+        epoll_ctl(sio_epoll, EPOLL_CTL_ADD, sio_wakeup[0], &ev) == -1) {
+      if (sio_epoll != -1) {
+        close(sio_epoll);
+      }
+      close(sio_wakeup[0]);
+      close(sio_wakeup[1]);
+      goto done;
+    }
+#endif
+    sio_reactor_quit = 0;
+    if (pthread_create(&sio_reactor_thread, NULL, &sio_reactor, NULL) != 0) {
+#ifdef SIO_USE_EPOLL
+      close(sio_epoll);
+#endif
+      close(sio_wakeup[0]);
+      close(sio_wakeup[1]);
+      goto done;
+    }
+    sio_reactor_running = 1;
+  }
+
+#ifdef SIO_USE_EPOLL
+  ev.events = EPOLLIN;
+  ev.data.ptr = port;
+  if (epoll_ctl(sio_epoll, EPOLL_CTL_ADD, port->file, &ev) == -1) {
+    goto done;
+  }
+#endif
+
+  port->next = sio_ports;
+  sio_ports = port;
+  port->registered = 1;
+
+  sio_wake_reactor();
+  rval = 0;
+
+done:
+  pthread_mutex_unlock(&sio_reactor_mutex);
+  pthread_mutex_unlock(&sio_open_mutex);
+
+  return rval;
+}
+
+/*---------------------------------------------------------------------*/
+/* remove a port from the reactor, and stop the reactor if it was the
+   last port */
+
+static void sio_unregister(sioport *port)
+{
+  sioport **pp;
+  int stop = 0;
+
+  pthread_mutex_lock(&sio_open_mutex);
+  pthread_mutex_lock(&sio_reactor_mutex);
+
+  /* a port that failed to register was never given to the reactor,
+     which might not even have been started */
+  if (!port->registered || !sio_reactor_running) {
+    pthread_mutex_unlock(&sio_reactor_mutex);
+    pthread_mutex_unlock(&sio_open_mutex);
+    return;
+  }
+
+  for (pp = &sio_ports; *pp != NULL; pp = &(*pp)->next) {
+    if (*pp == port) {
+      *pp = port->next;
+      break;
+    }
+  }
+  port->registered = 0;
+#ifdef SIO_USE_EPOLL
+  epoll_ctl(sio_epoll, EPOLL_CTL_DEL, port->file, NULL);
+#endif
+
+  if (sio_ports == NULL) {
+    sio_reactor_quit = 1;
+    sio_reactor_running = 0;
+    stop = 1;
+  }
+  sio_wake_reactor();
+
+  pthread_mutex_unlock(&sio_reactor_mutex);
+
+  if (stop) {
+    pthread_join(sio_reactor_thread, NULL);
+#ifdef SIO_USE_EPOLL
+    close(sio_epoll);
+    sio_epoll = -1;
+#endif
+    close(sio_wakeup[0]);
+    close(sio_wakeup[1]);
+    sio_wakeup[0] = -1;
+    sio_wakeup[1] = -1;
+  }
+
+  pthread_mutex_unlock(&sio_open_mutex);
+}
+
+/*---------------------------------------------------------------------*/
+/* open a TCP connection, given "host:port" */
+
+static int sio_open_tcp(const char *address)
+{
+  char host[256];
+  const char *cp;
+  struct addrinfo hints, *res, *rp;
+  int s = -1;
+  int on = 1;
+
+  cp = strrchr(address, ':');
+  if (cp == NULL || cp - address > 255) {
+    return -1;
+  }
+  strncpy(host, address, cp - address);
+  host[cp - address] = '\0';
+
+  memset(&hints, 0, sizeof(hints));
+  hints.ai_family = AF_UNSPEC;
+  hints.ai_socktype = SOCK_STREAM;
+  if (getaddrinfo(host, cp + 1, &hints, &res) != 0) {
+    return -1;
+  }
+
+  for (rp = res; rp != NULL; rp = rp->ai_next) {
+    s = socket(rp->ai_family, rp->ai_socktype, rp->ai_protocol);
+    if (s == -1) {
+      continue;
+    }
+    if (connect(s, rp->ai_addr, rp->ai_addrlen) == 0) {
+      break;
+    }
+    close(s);
+    s = -1;
+  }
+  freeaddrinfo(res);
+
+  /* commands are short, so don't let them sit in the send buffer */
+  if (s != -1) {
+    setsockopt(s, IPPROTO_TCP, TCP_NODELAY, (char *)&on, sizeof(on));
+  }
+
+  return s;
+}
+
+/*---------------------------------------------------------------------*/
+sioport *sioOpen(const char *device)
+{
+  struct flock fl; /* for file locking */
+  struct flock fu; /* for file unlocking */
+  sioport *port;
+  struct termios t;
+
+  /* the field order of struct flock differs between unices */
+  memset(&fl, 0, sizeof(fl));
+  fl.l_type = F_WRLCK;
+  memset(&fu, 0, sizeof(fu));
+  fu.l_type = F_UNLCK;
+
+  port = (sioport *)malloc(sizeof(sioport));
+  if (port == NULL) {
+    return NULL;
+  }
+  memset(port, 0, sizeof(sioport));
+  port->timeout = TIMEOUT_PERIOD;
+  port->framer = &sioFrameCR;
+
+  if (strncmp(device, "tcp:", 4) == 0) {
+    port->tcp = 1;
+    port->file = sio_open_tcp(&device[4]);
+    if (port->file == -1) {
+      free(port);
+      return NULL;
+    }
+  }
+  else {
+    port->file = open(device, O_RDWR|O_NOCTTY|O_NDELAY);
+    if (port->file == -1) {
+      free(port);
+      return NULL;
+    }
+
+#ifndef __APPLE__
+    /* get exclusive lock on the serial port */
+    /* on many unices, this has no effect for device files */
+    if (fcntl(port->file, F_SETLK, &fl)) {
+      close(port->file);
+      free(port);
+      return NULL;
+    }
+#endif /* __APPLE__ */
+
+    /* save the state so that sioClose() can restore it, and then make
+       the port raw: the reactor does all of the waiting */
+    if (tcgetattr(port->file, &t) == -1) {
+      fcntl(port->file, F_SETLK, &fu);
+      close(port->file);
+      free(port);
+      return NULL;
+    }
+    port->save_termios = t;
+    port->saved = 1;
+
+    t.c_lflag = 0;
+    t.c_iflag = 0;
+    t.c_oflag = 0;
+    t.c_cc[VMIN] = 1;
+    t.c_cc[VTIME] = 0;
+
+    if (tcsetattr(port->file, TCSANOW, &t) == -1) {
+      fcntl(port->file, F_SETLK, &fu);
+      close(port->file);
+      free(port);
+      return NULL;
+    }
+
+    tcflush(port->file, TCIOFLUSH);
+  }
+
+  fcntl(port->file, F_SETFL, O_NONBLOCK);
+
+  pthread_mutex_init(&port->mutex, NULL);
+  pthread_cond_init(&port->cond, NULL);
+
+  if (sio_register(port) != 0) {
+    pthread_mutex_destroy(&port->mutex);
+    pthread_cond_destroy(&port->cond);
+    if (port->saved) {
+      tcsetattr(port->file, TCSANOW, &port->save_termios);
+      fcntl(port->file, F_SETLK, &fu);
+    }
+    close(port->file);
+    free(port);
+    return NULL;
+  }
+
+  return port;
+}
+
+/*---------------------------------------------------------------------*/
+void sioClose(sioport *port)
+{
+  struct flock fu; /* for file unlocking */
+
+  memset(&fu, 0, sizeof(fu));
+  fu.l_type = F_UNLCK;
+
+  sio_unregister(port);
+
+  if (port->saved) {
+    tcsetattr(port->file, TCSANOW, &port->save_termios);
+    fcntl(port->file, F_SETLK, &fu);
+  }
+  close(port->file);
+
+  pthread_mutex_destroy(&port->mutex);
+  pthread_cond_destroy(&port->cond);
+  free(port);
+}
+
+/*---------------------------------------------------------------------*/
+int sioGetHandle(sioport *port)
+{
+  return port->file;
+}
+
+/*---------------------------------------------------------------------*/
+int sioComm(sioport *port, int baud, const char *mode, int handshake)
+{
+  struct termios t;
+  speed_t newbaud;
+
+  if (port->tcp) {
+    return 0;
+  }
+
+  switch (baud)
+    {
+    case 1200:   newbaud = B1200;   break;
+    case 2400:   newbaud = B2400;   break;
+    case 4800:   newbaud = B4800;   break;
+    case 9600:   newbaud = B9600;   break;
+    case 19200:  newbaud = B19200;  break;
+    case 38400:  newbaud = B38400;  break;
+#ifdef B57600
+    case 57600:  newbaud = B57600;  break;
+#endif
+#ifdef B115200
+    case 115200: newbaud = B115200; break;
+#endif
+#ifdef B230400
+    case 230400: newbaud = B230400; break;
+#endif
+#ifdef B921600
+    case 921600: newbaud = B921600; break;
+#endif
+    default:     return -1;
+    }
+
+  if (tcgetattr(port->file, &t) == -1) {
+    return -1;
+  }
+
+  cfsetispeed(&t, newbaud);
+  cfsetospeed(&t, newbaud);
+
+  t.c_cflag &= ~CSIZE;
+  if (mode[0] == '8') {                 /* set data bits */
+    t.c_cflag |= CS8;
+  }
+  else if (mode[0] == '7') {
+    t.c_cflag |= CS7;
+  }
+  else {
+    return -1;
+  }
+
+  if (mode[1] == 'N') {                 /* set parity */
+    t.c_cflag &= ~PARENB;
+    t.c_cflag &= ~PARODD;
+  }
+  else if (mode[1] == 'O') {
+    t.c_cflag |= PARENB;
+    t.c_cflag |= PARODD;
+  }
+  else if (mode[1] == 'E') {
+    t.c_cflag |= PARENB;
+    t.c_cflag &= ~PARODD;
+  }
+  else {
+    return -1;
+  }
+
+  if (mode[2] == '1') {                  /* set stop bits */
+    t.c_cflag &= ~CSTOPB;
+  }
+  else if (mode[2] == '2') {
+    t.c_cflag |= CSTOPB;
+  }
+  else {
+    return -1;
+  }
+
+  t.c_cflag |= CREAD | CLOCAL;
+  if (handshake) {
+    t.c_cflag |= CRTSCTS;
+  }
+  else {
+    t.c_cflag &= ~CRTSCTS;
+  }
+
+  if (tcsetattr(port->file, TCSADRAIN, &t) == -1) {
+    return -1;
+  }
+
+  return 0;
+}
+
+/*---------------------------------------------------------------------*/
+void sioSetTimeout(sioport *port, int milliseconds)
+{
+  port->timeout = milliseconds;
+}
+
+/*---------------------------------------------------------------------*/
+void sioSetFramer(sioport *port, sioFramer framer, void *framer_data)
+{
+  pthread_mutex_lock(&port->mutex);
+  port->framer = framer;
+  port->framer_data = framer_data;
+  sio_frame_input(port);
+  pthread_mutex_unlock(&port->mutex);
+}
+
+/*---------------------------------------------------------------------*/
+int sioFrameCR(void *framer_data, const char *data, int n)
+{
+  const char *cp = (const char *)memchr(data, '\r', n);
+
+  (void)framer_data;
+  return (cp ? (int)(cp - data) + 1 : 0);
+}
+
+/*---------------------------------------------------------------------*/
+int sioFrameLF(void *framer_data, const char *data, int n)
+{
+  const char *cp = (const char *)memchr(data, '\n', n);
+
+  (void)framer_data;
+  return (cp ? (int)(cp - data) + 1 : 0);
+}
+
+/*---------------------------------------------------------------------*/
+int sioFrameFixed(void *framer_data, const char *data, int n)
+{
+  int len = *((int *)framer_data);
+
+  (void)data;
+  return (n >= len ? len : 0);
+}
+
+/*---------------------------------------------------------------------*/
+int sioWrite(sioport *port, const char *text, int n)
+{
+  struct pollfd pfd;
+  double start_time, wait;
+  int i = 0;
+  int m;
+
+  start_time = sio_time();
+
+  pthread_mutex_lock(&port->mutex);
+  port->write_time = start_time;
+  pthread_mutex_unlock(&port->mutex);
+
+  pfd.fd = port->file;
+  pfd.events = POLLOUT;
+
+  while (n > 0) {
+    if ((m = write(port->file, &text[i], n)) == -1) {
+      if (errno == EINTR) {
+        /* interrupted by a signal before anything was written */
+        continue;
+      }
+      if (errno == EAGAIN) {
+        /* output buffer is full, wait until there is room */
+        wait = port->timeout - (sio_time() - start_time);
+        if (wait <= 0) {
+          break;
+        }
+        m = poll(&pfd, 1, (int)wait);
+        if (m == 0 || (m == -1 && errno != EINTR)) {
+          break;
+        }
+        continue;
+      }
+      return -1;  /* IO error occurred */
+    }
+
+    n -= m;  /* n is number of chars left to write */
+    i += m;  /* i is the number of chars written */
+  }
+
+  pthread_mutex_lock(&port->mutex);
+  port->stats.bytes_written += i;
+  pthread_mutex_unlock(&port->mutex);
+
+  return i;  /* return the number of characters written */
+}
+
+/*---------------------------------------------------------------------*/
+/* wait for a reply and copy it, optionally skipping to the newest one */
+
+static int sio_read(sioport *port, char *reply, int n, int latest)
+{
+  struct timeval tv;
+  struct timespec abstime;
+  int i, m, rval = 0;
+
+  gettimeofday(&tv, 0);
+  abstime.tv_sec = tv.tv_sec + port->timeout/1000;
+  abstime.tv_nsec = tv.tv_usec*1000 + (port->timeout % 1000)*1000000;
+  if (abstime.tv_nsec >= 1000000000) {
+    abstime.tv_sec++;
+    abstime.tv_nsec -= 1000000000;
+  }
+
+  pthread_mutex_lock(&port->mutex);
+
+  while (port->num_frames == 0 && !port->hangup) {
+    if (pthread_cond_timedwait(&port->cond, &port->mutex, &abstime)
+        == ETIMEDOUT) {
+      break;
+    }
+  }
+
+  if (port->num_frames > 0) {
+    if (latest) {
+      port->first_frame = (port->first_frame + port->num_frames - 1)
+                            % SIO_MAX_FRAMES;
+      port->num_frames = 1;
+    }
+    i = port->first_frame;
+    m = port->frame_len[i];
+    rval = (m < n ? m : n);
+    memcpy(reply, port->frames[i], rval);
+    port->first_frame = (i + 1) % SIO_MAX_FRAMES;
+    port->num_frames--;
+  }
+  else if (port->hangup) {
+    rval = -1;
+  }
+  else {
+    port->stats.timeouts++;
+  }
+
+  pthread_mutex_unlock(&port->mutex);
+
+  return rval;
+}
+
+/*---------------------------------------------------------------------*/
+int sioRead(sioport *port, char *reply, int n)
+{
+  return sio_read(port, reply, n, 0);
+}
+
+/*---------------------------------------------------------------------*/
+int sioReadLatest(sioport *port, char *reply, int n)
+{
+  return sio_read(port, reply, n, 1);
+}
+
+/*---------------------------------------------------------------------*/
+int sioFlush(sioport *port, int buffers)
+{
+  int flushtype = TCIOFLUSH;
+
+  if (buffers == SIO_IFLUSH) {
+    flushtype = TCIFLUSH;
+  }
+  else if (buffers == SIO_OFLUSH) {
+    flushtype = TCOFLUSH;
+  }
+
+  pthread_mutex_lock(&port->mutex);
+  if (!port->tcp) {
+    tcflush(port->file, flushtype);
+  }
+  if (buffers & SIO_IFLUSH) {
+    port->input_len = 0;
+    port->num_frames = 0;
+  }
+  pthread_mutex_unlock(&port->mutex);
+
+  return 0;
+}
+
+/*---------------------------------------------------------------------*/
+int sioBreak(sioport *port)
+{
+  sioFlush(port, SIO_IOFLUSH);
+  if (!port->tcp) {
+    tcsendbreak(port->file, 0);
+  }
+
+  return 0;
+}
+
+/*---------------------------------------------------------------------*/
+void sioGetStatistics(sioport *port, siostats *stats)
+{
+  pthread_mutex_lock(&port->mutex);
+  *stats = port->stats;
+  stats->latency_mean = 0;
+  if (port->stats.replies > 0) {
+    stats->latency_mean = port->latency_sum/port->stats.replies;
+  }
+  pthread_mutex_unlock(&port->mutex);
+}
+
+/*---------------------------------------------------------------------*/
+void sioResetStatistics(sioport *port)
+{
+  pthread_mutex_lock(&port->mutex);
+  memset(&port->stats, 0, sizeof(siostats));
+  port->latency_sum = 0;
+  pthread_mutex_unlock(&port->mutex);
+}
@@ -0,0 +1,195 @@
+/*=======================================================================
+
+  Program:   Serial I/O Library
+  Module:    serialio.h
+  Language:  C
+
+==========================================================================
+
+Redistribution of this source code and/or any binary applications created
+using this source code is prohibited without the expressed, written
+permission of the copyright holders.
+
+THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS ``AS IS''
+AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ARE DISCLAIMED. IN NO EVENT SHALL THE REGENTS OR CONTRIBUTORS BE LIABLE FOR
+ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR CONSEQUENTIAL
+DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF SUBSTITUTE GOODS OR
+SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS INTERRUPTION) HOWEVER
+CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN CONTRACT, STRICT LIABILITY,
+OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE) ARISING IN ANY WAY OUT OF THE USE
+OF THIS SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
+=======================================================================*/
+
+/*! \file serialio.h
+  This file contains a serial transport that is shared by the device
+  libraries.  All of the ports that are opened through it are read by
+  a single I/O thread, which cuts the incoming bytes into replies with
+  a framing function that is supplied by each device library.
+*/
+
+#ifndef SERIALIO_H
+#define SERIALIO_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/*=====================================================================*/
+/*! \defgroup SerialIO Serial I/O Methods
+  These methods open a serial port, a pseudo-terminal, or a TCP
+  connection (a device name of the form "tcp:host:port", e.g. for a
+  device simulator or a serial-to-ethernet server) and provide
+  non-blocking I/O on it.
+
+  The ports are multiplexed on one reactor thread (epoll on Linux,
+  poll elsewhere) that is started when the first port is opened and
+  stopped when the last one is closed.  The reactor thread reads
+  whatever arrives and uses the port's framer to find the complete
+  replies, which are queued until sioRead() takes them.  Windows is
+  not supported.
+*/
+
+/*! \ingroup SerialIO
+  A framer is given the bytes that have been received but not yet
+  framed, and returns the length of the complete reply at the start
+  of them, zero if more bytes are needed, or minus the number of bytes
+  that should be thrown away to get back in step with the device.
+*/
+typedef int (*sioFramer)(void *framer_data, const char *data, int n);
+
+/*! \ingroup SerialIO
+  Timing and error counts for a port, see sioGetStatistics().
+  The latency is the time from the start of a sioWrite() to the
+  arrival of the complete reply that followed it.
+*/
+typedef struct {
+  unsigned long bytes_read;      /* bytes received */
+  unsigned long bytes_written;   /* bytes sent */
+  unsigned long frames;          /* complete replies received */
+  unsigned long frames_dropped;  /* replies replaced before being read */
+  unsigned long bytes_discarded; /* bytes thrown away by the framer */
+  unsigned long timeouts;        /* sioRead() calls that timed out */
+  unsigned long replies;         /* writes that got a timed reply */
+  double latency_min;            /* milliseconds */
+  double latency_max;            /* milliseconds */
+  double latency_mean;           /* milliseconds */
+} siostats;
+
+/*! \ingroup SerialIO
+  The port structure is opaque. */
+typedef struct sioport sioport;
+
+/*! \ingroup SerialIO
+  The longest reply that can be received, longer replies are cut. */
+#define SIO_MAX_REPLY 2048
+
+/*! \ingroup SerialIO
+  Flush flags for sioFlush() */
+#define SIO_IFLUSH  0x1
+#define SIO_OFLUSH  0x2
+#define SIO_IOFLUSH 0x3
+
+/*! \ingroup SerialIO
+  Open a port and register it with the reactor thread.  The default
+  framer cuts the input at each carriage return.
+
+  \param device  a serial port or pseudo-terminal device name, or
+                 "tcp:host:port" for a TCP connection
+  \return        a new port, or NULL if the port could not be opened
+*/
+sioport *sioOpen(const char *device);
+
+/*! \ingroup SerialIO
+  Close a port.  The comm parameters of a serial port are restored to
+  what they were when it was opened.
+*/
+void sioClose(sioport *port);
+
+/*! \ingroup SerialIO
+  Get the file descriptor for the port.
+*/
+int sioGetHandle(sioport *port);
+
+/*! \ingroup SerialIO
+  Set the comm parameters.  This has no effect on TCP ports.
+
+  \param baud       the baud rate, e.g. 9600 or 115200
+  \param mode       data bits, parity and stop bits, e.g. "8N1"
+  \param handshake  1 for RTS/CTS hardware handshaking, 0 for none
+  \return           0 if successful, -1 otherwise
+*/
+int sioComm(sioport *port, int baud, const char *mode, int handshake);
+
+/*! \ingroup SerialIO
+  Set the time that sioRead() and sioWrite() will wait, in milliseconds.
+  The default is 5000.
+*/
+void sioSetTimeout(sioport *port, int milliseconds);
+
+/*! \ingroup SerialIO
+  Set the function that finds the end of each reply.  Any input that
+  has not been framed yet is framed with the new framer.
+*/
+void sioSetFramer(sioport *port, sioFramer framer, void *framer_data);
+
+/*! \ingroup SerialIO
+  Framers for replies that end with a carriage return, with a line
+  feed, or that have a fixed length (framer_data is a pointer to an
+  int that holds the length).
+*/
+int sioFrameCR(void *framer_data, const char *data, int n);
+int sioFrameLF(void *framer_data, const char *data, int n);
+int sioFrameFixed(void *framer_data, const char *data, int n);
+
+/*! \ingroup SerialIO
+  Write to the port, waiting for as long as the timeout if the output
+  buffer is full.
+
+  \return  the number of bytes written, or -1 on an I/O error
+*/
+int sioWrite(sioport *port, const char *text, int n);
+
+/*! \ingroup SerialIO
+  Get the oldest reply that has not yet been read, waiting for as long
+  as the timeout for one to arrive.  Only the first n bytes of the reply
+  are returned if it is longer than n.
+
+  \return  the number of bytes in reply, 0 on timeout, or -1 on an
+           I/O error or if the device hung up
+*/
+int sioRead(sioport *port, char *reply, int n);
+
+/*! \ingroup SerialIO
+  Like sioRead(), but older replies are thrown away so that the most
+  recent one is returned.  This is meant for streaming devices.
+*/
+int sioReadLatest(sioport *port, char *reply, int n);
+
+/*! \ingroup SerialIO
+  Throw away the input that has been received (including the queued
+  replies) and/or the output that has not been sent yet.
+*/
+int sioFlush(sioport *port, int buffers);
+
+/*! \ingroup SerialIO
+  Flush the port and send a serial break.
+*/
+int sioBreak(sioport *port);
+
+/*! \ingroup SerialIO
+  Get the timing and error counts for the port.
+*/
+void sioGetStatistics(sioport *port, siostats *stats);
+
+/*! \ingroup SerialIO
+  Reset the timing and error counts for the port.
+*/
+void sioResetStatistics(sioport *port);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* SERIALIO_H */
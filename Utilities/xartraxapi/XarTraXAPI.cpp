@@ -1461,70 +1461,576 @@ int xarALaserProjectDeg(polaris *pol, char *filename, double time, unsigned repe
 */
 int xarALaserProjectXYZ(polaris *pol, char *filename, double time, unsigned repeats, double _OHAT[3], double transform[4][4], vtkMatrix4x4 * worldMatrix)
 {
-	FILE *fileIN;
+	xarPointSet *points;
+	xarAngleTable *table;
+	int errnum;
+
+	// the file is read on every call, so that changes to it are projected.  To project the same points
+	// repeatedly, keep them with xarLoadPointSet and xarNewAngleTable and use xarALaserProjectTable.
+	if (!(points = xarLoadPointSet(filename)))
+		return XAR_FILEERROR; //error_value?
+	if (!(table = xarNewAngleTable())) {
+		xarFreePointSet(points);
+		return XAR_FILEERROR;
+	}
+
+	if (xarCompileAngleTable(table, points, _OHAT, transform, worldMatrix) < 0)
+		errnum = XAR_FILEERROR;
+	else
+		errnum = xarALaserProjectTable(pol, table, time, repeats);
+
+	xarFreeAngleTable(table);
+	xarFreePointSet(points);
+
+	return errnum;
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   uploads a compiled angle table (see xarCompileAngleTable) and runs the projection.
+
+  \param pol		a pointer to a polaris structure
+  \param table		the angle table to be projected
+  \param time		xarATimebpts() time value
+  \param repeats	number of times to repeat the pattern.
+
+  \return integer error code, XAR_OKAY if the projection was started.
+*/
+int xarALaserProjectTable(polaris *pol, xarAngleTable *table, double time, unsigned repeats)
+{
 	int tableSize;
 	double actualDump;
 	char * message;
 
-	// open the data file
-	if (!(fileIN = fopen(filename, "r")))
-		return XAR_FILEERROR; //error_value?
-	
 	message = xarARepeat(pol, repeats);  // set the repeating times
 	if(atoi(message))
 		return atoi(message);
+	message = xarAUploadAngleTable(pol, table, 0);
+	if(atoi(message))
+		return atoi(message);
+	message = xarATimebptsA(pol, time, &actualDump);
+	if(atoi(message))
+		return atoi(message);
+	message = xarAComplete(pol);												 // acknowledge the system
+	if(atoi(message))
+		return atoi(message);
+	message = xarSizePosTable(pol, &tableSize);
+	if(atoi(message))
+		return atoi(message);
+	message = xarReadPosTable(pol, XAR_CHANNEL_X, XAR_UNIT_DEG);
+	if(atoi(message))
+		return atoi(message);
+	message = xarReadPosTable(pol, XAR_CHANNEL_Y, XAR_UNIT_DEG);
+	if(atoi(message))
+		return atoi(message);
+	message = xarExecute(pol);
+	if(atoi(message))
+		return atoi(message);
+	// mirror command session ends here 
+	return XAR_OKAY;
+}
 
-	int data_count,	total_count=0,end = 0, start=0;
-	char szX[50], szY[50], szZ[50], szInfra[50], szVisible[50];
+/* sends the angles of points first to last-1 of a table to the arbitrary waveform position table, starting at
+   position offset + first.  Each _aposition command is filled with as many points as will fit in XAR_AW_MAXDATA
+   characters, and the text for each point is only formatted once.
+*/
+static char * xarAUploadAngleRange(polaris *pol, xarAngleTable *table, int offset, int first, int last)
+{
+	char data[XAR_AW_MAXDATA+1];
+	char temp[100];
+	char * message = pol->command_reply;
+	int i, n, length = 0, start = offset + first;
+
+	for (i = first; i < last; i++) {
+		n = xarAPositionFormat(temp, table->angles[2*i], table->angles[2*i+1], table->vi[i], table->invi[i]);
+		if (length + n > XAR_AW_MAXDATA && length > 0) {
+			data[length] = '\0';
+			message = xarAPosition(pol, start, offset + i, XAR_UNIT_DEG, data);
+			if(atoi(message))
+				return message;
+			start = offset + i;
+			length = 0;
+		}
+		memcpy(&data[length], temp, n);
+		length += n;
+	}
+	if (length > 0) {
+		data[length] = '\0';
+		message = xarAPosition(pol, start, offset + last, XAR_UNIT_DEG, data);
+		if(atoi(message))
+			return message;
+	}
+	memset(&table->changed[first], 0, last - first);
+	return message;
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   sends the angles in a table to the arbitrary waveform position table.  Each _aposition command is filled with as many
+   points as will fit in XAR_AW_MAXDATA characters, and the text for each point is only formatted once.
+
+  \param pol		a pointer to a polaris structure
+  \param table		the angle table to be sent
+  \param offset		the position in the waveform table at which the first point is stored
+
+  \return char pointer containing result of the last operation called.
+*/
+char * xarAUploadAngleTable(polaris *pol, xarAngleTable *table, int offset)
+{
+	pol->command_reply[0] = '\0';
+	return xarAUploadAngleRange(pol, table, offset, 0, table->numPoints);
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   sends only the angles that have changed since the table was last uploaded, for a table that is already in the
+   arbitrary waveform position table.  Each run of changed points is sent with as few _aposition commands as possible,
+   and runs that are separated by no more than XAR_AW_MERGEGAP unchanged points are sent together, since resending a
+   few points costs less than another command.
+
+  \param pol		a pointer to a polaris structure
+  \param table		the angle table to be sent
+  \param offset		the position in the waveform table at which the first point is stored
+
+  \return char pointer containing result of the last operation called.
+*/
+char * xarAUploadChangedAngles(polaris *pol, xarAngleTable *table, int offset)
+{
+	char * message = pol->command_reply;
+	int i = 0, first, last;
+
+	pol->command_reply[0] = '\0';
+	while (i < table->numPoints) {
+		if (!table->changed[i]) {
+			i++;
+			continue;
+		}
+		first = i;
+		last = ++i;
+		for (; i < table->numPoints && i - last <= XAR_AW_MERGEGAP; i++) {
+			if (table->changed[i])
+				last = i + 1;
+		}
+		i = last;
+		message = xarAUploadAngleRange(pol, table, offset, first, last);
+		if(atoi(message))
+			return message;
+	}
+	return message;
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   reads a file that has an X-Position Y-Position Z-Position visibleOn infraOn for each point (after a line that starts
+   with '#') into memory, so that it can be compiled into angle tables any number of times.
+
+  \param filename	char pointer to the name of the file to be loaded.
+
+  \return the point set, or NULL if the file could not be read.  Free it with xarFreePointSet.
+*/
+xarPointSet * xarLoadPointSet(const char *filename)
+{
+	static unsigned long lastGeneration = 0;
+	FILE *fileIN;
 	char readline[150];
-	char data[1024], temp[75];
 	double X,Y,Z;
-	double angleX, angleY;
+	int vi, invi;
+	int allocated = 0;
 	bool OKtoRead = false;
-	while (fgets(readline, 80, fileIN) != NULL) {
-		sscanf(readline, "%s\t%s\t%s\t%s\t%s", &szX, &szY, &szZ, &szVisible,&szInfra);
+	xarPointSet *points;
+	double *newXYZ;
+	int *newVI, *newINVI;
+
+	if (!(fileIN = fopen(filename, "r")))
+		return NULL;
+
+	if (!(points = (xarPointSet *)malloc(sizeof(xarPointSet)))) {
+		fclose(fileIN);
+		return NULL;
+	}
+	points->numPoints = 0;
+	points->xyz = NULL;
+	points->vi = NULL;
+	points->invi = NULL;
+	// an angle table is only reused for the point set that it was compiled from, and a new point set
+	// can have the same address as one that was freed, so each one is given its own number
+	points->generation = ++lastGeneration;
+
+	while (fgets(readline, 150, fileIN) != NULL) {
 		if (OKtoRead == false) {
 			if (readline[0] == '#') {
 				OKtoRead = true;
 			}
 			continue;
 		}
-		X = atof(szX); 
-		Y = atof(szY); 
-		Z = atof(szZ);
-		xarPositionToAngle(	X*transform[0][0]+ Y*transform[0][1]+ Z*transform[0][2]+ transform[0][3],
-							X*transform[1][0]+ Y*transform[1][1]+ Z*transform[1][2]+ transform[1][3],
-							X*transform[2][0]+ Y*transform[2][1]+ Z*transform[2][2]+ transform[2][3],
-							_OHAT, angleX, angleY,worldMatrix);
-			xarAPositionBuildCommand(data_count,temp,angleX,angleY,atoi(szVisible),atoi(szInfra));
-		if (total_count==0)
-			strcpy(data, temp);
-		else
-			strcat(data, temp);
-		total_count+=data_count;
-		end++;
-			if (total_count >= 900) {
-			message = xarAPosition(pol, start, end, XAR_UNIT_DEG, data);
-			if(atoi(message))
-				return atoi(message);
-			start=end;
-			total_count=0;
+		if (sscanf(readline, "%lf %lf %lf %d %d", &X, &Y, &Z, &vi, &invi) != 5)
+			continue;
+		if (points->numPoints == allocated) {
+			allocated = (allocated == 0 ? 256 : 2*allocated);
+			newXYZ = (double *)realloc(points->xyz, 3*allocated*sizeof(double));
+			if (newXYZ)
+				points->xyz = newXYZ;
+			newVI = (int *)realloc(points->vi, allocated*sizeof(int));
+			if (newVI)
+				points->vi = newVI;
+			newINVI = (int *)realloc(points->invi, allocated*sizeof(int));
+			if (newINVI)
+				points->invi = newINVI;
+			if (!newXYZ || !newVI || !newINVI) {
+				fclose(fileIN);
+				xarFreePointSet(points);
+				return NULL;
+			}
 		}
+		points->xyz[3*points->numPoints] = X;
+		points->xyz[3*points->numPoints+1] = Y;
+		points->xyz[3*points->numPoints+2] = Z;
+		points->vi[points->numPoints] = vi;
+		points->invi[points->numPoints] = invi;
+		points->numPoints++;
 	}
 	fclose(fileIN);
-	if (total_count != 0) {
-		message = xarAPosition(pol, start, end, XAR_UNIT_DEG, data);
-		if(atoi(message))
-			return atoi(message);
 
-		start=end;
-		total_count=0;
+	return points;
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   frees a point set that was returned by xarLoadPointSet.  An angle table that was compiled from it is fully recompiled
+   when it is next used with any other point set, because every point set that is loaded has its own generation number.
+
+  \param points		the point set to be freed
+*/
+void xarFreePointSet(xarPointSet *points)
+{
+	if (points == NULL)
+		return;
+	free(points->xyz);
+	free(points->vi);
+	free(points->invi);
+	free(points);
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   creates an empty angle table for use with xarCompileAngleTable.
+
+  \return the angle table, or NULL if it could not be allocated.  Free it with xarFreeAngleTable.
+*/
+xarAngleTable * xarNewAngleTable()
+{
+	xarAngleTable *table = (xarAngleTable *)malloc(sizeof(xarAngleTable));
+
+	if (table)
+		memset(table, 0, sizeof(xarAngleTable));
+	return table;
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   frees an angle table that was returned by xarNewAngleTable.
+
+  \param table		the angle table to be freed
+*/
+void xarFreeAngleTable(xarAngleTable *table)
+{
+	if (table == NULL)
+		return;
+	free(table->angles);
+	free(table->positions);
+	free(table->vi);
+	free(table->invi);
+	free(table->changed);
+	free(table);
+}
+
+/* combines the file to projection transform and the optional world matrix into a single 3x4 matrix.
+*/
+static void xarCombineTransforms(double matrix[12], double transform[4][4], vtkMatrix4x4 * worldMatrix)
+{
+	int i,j;
+
+	for (i = 0; i < 3; i++) {
+		for (j = 0; j < 4; j++) {
+			if (worldMatrix != NULL) {
+				matrix[4*i+j] = worldMatrix->GetElement(i,0)*transform[0][j] +
+								worldMatrix->GetElement(i,1)*transform[1][j] +
+								worldMatrix->GetElement(i,2)*transform[2][j] +
+								worldMatrix->GetElement(i,3)*(j == 3 ? 1.0 : 0.0);
+			}
+			else {
+				matrix[4*i+j] = transform[i][j];
+			}
+		}
 	}
+}
 
-	message = xarATimebptsA(pol, time, &actualDump);
+/* transforms every point in a point set by the matrix and computes the angles for the points that moved by more than
+   the threshold since their angles were last computed.  A negative threshold recomputes every point.  Returns the
+   number of points whose angles were computed, or -1 if the table could not be allocated.
+*/
+static int xarComputeAngles(xarAngleTable *table, const xarPointSet *points, double _OHAT[3], const double matrix[12], double threshold)
+{
+	double X,Y,Z,pos[3];
+	double dx,dy,dz;
+	int *vi, *invi;
+	char *changed;
+	const double *xyz;
+	double *angles, *positions;
+	int i, count = 0;
+
+	// a different point set or laser direction invalidates all of the angles
+	if (table->generation != points->generation || table->numPoints != points->numPoints ||
+		memcmp(table->OHAT, _OHAT, 3*sizeof(double)) != 0) {
+		threshold = -1;
+		if (table->numPoints != points->numPoints) {
+			// the table is marked as empty until all of its arrays have the new size
+			table->numPoints = 0;
+			table->generation = 0;
+			if (!(angles = (double *)realloc(table->angles, 2*(points->numPoints+1)*sizeof(double))))
+				return -1;
+			table->angles = angles;
+			if (!(positions = (double *)realloc(table->positions, 3*(points->numPoints+1)*sizeof(double))))
+				return -1;
+			table->positions = positions;
+			if (!(vi = (int *)realloc(table->vi, (points->numPoints+1)*sizeof(int))))
+				return -1;
+			table->vi = vi;
+			if (!(invi = (int *)realloc(table->invi, (points->numPoints+1)*sizeof(int))))
+				return -1;
+			table->invi = invi;
+			if (!(changed = (char *)realloc(table->changed, points->numPoints+1)))
+				return -1;
+			table->changed = changed;
+			table->numPoints = points->numPoints;
+		}
+		memcpy(table->vi, points->vi, points->numPoints*sizeof(int));
+		memcpy(table->invi, points->invi, points->numPoints*sizeof(int));
+	}
+
+	xyz = points->xyz;
+	angles = table->angles;
+	positions = table->positions;
+	for (i = 0; i < points->numPoints; i++) {
+		X = xyz[0]; 
+		Y = xyz[1]; 
+		Z = xyz[2];
+		pos[0] = X*matrix[0]+ Y*matrix[1]+ Z*matrix[2]+ matrix[3];
+		pos[1] = X*matrix[4]+ Y*matrix[5]+ Z*matrix[6]+ matrix[7];
+		pos[2] = X*matrix[8]+ Y*matrix[9]+ Z*matrix[10]+ matrix[11];
+		dx = pos[0] - positions[0];
+		dy = pos[1] - positions[1];
+		dz = pos[2] - positions[2];
+		if (threshold < 0 || dx*dx + dy*dy + dz*dz > threshold*threshold) {
+			xarPositionToAngle(pos[0], pos[1], pos[2], _OHAT, angles[0], angles[1]);
+			positions[0] = pos[0];
+			positions[1] = pos[1];
+			positions[2] = pos[2];
+			table->changed[i] = 1;
+			count++;
+		}
+		xyz += 3;
+		angles += 2;
+		positions += 3;
+	}
+
+	// if some of the angles were kept from an earlier matrix, then the table is not
+	// exactly up to date with this matrix and xarCompileAngleTable must not reuse it
+	table->generation = points->generation;
+	if (count == points->numPoints)
+		memcpy(table->matrix, matrix, 12*sizeof(double));
+	else
+		memset(table->matrix, 0, 12*sizeof(double));
+	memcpy(table->OHAT, _OHAT, 3*sizeof(double));
+
+	return count;
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   computes the X and Y angles for every point in a point set.  The transform and worldMatrix are combined into a single
+   matrix before the points are converted, and if the table was last compiled from the same point set with the same
+   matrix and OHAT then nothing is done.
+
+  \param table		the angle table that will hold the result
+  \param points		the point set to be projected
+  \param _OHAT		unit vector of the laser in the polaris space
+  \param transform  4x4 array containing the file (original) to projection (target) transformation.
+  \param worldMatrix optional transformation that is applied after transform
+
+  \return 1 if the angles were computed, 0 if the table was already up to date, or -1 if the table is too large
+  or could not be allocated.
+*/
+int xarCompileAngleTable(xarAngleTable *table, const xarPointSet *points, double _OHAT[3], double transform[4][4], vtkMatrix4x4 * worldMatrix)
+{
+	double matrix[12];
+
+	if (points->numPoints > XAR_AW_MAXPTS)
+		return -1;
+
+	xarCombineTransforms(matrix, transform, worldMatrix);
+
+	if (table->generation == points->generation && table->numPoints == points->numPoints &&
+		memcmp(table->matrix, matrix, sizeof(matrix)) == 0 &&
+		memcmp(table->OHAT, _OHAT, 3*sizeof(double)) == 0)
+		return 0;
+
+	if (xarComputeAngles(table, points, _OHAT, matrix, -1) < 0)
+		return -1;
+
+	return 1;
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   brings an angle table up to date with a new transform, like xarCompileAngleTable, except that the angles are only
+   recomputed for the points that have moved by more than the threshold since their angles were last computed.  The
+   table is compiled in full if it was last compiled from a different point set or OHAT.
+
+  \param table		the angle table that will hold the result
+  \param points		the point set to be projected
+  \param _OHAT		unit vector of the laser in the polaris space
+  \param transform  4x4 array containing the file (original) to projection (target) transformation.
+  \param worldMatrix optional transformation that is applied after transform
+  \param threshold	the distance (in polaris units) that a point can move before its angles are recomputed
+
+  \return the number of points whose angles were recomputed, or -1 if the table is too large or could not be
+  allocated.
+*/
+int xarRefreshAngleTable(xarAngleTable *table, const xarPointSet *points, double _OHAT[3], double transform[4][4], vtkMatrix4x4 * worldMatrix, double threshold)
+{
+	double matrix[12];
+
+	if (points->numPoints > XAR_AW_MAXPTS)
+		return -1;
+
+	xarCombineTransforms(matrix, transform, worldMatrix);
+
+	return xarComputeAngles(table, points, _OHAT, matrix, threshold);
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   creates a projection that follows a tracked tool.  The points are mapped into the polaris space by the registration
+   and then by the tool's transform, so the pattern stays attached to whatever the tool is attached to (e.g. the
+   patient reference).
+
+  \param points		the point set to be projected, in the coordinates of the registration
+  \param registration 4x4 array containing the point set to tool transformation
+  \param _OHAT		unit vector of the laser in the polaris space
+  \param threshold	the distance (in polaris units) that a point must move before the projection is updated
+
+  \return the tracked projection, or NULL if it could not be allocated.  Free it with xarFreeTrackedProjection.
+*/
+xarTrackedProjection * xarNewTrackedProjection(const xarPointSet *points, double registration[4][4], double _OHAT[3], double threshold)
+{
+	xarTrackedProjection *proj = (xarTrackedProjection *)malloc(sizeof(xarTrackedProjection));
+
+	if (proj == NULL)
+		return NULL;
+	memset(proj, 0, sizeof(xarTrackedProjection));
+	if (!(proj->table = xarNewAngleTable())) {
+		free(proj);
+		return NULL;
+	}
+	proj->points = points;
+	memcpy(proj->registration, registration, 16*sizeof(double));
+	memcpy(proj->OHAT, _OHAT, 3*sizeof(double));
+	proj->threshold = threshold;
+
+	return proj;
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   frees a tracked projection that was returned by xarNewTrackedProjection.  The projection is not stopped.
+
+  \param proj		the tracked projection to be freed
+*/
+void xarFreeTrackedProjection(xarTrackedProjection *proj)
+{
+	if (proj == NULL)
+		return;
+	xarFreeAngleTable(proj->table);
+	free(proj);
+}
+
+/* brings the angle table of a tracked projection up to date with a tool pose, the point set is mapped by the
+   registration and then by the tool matrix.  Returns the number of points whose angles were recomputed, or -1.
+*/
+static int xarRefreshTrackedProjection(xarTrackedProjection *proj, double toolMatrix[4][4], double threshold)
+{
+	double transform[4][4];
+	int i,j;
+
+	for (i = 0; i < 4; i++) {
+		for (j = 0; j < 4; j++) {
+			transform[i][j] = toolMatrix[i][0]*proj->registration[0][j] +
+							  toolMatrix[i][1]*proj->registration[1][j] +
+							  toolMatrix[i][2]*proj->registration[2][j] +
+							  toolMatrix[i][3]*proj->registration[3][j];
+		}
+	}
+
+	return xarRefreshAngleTable(proj->table, proj->points, proj->OHAT, transform, NULL, threshold);
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   starts projecting a tracked projection at the given tool pose.  The waveform is repeated indefinitely, and
+   xarUpdateTrackedProjection must be called after each tracker update to make it follow the tool.
+
+  \param pol		a pointer to a polaris structure
+  \param proj		the tracked projection
+  \param toolMatrix 4x4 array containing the tool to polaris transformation
+  \param timeStamp	the time stamp of the tool pose
+  \param time		xarATimebpts() time value
+
+  \return integer error code, XAR_OKAY if the projection was started.
+*/
+int xarStartTrackedProjection(polaris *pol, xarTrackedProjection *proj, double toolMatrix[4][4], double timeStamp, double time)
+{
+	int errnum;
+
+	if (xarRefreshTrackedProjection(proj, toolMatrix, -1) < 0)
+		return XAR_FILEERROR;
+
+	proj->timeStamp = timeStamp;
+	errnum = xarALaserProjectTable(pol, proj->table, time, XAR_REPEAT_MAX);
+	proj->running = (errnum == XAR_OKAY);
+
+	return errnum;
+}
+
+/*! \ingroup XarTraXarbitrarywaveform
+   brings a running tracked projection up to date with the tool's latest pose.  Nothing is sent if the pose has the
+   same time stamp as the last one, if the tool status is not zero, or if no point has moved by more than the
+   threshold, otherwise only the angles of the points that moved are recomputed and sent.
+
+   For a vtkTrackerTool, the tool matrix is the tool's GetTransform()->GetMatrix(), the status is nonzero if
+   IsMissing() or IsOutOfView(), and the time stamp is GetTimeStamp().  vtkXarTraXProjection in Tracking observes a
+   tool and calls this function whenever the tool is updated.
+
+   The new table is loaded with _aposition while the controller continues to draw the previous one from its display
+   buffers, which are only replaced by the xarReadPosTable transfers at the end, so the pattern does not blank while
+   it is being updated.
+
+  \param pol		a pointer to a polaris structure
+  \param proj		the tracked projection
+  \param toolMatrix 4x4 array containing the tool to polaris transformation
+  \param toolStatus	zero if the pose is valid, nonzero if the tool is missing or out of view
+  \param timeStamp	the time stamp of the tool pose
+
+  \return integer error code, XAR_OKAY if the projection is up to date.
+*/
+int xarUpdateTrackedProjection(polaris *pol, xarTrackedProjection *proj, double toolMatrix[4][4], int toolStatus, double timeStamp)
+{
+	int tableSize;
+	int count;
+	char * message;
+
+	if (!proj->running || toolStatus != 0 || timeStamp == proj->timeStamp)
+		return XAR_OKAY;
+	proj->timeStamp = timeStamp;
+
+	count = xarRefreshTrackedProjection(proj, toolMatrix, proj->threshold);
+	if (count < 0)
+		return XAR_FILEERROR;
+	if (count == 0)
+		return XAR_OKAY;
+
+	message = xarAUploadChangedAngles(pol, proj->table, 0);
 	if(atoi(message))
 		return atoi(message);
-	message = xarAComplete(pol);												 // acknowledge the system
+	message = xarAComplete(pol);
 	if(atoi(message))
 		return atoi(message);
 	message = xarSizePosTable(pol, &tableSize);
@@ -1536,10 +2042,7 @@ int xarALaserProjectXYZ(polaris *pol, char *filename, double time, unsigned repe
 	message = xarReadPosTable(pol, XAR_CHANNEL_Y, XAR_UNIT_DEG);
 	if(atoi(message))
 		return atoi(message);
-	message = xarExecute(pol);
-	if(atoi(message))
-		return atoi(message);
-	// mirror command session ends here 
+
 	return XAR_OKAY;
 }
 
@@ -2236,26 +2739,35 @@ bool getNextPoint(double *x, double *y, MaxMinValue *mmv, double maxAngle, FILE
 */
 void xarAPositionBuildCommand(int &count, char data[], double x, double y, int vi, int invi)
 {
-	int j=0;
-	char temp[100];
-	
-	strcpy(data,",");
-	ftoa(x,temp);
-	j+=strlen(temp)+1;
-	strcat(data,temp);
-	strcat(data,",");
-	ftoa(y,temp);
-	j+=strlen(temp)+1;
-	strcat(data,temp);
-	strcat(data,",");
-	_itoa(vi,temp,10);
-	j+=strlen(temp)+1;
-	strcat(data,temp);
-	strcat(data,",");
-	_itoa(invi,temp,10);
-	j+=strlen(temp)+1;
-	strcat(data,temp);
-	count=j;
+	count = xarAPositionFormat(data, x, y, vi, invi);
+}
+
+/*! \ingroup XarTraXExtra
+   writes the char array represetion of a data point for an Arbitrary wave format, in the same format as
+   xarAPositionBuildCommand, but returns the number of characters written so that points can be appended
+   to a command without searching for the end of the string.
+
+  \param data		where the data point is to be written (it is null-terminated)
+  \param x			the x position of the point
+  \param y			the y position of the point
+  \param vi			visible laser state, XAR_LASER_ON or XAR_LASER_OFF
+  \param invi		infrared laser state, XAR_LASER_ON or XAR_LASER_OFF
+
+  \return the number of characters written, not including the null.
+*/
+int xarAPositionFormat(char *data, double x, double y, int vi, int invi)
+{
+	char *cp = data;
+
+	*cp++ = ',';
+	ftoa(x,cp);
+	cp += strlen(cp);
+	*cp++ = ',';
+	ftoa(y,cp);
+	cp += strlen(cp);
+	cp += sprintf(cp, ",%d,%d", vi, invi);
+
+	return (int)(cp - data);
 }
 
 /*! \ingroup XarTraXExtra
@@ -72,6 +72,42 @@ typedef struct{
 	int inv;
 } APosData2;
 
+/* A point set read from an X Y Z visible infra file, kept in memory so
+   that it can be re-projected without touching the file again */
+typedef struct{
+	int numPoints;
+	double *xyz;				// numPoints*3 positions
+	int *vi;
+	int *invi;
+	unsigned long generation;	// different for every point set that is loaded
+} xarPointSet;
+
+/* The angles for a point set under one transform, along with the key that
+   they were computed for so that an unchanged projection is not redone */
+typedef struct{
+	int numPoints;
+	double *angles;				// numPoints*2 angles, in degrees
+	double *positions;			// numPoints*3 polaris positions the angles were computed for
+	int *vi;
+	int *invi;
+	char *changed;				// nonzero for each point whose angles have not been uploaded
+	unsigned long generation;	// of the point set the angles were computed for
+	double matrix[12];			// the file to polaris transform, 3x4
+	double OHAT[3];
+} xarAngleTable;
+
+/* A projection that follows a tracked tool, see xarUpdateTrackedProjection.  The tool pose is
+   passed in by the caller, so this library does not depend on any particular tracker */
+typedef struct{
+	const xarPointSet *points;
+	double registration[4][4];	// point set to tool transform
+	double OHAT[3];
+	double threshold;			// how far a point can move before it is updated
+	xarAngleTable *table;
+	double timeStamp;			// tool timestamp of the last pose that was used
+	int running;
+} xarTrackedProjection;
+
 //------------------------------------------------------
 /* Used to define which channel is being addressed */
 /*\{*/
@@ -226,6 +262,8 @@ typedef struct{
 #define XAR_RS_MAXPTS			30000		// Maximum number of points in Raster
 #define XAR_FG_MAXPTS			30000		// Maximum number of points in function generator table
 #define XAR_AW_MAXPTS			50000
+#define XAR_AW_MAXDATA			1000		// Maximum characters of data in one _aposition command
+#define XAR_AW_MERGEGAP			8			// Unchanged points that are resent instead of starting a new _aposition command
 #define XAR_REPEAT_MAX			0xFFFFFFFF	// Maximum possible number of repeats
 /*\}*/
 
@@ -365,6 +403,11 @@ typedef struct{
  int	xarALaserProject(polaris *pol, char *filename, double time, unsigned repeats, double maxAngle);
  int	xarALaserProjectDeg(polaris *pol, char *filename, double time, unsigned repeats);
  int	xarALaserProjectXYZ(polaris *pol, char *filename, double time, unsigned repeats, double _OHAT[3], double transform[4][4], vtkMatrix4x4 * worldMatrix = NULL);
+ int	xarALaserProjectTable(polaris *pol, xarAngleTable *table, double time, unsigned repeats);
+ char * xarAUploadAngleTable(polaris *pol, xarAngleTable *table, int offset = 0);
+ char * xarAUploadChangedAngles(polaris *pol, xarAngleTable *table, int offset = 0);
+ int	xarStartTrackedProjection(polaris *pol, xarTrackedProjection *proj, double toolMatrix[4][4], double timeStamp, double time);
+ int	xarUpdateTrackedProjection(polaris *pol, xarTrackedProjection *proj, double toolMatrix[4][4], int toolStatus, double timeStamp);
 
 
 /*=====================================================================*/
@@ -393,6 +436,15 @@ typedef struct{
  int	xarLoadFile(char *Filename,	MaxMinValue *mmv, unsigned &TotalPoints, bool Loaded = false);
  bool	getNextPoint(double *x,	double *y, MaxMinValue *mmv, double maxAngle, FILE *file);
  void	xarAPositionBuildCommand(int &count, char data[], double x, double y, int vi, int invi);
+ int	xarAPositionFormat(char *data, double x, double y, int vi, int invi);
+ xarPointSet *	xarLoadPointSet(const char *filename);
+ void	xarFreePointSet(xarPointSet *points);
+ xarAngleTable * xarNewAngleTable();
+ void	xarFreeAngleTable(xarAngleTable *table);
+ int	xarCompileAngleTable(xarAngleTable *table, const xarPointSet *points, double _OHAT[3], double transform[4][4], vtkMatrix4x4 * worldMatrix = NULL);
+ int	xarRefreshAngleTable(xarAngleTable *table, const xarPointSet *points, double _OHAT[3], double transform[4][4], vtkMatrix4x4 * worldMatrix, double threshold);
+ xarTrackedProjection * xarNewTrackedProjection(const xarPointSet *points, double registration[4][4], double _OHAT[3], double threshold);
+ void	xarFreeTrackedProjection(xarTrackedProjection *proj);
  char * xarUploadDataTOSBC(	polaris *pol, int selectUnits, double xPositionTable[], double yPositionTable[], int sizeofPositionTable);
  char * xarReadFromPolaris(polaris *pol, double trans[4]);
  void	xarFindOHAT(polaris * pol, double _OHAT[3]);